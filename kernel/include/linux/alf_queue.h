@@ -19,16 +19,40 @@
  */
 #include <linux/compiler.h>
 #include <linux/kernel.h>
+#include <linux/wait.h>
 
 struct alf_actor {
 	u32 head;
 	u32 tail;
+	u32 cached; /* Shadow of other side's tail, see *_cached() */
 };
 
+/* Optional contention instrumentation, compiled out unless the
+ * ALF_QUEUE_STATS define is set (CONFIG_ALF_QUEUE_STATS=y).  Per CPU
+ * counters, summed up in /sys/kernel/debug/alf_queue/<name>/stats
+ * after alf_queue_stats_register().
+ */
+#define ALF_STATS_BULK_BUCKETS 8 /* log2 buckets: 1,2-3,4-7,..,>=128 */
+
+struct alf_queue_stats {
+	u64 enq_retry;		/* cmpxchg retries on producer.head */
+	u64 deq_retry;		/* cmpxchg retries on consumer.head */
+	u64 enq_full;		/* enqueue rejected, not enough space */
+	u64 deq_empty;		/* dequeue on empty queue */
+	u64 enq_bulk[ALF_STATS_BULK_BUCKETS]; /* enqueued elems per call */
+	u64 deq_bulk[ALF_STATS_BULK_BUCKETS]; /* dequeued elems per call */
+};
+
+struct dentry;
+
 struct alf_queue {
 	u32 size;
 	u32 mask;
 	u32 flags;
+#ifdef ALF_QUEUE_STATS
+	struct alf_queue_stats __percpu *stats;
+	struct dentry *stats_dentry;
+#endif
 	struct alf_actor producer ____cacheline_aligned_in_smp;
 	struct alf_actor consumer ____cacheline_aligned_in_smp;
 	void *ring[0] ____cacheline_aligned_in_smp;
@@ -37,52 +61,100 @@ struct alf_queue {
 struct alf_queue *alf_queue_alloc(u32 size, gfp_t gfp);
 void		  alf_queue_free(struct alf_queue *q);
 
+#ifdef ALF_QUEUE_STATS
+#include <linux/percpu.h>
+#include <linux/log2.h>
+int  alf_queue_stats_register(struct alf_queue *q, const char *name);
+
+#define alf_stat_inc(q, field)	this_cpu_inc((q)->stats->field)
+#define alf_stat_bulk(q, dir, n)					\
+	this_cpu_inc((q)->stats->dir##_bulk[min_t(u32, ilog2(n),	\
+					ALF_STATS_BULK_BUCKETS - 1)])
+#else
+static inline int
+alf_queue_stats_register(struct alf_queue *q, const char *name)
+{
+	return 0;
+}
+#define alf_stat_inc(q, field)		do { } while (0)
+#define alf_stat_bulk(q, dir, n)	do { } while (0)
+#endif
+
 /* Helpers for LOAD and STORE of elements, have been split-out because:
  *  1. They can be reused for both "Single" and "Multi" variants
  *  2. Allow us to experiment with (pipeline) optimizations in this area.
  */
 /* Only a single of these helpers will survive upstream submission */
 #include <linux/alf_queue_helpers.h>
+#ifndef ALF_QUEUE_AUTO_HELPER
 #define __helper_alf_enqueue_store __helper_alf_enqueue_store_unroll
 #define __helper_alf_dequeue_load  __helper_alf_dequeue_load_unroll
+#else
+/* Helper selected at load time by a self-calibration in
+ * lib/alf_queue.c, can be overridden via debugfs file
+ * /sys/kernel/debug/alf_queue/helper.  This trades the inlined
+ * helper for a direct call, patched via static_call.
+ */
+#include <linux/static_call.h>
+DECLARE_STATIC_CALL(alf_enqueue_store, __helper_alf_enqueue_store_unroll);
+DECLARE_STATIC_CALL(alf_dequeue_load,  __helper_alf_dequeue_load_unroll);
+#define __helper_alf_enqueue_store(p_head, q, ptr, n) \
+	static_call(alf_enqueue_store)(p_head, q, ptr, n)
+#define __helper_alf_dequeue_load(c_head, q, ptr, elems) \
+	static_call(alf_dequeue_load)(c_head, q, ptr, elems)
+#endif
+
+enum alf_queue_behavior {
+	ALF_QUEUE_FIXED = 0, /* Enq/Deq a fixed number of items from queue */
+	ALF_QUEUE_VARIABLE   /* Enq/Deq as many items as possible */
+};
 
 /* Main Multi-Producer ENQUEUE
  *
- * Even-though current API have a "fixed" semantics of aborting if it
- * cannot enqueue the full bulk size.  Users of this API should check
- * on the returned number of enqueue elements match, to verify enqueue
- * was successful.  This allow us to introduce a "variable" enqueue
- * scheme later.
+ * The alf_mp_enqueue() API have "fixed" semantics of aborting if it
+ * cannot enqueue the full bulk size, while alf_mp_enqueue_burst()
+ * enqueue as many elements as there is space for.  Users of both
+ * should check the returned number of enqueued elements.
  *
  * Not preemption safe. Multiple CPUs can enqueue elements, but the
  * same CPU is not allowed to be preempted and access the same
  * queue. Due to how the tail is updated, this can result in a soft
- * lock-up. (Same goes for alf_mc_dequeue).
+ * lock-up. (Same goes for alf_mc_dequeue).  See linux/alf_queue_seq.h
+ * for a variant callable from preemptible context.
  */
-static inline int
-alf_mp_enqueue(const u32 n;
-	       struct alf_queue *q, void *ptr[n], const u32 n)
+static __always_inline int
+__alf_mp_do_enqueue(const u32 n;
+		    struct alf_queue *q, void *ptr[n], const u32 n,
+		    enum alf_queue_behavior behavior)
 {
-	u32 p_head, p_next, c_tail, space;
+	u32 p_head, p_next, c_tail, space, cnt;
 
 	/* Reserve part of the array for enqueue STORE/WRITE */
-	do {
+	for (;;) {
 		p_head = READ_ONCE(q->producer.head);
 		c_tail = READ_ONCE(q->consumer.tail);/* as smp_load_aquire */
 
 		space = q->size + c_tail - p_head;
-		if (n > space)
-			return 0;
-
-		p_next = p_head + n;
+		cnt = n;
+		if (unlikely(cnt > space)) {
+			if (behavior == ALF_QUEUE_FIXED || space == 0) {
+				alf_stat_inc(q, enq_full);
+				return 0;
+			}
+			cnt = space;
+		}
+
+		p_next = p_head + cnt;
+		if (likely(cmpxchg(&q->producer.head, p_head, p_next) == p_head))
+			break;
+		alf_stat_inc(q, enq_retry);
 	}
-	while (unlikely(cmpxchg(&q->producer.head, p_head, p_next) != p_head));
 	/* The memory barrier of smp_load_acquire(&q->consumer.tail)
 	 * is satisfied by cmpxchg implicit full memory barrier
 	 */
 
 	/* STORE the elems into the queue array */
-	__helper_alf_enqueue_store(p_head, q, ptr, n);
+	__helper_alf_enqueue_store(p_head, q, ptr, cnt);
 	smp_wmb(); /* Write-Memory-Barrier matching dequeue LOADs */
 
 	/* Wait for other concurrent preceding enqueues not yet done,
@@ -93,32 +165,42 @@ alf_mp_enqueue(const u32 n;
 		cpu_relax();
 	/* Mark this enq done and avail for consumption */
 	WRITE_ONCE(q->producer.tail, p_next);
+	alf_stat_bulk(q, enq, cnt);
 
-	return n;
+	return cnt;
 }
 
-/* Main Multi-Consumer DEQUEUE */
-static inline int
-alf_mc_dequeue(const u32 n;
-	       struct alf_queue *q, void *ptr[n], const u32 n)
+/* Main Multi-Consumer DEQUEUE
+ *
+ * Dequeue have always had "variable" semantics, returning as many
+ * elements as available up to n.  ALF_QUEUE_FIXED is provided for
+ * symmetry with enqueue.
+ */
+static __always_inline int
+__alf_mc_do_dequeue(const u32 n;
+		    struct alf_queue *q, void *ptr[n], const u32 n,
+		    enum alf_queue_behavior behavior)
 {
 	u32 c_head, c_next, p_tail, elems;
 
 	/* Reserve part of the array for dequeue LOAD/READ */
-	do {
+	for (;;) {
 		c_head = READ_ONCE(q->consumer.head);
 		p_tail = READ_ONCE(q->producer.tail);
 
 		elems = p_tail - c_head;
 
-		if (elems == 0)
+		if (elems == 0 || (behavior == ALF_QUEUE_FIXED && elems < n)) {
+			alf_stat_inc(q, deq_empty);
 			return 0;
-		else
-			elems = min(elems, n);
+		}
+		elems = min(elems, n);
 
 		c_next = c_head + elems;
+		if (likely(cmpxchg(&q->consumer.head, c_head, c_next) == c_head))
+			break;
+		alf_stat_inc(q, deq_retry);
 	}
-	while (unlikely(cmpxchg(&q->consumer.head, c_head, c_next) != c_head));
 
 	/* LOAD the elems from the queue array.
 	 *   We don't need a smb_rmb() Read-Memory-Barrier here because
@@ -136,10 +218,40 @@ alf_mc_dequeue(const u32 n;
 	 * must happen after the dequeue LOADs.  Paired with enqueue
 	 * implicit full-MB in cmpxchg.
 	 */
+	alf_stat_bulk(q, deq, elems);
 
 	return elems;
 }
 
+static inline int
+alf_mp_enqueue(const u32 n;
+	       struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_mp_do_enqueue(q, ptr, n, ALF_QUEUE_FIXED);
+}
+
+static inline int
+alf_mp_enqueue_burst(const u32 n;
+		     struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_mp_do_enqueue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+static inline int
+alf_mc_dequeue(const u32 n;
+	       struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_mc_do_dequeue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+/* Same semantics as alf_mc_dequeue(), named for symmetry */
+static inline int
+alf_mc_dequeue_burst(const u32 n;
+		     struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_mc_do_dequeue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
 /* #define ASSERT_DEBUG_SPSC 1 */
 #ifndef ASSERT_DEBUG_SPSC
 #define ASSERT(x) do { } while (0)
@@ -157,11 +269,12 @@ alf_mc_dequeue(const u32 n;
 /* Main SINGLE Producer ENQUEUE
  *  caller MUST make sure preemption is disabled
  */
-static inline int
-alf_sp_enqueue(const u32 n;
-	       struct alf_queue *q, void *ptr[n], const u32 n)
+static __always_inline int
+__alf_sp_do_enqueue(const u32 n;
+		    struct alf_queue *q, void *ptr[n], const u32 n,
+		    enum alf_queue_behavior behavior)
 {
-	u32 p_head, p_next, c_tail, space;
+	u32 p_head, p_next, c_tail, space, cnt;
 
 	/* Reserve part of the array for enqueue STORE/WRITE */
 	p_head = q->producer.head;
@@ -169,15 +282,21 @@ alf_sp_enqueue(const u32 n;
 	c_tail = READ_ONCE(q->consumer.tail);
 
 	space = q->size + c_tail - p_head;
-	if (n > space)
-		return 0;
+	cnt = n;
+	if (unlikely(cnt > space)) {
+		if (behavior == ALF_QUEUE_FIXED || space == 0) {
+			alf_stat_inc(q, enq_full);
+			return 0;
+		}
+		cnt = space;
+	}
 
-	p_next = p_head + n;
+	p_next = p_head + cnt;
 	ASSERT(READ_ONCE(q->producer.head) == p_head);
 	q->producer.head = p_next;
 
 	/* STORE the elems into the queue array */
-	__helper_alf_enqueue_store(p_head, q, ptr, n);
+	__helper_alf_enqueue_store(p_head, q, ptr, cnt);
 	smp_wmb(); /* Write-Memory-Barrier matching dequeue LOADs */
 
 	/* Assert no other CPU (or same CPU via preemption) changed queue */
@@ -185,16 +304,18 @@ alf_sp_enqueue(const u32 n;
 
 	/* Mark this enq done and avail for consumption */
 	WRITE_ONCE(q->producer.tail, p_next);
+	alf_stat_bulk(q, enq, cnt);
 
-	return n;
+	return cnt;
 }
 
 /* Main SINGLE Consumer DEQUEUE
  *  caller MUST make sure preemption is disabled
  */
-static inline int
-alf_sc_dequeue(const u32 n;
-	       struct alf_queue *q, void *ptr[n], const u32 n)
+static __always_inline int
+__alf_sc_do_dequeue(const u32 n;
+		    struct alf_queue *q, void *ptr[n], const u32 n,
+		    enum alf_queue_behavior behavior)
 {
 	u32 c_head, c_next, p_tail, elems;
 
@@ -204,10 +325,11 @@ alf_sc_dequeue(const u32 n;
 
 	elems = p_tail - c_head;
 
-	if (elems == 0)
+	if (elems == 0 || (behavior == ALF_QUEUE_FIXED && elems < n)) {
+		alf_stat_inc(q, deq_empty);
 		return 0;
-	else
-		elems = min(elems, n);
+	}
+	elems = min(elems, n);
 
 	c_next = c_head + elems;
 	ASSERT(READ_ONCE(q->consumer.head) == c_head);
@@ -228,6 +350,150 @@ alf_sc_dequeue(const u32 n;
 
 	/* Mark this deq done and avail for producers */
 	WRITE_ONCE(q->consumer.tail, c_next);
+	alf_stat_bulk(q, deq, elems);
+
+	return elems;
+}
+
+static inline int
+alf_sp_enqueue(const u32 n;
+	       struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_sp_do_enqueue(q, ptr, n, ALF_QUEUE_FIXED);
+}
+
+static inline int
+alf_sp_enqueue_burst(const u32 n;
+		     struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_sp_do_enqueue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+static inline int
+alf_sc_dequeue(const u32 n;
+	       struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_sc_do_dequeue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+/* Same semantics as alf_sc_dequeue(), named for symmetry */
+static inline int
+alf_sc_dequeue_burst(const u32 n;
+		     struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_sc_do_dequeue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+/* SINGLE Producer/Consumer with cached indices
+ *
+ * The plain SP/SC variants read the other side's tail on every call,
+ * thus the producer and consumer cache-lines bounce between CPUs
+ * even when there is plenty of space/elements.  These variants keep
+ * a shadow copy of the other side's tail, in their own cache-line,
+ * and only refresh it when the queue appears to be full/empty (for
+ * the requested n), like ptr_ring only touching the other side on
+ * full/empty.
+ *
+ * A stale shadow is always a lower bound of space/elements, as the
+ * tails only move forward.  When the same side also uses the plain
+ * variants its head can move past what the shadow allows, and the
+ * u32 space/elements underflows, thus the refresh check is done with
+ * signed (wrap-safe) math.  Thus, it is safe to mix these with the
+ * plain SP/SC/MC/MP variants on the same queue, although the shadow
+ * only pays off when the same side consistently uses them.
+ *
+ * Same rules as alf_sp_enqueue/alf_sc_dequeue, caller MUST make sure
+ * preemption is disabled.
+ */
+static __always_inline int
+__alf_sp_do_enqueue_cached(const u32 n;
+			   struct alf_queue *q, void *ptr[n], const u32 n,
+			   enum alf_queue_behavior behavior)
+{
+	u32 p_head, p_next, space, cnt;
+
+	p_head = q->producer.head;
+	space = q->size + q->producer.cached - p_head;
+	if (unlikely((s32)space < (s32)n)) {
+		/* Appears full, refresh shadow of consumer.tail */
+		smp_rmb(); /* for consumer.tail write, making sure deq loads are done */
+		q->producer.cached = READ_ONCE(q->consumer.tail);
+		space = q->size + q->producer.cached - p_head;
+	}
+	cnt = n;
+	if (unlikely(cnt > space)) {
+		if (behavior == ALF_QUEUE_FIXED || space == 0) {
+			alf_stat_inc(q, enq_full);
+			return 0;
+		}
+		cnt = space;
+	}
+
+	p_next = p_head + cnt;
+	ASSERT(READ_ONCE(q->producer.head) == p_head);
+	q->producer.head = p_next;
+
+	/* STORE the elems into the queue array */
+	__helper_alf_enqueue_store(p_head, q, ptr, cnt);
+	smp_wmb(); /* Write-Memory-Barrier matching dequeue LOADs */
+
+	ASSERT(READ_ONCE(q->producer.tail) == p_head);
+	/* Mark this enq done and avail for consumption */
+	WRITE_ONCE(q->producer.tail, p_next);
+	alf_stat_bulk(q, enq, cnt);
+
+	return cnt;
+}
+
+static inline int
+alf_sp_enqueue_cached(const u32 n;
+		      struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_sp_do_enqueue_cached(q, ptr, n, ALF_QUEUE_FIXED);
+}
+
+static inline int
+alf_sp_enqueue_cached_burst(const u32 n;
+			    struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	return __alf_sp_do_enqueue_cached(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+static inline int
+alf_sc_dequeue_cached(const u32 n;
+		      struct alf_queue *q, void *ptr[n], const u32 n)
+{
+	u32 c_head, c_next, elems;
+
+	c_head = q->consumer.head;
+	elems = q->consumer.cached - c_head;
+	if ((s32)elems < (s32)n) {
+		/* Appears (too) empty, refresh shadow of producer.tail */
+		q->consumer.cached = READ_ONCE(q->producer.tail);
+		elems = q->consumer.cached - c_head;
+		if (elems == 0) {
+			alf_stat_inc(q, deq_empty);
+			return 0;
+		}
+	}
+	elems = min(elems, n);
+
+	c_next = c_head + elems;
+	ASSERT(READ_ONCE(q->consumer.head) == c_head);
+	q->consumer.head = c_next;
+
+	smp_rmb(); /* Read-Memory-Barrier matching enq STOREs */
+	__helper_alf_dequeue_load(c_head, q, ptr, elems);
+
+	/* Dequeue LOADs must be done before STORE to consumer.tail,
+	 * see alf_sc_dequeue()
+	 */
+	smp_wmb();
+
+	ASSERT(READ_ONCE(q->consumer.tail) == c_head);
+	/* Mark this deq done and avail for producers */
+	WRITE_ONCE(q->consumer.tail, c_next);
+	alf_stat_bulk(q, deq, elems);
 
 	return elems;
 }
@@ -285,4 +551,239 @@ alf_queue_avail_space(struct alf_queue *q)
 	return space;
 }
 
+/* Optional blocking consumer support
+ *
+ * Consumers normally busy-poll the queue.  A consumer can instead
+ * call alf_queue_wait(), which spins for spin_loops polls and then
+ * sleeps until a producer calls alf_queue_notify() after enqueue.
+ *
+ * Wakeup batching: the consumer only sets "waiting" after it found
+ * the queue empty, and the first producer to see it clears the flag
+ * (xchg) and issues the single wake_up.  Thus, only empty->non-empty
+ * transitions signal.  When the queue is busy, a producer pays a
+ * full barrier and a read of a cache-line, which stays shared since
+ * nobody writes it.
+ *
+ * Pairing: consumer writes waiting, MB (in prepare_to_wait), reads
+ * producer.tail.  Producer writes producer.tail, MB, reads waiting.
+ */
+struct alf_queue_notify {
+	wait_queue_head_t wait;
+	unsigned int spin_loops;
+	int waiting ____cacheline_aligned_in_smp;
+};
+
+static inline void
+alf_queue_notify_init(struct alf_queue_notify *nt, unsigned int spin_loops)
+{
+	init_waitqueue_head(&nt->wait);
+	nt->spin_loops = spin_loops;
+	nt->waiting = 0;
+}
+
+/* Producer side, call after a successful enqueue */
+static inline void
+alf_queue_notify(struct alf_queue_notify *nt)
+{
+	smp_mb(); /* producer.tail store before reading waiting */
+	if (unlikely(READ_ONCE(nt->waiting)) && xchg(&nt->waiting, 0))
+		wake_up(&nt->wait);
+}
+
+/* Consumer side, wait for the queue to become non-empty.
+ *
+ * Returns like wait_event_interruptible_timeout(): zero on timeout,
+ * -ERESTARTSYS on signal, otherwise remaining jiffies (at least 1).
+ * Must be called from sleepable context.
+ */
+static inline long
+alf_queue_wait(struct alf_queue *q, struct alf_queue_notify *nt,
+	       long timeout)
+{
+	unsigned int spin;
+	long ret;
+
+	for (spin = 0; spin < nt->spin_loops; spin++) {
+		if (alf_queue_count(q))
+			return timeout ? timeout : 1;
+		cpu_relax();
+	}
+	WRITE_ONCE(nt->waiting, 1);
+	ret = wait_event_interruptible_timeout(nt->wait,
+					       alf_queue_count(q) != 0,
+					       timeout);
+	WRITE_ONCE(nt->waiting, 0);
+	return ret;
+}
+
+/* Blocking variant of alf_sc_dequeue(), same preemption rules apply
+ * to the dequeue itself, thus the caller must be the only consumer.
+ * Returns number of dequeued elements, or zero on timeout/signal.
+ */
+static inline int
+alf_sc_dequeue_wait(const u32 n;
+		    struct alf_queue *q, struct alf_queue_notify *nt,
+		    void *ptr[n], const u32 n, long timeout)
+{
+	int cnt;
+
+	do {
+		cnt = alf_sc_dequeue(q, ptr, n);
+		if (cnt)
+			return cnt;
+		timeout = alf_queue_wait(q, nt, timeout);
+	} while (timeout > 0);
+
+	return 0;
+}
+
+/* Statically sized queue, embedded in a user struct
+ *
+ * DEFINE_ALF_QUEUE(name, size) declares "struct name" with the ring
+ * array embedded, plus name_{init,sp_enqueue,sc_dequeue,mp_enqueue,
+ * mc_dequeue,count}() operations, where size and mask are compile
+ * time constants.  This avoid loading q->size/q->mask on every op,
+ * and allow the compiler to fully unroll for constant bulk sizes.
+ *
+ * Same semantics (fixed enqueue, variable dequeue) and same
+ * preemption rules as the dynamic alf_queue variants.
+ */
+static __always_inline void
+__alf_static_store(void **ring, const u32 size, u32 head,
+		   void **ptr, const u32 n)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++)
+		ring[(head + i) & (size - 1)] = ptr[i];
+}
+
+static __always_inline void
+__alf_static_load(void **ring, const u32 size, u32 head,
+		  void **ptr, const u32 n)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++)
+		ptr[i] = ring[(head + i) & (size - 1)];
+}
+
+static __always_inline int
+__alf_static_sp_enqueue(struct alf_actor *p, struct alf_actor *c,
+			void **ring, const u32 size, void **ptr, const u32 n)
+{
+	u32 p_head = p->head;
+
+	smp_rmb(); /* for consumer.tail write, making sure deq loads are done */
+	if (n > size + READ_ONCE(c->tail) - p_head)
+		return 0;
+	p->head = p_head + n;
+	__alf_static_store(ring, size, p_head, ptr, n);
+	smp_wmb(); /* Write-Memory-Barrier matching dequeue LOADs */
+	WRITE_ONCE(p->tail, p_head + n);
+	return n;
+}
+
+static __always_inline int
+__alf_static_sc_dequeue(struct alf_actor *p, struct alf_actor *c,
+			void **ring, const u32 size, void **ptr, const u32 n)
+{
+	u32 c_head = c->head;
+	u32 elems = READ_ONCE(p->tail) - c_head;
+
+	if (elems == 0)
+		return 0;
+	elems = min(elems, n);
+	c->head = c_head + elems;
+	smp_rmb(); /* Read-Memory-Barrier matching enq STOREs */
+	__alf_static_load(ring, size, c_head, ptr, elems);
+	smp_wmb(); /* dequeue LOADs before STORE to consumer.tail */
+	WRITE_ONCE(c->tail, c_head + elems);
+	return elems;
+}
+
+static __always_inline int
+__alf_static_mp_enqueue(struct alf_actor *p, struct alf_actor *c,
+			void **ring, const u32 size, void **ptr, const u32 n)
+{
+	u32 p_head, p_next;
+
+	do {
+		p_head = READ_ONCE(p->head);
+		if (n > size + READ_ONCE(c->tail) - p_head)
+			return 0;
+		p_next = p_head + n;
+	} while (unlikely(cmpxchg(&p->head, p_head, p_next) != p_head));
+
+	__alf_static_store(ring, size, p_head, ptr, n);
+	smp_wmb(); /* Write-Memory-Barrier matching dequeue LOADs */
+	while (unlikely(READ_ONCE(p->tail) != p_head))
+		cpu_relax();
+	WRITE_ONCE(p->tail, p_next);
+	return n;
+}
+
+static __always_inline int
+__alf_static_mc_dequeue(struct alf_actor *p, struct alf_actor *c,
+			void **ring, const u32 size, void **ptr, const u32 n)
+{
+	u32 c_head, c_next, elems;
+
+	do {
+		c_head = READ_ONCE(c->head);
+		elems = READ_ONCE(p->tail) - c_head;
+		if (elems == 0)
+			return 0;
+		elems = min(elems, n);
+		c_next = c_head + elems;
+	} while (unlikely(cmpxchg(&c->head, c_head, c_next) != c_head));
+
+	__alf_static_load(ring, size, c_head, ptr, elems);
+	while (unlikely(READ_ONCE(c->tail) != c_head))
+		cpu_relax();
+	smp_store_release(&c->tail, c_next);
+	return elems;
+}
+
+#define DEFINE_ALF_QUEUE(name, SIZE)					\
+struct name {								\
+	struct alf_actor producer ____cacheline_aligned_in_smp;		\
+	struct alf_actor consumer ____cacheline_aligned_in_smp;		\
+	void *ring[SIZE] ____cacheline_aligned_in_smp;			\
+};									\
+static inline void name##_init(struct name *q)				\
+{									\
+	BUILD_BUG_ON_NOT_POWER_OF_2(SIZE);				\
+	memset(&q->producer, 0, sizeof(q->producer));			\
+	memset(&q->consumer, 0, sizeof(q->consumer));			\
+}									\
+static __always_inline int						\
+name##_sp_enqueue(struct name *q, void **ptr, const u32 n)		\
+{									\
+	return __alf_static_sp_enqueue(&q->producer, &q->consumer,	\
+				       q->ring, SIZE, ptr, n);		\
+}									\
+static __always_inline int						\
+name##_sc_dequeue(struct name *q, void **ptr, const u32 n)		\
+{									\
+	return __alf_static_sc_dequeue(&q->producer, &q->consumer,	\
+				       q->ring, SIZE, ptr, n);		\
+}									\
+static __always_inline int						\
+name##_mp_enqueue(struct name *q, void **ptr, const u32 n)		\
+{									\
+	return __alf_static_mp_enqueue(&q->producer, &q->consumer,	\
+				       q->ring, SIZE, ptr, n);		\
+}									\
+static __always_inline int						\
+name##_mc_dequeue(struct name *q, void **ptr, const u32 n)		\
+{									\
+	return __alf_static_mc_dequeue(&q->producer, &q->consumer,	\
+				       q->ring, SIZE, ptr, n);		\
+}									\
+static inline int name##_count(struct name *q)				\
+{									\
+	return READ_ONCE(q->producer.tail) - READ_ONCE(q->consumer.head); \
+}
+
 #endif /* _LINUX_ALF_QUEUE_H */
@@ -349,3 +349,111 @@ __helper_alf_dequeue_load_memcpy(u32 c_head, struct alf_queue *q,
 		memcpy(&ptr[q->size-c_head], &q->ring[0], c_next * sizeof(ptr[0]));
 	}
 }
+
+/* SIMD helpers, moving 4 (AVX2) or 8 (NEON, 4x 128-bit) pointers per
+ * instruction, with a single split at the array wrap.  Using the
+ * vector unit requires kernel_fpu_begin()/kernel_neon_begin(), which
+ * cost more than a small bulk copy, thus below
+ * ALF_SIMD_MIN_BULK (or when the FPU is not usable in this context)
+ * they fall back to the _unroll helpers.
+ */
+#define ALF_SIMD_MIN_BULK 8
+
+#if defined(CONFIG_X86_64)
+#include <asm/fpu/api.h>
+#include <asm/cpufeature.h>
+
+#define __alf_simd_usable()					\
+	(boot_cpu_has(X86_FEATURE_AVX2) && irq_fpu_usable())
+#define __alf_simd_begin()	kernel_fpu_begin()
+#define __alf_simd_end()	kernel_fpu_end()
+
+static __always_inline void
+__alf_simd_copy_ptrs(void **dst, void **src, u32 n)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		asm volatile("vmovdqu   (%0), %%ymm0\n\t"
+			     "vmovdqu 32(%0), %%ymm1\n\t"
+			     "vmovdqu %%ymm0,   (%1)\n\t"
+			     "vmovdqu %%ymm1, 32(%1)\n\t"
+			     : : "r" (&src[i]), "r" (&dst[i])
+			     : "xmm0", "xmm1", "memory");
+	}
+	if (i + 4 <= n) {
+		asm volatile("vmovdqu (%0), %%ymm0\n\t"
+			     "vmovdqu %%ymm0, (%1)\n\t"
+			     : : "r" (&src[i]), "r" (&dst[i])
+			     : "xmm0", "memory");
+		i += 4;
+	}
+	for (; i < n; i++)
+		dst[i] = src[i];
+}
+#define ALF_HAVE_SIMD_HELPER 1
+
+#elif defined(CONFIG_ARM64) && defined(CONFIG_KERNEL_MODE_NEON)
+#include <asm/neon.h>
+#include <asm/simd.h>
+
+#define __alf_simd_usable()	may_use_simd()
+#define __alf_simd_begin()	kernel_neon_begin()
+#define __alf_simd_end()	kernel_neon_end()
+
+static __always_inline void
+__alf_simd_copy_ptrs(void **dst, void **src, u32 n)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		asm volatile("ld1 {v0.2d-v3.2d}, [%0]\n\t"
+			     "st1 {v0.2d-v3.2d}, [%1]\n\t"
+			     : : "r" (&src[i]), "r" (&dst[i])
+			     : "v0", "v1", "v2", "v3", "memory");
+	}
+	for (; i < n; i++)
+		dst[i] = src[i];
+}
+#define ALF_HAVE_SIMD_HELPER 1
+#endif
+
+#ifdef ALF_HAVE_SIMD_HELPER
+static inline void
+__helper_alf_enqueue_store_simd(u32 p_head, struct alf_queue *q,
+				void **ptr, const u32 n)
+{
+	u32 index = p_head & q->mask;
+	u32 first = min(n, q->size - index);
+
+	if (n < ALF_SIMD_MIN_BULK || !__alf_simd_usable()) {
+		__helper_alf_enqueue_store_unroll(p_head, q, ptr, n);
+		return;
+	}
+	__alf_simd_begin();
+	__alf_simd_copy_ptrs(&q->ring[index], ptr, first);
+	if (unlikely(first < n)) /* handle array wrap */
+		__alf_simd_copy_ptrs(&q->ring[0], &ptr[first], n - first);
+	__alf_simd_end();
+}
+static inline void
+__helper_alf_dequeue_load_simd(u32 c_head, struct alf_queue *q,
+			       void **ptr, const u32 elems)
+{
+	u32 index = c_head & q->mask;
+	u32 first = min(elems, q->size - index);
+
+	if (elems < ALF_SIMD_MIN_BULK || !__alf_simd_usable()) {
+		__helper_alf_dequeue_load_unroll(c_head, q, ptr, elems);
+		return;
+	}
+	__alf_simd_begin();
+	__alf_simd_copy_ptrs(ptr, &q->ring[index], first);
+	if (unlikely(first < elems)) /* handle array wrap */
+		__alf_simd_copy_ptrs(&ptr[first], &q->ring[0], elems - first);
+	__alf_simd_end();
+}
+#else
+#define __helper_alf_enqueue_store_simd __helper_alf_enqueue_store_unroll
+#define __helper_alf_dequeue_load_simd  __helper_alf_dequeue_load_unroll
+#endif
@@ -0,0 +1,97 @@
+#ifndef _LINUX_ALF_QUEUE_RESIZE_H
+#define _LINUX_ALF_QUEUE_RESIZE_H
+/* linux/alf_queue_resize.h
+ *
+ * Online grow/shrink of an alf_queue, without stopping producers or
+ * consumers (unlike ptr_ring_resize() taking both locks).
+ *
+ * Drained swap with epoch handover:
+ *  1. Resize publish a new queue as producer queue ("prod")
+ *  2. synchronize_rcu(), after which no producer is enqueuing into
+ *     the old queue, which is then marked "sealed"
+ *  3. Consumers keep dequeuing from the old queue ("cons"), and the
+ *     consumer that finds the sealed queue empty moves "cons" to the
+ *     new queue.  Thus, FIFO order is kept across the swap.
+ *  4. The old (sealed) queue, once consumers moved on, is freed after
+ *     a grace period by the next resize or by alf_queue_rs_reclaim()
+ *
+ * Enqueue/dequeue are RCU read-side sections around the normal MP/MC
+ * queue operations.  Resize, reclaim and destroy must be called from
+ * sleepable context.
+ */
+#include <linux/alf_queue.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+
+struct alf_queue_rs {
+	struct alf_queue __rcu *prod;	/* Producers enqueue here */
+	struct alf_queue __rcu *cons;	/* Consumers dequeue here */
+	struct alf_queue *sealed;	/* Old prod queue, no producers left */
+	struct mutex resize_mutex;
+};
+
+int  alf_queue_rs_init(struct alf_queue_rs *r, u32 size, gfp_t gfp);
+int  alf_queue_rs_resize(struct alf_queue_rs *r, u32 size, gfp_t gfp);
+void alf_queue_rs_reclaim(struct alf_queue_rs *r);
+void alf_queue_rs_destroy(struct alf_queue_rs *r);
+
+static inline int
+alf_queue_rs_mp_enqueue(const u32 n;
+			struct alf_queue_rs *r, void *ptr[n], const u32 n)
+{
+	struct alf_queue *q;
+	int cnt;
+
+	rcu_read_lock();
+	q = rcu_dereference(r->prod);
+	cnt = alf_mp_enqueue(q, ptr, n);
+	rcu_read_unlock();
+
+	return cnt;
+}
+
+/* Slow-path: cons queue looked empty, check if it is sealed and switch.
+ *
+ * A producer that entered its RCU section before the prod swap can
+ * still have enqueued into q after the empty dequeue above.  Once q
+ * is seen sealed those enqueues are complete, thus dequeue from q
+ * again and only move "cons" if it is still empty.
+ */
+static inline int
+__alf_queue_rs_switch(const u32 n;
+		      struct alf_queue_rs *r, struct alf_queue *q,
+		      void *ptr[n], const u32 n)
+{
+	struct alf_queue *prod;
+	int cnt;
+
+	/* Pairs with smp_store_release in alf_queue_rs_resize() */
+	if (smp_load_acquire(&r->sealed) != q)
+		return 0;
+	cnt = alf_mc_dequeue(q, ptr, n);
+	if (cnt)
+		return cnt;
+	/* Sealed and empty, a consumer hands over (others fail cmpxchg) */
+	prod = rcu_dereference(r->prod);
+	cmpxchg((struct alf_queue __force **)&r->cons, q, prod);
+	return alf_mc_dequeue(prod, ptr, n);
+}
+
+static inline int
+alf_queue_rs_mc_dequeue(const u32 n;
+			struct alf_queue_rs *r, void *ptr[n], const u32 n)
+{
+	struct alf_queue *q;
+	int cnt;
+
+	rcu_read_lock();
+	q = rcu_dereference(r->cons);
+	cnt = alf_mc_dequeue(q, ptr, n);
+	if (unlikely(cnt == 0))
+		cnt = __alf_queue_rs_switch(r, q, ptr, n);
+	rcu_read_unlock();
+
+	return cnt;
+}
+
+#endif /* _LINUX_ALF_QUEUE_RESIZE_H */
@@ -0,0 +1,149 @@
+#ifndef _LINUX_ALF_QUEUE_SEQ_H
+#define _LINUX_ALF_QUEUE_SEQ_H
+/* linux/alf_queue_seq.h
+ *
+ * Preemption tolerant Multi-Producer/Multi-Consumer ALF queue, using
+ * per-slot sequence numbers (as in D. Vyukov's bounded MPMC queue).
+ *
+ * alf_mp_enqueue/alf_mc_dequeue publish via a shared tail, which an
+ * enqueue (dequeue) can only advance after all preceding ones are
+ * done.  A task preempted between reserving (cmpxchg on head) and
+ * publishing, thus makes every later caller spin on the tail, which
+ * is a soft lock-up if they run on the same CPU.
+ *
+ * Here every slot carries its own sequence number, and an enqueue
+ * publishes its slots by writing their sequence numbers, without
+ * waiting for any other enqueue.  Slot seq for position pos is:
+ *   pos             free, the producer of pos can write it
+ *   pos + 1         holds the element of pos
+ *   pos + size      consumed, free for the producer of pos + size
+ *
+ * A preempted producer (consumer) only holds back its own slots.
+ * Other producers keep filling later slots until the queue is full,
+ * and consumers return the elements before the held slot and then
+ * find the queue empty, instead of spinning.  Thus, no caller ever
+ * waits on another, and the queue can be used from preemptible
+ * context (e.g. worker threads).  FIFO order is kept, the elements
+ * after an unpublished slot are returned once it gets published.
+ *
+ * Bulk enqueue/dequeue reserve a run of slots with a single cmpxchg,
+ * after checking the run is free (ready), thus the same fixed and
+ * burst semantics as alf_mp_enqueue/alf_mp_enqueue_burst.
+ *
+ * The cost is a seq LOAD and STORE per element, and the ring array is
+ * twice the size (slot is seq + pointer).
+ */
+#include <linux/alf_queue.h>
+
+struct alf_seq_slot {
+	u32 seq;
+	void *ptr;
+};
+
+struct alf_queue_seq {
+	u32 size;
+	u32 mask;
+	u32 enq_head ____cacheline_aligned_in_smp;
+	u32 deq_head ____cacheline_aligned_in_smp;
+	struct alf_seq_slot ring[0] ____cacheline_aligned_in_smp;
+};
+
+struct alf_queue_seq *alf_queue_seq_alloc(u32 size, gfp_t gfp);
+void		      alf_queue_seq_free(struct alf_queue_seq *q);
+
+static __always_inline int
+__alf_seq_mp_do_enqueue(const u32 n;
+			struct alf_queue_seq *q, void *ptr[n], const u32 n,
+			enum alf_queue_behavior behavior)
+{
+	struct alf_seq_slot *slot;
+	u32 head, cnt, i;
+
+	/* Reserve a run of free slots */
+	for (;;) {
+		head = READ_ONCE(q->enq_head);
+		for (cnt = 0; cnt < n; cnt++) {
+			slot = &q->ring[(head + cnt) & q->mask];
+			/* Acquire pairs with release in dequeue */
+			if (smp_load_acquire(&slot->seq) != head + cnt)
+				break;
+		}
+		if (cnt < n && (behavior == ALF_QUEUE_FIXED || cnt == 0)) {
+			/* A stale head also gets here, recheck it */
+			if (READ_ONCE(q->enq_head) != head)
+				continue;
+			return 0;
+		}
+		if (likely(cmpxchg(&q->enq_head, head, head + cnt) == head))
+			break;
+	}
+
+	/* STORE elems, each slot is published on its own */
+	for (i = 0; i < cnt; i++) {
+		slot = &q->ring[(head + i) & q->mask];
+		slot->ptr = ptr[i];
+		smp_store_release(&slot->seq, head + i + 1);
+	}
+
+	return cnt;
+}
+
+static __always_inline int
+__alf_seq_mc_do_dequeue(const u32 n;
+			struct alf_queue_seq *q, void *ptr[n], const u32 n,
+			enum alf_queue_behavior behavior)
+{
+	struct alf_seq_slot *slot;
+	u32 head, cnt, i;
+
+	/* Reserve a run of published slots */
+	for (;;) {
+		head = READ_ONCE(q->deq_head);
+		for (cnt = 0; cnt < n; cnt++) {
+			slot = &q->ring[(head + cnt) & q->mask];
+			/* Acquire pairs with release in enqueue */
+			if (smp_load_acquire(&slot->seq) != head + cnt + 1)
+				break;
+		}
+		if (cnt < n && (behavior == ALF_QUEUE_FIXED || cnt == 0)) {
+			if (READ_ONCE(q->deq_head) != head)
+				continue;
+			return 0;
+		}
+		if (likely(cmpxchg(&q->deq_head, head, head + cnt) == head))
+			break;
+	}
+
+	/* LOAD elems, and hand each slot back to producers of next lap */
+	for (i = 0; i < cnt; i++) {
+		slot = &q->ring[(head + i) & q->mask];
+		ptr[i] = slot->ptr;
+		smp_store_release(&slot->seq, head + i + q->size);
+	}
+
+	return cnt;
+}
+
+static inline int
+alf_seq_mp_enqueue(const u32 n;
+		   struct alf_queue_seq *q, void *ptr[n], const u32 n)
+{
+	return __alf_seq_mp_do_enqueue(q, ptr, n, ALF_QUEUE_FIXED);
+}
+
+static inline int
+alf_seq_mp_enqueue_burst(const u32 n;
+			 struct alf_queue_seq *q, void *ptr[n], const u32 n)
+{
+	return __alf_seq_mp_do_enqueue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+/* Like alf_mc_dequeue(), returns as many elements as available up to n */
+static inline int
+alf_seq_mc_dequeue(const u32 n;
+		   struct alf_queue_seq *q, void *ptr[n], const u32 n)
+{
+	return __alf_seq_mc_do_dequeue(q, ptr, n, ALF_QUEUE_VARIABLE);
+}
+
+#endif /* _LINUX_ALF_QUEUE_SEQ_H */
@@ -0,0 +1,93 @@
+#ifndef _LINUX_ALF_QUEUE_SET_H
+#define _LINUX_ALF_QUEUE_SET_H
+/* linux/alf_queue_set.h
+ *
+ * Multi-queue fan-in of SPSC alf_queues, e.g. per-CPU producers to a
+ * single consumer.
+ *
+ * Polling many queues costs a cache-miss per empty queue.  Instead
+ * producers mark their queue in a shared "active" bitmap on the
+ * empty->non-empty transition, and the consumer only visit queues
+ * with their bit set, clearing it when it drains a queue.
+ *
+ * Pairing: producer stores producer.tail, MB, test_bit (and set).
+ * Consumer clear_bit, MB, re-reads producer.tail.  Thus, either the
+ * consumer sees the new elements or the producer sees the cleared bit.
+ *
+ * Every queue have a single producer (same rules as alf_sp_enqueue)
+ * and the set have a single consumer.
+ */
+#include <linux/alf_queue.h>
+#include <linux/bitops.h>
+
+struct alf_queue_set {
+	unsigned int nr_queues;
+	unsigned int next;	/* Consumer round-robin start */
+	struct alf_queue **queues;
+	/* The bitmap gets written by producers, keep it separate */
+	unsigned long active[0] ____cacheline_aligned_in_smp;
+};
+
+struct alf_queue_set *alf_queue_set_alloc(unsigned int nr_queues, u32 size,
+					  gfp_t gfp);
+void		      alf_queue_set_free(struct alf_queue_set *set);
+
+static inline int
+alf_queue_set_enqueue(const u32 n;
+		      struct alf_queue_set *set, unsigned int idx,
+		      void *ptr[n], const u32 n)
+{
+	int cnt = alf_sp_enqueue(set->queues[idx], ptr, n);
+
+	if (unlikely(cnt == 0))
+		return 0;
+
+	smp_mb(); /* producer.tail store before reading active bit */
+	/* Only write the shared bitmap on empty->non-empty transition */
+	if (!test_bit(idx, set->active))
+		set_bit(idx, set->active);
+
+	return cnt;
+}
+
+/* Bulk dequeue up to n elements from the active queues, round-robin
+ * starting after the queue that was visited last, for fairness.
+ * Visits at most nr_queues queues.  Returns the number of elements
+ * dequeued.
+ */
+static inline int
+alf_queue_set_dequeue(const u32 n;
+		      struct alf_queue_set *set, void *ptr[n], const u32 n)
+{
+	unsigned int nr = set->nr_queues;
+	unsigned int idx, visited = 0;
+	unsigned int cnt = 0;
+	struct alf_queue *q;
+
+	idx = find_next_bit(set->active, nr, set->next);
+	if (idx >= nr)
+		idx = find_first_bit(set->active, nr);
+
+	while (idx < nr && cnt < n) {
+		q = set->queues[idx];
+		cnt += alf_sc_dequeue(q, &ptr[cnt], n - cnt);
+
+		if (alf_queue_count(q) == 0) {
+			clear_bit(idx, set->active);
+			smp_mb__after_atomic(); /* clear before re-check */
+			if (unlikely(alf_queue_count(q)))
+				set_bit(idx, set->active);
+		}
+		set->next = (idx + 1 < nr) ? idx + 1 : 0;
+		if (++visited == nr)
+			break;
+
+		idx = find_next_bit(set->active, nr, idx + 1);
+		if (idx >= nr)
+			idx = find_first_bit(set->active, nr);
+	}
+
+	return cnt;
+}
+
+#endif /* _LINUX_ALF_QUEUE_SET_H */
@@ -0,0 +1,78 @@
+#pragma once
+/* Zero clearing of buffers, dispatched on size class
+ *
+ * mem_clear() is the reusable outcome of lib/time_bench_memset.c.
+ * Small sizes are best left to memset() (compiler inlined stores),
+ * while larger clears can benefit from "rep stosb" (ERMS/FSRS CPUs)
+ * or from non-temporal stores, which do not pull the cleared lines
+ * into the cache.  Which variant wins is CPU specific, thus
+ * lib/mem_clear.c calibrates the method per size class at load
+ * time, which can be inspected and overridden via debugfs file
+ * /sys/kernel/debug/mem_clear/classes.
+ *
+ * Notice: non-temporal stores evict the lines from the cache, which
+ * is a loss when the buffer is written again right after clearing
+ * (e.g. skb headers).  They are only a win for big buffers that are
+ * not touched soon after.
+ */
+#include <linux/types.h>
+#include <linux/string.h>
+
+enum mem_clear_method {
+	MEM_CLEAR_MEMSET = 0,
+	MEM_CLEAR_ERMS,		/* rep stosb */
+	MEM_CLEAR_MOVNTI,	/* Non-temporal 8 byte stores */
+	MEM_CLEAR_AVX_NT,	/* Non-temporal 32 byte AVX stores */
+	MEM_CLEAR_METHOD_MAX
+};
+
+#ifdef CONFIG_X86_64
+static inline void __mem_clear_erms(void *ptr, size_t len)
+{
+	asm volatile("rep stosb"
+		     : "+D" (ptr), "+c" (len)
+		     : "a" (0)
+		     : "memory");
+}
+
+/* Non-temporal stores are weakly ordered, thus end with a sfence to
+ * make the zeroes visible before e.g. publishing the buffer.
+ */
+static inline void __mem_clear_movnti(void *ptr, size_t len)
+{
+	size_t head = -(unsigned long)ptr & 7;
+	size_t i, qwords;
+	u64 *p;
+
+	if (head > len)
+		head = len;
+	memset(ptr, 0, head);
+	p = ptr + head;
+	len -= head;
+	qwords = len / 8;
+
+	for (i = 0; i + 4 <= qwords; i += 4) {
+		asm volatile("movnti %4, %0\n\t"
+			     "movnti %4, %1\n\t"
+			     "movnti %4, %2\n\t"
+			     "movnti %4, %3"
+			     : "=m" (p[i]), "=m" (p[i + 1]),
+			       "=m" (p[i + 2]), "=m" (p[i + 3])
+			     : "r" (0UL));
+	}
+	for (; i < qwords; i++)
+		asm volatile("movnti %1, %0" : "=m" (p[i]) : "r" (0UL));
+	asm volatile("sfence" ::: "memory");
+	memset(p + qwords, 0, len & 7);
+}
+
+/* Needs the FPU, falls back to __mem_clear_movnti() if not usable */
+void __mem_clear_avx_nt(void *ptr, size_t len);
+#else
+#define __mem_clear_erms(ptr, len)	memset(ptr, 0, len)
+#define __mem_clear_movnti(ptr, len)	memset(ptr, 0, len)
+#define __mem_clear_avx_nt(ptr, len)	memset(ptr, 0, len)
+#endif
+
+/* Clear len bytes at ptr, using the calibrated method for the size */
+void mem_clear(void *ptr, size_t len);
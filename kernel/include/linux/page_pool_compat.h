@@ -0,0 +1,42 @@
+#ifndef _LINUX_PAGE_POOL_COMPAT_H
+#define _LINUX_PAGE_POOL_COMPAT_H
+/* linux/page_pool_compat.h
+ *
+ * page_pool API differences between kernel versions, shared by the
+ * page_pool benchmarks and the alloc compare benches.
+ */
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 5, 0)
+#include <net/page_pool.h>
+#else
+#include <net/page_pool/helpers.h>
+#endif
+
+/* page_pool_put_page() got a dma_sync_size argument in v5.6 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+static inline
+void _page_pool_put_page(struct page_pool *pool, struct page *page,
+			 bool allow_direct)
+{
+	page_pool_put_page(pool, page, -1, allow_direct);
+}
+#else
+static inline
+void _page_pool_put_page(struct page_pool *pool, struct page *page,
+			 bool allow_direct)
+{
+	page_pool_put_page(pool, page, allow_direct);
+}
+#endif
+
+/* page_pool frag API, the pool needs PP_FLAG_PAGE_FRAG until v6.7 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 15, 0)
+#define HAVE_PAGE_POOL_FRAG
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+#define PP_FLAGS_FRAG	PP_FLAG_PAGE_FRAG
+#else
+#define PP_FLAGS_FRAG	0
+#endif
+#endif
+
+#endif /* _LINUX_PAGE_POOL_COMPAT_H */
@@ -0,0 +1,49 @@
+/*
+ * page_scan - parallel walk of all struct page's
+ *
+ * Walking every struct page from a single thread (the PoC in
+ * mm/bench/page_bench06_walk_all.c) takes far too long on big memory
+ * hosts (1.5TB is ~400M struct pages).  page_scan_run() splits the
+ * PFN range of every populated zone into chunks, which worker CPUs
+ * grab dynamically (atomic chunk index, thus no static imbalance
+ * between small and large zones/nodes).
+ *
+ * Each worker prefetches struct page ahead of the walk, and yields
+ * online pages of the zone in batches to a callback.  A callback
+ * returning non-zero stops the scan on all workers.
+ *
+ * Callbacks run in process context (per CPU workqueue) concurrently
+ * on all selected CPUs, @worker is the index of the calling worker
+ * (0..nr_workers-1), for keeping per worker state without locking.
+ *
+ * NOTICE: memory hotplug is not blocked during the scan, pages are
+ * only checked via pfn_to_online_page().  Page state can change under
+ * the callback, only use it for monitoring type scans.
+ */
+#ifndef _LINUX_PAGE_SCAN_H
+#define _LINUX_PAGE_SCAN_H
+
+#include <linux/mm.h>
+#include <linux/cpumask.h>
+
+#define PAGE_SCAN_MAX_BATCH	64
+#define PAGE_SCAN_CHUNK_PFNS	(1UL << 15)	/* 128MB with 4K pages */
+#define PAGE_SCAN_PREFETCH	8
+
+typedef int (*page_scan_fn_t)(struct page **pages, unsigned int nr,
+			      unsigned int worker, void *data);
+
+struct page_scan_params {
+	page_scan_fn_t fn;
+	void *data;
+	/* Optional, zero/NULL selects defaults */
+	const struct cpumask *cpumask;	/* Worker CPUs (default online) */
+	unsigned long chunk_pfns;	/* PFNs per chunk */
+	unsigned int batch;		/* Pages per callback */
+	unsigned int prefetch;		/* struct page's prefetched ahead */
+};
+
+/* Returns number of pages yielded to the callback, or negative errno */
+long page_scan_run(const struct page_scan_params *params);
+
+#endif /* _LINUX_PAGE_SCAN_H */
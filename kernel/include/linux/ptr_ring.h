@@ -24,22 +24,67 @@
 #include <linux/compiler.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
+#include <linux/prefetch.h>
 #include <asm/errno.h>
 #endif
 
+/* Line sharing instrumentation, compiled in with PTR_RING_STATS
+ * (CONFIG_PTR_RING_STATS), read with ptr_ring_get_stats()
+ */
+struct ptr_ring_stats {
+	unsigned long prod_full;	/* Produce found slot not yet zeroed */
+	unsigned long cons_flush;	/* Consumer batched zeroing runs */
+	unsigned long cons_flush_shared;/* ... on line producer writes to */
+};
+
 struct ptr_ring {
 	int producer ____cacheline_aligned_in_smp;
 	spinlock_t producer_lock;
+#ifdef PTR_RING_STATS
+	unsigned long stat_prod_full;
+#endif
 	int consumer_head ____cacheline_aligned_in_smp; /* next valid entry */
 	int consumer_tail; /* next entry to invalidate */
 	spinlock_t consumer_lock;
+#ifdef PTR_RING_STATS
+	unsigned long stat_cons_flush;
+	unsigned long stat_cons_flush_shared;
+#endif
+	/* Lazy resize, see ptr_ring_resize_multiple_lazy().  Entries from
+	 * before the resize, consumed before the ones in queue.
+	 */
+	void **old_queue; /* or NULL when drained */
+	int old_size;
+	int old_head;
+	void **old_free; /* drained old_queue, see ptr_ring_resize_reclaim() */
 	/* Shared consumer/producer data */
 	/* Read-only by both the producer and the consumer */
 	int size ____cacheline_aligned_in_smp; /* max entries in queue */
 	int batch; /* number of entries to consume in a batch */
+	int batch_cfg; /* requested batch, 0 = default from SMP_CACHE_BYTES */
 	void **queue;
 };
 
+#ifdef PTR_RING_STATS
+#define ptr_ring_stat_inc(r, field)	((r)->stat_##field++)
+#else
+#define ptr_ring_stat_inc(r, field)	do { } while (0)
+#endif
+
+/* Snapshot of the counters, all zero without PTR_RING_STATS.  Lockless
+ * reads, thus only approximate while the ring is in use.
+ */
+static inline void ptr_ring_get_stats(struct ptr_ring *r,
+				      struct ptr_ring_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+#ifdef PTR_RING_STATS
+	st->prod_full	      = READ_ONCE(r->stat_prod_full);
+	st->cons_flush	      = READ_ONCE(r->stat_cons_flush);
+	st->cons_flush_shared = READ_ONCE(r->stat_cons_flush_shared);
+#endif
+}
+
 /* Note: callers invoking this in a loop must use a compiler barrier,
  * for example cpu_relax().
  *
@@ -103,8 +148,12 @@ static inline bool ptr_ring_full_bh(struct ptr_ring *r)
  */
 static inline int __ptr_ring_produce(struct ptr_ring *r, void *ptr)
 {
-	if (unlikely(!r->size) || r->queue[r->producer])
+	if (unlikely(!r->size))
 		return -ENOSPC;
+	if (r->queue[r->producer]) {
+		ptr_ring_stat_inc(r, prod_full);
+		return -ENOSPC;
+	}
 
 	/* Make sure the pointer we are storing points to a valid data. */
 	/* Pairs with smp_read_barrier_depends in __ptr_ring_consume. */
@@ -166,8 +215,119 @@ static inline int ptr_ring_produce_bh(struct ptr_ring *r, void *ptr)
 	return ret;
 }
 
+/* Produce up to n pointers, with a single smp_wmb() for all of them.
+ * Stops at the first slot still in use by the consumer.  Callers must
+ * hold producer_lock.
+ *
+ * Returns the number of pointers produced, 0 if the ring is full.
+ */
+static inline int __ptr_ring_produce_batched(struct ptr_ring *r,
+					     void **array, int n)
+{
+	int producer = r->producer;
+	int i;
+
+	if (unlikely(!r->size))
+		return 0;
+
+	/* Make sure the pointers we are storing points to valid data. */
+	/* Pairs with smp_read_barrier_depends in __ptr_ring_consume. */
+	smp_wmb();
+
+	for (i = 0; i < n; i++) {
+		if (r->queue[producer]) {
+			ptr_ring_stat_inc(r, prod_full);
+			break;
+		}
+		WRITE_ONCE(r->queue[producer], array[i]);
+		if (unlikely(++producer >= r->size))
+			producer = 0;
+	}
+	r->producer = producer;
+	return i;
+}
+
+static inline int ptr_ring_produce_batched(struct ptr_ring *r,
+					   void **array, int n)
+{
+	int ret;
+
+	spin_lock(&r->producer_lock);
+	ret = __ptr_ring_produce_batched(r, array, n);
+	spin_unlock(&r->producer_lock);
+
+	return ret;
+}
+
+static inline int ptr_ring_produce_batched_irq(struct ptr_ring *r,
+					       void **array, int n)
+{
+	int ret;
+
+	spin_lock_irq(&r->producer_lock);
+	ret = __ptr_ring_produce_batched(r, array, n);
+	spin_unlock_irq(&r->producer_lock);
+
+	return ret;
+}
+
+static inline int ptr_ring_produce_batched_any(struct ptr_ring *r,
+					       void **array, int n)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&r->producer_lock, flags);
+	ret = __ptr_ring_produce_batched(r, array, n);
+	spin_unlock_irqrestore(&r->producer_lock, flags);
+
+	return ret;
+}
+
+static inline int ptr_ring_produce_batched_bh(struct ptr_ring *r,
+					      void **array, int n)
+{
+	int ret;
+
+	spin_lock_bh(&r->producer_lock);
+	ret = __ptr_ring_produce_batched(r, array, n);
+	spin_unlock_bh(&r->producer_lock);
+
+	return ret;
+}
+
+/* Lazy resize: the old queue holds no buffered (consumed, not yet
+ * zeroed) entries, and the producer never writes to it, thus the old
+ * entries are the ones from old_head up to the first NULL slot.  When
+ * drained, the old queue is retired for ptr_ring_resize_reclaim().
+ */
+static inline void *__ptr_ring_peek_old(struct ptr_ring *r)
+{
+	void *ptr = r->old_queue[r->old_head];
+
+	if (ptr)
+		return ptr;
+	r->old_free = r->old_queue;
+	WRITE_ONCE(r->old_queue, NULL);
+	return NULL;
+}
+
+static inline void __ptr_ring_discard_old(struct ptr_ring *r)
+{
+	r->old_queue[r->old_head] = NULL;
+	if (unlikely(++r->old_head >= r->old_size))
+		r->old_head = 0;
+}
+
 static inline void *__ptr_ring_peek(struct ptr_ring *r)
 {
+	void *ptr;
+
+	if (unlikely(r->old_queue)) {
+		ptr = __ptr_ring_peek_old(r);
+		if (ptr)
+			return ptr;
+	}
 	if (likely(r->size))
 		return READ_ONCE(r->queue[r->consumer_head]);
 	return NULL;
@@ -193,6 +353,9 @@ static inline void *__ptr_ring_peek(struct ptr_ring *r)
  */
 static inline bool __ptr_ring_empty(struct ptr_ring *r)
 {
+	/* Old entries (or old queue about to be retired by consumer) */
+	if (unlikely(READ_ONCE(r->old_queue)))
+		return false;
 	if (likely(r->size))
 		return !r->queue[READ_ONCE(r->consumer_head)];
 	return true;
@@ -264,6 +427,12 @@ static inline void __ptr_ring_discard_one(struct ptr_ring *r)
 	int consumer_head = r->consumer_head;
 	int head = consumer_head++;
 
+	/* Peek returned an entry of the old queue, if not yet drained */
+	if (unlikely(r->old_queue)) {
+		__ptr_ring_discard_old(r);
+		return;
+	}
+
 	/* Once we have processed enough entries invalidate them in
 	 * the ring all at once so producer can reuse their space in the ring.
 	 * We also do this when we reach end of the ring - not mandatory
@@ -276,6 +445,17 @@ static inline void __ptr_ring_discard_one(struct ptr_ring *r)
 		 * producer won't make progress and touch other cache lines
 		 * besides the first one until we write out all entries.
 		 */
+#ifdef PTR_RING_STATS
+		{
+			/* Producer writing in a line being zeroed? */
+			const int epl = SMP_CACHE_BYTES / sizeof(*r->queue);
+			int pline = READ_ONCE(r->producer) / epl;
+
+			ptr_ring_stat_inc(r, cons_flush);
+			if (pline >= r->consumer_tail / epl && pline <= head / epl)
+				ptr_ring_stat_inc(r, cons_flush_shared);
+		}
+#endif
 		while (likely(head >= r->consumer_tail))
 			r->queue[head--] = NULL;
 		r->consumer_tail = consumer_head;
@@ -418,6 +598,64 @@ static inline int ptr_ring_consume_batched_bh(struct ptr_ring *r,
 	return ret;
 }
 
+/* Prefetch the objects of the next @dist entries still in the ring,
+ * after the consumer head, so a following consume finds them warm.
+ * Stops at the first empty slot.  Callers must hold consumer_lock
+ * (or be the lockless SPSC consumer).
+ */
+static inline void __ptr_ring_prefetch_ahead(struct ptr_ring *r, int dist)
+{
+	int head = r->consumer_head;
+	void *ptr;
+	int i;
+
+	if (unlikely(!r->size || r->old_queue))
+		return;
+	for (i = 0; i < dist; i++) {
+		ptr = READ_ONCE(r->queue[head]);
+		if (!ptr)
+			break;
+		prefetch(ptr);
+		if (unlikely(++head >= r->size))
+			head = 0;
+	}
+}
+
+/* Lockless SPSC mode.
+ *
+ * When there is provably a single producer and a single consumer
+ * (e.g. one CPU each, or per-CPU rings drained by one CPU), the
+ * producer_lock and consumer_lock can be skipped, as the NULL-slot
+ * protocol alone hands over the entries: the producer only writes
+ * NULL slots and producer index, the consumer only non-NULL slots and
+ * the consumer indexes.
+ *
+ * The caller guarantees that each side is never run concurrently with
+ * itself, including from IRQ/BH context on the same CPU, and that the
+ * ring is not resized or mixed with the locked API while in use.
+ */
+static inline int ptr_ring_produce_spsc(struct ptr_ring *r, void *ptr)
+{
+	return __ptr_ring_produce(r, ptr);
+}
+
+static inline int ptr_ring_produce_batched_spsc(struct ptr_ring *r,
+						void **array, int n)
+{
+	return __ptr_ring_produce_batched(r, array, n);
+}
+
+static inline void *ptr_ring_consume_spsc(struct ptr_ring *r)
+{
+	return __ptr_ring_consume(r);
+}
+
+static inline int ptr_ring_consume_batched_spsc(struct ptr_ring *r,
+						void **array, int n)
+{
+	return __ptr_ring_consume_batched(r, array, n);
+}
+
 /* Cast to structure type and call a function without discarding from FIFO.
  * Function must return a value.
  * Callers must take consumer_lock.
@@ -474,7 +712,8 @@ static inline void **__ptr_ring_init_queue_alloc(unsigned int size, gfp_t gfp)
 static inline void __ptr_ring_set_size(struct ptr_ring *r, int size)
 {
 	r->size = size;
-	r->batch = SMP_CACHE_BYTES * 2 / sizeof(*(r->queue));
+	r->batch = r->batch_cfg ? r->batch_cfg :
+		SMP_CACHE_BYTES * 2 / sizeof(*(r->queue));
 	/* We need to set batch at least to 1 to make logic
 	 * in __ptr_ring_discard_one work correctly.
 	 * Batching too much (because ring is small) would cause a lot of
@@ -484,20 +723,37 @@ static inline void __ptr_ring_set_size(struct ptr_ring *r, int size)
 		r->batch = 1;
 }
 
-static inline int ptr_ring_init(struct ptr_ring *r, int size, gfp_t gfp)
+/* Like ptr_ring_init(), with the consumer discard batch set to @batch
+ * entries (0 = default of two cache-lines), kept across resize.
+ * Clamped to size/2, as larger batches make the ring too bursty.
+ */
+static inline int ptr_ring_init_batch(struct ptr_ring *r, int size,
+				      int batch, gfp_t gfp)
 {
 	r->queue = __ptr_ring_init_queue_alloc(size, gfp);
 	if (!r->queue)
 		return -ENOMEM;
 
+	r->batch_cfg = max(batch, 0);
 	__ptr_ring_set_size(r, size);
 	r->producer = r->consumer_head = r->consumer_tail = 0;
+	r->old_queue = r->old_free = NULL;
+	r->old_size = r->old_head = 0;
 	spin_lock_init(&r->producer_lock);
 	spin_lock_init(&r->consumer_lock);
+#ifdef PTR_RING_STATS
+	r->stat_prod_full = 0;
+	r->stat_cons_flush = r->stat_cons_flush_shared = 0;
+#endif
 
 	return 0;
 }
 
+static inline int ptr_ring_init(struct ptr_ring *r, int size, gfp_t gfp)
+{
+	return ptr_ring_init_batch(r, size, 0, gfp);
+}
+
 /*
  * Return entries into ring. Destroy entries that don't fit.
  *
@@ -520,6 +776,20 @@ static inline void ptr_ring_unconsume(struct ptr_ring *r, void **batch, int n,
 	if (!r->size)
 		goto done;
 
+	/* Lazy resize in progress, entries go in front of the old ones */
+	if (unlikely(r->old_queue)) {
+		while (n) {
+			head = r->old_head - 1;
+			if (head < 0)
+				head = r->old_size - 1;
+			if (r->old_queue[head])
+				goto done;
+			r->old_queue[head] = batch[--n];
+			r->old_head = head;
+		}
+		goto done;
+	}
+
 	/*
 	 * Clean out buffered entries (for simplicity). This way following code
 	 * can test entries for NULL and if not assume they are valid.
@@ -592,7 +862,7 @@ static inline int ptr_ring_resize(struct ptr_ring *r, int size, gfp_t gfp,
 {
 	unsigned long flags;
 	void **queue = __ptr_ring_init_queue_alloc(size, gfp);
-	void **old;
+	void **old, **old_free;
 
 	if (!queue)
 		return -ENOMEM;
@@ -601,11 +871,15 @@ static inline int ptr_ring_resize(struct ptr_ring *r, int size, gfp_t gfp,
 	spin_lock(&(r)->producer_lock);
 
 	old = __ptr_ring_swap_queue(r, queue, size, gfp, destroy);
+	/* Consume loop drained (and retired) the old queue of a lazy resize */
+	old_free = r->old_free;
+	r->old_free = NULL;
 
 	spin_unlock(&(r)->producer_lock);
 	spin_unlock_irqrestore(&(r)->consumer_lock, flags);
 
 	kvfree(old);
+	kvfree(old_free);
 
 	return 0;
 }
@@ -623,6 +897,7 @@ static inline int ptr_ring_resize_multiple(struct ptr_ring **rings,
 {
 	unsigned long flags;
 	void ***queues;
+	void **old_free;
 	int i;
 
 	queues = kmalloc_array(nrings, sizeof(*queues), gfp);
@@ -640,8 +915,11 @@ static inline int ptr_ring_resize_multiple(struct ptr_ring **rings,
 		spin_lock(&(rings[i])->producer_lock);
 		queues[i] = __ptr_ring_swap_queue(rings[i], queues[i],
 						  size, gfp, destroy);
+		old_free = rings[i]->old_free;
+		rings[i]->old_free = NULL;
 		spin_unlock(&(rings[i])->producer_lock);
 		spin_unlock_irqrestore(&(rings[i])->consumer_lock, flags);
+		kvfree(old_free);
 	}
 
 	for (i = 0; i < nrings; ++i)
@@ -661,6 +939,132 @@ noqueues:
 	return -ENOMEM;
 }
 
+/* Lazy resize: only the queue swap happens under the locks, which is
+ * O(1) instead of copying all entries.  The entries stay in the old
+ * queue, the consumer drains them before moving on to the new queue
+ * (FIFO order is kept), and the producer fills the new queue right
+ * away.  Thus, until drained, up to old+new size entries are queued,
+ * and no entries are destroyed on shrink.
+ */
+static inline void **__ptr_ring_swap_queue_lazy(struct ptr_ring *r,
+						void **queue, int size)
+{
+	void **old = r->queue;
+	int head;
+
+	/* Clean out buffered entries, like ptr_ring_unconsume() */
+	head = r->consumer_head - 1;
+	while (likely(head >= r->consumer_tail))
+		r->queue[head--] = NULL;
+
+	if (r->size && r->queue[r->consumer_head]) {
+		r->old_size = r->size;
+		r->old_head = r->consumer_head;
+		WRITE_ONCE(r->old_queue, old);
+		old = NULL; /* Freed once drained */
+	}
+	__ptr_ring_set_size(r, size);
+	r->producer = 0;
+	r->consumer_head = 0;
+	r->consumer_tail = 0;
+	r->queue = queue;
+
+	return old;
+}
+
+/* Free old queues which the consumer drained after a lazy resize.
+ * Called by the resizer later on, the lazy resize functions reclaim
+ * as part of their busy check.
+ */
+static inline void ptr_ring_resize_reclaim(struct ptr_ring *r)
+{
+	unsigned long flags;
+	void **old;
+
+	spin_lock_irqsave(&r->consumer_lock, flags);
+	old = r->old_free;
+	r->old_free = NULL;
+	spin_unlock_irqrestore(&r->consumer_lock, flags);
+
+	kvfree(old);
+}
+
+/* Like ptr_ring_resize_multiple(), but lazy (see above), thus producers
+ * and consumers are stopped only for the swap, not for copying every
+ * entry.  Returns -EBUSY if a ring is still draining the old queue of
+ * an earlier lazy resize, then no ring is resized.  Resizes of the
+ * rings must be serialized by the caller (e.g. RTNL for tun/tap).
+ *
+ * Note: producer lock is nested within consumer lock, same as
+ * ptr_ring_resize_multiple().
+ */
+static inline int ptr_ring_resize_multiple_lazy(struct ptr_ring **rings,
+						unsigned int nrings,
+						int size, gfp_t gfp)
+{
+	unsigned long flags;
+	void ***queues;
+	void **old_free;
+	bool busy;
+	int i;
+
+	/* Reclaim and busy check in one critical section, else the
+	 * consumer can retire the old queue in between, and the next
+	 * drain overwrites (leaks) that old_free.
+	 */
+	for (i = 0; i < nrings; ++i) {
+		spin_lock_irqsave(&(rings[i])->consumer_lock, flags);
+		old_free = rings[i]->old_free;
+		rings[i]->old_free = NULL;
+		busy = !!rings[i]->old_queue;
+		spin_unlock_irqrestore(&(rings[i])->consumer_lock, flags);
+		kvfree(old_free);
+		if (busy)
+			return -EBUSY;
+	}
+
+	queues = kmalloc_array(nrings, sizeof(*queues), gfp);
+	if (!queues)
+		goto noqueues;
+
+	for (i = 0; i < nrings; ++i) {
+		queues[i] = __ptr_ring_init_queue_alloc(size, gfp);
+		if (!queues[i])
+			goto nomem;
+	}
+
+	for (i = 0; i < nrings; ++i) {
+		spin_lock_irqsave(&(rings[i])->consumer_lock, flags);
+		spin_lock(&(rings[i])->producer_lock);
+		queues[i] = __ptr_ring_swap_queue_lazy(rings[i], queues[i],
+						       size);
+		spin_unlock(&(rings[i])->producer_lock);
+		spin_unlock_irqrestore(&(rings[i])->consumer_lock, flags);
+	}
+
+	for (i = 0; i < nrings; ++i)
+		kvfree(queues[i]); /* NULL when draining */
+
+	kfree(queues);
+
+	return 0;
+
+nomem:
+	while (--i >= 0)
+		kvfree(queues[i]);
+
+	kfree(queues);
+
+noqueues:
+	return -ENOMEM;
+}
+
+static inline int ptr_ring_resize_lazy(struct ptr_ring *r, int size,
+				       gfp_t gfp)
+{
+	return ptr_ring_resize_multiple_lazy(&r, 1, size, gfp);
+}
+
 static inline void ptr_ring_cleanup(struct ptr_ring *r, void (*destroy)(void *))
 {
 	void *ptr;
@@ -668,6 +1072,8 @@ static inline void ptr_ring_cleanup(struct ptr_ring *r, void (*destroy)(void *))
 	if (destroy)
 		while ((ptr = ptr_ring_consume(r)))
 			destroy(ptr);
+	kvfree(r->old_queue); /* Not drained, without destroy */
+	kvfree(r->old_free);
 	kvfree(r->queue);
 }
 
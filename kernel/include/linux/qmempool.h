@@ -23,6 +23,31 @@
  *
  * Only support GFP_ATOMIC allocations from SLAB.
  *
+ * Instead of a kmem_cache a pool can be backed by order-N pages
+ * (qmempool_create_pages()), for recycling e.g. RX pages in drivers
+ * not using page_pool.  Elements are then page_address() of the pages,
+ * see qmempool_{alloc,free}_page().
+ *
+ * Cached elements adapt per CPU (localq depth follows the observed
+ * alloc/free imbalance), and a shrinker drains localq/sharedq back to
+ * the kmem_cache under memory pressure.
+ *
+ * The qmempool_{alloc,free}_any() API is a variant callable from any
+ * context (hardirq and preemptible process context included), see
+ * "Any context variant" below.
+ *
+ * NUMA: there is a sharedq per memory node, and the localq of a CPU
+ * only caches elements from the CPU's own node (cpu_to_mem()).
+ * Elements freed on another node are collected per CPU and returned
+ * in bulk to the sharedq of the node owning the memory.
+ *
+ * Producer/consumer CPU pairs (alloc on one CPU, free on another, e.g.
+ * RX->TX redirect): with qmempool_remote_cpu_enable() frees via
+ * qmempool_free_to_cpu() are batched and returned over an SPSC queue
+ * straight to the allocating CPU, which refills its localq from these
+ * before touching sharedq.
+ *
+ *
  * Copyright (C) 2014, Red Hat, Inc., Jesper Dangaard Brouer
  *  for licensing details see kernel-base/COPYING
  */
@@ -31,26 +56,128 @@
 #define _LINUX_QMEMPOOL_H
 
 #include <linux/alf_queue.h>
+#include <linux/alf_queue_set.h>
 #include <linux/prefetch.h>
 #include <linux/hardirq.h>
+#include <linux/mm.h>
+#include <linux/topology.h>
+#include <linux/log2.h>
+#include <linux/version.h>
+#include <linux/jump_label.h>
 
 /* Bulking is an essential part of the performance gains as this
  * amortize the cost of cmpxchg ops used when accessing sharedq
+ *
+ * These are the defaults used by qmempool_create().  Per pool values
+ * can be given to qmempool_create_tuned(), limited by the _MAX values
+ * as they size on-stack arrays.
  */
 #define QMEMPOOL_BULK 16
 #define QMEMPOOL_REFILL_MULTIPLIER 2
+#define QMEMPOOL_BULK_MAX 64
+#define QMEMPOOL_REFILL_MULTIPLIER_MAX 8
 
 struct qmempool_percpu {
 	struct alf_queue *localq;
+	int nid;	/* Memory node served by localq, cpu_to_mem() */
+	/* Remote frees (elements from another node) pending for return
+	 * in bulk to the sharedq of node remote_nid
+	 */
+	int remote_nid;
+	int remote_cnt;
+	void *remote[QMEMPOOL_BULK_MAX];
+	/* Adaptive localq depth, pool bulk size .. localq size, see
+	 * __qmempool_adapt().  Events counted since last adaptation.
+	 */
+	unsigned int depth;
+	unsigned int refills;	/* localq ran empty */
+	unsigned int overflows;	/* localq reached depth */
+	/* Remote CPU frees, see qmempool_remote_cpu_enable().  The xset
+	 * has a SPSC queue per freeing CPU, consumed by this CPU.
+	 * Frees to another CPU are pending in xcpu[] while they belong
+	 * to the same owner CPU.
+	 */
+	struct alf_queue_set *xset;
+	int xcpu_owner;
+	int xcpu_cnt;
+	void *xcpu[QMEMPOOL_BULK_MAX];
 };
 
+/* Any context variant: per CPU freelist linked through the first word
+ * of the free elements, updated together with a transaction id ("tid")
+ * by a single this_cpu double-word cmpxchg, like SLUB's per CPU
+ * freelist.  The tid changes on every update thus a pop racing with
+ * an interrupt (ABA), or a task migrated to another CPU (tid encodes
+ * the CPU), makes the cmpxchg fail and retry.  The low bits of tid
+ * count the elements on the freelist, bounding its depth.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0)
+# ifdef system_has_cmpxchg_double
+#  define QMEMPOOL_ANY_CMPXCHG
+#  define qmempool_any_has_cmpxchg()	system_has_cmpxchg_double()
+# endif
+#else
+/* v6.6 replaced cmpxchg_double by 128-bit (64-bit on 32-bit) cmpxchg */
+# if defined(CONFIG_64BIT) && defined(system_has_cmpxchg128)
+#  define QMEMPOOL_ANY_CMPXCHG
+#  define qmempool_any_has_cmpxchg()	system_has_cmpxchg128()
+#  define this_cpu_cmpxchg_qmempool	this_cpu_cmpxchg128
+typedef u128 qmempool_any_full_t;
+# elif !defined(CONFIG_64BIT) && defined(system_has_cmpxchg64)
+#  define QMEMPOOL_ANY_CMPXCHG
+#  define qmempool_any_has_cmpxchg()	system_has_cmpxchg64()
+#  define this_cpu_cmpxchg_qmempool	this_cpu_cmpxchg64
+typedef u64 qmempool_any_full_t;
+# endif
+#endif
+#ifndef QMEMPOOL_ANY_CMPXCHG
+/* Without double-word cmpxchg the freelist is protected by IRQ disable */
+# define qmempool_any_has_cmpxchg()	false
+#endif
+
+#define QMEMPOOL_ANY_CNT_BITS	16
+#define QMEMPOOL_ANY_CNT_MASK	((1UL << QMEMPOOL_ANY_CNT_BITS) - 1)
+#define QMEMPOOL_ANY_TID_STEP	\
+	(roundup_pow_of_two(CONFIG_NR_CPUS) << QMEMPOOL_ANY_CNT_BITS)
+
+struct qmempool_any_cpu {
+	union {
+		struct {
+			void *freelist;
+			unsigned long tid; /* seq | cpu | count */
+		};
+#ifdef this_cpu_cmpxchg_qmempool
+		qmempool_any_full_t full;
+#endif
+	};
+} __aligned(2 * sizeof(void *));
+
+/* Optional per pool statistics, compiled out unless the QMEMPOOL_STATS
+ * define is set (CONFIG_QMEMPOOL_STATS=y).  Per CPU counters, summed
+ * up in /sys/kernel/debug/qmempool/<name>/stats after
+ * qmempool_stats_register().  Meant for choosing the bulk size and
+ * refill multiplier (qmempool_create_tuned()) for a workload.
+ */
+struct qmempool_stats {
+	u64 localq_hit;		/* elems alloc'ed from localq (or freelist) */
+	u64 sharedq_refill;	/* localq empty, refilled from sharedq */
+	u64 slab_alloc;		/* sharedq empty, refilled from slab */
+	u64 localq_overflow;	/* localq at depth, bulk moved to sharedq */
+	u64 sharedq_overflow;	/* sharedq full, elems freed to slab */
+	u64 free_remote;	/* elems freed from another node */
+	u64 free_remote_cpu;	/* elems freed to their owner CPU */
+	u64 remote_cpu_refill;	/* localq refilled from remote CPU frees */
+};
+
+struct dentry;
+
 struct qmempool {
 	/* The shared queue (sharedq) is a Multi-Producer-Multi-Consumer
 	 *  queue where access is protected by an atomic cmpxchg operation.
 	 *  The queue support bulk transfers, which amortize the cost
 	 *  of the atomic cmpxchg operation.
 	 */
-	struct alf_queue	*sharedq;
+	struct alf_queue	**sharedq; /* Per node, indexed by node id */
 
 	/* Per CPU local "cache" queues for faster atomic free access.
 	 * The local queues (localq) are Single-Producer-Single-Consumer
@@ -58,23 +185,162 @@ struct qmempool {
 	 */
 	struct qmempool_percpu __percpu *percpu;
 
-	/* Backed by some SLAB kmem_cache */
+	/* Per CPU freelists of the any context variant */
+	struct qmempool_any_cpu __percpu *any;
+	unsigned int any_max; /* depth of the freelist (localq size) */
+
+	/* Backed by some SLAB kmem_cache, or by pages if NULL */
 	struct kmem_cache	*kmem;
+	unsigned int		page_order;
 
 	/* Setup */
 	uint32_t prealloc;
+	uint32_t localq_sz;
+	uint32_t elem_size;	/* For debug poisoning */
+	atomic_t debug_errors;	/* Reported by debug mode */
+	uint16_t bulk;		/* Elements moved per sharedq access */
+	uint16_t refill_mult;	/* Bulks per slab refill/sharedq drain */
 	gfp_t gfp_mask;
+
+	bool remote_cpu;	/* qmempool_remote_cpu_enable() done */
+
+	/* On qmempool_list, for the shrinker */
+	struct list_head list;
+
+#ifdef QMEMPOOL_STATS
+	struct qmempool_stats __percpu *stats;
+	struct dentry *stats_dentry;
+#endif
 };
 
+#ifdef QMEMPOOL_STATS
+int  qmempool_stats_register(struct qmempool *pool, const char *name);
+void qmempool_stats_sum(struct qmempool *pool, struct qmempool_stats *sum);
+
+#define qmempool_stat_add(pool, field, n) this_cpu_add((pool)->stats->field, n)
+#else
+static inline int
+qmempool_stats_register(struct qmempool *pool, const char *name)
+{
+	return 0;
+}
+static inline void
+qmempool_stats_sum(struct qmempool *pool, struct qmempool_stats *sum)
+{
+	memset(sum, 0, sizeof(*sum));
+}
+#define qmempool_stat_add(pool, field, n)	do { } while (0)
+#endif
+#define qmempool_stat_inc(pool, field)	qmempool_stat_add(pool, field, 1)
+
 extern void qmempool_destroy(struct qmempool *pool);
 extern struct qmempool *qmempool_create(
 	uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
 	struct kmem_cache *kmem, gfp_t gfp_mask);
+extern struct qmempool *qmempool_create_tuned(
+	uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
+	struct kmem_cache *kmem, gfp_t gfp_mask,
+	unsigned int bulk, unsigned int refill_mult);
+extern struct qmempool *qmempool_create_pages(
+	uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
+	unsigned int order, gfp_t gfp_mask);
+
+static inline bool qmempool_is_page_backed(const struct qmempool *pool)
+{
+	return !pool->kmem;
+}
+
+/* Per pool bulk size and refill multiplier.  Pools using the defaults
+ * get the compile-time constants, thus loops over a bulk can still be
+ * constant-folded/unrolled on the common path.
+ */
+static __always_inline int qmempool_bulk(const struct qmempool *pool)
+{
+	if (likely(pool->bulk == QMEMPOOL_BULK))
+		return QMEMPOOL_BULK;
+	return pool->bulk;
+}
+
+static __always_inline int qmempool_refill_mult(const struct qmempool *pool)
+{
+	if (likely(pool->refill_mult == QMEMPOOL_REFILL_MULTIPLIER))
+		return QMEMPOOL_REFILL_MULTIPLIER;
+	return pool->refill_mult;
+}
 
 extern void *__qmempool_alloc_from_sharedq(
-	struct qmempool *pool, gfp_t gfp_mask, struct alf_queue *localq);
+	struct qmempool *pool, gfp_t gfp_mask, struct qmempool_percpu *cpu);
 extern void __qmempool_free_to_sharedq(void *elem, struct qmempool *pool,
-				       struct alf_queue *localq);
+				       struct qmempool_percpu *cpu);
+extern void __qmempool_free_remote(void *elem, struct qmempool *pool,
+				   struct qmempool_percpu *cpu);
+extern void __qmempool_free_remote_cpu(void *elem, struct qmempool *pool,
+				       struct qmempool_percpu *cpu, int owner);
+extern int qmempool_remote_cpu_enable(struct qmempool *pool, u32 qsize);
+extern int __qmempool_alloc_bulk_from_sharedq(
+	struct qmempool *pool, gfp_t gfp_mask, struct qmempool_percpu *cpu,
+	void **elems, int n);
+extern void __qmempool_free_bulk_to_sharedq(
+	struct qmempool *pool, struct qmempool_percpu *cpu,
+	void **elems, int n);
+
+/* Debug mode, toggled at runtime via the qmempool "debug" module
+ * parameter (/sys/module/qmempool/parameters/debug), a static key thus
+ * only a NOP in the fast-path while off.  Elements cached in the pool
+ * bypass SLUB debugging, instead when on:
+ *  - free poisons the element (POISON_FREE) and marks it by a magic
+ *    word, finding the magic already set is reported as double free
+ *  - alloc verifies the poison, a modified element is reported as
+ *    use-after-free, and clears the magic
+ * The first word is left alone, as the any context freelist links
+ * through it, and the second holds the magic.  Thus, writes to the
+ * first two words are not detected, and pools with elements smaller
+ * than three words are not checked.  Elements cached before debug got
+ * (re-)enabled are not checked.
+ * Redzones are not added by qmempool, use slub_debug on the kmem_cache.
+ */
+DECLARE_STATIC_KEY_FALSE(qmempool_debug_key);
+
+extern void __qmempool_debug_alloc(struct qmempool *pool, void *elem);
+extern bool __qmempool_debug_free(struct qmempool *pool, void *elem);
+
+static __always_inline void *qmempool_debug_alloc(struct qmempool *pool,
+						  void *elem)
+{
+	if (static_branch_unlikely(&qmempool_debug_key) && elem)
+		__qmempool_debug_alloc(pool, elem);
+	return elem;
+}
+
+/* Returns false if the element must not be freed (double free) */
+static __always_inline bool qmempool_debug_free(struct qmempool *pool,
+						void *elem)
+{
+	if (static_branch_unlikely(&qmempool_debug_key))
+		return __qmempool_debug_free(pool, elem);
+	return true;
+}
+
+/* Returns the number of elements left in @elems, double frees removed */
+static __always_inline int qmempool_debug_free_bulk(struct qmempool *pool,
+						    void **elems, int n)
+{
+	int i, num;
+
+	if (!static_branch_unlikely(&qmempool_debug_key))
+		return n;
+	for (i = 0, num = 0; i < n; i++) {
+		if (__qmempool_debug_free(pool, elems[i]))
+			elems[num++] = elems[i];
+	}
+	return num;
+}
+
+/* Memory node of an element, slab objects are in the linear mapping */
+static inline int qmempool_elem_nid(const void *elem)
+{
+	return page_to_nid(virt_to_page(elem));
+}
 
 /* The percpu variables (SPSC queues) needs preempt protection, and
  * the shared MPMC queue also needs protection against the same CPU
@@ -131,9 +397,6 @@ static inline void __qmempool_preempt_enable(int in_serving_softirq)
  */
 static inline void * main_qmempool_alloc(struct qmempool *pool, gfp_t gfp_mask)
 {
-	/* NUMA considerations, for now the numa node is not handles,
-	 * this could be handled via e.g. numa_mem_id()
-	 */
 	void *elem;
 	struct qmempool_percpu *cpu;
 	int num;
@@ -141,15 +404,17 @@ static inline void * main_qmempool_alloc(struct qmempool *pool, gfp_t gfp_mask)
 	/* 1. attempt get element from local per CPU queue */
 	cpu = this_cpu_ptr(pool->percpu);
 	num = alf_sc_dequeue(cpu->localq, (void **)&elem, 1);
-	if (num == 1) /* Succes: alloc elem by deq from localq cpu cache */
-		return elem;
+	if (num == 1) { /* Succes: alloc elem by deq from localq cpu cache */
+		qmempool_stat_inc(pool, localq_hit);
+		return qmempool_debug_alloc(pool, elem);
+	}
 
 	/* 2. attempt get element from shared queue.  This involves
 	 * refilling the localq for next round. Side-effect can be
-	 * alloc from SLAB.
+	 * alloc from SLAB.  Both are node local to this CPU.
 	 */
-	elem = __qmempool_alloc_from_sharedq(pool, gfp_mask, cpu->localq);
-	return elem;
+	elem = __qmempool_alloc_from_sharedq(pool, gfp_mask, cpu);
+	return qmempool_debug_alloc(pool, elem);
 }
 
 static inline void *__qmempool_alloc(struct qmempool *pool, gfp_t gfp_mask)
@@ -175,21 +440,32 @@ static inline void main_qmempool_free(struct qmempool *pool, void *elem)
 	struct qmempool_percpu *cpu;
 	int num;
 
-	/* NUMA considerations, how do we make sure to avoid caching
-	 * elements from a different NUMA node.
-	 */
-
-	/* 1. attempt to free/return element to local per CPU queue */
+	if (!qmempool_debug_free(pool, elem))
+		return;
 	cpu = this_cpu_ptr(pool->percpu);
-	num = alf_sp_enqueue(cpu->localq, &elem, 1);
-	if (num == 1) /* success: element free'ed by enqueue to localq */
+
+	/* 0. elements from another node are not cached in localq, but
+	 * handed back to the owning node (compiled out on !NUMA)
+	 */
+	if (unlikely(nr_node_ids > 1) && qmempool_elem_nid(elem) != cpu->nid) {
+		__qmempool_free_remote(elem, pool, cpu);
 		return;
+	}
+
+	/* 1. attempt to free/return element to local per CPU queue,
+	 * bounded by its adaptive depth
+	 */
+	if (likely(alf_queue_count(cpu->localq) < cpu->depth)) {
+		num = alf_sp_enqueue(cpu->localq, &elem, 1);
+		if (num == 1) /* success: element free'ed by enqueue to localq */
+			return;
+	}
 
 	/* 2. localq cannot store more elements, need to return some
 	 * from localq to sharedq, to make room. Side-effect can be
 	 * free to SLAB.
 	 */
-	__qmempool_free_to_sharedq(elem, pool, cpu->localq);
+	__qmempool_free_to_sharedq(elem, pool, cpu);
 }
 
 static inline void __qmempool_free(struct qmempool *pool, void *elem)
@@ -205,10 +481,262 @@ static inline void __qmempool_free_softirq(struct qmempool *pool, void *elem)
 	main_qmempool_free(pool, elem);
 }
 
+/* Free to owning CPU
+ *
+ * For elements known to be allocated on CPU @owner (e.g. recorded in
+ * the object at alloc time).  Without qmempool_remote_cpu_enable() or
+ * when @owner is this CPU, same as the normal free.
+ */
+static inline void main_qmempool_free_to_cpu(struct qmempool *pool,
+					     void *elem, int owner)
+{
+	if (likely(!pool->remote_cpu || owner == smp_processor_id())) {
+		main_qmempool_free(pool, elem);
+		return;
+	}
+	if (!qmempool_debug_free(pool, elem))
+		return;
+	__qmempool_free_remote_cpu(elem, pool, this_cpu_ptr(pool->percpu),
+				   owner);
+}
+
+static inline void __qmempool_free_to_cpu(struct qmempool *pool, void *elem,
+					  int owner)
+{
+	int state;
+
+	state = __qmempool_preempt_disable();
+	main_qmempool_free_to_cpu(pool, elem, owner);
+	__qmempool_preempt_enable(state);
+}
+
+static inline void __qmempool_free_to_cpu_softirq(struct qmempool *pool,
+						  void *elem, int owner)
+{
+	main_qmempool_free_to_cpu(pool, elem, owner);
+}
+
+/* Bulk alloc and free
+ *
+ * Moves whole batches between the caller's array and localq/sharedq,
+ * e.g. for a NAPI poll allocating 64 buffers per round.  Alloc returns
+ * the number of elements stored in @elems (less than @n only if slab
+ * is depleted).  Free may clobber the @elems array content.
+ *
+ * Like the single element variants, the main_ functions must be
+ * called from a preemptive safe context.
+ */
+static inline int main_qmempool_alloc_bulk(struct qmempool *pool,
+					   void **elems, int n,
+					   gfp_t gfp_mask)
+{
+	struct qmempool_percpu *cpu;
+	int num, i;
+
+	/* 1. take what localq has, a single dequeue */
+	cpu = this_cpu_ptr(pool->percpu);
+	num = alf_sc_dequeue(cpu->localq, elems, n);
+	qmempool_stat_add(pool, localq_hit, num);
+
+	/* 2. remainder straight from sharedq (and slab) into @elems */
+	if (unlikely(num < n))
+		num += __qmempool_alloc_bulk_from_sharedq(pool, gfp_mask, cpu,
+							  &elems[num], n - num);
+
+	if (static_branch_unlikely(&qmempool_debug_key)) {
+		for (i = 0; i < num; i++)
+			__qmempool_debug_alloc(pool, elems[i]);
+	}
+	return num;
+}
+
+static inline void main_qmempool_free_bulk(struct qmempool *pool,
+					   void **elems, int n)
+{
+	struct qmempool_percpu *cpu;
+
+	n = qmempool_debug_free_bulk(pool, elems, n);
+
+	/* 1. all elements fit in localq, a single enqueue */
+	cpu = this_cpu_ptr(pool->percpu);
+	if (likely(nr_node_ids == 1) &&
+	    alf_queue_count(cpu->localq) + n <= cpu->depth &&
+	    alf_sp_enqueue(cpu->localq, elems, n) == n)
+		return;
+
+	/* 2. split off remote elements, overflow to sharedq (and slab) */
+	__qmempool_free_bulk_to_sharedq(pool, cpu, elems, n);
+}
+
+static inline int __qmempool_alloc_bulk(struct qmempool *pool, void **elems,
+					int n, gfp_t gfp_mask)
+{
+	int state, num;
+
+	state = __qmempool_preempt_disable();
+	num   = main_qmempool_alloc_bulk(pool, elems, n, gfp_mask);
+	__qmempool_preempt_enable(state);
+	return num;
+}
+
+static inline int __qmempool_alloc_bulk_softirq(struct qmempool *pool,
+						void **elems, int n,
+						gfp_t gfp_mask)
+{
+	return main_qmempool_alloc_bulk(pool, elems, n, gfp_mask);
+}
+
+static inline void __qmempool_free_bulk(struct qmempool *pool,
+					    void **elems, int n)
+{
+	int state;
+
+	state = __qmempool_preempt_disable();
+	main_qmempool_free_bulk(pool, elems, n);
+	__qmempool_preempt_enable(state);
+}
+
+static inline void __qmempool_free_bulk_softirq(struct qmempool *pool,
+						void **elems, int n)
+{
+	main_qmempool_free_bulk(pool, elems, n);
+}
+
+/* Any context variant
+ *
+ * Fast-path is a this_cpu double-word cmpxchg on the per CPU freelist,
+ * no BH or preempt disable, callable from hardirq, softirq and
+ * (preemptible) process context.  The slow-path (empty/full freelist,
+ * remote node element) runs with IRQs disabled, to move a bulk from/to
+ * sharedq.  Remote node frees are not batched in this variant.
+ *
+ * Don't mix with the softirq API on a pool also used from hardirq, as
+ * the hardirq could interrupt a softirq in the middle of a sharedq
+ * enqueue/dequeue on the same CPU (see alf_mp_enqueue()).
+ */
+extern void *__qmempool_alloc_any_slow(struct qmempool *pool, gfp_t gfp_mask);
+extern void __qmempool_free_any_slow(struct qmempool *pool, void *elem);
+
+static __always_inline unsigned long __qmempool_any_tid(unsigned long tid,
+							int delta)
+{
+	return tid + QMEMPOOL_ANY_TID_STEP + delta;
+}
+
+static __always_inline bool
+__qmempool_any_cmpxchg(struct qmempool *pool, void *o_list,
+		       unsigned long o_tid, void *n_list, unsigned long n_tid)
+{
+#if defined(this_cpu_cmpxchg_qmempool)
+	struct qmempool_any_cpu o = { .freelist = o_list, .tid = o_tid };
+	struct qmempool_any_cpu n = { .freelist = n_list, .tid = n_tid };
+
+	return this_cpu_cmpxchg_qmempool(pool->any->full, o.full, n.full)
+		== o.full;
+#elif defined(QMEMPOOL_ANY_CMPXCHG)
+	return this_cpu_cmpxchg_double(pool->any->freelist, pool->any->tid,
+				       o_list, o_tid, n_list, n_tid);
+#else
+	BUILD_BUG();
+	return false;
+#endif
+}
+
+static inline void *__qmempool_alloc_any(struct qmempool *pool,
+					 gfp_t gfp_mask)
+{
+	unsigned long tid;
+	void *elem, *next;
+
+	if (!qmempool_any_has_cmpxchg())
+		return qmempool_debug_alloc(pool,
+				__qmempool_alloc_any_slow(pool, gfp_mask));
+
+	do {
+		tid  = this_cpu_read(pool->any->tid);
+		barrier(); /* tid before freelist, verified by cmpxchg */
+		elem = this_cpu_read(pool->any->freelist);
+		if (unlikely(!elem))
+			return qmempool_debug_alloc(pool,
+					__qmempool_alloc_any_slow(pool, gfp_mask));
+		/* Can read garbage if elem got popped meanwhile, then
+		 * tid changed and the cmpxchg fails
+		 */
+		next = READ_ONCE(*(void **)elem);
+	} while (unlikely(!__qmempool_any_cmpxchg(pool, elem, tid, next,
+						  __qmempool_any_tid(tid, -1))));
+	qmempool_stat_inc(pool, localq_hit);
+	return qmempool_debug_alloc(pool, elem);
+}
+
+static inline void __qmempool_free_any(struct qmempool *pool, void *elem)
+{
+	unsigned long tid;
+	void *head;
+
+	if (!qmempool_debug_free(pool, elem))
+		return;
+	if (!qmempool_any_has_cmpxchg() ||
+	    (unlikely(nr_node_ids > 1) &&
+	     qmempool_elem_nid(elem) != numa_mem_id())) {
+		__qmempool_free_any_slow(pool, elem);
+		return;
+	}
+
+	do {
+		tid  = this_cpu_read(pool->any->tid);
+		barrier(); /* tid before freelist, verified by cmpxchg */
+		head = this_cpu_read(pool->any->freelist);
+		if (unlikely((tid & QMEMPOOL_ANY_CNT_MASK) >= pool->any_max)) {
+			__qmempool_free_any_slow(pool, elem);
+			return;
+		}
+		WRITE_ONCE(*(void **)elem, head);
+	} while (unlikely(!__qmempool_any_cmpxchg(pool, head, tid, elem,
+						  __qmempool_any_tid(tid, 1))));
+}
+
+/* Page backed pools
+ *
+ * A page is only recycled into the pool when the caller holds the
+ * last reference, else (e.g. still attached to an skb frag) the
+ * reference is dropped and the page leaves the pool.  Pages from the
+ * pfmemalloc reserves are not recycled either (like page_pool).
+ */
+static inline bool __qmempool_page_recyclable(struct page *page)
+{
+	return page_ref_count(page) == 1 && !page_is_pfmemalloc(page);
+}
+
+static inline struct page *__qmempool_alloc_page_softirq(struct qmempool *pool,
+							 gfp_t gfp_mask)
+{
+	void *elem = __qmempool_alloc_softirq(pool, gfp_mask);
+
+	return elem ? virt_to_page(elem) : NULL;
+}
+
+static inline void __qmempool_free_page_softirq(struct qmempool *pool,
+						struct page *page)
+{
+	if (likely(__qmempool_page_recyclable(page)))
+		__qmempool_free_softirq(pool, page_address(page));
+	else
+		put_page(page);
+}
+
 /* API users can choose to use "__" prefixed versions for inlining */
 extern void *qmempool_alloc(struct qmempool *pool, gfp_t gfp_mask);
 extern void *qmempool_alloc_softirq(struct qmempool *pool, gfp_t gfp_mask);
 extern void qmempool_free(struct qmempool *pool, void *elem);
 extern void qmempool_free_softirq(struct qmempool *pool, void *elem);
+extern void qmempool_free_to_cpu(struct qmempool *pool, void *elem, int owner);
+extern int qmempool_alloc_bulk(struct qmempool *pool, void **elems, int n,
+			       gfp_t gfp_mask);
+extern void qmempool_free_bulk(struct qmempool *pool, void **elems, int n);
+extern void *qmempool_alloc_any(struct qmempool *pool, gfp_t gfp_mask);
+extern void qmempool_free_any(struct qmempool *pool, void *elem);
+extern struct page *qmempool_alloc_page(struct qmempool *pool, gfp_t gfp_mask);
+extern void qmempool_free_page(struct qmempool *pool, struct page *page);
 
 #endif /* _LINUX_QMEMPOOL_H */
@@ -0,0 +1,139 @@
+/*
+ * ring_mempool - object pool on top of ring_queue, ala DPDK rte_mempool
+ *
+ * A fixed population of objects, allocated from a kmem_cache when the
+ * pool is created, is stored in a MPMC ring_queue.  Each CPU has a
+ * cache (array of object pointers, used as a LIFO stack) in front of
+ * the ring, and get/put only touch the ring in bulk:
+ *  - get: cache has too few objects, dequeue a cache_size bulk plus
+ *    the request from the ring
+ *  - put: cache exceeds the flush threshold (1.5x cache_size), the
+ *    whole cache is enqueued to the ring
+ * Requests bigger than the cache go directly to the ring.
+ *
+ * Compared to qmempool (alf_queue backed), the pool does not grow or
+ * shrink: get fails with -ENOENT when the ring and the local cache
+ * are empty, even if objects sit in the caches of other CPUs.  Size
+ * the pool for the in-flight objects plus nr_cpus * 1.5 * cache_size.
+ *
+ * Like ring_queue, not preemption safe.  Must be called from softirq
+ * context or with BH disabled, and not from hardirq context.
+ *
+ * Copyright (C) 2014, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#ifndef _LINUX_RING_MEMPOOL_H
+#define _LINUX_RING_MEMPOOL_H
+
+#include <linux/ring_queue.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+/* Max per CPU cache_size, the cache array holds twice this */
+#define RING_MEMPOOL_CACHE_MAX 512
+
+struct ring_mempool_cache {
+	unsigned int size;	/* Copy of pool cache_size */
+	unsigned int flushthresh;
+	unsigned int len;	/* Objects in cache */
+	void *objs[];		/* 2 * size, top of stack at objs[len-1] */
+};
+
+struct ring_mempool {
+	struct ring_queue *ring;
+	struct ring_mempool_cache __percpu *cache; /* NULL if cache_size 0 */
+	unsigned int cache_size;
+	unsigned int size;	/* Objects in pool */
+	struct kmem_cache *kmem;
+};
+
+struct ring_mempool *ring_mempool_create(unsigned int size,
+					 unsigned int cache_size,
+					 struct kmem_cache *kmem,
+					 gfp_t gfp_mask);
+void ring_mempool_destroy(struct ring_mempool *pool);
+unsigned int ring_mempool_avail_count(struct ring_mempool *pool);
+
+/* Get n objects, all or none.
+ *
+ * Return 0 on success, -ENOENT if not enough objects available.
+ */
+static inline int
+ring_mempool_get_bulk(struct ring_mempool *pool, void **obj_table,
+		      unsigned int n)
+{
+	struct ring_mempool_cache *cache;
+	unsigned int req, i;
+
+	if (unlikely(!pool->cache))
+		goto ring_dequeue;
+
+	cache = this_cpu_ptr(pool->cache);
+	if (unlikely(n > cache->size))
+		goto ring_dequeue;
+
+	/* Refill to cache_size on top of the n objects requested */
+	if (cache->len < n) {
+		req = n + (cache->size - cache->len);
+		if (ring_queue_mc_dequeue_bulk(pool->ring,
+					       &cache->objs[cache->len], req))
+			goto ring_dequeue; /* Try without the refill part */
+		cache->len += req;
+	}
+
+	for (i = 0; i < n; i++)
+		obj_table[i] = cache->objs[--cache->len];
+	return 0;
+
+ring_dequeue:
+	return ring_queue_mc_dequeue_bulk(pool->ring, obj_table, n);
+}
+
+/* Put n objects, which must belong to the pool */
+static inline void
+ring_mempool_put_bulk(struct ring_mempool *pool, void * const *obj_table,
+		      unsigned int n)
+{
+	struct ring_mempool_cache *cache;
+	void **cache_objs;
+
+	if (unlikely(!pool->cache))
+		goto ring_enqueue;
+
+	cache = this_cpu_ptr(pool->cache);
+	if (unlikely(n > cache->flushthresh))
+		goto ring_enqueue;
+
+	if (cache->len + n <= cache->flushthresh) {
+		cache_objs = &cache->objs[cache->len];
+		cache->len += n;
+	} else {
+		/* Flush whole cache, keeps ring access a single bulk */
+		ring_queue_mp_enqueue_bulk(pool->ring, cache->objs,
+					   cache->len);
+		cache_objs = &cache->objs[0];
+		cache->len = n;
+	}
+	memcpy(cache_objs, obj_table, sizeof(void *) * n);
+	return;
+
+ring_enqueue:
+	/* Cannot fail, ring holds the full population */
+	ring_queue_mp_enqueue_bulk(pool->ring, obj_table, n);
+}
+
+static inline void *ring_mempool_get(struct ring_mempool *pool)
+{
+	void *obj;
+
+	if (ring_mempool_get_bulk(pool, &obj, 1))
+		return NULL;
+	return obj;
+}
+
+static inline void ring_mempool_put(struct ring_mempool *pool, void *obj)
+{
+	ring_mempool_put_bulk(pool, &obj, 1);
+}
+
+#endif /* _LINUX_RING_MEMPOOL_H */
@@ -108,12 +108,48 @@
 #include <asm/processor.h>  /* cpu_relax() */
 #include <linux/compiler.h> /* barrier() */
 #include <linux/percpu.h>
+#include <linux/cache.h> /* SMP_CACHE_BYTES */
+#include <linux/string.h> /* memcpy() */
+#include <linux/bitops.h>
 
 enum ring_queue_queue_behavior {
 	RING_QUEUE_FIXED = 0, /* Enq/Deq a fixed number of items from a ring */
 	RING_QUEUE_VARIABLE   /* Enq/Deq as many items a possible from ring */
 };
 
+/* Head/tail index slots, placed in the idx[] area of the ring
+ * according to the layout selected at ring_queue_create() time
+ */
+/* Per-CPU counters of MP/MC waits for earlier enqueue/dequeue to
+ * update the tail, kept if created with RING_F_WAIT_STATS
+ */
+struct ring_queue_wait_stats {
+	u64 waits;	/* Times tail was not ready, slow-path taken */
+	u64 rounds;	/* Backoff rounds (cpu_relax() bursts) */
+	u64 yields;	/* Times CPU was yielded */
+	u64 wait_ns;	/* Total time spent waiting */
+};
+
+/* High/low watermark flow control, see ring_queue_set_flow_control() */
+#define RING_FC_CONGESTED	0 /* Bit in state */
+struct ring_queue;
+struct ring_queue_fc {
+	u32 high;		/* Enter congested at >= high elements */
+	u32 low;		/* Leave congested at <= low elements */
+	unsigned long state;
+	void (*notify)(struct ring_queue *r, bool congested, void *data);
+	void *data;
+};
+
+enum ring_queue_idx {
+	RING_IDX_PROD_HEAD = 0,
+	RING_IDX_PROD_TAIL,
+	RING_IDX_CONS_HEAD,
+	RING_IDX_CONS_TAIL,
+	RING_IDX_NR
+};
+#define RING_IDX_PER_LINE (SMP_CACHE_BYTES / sizeof(u32))
+
 /**
  * The ring queue structure.
  *
@@ -123,32 +159,45 @@ enum ring_queue_queue_behavior {
  * field. Thanks to this assumption, we can do subtractions between 2 index
  * values in a modulo-32bit base: that's why the overflow of the indexes is not
  * a problem.
+ *
+ * Read-mostly config (size, mask, watermark, flags) lives on its own
+ * cache-line, and the head/tail indexes in the idx[] area, which is
+ * RING_IDX_NR cache-lines.  The layout flags at creation select the
+ * placement of the indexes inside idx[] (see RING_F_LAYOUT_*):
+ *  - split (default): prod head+tail and cons head+tail on two lines
+ *  - compact: all four indexes on one line (the old non-split layout)
+ *  - pad: every index on its own line
+ * Index access costs a load of the offset from the (hot) config line.
  */
 struct ring_queue {
 	int flags;		/* Flags supplied at creation */
+	u32 esize;		/* Element size, sizeof(void *) unless inline */
 
-	/* Ring producer status */
+	/* Ring producer config */
 	struct prod {
 		u32 watermark;	/* Maximum items before EDQUOT */
 		u32 sp_enqueue;	/* True, if single producer */
 		u32 size;	/* Size of ring */
 		u32 mask;	/* Mask (size-1) of ring */
-		u32 head;	/* Producer head */
-		u32 tail;	/* Producer tail */
-	} prod ____cacheline_aligned_in_smp;
+	} prod;
 
-	/* Ring consumer status */
+	/* Ring consumer config */
 	struct cons {
 		u32 sc_dequeue;	/* True, if single consumer */
 		u32 size;	/* Size of the ring */
 		u32 mask;	/* Mask (size-1) of ring */
-		u32 head;	/* Consumer head */
-		u32 tail;	/* Consumer tail */
-#ifdef CONFIG_LIB_RING_QUEUE_SPLIT_PROD_CONS
-	} cons ____cacheline_aligned_in_smp;
-#else
 	} cons;
-#endif
+
+	u16 off[RING_IDX_NR];	/* Position of head/tail in idx[] */
+
+	/* MP/MC tail wait backoff, see ring_queue_set_backoff() */
+	u16 backoff_pause_max;	/* Max cpu_relax() per round, doubling */
+	u16 backoff_rounds;	/* Rounds before yield (RING_F_WAIT_YIELD) */
+	struct ring_queue_wait_stats __percpu *wait_stats; /* or NULL */
+	struct ring_queue_fc *fc; /* Flow control, or NULL */
+
+	/* Producer/consumer head and tail, placed via off[] */
+	u32 idx[RING_IDX_NR * RING_IDX_PER_LINE] ____cacheline_aligned_in_smp;
 
 	/* Memory space of ring starts here.
 	 * not volatile so need to be careful
@@ -156,14 +205,81 @@ struct ring_queue {
 	void *ring[0] ____cacheline_aligned_in_smp;
 };
 
+static __always_inline u32 *
+__ring_queue_idx(const struct ring_queue *r, enum ring_queue_idx which)
+{
+	return (u32 *)&r->idx[r->off[which]];
+}
+#define RQ_PROD_HEAD(r) (*__ring_queue_idx(r, RING_IDX_PROD_HEAD))
+#define RQ_PROD_TAIL(r) (*__ring_queue_idx(r, RING_IDX_PROD_TAIL))
+#define RQ_CONS_HEAD(r) (*__ring_queue_idx(r, RING_IDX_CONS_HEAD))
+#define RQ_CONS_TAIL(r) (*__ring_queue_idx(r, RING_IDX_CONS_TAIL))
+
 #define RING_F_SP_ENQ 0x0001 /* Flag selects enqueue "single-producer" */
 #define RING_F_SC_DEQ 0x0002 /* Flag selects dequeue "single-consumer" */
+#define RING_F_LAYOUT_COMPACT 0x0004 /* All head/tail on one cache-line */
+#define RING_F_LAYOUT_PAD     0x0008 /* Each head/tail on own cache-line */
+#define RING_F_WAIT_STATS     0x0010 /* Keep per-CPU wait counters */
+#define RING_F_WAIT_YIELD     0x0020 /* Waiters may yield(), process ctx */
 #define RING_QUEUE_QUOT_EXCEED (1 << 31)  /* Quota exceed for burst ops */
 #define RING_QUEUE_SZ_MASK  (unsigned)(0x0fffffff) /* Ring size mask */
 
 struct ring_queue * ring_queue_create(unsigned int count, unsigned int flags);
+struct ring_queue * ring_queue_create_elem(unsigned int count,
+					   unsigned int esize,
+					   unsigned int flags);
 bool ring_queue_free(struct ring_queue *r);
 int ring_queue_set_water_mark(struct ring_queue *r, unsigned count);
+void ring_queue_set_backoff(struct ring_queue *r, unsigned int pause_max,
+			    unsigned int rounds);
+void ring_queue_get_wait_stats(struct ring_queue *r,
+			       struct ring_queue_wait_stats *sum);
+void __ring_queue_wait_tail_slow(struct ring_queue *r, u32 *tail, u32 head);
+int  ring_queue_set_flow_control(struct ring_queue *r, u32 high, u32 low,
+				 void (*notify)(struct ring_queue *r,
+						bool congested, void *data),
+				 void *data);
+void __ring_queue_fc_change(struct ring_queue *r, bool congested);
+
+/* Flow control (hysteresis) checks, after enqueue with the element
+ * count seen by this enqueue, and after dequeue likewise.  Only the
+ * transitions take the out-of-line path.
+ */
+static __always_inline void
+ring_queue_fc_check_enq(struct ring_queue *r, u32 used)
+{
+	struct ring_queue_fc *fc = r->fc;
+
+	if (unlikely(fc) && unlikely(used >= fc->high) &&
+	    !test_bit(RING_FC_CONGESTED, &fc->state))
+		__ring_queue_fc_change(r, true);
+}
+
+static __always_inline void
+ring_queue_fc_check_deq(struct ring_queue *r, u32 used)
+{
+	struct ring_queue_fc *fc = r->fc;
+
+	if (unlikely(fc) && unlikely(used <= fc->low) &&
+	    test_bit(RING_FC_CONGESTED, &fc->state))
+		__ring_queue_fc_change(r, false);
+}
+
+/* Cheap test for producers, e.g. to reduce NAPI budget upstream */
+static inline bool ring_queue_congested(const struct ring_queue *r)
+{
+	return r->fc && test_bit(RING_FC_CONGESTED, &r->fc->state);
+}
+
+/* MP/MC: wait for enqueues/dequeues that preceeded us to update the
+ * tail to our head.  The slow-path backs off, see ring_queue_set_backoff()
+ */
+static __always_inline void
+ring_queue_wait_tail(struct ring_queue *r, u32 *tail, u32 head)
+{
+	if (unlikely(READ_ONCE(*tail) != head))
+		__ring_queue_wait_tail_slow(r, tail, head);
+}
 
 /* the actual enqueue of pointers on the ring.
  * Placed here since identical code needed in both
@@ -239,8 +355,8 @@ __ring_queue_mp_do_enqueue(struct ring_queue *r, void * const *obj_table,
 		/* Reset n to the initial burst count */
 		n = max;
 
-		prod_head = READ_ONCE(r->prod.head);
-		cons_tail = READ_ONCE(r->cons.tail);
+		prod_head = READ_ONCE(RQ_PROD_HEAD(r));
+		cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
 		/* The subtraction is done between two unsigned 32bits value
 		 * (the result is always modulo 32 bits even if we have
 		 * prod_head > cons_tail). So 'free_entries' is always between 0
@@ -262,7 +378,7 @@ __ring_queue_mp_do_enqueue(struct ring_queue *r, void * const *obj_table,
 		}
 
 		prod_next = prod_head + n;
-		success = (cmpxchg(&r->prod.head, prod_head,
+		success = (cmpxchg(&RQ_PROD_HEAD(r), prod_head,
 				   prod_next) == prod_head);
 	} while (unlikely(success == 0));
 	/* smp_rmb() for cons.tail is implicit by cmpxchg */
@@ -281,10 +397,10 @@ __ring_queue_mp_do_enqueue(struct ring_queue *r, void * const *obj_table,
 	/* If there are other enqueues in progress that preceeded us,
 	 * we need to wait for them to complete
 	 */
-	while (unlikely(READ_ONCE(r->prod.tail) != prod_head))
-		cpu_relax();
+	ring_queue_wait_tail(r, &RQ_PROD_TAIL(r), prod_head);
 
-	WRITE_ONCE(r->prod.tail, prod_next);
+	WRITE_ONCE(RQ_PROD_TAIL(r), prod_next);
+	ring_queue_fc_check_enq(r, mask - free_entries + n);
 	return ret;
 }
 
@@ -301,9 +417,9 @@ __ring_queue_sp_do_enqueue(struct ring_queue *r, void * const *obj_table,
 	u32 mask = r->prod.mask;
 	int ret;
 
-	prod_head = READ_ONCE(r->prod.head);
+	prod_head = READ_ONCE(RQ_PROD_HEAD(r));
 	smp_rmb(); /* for cons.tail write, making sure deq loads are done */
-	cons_tail = READ_ONCE(r->cons.tail);
+	cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
 	/* The subtraction is done between two unsigned 32bits value
 	 * (the result is always modulo 32 bits even if we have
 	 * prod_head > cons_tail). So 'free_entries' is always between 0
@@ -325,7 +441,7 @@ __ring_queue_sp_do_enqueue(struct ring_queue *r, void * const *obj_table,
 	}
 
 	prod_next = prod_head + n;
-	WRITE_ONCE(r->prod.head, prod_next);
+	WRITE_ONCE(RQ_PROD_HEAD(r), prod_next);
 
 	ENQUEUE_PTRS(); /* write entries in ring */
 	smp_wmb(); /* matching dequeue LOADs */
@@ -338,7 +454,8 @@ __ring_queue_sp_do_enqueue(struct ring_queue *r, void * const *obj_table,
 		ret = (behavior == RING_QUEUE_FIXED) ? 0 : n;
 	}
 
-	WRITE_ONCE(r->prod.tail, prod_next);
+	WRITE_ONCE(RQ_PROD_TAIL(r), prod_next);
+	ring_queue_fc_check_enq(r, mask - free_entries + n);
 	return ret;
 }
 
@@ -361,8 +478,8 @@ __ring_queue_mc_do_dequeue(struct ring_queue *r, void **obj_table,
 		/* Restore n as it may change every loop */
 		n = max;
 
-		cons_head = READ_ONCE(r->cons.head);
-		prod_tail = READ_ONCE(r->prod.tail);
+		cons_head = READ_ONCE(RQ_CONS_HEAD(r));
+		prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
 		/* The subtraction is done between two unsigned 32bits value
 		 * (the result is always modulo 32 bits even if we have
 		 * cons_head > prod_tail). So 'entries' is always between 0
@@ -383,7 +500,7 @@ __ring_queue_mc_do_dequeue(struct ring_queue *r, void **obj_table,
 		}
 
 		cons_next = cons_head + n;
-		success = (cmpxchg(&r->cons.head, cons_head,
+		success = (cmpxchg(&RQ_CONS_HEAD(r), cons_head,
 				   cons_next) == cons_head);
 	} while (unlikely(success == 0));
 
@@ -393,12 +510,12 @@ __ring_queue_mc_do_dequeue(struct ring_queue *r, void **obj_table,
 	/* If there are other dequeues in progress that preceded us,
 	 * we need to wait for them to complete
 	 */
-	while (unlikely(READ_ONCE(r->cons.tail) != cons_head))
-		cpu_relax();
+	ring_queue_wait_tail(r, &RQ_CONS_TAIL(r), cons_head);
 
 	/* cons.tail must not be visible before dequeue LOADs are finished */
 	smp_wmb();
-	WRITE_ONCE(r->cons.tail, cons_next);
+	WRITE_ONCE(RQ_CONS_TAIL(r), cons_next);
+	ring_queue_fc_check_deq(r, entries - n);
 
 	return behavior == RING_QUEUE_FIXED ? 0 : n;
 }
@@ -415,8 +532,8 @@ __ring_queue_sc_do_dequeue(struct ring_queue *r, void **obj_table,
 	unsigned i;
 	u32 mask = r->prod.mask;
 
-	cons_head = READ_ONCE(r->cons.head);
-	prod_tail = READ_ONCE(r->prod.tail);
+	cons_head = READ_ONCE(RQ_CONS_HEAD(r));
+	prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
 	/* The subtraction is done between two unsigned 32bits value
 	 * (the result is always modulo 32 bits even if we have
 	 * cons_head > prod_tail). So 'entries' is always between 0
@@ -436,14 +553,15 @@ __ring_queue_sc_do_dequeue(struct ring_queue *r, void **obj_table,
 	}
 
 	cons_next = cons_head + n;
-	WRITE_ONCE(r->cons.head, cons_next);
+	WRITE_ONCE(RQ_CONS_HEAD(r), cons_next);
 
 	smp_rmb(); /* matching enqueue STOREs */
 	DEQUEUE_PTRS(); /* copy in table */
 
 	/* cons.tail must not be visible before dequeue LOADs are finished */
 	smp_wmb();
-	WRITE_ONCE(r->cons.tail, cons_next);
+	WRITE_ONCE(RQ_CONS_TAIL(r), cons_next);
+	ring_queue_fc_check_deq(r, entries - n);
 	return behavior == RING_QUEUE_FIXED ? 0 : n;
 }
 
@@ -686,32 +804,32 @@ ring_queue_dequeue(struct ring_queue *r, void **obj_p)
 /* Test if a ring is full */
 static inline int ring_queue_full(const struct ring_queue *r)
 {
-	u32 prod_tail = READ_ONCE(r->prod.tail);
-	u32 cons_tail = READ_ONCE(r->cons.tail);
+	u32 prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
+	u32 cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
 	return (((cons_tail - prod_tail - 1) & r->prod.mask) == 0);
 }
 
 /* Test if a ring is empty */
 static inline int ring_queue_empty(const struct ring_queue *r)
 {
-	u32 prod_tail = READ_ONCE(r->prod.tail);
-	u32 cons_tail = READ_ONCE(r->cons.tail);
+	u32 prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
+	u32 cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
 	return !!(cons_tail == prod_tail);
 }
 
 /* Return the number of entries in a ring */
 static inline unsigned ring_queue_count(const struct ring_queue *r)
 {
-	u32 prod_tail = READ_ONCE(r->prod.tail);
-	u32 cons_tail = READ_ONCE(r->cons.tail);
+	u32 prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
+	u32 cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
 	return ((prod_tail - cons_tail) & r->prod.mask);
 }
 
 /* Return the number of free entries in a ring */
 static inline unsigned ring_queue_free_count(const struct ring_queue *r)
 {
-	u32 prod_tail = READ_ONCE(r->prod.tail);
-	u32 cons_tail = READ_ONCE(r->cons.tail);
+	u32 prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
+	u32 cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
 	return ((cons_tail - prod_tail - 1) & r->prod.mask);
 }
 
@@ -772,4 +890,463 @@ ring_queue_dequeue_burst(struct ring_queue *r, void **obj_table, unsigned n)
 		return ring_queue_mc_dequeue_burst(r, obj_table, n);
 }
 
+/* Head/tail helpers for the zero-copy and inline element APIs below.
+ *
+ * The move_*_head functions claim up to n slots and return the number
+ * claimed, or 0 (RING_QUEUE_FIXED: if not all n are available).  The
+ * update_*_tail functions publish the claim moved from head to next.
+ */
+static __always_inline unsigned
+__ring_queue_mp_move_prod_head(struct ring_queue *r, unsigned n,
+			       enum ring_queue_queue_behavior behavior,
+			       u32 *old_head)
+{
+	u32 prod_head, cons_tail, free_entries;
+	const unsigned max = n;
+	u32 mask = r->prod.mask;
+
+	do {
+		n = max;
+		prod_head = READ_ONCE(RQ_PROD_HEAD(r));
+		cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
+		free_entries = (mask + cons_tail - prod_head);
+		if (unlikely(n > free_entries)) {
+			if (behavior == RING_QUEUE_FIXED || free_entries == 0)
+				return 0;
+			n = free_entries;
+		}
+	} while (unlikely(cmpxchg(&RQ_PROD_HEAD(r), prod_head,
+				  prod_head + n) != prod_head));
+	/* smp_rmb() for cons.tail is implicit by cmpxchg */
+
+	*old_head = prod_head;
+	return n;
+}
+
+static __always_inline unsigned
+__ring_queue_sp_move_prod_head(struct ring_queue *r, unsigned n,
+			       enum ring_queue_queue_behavior behavior,
+			       u32 *old_head)
+{
+	u32 prod_head, cons_tail, free_entries;
+
+	prod_head = READ_ONCE(RQ_PROD_HEAD(r));
+	smp_rmb(); /* for cons.tail write, making sure deq loads are done */
+	cons_tail = READ_ONCE(RQ_CONS_TAIL(r));
+	free_entries = (r->prod.mask + cons_tail - prod_head);
+	if (unlikely(n > free_entries)) {
+		if (behavior == RING_QUEUE_FIXED || free_entries == 0)
+			return 0;
+		n = free_entries;
+	}
+	WRITE_ONCE(RQ_PROD_HEAD(r), prod_head + n);
+
+	*old_head = prod_head;
+	return n;
+}
+
+static __always_inline unsigned
+__ring_queue_mc_move_cons_head(struct ring_queue *r, unsigned n,
+			       enum ring_queue_queue_behavior behavior,
+			       u32 *old_head)
+{
+	u32 cons_head, prod_tail, entries;
+	const unsigned max = n;
+
+	do {
+		n = max;
+		cons_head = READ_ONCE(RQ_CONS_HEAD(r));
+		prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
+		entries = (prod_tail - cons_head);
+		if (unlikely(n > entries)) {
+			if (behavior == RING_QUEUE_FIXED || entries == 0)
+				return 0;
+			n = entries;
+		}
+	} while (unlikely(cmpxchg(&RQ_CONS_HEAD(r), cons_head,
+				  cons_head + n) != cons_head));
+	/* The smp_rmb() is implicit by the cmpxchg's full MB */
+
+	*old_head = cons_head;
+	return n;
+}
+
+static __always_inline unsigned
+__ring_queue_sc_move_cons_head(struct ring_queue *r, unsigned n,
+			       enum ring_queue_queue_behavior behavior,
+			       u32 *old_head)
+{
+	u32 cons_head, prod_tail, entries;
+
+	cons_head = READ_ONCE(RQ_CONS_HEAD(r));
+	prod_tail = READ_ONCE(RQ_PROD_TAIL(r));
+	entries = prod_tail - cons_head;
+	if (unlikely(n > entries)) {
+		if (behavior == RING_QUEUE_FIXED || entries == 0)
+			return 0;
+		n = entries;
+	}
+	WRITE_ONCE(RQ_CONS_HEAD(r), cons_head + n);
+	smp_rmb(); /* matching enqueue STOREs */
+
+	*old_head = cons_head;
+	return n;
+}
+
+static __always_inline void
+__ring_queue_update_prod_tail(struct ring_queue *r, u32 head, u32 next,
+			      bool single)
+{
+	smp_wmb(); /* matching dequeue LOADs */
+
+	/* Wait for claims that preceeded us to be published */
+	if (!single)
+		ring_queue_wait_tail(r, &RQ_PROD_TAIL(r), head);
+
+	WRITE_ONCE(RQ_PROD_TAIL(r), next);
+}
+
+static __always_inline void
+__ring_queue_update_cons_tail(struct ring_queue *r, u32 head, u32 next,
+			      bool single)
+{
+	if (!single)
+		ring_queue_wait_tail(r, &RQ_CONS_TAIL(r), head);
+
+	/* cons.tail must not be visible before LOADs are finished */
+	smp_mb();
+	WRITE_ONCE(RQ_CONS_TAIL(r), next);
+}
+
+/* Zero-copy API: reserve/commit on enqueue and peek/release on dequeue.
+ *
+ * Instead of copying an obj_table into/out of the ring, the caller gets
+ * pointers directly into ring[] via struct ring_queue_zc.  Due to
+ * wrap-around the slots are described as up to two segments, ptr1[0..n1)
+ * followed by ptr2[0..n - n1).
+ *
+ * Every reserve (or peek) returning n > 0 must be followed by exactly
+ * one commit (or release) of the same zc, of the same mode (SP/MP or
+ * SC/MC), before the next reserve (peek) from this context.  In MP/MC
+ * mode, later reservations by other CPUs spin in commit/release until
+ * earlier ones complete, thus keep the window short and do not sleep.
+ * The watermark and flow control are not checked by the zero-copy API.
+ */
+struct ring_queue_zc {
+	void **ptr1;	/* First segment of slots */
+	void **ptr2;	/* Second segment, after wrap, or NULL */
+	u32 n1;		/* Slots in first segment */
+	u32 n;		/* Total slots reserved */
+	u32 head;	/* Index at reserve time */
+	u32 next;	/* Index to publish on commit */
+};
+
+static __always_inline unsigned
+__ring_queue_zc_fill(struct ring_queue *r, u32 head, u32 n,
+		     struct ring_queue_zc *zc)
+{
+	const u32 size = r->prod.size;
+	u32 idx = head & r->prod.mask;
+
+	zc->head = head;
+	zc->next = head + n;
+	zc->n    = n;
+	zc->ptr1 = &r->ring[idx];
+	if (likely(idx + n <= size)) {
+		zc->n1   = n;
+		zc->ptr2 = NULL;
+	} else {
+		zc->n1   = size - idx;
+		zc->ptr2 = &r->ring[0];
+	}
+	return n;
+}
+
+/* Store the i'th element of a reservation */
+static inline void ring_queue_zc_store(struct ring_queue_zc *zc, u32 i,
+				       void *obj)
+{
+	if (likely(i < zc->n1))
+		zc->ptr1[i] = obj;
+	else
+		zc->ptr2[i - zc->n1] = obj;
+}
+
+/* Load the i'th element of a peek */
+static inline void *ring_queue_zc_load(const struct ring_queue_zc *zc, u32 i)
+{
+	if (likely(i < zc->n1))
+		return zc->ptr1[i];
+	return zc->ptr2[i - zc->n1];
+}
+
+/**
+ * Reserve up to n slots for enqueue (multi-producers safe).
+ *
+ * @return
+ *   The number of slots reserved (described in zc), 0 if ring is full.
+ */
+static inline unsigned
+ring_queue_mp_enqueue_reserve(struct ring_queue *r, unsigned n,
+			      struct ring_queue_zc *zc)
+{
+	u32 head;
+
+	n = __ring_queue_mp_move_prod_head(r, n, RING_QUEUE_VARIABLE, &head);
+	return n ? __ring_queue_zc_fill(r, head, n, zc) : 0;
+}
+
+/* Publish slots written via zc, to consumers (multi-producers safe) */
+static inline void
+ring_queue_mp_enqueue_commit(struct ring_queue *r, struct ring_queue_zc *zc)
+{
+	__ring_queue_update_prod_tail(r, zc->head, zc->next, false);
+}
+
+/**
+ * Reserve up to n slots for enqueue (NOT multi-producers safe).
+ *
+ * @return
+ *   The number of slots reserved (described in zc), 0 if ring is full.
+ */
+static inline unsigned
+ring_queue_sp_enqueue_reserve(struct ring_queue *r, unsigned n,
+			      struct ring_queue_zc *zc)
+{
+	u32 head;
+
+	n = __ring_queue_sp_move_prod_head(r, n, RING_QUEUE_VARIABLE, &head);
+	return n ? __ring_queue_zc_fill(r, head, n, zc) : 0;
+}
+
+/* Publish slots written via zc, to consumers (NOT multi-producers safe) */
+static inline void
+ring_queue_sp_enqueue_commit(struct ring_queue *r, struct ring_queue_zc *zc)
+{
+	__ring_queue_update_prod_tail(r, zc->head, zc->next, true);
+}
+
+/**
+ * Peek at up to n elements for dequeue (multi-consumers safe).
+ *
+ * @return
+ *   The number of elements available via zc, 0 if ring is empty.
+ */
+static inline unsigned
+ring_queue_mc_dequeue_peek(struct ring_queue *r, unsigned n,
+			   struct ring_queue_zc *zc)
+{
+	u32 head;
+
+	n = __ring_queue_mc_move_cons_head(r, n, RING_QUEUE_VARIABLE, &head);
+	return n ? __ring_queue_zc_fill(r, head, n, zc) : 0;
+}
+
+/* Give slots read via zc back to producers (multi-consumers safe) */
+static inline void
+ring_queue_mc_dequeue_release(struct ring_queue *r, struct ring_queue_zc *zc)
+{
+	__ring_queue_update_cons_tail(r, zc->head, zc->next, false);
+}
+
+/**
+ * Peek at up to n elements for dequeue (NOT multi-consumers safe).
+ *
+ * @return
+ *   The number of elements available via zc, 0 if ring is empty.
+ */
+static inline unsigned
+ring_queue_sc_dequeue_peek(struct ring_queue *r, unsigned n,
+			   struct ring_queue_zc *zc)
+{
+	u32 head;
+
+	n = __ring_queue_sc_move_cons_head(r, n, RING_QUEUE_VARIABLE, &head);
+	return n ? __ring_queue_zc_fill(r, head, n, zc) : 0;
+}
+
+/* Give slots read via zc back to producers (NOT multi-consumers safe) */
+static inline void
+ring_queue_sc_dequeue_release(struct ring_queue *r, struct ring_queue_zc *zc)
+{
+	__ring_queue_update_cons_tail(r, zc->head, zc->next, true);
+}
+
+/* Inline element mode: rings created by ring_queue_create_elem() store
+ * fixed size elements (r->esize bytes) directly in the ring memory,
+ * instead of void pointers.  Only the *_elem_* functions below may be
+ * used on such a ring (plus count/empty/full helpers).
+ */
+static __always_inline void *
+__ring_queue_elem(struct ring_queue *r, u32 idx)
+{
+	return (char *)r->ring + (size_t)idx * r->esize;
+}
+
+static __always_inline void
+__ring_queue_elem_copy_in(struct ring_queue *r, u32 head,
+			  const void *obj_table, unsigned n)
+{
+	const u32 size = r->prod.size;
+	u32 idx = head & r->prod.mask;
+	u32 n1 = min(n, size - idx);
+
+	memcpy(__ring_queue_elem(r, idx), obj_table, (size_t)n1 * r->esize);
+	if (unlikely(n1 < n))
+		memcpy(__ring_queue_elem(r, 0),
+		       (const char *)obj_table + (size_t)n1 * r->esize,
+		       (size_t)(n - n1) * r->esize);
+}
+
+static __always_inline void
+__ring_queue_elem_copy_out(struct ring_queue *r, u32 head,
+			   void *obj_table, unsigned n)
+{
+	const u32 size = r->cons.size;
+	u32 idx = head & r->cons.mask;
+	u32 n1 = min(n, size - idx);
+
+	memcpy(obj_table, __ring_queue_elem(r, idx), (size_t)n1 * r->esize);
+	if (unlikely(n1 < n))
+		memcpy((char *)obj_table + (size_t)n1 * r->esize,
+		       __ring_queue_elem(r, 0), (size_t)(n - n1) * r->esize);
+}
+
+static __always_inline int
+__ring_queue_do_enqueue_elem(struct ring_queue *r, const void *obj_table,
+			     unsigned n, enum ring_queue_queue_behavior behavior,
+			     bool single)
+{
+	u32 head;
+
+	n = single ?
+		__ring_queue_sp_move_prod_head(r, n, behavior, &head) :
+		__ring_queue_mp_move_prod_head(r, n, behavior, &head);
+	if (unlikely(n == 0))
+		return behavior == RING_QUEUE_FIXED ? -ENOBUFS : 0;
+
+	__ring_queue_elem_copy_in(r, head, obj_table, n);
+	__ring_queue_update_prod_tail(r, head, head + n, single);
+	if (unlikely(r->fc))
+		ring_queue_fc_check_enq(r, READ_ONCE(RQ_PROD_TAIL(r)) -
+					   READ_ONCE(RQ_CONS_TAIL(r)));
+	return behavior == RING_QUEUE_FIXED ? 0 : n;
+}
+
+static __always_inline int
+__ring_queue_do_dequeue_elem(struct ring_queue *r, void *obj_table,
+			     unsigned n, enum ring_queue_queue_behavior behavior,
+			     bool single)
+{
+	u32 head;
+
+	n = single ?
+		__ring_queue_sc_move_cons_head(r, n, behavior, &head) :
+		__ring_queue_mc_move_cons_head(r, n, behavior, &head);
+	if (unlikely(n == 0))
+		return behavior == RING_QUEUE_FIXED ? -ENOENT : 0;
+
+	__ring_queue_elem_copy_out(r, head, obj_table, n);
+	__ring_queue_update_cons_tail(r, head, head + n, single);
+	if (unlikely(r->fc))
+		ring_queue_fc_check_deq(r, READ_ONCE(RQ_PROD_TAIL(r)) -
+					   READ_ONCE(RQ_CONS_TAIL(r)));
+	return behavior == RING_QUEUE_FIXED ? 0 : n;
+}
+
+/**
+ * Enqueue n elements of r->esize bytes, copied from obj_table.
+ *
+ * @return
+ *   - 0: Success; elements enqueued.
+ *   - -ENOBUFS: Not enough room in the ring; no element is enqueued.
+ */
+static inline int
+ring_queue_mp_enqueue_elem_bulk(struct ring_queue *r, const void *obj_table,
+				unsigned n)
+{
+	return __ring_queue_do_enqueue_elem(r, obj_table, n,
+					    RING_QUEUE_FIXED, false);
+}
+
+static inline int
+ring_queue_sp_enqueue_elem_bulk(struct ring_queue *r, const void *obj_table,
+				unsigned n)
+{
+	return __ring_queue_do_enqueue_elem(r, obj_table, n,
+					    RING_QUEUE_FIXED, true);
+}
+
+/**
+ * Dequeue n elements of r->esize bytes, copied into obj_table.
+ *
+ * @return
+ *   - 0: Success; elements dequeued.
+ *   - -ENOENT: Not enough entries in the ring; no element is dequeued.
+ */
+static inline int
+ring_queue_mc_dequeue_elem_bulk(struct ring_queue *r, void *obj_table,
+				unsigned n)
+{
+	return __ring_queue_do_dequeue_elem(r, obj_table, n,
+					    RING_QUEUE_FIXED, false);
+}
+
+static inline int
+ring_queue_sc_dequeue_elem_bulk(struct ring_queue *r, void *obj_table,
+				unsigned n)
+{
+	return __ring_queue_do_dequeue_elem(r, obj_table, n,
+					    RING_QUEUE_FIXED, true);
+}
+
+/* The "*_elem_burst" variants return the number of elements moved */
+static inline int
+ring_queue_mp_enqueue_elem_burst(struct ring_queue *r, const void *obj_table,
+				 unsigned n)
+{
+	return __ring_queue_do_enqueue_elem(r, obj_table, n,
+					    RING_QUEUE_VARIABLE, false);
+}
+
+static inline int
+ring_queue_sp_enqueue_elem_burst(struct ring_queue *r, const void *obj_table,
+				 unsigned n)
+{
+	return __ring_queue_do_enqueue_elem(r, obj_table, n,
+					    RING_QUEUE_VARIABLE, true);
+}
+
+static inline int
+ring_queue_mc_dequeue_elem_burst(struct ring_queue *r, void *obj_table,
+				 unsigned n)
+{
+	return __ring_queue_do_dequeue_elem(r, obj_table, n,
+					    RING_QUEUE_VARIABLE, false);
+}
+
+static inline int
+ring_queue_sc_dequeue_elem_burst(struct ring_queue *r, void *obj_table,
+				 unsigned n)
+{
+	return __ring_queue_do_dequeue_elem(r, obj_table, n,
+					    RING_QUEUE_VARIABLE, true);
+}
+
+static inline int
+ring_queue_enqueue_elem_bulk(struct ring_queue *r, const void *obj_table,
+			     unsigned n)
+{
+	return __ring_queue_do_enqueue_elem(r, obj_table, n, RING_QUEUE_FIXED,
+					    r->prod.sp_enqueue);
+}
+
+static inline int
+ring_queue_dequeue_elem_bulk(struct ring_queue *r, void *obj_table,
+			     unsigned n)
+{
+	return __ring_queue_do_dequeue_elem(r, obj_table, n, RING_QUEUE_FIXED,
+					    r->cons.sc_dequeue);
+}
+
 #endif /* _LINUX_RING_QUEUE_H */
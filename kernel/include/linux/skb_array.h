@@ -59,6 +59,30 @@ static inline int skb_array_produce_any(struct skb_array *a, struct sk_buff *skb
 	return ptr_ring_produce_any(&a->ring, skb);
 }
 
+static inline int skb_array_produce_batched(struct skb_array *a,
+					    struct sk_buff **array, int n)
+{
+	return ptr_ring_produce_batched(&a->ring, (void **)array, n);
+}
+
+static inline int skb_array_produce_batched_irq(struct skb_array *a,
+						struct sk_buff **array, int n)
+{
+	return ptr_ring_produce_batched_irq(&a->ring, (void **)array, n);
+}
+
+static inline int skb_array_produce_batched_bh(struct skb_array *a,
+					       struct sk_buff **array, int n)
+{
+	return ptr_ring_produce_batched_bh(&a->ring, (void **)array, n);
+}
+
+static inline int skb_array_produce_batched_any(struct skb_array *a,
+						struct sk_buff **array, int n)
+{
+	return ptr_ring_produce_batched_any(&a->ring, (void **)array, n);
+}
+
 /* Might be slightly faster than skb_array_empty below, but only safe if the
  * array is never resized. Also, callers invoking this in a loop must take care
  * to use a compiler barrier, for example cpu_relax().
@@ -143,6 +167,81 @@ static inline int skb_array_consume_batched_bh(struct skb_array *a,
 	return ptr_ring_consume_batched_bh(&a->ring, (void **)array, n);
 }
 
+/* Batched consume, that prefetch the skb heads of the next @dist
+ * entries left in the ring.  With @data also prefetch skb->data of the
+ * returned batch, whose heads got prefetched by the previous call.
+ * The prefetch distance should cover the consumer work per batch.
+ */
+static inline int __skb_array_consume_batched_prefetch(struct skb_array *a,
+							struct sk_buff **array,
+							int n, int dist,
+							bool data)
+{
+	int i, cnt;
+
+	cnt = __ptr_ring_consume_batched(&a->ring, (void **)array, n);
+	if (dist)
+		__ptr_ring_prefetch_ahead(&a->ring, dist);
+	if (data) {
+		for (i = 0; i < cnt; i++)
+			prefetch(array[i]->data);
+	}
+	return cnt;
+}
+
+static inline int skb_array_consume_batched_prefetch(struct skb_array *a,
+						     struct sk_buff **array,
+						     int n, int dist, bool data)
+{
+	int ret;
+
+	spin_lock(&a->ring.consumer_lock);
+	ret = __skb_array_consume_batched_prefetch(a, array, n, dist, data);
+	spin_unlock(&a->ring.consumer_lock);
+
+	return ret;
+}
+
+static inline int skb_array_consume_batched_prefetch_bh(struct skb_array *a,
+							struct sk_buff **array,
+							int n, int dist,
+							bool data)
+{
+	int ret;
+
+	spin_lock_bh(&a->ring.consumer_lock);
+	ret = __skb_array_consume_batched_prefetch(a, array, n, dist, data);
+	spin_unlock_bh(&a->ring.consumer_lock);
+
+	return ret;
+}
+
+/* Lockless SPSC mode, see ptr_ring_produce_spsc() for the rules */
+static inline int skb_array_produce_spsc(struct skb_array *a,
+					 struct sk_buff *skb)
+{
+	return ptr_ring_produce_spsc(&a->ring, skb);
+}
+
+static inline struct sk_buff *skb_array_consume_spsc(struct skb_array *a)
+{
+	return ptr_ring_consume_spsc(&a->ring);
+}
+
+static inline int skb_array_consume_batched_spsc(struct skb_array *a,
+						 struct sk_buff **array, int n)
+{
+	return ptr_ring_consume_batched_spsc(&a->ring, (void **)array, n);
+}
+
+static inline int
+skb_array_consume_batched_prefetch_spsc(struct skb_array *a,
+					struct sk_buff **array,
+					int n, int dist, bool data)
+{
+	return __skb_array_consume_batched_prefetch(a, array, n, dist, data);
+}
+
 static inline int __skb_array_len_with_tag(struct sk_buff *skb)
 {
 	if (likely(skb)) {
@@ -182,6 +281,18 @@ static inline int skb_array_init(struct skb_array *a, int size, gfp_t gfp)
 	return ptr_ring_init(&a->ring, size, gfp);
 }
 
+static inline int skb_array_init_batch(struct skb_array *a, int size,
+				       int batch, gfp_t gfp)
+{
+	return ptr_ring_init_batch(&a->ring, size, batch, gfp);
+}
+
+static inline void skb_array_get_stats(struct skb_array *a,
+				       struct ptr_ring_stats *st)
+{
+	ptr_ring_get_stats(&a->ring, st);
+}
+
 static void __skb_array_destroy_skb(void *ptr)
 {
 	kfree_skb(ptr);
@@ -208,6 +319,16 @@ static inline int skb_array_resize_multiple(struct skb_array **rings,
 					__skb_array_destroy_skb);
 }
 
+/* Lazy variant, see ptr_ring_resize_multiple_lazy() */
+static inline int skb_array_resize_multiple_lazy(struct skb_array **rings,
+						 int nrings, unsigned int size,
+						 gfp_t gfp)
+{
+	BUILD_BUG_ON(offsetof(struct skb_array, ring));
+	return ptr_ring_resize_multiple_lazy((struct ptr_ring **)rings,
+					     nrings, size, gfp);
+}
+
 static inline void skb_array_cleanup(struct skb_array *a)
 {
 	ptr_ring_cleanup(&a->ring, __skb_array_destroy_skb);
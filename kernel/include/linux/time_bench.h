@@ -7,11 +7,58 @@
 #ifndef _LINUX_TIME_BENCH_H
 #define _LINUX_TIME_BENCH_H
 
+#include <linux/timex.h> /* get_cycles() */
+#include <linux/ktime.h>
+#include <linux/list.h>
+
+struct module;
+
+/* Optional per-iteration latency histogram (log-linear buckets)
+ *
+ * Values below TIME_BENCH_HIST_SUB are recorded exactly, above that
+ * each power-of-two range is split into TIME_BENCH_HIST_SUB linear
+ * sub-buckets, giving approx 12.5% worst-case relative error.
+ * Values at or above 2^TIME_BENCH_HIST_MAX_BITS end in the last bucket
+ * (the exact max is tracked separately).
+ */
+#define TIME_BENCH_HIST_SUB_BITS	3
+#define TIME_BENCH_HIST_SUB		(1 << TIME_BENCH_HIST_SUB_BITS)
+#define TIME_BENCH_HIST_MAX_BITS	40
+#define TIME_BENCH_HIST_BUCKETS	\
+	((TIME_BENCH_HIST_MAX_BITS - TIME_BENCH_HIST_SUB_BITS + 1) * \
+	 TIME_BENCH_HIST_SUB)
+
+struct time_bench_hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[TIME_BENCH_HIST_BUCKETS];
+
+	/* Derived result records (in cycles) */
+	uint64_t p50, p99, p999;
+};
+
+/* Selectable PMU events, configured via perf_event kernel counters.
+ * Bit number in time_bench "pmu_events" mask (see lib/time_bench.c)
+ */
+enum time_bench_pmu_event {
+	TIME_BENCH_PMU_CYCLES = 0,
+	TIME_BENCH_PMU_INSTRUCTIONS,
+	TIME_BENCH_PMU_LLC_MISSES,
+	TIME_BENCH_PMU_BRANCH_MISSES,
+	TIME_BENCH_PMU_L1D_MISSES,
+	TIME_BENCH_PMU_DTLB_MISSES,
+	TIME_BENCH_PMU_STALLS_BACKEND,
+	TIME_BENCH_PMU_NR	/* Last */
+};
+
+struct perf_event;
+
 /* Main structure used for recording a benchmark run */
 struct time_bench_record
 {
 	uint32_t version_abi;
-	uint32_t loops;		/* Requested loop invocations */
+	uint64_t loops;		/* Requested loop invocations */
 	uint32_t step;		/* option for e.g. bulk invocations */
 
 	uint32_t flags; 	/* Measurements types enabled */
@@ -19,8 +66,14 @@ struct time_bench_record
 #define TIME_BENCH_TSC		(1<<1)
 #define TIME_BENCH_WALLCLOCK	(1<<2)
 #define TIME_BENCH_PMU		(1<<3)
+#define TIME_BENCH_HIST		(1<<4)
+#define TIME_BENCH_PMU_EVENTS	(1<<5)
+#define TIME_BENCH_STEP_BYTES	(1<<6) /* Bench declares step as bytes-per-op */
+#define TIME_BENCH_NOISE	(1<<7)
+#define TIME_BENCH_FREQ		(1<<8)
 
 	uint32_t cpu; /* Used when embedded in time_bench_cpu */
+	uint32_t cpu_idx; /* Index of CPU within cpumask of concurrent run */
 
 	/* Records */
 	uint64_t invoked_cnt; 	/* Returned actual invocations */
@@ -47,12 +100,56 @@ struct time_bench_record
 	uint64_t time_sec;
 	uint32_t time_sec_remainder;
 	uint64_t pmc_ipc_quotient, pmc_ipc_decimal; /* inst per cycle */
+	/* Throughput, derived from invoked_cnt and wallclock time */
+	uint64_t ops_per_sec;
+	uint64_t bytes_per_sec; /* Only if TIME_BENCH_STEP_BYTES */
+
+	/* PMU event counters via perf_event, if TIME_BENCH_PMU_EVENTS */
+	uint32_t pmu_mask;	/* Bitmask of enum time_bench_pmu_event */
+	struct perf_event *pmu_evt[TIME_BENCH_PMU_NR];
+	uint64_t pmu_start[TIME_BENCH_PMU_NR];
+	uint64_t pmu_stop[TIME_BENCH_PMU_NR];
+	uint64_t pmu_delta[TIME_BENCH_PMU_NR];
+	uint64_t pmu_per_call_quotient[TIME_BENCH_PMU_NR];
+	uint64_t pmu_per_call_decimal[TIME_BENCH_PMU_NR];
+
+	/* Interference (noise) detection, if TIME_BENCH_NOISE */
+	int noise_cpu;		/* CPU at time_bench_start() */
+	uint64_t irqs_start, softirqs_start, ctxsw_start;
+	uint64_t irqs, softirqs, ctxsw; /* During measurement period */
+	bool migrated;
+
+	/* Effective core frequency, if TIME_BENCH_FREQ (x86 APERF/MPERF).
+	 * Without it, derived from PMU cycles event if enabled.
+	 */
+	uint64_t aperf_start, mperf_start;
+	uint64_t aperf, mperf;	/* During measurement period */
+	uint64_t core_cycles;	/* Actual core cycles per call */
+	uint32_t freq_mhz;	/* Average core frequency while running */
+	uint32_t c0_permille;	/* Time not idle (in C0), MPERF vs TSC */
+
+	/* Per-iteration latency histogram, only valid if TIME_BENCH_HIST
+	 * is set.  Storage is owned by time_bench (per CPU) and is valid
+	 * until the next benchmark run on that CPU.
+	 */
+	struct time_bench_hist *hist;
 };
 
-/* For synchronizing parallel CPUs to run concurrently */
+/* For synchronizing parallel CPUs to run concurrently
+ *
+ * Default release of all CPUs happens via a completion, which wakes
+ * CPUs with scheduler latency skew.  In spin-barrier mode (time_bench
+ * module parameter "spin_start") all CPUs instead spin on a shared
+ * generation counter, which the last CPU to arrive increments.
+ */
 struct time_bench_sync {
 	atomic_t nr_tests_running;
 	struct completion start_event;
+	/* Spin-barrier release mode */
+	bool spin_release;
+	int nr_cpus;		/* CPUs participating */
+	atomic_t nr_arrived;	/* Only incremented, launcher waits on it */
+	unsigned int start_gen;
 };
 
 /* Keep track of CPUs executing our bench function.
@@ -76,12 +173,12 @@ struct time_bench_cpu {
 
 /*
  * Below TSC assembler code is not compatible with other archs, and
- * can also fail on guests if cpu-flags are not correct.
+ * can also fail on guests if cpu-flags are not correct.  Thus, it is
+ * only used on x86_64, and the clock backend can be changed at load
+ * time (see enum time_bench_clock_type).
  *
  * The way TSC reading is used, many iterations, does not require as
  * high accuracy as described below (in Intel Doc #324264).
- *
- * Considering changing to use get_cycles() (#include <asm/timex.h>).
  */
 
 /** TSC (Time-Stamp Counter) based **
@@ -96,11 +193,16 @@ struct time_bench_cpu {
  *   raw_local_irq_restore(flags);
  *   preempt_enable();
  *
+ * The time_bench module parameter "exclusive" applies this pattern
+ * around the bench function, for both time_bench_loop() and
+ * time_bench_run_concurrent().
+ *
  * Clobbered registers: "%rax", "%rbx", "%rcx", "%rdx"
  *  RDTSC only change "%rax" and "%rdx" but
  *  CPUID clears the high 32-bits of all (rax/rbx/rcx/rdx)
  */
-static __always_inline uint64_t tsc_start_clock(void) {
+#if defined(CONFIG_X86_64)
+static __always_inline uint64_t native_start_clock(void) {
 	/* See: Intel Doc #324264 */
 	unsigned hi, lo;
 	asm volatile (
@@ -109,11 +211,10 @@ static __always_inline uint64_t tsc_start_clock(void) {
 		"mov %%edx, %0\n\t"
 		"mov %%eax, %1\n\t": "=r" (hi), "=r" (lo)::
 		"%rax", "%rbx", "%rcx", "%rdx");
-	//FIXME: on 32bit use clobbered %eax + %edx
 	return ((uint64_t)lo) | (((uint64_t)hi) << 32);
 }
 
-static __always_inline uint64_t tsc_stop_clock(void) {
+static __always_inline uint64_t native_stop_clock(void) {
 	/* See: Intel Doc #324264 */
 	unsigned hi, lo;
 	asm volatile(
@@ -124,6 +225,74 @@ static __always_inline uint64_t tsc_stop_clock(void) {
 		"%rax", "%rbx", "%rcx", "%rdx");
 	return ((uint64_t)lo) | (((uint64_t)hi) << 32);
 }
+#elif defined(CONFIG_ARM64)
+/** ARM64 virtual counter (CNTVCT_EL0) **
+ * The ISB prevents the counter read from being speculated ahead of
+ * (or delayed past) the code being measured.  Notice this counter
+ * runs at a fixed frequency (CNTFRQ_EL0), not the CPU clock, see
+ * calibration in lib/time_bench.c.
+ */
+static __always_inline uint64_t native_start_clock(void) {
+	uint64_t val;
+
+	asm volatile("isb\n\t"
+		     "mrs %0, cntvct_el0\n\t"
+		     "isb\n\t" : "=r" (val) :: "memory");
+	return val;
+}
+
+static __always_inline uint64_t native_stop_clock(void) {
+	return native_start_clock();
+}
+#else
+static __always_inline uint64_t native_start_clock(void) {
+	return get_cycles();
+}
+
+static __always_inline uint64_t native_stop_clock(void) {
+	return get_cycles();
+}
+#endif
+
+/** Pluggable clock backend **
+ *
+ * The "tsc" records are taken from the clock backend selected by the
+ * time_bench module parameter "clock" (at load time), defaulting to
+ * TIME_BENCH_CLOCK_DEFAULT which can be overridden at build time.
+ * The native backend is automatically avoided on x86 if the CPU (or
+ * guest) does not advertise TSC+RDTSCP.  Frequency of the selected
+ * counter gets calibrated, see time_bench_clock_khz(), making the
+ * cycle numbers comparable across architectures.
+ */
+enum time_bench_clock_type {
+	TIME_BENCH_CLOCK_NATIVE = 0,	/* RDTSC(P) on x86, CNTVCT_EL0 arm64 */
+	TIME_BENCH_CLOCK_GET_CYCLES,	/* get_cycles() */
+	TIME_BENCH_CLOCK_KTIME,		/* ktime_get_ns() always works */
+};
+
+#ifndef TIME_BENCH_CLOCK_DEFAULT
+#define TIME_BENCH_CLOCK_DEFAULT TIME_BENCH_CLOCK_NATIVE
+#endif
+
+extern int time_bench_clock;
+uint32_t time_bench_clock_khz(void);
+const char *time_bench_clock_name(void);
+
+static __always_inline uint64_t tsc_start_clock(void) {
+	if (likely(time_bench_clock == TIME_BENCH_CLOCK_NATIVE))
+		return native_start_clock();
+	if (time_bench_clock == TIME_BENCH_CLOCK_GET_CYCLES)
+		return get_cycles();
+	return ktime_get_ns();
+}
+
+static __always_inline uint64_t tsc_stop_clock(void) {
+	if (likely(time_bench_clock == TIME_BENCH_CLOCK_NATIVE))
+		return native_stop_clock();
+	if (time_bench_clock == TIME_BENCH_CLOCK_GET_CYCLES)
+		return get_cycles();
+	return ktime_get_ns();
+}
 
 /* Notes for RDTSC and RDTSCP
  *
@@ -173,6 +342,19 @@ inline uint64_t rdtsc(void)
 
 bool time_bench_PMU_config(bool enable);
 
+/* Generalized PMU event counters via perf_event kernel counters
+ *
+ * Counters get created for the task running the benchmark, and
+ * events are selected via bitmask of enum time_bench_pmu_event.
+ * Reading happens via perf_event_read_value(), which can sleep, thus
+ * time_bench_start()/time_bench_stop() must be called from sleepable
+ * context when TIME_BENCH_PMU_EVENTS is enabled.
+ */
+void time_bench_pmu_set_events(uint32_t mask);
+bool time_bench_pmu_setup(struct time_bench_record *rec);
+void time_bench_pmu_teardown(struct time_bench_record *rec);
+void time_bench_pmu_read(struct time_bench_record *rec, uint64_t *vals);
+
 /* Raw reading via rdpmc() using fixed counters
  *
  * From: https://github.com/andikleen/simple-pmu
@@ -184,6 +366,7 @@ enum {
 	FIXED_CPU_CLK_UNHALTED_REF  = 2,
 };
 
+#ifdef CONFIG_X86
 static __always_inline unsigned long long p_rdpmc(unsigned in)
 {
 	unsigned d, a;
@@ -218,48 +401,223 @@ inline uint64_t msr_inst(unsigned long long *msr_result)
 {
 	return rdmsrl_safe(MSR_IA32_PCM0, msr_result);
 }
+#else
+/* Raw fixed counters not supported, use TIME_BENCH_PMU_EVENTS */
+static __always_inline unsigned long long pmc_inst(void) { return 0; }
+static __always_inline unsigned long long pmc_clk(void)  { return 0; }
+#endif /* CONFIG_X86 */
+
+
+/** Interrupt/preemption noise detection **
+ *
+ * Snapshot per-CPU IRQ and softirq counters, plus context switches of
+ * the task, at start/stop of the measurement period.  Timer ticks and
+ * the tick related softirqs are expected, and are not counted as
+ * interference.
+ */
+void time_bench_noise_start(struct time_bench_record *rec);
+void time_bench_noise_stop(struct time_bench_record *rec);
+bool time_bench_noise_detected(struct time_bench_record *rec);
 
+/** Core frequency and C-state normalization **
+ *
+ * TSC cycles tick at a fixed rate, thus with turbo or power-saving
+ * frequency scaling they differ from the cycles the core actually
+ * spent.  On x86 the APERF (actual) and MPERF (TSC rate, C0 only)
+ * MSRs are read at start/stop, giving core cycles per call, the
+ * average effective frequency and how much of the period the CPU
+ * was idle (C-states).  Enabled via time_bench module parameter
+ * "freq", when the CPU advertises APERFMPERF.
+ */
+void time_bench_freq_start(struct time_bench_record *rec);
+void time_bench_freq_stop(struct time_bench_record *rec);
 
 /** Generic functions **
  */
-bool time_bench_loop(uint32_t loops, int step, char *txt, void *data,
+bool time_bench_loop(uint64_t loops, int step, char *txt, void *data,
 		     int (*func)(struct time_bench_record *rec, void *data)
 	);
+/* Max @repeat, the per repetition samples live on the stack, as
+ * benches can run in softirq (tasklet) context
+ */
+#define TIME_BENCH_REPEAT_MAX	32
+bool time_bench_loop_repeat(uint64_t loops, int step, char *txt, void *data,
+			    int (*func)(struct time_bench_record *rec,
+					void *data),
+			    int warmup, int repeat);
 bool time_bench_calc_stats(struct time_bench_record *rec);
 
 void time_bench_run_concurrent(
-		uint32_t loops, int step, void* data,
+		uint64_t loops, int step, void* data,
 		const struct cpumask *mask, /* Support masking outsome CPUs*/
 		struct time_bench_sync *sync,
 		struct time_bench_cpu *cpu_tasks,
 		int (*func)(struct time_bench_record *record, void *data)
 	);
+/* Topology aware selection of CPUs for parallel benchmarks
+ *
+ * @topology: NULL/"" or "first" = first @nr_cpus online CPUs
+ *            "core"  = one CPU per physical core (skip SMT siblings)
+ *            "smt"   = SMT siblings of a core before the next core, thus
+ *                      consecutive CPUs (cpu_idx pairs) share a core
+ *            "node"  = CPUs on the same NUMA node
+ *            "cross" = round-robin across NUMA nodes, thus consecutive
+ *                      CPUs (cpu_idx even/odd pairs) are cross node
+ *            else parsed as explicit cpulist, e.g. "0,2,8-11"
+ * @nr_cpus: limit number of CPUs, zero means all matching CPUs
+ *
+ * Returns number of CPUs selected, or negative errno.
+ */
+int time_bench_cpumask_select(struct cpumask *mask, const char *topology,
+			      int nr_cpus);
+void time_bench_print_topology(const char *desc, const struct cpumask *mask);
+
 void time_bench_print_stats_cpumask(const char *desc,
 				    struct time_bench_cpu *cpu_tasks,
 				    const struct cpumask *mask);
 
+/** Runtime triggerable benchmarks **
+ *
+ * Bench modules register an array of named benches, which then can be
+ * listed, tuned and (re)run via the debugfs file:
+ *   /sys/kernel/debug/time_bench/control
+ *
+ * Reading lists "<module>/<name> loops step cpu runs".  Commands:
+ *   run <module>/<name> [loops=N] [step=N] [cpu=N] [repeat=N]
+ *   set <module>/<name> [loops=N] [step=N] [cpu=N]
+ * where "run" overrides only apply to that run and "set" changes the
+ * defaults.  cpu=-1 runs on the CPU of the writer.  Results get
+ * exported via the "results" file as any time_bench_loop() run.
+ *
+ * The bench func must be safe to invoke repeatedly, with all state it
+ * needs (passed via data) staying valid until unregister.
+ */
+struct time_bench_entry {
+	const char	*name;
+	uint64_t	loops;
+	int		step;
+	void		*data;
+	int (*func)(struct time_bench_record *rec, void *data);
+	/* Private, set by time_bench_register() */
+	int		cpu;
+	uint64_t	runs;
+	struct module	*owner;
+	struct list_head list;
+};
+
+int __time_bench_register(struct time_bench_entry *benches, int nr,
+			  struct module *owner);
+#define time_bench_register(benches, nr) \
+	__time_bench_register(benches, nr, THIS_MODULE)
+void time_bench_unregister(struct time_bench_entry *benches, int nr);
+
 //FIXME: use rec->flags to select measurement, should be MACRO
 static __always_inline void
 time_bench_start(struct time_bench_record *rec) {
+	if (rec->flags & TIME_BENCH_NOISE)
+		time_bench_noise_start(rec);
 	//getnstimeofday(&rec->ts_start);
 	ktime_get_real_ts64(&rec->ts_start);
+	if (rec->flags & TIME_BENCH_PMU_EVENTS)
+		time_bench_pmu_read(rec, rec->pmu_start);
 	if (rec->flags & TIME_BENCH_PMU) {
 		rec->pmc_inst_start = pmc_inst();
 		rec->pmc_clk_start  = pmc_clk();
 	}
+	if (rec->flags & TIME_BENCH_FREQ)
+		time_bench_freq_start(rec);
 	rec->tsc_start = tsc_start_clock();
 }
 
 static __always_inline void
 time_bench_stop(struct time_bench_record *rec, uint64_t invoked_cnt) {
 	rec->tsc_stop = tsc_stop_clock();
+	if (rec->flags & TIME_BENCH_FREQ)
+		time_bench_freq_stop(rec);
 	if (rec->flags & TIME_BENCH_PMU) {
 		rec->pmc_inst_stop = pmc_inst();
 		rec->pmc_clk_stop  = pmc_clk();
 	}
+	if (rec->flags & TIME_BENCH_PMU_EVENTS)
+		time_bench_pmu_read(rec, rec->pmu_stop);
 	//getnstimeofday(&rec->ts_stop);
 	ktime_get_real_ts64(&rec->ts_stop);
+	if (rec->flags & TIME_BENCH_NOISE)
+		time_bench_noise_stop(rec);
 	rec->invoked_cnt = invoked_cnt;
 }
 
+/** Latency histogram sample hooks **
+ *
+ * Bench functions can feed the histogram per iteration like:
+ *
+ *	for (i = 0; i < rec->loops; i++) {
+ *		uint64_t t = time_bench_hist_begin(rec);
+ *		_your_code_
+ *		time_bench_hist_end(rec, t);
+ *	}
+ *
+ * When histogram mode is not enabled (module parameter "hist" of
+ * time_bench) these reduce to testing a flag.  Samples are taken from
+ * the same clock backend as the "tsc" records (module parameter
+ * "clock").  Notice reading the clock per iteration adds overhead,
+ * thus numbers are most meaningful for operations well above the
+ * cost of a clock read.
+ *
+ * Modules can also keep their own histograms (e.g. one per phase of
+ * a stress test), via time_bench_hist_init(), time_bench_hist_add()
+ * and time_bench_hist_calc() deriving the p50/p99/p99.9 records.
+ */
+void time_bench_hist_init(struct time_bench_hist *h);
+void time_bench_hist_calc(struct time_bench_hist *h);
+
+static __always_inline unsigned int time_bench_hist_idx(uint64_t val)
+{
+	unsigned int msb, shift;
+
+	if (val < TIME_BENCH_HIST_SUB)
+		return val;
+
+	msb = fls64(val) - 1;
+	if (msb >= TIME_BENCH_HIST_MAX_BITS)
+		return TIME_BENCH_HIST_BUCKETS - 1;
+
+	shift = msb - TIME_BENCH_HIST_SUB_BITS;
+	return ((shift + 1) << TIME_BENCH_HIST_SUB_BITS) +
+		((val >> shift) & (TIME_BENCH_HIST_SUB - 1));
+}
+
+static __always_inline void
+time_bench_hist_add(struct time_bench_hist *hist, uint64_t val)
+{
+	hist->buckets[time_bench_hist_idx(val)]++;
+	hist->count++;
+	if (val > hist->max)
+		hist->max = val;
+	if (val < hist->min)
+		hist->min = val;
+}
+
+static __always_inline void
+time_bench_hist_sample(struct time_bench_record *rec, uint64_t cycles)
+{
+	if (rec->flags & TIME_BENCH_HIST)
+		time_bench_hist_add(rec->hist, cycles);
+}
+
+static __always_inline uint64_t
+time_bench_hist_begin(struct time_bench_record *rec)
+{
+	if (rec->flags & TIME_BENCH_HIST)
+		return tsc_start_clock();
+	return 0;
+}
+
+static __always_inline void
+time_bench_hist_end(struct time_bench_record *rec, uint64_t begin)
+{
+	if (rec->flags & TIME_BENCH_HIST)
+		time_bench_hist_add(rec->hist, tsc_stop_clock() - begin);
+}
+
 #endif /* _LINUX_TIME_BENCH_H */
@@ -50,7 +50,7 @@
  * Legend:
  * [1] wfcq_enqueue
  * [2] __wfcq_splice (destination queue)
- * [3] __wfcq_dequeue
+ * [3] __wfcq_dequeue, __wfcq_dequeue_nonblocking, __wfcq_dequeue_bulk
  * [4] __wfcq_splice (source queue)
  * [5] __wfcq_first
  * [6] __wfcq_next
@@ -71,12 +71,19 @@
 /*
  * Load a data from shared memory.
  */
-#define CMM_LOAD_SHARED(p)		ACCESS_ONCE(p)
+#define CMM_LOAD_SHARED(p)		READ_ONCE(p)
 
 /*
  * Identify a shared store.
  */
-#define CMM_STORE_SHARED(x, v)		({ ACCESS_ONCE(x) = (v); })
+#define CMM_STORE_SHARED(x, v)		WRITE_ONCE(x, v)
+
+/* Removed in v5.9, where READ_ONCE() provides dependency ordering */
+#ifndef smp_read_barrier_depends
+#define smp_read_barrier_depends()	do { } while (0)
+#endif
+
+#define WFCQ_WOULDBLOCK		((struct wfcq_node *) -1UL)
 
 enum wfcq_ret {
 	WFCQ_RET_DEST_EMPTY	= 0,
@@ -346,6 +353,99 @@ __wfcq_dequeue(struct wfcq_head *head, struct wfcq_tail *tail)
 	return node;
 }
 
+/*
+ * __wfcq_dequeue_nonblocking: dequeue a node from the queue, without
+ * busy-waiting.
+ *
+ * Same as __wfcq_dequeue(), but returns WFCQ_WOULDBLOCK instead of
+ * busy-waiting on an enqueuer that has moved the tail but not yet
+ * linked its node, e.g. when polling the queue together with other
+ * work.
+ */
+static inline struct wfcq_node *
+__wfcq_dequeue_nonblocking(struct wfcq_head *head, struct wfcq_tail *tail)
+{
+	struct wfcq_node *node, *next;
+
+	if (wfcq_empty(head, tail))
+		return NULL;
+
+	if ((node = CMM_LOAD_SHARED(head->node.next)) == NULL)
+		return WFCQ_WOULDBLOCK;
+
+	if ((next = CMM_LOAD_SHARED(node->next)) == NULL) {
+		/* See __wfcq_dequeue() */
+		wfcq_node_init(&head->node);
+		if (cmpxchg(&tail->p, node, &head->node) == node)
+			return node;
+		if ((next = CMM_LOAD_SHARED(node->next)) == NULL) {
+			/* Enqueue in progress, restore queue head */
+			head->node.next = node;
+			return WFCQ_WOULDBLOCK;
+		}
+	}
+
+	/*
+	 * Move queue head forward.
+	 */
+	head->node.next = next;
+
+	/* Load q->head.next before loading node's content */
+	smp_read_barrier_depends();
+	return node;
+}
+
+/*
+ * __wfcq_dequeue_bulk: dequeue up to @n nodes from the queue, into
+ * the @nodes array, in FIFO order.
+ *
+ * Single pass over the next pointers, and the queue head is only
+ * moved (written) once, thus callers serializing dequeue by a lock
+ * take it once per batch.  As __wfcq_dequeue(), it busy-waits on an
+ * enqueuer that has moved the tail but not yet linked its node.
+ * Same memory ordering and mutual exclusion rules as __wfcq_dequeue().
+ *
+ * Returns the number of nodes dequeued, 0 if queue is empty.
+ */
+static inline int __wfcq_dequeue_bulk(struct wfcq_head *head,
+		struct wfcq_tail *tail,
+		struct wfcq_node **nodes, int n)
+{
+	struct wfcq_node *node, *next;
+	int cnt = 0;
+
+	if (n <= 0 || wfcq_empty(head, tail))
+		return 0;
+
+	node = ___wfcq_node_sync_next(&head->node);
+	for (;;) {
+		nodes[cnt++] = node;
+		if ((next = CMM_LOAD_SHARED(node->next)) == NULL) {
+			/*
+			 * @node is probably the last node, try to move
+			 * the tail to &q->head, see __wfcq_dequeue().
+			 * Success leaves the queue empty.
+			 */
+			wfcq_node_init(&head->node);
+			if (cmpxchg(&tail->p, node, &head->node) == node)
+				return cnt;
+			next = ___wfcq_node_sync_next(node);
+		}
+		if (cnt == n)
+			break;
+		node = next;
+	}
+
+	/*
+	 * Move queue head forward, past the last dequeued node.
+	 */
+	head->node.next = next;
+
+	/* Load q->head.next before loading node's content */
+	smp_read_barrier_depends();
+	return cnt;
+}
+
 /*
  * __wfcq_splice: enqueue all src_q nodes at the end of dest_q.
  *
@@ -0,0 +1,142 @@
+#ifndef _LINUX_WFCQ_POOL_H
+#define _LINUX_WFCQ_POOL_H
+/* linux/wfcq_pool.h
+ *
+ * Recycling of the objects carrying intrusive wfcq nodes, via a per
+ * CPU qmempool cache, instead of a kmalloc/kfree per message.
+ *
+ * The caller struct embeds a struct wfcq_pool_node, and
+ * DEFINE_WFCQ_POOL() generates typed helpers for it:
+ *
+ *  struct my_msg {
+ *	struct wfcq_pool_node qnode;
+ *	...
+ *  };
+ *  DEFINE_WFCQ_POOL(my_msg, struct my_msg, qnode);
+ *
+ *  my_msg_alloc(), my_msg_free()       - object from/to the pool
+ *  my_msg_enqueue()                    - wfcq_enqueue() of object
+ *  __my_msg_dequeue(), __my_msg_dequeue_bulk() - typed __wfcq_dequeue*()
+ *
+ * Messages are typically freed by the consumer on another CPU.  The
+ * allocating CPU is recorded in the node, and the free hands the object
+ * back to that CPU (qmempool_free_to_cpu()), which with the pool's
+ * remote CPU returns enabled (see wfcq_pool_init()) avoids that every
+ * object travels through the sharedq.
+ *
+ * Same context rules as qmempool, not usable from hardirq context.
+ */
+#include <linux/wfc_queue.h>
+#include <linux/qmempool.h>
+#include <linux/slab.h>
+
+struct wfcq_pool_node {
+	struct wfcq_node node;
+	int owner;	/* Allocating CPU */
+};
+
+struct wfcq_pool {
+	struct kmem_cache *kmem;
+	struct qmempool *pool;
+};
+
+/* Remote CPU return queue size, used when xcpu returns are requested */
+#define WFCQ_POOL_XCPU_QSIZE 256
+
+static inline int wfcq_pool_init(struct wfcq_pool *p, const char *name,
+				 size_t size, uint32_t localq_sz,
+				 uint32_t sharedq_sz, bool xcpu)
+{
+	int err;
+
+	p->kmem = kmem_cache_create(name, size, 0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!p->kmem)
+		return -ENOMEM;
+	p->pool = qmempool_create(localq_sz, sharedq_sz, 0, p->kmem,
+				  GFP_KERNEL);
+	if (!p->pool) {
+		err = -ENOMEM;
+		goto err_kmem;
+	}
+	if (xcpu) {
+		err = qmempool_remote_cpu_enable(p->pool, WFCQ_POOL_XCPU_QSIZE);
+		if (err)
+			goto err_pool;
+	}
+	return 0;
+
+err_pool:
+	qmempool_destroy(p->pool);
+err_kmem:
+	kmem_cache_destroy(p->kmem);
+	return err;
+}
+
+static inline void wfcq_pool_destroy(struct wfcq_pool *p)
+{
+	qmempool_destroy(p->pool);
+	kmem_cache_destroy(p->kmem);
+}
+
+static inline void *__wfcq_pool_alloc(struct wfcq_pool *p, gfp_t gfp_mask,
+				      size_t offset)
+{
+	struct wfcq_pool_node *qnode;
+	void *obj;
+	int state;
+
+	state = __qmempool_preempt_disable();
+	obj = main_qmempool_alloc(p->pool, gfp_mask);
+	if (likely(obj)) {
+		qnode = obj + offset;
+		wfcq_node_init(&qnode->node);
+		qnode->owner = smp_processor_id();
+	}
+	__qmempool_preempt_enable(state);
+	return obj;
+}
+
+static inline void __wfcq_pool_free(struct wfcq_pool *p, void *obj,
+				    size_t offset)
+{
+	struct wfcq_pool_node *qnode = obj + offset;
+
+	__qmempool_free_to_cpu(p->pool, obj, qnode->owner);
+}
+
+#define DEFINE_WFCQ_POOL(name, type, member)				\
+static inline type *name##_alloc(struct wfcq_pool *p, gfp_t gfp_mask)	\
+{									\
+	return __wfcq_pool_alloc(p, gfp_mask, offsetof(type, member));	\
+}									\
+static inline void name##_free(struct wfcq_pool *p, type *obj)		\
+{									\
+	__wfcq_pool_free(p, obj, offsetof(type, member));		\
+}									\
+static inline bool name##_enqueue(struct wfcq_head *head,		\
+				  struct wfcq_tail *tail, type *obj)	\
+{									\
+	return wfcq_enqueue(head, tail, &obj->member.node);		\
+}									\
+static inline type *__##name##_dequeue(struct wfcq_head *head,		\
+				       struct wfcq_tail *tail)		\
+{									\
+	struct wfcq_node *node = __wfcq_dequeue(head, tail);		\
+									\
+	return node ? container_of(node, type, member.node) : NULL;	\
+}									\
+/* Dequeue into @objs in place, the node pointers get converted */	\
+static inline int __##name##_dequeue_bulk(struct wfcq_head *head,	\
+					  struct wfcq_tail *tail,	\
+					  type **objs, int n)		\
+{									\
+	struct wfcq_node **nodes = (struct wfcq_node **)objs;		\
+	int i, cnt;							\
+									\
+	cnt = __wfcq_dequeue_bulk(head, tail, nodes, n);		\
+	for (i = 0; i < cnt; i++)					\
+		objs[i] = container_of(nodes[i], type, member.node);	\
+	return cnt;							\
+}
+
+#endif /* _LINUX_WFCQ_POOL_H */
@@ -13,8 +13,212 @@
 #include <linux/module.h>
 #include <linux/slab.h> /* kzalloc */
 #include <linux/alf_queue.h>
+#include <linux/alf_queue_set.h>
+#include <linux/alf_queue_resize.h>
+#include <linux/alf_queue_seq.h>
 #include <linux/log2.h>
 
+#if defined(ALF_QUEUE_AUTO_HELPER) || defined(ALF_QUEUE_STATS)
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+static struct dentry *alf_debugfs_dir;
+#endif
+
+#ifdef ALF_QUEUE_AUTO_HELPER
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+
+DEFINE_STATIC_CALL(alf_enqueue_store, __helper_alf_enqueue_store_unroll);
+DEFINE_STATIC_CALL(alf_dequeue_load,  __helper_alf_dequeue_load_unroll);
+EXPORT_STATIC_CALL_GPL(alf_enqueue_store);
+EXPORT_STATIC_CALL_GPL(alf_dequeue_load);
+
+static unsigned int calibrate_loops = 20000;
+module_param(calibrate_loops, uint, 0444);
+MODULE_PARM_DESC(calibrate_loops, "Loops per helper and bulk size in load-time calibration (0=disable)");
+
+#define ALF_HELPER(NAME)					\
+	{ .name = #NAME,					\
+	  .store = __helper_alf_enqueue_store_##NAME,		\
+	  .load  = __helper_alf_dequeue_load_##NAME }
+
+static struct alf_helper {
+	const char *name;
+	typeof(__helper_alf_enqueue_store_unroll) *store;
+	typeof(__helper_alf_dequeue_load_unroll)  *load;
+	u64 ps[4]; /* picosec per elem, for each bulk size in calib_bulk[] */
+} alf_helpers[] = {
+	ALF_HELPER(simple),
+	ALF_HELPER(mask),
+	ALF_HELPER(mask_less),
+	ALF_HELPER(mask_less2),
+	ALF_HELPER(nomask),
+	ALF_HELPER(unroll),
+	ALF_HELPER(unroll_duff),
+	ALF_HELPER(memcpy),
+	ALF_HELPER(simd),
+};
+static const u32 calib_bulk[] = { 4, 8, 16, 32 };
+
+static DEFINE_MUTEX(alf_helper_mutex);
+static struct alf_helper *alf_helper_selected = &alf_helpers[5]; /* unroll */
+static bool alf_helper_override;
+
+static void alf_helper_select(struct alf_helper *h)
+{
+	static_call_update(alf_enqueue_store, h->store);
+	static_call_update(alf_dequeue_load,  h->load);
+	alf_helper_selected = h;
+}
+
+/* Same store+load cycle as time_BULK_enq_deq() in alf_queue_bench.c,
+ * but calling the helpers directly.  The queue head is advanced by a
+ * non-multiple of the bulk size, to also exercise the wrap handling.
+ */
+static u64 alf_helper_measure(struct alf_queue *q, struct alf_helper *h,
+			      u32 bulk)
+{
+	void *objs[32], *deq_objs[32];
+	u32 head = 0;
+	u64 start, stop;
+	unsigned int i;
+
+	for (i = 0; i < bulk; i++)
+		objs[i] = (void *)(unsigned long)(i + 20);
+
+	preempt_disable();
+	start = ktime_get_ns();
+	for (i = 0; i < calibrate_loops; i++) {
+		h->store(head, q, objs, bulk);
+		barrier();
+		h->load(head, q, deq_objs, bulk);
+		head += bulk + 1;
+	}
+	stop = ktime_get_ns();
+	preempt_enable();
+
+	return div64_u64((stop - start) * 1000,
+			 (u64)calibrate_loops * bulk * 2);
+}
+
+static int alf_helper_calibrate(void)
+{
+	struct alf_helper *best = NULL;
+	u64 best_sum = U64_MAX;
+	struct alf_queue *q;
+	int i, j;
+
+	if (!calibrate_loops)
+		return 0;
+
+	q = alf_queue_alloc(64, GFP_KERNEL);
+	if (IS_ERR(q))
+		return PTR_ERR(q);
+
+	for (i = 0; i < ARRAY_SIZE(alf_helpers); i++) {
+		struct alf_helper *h = &alf_helpers[i];
+		u64 sum = 0;
+
+		for (j = 0; j < ARRAY_SIZE(calib_bulk); j++) {
+			h->ps[j] = alf_helper_measure(q, h, calib_bulk[j]);
+			sum += h->ps[j];
+		}
+		if (sum < best_sum) {
+			best_sum = sum;
+			best = h;
+		}
+		cond_resched();
+	}
+	alf_queue_free(q);
+
+	alf_helper_select(best);
+	pr_info("Selected STORE/LOAD helper: %s\n", best->name);
+	return 0;
+}
+
+static int alf_helper_show(struct seq_file *m, void *v)
+{
+	int i, j;
+
+	mutex_lock(&alf_helper_mutex);
+	seq_printf(m, "selected: %s (%s)\n", alf_helper_selected->name,
+		   alf_helper_override ? "override" : "auto");
+	seq_puts(m, "# helper      ps/elem bulk:");
+	for (j = 0; j < ARRAY_SIZE(calib_bulk); j++)
+		seq_printf(m, " %u", calib_bulk[j]);
+	seq_puts(m, "\n");
+	for (i = 0; i < ARRAY_SIZE(alf_helpers); i++) {
+		seq_printf(m, "%c%-12s",
+			   &alf_helpers[i] == alf_helper_selected ? '*' : ' ',
+			   alf_helpers[i].name);
+		for (j = 0; j < ARRAY_SIZE(calib_bulk); j++)
+			seq_printf(m, " %llu", alf_helpers[i].ps[j]);
+		seq_puts(m, "\n");
+	}
+	mutex_unlock(&alf_helper_mutex);
+	return 0;
+}
+
+static int alf_helper_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, alf_helper_show, NULL);
+}
+
+/* Write a helper name to override, or "auto" to re-run calibration */
+static ssize_t alf_helper_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	char buf[32];
+	int i, err = -EINVAL;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	strim(buf);
+
+	mutex_lock(&alf_helper_mutex);
+	if (!strcmp(buf, "auto")) {
+		err = alf_helper_calibrate();
+		alf_helper_override = false;
+	} else {
+		for (i = 0; i < ARRAY_SIZE(alf_helpers); i++) {
+			if (strcmp(buf, alf_helpers[i].name))
+				continue;
+			alf_helper_select(&alf_helpers[i]);
+			alf_helper_override = true;
+			err = 0;
+			break;
+		}
+	}
+	mutex_unlock(&alf_helper_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations alf_helper_fops = {
+	.owner		= THIS_MODULE,
+	.open		= alf_helper_open,
+	.read		= seq_read,
+	.write		= alf_helper_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init alf_helper_init(void)
+{
+	mutex_lock(&alf_helper_mutex);
+	alf_helper_calibrate();
+	mutex_unlock(&alf_helper_mutex);
+
+	debugfs_create_file("helper", 0644, alf_debugfs_dir, NULL,
+			    &alf_helper_fops);
+}
+#endif /* ALF_QUEUE_AUTO_HELPER */
+
 struct alf_queue *alf_queue_alloc(u32 size, gfp_t gfp)
 {
 	struct alf_queue *q;
@@ -32,16 +236,269 @@ struct alf_queue *alf_queue_alloc(u32 size, gfp_t gfp)
 	q->size = size;
 	q->mask = size - 1;
 
+#ifdef ALF_QUEUE_STATS
+	q->stats = alloc_percpu_gfp(struct alf_queue_stats, gfp);
+	if (!q->stats) {
+		kfree(q);
+		return ERR_PTR(-ENOMEM);
+	}
+#endif
 	return q;
 }
 EXPORT_SYMBOL_GPL(alf_queue_alloc);
 
 void alf_queue_free(struct alf_queue *q)
 {
+#ifdef ALF_QUEUE_STATS
+	debugfs_remove_recursive(q->stats_dentry);
+	free_percpu(q->stats);
+#endif
 	kfree(q);
 }
 EXPORT_SYMBOL_GPL(alf_queue_free);
 
+struct alf_queue_seq *alf_queue_seq_alloc(u32 size, gfp_t gfp)
+{
+	struct alf_queue_seq *q;
+	u32 i;
+
+	if (!(is_power_of_2(size)) || size > 65536)
+		return ERR_PTR(-EINVAL);
+
+	q = kzalloc(size * sizeof(struct alf_seq_slot) +
+		    sizeof(struct alf_queue_seq), gfp);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+
+	q->size = size;
+	q->mask = size - 1;
+	/* Slot i is free for the producer of position i */
+	for (i = 0; i < size; i++)
+		q->ring[i].seq = i;
+	return q;
+}
+EXPORT_SYMBOL_GPL(alf_queue_seq_alloc);
+
+void alf_queue_seq_free(struct alf_queue_seq *q)
+{
+	kfree(q);
+}
+EXPORT_SYMBOL_GPL(alf_queue_seq_free);
+
+#ifdef ALF_QUEUE_STATS
+static int alf_queue_stats_show(struct seq_file *m, void *v)
+{
+	struct alf_queue *q = m->private;
+	struct alf_queue_stats sum = {};
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct alf_queue_stats *st = per_cpu_ptr(q->stats, cpu);
+
+		sum.enq_retry += st->enq_retry;
+		sum.deq_retry += st->deq_retry;
+		sum.enq_full  += st->enq_full;
+		sum.deq_empty += st->deq_empty;
+		for (i = 0; i < ALF_STATS_BULK_BUCKETS; i++) {
+			sum.enq_bulk[i] += st->enq_bulk[i];
+			sum.deq_bulk[i] += st->deq_bulk[i];
+		}
+	}
+	seq_printf(m, "size:%u count:%d\n", q->size, alf_queue_count(q));
+	seq_printf(m, "enq_retry:%llu deq_retry:%llu\n",
+		   sum.enq_retry, sum.deq_retry);
+	seq_printf(m, "enq_full:%llu deq_empty:%llu\n",
+		   sum.enq_full, sum.deq_empty);
+	seq_puts(m, "# bulk(>=) enq deq\n");
+	for (i = 0; i < ALF_STATS_BULK_BUCKETS; i++)
+		seq_printf(m, "%u %llu %llu\n", 1U << i,
+			   sum.enq_bulk[i], sum.deq_bulk[i]);
+	return 0;
+}
+
+static int alf_queue_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, alf_queue_stats_show, inode->i_private);
+}
+
+static const struct file_operations alf_queue_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= alf_queue_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Expose queue stats as /sys/kernel/debug/alf_queue/<name>/stats,
+ * removed again by alf_queue_free()
+ */
+int alf_queue_stats_register(struct alf_queue *q, const char *name)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(name, alf_debugfs_dir);
+	if (IS_ERR(dir))
+		return PTR_ERR(dir);
+	debugfs_create_file("stats", 0444, dir, q, &alf_queue_stats_fops);
+	q->stats_dentry = dir;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(alf_queue_stats_register);
+#endif /* ALF_QUEUE_STATS */
+
+int alf_queue_rs_init(struct alf_queue_rs *r, u32 size, gfp_t gfp)
+{
+	struct alf_queue *q = alf_queue_alloc(size, gfp);
+
+	if (IS_ERR(q))
+		return PTR_ERR(q);
+
+	RCU_INIT_POINTER(r->prod, q);
+	RCU_INIT_POINTER(r->cons, q);
+	r->sealed = NULL;
+	mutex_init(&r->resize_mutex);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(alf_queue_rs_init);
+
+/* Free the sealed old queue, if consumers have moved on from it.
+ * Consumers can still be inside a dequeue on it, thus wait a grace
+ * period before freeing.
+ */
+static void __alf_queue_rs_reclaim(struct alf_queue_rs *r)
+{
+	struct alf_queue *sealed = r->sealed;
+
+	if (!sealed || rcu_access_pointer(r->cons) == sealed)
+		return;
+	synchronize_rcu();
+	WRITE_ONCE(r->sealed, NULL);
+	alf_queue_free(sealed);
+}
+
+void alf_queue_rs_reclaim(struct alf_queue_rs *r)
+{
+	mutex_lock(&r->resize_mutex);
+	__alf_queue_rs_reclaim(r);
+	mutex_unlock(&r->resize_mutex);
+}
+EXPORT_SYMBOL_GPL(alf_queue_rs_reclaim);
+
+/* Returns -EBUSY if consumers have not yet drained the queue from a
+ * previous resize.  Does not wait for consumers, only for producers
+ * to leave the old queue (an RCU grace period).
+ */
+int alf_queue_rs_resize(struct alf_queue_rs *r, u32 size, gfp_t gfp)
+{
+	struct alf_queue *old, *new;
+	int err = 0;
+
+	mutex_lock(&r->resize_mutex);
+	__alf_queue_rs_reclaim(r);
+
+	old = rcu_dereference_protected(r->prod,
+					lockdep_is_held(&r->resize_mutex));
+	if (rcu_access_pointer(r->cons) != old) {
+		err = -EBUSY;
+		goto out;
+	}
+	new = alf_queue_alloc(size, gfp);
+	if (IS_ERR(new)) {
+		err = PTR_ERR(new);
+		goto out;
+	}
+	/* New producers go to the new queue from now on */
+	rcu_assign_pointer(r->prod, new);
+	synchronize_rcu();
+	/* No producer left in old queue, consumers can switch when empty.
+	 * Release pairs with the acquire in __alf_queue_rs_switch().
+	 */
+	smp_store_release(&r->sealed, old);
+out:
+	mutex_unlock(&r->resize_mutex);
+	return err;
+}
+EXPORT_SYMBOL_GPL(alf_queue_rs_resize);
+
+/* Caller must make sure no producers or consumers are left, elements
+ * still in the queues are not freed (they are opaque pointers).
+ */
+void alf_queue_rs_destroy(struct alf_queue_rs *r)
+{
+	struct alf_queue *prod = rcu_dereference_protected(r->prod, 1);
+	struct alf_queue *cons = rcu_dereference_protected(r->cons, 1);
+
+	__alf_queue_rs_reclaim(r);
+	if (cons != prod)
+		alf_queue_free(cons); /* sealed, not drained */
+	alf_queue_free(prod);
+}
+EXPORT_SYMBOL_GPL(alf_queue_rs_destroy);
+
+struct alf_queue_set *alf_queue_set_alloc(unsigned int nr_queues, u32 size,
+					  gfp_t gfp)
+{
+	struct alf_queue_set *set;
+	struct alf_queue *q;
+	unsigned int i;
+
+	if (!nr_queues)
+		return ERR_PTR(-EINVAL);
+
+	set = kzalloc(sizeof(*set) + BITS_TO_LONGS(nr_queues) * sizeof(long),
+		      gfp);
+	if (!set)
+		return ERR_PTR(-ENOMEM);
+	set->queues = kcalloc(nr_queues, sizeof(*set->queues), gfp);
+	if (!set->queues) {
+		kfree(set);
+		return ERR_PTR(-ENOMEM);
+	}
+	set->nr_queues = nr_queues;
+
+	for (i = 0; i < nr_queues; i++) {
+		q = alf_queue_alloc(size, gfp);
+		if (IS_ERR(q)) {
+			alf_queue_set_free(set);
+			return ERR_CAST(q);
+		}
+		set->queues[i] = q;
+	}
+	return set;
+}
+EXPORT_SYMBOL_GPL(alf_queue_set_alloc);
+
+void alf_queue_set_free(struct alf_queue_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->nr_queues; i++) {
+		if (set->queues[i])
+			alf_queue_free(set->queues[i]);
+	}
+	kfree(set->queues);
+	kfree(set);
+}
+EXPORT_SYMBOL_GPL(alf_queue_set_free);
+
+#if defined(ALF_QUEUE_AUTO_HELPER) || defined(ALF_QUEUE_STATS)
+static int __init alf_queue_module_init(void)
+{
+	alf_debugfs_dir = debugfs_create_dir("alf_queue", NULL);
+#ifdef ALF_QUEUE_AUTO_HELPER
+	alf_helper_init();
+#endif
+	return 0;
+}
+module_init(alf_queue_module_init);
+
+static void __exit alf_queue_module_exit(void)
+{
+	debugfs_remove_recursive(alf_debugfs_dir);
+}
+module_exit(alf_queue_module_exit);
+#endif
+
 MODULE_DESCRIPTION("ALF: Array-based Lock-Free queue");
 MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
 MODULE_LICENSE("GPL");
@@ -6,6 +6,7 @@
 
 #include <linux/module.h>
 #include <linux/alf_queue.h>
+#include <linux/alf_queue_seq.h>
 
 //#include <linux/list.h>
 //#include <linux/spinlock.h>
@@ -22,7 +23,7 @@ static int verbose=1;
 static int time_bench_for_loop(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -52,7 +53,7 @@ static __always_inline int time_bench_one_enq_deq(
 	int on_stack = 123;
 	int *obj = &on_stack;
 	int *deq_obj = NULL;
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	struct alf_queue *queue = (struct alf_queue*)data;
 
@@ -60,15 +61,11 @@ static __always_inline int time_bench_one_enq_deq(
 		pr_err("Need queue struct ptr as input\n");
 		return -1;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		/* Compile will hopefull optimized this out */
 		if (type & ALF_FLAG_SP) {
 			if (alf_sp_enqueue(queue, (void **)&obj, 1) != 1)
@@ -94,6 +91,7 @@ static __always_inline int time_bench_one_enq_deq(
 		}
 
 		loops_cnt++;
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, loops_cnt);
 
@@ -124,7 +122,8 @@ static __always_inline int time_multi_enq_deq(
 	int on_stack = 123;
 	int *obj = &on_stack;
 	int *deq_obj = NULL;
-	int i, n;
+	uint64_t i;
+	int n;
 	uint64_t loops_cnt = 0;
 	int elems = rec->step;
 	struct alf_queue* queue = (struct alf_queue*)data;
@@ -133,16 +132,12 @@ static __always_inline int time_multi_enq_deq(
 		pr_err("Need queue struct ptr as input\n");
 		return -1;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2 * elems) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		for (n = 0; n < elems; n++) {
 			if (type & ALF_FLAG_SP) {
 				if (alf_sp_enqueue(queue,(void **)&obj, 1) != 1)
@@ -168,6 +163,7 @@ static __always_inline int time_multi_enq_deq(
 			}
 			loops_cnt++;
 		}
+		time_bench_hist_end(rec, t);
 	}
 
 	time_bench_stop(rec, loops_cnt);
@@ -195,7 +191,7 @@ static __always_inline int time_BULK_enq_deq(
 #define MAX_BULK 32
 	int *objs[MAX_BULK];
 	int *deq_objs[MAX_BULK];
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	int bulk = rec->step;
 	struct alf_queue* queue = (struct alf_queue*)data;
@@ -209,11 +205,6 @@ static __always_inline int time_BULK_enq_deq(
 			__func__, bulk, MAX_BULK);
 		bulk = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
 	/* fake init pointers to a number */
 	for (i = 0; i < MAX_BULK; i++)
 		objs[i] = (void *)(unsigned long)(i+20);
@@ -222,6 +213,8 @@ static __always_inline int time_BULK_enq_deq(
 
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		if (type & ALF_FLAG_SP) {
 			if (alf_sp_enqueue(queue, (void**)objs, bulk) != bulk)
 				goto fail;
@@ -244,6 +237,7 @@ static __always_inline int time_BULK_enq_deq(
 			BUILD_BUG();
 		}
 		loops_cnt +=bulk;
+		time_bench_hist_end(rec, t);
 	}
 
 	time_bench_stop(rec, loops_cnt);
@@ -265,6 +259,246 @@ static int time_BULK_enq_deq_spsc(
 }
 
 
+/* Per-slot sequence (preemption tolerant) MPMC queue, same
+ * enqueue+dequeue patterns as the MPMC tests above
+ */
+static int time_bench_one_enq_deq_seq(
+	struct time_bench_record *rec, void *data)
+{
+	int on_stack = 123;
+	int *obj = &on_stack;
+	int *deq_obj = NULL;
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+	struct alf_queue_seq *queue = data;
+
+	if (queue == NULL) {
+		pr_err("Need queue struct ptr as input\n");
+		return -1;
+	}
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		if (alf_seq_mp_enqueue(queue, (void **)&obj, 1) != 1)
+			goto fail;
+		loops_cnt++;
+		barrier(); /* compiler barrier */
+		if (alf_seq_mc_dequeue(queue, (void **)&deq_obj, 1) != 1)
+			goto fail;
+		loops_cnt++;
+		time_bench_hist_end(rec, t);
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	return loops_cnt;
+fail:
+	return 0;
+}
+
+static int time_multi_enq_deq_seq(
+	struct time_bench_record *rec, void *data)
+{
+	int on_stack = 123;
+	int *obj = &on_stack;
+	int *deq_obj = NULL;
+	uint64_t i;
+	int n;
+	uint64_t loops_cnt = 0;
+	int elems = rec->step;
+	struct alf_queue_seq *queue = data;
+
+	if (queue == NULL) {
+		pr_err("Need queue struct ptr as input\n");
+		return -1;
+	}
+	time_bench_start(rec);
+
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		for (n = 0; n < elems; n++) {
+			if (alf_seq_mp_enqueue(queue, (void **)&obj, 1) != 1)
+				goto fail;
+			loops_cnt++;
+		}
+		barrier(); /* compiler barrier */
+		for (n = 0; n < elems; n++) {
+			if (alf_seq_mc_dequeue(queue, (void **)&deq_obj, 1) != 1)
+				goto fail;
+			loops_cnt++;
+		}
+		time_bench_hist_end(rec, t);
+	}
+
+	time_bench_stop(rec, loops_cnt);
+
+	return loops_cnt;
+fail:
+	return -1;
+}
+
+static int time_BULK_enq_deq_seq(
+	struct time_bench_record *rec, void *data)
+{
+	int *objs[MAX_BULK];
+	int *deq_objs[MAX_BULK];
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+	int bulk = rec->step;
+	struct alf_queue_seq *queue = data;
+
+	if (queue == NULL) {
+		pr_err("Need alf_queue_seq as input\n");
+		return -1;
+	}
+	if (bulk > MAX_BULK) {
+		pr_warn("%s() bulk(%d) request too big cap at %d\n",
+			__func__, bulk, MAX_BULK);
+		bulk = MAX_BULK;
+	}
+	/* fake init pointers to a number */
+	for (i = 0; i < MAX_BULK; i++)
+		objs[i] = (void *)(unsigned long)(i+20);
+
+	time_bench_start(rec);
+
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		if (alf_seq_mp_enqueue(queue, (void **)objs, bulk) != bulk)
+			goto fail;
+		loops_cnt += bulk;
+		barrier(); /* compiler barrier */
+		if (alf_seq_mc_dequeue(queue, (void **)deq_objs, bulk) != bulk)
+			goto fail;
+		loops_cnt += bulk;
+		time_bench_hist_end(rec, t);
+	}
+
+	time_bench_stop(rec, loops_cnt);
+
+	return loops_cnt;
+fail:
+	return -1;
+}
+
+/* Compare the STORE/LOAD helpers directly, without the queue
+ * head/tail handling, to see if the SIMD helper beats _unroll.
+ * Head is advanced by a non-multiple of the bulk size, to include
+ * array wrap handling.
+ */
+typedef void (alf_store_func)(u32, struct alf_queue *, void **, const u32);
+typedef void (alf_load_func)(u32, struct alf_queue *, void **, const u32);
+
+static __always_inline int time_BULK_helper(
+	struct time_bench_record *rec, void *data,
+	alf_store_func store, alf_load_func load)
+{
+#define MAX_HELPER_BULK 64
+	void *objs[MAX_HELPER_BULK];
+	void *deq_objs[MAX_HELPER_BULK];
+	struct alf_queue *queue = (struct alf_queue *)data;
+	int bulk = rec->step;
+	uint64_t loops_cnt = 0;
+	u32 head = 0;
+	uint64_t i;
+
+	if (queue == NULL || bulk > MAX_HELPER_BULK || bulk > queue->size)
+		return -1;
+	for (i = 0; i < MAX_HELPER_BULK; i++)
+		objs[i] = (void *)(unsigned long)(i+20);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		store(head, queue, objs, bulk);
+		barrier(); /* compiler barrier */
+		load(head, queue, deq_objs, bulk);
+		head += bulk + 1;
+		loops_cnt += bulk * 2;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	return loops_cnt;
+#undef MAX_HELPER_BULK
+}
+static int time_BULK_helper_unroll(
+	struct time_bench_record *rec, void *data)
+{
+	return time_BULK_helper(rec, data, __helper_alf_enqueue_store_unroll,
+				__helper_alf_dequeue_load_unroll);
+}
+static int time_BULK_helper_simd(
+	struct time_bench_record *rec, void *data)
+{
+	return time_BULK_helper(rec, data, __helper_alf_enqueue_store_simd,
+				__helper_alf_dequeue_load_simd);
+}
+
+/* Statically sized queue, compile-time size/mask, same ring size as
+ * the dynamic queue tests below
+ */
+DEFINE_ALF_QUEUE(alf_static512, 512);
+static struct alf_static512 static_q;
+
+static __always_inline int time_BULK_enq_deq_static(
+	struct time_bench_record *rec, void *data,
+	enum queue_behavior_type type, const int bulk)
+{
+	int *objs[32];
+	int *deq_objs[32];
+	struct alf_static512 *q = data;
+	uint64_t loops_cnt = 0;
+	uint64_t i;
+
+	for (i = 0; i < bulk; i++)
+		objs[i] = (void *)(unsigned long)(i+20);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (type & ALF_FLAG_SP) {
+			if (alf_static512_sp_enqueue(q, (void **)objs, bulk) != bulk)
+				goto fail;
+		} else {
+			if (alf_static512_mp_enqueue(q, (void **)objs, bulk) != bulk)
+				goto fail;
+		}
+		loops_cnt += bulk;
+		barrier(); /* compiler barrier */
+		if (type & ALF_FLAG_SC) {
+			if (alf_static512_sc_dequeue(q, (void **)deq_objs, bulk) != bulk)
+				goto fail;
+		} else {
+			if (alf_static512_mc_dequeue(q, (void **)deq_objs, bulk) != bulk)
+				goto fail;
+		}
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	return loops_cnt;
+fail:
+	return -1;
+}
+/* Constant bulk sizes, to let the compiler unroll fully */
+#define DEFINE_STATIC_BENCH(TYPE, type, BULK)				\
+static int time_static_##type##_bulk##BULK(				\
+	struct time_bench_record *rec, void *data)			\
+{									\
+	return time_BULK_enq_deq_static(rec, data, TYPE, BULK);	\
+}
+DEFINE_STATIC_BENCH(SPSC, spsc, 1)
+DEFINE_STATIC_BENCH(SPSC, spsc, 8)
+DEFINE_STATIC_BENCH(SPSC, spsc, 16)
+DEFINE_STATIC_BENCH(MPMC, mpmc, 1)
+DEFINE_STATIC_BENCH(MPMC, mpmc, 8)
+DEFINE_STATIC_BENCH(MPMC, mpmc, 16)
+
 int run_benchmark_tests(void)
 {
 	uint32_t loops = 10000000;
@@ -272,6 +506,7 @@ int run_benchmark_tests(void)
 	int passed_count = 0;
 	struct alf_queue *MPMC;
 	struct alf_queue *SPSC;
+	struct alf_queue_seq *SEQ;
 
 	/* Results listed below for a E5-2695 CPU */
 
@@ -300,6 +535,22 @@ int run_benchmark_tests(void)
 
 	alf_queue_free(MPMC);
 
+	/* MPMC per-slot sequence queue, preemption tolerant */
+	SEQ = alf_queue_seq_alloc(ring_size, GFP_KERNEL);
+	if (IS_ERR(SEQ))
+		return PTR_ERR(SEQ);
+
+	time_bench_loop(loops, 0, "ALF-SEQ-simple", SEQ,
+			time_bench_one_enq_deq_seq);
+	time_bench_loop(loops/100, 128, "ALF-SEQ-multi", SEQ,
+			time_multi_enq_deq_seq);
+	time_bench_loop(loops,  2, "SEQ-bulk2",  SEQ, time_BULK_enq_deq_seq);
+	time_bench_loop(loops,  4, "SEQ-bulk4",  SEQ, time_BULK_enq_deq_seq);
+	time_bench_loop(loops,  8, "SEQ-bulk8",  SEQ, time_BULK_enq_deq_seq);
+	time_bench_loop(loops, 16, "SEQ-bulk16", SEQ, time_BULK_enq_deq_seq);
+
+	alf_queue_seq_free(SEQ);
+
 	/* SPSC: Single-Producer-Single-Consumer tests */
 	SPSC = alf_queue_alloc(ring_size, GFP_KERNEL);
 
@@ -317,7 +568,41 @@ int run_benchmark_tests(void)
 	time_bench_loop(loops,  8, "SPSC-bulk8",  SPSC, time_BULK_enq_deq_spsc);
 	time_bench_loop(loops, 16, "SPSC-bulk16", SPSC, time_BULK_enq_deq_spsc);
 
+	/* STORE/LOAD helpers: scalar unroll vs. SIMD */
+	time_bench_loop(loops,  8, "helper-unroll-bulk8",  SPSC,
+			time_BULK_helper_unroll);
+	time_bench_loop(loops,  8, "helper-simd-bulk8",    SPSC,
+			time_BULK_helper_simd);
+	time_bench_loop(loops, 16, "helper-unroll-bulk16", SPSC,
+			time_BULK_helper_unroll);
+	time_bench_loop(loops, 16, "helper-simd-bulk16",   SPSC,
+			time_BULK_helper_simd);
+	time_bench_loop(loops, 32, "helper-unroll-bulk32", SPSC,
+			time_BULK_helper_unroll);
+	time_bench_loop(loops, 32, "helper-simd-bulk32",   SPSC,
+			time_BULK_helper_simd);
+	time_bench_loop(loops, 64, "helper-unroll-bulk64", SPSC,
+			time_BULK_helper_unroll);
+	time_bench_loop(loops, 64, "helper-simd-bulk64",   SPSC,
+			time_BULK_helper_simd);
+
 	alf_queue_free(SPSC);
+
+	/* DEFINE_ALF_QUEUE static queue, compare with dynamic above */
+	alf_static512_init(&static_q);
+	time_bench_loop(loops*10, 1, "static-SPSC-simple", &static_q,
+			time_static_spsc_bulk1);
+	time_bench_loop(loops, 8,  "static-SPSC-bulk8",  &static_q,
+			time_static_spsc_bulk8);
+	time_bench_loop(loops, 16, "static-SPSC-bulk16", &static_q,
+			time_static_spsc_bulk16);
+	time_bench_loop(loops, 1,  "static-MPMC-simple", &static_q,
+			time_static_mpmc_bulk1);
+	time_bench_loop(loops, 8,  "static-MPMC-bulk8",  &static_q,
+			time_static_mpmc_bulk8);
+	time_bench_loop(loops, 16, "static-MPMC-bulk16", &static_q,
+			time_static_mpmc_bulk16);
+
 	return passed_count;
 }
 
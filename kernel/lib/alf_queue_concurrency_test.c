@@ -26,6 +26,14 @@
 
 static int verbose=1;
 
+static int burst;
+module_param(burst, int, 0);
+MODULE_PARM_DESC(burst, "Use variable (burst) enqueue/dequeue semantics");
+
+static int blocking;
+module_param(blocking, int, 0);
+MODULE_PARM_DESC(blocking, "Consumer sleeps on empty queue, producers notify");
+
 static struct completion dequeue_start;
 
 /* Struct hack to send data in the void ptr */
@@ -58,6 +66,7 @@ static struct my_consumer consumer;
 
 /* Multi-Producer-Multi-Consumer Queue */
 static struct alf_queue *mpmc;
+static struct alf_queue_notify mpmc_notify;
 
 #define SLEEP_TIME_ENQ	0
 #define SLEEP_TIME_DEQ	1
@@ -106,21 +115,30 @@ alf_run_producer(struct alf_queue *q, struct my_producer *me)
 		}
 
 		retries = 0;
+		n = 0;
 	retry:
-		n = alf_mp_enqueue(q, objs, PRODUCER_BULK);
-		if (n == 0) {
+		/* Burst enqueue can accept a partial bulk, retry with
+		 * the remaining elements to keep the serial numbers in
+		 * order for the consumer.
+		 */
+		if (burst)
+			n += alf_mp_enqueue_burst(q, &objs[n],
+						  PRODUCER_BULK - n);
+		else
+			n = alf_mp_enqueue(q, objs, PRODUCER_BULK);
+		if (n < PRODUCER_BULK) {
 			if (++retries < retries_max) {
 				cpu_relax(); // cond_resched();
 				goto retry;
 			}
-			/* scroll back counter */
-			me->data.cnt -= PRODUCER_BULK;
+			/* scroll back counter, for the part not enqueued */
+			me->data.cnt -= PRODUCER_BULK - n;
+			total += n;
 			continue;
-		} else {
-			/* Fix this code if the API changed ;-) */
-			BUG_ON(n != PRODUCER_BULK);
 		}
 		total += n;
+		if (blocking)
+			alf_queue_notify(&mpmc_notify);
 		/* Hack: Wake up consumer after some enqueue */
 //		if (loops == 10)
 //			wake_up_process(consumer.kthread);
@@ -188,7 +206,13 @@ alf_run_consumer(struct alf_queue *q, struct my_consumer *me,
 	time_bench_start(rec);
 	for (j = 0; j < loops; j++) {
 
-		n = alf_mc_dequeue(q, deq_objs, CONSUMER_BULK);
+		if (burst)
+			n = alf_mc_dequeue_burst(q, deq_objs, CONSUMER_BULK);
+		else
+			n = alf_mc_dequeue(q, deq_objs, CONSUMER_BULK);
+		if (n == 0 && blocking &&
+		    alf_queue_wait(q, &mpmc_notify, HZ/10) > 0)
+			continue; /* woken up by producer */
 		if (n == 0)
 			break; /* empty queue */
 		total += n;
@@ -277,6 +301,7 @@ static int __init alf_queue_concurrent_module_init(void)
 	if (IS_ERR_OR_NULL(mpmc))
 		return -ENOMEM;
 
+	alf_queue_notify_init(&mpmc_notify, 1000);
 	init_completion(&dequeue_start);
 	// Do we need to reinit_completion() somewhere?
 
@@ -15,18 +15,29 @@ static int parallel_cpus = 4;
 module_param(parallel_cpus, uint, 0);
 MODULE_PARM_DESC(parallel_cpus, "Number of parallel CPUs (default 4)");
 
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
 static int bulk = 8;
 module_param(bulk, uint, 0);
 MODULE_PARM_DESC(bulk, "For bulking test adjust bulk size (default 8)");
 
+/* E.g. pmu_events=0x17 for cycles, instructions, LLC and L1D misses */
+static uint pmu_events;
+module_param(pmu_events, uint, 0);
+MODULE_PARM_DESC(pmu_events, "PMU events (bitmask of enum time_bench_pmu_event) per CPU, to quantify cache-line bouncing (default off)");
+
 #define ALF_FLAG_MP 0x1  /* Multi  Producer */
 #define ALF_FLAG_MC 0x2  /* Multi  Consumer */
 #define ALF_FLAG_SP 0x4  /* Single Producer */
 #define ALF_FLAG_SC 0x8  /* Single Consumer */
+#define ALF_FLAG_CACHED 0x10 /* SP/SC with cached shadow indices */
 
 enum queue_behavior_type {
 	MPMC = (ALF_FLAG_MP|ALF_FLAG_MC),
-	SPSC = (ALF_FLAG_SP|ALF_FLAG_SC)
+	SPSC = (ALF_FLAG_SP|ALF_FLAG_SC),
+	SPSC_CACHED = (ALF_FLAG_SP|ALF_FLAG_SC|ALF_FLAG_CACHED)
 };
 
 static __always_inline int time_bench_CPU_enq_or_deq(
@@ -36,7 +47,7 @@ static __always_inline int time_bench_CPU_enq_or_deq(
 	int on_stack = 123;
 	int *obj = &on_stack;
 	int *deq_obj = NULL;
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	struct alf_queue *queue = (struct alf_queue*)data;
 	bool enq_CPU = false;
@@ -45,14 +56,8 @@ static __always_inline int time_bench_CPU_enq_or_deq(
 		pr_err("Need queue struct ptr as input\n");
 		return -1;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
-	/* Split CPU between enq/deq based on even/odd */
-	if ((smp_processor_id() % 2)== 0)
+	/* Split CPU between enq/deq based on even/odd index in cpumask */
+	if ((rec->cpu_idx % 2) == 0)
 		enq_CPU = true;
 
 	/* Hack: use "step" to mark enq/deq, as "step" gets printed */
@@ -64,7 +69,11 @@ static __always_inline int time_bench_CPU_enq_or_deq(
 
 		if (enq_CPU) {
 			/* Compile will hopefully optimized this out */
-			if (type & ALF_FLAG_SP) {
+			if (type & ALF_FLAG_CACHED) {
+				if (alf_sp_enqueue_cached(queue,
+							  (void **)&obj, 1)!=1)
+					goto finish_early;
+			} else if (type & ALF_FLAG_SP) {
 				if (alf_sp_enqueue(queue, (void **)&obj, 1)!=1)
 					goto finish_early;
 			} else if (type & ALF_FLAG_MP) {
@@ -74,7 +83,11 @@ static __always_inline int time_bench_CPU_enq_or_deq(
 				BUILD_BUG();
 			}
 		} else {
-			if (type & ALF_FLAG_SC) {
+			if (type & ALF_FLAG_CACHED) {
+				if (alf_sc_dequeue_cached(queue,
+						   (void **)&deq_obj, 1) != 1)
+					goto finish_early;
+			} else if (type & ALF_FLAG_SC) {
 				if (alf_sc_dequeue(queue,
 						   (void **)&deq_obj, 1) != 1)
 					goto finish_early;
@@ -95,10 +108,10 @@ static __always_inline int time_bench_CPU_enq_or_deq(
 finish_early:
 	time_bench_stop(rec, loops_cnt);
 	if (enq_CPU) {
-		pr_err("%s() WARN: enq fullq(CPU:%d) i:%d\n",
+		pr_err("%s() WARN: enq fullq(CPU:%d) i:%llu\n",
 		       __func__, smp_processor_id(), i);
 	} else {
-		pr_err("%s() WARN: deq emptyq (CPU:%d) i:%d\n",
+		pr_err("%s() WARN: deq emptyq (CPU:%d) i:%llu\n",
 		       __func__, smp_processor_id(), i);
 	}
 	return loops_cnt;
@@ -114,6 +127,11 @@ static int time_bench_CPU_enq_or_deq_spsc(
 {
 	return time_bench_CPU_enq_or_deq(rec, data, SPSC);
 }
+static int time_bench_CPU_enq_or_deq_spsc_cached(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_CPU_enq_or_deq(rec, data, SPSC_CACHED);
+}
 
 /* Below bulk variant */
 static __always_inline int time_bench_CPU_BULK_enq_or_deq(
@@ -127,7 +145,7 @@ static __always_inline int time_bench_CPU_BULK_enq_or_deq(
 	int bulk = rec->step;
 	struct alf_queue* queue = (struct alf_queue*)data;
 	bool enq_CPU = false;
-	int i;
+	uint64_t i;
 
 	if (queue == NULL) {
 		pr_err("Need alf_queue as input\n");
@@ -139,14 +157,8 @@ static __always_inline int time_bench_CPU_BULK_enq_or_deq(
 		bulk = MAX_BULK;
 		rec->step = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
-	/* Split CPU between enq/deq based on even/odd */
-	if ((smp_processor_id() % 2)== 0)
+	/* Split CPU between enq/deq based on even/odd index in cpumask */
+	if ((rec->cpu_idx % 2) == 0)
 		enq_CPU = true;
 
 	/* fake init pointers to a number */
@@ -161,7 +173,11 @@ static __always_inline int time_bench_CPU_BULK_enq_or_deq(
 
 		if (enq_CPU) { /* Enqueue side */
 			/* Compile will hopefully optimized this out */
-			if (type & ALF_FLAG_SP) {
+			if (type & ALF_FLAG_CACHED) {
+				if (alf_sp_enqueue_cached(queue,
+						   (void**)objs, bulk) != bulk)
+					goto finish_early;
+			} else if (type & ALF_FLAG_SP) {
 				if (alf_sp_enqueue(queue,
 						   (void**)objs, bulk) != bulk)
 					goto finish_early;
@@ -173,7 +189,11 @@ static __always_inline int time_bench_CPU_BULK_enq_or_deq(
 				BUILD_BUG();
 			}
 		} else { /* Dequeue side */
-			if (type & ALF_FLAG_SC) {
+			if (type & ALF_FLAG_CACHED) {
+				if (alf_sc_dequeue_cached(queue,
+						(void **)deq_objs, bulk) != bulk)
+					goto finish_early;
+			} else if (type & ALF_FLAG_SC) {
 				if (alf_sc_dequeue(queue, (void **)deq_objs,
 						   bulk) != bulk)
 					goto finish_early;
@@ -194,10 +214,10 @@ static __always_inline int time_bench_CPU_BULK_enq_or_deq(
 finish_early:
 	time_bench_stop(rec, loops_cnt);
 	if (enq_CPU) {
-		pr_err("%s() WARN: enq fullq(CPU:%d) i:%d bulk:%d\n",
+		pr_err("%s() WARN: enq fullq(CPU:%d) i:%llu bulk:%d\n",
 		       __func__, smp_processor_id(), i, bulk);
 	} else {
-		pr_err("%s() WARN: deq emptyq (CPU:%d) i:%d bulk:%d\n",
+		pr_err("%s() WARN: deq emptyq (CPU:%d) i:%llu bulk:%d\n",
 		       __func__, smp_processor_id(), i, bulk);
 	}
 	return loops_cnt;
@@ -214,6 +234,11 @@ static int time_bench_CPU_BULK_enq_or_deq_spsc(
 {
 	return time_bench_CPU_BULK_enq_or_deq(rec, data, SPSC);
 }
+static int time_bench_CPU_BULK_enq_or_deq_spsc_cached(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_CPU_BULK_enq_or_deq(rec, data, SPSC_CACHED);
+}
 
 
 int run_parallel(const char *desc, uint32_t loops, const cpumask_t *cpumask,
@@ -280,13 +305,16 @@ static void run_parallel_two_CPUs(enum queue_behavior_type type,
 	if (!(queue = alloc_and_init_queue(q_size, prefill)))
 		return; /* fail */
 
-	/* Restrict the CPUs to run on
+	/* Restrict the CPUs to run on, two CPUs of selected topology
 	 */
-	cpumask_clear(&cpumask);
-	cpumask_set_cpu(0, &cpumask);
-	cpumask_set_cpu(1, &cpumask);
+	if (time_bench_cpumask_select(&cpumask, topology, 2) < 2)
+		goto out;
 
-	if (type & SPSC) {
+	if (type & ALF_FLAG_CACHED) {
+		run_parallel("alf_queue_SPSC_cached_parallel_two_CPUs",
+			     loops, &cpumask, 0, queue,
+			     time_bench_CPU_enq_or_deq_spsc_cached);
+	} else if (type & SPSC) {
 		run_parallel("alf_queue_SPSC_parallel_two_CPUs",
 			     loops, &cpumask, 0, queue,
 			     time_bench_CPU_enq_or_deq_spsc);
@@ -297,6 +325,7 @@ static void run_parallel_two_CPUs(enum queue_behavior_type type,
 	} else {
 		pr_err("%s() WRONG TYPE!!! FIX\n", __func__);
 	}
+out:
 	alf_queue_free(queue);
 }
 
@@ -308,7 +337,6 @@ static void run_parallel_many_CPUs(enum queue_behavior_type type,
 {
 	struct alf_queue *queue = NULL;
 	cpumask_t cpumask;
-	int i;
 
 	if (CPUs == 0)
 		return;
@@ -320,10 +348,8 @@ static void run_parallel_many_CPUs(enum queue_behavior_type type,
 	 */
 	if (verbose)
 		pr_info("Limit to %d parallel CPUs\n", CPUs);
-	cpumask_clear(&cpumask);
-	for (i = 0; i < CPUs ; i++) {
-		cpumask_set_cpu(i, &cpumask);
-	}
+	if (time_bench_cpumask_select(&cpumask, topology, CPUs) < 0)
+		goto out;
 
 	if (type & SPSC) {
 		if (CPUs > 2) {
@@ -351,7 +377,6 @@ static void run_parallel_many_CPUs_bulk(enum queue_behavior_type type,
 {
 	struct alf_queue *queue = NULL;
 	cpumask_t cpumask;
-	int i;
 
 	if (CPUs == 0)
 		return;
@@ -363,10 +388,8 @@ static void run_parallel_many_CPUs_bulk(enum queue_behavior_type type,
 	 */
 	if (verbose)
 		pr_info("Limit to %d parallel CPUs (bulk:%d)\n", CPUs, bulk);
-	cpumask_clear(&cpumask);
-	for (i = 0; i < CPUs ; i++) {
-		cpumask_set_cpu(i, &cpumask);
-	}
+	if (time_bench_cpumask_select(&cpumask, topology, CPUs) < 0)
+		goto out;
 
 	if (type & SPSC) {
 		if (CPUs > 2) {
@@ -374,9 +397,14 @@ static void run_parallel_many_CPUs_bulk(enum queue_behavior_type type,
 			       __func__);
 			goto out;
 		}
-		run_parallel("alf_queue_BULK_SPSC_parallel_many_CPUs",
-			     loops, &cpumask, bulk, queue,
-			     time_bench_CPU_BULK_enq_or_deq_spsc);
+		if (type & ALF_FLAG_CACHED)
+			run_parallel("alf_queue_BULK_SPSC_cached_parallel_many_CPUs",
+				     loops, &cpumask, bulk, queue,
+				     time_bench_CPU_BULK_enq_or_deq_spsc_cached);
+		else
+			run_parallel("alf_queue_BULK_SPSC_parallel_many_CPUs",
+				     loops, &cpumask, bulk, queue,
+				     time_bench_CPU_BULK_enq_or_deq_spsc);
 	} else if (type & MPMC) {
 		run_parallel("alf_queue_BULK_MPMC_parallel_many_CPUs",
 			     loops, &cpumask, bulk, queue,
@@ -396,8 +424,15 @@ int run_benchmark_tests(void)
 	int prefill = 32000;
 	int q_size = 65536;
 
+	/* Per CPU PMU counters (e.g. LLC/L1D misses) show the reduced
+	 * cache-line bouncing of the cached SPSC variant
+	 */
+	if (pmu_events)
+		time_bench_pmu_set_events(pmu_events);
+
 	run_parallel_two_CPUs(MPMC, loops, q_size, prefill);
 	run_parallel_two_CPUs(SPSC, loops, q_size, prefill);
+	run_parallel_two_CPUs(SPSC_CACHED, loops, q_size, prefill);
 
 	run_parallel_many_CPUs(MPMC, loops, q_size, prefill, parallel_cpus);
 	//run_parallel_many_CPUs(SPSC, loops, q_size, prefill, parallel_cpus);
@@ -406,6 +441,11 @@ int run_benchmark_tests(void)
 	run_parallel_many_CPUs_bulk(
 		MPMC, loops, q_size, prefill, parallel_cpus, bulk);
 	//run_parallel_many_CPUs_bulk(SPSC, loops, q_size, prefill, 2, 8);
+	run_parallel_many_CPUs_bulk(SPSC, loops, q_size, prefill, 2, bulk);
+	run_parallel_many_CPUs_bulk(SPSC_CACHED, loops, q_size, prefill, 2, bulk);
+
+	if (pmu_events)
+		time_bench_pmu_set_events(0);
 
 	return 0;
 }
@@ -0,0 +1,179 @@
+/*
+* Concurrency/parallel benchmark module for linux/alf_queue_set.h
+*  Fan-in from many producer CPUs into a single consumer CPU, comparing
+*  an alf_queue_set of SPSC queues with a single MPSC alf_queue.
+*
+*  The first CPU in the cpumask (cpu_idx 0) is the consumer, all other
+*  CPUs are producers.
+*/
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/alf_queue.h>
+#include <linux/alf_queue_set.h>
+#include <linux/time_bench.h>
+#include <linux/slab.h>
+
+static int verbose=1;
+
+static int parallel_cpus = 4;
+module_param(parallel_cpus, uint, 0);
+MODULE_PARM_DESC(parallel_cpus, "Number of parallel CPUs, one consumer (default 4)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+static int bulk = 8;
+module_param(bulk, uint, 0);
+MODULE_PARM_DESC(bulk, "Bulk size for enqueue and dequeue (default 8)");
+
+static int nr_queues = 64;
+module_param(nr_queues, uint, 0);
+MODULE_PARM_DESC(nr_queues, "Queues in set, producers use the first ones, rest stay idle (default 64)");
+
+#define MAX_BULK 64
+#define Q_SIZE	 1024
+
+struct fan_in {
+	struct alf_queue_set *set;	/* Used if non-NULL */
+	struct alf_queue *mpsc;
+	int nr_producers;
+};
+
+static __always_inline int time_bench_fan_in(
+	struct time_bench_record *rec, void *data, bool use_set)
+{
+	struct fan_in *f = data;
+	void *objs[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	uint64_t target;
+	int n, i;
+	int bulk = min_t(int, rec->step, MAX_BULK);
+	bool consumer = (rec->cpu_idx == 0);
+	unsigned int idx = rec->cpu_idx - 1;
+
+	for (i = 0; i < MAX_BULK; i++)
+		objs[i] = (void *)(unsigned long)(i+20);
+
+	/* Consumer dequeue everything all producers enqueue */
+	target = consumer ? rec->loops * f->nr_producers : rec->loops;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < target) {
+		n = min_t(uint64_t, bulk, target - loops_cnt);
+		if (consumer) {
+			if (use_set)
+				n = alf_queue_set_dequeue(f->set, objs, n);
+			else
+				n = alf_sc_dequeue(f->mpsc, objs, n);
+		} else {
+			if (use_set)
+				n = alf_queue_set_enqueue(f->set, idx, objs, n);
+			else
+				n = alf_mp_enqueue(f->mpsc, objs, n);
+		}
+		if (n == 0) {
+			cpu_relax(); /* empty or full, wait for other side */
+			continue;
+		}
+		loops_cnt += n;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark consumer, as "step" gets printed */
+	rec->step = consumer;
+	return loops_cnt;
+}
+static int time_bench_fan_in_set(struct time_bench_record *rec, void *data)
+{
+	return time_bench_fan_in(rec, data, true);
+}
+static int time_bench_fan_in_mpsc(struct time_bench_record *rec, void *data)
+{
+	return time_bench_fan_in(rec, data, false);
+}
+
+static void run_parallel(const char *desc, uint32_t loops,
+			 const cpumask_t *cpumask, int step, void *data,
+			 int (*func)(struct time_bench_record *record,
+				     void *data))
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	size_t size;
+
+	/* Allocate records for every CPU */
+	size = sizeof(*cpu_tasks) * num_possible_cpus();
+	cpu_tasks = kzalloc(size, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	time_bench_run_concurrent(loops, step, data,
+				  cpumask, &sync, cpu_tasks, func);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+
+	kfree(cpu_tasks);
+}
+
+int run_benchmark_tests(void)
+{
+	uint32_t loops = 1000000;
+	struct fan_in f = {};
+	cpumask_t cpumask;
+	int cpus;
+
+	cpus = time_bench_cpumask_select(&cpumask, topology, parallel_cpus);
+	if (cpus < 2) {
+		pr_err("Need at least two CPUs (got %d)\n", cpus);
+		return -EINVAL;
+	}
+	f.nr_producers = cpus - 1;
+	if (nr_queues < f.nr_producers)
+		nr_queues = f.nr_producers;
+	if (verbose)
+		pr_info("Fan-in: %d producers, set of %d queues, bulk:%d\n",
+			f.nr_producers, nr_queues, bulk);
+
+	f.set = alf_queue_set_alloc(nr_queues, Q_SIZE, GFP_KERNEL);
+	if (IS_ERR(f.set))
+		return PTR_ERR(f.set);
+	run_parallel("alf_queue_set_fan_in", loops, &cpumask, bulk, &f,
+		     time_bench_fan_in_set);
+	alf_queue_set_free(f.set);
+	f.set = NULL;
+
+	f.mpsc = alf_queue_alloc(Q_SIZE, GFP_KERNEL);
+	if (IS_ERR(f.mpsc))
+		return PTR_ERR(f.mpsc);
+	run_parallel("alf_queue_MPSC_fan_in", loops, &cpumask, bulk, &f,
+		     time_bench_fan_in_mpsc);
+	alf_queue_free(f.mpsc);
+
+	return 0;
+}
+
+static int __init alf_queue_set_parallel01_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (run_benchmark_tests() < 0) {
+		return -ECANCELED;
+	}
+
+	return 0;
+}
+module_init(alf_queue_set_parallel01_module_init);
+
+static void __exit alf_queue_set_parallel01_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(alf_queue_set_parallel01_module_exit);
+
+MODULE_DESCRIPTION("Fan-in benchmark of alf_queue_set vs. MPSC alf_queue");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -7,6 +7,11 @@
 
 #include <linux/module.h>
 #include <linux/alf_queue.h>
+#include <linux/alf_queue_resize.h>
+#include <linux/alf_queue_seq.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
 
 static int verbose=1;
 
@@ -211,6 +216,328 @@ fail:
 #undef SIZE
 }
 
+/* Testing: the "variable" burst semantics.  A burst enqueue into a
+ * queue with less space than the bulk size, enqueue what fits
+ * instead of aborting.
+ */
+static __always_inline bool
+__test_burst_partial(bool single)
+{
+#define BULK 10
+#define SIZE 16
+	struct alf_queue *q;
+	void *objs[BULK];
+	void *deq_objs[SIZE];
+	int i, n = 42;
+	int cnt;
+
+	q = alf_queue_alloc(SIZE, GFP_KERNEL);
+	if (IS_ERR_OR_NULL(q))
+		return false;
+	for (i = 0; i < BULK; i++)
+		objs[i] = (void *)(unsigned long)(n + i);
+
+	/* First burst fits completely */
+	cnt = single ? alf_sp_enqueue_burst(q, objs, BULK) :
+		       alf_mp_enqueue_burst(q, objs, BULK);
+	if (cnt != BULK)
+		goto fail;
+	/* Fixed semantics must still abort on a partial fit */
+	cnt = single ? alf_sp_enqueue(q, objs, BULK) :
+		       alf_mp_enqueue(q, objs, BULK);
+	if (cnt != 0)
+		goto fail;
+	/* Second burst only partially fits */
+	cnt = single ? alf_sp_enqueue_burst(q, objs, BULK) :
+		       alf_mp_enqueue_burst(q, objs, BULK);
+	if (verbose)
+		pr_info("%s(single:%d): partial burst enq:%d avail:%d\n",
+			__func__, single, cnt, alf_queue_avail_space(q));
+	if (cnt != (SIZE - BULK))
+		goto fail;
+	/* Queue full, burst enqueue returns zero */
+	cnt = single ? alf_sp_enqueue_burst(q, objs, BULK) :
+		       alf_mp_enqueue_burst(q, objs, BULK);
+	if (cnt != 0 || alf_queue_avail_space(q) != 0)
+		goto fail;
+
+	/* Dequeue burst, more than available */
+	cnt = single ? alf_sc_dequeue_burst(q, deq_objs, SIZE) :
+		       alf_mc_dequeue_burst(q, deq_objs, SIZE);
+	if (cnt != SIZE)
+		goto fail;
+	/* Validate order: first full burst followed by the partial one */
+	for (i = 0; i < SIZE; i++) {
+		if (deq_objs[i] != objs[i % BULK])
+			goto fail;
+	}
+	if (!alf_queue_empty(q))
+		goto fail;
+	cnt = single ? alf_sc_dequeue_burst(q, deq_objs, SIZE) :
+		       alf_mc_dequeue_burst(q, deq_objs, SIZE);
+	if (cnt != 0)
+		goto fail;
+
+	alf_queue_free(q);
+	return true;
+fail:
+	alf_queue_free(q);
+	return false;
+#undef BULK
+#undef SIZE
+}
+
+static bool test_burst_partial_mpmc(void)
+{
+	return __test_burst_partial(false);
+}
+
+/* Single threaded test, no need to disable preemption for SP/SC */
+static bool test_burst_partial_spsc(void)
+{
+	return __test_burst_partial(true);
+}
+
+/* Testing: per-slot sequence queue keeps FIFO order over several laps
+ * of the ring, fixed enqueue aborts when the bulk does not fit, and
+ * burst enqueue/dequeue return what fits (is available).
+ */
+static bool test_seq_queue_full_and_empty(void)
+{
+#define BULK 6
+#define SIZE 16
+	struct alf_queue_seq *q;
+	void *objs[BULK];
+	void *deq_objs[BULK];
+	unsigned long enq_n = 20, deq_n = 20;
+	int i, j, cnt;
+
+	q = alf_queue_seq_alloc(SIZE, GFP_KERNEL);
+	if (IS_ERR_OR_NULL(q))
+		return false;
+	/* Several laps, FIFO order must hold across the wrap */
+	for (j = 0; j < 4 * SIZE / BULK; j++) {
+		for (i = 0; i < BULK; i++)
+			objs[i] = (void *)enq_n++;
+		if (alf_seq_mp_enqueue(q, objs, BULK) != BULK)
+			goto fail;
+		if (alf_seq_mc_dequeue(q, deq_objs, BULK) != BULK)
+			goto fail;
+		for (i = 0; i < BULK; i++)
+			if ((unsigned long)deq_objs[i] != deq_n++)
+				goto fail;
+	}
+	/* Fill up: SIZE/BULK fixed enqueues fit, the next one does not */
+	for (j = 0; j < SIZE / BULK; j++)
+		if (alf_seq_mp_enqueue(q, objs, BULK) != BULK)
+			goto fail;
+	if (alf_seq_mp_enqueue(q, objs, BULK) != 0)
+		goto fail;
+	/* Burst enqueue fills the remaining slots */
+	cnt = alf_seq_mp_enqueue_burst(q, objs, BULK);
+	if (cnt != SIZE % BULK)
+		goto fail;
+	if (alf_seq_mp_enqueue_burst(q, objs, BULK) != 0)
+		goto fail;
+	/* Drain: dequeue returns what is left, then empty */
+	for (cnt = 0; (i = alf_seq_mc_dequeue(q, deq_objs, BULK)) > 0;)
+		cnt += i;
+	if (cnt != SIZE)
+		goto fail;
+	if (alf_seq_mc_dequeue(q, deq_objs, 1) != 0)
+		goto fail;
+	alf_queue_seq_free(q);
+	return true;
+fail:
+	alf_queue_seq_free(q);
+	return false;
+#undef BULK
+#undef SIZE
+}
+
+/* Testing: online resize keeps FIFO order across the queue swap, and
+ * elements in the old queue are dequeued before the new ones.
+ */
+static bool test_resize_grow_and_shrink(void)
+{
+#define SIZE 16
+#define ELEMS 40
+	struct alf_queue_rs r;
+	void *obj, *deq_obj;
+	unsigned long i, n = 0, next = 0;
+
+	if (alf_queue_rs_init(&r, SIZE, GFP_KERNEL))
+		return false;
+
+	/* Fill the small queue, then grow while it holds elements */
+	for (i = 0; i < SIZE; i++, n++) {
+		obj = (void *)n;
+		if (alf_queue_rs_mp_enqueue(&r, &obj, 1) != 1)
+			goto fail;
+	}
+	if (alf_queue_rs_resize(&r, 64, GFP_KERNEL))
+		goto fail;
+	/* Not drained yet, second resize must wait for consumers */
+	if (alf_queue_rs_resize(&r, 8, GFP_KERNEL) != -EBUSY)
+		goto fail;
+	for (i = 0; i < ELEMS; i++, n++) {
+		obj = (void *)n;
+		if (alf_queue_rs_mp_enqueue(&r, &obj, 1) != 1)
+			goto fail;
+	}
+	/* Dequeue all in order, crossing from old to new queue */
+	while (alf_queue_rs_mc_dequeue(&r, &deq_obj, 1) == 1) {
+		if ((unsigned long)deq_obj != next++)
+			goto fail;
+	}
+	if (verbose)
+		pr_info("%s(): dequeued %lu of %lu in order\n",
+			__func__, next, n);
+	if (next != n)
+		goto fail;
+
+	/* Drained, thus shrinking is now allowed */
+	if (alf_queue_rs_resize(&r, 8, GFP_KERNEL))
+		goto fail;
+	alf_queue_rs_destroy(&r);
+	return true;
+fail:
+	alf_queue_rs_destroy(&r);
+	return false;
+#undef SIZE
+#undef ELEMS
+}
+
+/* Testing: resize under concurrent MP/MC load loses no elements.
+ *
+ * Producers enqueue a known sequence while the queue is resized back
+ * and forth, consumers count and sum what they dequeue.  An element
+ * stranded in an old queue makes the dequeued count fall short.
+ * alf_mp_enqueue/alf_mc_dequeue are not preemption safe, thus the
+ * threads disable preemption around each call.
+ */
+#define RS_PRODUCERS	2
+#define RS_CONSUMERS	2
+#define RS_PER_PROD	200000UL
+
+struct rs_stress {
+	struct alf_queue_rs r;
+	atomic_t producers_done;
+	atomic64_t deq_cnt;
+	atomic64_t deq_sum;
+};
+
+static int rs_stress_producer(void *data)
+{
+	struct rs_stress *st = data;
+	unsigned long i;
+	void *obj;
+	int cnt;
+
+	for (i = 1; i <= RS_PER_PROD && !kthread_should_stop(); i++) {
+		obj = (void *)i;
+		do {
+			preempt_disable();
+			cnt = alf_queue_rs_mp_enqueue(&st->r, &obj, 1);
+			preempt_enable();
+			if (!cnt)
+				cond_resched();
+		} while (!cnt && !kthread_should_stop());
+	}
+	atomic_inc(&st->producers_done);
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(1);
+	return 0;
+}
+
+static int rs_stress_consumer(void *data)
+{
+	struct rs_stress *st = data;
+	void *objs[8];
+	int cnt, i;
+
+	while (!kthread_should_stop()) {
+		preempt_disable();
+		cnt = alf_queue_rs_mc_dequeue(&st->r, objs, 8);
+		preempt_enable();
+		if (!cnt) {
+			cond_resched();
+			continue;
+		}
+		for (i = 0; i < cnt; i++)
+			atomic64_add((unsigned long)objs[i], &st->deq_sum);
+		atomic64_add(cnt, &st->deq_cnt);
+	}
+	return 0;
+}
+
+static bool test_resize_concurrent_mpmc(void)
+{
+	const u64 total = RS_PRODUCERS * RS_PER_PROD;
+	const u64 sum = RS_PRODUCERS * (RS_PER_PROD * (RS_PER_PROD + 1) / 2);
+	struct task_struct *tasks[RS_PRODUCERS + RS_CONSUMERS] = {};
+	unsigned long timeout;
+	unsigned int resizes = 0, busy = 0;
+	struct rs_stress *st;
+	bool ok = false;
+	int i, err;
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return false;
+	if (alf_queue_rs_init(&st->r, 16, GFP_KERNEL))
+		goto out_free;
+
+	for (i = 0; i < ARRAY_SIZE(tasks); i++) {
+		tasks[i] = kthread_run(i < RS_PRODUCERS ?
+				       rs_stress_producer : rs_stress_consumer,
+				       st, "alf_rs_test%d", i);
+		if (IS_ERR(tasks[i])) {
+			tasks[i] = NULL;
+			goto out_stop;
+		}
+	}
+
+	/* Grow and shrink while producers are running */
+	while (atomic_read(&st->producers_done) < RS_PRODUCERS) {
+		err = alf_queue_rs_resize(&st->r, (resizes & 1) ? 16 : 1024,
+					  GFP_KERNEL);
+		if (err == -EBUSY)
+			busy++;
+		else if (err)
+			goto out_stop;
+		else
+			resizes++;
+		usleep_range(100, 200);
+	}
+
+	/* Consumers must get every element, lost ones never show up */
+	timeout = jiffies + 10 * HZ;
+	while (atomic64_read(&st->deq_cnt) < total &&
+	       time_before(jiffies, timeout))
+		msleep(1);
+	ok = true;
+out_stop:
+	for (i = 0; i < ARRAY_SIZE(tasks); i++)
+		if (tasks[i])
+			kthread_stop(tasks[i]);
+
+	if (verbose)
+		pr_info("%s(): resizes:%u busy:%u dequeued %lld of %llu\n",
+			__func__, resizes, busy,
+			(s64)atomic64_read(&st->deq_cnt), total);
+	if (atomic64_read(&st->deq_cnt) != total ||
+	    atomic64_read(&st->deq_sum) != sum)
+		ok = false;
+	alf_queue_rs_destroy(&st->r);
+out_free:
+	kfree(st);
+	return ok;
+}
+#undef RS_PRODUCERS
+#undef RS_CONSUMERS
+#undef RS_PER_PROD
+
 #define TEST_FUNC(func) 					\
 do {								\
 	if (!(func)) {						\
@@ -231,6 +558,11 @@ int run_basic_tests(void)
 	TEST_FUNC(test_add_and_remove_elem());
 	TEST_FUNC(test_add_and_remove_elems_BULK());
 	TEST_FUNC(test_add_until_full());
+	TEST_FUNC(test_burst_partial_mpmc());
+	TEST_FUNC(test_burst_partial_spsc());
+	TEST_FUNC(test_seq_queue_full_and_empty());
+	TEST_FUNC(test_resize_grow_and_shrink());
+	TEST_FUNC(test_resize_concurrent_mpmc());
 	return passed_count;
 }
 
@@ -0,0 +1,373 @@
+/*
+ * Benchmark of cross CPU page recycling strategies, side by side.
+ *
+ * mm/bench/page_bench05_cross_cpu.c (experiment1/3) and
+ * bench_page_pool_cross_cpu.c (returning_cpus) measure related things
+ * with different loop structures, thus cannot be compared directly.
+ * This module runs every strategy under the same loop and the same
+ * producer/consumer topology:
+ *
+ *  CPUs are paired (cpu_idx even/odd, see time_bench_cpumask_select()
+ *  "topology").  The even CPU simulates NIC-RX: gets a page and
+ *  transfers it over a SPSC ptr_ring to its partner, simulating the
+ *  remote CPU consuming/freeing the page (e.g. TX completion).
+ *
+ *  Strategies:
+ *   plain     : alloc_pages() / put_page() on remote CPU
+ *   ring      : remote CPU returns page to owner via a ptr_ring,
+ *               owner reuses returned pages before alloc_pages()
+ *   pp_ring   : page_pool alloc, remote page_pool_put_page() which
+ *               recycles into the pool's ptr_ring
+ *   pp_direct : page_pool alloc, remote returns page to owner via a
+ *               ptr_ring, owner does the direct (alloc cache) put
+ *
+ * Reported per CPU are ns per page (time_bench stats, "step" marks
+ * owner:1/remote:0 CPU) and, with cache_misses=1, LLC and L1D misses
+ * per page via time_bench PMU events.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+
+#include <linux/page_pool_compat.h>
+
+#include <linux/interrupt.h>
+#include <linux/limits.h>
+#include <linux/ptr_ring.h>
+
+static int verbose=1;
+
+static uint32_t loops = 1000000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Pages per CPU per strategy");
+
+static int nr_pairs = 1;
+module_param(nr_pairs, uint, 0);
+MODULE_PARM_DESC(nr_pairs, "Number of owner/remote CPU pairs");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|smt|node|cross|<cpulist> (default first)");
+
+static int cache_misses = 1;
+module_param(cache_misses, uint, 0);
+MODULE_PARM_DESC(cache_misses, "Count LLC and L1D misses via time_bench PMU events");
+
+/* Quick and dirty way to unselect some of the strategies.
+ * Hint: Bash shells support writing binary number like: $((2#101010))
+ */
+static unsigned long run_flags = 0xFFFFFFFF;
+module_param(run_flags, ulong, 0);
+MODULE_PARM_DESC(run_flags, "Hack way to limit bench to run");
+
+#define MY_POOL_SIZE	1024
+#define SPSC_QUEUE_SZ	1024
+
+enum recycle_type {
+	RECYCLE_PLAIN = 0,
+	RECYCLE_RING,
+	RECYCLE_PP_RING,
+	RECYCLE_PP_DIRECT,
+	RECYCLE_NR
+};
+
+static const char *recycle_names[RECYCLE_NR] = {
+	[RECYCLE_PLAIN]     = "cross_cpu_plain",
+	[RECYCLE_RING]      = "cross_cpu_ring",
+	[RECYCLE_PP_RING]   = "cross_cpu_pp_ring",
+	[RECYCLE_PP_DIRECT] = "cross_cpu_pp_direct",
+};
+
+struct cpu_pair {
+	struct ptr_ring xfer;	/* owner -> remote */
+	struct ptr_ring ret;	/* remote -> owner */
+	struct page_pool *pp;
+	bool abort;		/* Owner failed, remote must not wait */
+} ____cacheline_aligned_in_smp;
+
+struct recycle_bench {
+	struct cpu_pair *pairs;
+	enum recycle_type type;
+};
+
+static struct page_pool *pp_create(void)
+{
+	struct page_pool *pp;
+
+	struct page_pool_params pp_params = {
+		.order = 0,
+		.flags = 0,
+		.pool_size = MY_POOL_SIZE,
+		.nid = NUMA_NO_NODE,
+		.dev = NULL, /* Only use for DMA mapping */
+		.dma_dir = DMA_BIDIRECTIONAL,
+	};
+
+	pp = page_pool_create(&pp_params);
+	if (IS_ERR(pp)) {
+		pr_warn("%s: Error(%ld) creating page_pool\n",
+			__func__, PTR_ERR(pp));
+		return NULL;
+	}
+	return pp;
+}
+
+/* Owner side, get a page like NIC-RX refill */
+static __always_inline struct page *owner_get_page(struct cpu_pair *p,
+						   enum recycle_type type)
+{
+	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_NORETRY | __GFP_NOWARN);
+	struct page *page;
+
+	switch (type) {
+	case RECYCLE_PLAIN:
+		return alloc_page(gfp_mask);
+	case RECYCLE_RING:
+		page = __ptr_ring_consume(&p->ret);
+		if (page)
+			return page;
+		return alloc_page(gfp_mask);
+	case RECYCLE_PP_RING:
+		local_bh_disable(); /* page_pool alloc runs in NAPI */
+		page = page_pool_alloc_pages(p->pp, gfp_mask);
+		local_bh_enable();
+		return page;
+	case RECYCLE_PP_DIRECT:
+		local_bh_disable();
+		/* Returned pages go into the lockless alloc cache */
+		while ((page = __ptr_ring_consume(&p->ret)))
+			page_pool_recycle_direct(p->pp, page);
+		page = page_pool_alloc_pages(p->pp, gfp_mask);
+		local_bh_enable();
+		return page;
+	default:
+		BUILD_BUG();
+	}
+	return NULL;
+}
+
+/* Remote side, page is done with */
+static __always_inline void remote_put_page(struct cpu_pair *p,
+					    struct page *page,
+					    enum recycle_type type)
+{
+	switch (type) {
+	case RECYCLE_PLAIN:
+		put_page(page);
+		break;
+	case RECYCLE_RING:
+		if (__ptr_ring_produce(&p->ret, page) < 0)
+			put_page(page); /* Owner ring full */
+		break;
+	case RECYCLE_PP_RING:
+		_page_pool_put_page(p->pp, page, false);
+		break;
+	case RECYCLE_PP_DIRECT:
+		if (__ptr_ring_produce(&p->ret, page) < 0)
+			_page_pool_put_page(p->pp, page, false);
+		break;
+	default:
+		BUILD_BUG();
+	}
+}
+
+static __always_inline int time_cross_cpu_recycle(
+	struct time_bench_record *rec, void *data, enum recycle_type type)
+{
+	struct recycle_bench *b = data;
+	struct cpu_pair *p = &b->pairs[rec->cpu_idx / 2];
+	bool owner_CPU = (rec->cpu_idx % 2) == 0;
+	uint64_t loops_cnt = 0;
+	struct page *page;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (owner_CPU) {
+			page = owner_get_page(p, type);
+			if (unlikely(!page)) {
+				WRITE_ONCE(p->abort, true);
+				break;
+			}
+			while (__ptr_ring_produce(&p->xfer, page) < 0)
+				cpu_relax(); /* full, wait for remote CPU */
+		} else {
+			page = __ptr_ring_consume(&p->xfer);
+			if (!page) {
+				if (READ_ONCE(p->abort))
+					break;
+				cpu_relax(); /* empty, wait for owner CPU */
+				continue;
+			}
+			remote_put_page(p, page, type);
+		}
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark owner/remote, as "step" gets printed */
+	rec->step = owner_CPU;
+	return loops_cnt;
+}
+/* Compiler should inline optimize other function calls out */
+static int time_plain(struct time_bench_record *rec, void *data)
+{
+	return time_cross_cpu_recycle(rec, data, RECYCLE_PLAIN);
+}
+static int time_ring(struct time_bench_record *rec, void *data)
+{
+	return time_cross_cpu_recycle(rec, data, RECYCLE_RING);
+}
+static int time_pp_ring(struct time_bench_record *rec, void *data)
+{
+	return time_cross_cpu_recycle(rec, data, RECYCLE_PP_RING);
+}
+static int time_pp_direct(struct time_bench_record *rec, void *data)
+{
+	return time_cross_cpu_recycle(rec, data, RECYCLE_PP_DIRECT);
+}
+
+static int (*recycle_funcs[RECYCLE_NR])(struct time_bench_record *rec,
+					void *data) = {
+	[RECYCLE_PLAIN]     = time_plain,
+	[RECYCLE_RING]      = time_ring,
+	[RECYCLE_PP_RING]   = time_pp_ring,
+	[RECYCLE_PP_DIRECT] = time_pp_direct,
+};
+
+/* Return leftover pages, a run can stop with pages in the rings */
+static void drain_pair(struct cpu_pair *p)
+{
+	struct page *page;
+
+	while ((page = __ptr_ring_consume(&p->xfer)) ||
+	       (page = __ptr_ring_consume(&p->ret))) {
+		if (p->pp)
+			_page_pool_put_page(p->pp, page, false);
+		else
+			put_page(page);
+	}
+}
+
+static void run_parallel(struct recycle_bench *b, const cpumask_t *cpumask,
+			 int pairs)
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	enum recycle_type type = b->type;
+	size_t size;
+	int i;
+
+	/* Allocate records for every CPU */
+	size = sizeof(*cpu_tasks) * num_possible_cpus();
+	cpu_tasks = kzalloc(size, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	for (i = 0; i < pairs; i++) {
+		b->pairs[i].abort = false;
+		b->pairs[i].pp = NULL;
+		if (type == RECYCLE_PP_RING || type == RECYCLE_PP_DIRECT) {
+			b->pairs[i].pp = pp_create();
+			if (!b->pairs[i].pp)
+				goto out;
+		}
+	}
+
+	time_bench_run_concurrent(loops, 0, b, cpumask, &sync, cpu_tasks,
+				  recycle_funcs[type]);
+	time_bench_print_stats_cpumask(recycle_names[type], cpu_tasks,
+				       cpumask);
+out:
+	for (i = 0; i < pairs; i++) {
+		drain_pair(&b->pairs[i]);
+		if (b->pairs[i].pp)
+			page_pool_destroy(b->pairs[i].pp);
+		b->pairs[i].pp = NULL;
+	}
+	kfree(cpu_tasks);
+}
+
+int run_benchmarks(void)
+{
+	struct recycle_bench b = {};
+	cpumask_t cpumask;
+	int cpus, pairs, i, err = 0;
+
+	cpus = time_bench_cpumask_select(&cpumask, topology, nr_pairs * 2);
+	if (cpus < 2) {
+		pr_err("Need at least two CPUs (got %d)\n", cpus);
+		return -EINVAL;
+	}
+	if (cpus % 2)
+		cpumask_clear_cpu(cpumask_last(&cpumask), &cpumask);
+	pairs = cpus / 2;
+	time_bench_print_topology("cross_cpu_recycle", &cpumask);
+
+	b.pairs = kcalloc(pairs, sizeof(*b.pairs), GFP_KERNEL);
+	if (!b.pairs)
+		return -ENOMEM;
+	for (i = 0; i < pairs; i++) {
+		err = ptr_ring_init(&b.pairs[i].xfer, SPSC_QUEUE_SZ, GFP_KERNEL);
+		if (err)
+			goto out;
+		err = ptr_ring_init(&b.pairs[i].ret, SPSC_QUEUE_SZ, GFP_KERNEL);
+		if (err) {
+			ptr_ring_cleanup(&b.pairs[i].xfer, NULL);
+			goto out;
+		}
+	}
+
+	if (cache_misses)
+		time_bench_pmu_set_events((1U << TIME_BENCH_PMU_LLC_MISSES) |
+					  (1U << TIME_BENCH_PMU_L1D_MISSES));
+
+	for (b.type = 0; b.type < RECYCLE_NR; b.type++) {
+		if (!(run_flags & (1 << b.type)))
+			continue;
+		if (verbose)
+			pr_info("Strategy %s with %d CPU pairs\n",
+				recycle_names[b.type], pairs);
+		run_parallel(&b, &cpumask, pairs);
+	}
+
+	if (cache_misses)
+		time_bench_pmu_set_events(0);
+out:
+	/* Rings are drained after each run */
+	while (i--) {
+		ptr_ring_cleanup(&b.pairs[i].xfer, NULL);
+		ptr_ring_cleanup(&b.pairs[i].ret, NULL);
+	}
+	kfree(b.pairs);
+	return err;
+}
+
+static int __init bench_page_cross_cpu_recycle_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!nr_pairs) {
+		pr_err("Module param nr_pairs must be at least 1\n");
+		return -EINVAL;
+	}
+
+	if (run_benchmarks() < 0)
+		return -ECANCELED;
+
+	return 0;
+}
+module_init(bench_page_cross_cpu_recycle_module_init);
+
+static void __exit bench_page_cross_cpu_recycle_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(bench_page_cross_cpu_recycle_module_exit);
+
+MODULE_DESCRIPTION("Benchmark of cross CPU page recycling strategies");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
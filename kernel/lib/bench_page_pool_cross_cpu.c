@@ -10,19 +10,13 @@
 #include <linux/mutex.h>
 #include <linux/time_bench.h>
 
-#include <linux/version.h>
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 5, 0)
-#include <net/page_pool.h>
-#else
-#include <net/page_pool/helpers.h>
-#endif
+#include <linux/page_pool_compat.h>
 
 #include <linux/interrupt.h>
 #include <linux/limits.h>
 #include <linux/delay.h>
 #include <linux/ptr_ring.h>
 
-/* notice time_bench is limited to U32_MAX nr loops */
 static unsigned long loops = 1000000;
 module_param(loops, ulong, 0);
 MODULE_PARM_DESC(loops, "Specify loops bench will run");
@@ -37,20 +31,12 @@ static int verbose=1;
 
 #define SPSC_QUEUE_SZ	1024
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
-static inline
-void _page_pool_put_page(struct page_pool *pool, struct page *page,
-			 bool allow_direct)
-{
-	page_pool_put_page(pool, page, -1, allow_direct);
-}
-#else
-static inline
-void _page_pool_put_page(struct page_pool *pool, struct page *page,
-			 bool allow_direct)
-{
-	page_pool_put_page(pool, page, allow_direct);
-}
+#ifdef HAVE_PAGE_POOL_FRAG
+/* Each size is a run, where remote CPUs return frags instead of pages */
+static unsigned int frag_sizes[8] = { 1024, 2048, 4096 };
+static int nr_frag_sizes = 3;
+module_param_array(frag_sizes, uint, &nr_frag_sizes, 0);
+MODULE_PARM_DESC(frag_sizes, "Fragment sizes of frag benches (default 1024,2048,4096)");
 #endif
 
 /*
@@ -85,6 +71,10 @@ void _page_pool_put_page(struct page_pool *pool, struct page *page,
  * setup.  These queues will have a bounded size, which will be the limiting
  * factor for refill-simulator CPU.
  *
+ * Frag variant: the refill CPU allocates frags (page_pool_alloc_frag)
+ * like drivers splitting pages into 2K/4K buffers.  A page is recycled
+ * by the last frag returned, thus remote CPUs also contend on the
+ * frag refcnt of pages shared between them.  Cost is per fragment.
  */
 
 bool init_cpu_queue(struct ptr_ring *queue, int q_size, int prefill,
@@ -140,14 +130,15 @@ static void pp_prefill(struct page_pool *pp, int elems)
 	kfree(array);
 }
 
-struct page_pool *pp_create(int pool_size, unsigned int prefill)
+struct page_pool *pp_create(int pool_size, unsigned int prefill,
+			    unsigned int flags)
 {
 	struct page_pool *pp;
 	int err;
 
 	struct page_pool_params pp_params = {
 		.order = 0,
-		.flags = 0,
+		.flags = flags,
 		.pool_size = pool_size,
 		.nid = NUMA_NO_NODE,
 		.dev = NULL, /* Only use for DMA mapping */
@@ -168,13 +159,26 @@ struct page_pool *pp_create(int pool_size, unsigned int prefill)
 struct datarec {
 	struct page_pool *pp;
 	int nr_cpus;
-	unsigned int nr_loops;
+	uint64_t nr_loops;
+	unsigned int frag_size;	/* Zero is whole pages */
 	struct ptr_ring *cpu_queues;
 	struct mutex wait_for_tasklet;
 	int tasklet_cpu;
 	struct tasklet_struct pp_tasklet;
 };
 
+static __always_inline
+struct page *pp_alloc(struct page_pool *pp, unsigned int frag_size,
+		      gfp_t gfp_mask)
+{
+#ifdef HAVE_PAGE_POOL_FRAG
+	unsigned int offset;
+
+	if (frag_size)
+		return page_pool_alloc_frag(pp, &offset, frag_size, gfp_mask);
+#endif
+	return page_pool_alloc_pages(pp, gfp_mask);
+}
 
 static void pp_tasklet_simulate_rx_napi(unsigned long data)
 {
@@ -200,7 +204,7 @@ static void pp_tasklet_simulate_rx_napi(unsigned long data)
 
 	while (cnt < nr_produce && --max_attempts) {
 
-		page = page_pool_alloc_pages(pp, gfp_mask);
+		page = pp_alloc(pp, d->frag_size, gfp_mask);
 		if (!page) {
 			pr_err("%s(): out-of-pages\n", __func__);
 			continue;
@@ -238,7 +242,7 @@ static int time_pp_put_page_recycle(
 	uint64_t wait_cnt = 0;
 	struct ptr_ring *queue;
 	struct page *page;
-	int i;
+	uint64_t i;
 
 	if (verbose)
 		pr_info("%s(): run on CPU:%d expect nr_cpus:%d\n",
@@ -300,7 +304,7 @@ static int time_pp_put_page_recycle(
 	return loops_cnt;
 }
 
-int run_parallel(const char *desc, uint32_t nr_loops, const cpumask_t *cpumask,
+int run_parallel(const char *desc, uint64_t nr_loops, const cpumask_t *cpumask,
 		 int step, void *data,
 		 int (*func)(struct time_bench_record *record, void *data)
 	)
@@ -332,8 +336,11 @@ static void empty_ptr_ring(struct page_pool *pp, struct ptr_ring *ring)
 }
 
 void noinline run_bench_pp_cpus(
-	int nr_cpus, uint32_t nr_loops, int q_size, int prefill)
+	int nr_cpus, uint64_t nr_loops, int q_size, int prefill,
+	unsigned int frag_size)
 {
+	unsigned int pp_flags = 0;
+	char desc[48];
 	struct ptr_ring *cpu_queues;
 	struct page_pool *pp;
 	cpumask_t cpumask;
@@ -343,7 +350,11 @@ void noinline run_bench_pp_cpus(
 	tasklet_init(&d.pp_tasklet, pp_tasklet_simulate_rx_napi,
 		     (unsigned long)&d);
 
-	pp = pp_create(MY_POOL_SIZE, 256 /*prefill*/ );
+#ifdef HAVE_PAGE_POOL_FRAG
+	if (frag_size)
+		pp_flags |= PP_FLAGS_FRAG;
+#endif
+	pp = pp_create(MY_POOL_SIZE, 256 /*prefill*/, pp_flags);
 	if (!pp)
 		return;
 
@@ -368,14 +379,19 @@ void noinline run_bench_pp_cpus(
 	d.nr_cpus = nr_cpus;
 	d.cpu_queues = cpu_queues;
 	d.nr_loops = nr_loops;
+	d.frag_size = frag_size;
 	mutex_init(&d.wait_for_tasklet);
 
 	mutex_lock(&d.wait_for_tasklet);
 	//tasklet_enable(&d.pp_tasklet);
 	/* tasklet schedule happens in time_pp_put_page_recycle() */
 
-	run_parallel("page_pool_cross_cpu",
-		     nr_loops, &cpumask, nr_cpus, &d,
+	if (frag_size)
+		snprintf(desc, sizeof(desc), "page_pool_cross_cpu_frag%u",
+			 frag_size);
+	else
+		snprintf(desc, sizeof(desc), "page_pool_cross_cpu");
+	run_parallel(desc, nr_loops, &cpumask, nr_cpus, &d,
 		     time_pp_put_page_recycle);
 
 //	mutex_lock(&d.wait_for_tasklet); /* Block waiting for tasklet */
@@ -391,9 +407,21 @@ fail:
 
 int run_benchmarks(void)
 {
-	uint32_t nr_loops = loops;
+	uint64_t nr_loops = loops;
+	int i __maybe_unused;
 
-	run_bench_pp_cpus(returning_cpus, nr_loops, SPSC_QUEUE_SZ, 0);
+	run_bench_pp_cpus(returning_cpus, nr_loops, SPSC_QUEUE_SZ, 0, 0);
+
+#ifdef HAVE_PAGE_POOL_FRAG
+	for (i = 0; i < nr_frag_sizes; i++) {
+		if (!frag_sizes[i] || frag_sizes[i] > PAGE_SIZE) {
+			pr_warn("Skip invalid frag size:%u\n", frag_sizes[i]);
+			continue;
+		}
+		run_bench_pp_cpus(returning_cpus, nr_loops, SPSC_QUEUE_SZ, 0,
+				  frag_sizes[i]);
+	}
+#endif
 
 	return 1;
 }
@@ -403,12 +431,6 @@ static int __init bench_page_pool_cross_cpu_module_init(void)
 	if (verbose)
 		pr_info("Loaded\n");
 
-	if (loops > U32_MAX) {
-		pr_err("Module param loops(%lu) exceeded U32_MAX(%u)\n",
-		       loops, U32_MAX);
-		return -ECHRNG;
-	}
-
 	run_benchmarks();
 	return 0;
 }
@@ -0,0 +1,307 @@
+/*
+ * Benchmark module for page_pool.
+ *
+ * Multi-queue steady state: N simulated RX-queues, each with its own
+ * page_pool, running NAPI like (tasklet) on N CPUs.  A configurable
+ * fraction of frames is XDP_REDIRECT'ed to the other queues, which
+ * "transmit" and on TX completion return the page to the pool it came
+ * from (page->pp), via that pool's ptr_ring as it is a remote CPU.
+ * Remaining frames are dropped locally (XDP_DROP), recycling direct
+ * into the pool's alloc cache.
+ *
+ * Per NAPI poll (budget) a queue first completes frames redirected to
+ * it, then processes its RX budget.  Frames are redirected round-robin
+ * to the other queues, a full TX ring drops the frame.
+ *
+ * Reported per queue CPU are ns per RX frame (time_bench stats) and
+ * the recycle hit rate, derived from pages the pool got from the page
+ * allocator (pool->pages_state_hold_cnt) during the run.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+
+#include <linux/version.h>
+#include <linux/page_pool_compat.h>
+
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/ptr_ring.h>
+
+static int verbose=1;
+
+static unsigned long loops = 1000000;
+module_param(loops, ulong, 0);
+MODULE_PARM_DESC(loops, "RX frames per queue");
+
+static unsigned int nr_queues = 4;
+module_param(nr_queues, uint, 0);
+MODULE_PARM_DESC(nr_queues, "Number of RX-queues, one CPU each");
+
+static unsigned int redirect_pct = 50;
+module_param(redirect_pct, uint, 0);
+MODULE_PARM_DESC(redirect_pct, "Percent of frames XDP_REDIRECT'ed to other queues");
+
+static unsigned int budget = 64;
+module_param(budget, uint, 0);
+MODULE_PARM_DESC(budget, "NAPI budget, frames per poll");
+
+static unsigned int pool_size = 1024;
+module_param(pool_size, uint, 0);
+MODULE_PARM_DESC(pool_size, "page_pool ptr_ring size per queue");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+#define TX_RING_SIZE	1024
+
+/* page->pp and page_pool_put_full_page() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+#define HAVE_PAGE_PP
+
+struct rx_queue {
+	int idx;
+	struct page_pool *pp;
+	struct ptr_ring tx_ring;	/* Frames redirected to this queue */
+	struct tasklet_struct tasklet;
+	struct completion done;
+	struct rx_queue *queues;	/* All queues, redirect targets */
+	u64 nr_frames;			/* Frames to process */
+
+	/* Stats of the run */
+	u64 frames, redirected, tx_full, tx_completed, alloc_fail;
+	u32 hold_start;
+	unsigned int redir_acc, redir_rr;
+} ____cacheline_aligned_in_smp;
+
+static struct page_pool *pp_create(void)
+{
+	struct page_pool *pp;
+
+	struct page_pool_params pp_params = {
+		.order = 0,
+		.flags = 0,
+		.pool_size = pool_size,
+		.nid = NUMA_NO_NODE,
+		.dev = NULL, /* Only use for DMA mapping */
+		.dma_dir = DMA_BIDIRECTIONAL,
+	};
+
+	pp = page_pool_create(&pp_params);
+	if (IS_ERR(pp)) {
+		pr_warn("%s: Error(%ld) creating page_pool\n",
+			__func__, PTR_ERR(pp));
+		return NULL;
+	}
+	return pp;
+}
+
+/* TX completion: return page to the pool it came from */
+static __always_inline void tx_complete(struct rx_queue *q)
+{
+	struct page *page;
+	unsigned int n;
+
+	for (n = 0; n < budget; n++) {
+		page = __ptr_ring_consume(&q->tx_ring);
+		if (!page)
+			break;
+		/* Remote CPU for page->pp, goes into its ptr_ring */
+		page_pool_put_full_page(page->pp, page, false);
+	}
+	q->tx_completed += n;
+}
+
+static __always_inline bool xdp_verdict_redirect(struct rx_queue *q)
+{
+	q->redir_acc += redirect_pct;
+	if (q->redir_acc < 100)
+		return false;
+	q->redir_acc -= 100;
+	return true;
+}
+
+static void napi_poll(struct rx_queue *q)
+{
+	struct rx_queue *target;
+	struct page *page;
+	unsigned int n, t;
+
+	tx_complete(q);
+
+	for (n = 0; n < budget; n++) {
+		page = page_pool_dev_alloc_pages(q->pp);
+		if (unlikely(!page)) {
+			q->alloc_fail++;
+			break;
+		}
+		/* XDP prog reads packet headers */
+		(void)READ_ONCE(*(unsigned long *)page_address(page));
+
+		if (nr_queues > 1 && xdp_verdict_redirect(q)) {
+			t = q->redir_rr++ % (nr_queues - 1);
+			target = &q->queues[(q->idx + 1 + t) % nr_queues];
+			if (ptr_ring_produce(&target->tx_ring, page) == 0) {
+				q->redirected++;
+				continue;
+			}
+			q->tx_full++;
+		}
+		/* XDP_DROP */
+		page_pool_recycle_direct(q->pp, page);
+	}
+	q->frames += n;
+}
+
+static void rx_queue_tasklet(unsigned long data)
+{
+	struct rx_queue *q = (struct rx_queue *)data;
+
+	while (q->frames < q->nr_frames) {
+		napi_poll(q);
+		if (unlikely(q->alloc_fail))
+			break;
+	}
+	complete(&q->done);
+}
+
+static int time_multiqueue(struct time_bench_record *rec, void *data)
+{
+	struct rx_queue *queues = data;
+	struct rx_queue *q = &queues[rec->cpu_idx];
+
+	q->nr_frames = rec->loops;
+	q->hold_start = READ_ONCE(q->pp->pages_state_hold_cnt);
+	reinit_completion(&q->done);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	/* Tasklet runs on the CPU that schedule it */
+	tasklet_schedule(&q->tasklet);
+	wait_for_completion(&q->done);
+	time_bench_stop(rec, q->frames);
+
+	return q->frames;
+}
+
+static void report_queue(struct rx_queue *q)
+{
+	u64 from_alloc = (u32)(q->pp->pages_state_hold_cnt - q->hold_start);
+	u64 frames = q->frames ? : 1;
+	u64 hit = frames > from_alloc ? frames - from_alloc : 0;
+
+	pr_info("queue:%d frames:%llu redirected:%llu tx_full:%llu"
+		" tx_completed:%llu page_alloc:%llu recycle-hit:%llu.%02llu%%\n",
+		q->idx, q->frames, q->redirected, q->tx_full,
+		q->tx_completed, from_alloc,
+		div64_u64(hit * 100, frames), div64_u64(hit * 10000, frames) % 100);
+	if (q->alloc_fail)
+		pr_warn("queue:%d stopped early, page_pool alloc failed\n",
+			q->idx);
+}
+
+static int run_benchmark(void)
+{
+	struct time_bench_cpu *cpu_tasks;
+	struct time_bench_sync sync;
+	struct rx_queue *queues;
+	cpumask_t cpumask;
+	struct page *page;
+	int cpus, i, err = 0;
+	char desc[64];
+
+	cpus = time_bench_cpumask_select(&cpumask, topology, nr_queues);
+	if (cpus < (int)nr_queues) {
+		pr_err("Need %u CPUs for queues (got %d)\n", nr_queues, cpus);
+		return -EINVAL;
+	}
+
+	queues = kcalloc(nr_queues, sizeof(*queues), GFP_KERNEL);
+	if (!queues)
+		return -ENOMEM;
+	cpu_tasks = kcalloc(num_possible_cpus(), sizeof(*cpu_tasks),
+			    GFP_KERNEL);
+	if (!cpu_tasks) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr_queues; i++) {
+		struct rx_queue *q = &queues[i];
+
+		q->idx = i;
+		q->queues = queues;
+		init_completion(&q->done);
+		tasklet_init(&q->tasklet, rx_queue_tasklet, (unsigned long)q);
+		err = ptr_ring_init(&q->tx_ring, TX_RING_SIZE, GFP_KERNEL);
+		if (err)
+			goto out_queues;
+		q->pp = pp_create();
+		if (!q->pp) {
+			ptr_ring_cleanup(&q->tx_ring, NULL);
+			err = -ENOMEM;
+			goto out_queues;
+		}
+	}
+
+	time_bench_run_concurrent(loops, 0, queues, &cpumask, &sync,
+				  cpu_tasks, time_multiqueue);
+	snprintf(desc, sizeof(desc), "page_pool_%uqueues_redirect%u%%",
+		 nr_queues, redirect_pct);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, &cpumask);
+	for (i = 0; i < nr_queues; i++)
+		report_queue(&queues[i]);
+
+out_queues:
+	/* Teardown: TX rings can hold pages of every pool */
+	while (i--) {
+		tasklet_kill(&queues[i].tasklet);
+		while ((page = __ptr_ring_consume(&queues[i].tx_ring)))
+			page_pool_put_full_page(page->pp, page, false);
+	}
+	for (i = 0; i < nr_queues; i++) {
+		if (!queues[i].pp)
+			break;
+		ptr_ring_cleanup(&queues[i].tx_ring, NULL);
+		page_pool_destroy(queues[i].pp);
+	}
+	kfree(cpu_tasks);
+out:
+	kfree(queues);
+	return err;
+}
+#endif /* HAVE_PAGE_PP */
+
+static int __init bench_page_pool_multiqueue_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!nr_queues || redirect_pct > 100 || !budget) {
+		pr_err("Invalid nr_queues:%u redirect_pct:%u or budget:%u\n",
+		       nr_queues, redirect_pct, budget);
+		return -EINVAL;
+	}
+#ifdef HAVE_PAGE_PP
+	if (run_benchmark() < 0)
+		return -ECANCELED;
+#else
+	pr_err("Need kernel v5.14+ (page->pp) for returning pages\n");
+	return -EOPNOTSUPP;
+#endif
+	return 0;
+}
+module_init(bench_page_pool_multiqueue_module_init);
+
+static void __exit bench_page_pool_multiqueue_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(bench_page_pool_multiqueue_module_exit);
+
+MODULE_DESCRIPTION("Benchmark of page_pool multi-queue with XDP_REDIRECT returns");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
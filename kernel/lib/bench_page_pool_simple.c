@@ -12,34 +12,17 @@
 #include <linux/time_bench.h>
 
 #include <linux/version.h>
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 5, 0)
-#include <net/page_pool.h>
-#else
-#include <net/page_pool/helpers.h>
-#endif
+#include <linux/page_pool_compat.h>
 
 #include <linux/interrupt.h>
 #include <linux/limits.h>
+#ifdef BENCH_QMEMPOOL
+#include <linux/qmempool.h>
+#endif
 
 static int verbose=1;
 #define MY_POOL_SIZE	1024
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
-static inline
-void _page_pool_put_page(struct page_pool *pool, struct page *page,
-			 bool allow_direct)
-{
-	page_pool_put_page(pool, page, -1, allow_direct);
-}
-#else
-static inline
-void _page_pool_put_page(struct page_pool *pool, struct page *page,
-			 bool allow_direct)
-{
-	page_pool_put_page(pool, page, allow_direct);
-}
-#endif
-
 DEFINE_MUTEX(wait_for_tasklet);
 
 /* Makes tests selectable. Useful for perf-record to analyze a single test.
@@ -59,11 +42,14 @@ enum benchmark_bit {
 	bit_run_bench_tasklet01,
 	bit_run_bench_tasklet02,
 	bit_run_bench_tasklet03,
+	bit_run_bench_no_softirq04,	/* qmempool page backed */
+	bit_run_bench_tasklet04,	/* qmempool page backed */
+	bit_run_bench_tasklet05,	/* frag alloc, fast-path recycle */
+	bit_run_bench_tasklet06,	/* frag alloc, ptr_ring return */
 };
 #define bit(b)		(1 << (b))
 #define enabled(b)	((run_flags & (bit(b))))
 
-/* notice time_bench is limited to U32_MAX nr loops */
 static unsigned long loops = 10000000;
 module_param(loops, ulong, 0);
 MODULE_PARM_DESC(loops, "Specify loops bench will run");
@@ -74,7 +60,7 @@ static int time_bench_for_loop(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
@@ -91,7 +77,7 @@ static int time_bench_atomic_inc(
 {
 	uint64_t loops_cnt = 0;
 	atomic_t cnt;
-	int i;
+	uint64_t i;
 
 	atomic_set(&cnt, 0);
 
@@ -115,7 +101,7 @@ static int time_bench_lock(
 {
 	uint64_t loops_cnt = 0;
 	spinlock_t lock;
-	int i;
+	uint64_t i;
 
 	spin_lock_init(&lock);
 
@@ -164,7 +150,8 @@ int time_bench_page_pool(
 {
 	uint64_t loops_cnt = 0;
 	gfp_t gfp_mask = GFP_ATOMIC; /* GFP_ATOMIC is not really needed */
-	int i, err;
+	uint64_t i;
+	int err;
 
 	struct page_pool *pp;
 	struct page *page;
@@ -252,6 +239,193 @@ int time_bench_page_pool03_slow(
 	return time_bench_page_pool(rec, data, type_page_allocator, __func__);
 }
 
+#ifdef HAVE_PAGE_POOL_FRAG
+static unsigned int frag_sizes[8] = { 512, 1024, 2048, 4096 };
+static int nr_frag_sizes = 4;
+module_param_array(frag_sizes, uint, &nr_frag_sizes, 0);
+MODULE_PARM_DESC(frag_sizes, "Fragment sizes of frag benches (default 512,1024,2048,4096)");
+
+/* Like a driver refilling its RX-ring, a bulk of frags is allocated
+ * before they are returned.  Else each alloc reuses the page just
+ * freed, and the page split and frag refcnt cost is not visible.
+ */
+#define FRAG_BULK	64
+
+static __always_inline
+int time_bench_page_pool_frag(
+	struct time_bench_record *rec, void *data,
+	enum test_type type, const char *func)
+{
+	unsigned int frag_size = (unsigned long)data;
+	gfp_t gfp_mask = GFP_ATOMIC;
+	struct page *pages[FRAG_BULK];
+	uint64_t loops_cnt = 0;
+	unsigned int offset;
+	int i, j, n, err;
+
+	struct page_pool *pp;
+
+	struct page_pool_params pp_params = {
+		.order = 0,
+		.flags = PP_FLAGS_FRAG,
+		.pool_size = MY_POOL_SIZE,
+		.nid = NUMA_NO_NODE,
+		.dev = NULL, /* Only use for DMA mapping */
+		.dma_dir = DMA_BIDIRECTIONAL,
+	};
+
+	pp = page_pool_create(&pp_params);
+	if (IS_ERR(pp)) {
+		err = PTR_ERR(pp);
+		pr_warn("%s: Error(%d) creating page_pool\n", func, err);
+		return 0;
+	}
+	pp_fill_ptr_ring(pp, 64);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		n = min_t(uint64_t, FRAG_BULK, rec->loops - loops_cnt);
+		for (i = 0; i < n; i++) {
+			pages[i] = page_pool_alloc_frag(pp, &offset, frag_size,
+							gfp_mask);
+			if (!pages[i])
+				break;
+		}
+		barrier(); /* avoid compiler to optimize this loop */
+
+		/* Last frag returned recycles the page */
+		for (j = 0; j < i; j++) {
+			if (type == type_fast_path)
+				page_pool_recycle_direct(pp, pages[j]);
+			else if (type == type_ptr_ring)
+				_page_pool_put_page(pp, pages[j], false);
+			else
+				BUILD_BUG();
+		}
+		loops_cnt += i;
+		if (i < n) {
+			pr_err("%s: out-of-pages\n", func);
+			break;
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Also releases the partially used frag page */
+	page_pool_destroy(pp);
+	return loops_cnt;
+}
+
+int time_bench_page_pool05_frag_fast_path(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_page_pool_frag(rec, data, type_fast_path, __func__);
+}
+
+int time_bench_page_pool06_frag_ptr_ring(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_page_pool_frag(rec, data, type_ptr_ring, __func__);
+}
+
+/* Per frag cost, compare with page_pool01/02 for the whole page */
+static void run_frag_tests(uint64_t nr_loops)
+{
+	unsigned long size;
+	char desc[64];
+	int i;
+
+	for (i = 0; i < nr_frag_sizes; i++) {
+		size = frag_sizes[i];
+		if (!size || size > PAGE_SIZE) {
+			pr_warn("Skip invalid frag size:%lu\n", size);
+			continue;
+		}
+		if (enabled(bit_run_bench_tasklet05)) {
+			snprintf(desc, sizeof(desc),
+				 "tasklet_page_pool05_frag%lu_fast_path", size);
+			time_bench_loop(nr_loops, 0, desc, (void *)size,
+					time_bench_page_pool05_frag_fast_path);
+		}
+		if (enabled(bit_run_bench_tasklet06)) {
+			snprintf(desc, sizeof(desc),
+				 "tasklet_page_pool06_frag%lu_ptr_ring", size);
+			time_bench_loop(nr_loops, 0, desc, (void *)size,
+					time_bench_page_pool06_frag_ptr_ring);
+		}
+	}
+}
+#endif /* HAVE_PAGE_POOL_FRAG */
+
+#ifdef BENCH_QMEMPOOL
+/* Comparison: page recycling via a page backed qmempool, same pool
+ * size as page_pool.  Created outside the tasklet, as qmempool_create
+ * can sleep.
+ */
+static struct qmempool *qm_pool;
+
+static __always_inline
+int time_bench_qmempool_page(
+	struct time_bench_record *rec, void *data, bool softirq)
+{
+	struct qmempool *pool = data;
+	uint64_t loops_cnt = 0;
+	gfp_t gfp_mask = GFP_ATOMIC;
+	struct page *page;
+	uint64_t i;
+
+	if (!pool)
+		return 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (softirq)
+			page = __qmempool_alloc_page_softirq(pool, gfp_mask);
+		else
+			page = qmempool_alloc_page(pool, gfp_mask);
+		if (!page)
+			break;
+		loops_cnt++;
+		barrier(); /* avoid compiler to optimize this loop */
+
+		/* Recycle, e.g. XDP_DROP use-case */
+		if (softirq)
+			__qmempool_free_page_softirq(pool, page);
+		else
+			qmempool_free_page(pool, page);
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+int time_bench_qmempool_page04(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_qmempool_page(rec, data, false);
+}
+
+int time_bench_qmempool_page04_softirq(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_qmempool_page(rec, data, true);
+}
+
+static void qm_pool_setup(void)
+{
+	qm_pool = qmempool_create_pages(64, MY_POOL_SIZE, 64, 0, GFP_ATOMIC);
+	if (!qm_pool)
+		pr_warn("Error creating page backed qmempool\n");
+}
+
+static void qm_pool_teardown(void)
+{
+	if (qm_pool)
+		qmempool_destroy(qm_pool);
+	qm_pool = NULL;
+}
+#endif /* BENCH_QMEMPOOL */
+
 /* Testing page_pool requires running under softirq.
  *
  * Running under a tasklet satisfy this, as tasklets are built on top of
@@ -259,7 +433,7 @@ int time_bench_page_pool03_slow(
  */
 static void pp_tasklet_handler(struct tasklet_struct *t)
 {
-	uint32_t nr_loops = loops;
+	uint64_t nr_loops = loops;
 
 	if (in_serving_softirq())
 		pr_warn("%s(): in_serving_softirq fast-path\n", __func__); // True
@@ -281,6 +455,17 @@ static void pp_tasklet_handler(struct tasklet_struct *t)
 				"tasklet_page_pool03_slow", NULL,
 				time_bench_page_pool03_slow);
 
+#ifdef BENCH_QMEMPOOL
+	if (enabled(bit_run_bench_tasklet04))
+		time_bench_loop(nr_loops, 0,
+				"tasklet_qmempool_page04_fast_path", qm_pool,
+				time_bench_qmempool_page04_softirq);
+#endif
+
+#ifdef HAVE_PAGE_POOL_FRAG
+	run_frag_tests(nr_loops);
+#endif
+
 	mutex_unlock(&wait_for_tasklet); /* Module __init waiting on unlock */
 }
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(5, 9, 0)
@@ -298,7 +483,7 @@ static void run_tasklet_tests(void)
 
 static int run_benchmark_tests(void)
 {
-	uint32_t nr_loops = loops;
+	uint64_t nr_loops = loops;
 	int passed_count = 0;
 
 	/* Baseline tests */
@@ -324,27 +509,57 @@ static int run_benchmark_tests(void)
 		time_bench_loop(nr_loops, 0,
 				"no-softirq-page_pool03",
 				NULL, time_bench_page_pool03_slow);
+#ifdef BENCH_QMEMPOOL
+	if (enabled(bit_run_bench_no_softirq04))
+		time_bench_loop(nr_loops, 0,
+				"no-softirq-qmempool_page04", qm_pool,
+				time_bench_qmempool_page04);
+#endif
 
 	return passed_count;
 }
 
+/* Non-tasklet benches, (re)runnable via time_bench debugfs control */
+static struct time_bench_entry pp_benches[] = {
+	{ .name = "for_loop",	.func = time_bench_for_loop },
+	{ .name = "atomic_inc",	.func = time_bench_atomic_inc },
+	{ .name = "lock",	.func = time_bench_lock },
+	{ .name = "no-softirq-page_pool01",
+	  .func = time_bench_page_pool01_fast_path },
+	{ .name = "no-softirq-page_pool02",
+	  .func = time_bench_page_pool02_ptr_ring },
+	{ .name = "no-softirq-page_pool03",
+	  .func = time_bench_page_pool03_slow },
+};
+
+static void pp_benches_register(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(pp_benches); i++)
+		pp_benches[i].loops = loops;
+	if (time_bench_register(pp_benches, ARRAY_SIZE(pp_benches)))
+		pr_warn("Cannot register benches with time_bench\n");
+}
+
 static int __init bench_page_pool_simple_module_init(void)
 {
 	if (verbose)
 		pr_info("Loaded\n");
 
-	if (loops > U32_MAX) {
-		pr_err("Module param loops(%lu) exceeded U32_MAX(%u)\n",
-		       loops, U32_MAX);
-		return -ECHRNG;
-	}
-
+#ifdef BENCH_QMEMPOOL
+	qm_pool_setup();
+#endif
 	run_benchmark_tests();
 
 	mutex_lock(&wait_for_tasklet);
 	run_tasklet_tests();
 	/* Sleep on mutex, waiting for tasklet to release */
 	mutex_lock(&wait_for_tasklet);
+#ifdef BENCH_QMEMPOOL
+	qm_pool_teardown();
+#endif
+	pp_benches_register();
 
 	return 0;
 	// tasklet_kill(&pp_tasklet);
@@ -355,6 +570,7 @@ module_init(bench_page_pool_simple_module_init);
 static void __exit bench_page_pool_simple_module_exit(void)
 {
 	tasklet_kill(&pp_tasklet);
+	time_bench_unregister(pp_benches, ARRAY_SIZE(pp_benches));
 
 	if (verbose)
 		pr_info("Unloaded\n");
@@ -0,0 +1,578 @@
+/*
+ * Head-to-head benchmark of the queue implementations
+ *  ring_queue, alf_queue, ptr_ring and wfcq (node at a time, and bulk)
+ *
+ * All queues are driven through the same ops table, and run the same
+ * matrix of mode (SPSC/MPSC/MPMC), ring size, bulk size and CPU
+ * topology, with the same loop count and time_bench reporting.
+ *
+ * Modes, split of roles by cpu_idx in the selected cpumask:
+ *  SPSC:    cpu_idx 0 producer, cpu_idx 1 consumer (two CPUs)
+ *  MPSC:    cpu_idx 0 consumer, rest producers
+ *  MPMC:    even cpu_idx producers, odd consumers
+ *  RECYCLE: every CPU dequeue a bulk and enqueue it again, on a queue
+ *           prefilled to half size.  Objects are owned by exactly one
+ *           CPU or the queue, thus intrusive queues (wfcq) can run it.
+ *
+ * Producers enqueue "loops" objects each.  Consumers run until all
+ * producers are done and the queue is drained.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/slab.h>
+#include <linux/mm.h> /* missing in ptr_ring.h on >= v4.16 */
+#include <linux/ptr_ring.h>
+#include <linux/ring_queue.h>
+#include <linux/alf_queue.h>
+#include <linux/wfc_queue.h>
+
+static int verbose=1;
+
+static unsigned long loops = 1000000;
+module_param(loops, ulong, 0);
+MODULE_PARM_DESC(loops, "Objects enqueued per producer, or ops per CPU in recycle (default 1000000)");
+
+static int parallel_cpus = 4;
+module_param(parallel_cpus, uint, 0);
+MODULE_PARM_DESC(parallel_cpus, "CPUs for MPSC/MPMC/RECYCLE, SPSC use two (default 4)");
+
+static char *topologies = "smt:core:cross";
+module_param(topologies, charp, 0);
+MODULE_PARM_DESC(topologies, "Colon separated time_bench topologies to run (default smt:core:cross)");
+
+static int bulk_max = 64;
+module_param(bulk_max, uint, 0);
+MODULE_PARM_DESC(bulk_max, "Run bulk 1,2,4..bulk_max (default 64)");
+
+static int size_min = 64;
+module_param(size_min, uint, 0);
+MODULE_PARM_DESC(size_min, "Smallest ring size, power of 2 (default 64)");
+
+static int size_max = 4096;
+module_param(size_max, uint, 0);
+MODULE_PARM_DESC(size_max, "Largest ring size, power of 2 (default 4096)");
+
+static unsigned long queue_mask = 0xFFFFFFFF;
+module_param(queue_mask, ulong, 0);
+MODULE_PARM_DESC(queue_mask, "Bitmask of queues: ring_queue=1 alf_queue=2 ptr_ring=4 wfcq=8 wfcq_bulk=16");
+
+static unsigned long mode_mask = 0xFFFFFFFF;
+module_param(mode_mask, ulong, 0);
+MODULE_PARM_DESC(mode_mask, "Bitmask of modes: SPSC=1 MPSC=2 MPMC=4 RECYCLE=8");
+
+#define MAX_BULK 64
+
+enum qcmp_mode {
+	QCMP_SPSC,
+	QCMP_MPSC,
+	QCMP_MPMC,
+	QCMP_RECYCLE,
+	QCMP_MODE_NR
+};
+static const char *qcmp_mode_names[QCMP_MODE_NR] = {
+	"SPSC", "MPSC", "MPMC", "RECYCLE"
+};
+#define QCMP_M(mode)	(1 << (mode))
+#define QCMP_ALL_MODES	(QCMP_M(QCMP_SPSC) | QCMP_M(QCMP_MPSC) | \
+			 QCMP_M(QCMP_MPMC) | QCMP_M(QCMP_RECYCLE))
+
+/* Bench objects, wfcq is intrusive and use the node */
+struct qcmp_obj {
+	struct wfcq_node node;	/* Must be first */
+	unsigned long data;
+};
+
+struct qcmp_ops {
+	const char *name;
+	unsigned int modes;	/* Supported QCMP_M(mode) */
+	void *(*create)(unsigned int size, enum qcmp_mode mode);
+	void  (*destroy)(void *q);
+	/* Return number of objects enqueued/dequeued, up to n */
+	int   (*enqueue_sp)(void *q, void **objs, int n);
+	int   (*enqueue_mp)(void *q, void **objs, int n);
+	int   (*dequeue_sc)(void *q, void **objs, int n);
+	int   (*dequeue_mc)(void *q, void **objs, int n);
+};
+
+/*** ring_queue ***/
+static void *qcmp_ring_queue_create(unsigned int size, enum qcmp_mode mode)
+{
+	unsigned int flags = 0;
+
+	if (mode == QCMP_SPSC)
+		flags = RING_F_SP_ENQ | RING_F_SC_DEQ;
+	else if (mode == QCMP_MPSC)
+		flags = RING_F_SC_DEQ;
+	return ring_queue_create(size, flags);
+}
+static void qcmp_ring_queue_destroy(void *q)
+{
+	ring_queue_free(q);
+}
+static int qcmp_ring_queue_enq_sp(void *q, void **objs, int n)
+{
+	return ring_queue_sp_enqueue_burst(q, objs, n) & RING_QUEUE_SZ_MASK;
+}
+static int qcmp_ring_queue_enq_mp(void *q, void **objs, int n)
+{
+	return ring_queue_mp_enqueue_burst(q, objs, n) & RING_QUEUE_SZ_MASK;
+}
+static int qcmp_ring_queue_deq_sc(void *q, void **objs, int n)
+{
+	return ring_queue_sc_dequeue_burst(q, objs, n);
+}
+static int qcmp_ring_queue_deq_mc(void *q, void **objs, int n)
+{
+	return ring_queue_mc_dequeue_burst(q, objs, n);
+}
+
+/*** alf_queue ***/
+static void *qcmp_alf_queue_create(unsigned int size, enum qcmp_mode mode)
+{
+	struct alf_queue *q = alf_queue_alloc(size, GFP_KERNEL);
+
+	return IS_ERR(q) ? NULL : q;
+}
+static void qcmp_alf_queue_destroy(void *q)
+{
+	alf_queue_free(q);
+}
+static int qcmp_alf_queue_enq_sp(void *q, void **objs, int n)
+{
+	return alf_sp_enqueue_burst(q, objs, n);
+}
+static int qcmp_alf_queue_enq_mp(void *q, void **objs, int n)
+{
+	return alf_mp_enqueue_burst(q, objs, n);
+}
+static int qcmp_alf_queue_deq_sc(void *q, void **objs, int n)
+{
+	return alf_sc_dequeue(q, objs, n);
+}
+static int qcmp_alf_queue_deq_mc(void *q, void **objs, int n)
+{
+	return alf_mc_dequeue(q, objs, n);
+}
+
+/*** ptr_ring, locked on both sides, thus same ops for all modes ***/
+static void *qcmp_ptr_ring_create(unsigned int size, enum qcmp_mode mode)
+{
+	struct ptr_ring *r = kzalloc(sizeof(*r), GFP_KERNEL);
+
+	if (r && ptr_ring_init(r, size, GFP_KERNEL) < 0) {
+		kfree(r);
+		return NULL;
+	}
+	return r;
+}
+static void qcmp_ptr_ring_destroy(void *q)
+{
+	ptr_ring_cleanup(q, NULL);
+	kfree(q);
+}
+static int qcmp_ptr_ring_enq(void *q, void **objs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (ptr_ring_produce(q, objs[i]) < 0)
+			break;
+	}
+	return i;
+}
+static int qcmp_ptr_ring_deq(void *q, void **objs, int n)
+{
+	return ptr_ring_consume_batched(q, objs, n);
+}
+
+/*** wfcq, unbounded and intrusive, dequeuers need mutual exclusion ***/
+struct qcmp_wfcq {
+	struct wfcq_head head;
+	spinlock_t dequeue_lock;
+	/* Enqueuers only touch the tail */
+	struct wfcq_tail tail ____cacheline_aligned_in_smp;
+};
+static void *qcmp_wfcq_create(unsigned int size, enum qcmp_mode mode)
+{
+	struct qcmp_wfcq *w = kzalloc(sizeof(*w), GFP_KERNEL);
+
+	if (!w)
+		return NULL;
+	wfcq_init(&w->head, &w->tail);
+	spin_lock_init(&w->dequeue_lock);
+	return w;
+}
+static void qcmp_wfcq_destroy(void *q)
+{
+	kfree(q);
+}
+static int qcmp_wfcq_enq(void *q, void **objs, int n)
+{
+	struct qcmp_wfcq *w = q;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct qcmp_obj *obj = objs[i];
+
+		wfcq_node_init(&obj->node);
+		wfcq_enqueue(&w->head, &w->tail, &obj->node);
+	}
+	return n;
+}
+static int qcmp_wfcq_deq_sc(void *q, void **objs, int n)
+{
+	struct qcmp_wfcq *w = q;
+	struct wfcq_node *node;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		node = __wfcq_dequeue(&w->head, &w->tail);
+		if (!node)
+			break;
+		objs[i] = container_of(node, struct qcmp_obj, node);
+	}
+	return i;
+}
+static int qcmp_wfcq_deq_mc(void *q, void **objs, int n)
+{
+	struct qcmp_wfcq *w = q;
+	int cnt;
+
+	spin_lock(&w->dequeue_lock);
+	cnt = qcmp_wfcq_deq_sc(q, objs, n);
+	spin_unlock(&w->dequeue_lock);
+	return cnt;
+}
+
+/* Bulk dequeue, a single lock round and one pass over the nodes */
+static int qcmp_wfcq_bulk_deq_sc(void *q, void **objs, int n)
+{
+	struct wfcq_node *nodes[MAX_BULK];
+	struct qcmp_wfcq *w = q;
+	int i, cnt;
+
+	cnt = __wfcq_dequeue_bulk(&w->head, &w->tail, nodes,
+				  min(n, MAX_BULK));
+	for (i = 0; i < cnt; i++)
+		objs[i] = container_of(nodes[i], struct qcmp_obj, node);
+	return cnt;
+}
+static int qcmp_wfcq_bulk_deq_mc(void *q, void **objs, int n)
+{
+	struct qcmp_wfcq *w = q;
+	int cnt;
+
+	spin_lock(&w->dequeue_lock);
+	cnt = qcmp_wfcq_bulk_deq_sc(q, objs, n);
+	spin_unlock(&w->dequeue_lock);
+	return cnt;
+}
+
+static const struct qcmp_ops qcmp_queues[] = {
+	{
+		.name       = "ring_queue",
+		.modes      = QCMP_ALL_MODES,
+		.create     = qcmp_ring_queue_create,
+		.destroy    = qcmp_ring_queue_destroy,
+		.enqueue_sp = qcmp_ring_queue_enq_sp,
+		.enqueue_mp = qcmp_ring_queue_enq_mp,
+		.dequeue_sc = qcmp_ring_queue_deq_sc,
+		.dequeue_mc = qcmp_ring_queue_deq_mc,
+	}, {
+		.name       = "alf_queue",
+		.modes      = QCMP_ALL_MODES,
+		.create     = qcmp_alf_queue_create,
+		.destroy    = qcmp_alf_queue_destroy,
+		.enqueue_sp = qcmp_alf_queue_enq_sp,
+		.enqueue_mp = qcmp_alf_queue_enq_mp,
+		.dequeue_sc = qcmp_alf_queue_deq_sc,
+		.dequeue_mc = qcmp_alf_queue_deq_mc,
+	}, {
+		.name       = "ptr_ring",
+		.modes      = QCMP_ALL_MODES,
+		.create     = qcmp_ptr_ring_create,
+		.destroy    = qcmp_ptr_ring_destroy,
+		.enqueue_sp = qcmp_ptr_ring_enq,
+		.enqueue_mp = qcmp_ptr_ring_enq,
+		.dequeue_sc = qcmp_ptr_ring_deq,
+		.dequeue_mc = qcmp_ptr_ring_deq,
+	}, {
+		/* The roles modes would need an object return path, as
+		 * a node cannot be re-enqueued before it is dequeued
+		 */
+		.name       = "wfcq",
+		.modes      = QCMP_M(QCMP_RECYCLE),
+		.create     = qcmp_wfcq_create,
+		.destroy    = qcmp_wfcq_destroy,
+		.enqueue_sp = qcmp_wfcq_enq,
+		.enqueue_mp = qcmp_wfcq_enq,
+		.dequeue_sc = qcmp_wfcq_deq_sc,
+		.dequeue_mc = qcmp_wfcq_deq_mc,
+	}, {
+		.name       = "wfcq_bulk",
+		.modes      = QCMP_M(QCMP_RECYCLE),
+		.create     = qcmp_wfcq_create,
+		.destroy    = qcmp_wfcq_destroy,
+		.enqueue_sp = qcmp_wfcq_enq,
+		.enqueue_mp = qcmp_wfcq_enq,
+		.dequeue_sc = qcmp_wfcq_bulk_deq_sc,
+		.dequeue_mc = qcmp_wfcq_bulk_deq_mc,
+	},
+};
+
+struct qcmp_run {
+	void *q;
+	int (*enqueue)(void *q, void **objs, int n);
+	int (*dequeue)(void *q, void **objs, int n);
+	enum qcmp_mode mode;
+	int nr_producers;
+	atomic_t producers_done;
+};
+
+static bool qcmp_is_producer(struct qcmp_run *run, int cpu_idx)
+{
+	switch (run->mode) {
+	case QCMP_SPSC:
+		return cpu_idx == 0;
+	case QCMP_MPSC:
+		return cpu_idx != 0;
+	default:
+		return (cpu_idx % 2) == 0;
+	}
+}
+
+static int time_bench_qcmp_roles(struct time_bench_record *rec, void *data)
+{
+	struct qcmp_run *run = data;
+	int bulk = min_t(int, rec->step, MAX_BULK);
+	bool producer = qcmp_is_producer(run, rec->cpu_idx);
+	void *objs[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	bool done;
+	int i, n;
+
+	for (i = 0; i < MAX_BULK; i++)
+		objs[i] = (void *)(unsigned long)(i+20);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	if (producer) {
+		while (loops_cnt < rec->loops) {
+			n = min_t(uint64_t, bulk, rec->loops - loops_cnt);
+			n = run->enqueue(run->q, objs, n);
+			if (n == 0) {
+				cpu_relax(); /* full, wait for consumers */
+				continue;
+			}
+			loops_cnt += n;
+		}
+		smp_mb__before_atomic(); /* enqueues before done count */
+		atomic_inc(&run->producers_done);
+	} else {
+		for (;;) {
+			done = atomic_read(&run->producers_done) ==
+				run->nr_producers;
+			smp_rmb(); /* read done before queue */
+			n = run->dequeue(run->q, objs, bulk);
+			if (n) {
+				loops_cnt += n;
+				continue;
+			}
+			if (done)
+				break;
+			cpu_relax(); /* empty, wait for producers */
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark producer, as "step" gets printed */
+	rec->step = producer;
+	return loops_cnt;
+}
+
+static int time_bench_qcmp_recycle(struct time_bench_record *rec, void *data)
+{
+	struct qcmp_run *run = data;
+	int bulk = min_t(int, rec->step, MAX_BULK);
+	void *objs[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int n, enq;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		n = run->dequeue(run->q, objs, bulk);
+		if (n == 0) {
+			cpu_relax(); /* objects held by other CPUs */
+			continue;
+		}
+		/* Queue is at most half full, thus room for our objects */
+		for (enq = 0; enq < n; )
+			enq += run->enqueue(run->q, &objs[enq], n - enq);
+		loops_cnt += 2 * n;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+static void run_parallel(const char *desc, uint32_t loops,
+			 const cpumask_t *cpumask, int step, void *data,
+			 int (*func)(struct time_bench_record *record,
+				     void *data))
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	size_t size;
+
+	/* Allocate records for every CPU */
+	size = sizeof(*cpu_tasks) * num_possible_cpus();
+	cpu_tasks = kzalloc(size, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	time_bench_run_concurrent(loops, step, data,
+				  cpumask, &sync, cpu_tasks, func);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+
+	kfree(cpu_tasks);
+}
+
+static void run_one(const struct qcmp_ops *ops, enum qcmp_mode mode,
+		    unsigned int size, int bulk, const char *topology,
+		    const cpumask_t *cpumask, int cpus)
+{
+	struct qcmp_obj *objs = NULL;
+	struct qcmp_run run = {};
+	void *tmp[MAX_BULK];
+	char desc[64];
+	int i, n;
+
+	run.mode = mode;
+	run.q = ops->create(size, mode);
+	if (!run.q) {
+		pr_err("%s: cannot create size:%u\n", ops->name, size);
+		return;
+	}
+	run.enqueue = (mode == QCMP_SPSC) ? ops->enqueue_sp : ops->enqueue_mp;
+	run.dequeue = (mode == QCMP_MPMC || mode == QCMP_RECYCLE) ?
+			ops->dequeue_mc : ops->dequeue_sc;
+	if (mode == QCMP_MPSC)
+		run.nr_producers = cpus - 1;
+	else if (mode == QCMP_MPMC)
+		run.nr_producers = (cpus + 1) / 2;
+	else
+		run.nr_producers = 1;
+	atomic_set(&run.producers_done, 0);
+
+	if (mode == QCMP_RECYCLE) {
+		objs = kcalloc(size / 2, sizeof(*objs), GFP_KERNEL);
+		if (!objs)
+			goto out;
+		for (i = 0; i < size / 2; i++) {
+			tmp[0] = &objs[i];
+			if (run.enqueue(run.q, tmp, 1) != 1)
+				goto out;
+		}
+	}
+
+	snprintf(desc, sizeof(desc), "%s-%s-sz%u-b%d-%s", ops->name,
+		 qcmp_mode_names[mode], size, bulk, topology);
+	run_parallel(desc, loops, cpumask, bulk, &run,
+		     mode == QCMP_RECYCLE ? time_bench_qcmp_recycle :
+					    time_bench_qcmp_roles);
+out:
+	/* Drain, objects are fake or owned by objs[] */
+	do {
+		n = run.dequeue(run.q, tmp, MAX_BULK);
+	} while (n > 0);
+	ops->destroy(run.q);
+	kfree(objs);
+}
+
+static void run_topology(const char *topology)
+{
+	cpumask_t cpumask, cpumask2;
+	enum qcmp_mode mode;
+	unsigned int size;
+	int cpus, cpus2, bulk, i;
+
+	cpus = time_bench_cpumask_select(&cpumask, topology, parallel_cpus);
+	cpus2 = time_bench_cpumask_select(&cpumask2, topology, 2);
+	if (cpus < 2 || cpus2 < 2) {
+		pr_warn("Topology:%s need at least two CPUs\n", topology);
+		return;
+	}
+
+	for (mode = 0; mode < QCMP_MODE_NR; mode++) {
+		if (!(mode_mask & QCMP_M(mode)))
+			continue;
+		for (size = size_min; size <= size_max; size *= 2) {
+			for (bulk = 1; bulk <= min(bulk_max, MAX_BULK);
+			     bulk *= 2) {
+				for (i = 0; i < ARRAY_SIZE(qcmp_queues); i++) {
+					const struct qcmp_ops *ops = &qcmp_queues[i];
+
+					if (!(queue_mask & (1UL << i)) ||
+					    !(ops->modes & QCMP_M(mode)))
+						continue;
+					if (mode == QCMP_SPSC)
+						run_one(ops, mode, size, bulk,
+							topology, &cpumask2, 2);
+					else
+						run_one(ops, mode, size, bulk,
+							topology, &cpumask, cpus);
+				}
+			}
+		}
+	}
+}
+
+static int run_benchmark_tests(void)
+{
+	char *list, *p, *topology;
+
+	if (!is_power_of_2(size_min) || !is_power_of_2(size_max) ||
+	    size_min < 2 || size_min > size_max) {
+		pr_err("Invalid ring sizes %d..%d\n", size_min, size_max);
+		return -EINVAL;
+	}
+
+	list = kstrdup(topologies, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+	p = list;
+	while ((topology = strsep(&p, ":")) != NULL) {
+		if (!*topology)
+			continue;
+		if (verbose)
+			pr_info("Topology:%s\n", topology);
+		run_topology(topology);
+	}
+	kfree(list);
+	return 0;
+}
+
+static int __init bench_queue_compare_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (run_benchmark_tests() < 0)
+		return -ECANCELED;
+
+	return 0;
+}
+module_init(bench_queue_compare_module_init);
+
+static void __exit bench_queue_compare_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(bench_queue_compare_module_exit);
+
+MODULE_DESCRIPTION("Head-to-head benchmark of ring_queue, alf_queue, ptr_ring and wfcq");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,384 @@
+/*
+ * Benchmark module for the SKB lifecycle, alloc to free
+ *
+ * Unlike time_bench_kmem_cache1 (kmem_cache of embedded sk_buff) and
+ * skb_array_* (fake SKB pointers), this uses real SKBs:
+ *  - alloc_skb() vs napi_alloc_skb(), the latter takes the SKB head
+ *    from the per CPU napi_skb_cache
+ *  - napi_build_skb() on page_pool pages, marked for recycle, like
+ *    drivers building SKBs around RX pages
+ *  - freed one-by-one via consume_skb(), via napi_consume_skb() which
+ *    refills the napi_skb_cache (and bulk frees it when full), or as
+ *    a list via kfree_skb_list() (bulk freeing on newer kernels)
+ * Single CPU, and cross-CPU where the "RX" CPU allocates and hands
+ * the SKBs via skb_array to the "socket" CPU that frees them.
+ *
+ * The NAPI variants depend on being called with BH disabled, thus
+ * the bench loops run under local_bh_disable().  Don't combine with
+ * the time_bench "exclusive" param (IRQs disabled).
+ *
+ * Needs v5.15 for napi_build_skb() and skb_mark_for_recycle(skb).
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h> /* missing in ptr_ring.h on >= v4.16 */
+#include <linux/skb_array.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+
+#include <linux/page_pool_compat.h>
+
+static int verbose=1;
+
+/* Makes tests selectable, bit number from enum below */
+static unsigned long run_flags = 0xFFFFFFFF;
+module_param(run_flags, ulong, 0);
+MODULE_PARM_DESC(run_flags, "Limit which bench test that runs");
+enum benchmark_bit {
+	bit_run_bench_alloc_skb,
+	bit_run_bench_napi_alloc_skb,
+	bit_run_bench_napi_consume,
+	bit_run_bench_napi_consume_bulk,
+	bit_run_bench_free_list_bulk,
+	bit_run_bench_pp_napi_consume,
+	bit_run_bench_pp_free_list_bulk,
+	bit_run_bench_xcpu_napi_consume,
+	bit_run_bench_xcpu_free_list,
+	bit_run_bench_xcpu_pp_napi_consume,
+	bit_run_bench_xcpu_pp_free_list,
+};
+#define bit(b)		(1 << (b))
+#define enabled(b)	((run_flags & (bit(b))))
+
+static unsigned long loops = 1000000;
+module_param(loops, ulong, 0);
+MODULE_PARM_DESC(loops, "Specify loops bench will run");
+
+static unsigned int skb_len = 256;
+module_param(skb_len, uint, 0);
+MODULE_PARM_DESC(skb_len, "Packet length put into each SKB (default 256)");
+
+#define BULK_MAX	64
+static unsigned int bulk = 16;
+module_param(bulk, uint, 0);
+MODULE_PARM_DESC(bulk, "SKBs per bulk alloc/free, max 64 (default 16)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection for cross-CPU: first|core|node|cross|<cpulist> (default first)");
+
+#define NAPI_BUDGET	64	/* napi_consume_skb() budget, 0 means not NAPI */
+#define PP_POOL_SIZE	4096
+#define PP_HEADROOM	256	/* Like XDP_PACKET_HEADROOM */
+#define XCPU_QUEUE_SZ	1024
+
+enum skb_src {
+	SRC_ALLOC_SKB,	/* alloc_skb(), slab SKB and kmalloc head */
+	SRC_NAPI,	/* napi_alloc_skb(), napi_skb_cache */
+	SRC_PP,		/* napi_build_skb() on page_pool page */
+};
+
+enum skb_free {
+	FREE_SINGLE,	/* consume_skb() */
+	FREE_NAPI,	/* napi_consume_skb(), refills napi_skb_cache */
+	FREE_LIST,	/* kfree_skb_list() */
+};
+
+struct skb_bench {
+	struct page_pool *pp;
+	struct skb_array queue;
+	enum skb_src src;
+	enum skb_free how;
+	unsigned int nr;	/* SKBs per alloc/free round */
+	bool abort;		/* Cross-CPU: RX CPU failed alloc */
+};
+
+/* Only napi->dev is used by napi_alloc_skb(), which stays NULL */
+static struct napi_struct bench_napi;
+
+static struct page_pool *pp_create(void)
+{
+	struct page_pool_params pp_params = {
+		.order = 0,
+		.flags = 0,
+		.pool_size = PP_POOL_SIZE,
+		.nid = NUMA_NO_NODE,
+		.dev = NULL, /* Only use for DMA mapping */
+		.dma_dir = DMA_BIDIRECTIONAL,
+	};
+	struct page_pool *pp;
+
+	pp = page_pool_create(&pp_params);
+	if (IS_ERR(pp)) {
+		pr_warn("%s: Error(%ld) creating page_pool\n",
+			__func__, PTR_ERR(pp));
+		return NULL;
+	}
+	return pp;
+}
+
+static __always_inline
+struct sk_buff *skb_alloc(struct skb_bench *b)
+{
+	struct sk_buff *skb;
+	struct page *page;
+
+	switch (b->src) {
+	case SRC_ALLOC_SKB:
+		skb = alloc_skb(skb_len, GFP_ATOMIC);
+		break;
+	case SRC_NAPI:
+		skb = napi_alloc_skb(&bench_napi, skb_len);
+		break;
+	case SRC_PP:
+		page = page_pool_dev_alloc_pages(b->pp);
+		if (!page)
+			return NULL;
+		skb = napi_build_skb(page_address(page), PAGE_SIZE);
+		if (!skb) {
+			_page_pool_put_page(b->pp, page, true);
+			return NULL;
+		}
+		skb_reserve(skb, PP_HEADROOM);
+		skb_mark_for_recycle(skb);
+		break;
+	default:
+		return NULL;
+	}
+	if (skb)
+		__skb_put(skb, skb_len);
+	return skb;
+}
+
+static __always_inline
+void skb_free_bulk(struct skb_bench *b, struct sk_buff **skbs, int n)
+{
+	int i;
+
+	if (!n)
+		return;
+	if (b->how == FREE_LIST) {
+		for (i = 0; i < n - 1; i++)
+			skbs[i]->next = skbs[i + 1];
+		skbs[n - 1]->next = NULL;
+		kfree_skb_list(skbs[0]);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		if (b->how == FREE_NAPI)
+			napi_consume_skb(skbs[i], NAPI_BUDGET);
+		else
+			consume_skb(skbs[i]);
+	}
+}
+
+/* Alloc b->nr SKBs, then free them, on the same CPU */
+static int time_skb_lifecycle(struct time_bench_record *rec, void *data)
+{
+	struct sk_buff *skbs[BULK_MAX];
+	struct skb_bench *b = data;
+	uint64_t loops_cnt = 0;
+	int n;
+
+	local_bh_disable();
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		for (n = 0; n < b->nr; n++) {
+			skbs[n] = skb_alloc(b);
+			if (!skbs[n])
+				break;
+		}
+		skb_free_bulk(b, skbs, n);
+		loops_cnt += n;
+		if (n < b->nr) {
+			pr_err("%s(): alloc failed\n", __func__);
+			break;
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+	local_bh_enable();
+
+	return loops_cnt;
+}
+
+/* Even cpu_idx is the RX CPU, allocating SKBs into the skb_array.
+ * Odd cpu_idx is the socket CPU, dequeuing up to b->nr and freeing
+ * them, thus SKB heads, data and pages are freed remotely.
+ */
+static int time_skb_xcpu(struct time_bench_record *rec, void *data)
+{
+	bool enq_CPU = ((rec->cpu_idx % 2) == 0);
+	struct sk_buff *skbs[BULK_MAX];
+	struct skb_bench *b = data;
+	uint64_t loops_cnt = 0;
+	struct sk_buff *skb;
+	int n;
+
+	local_bh_disable();
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops && !READ_ONCE(b->abort)) {
+		if (enq_CPU) {
+			skb = skb_alloc(b);
+			if (!skb) {
+				pr_err("%s(): alloc failed\n", __func__);
+				WRITE_ONCE(b->abort, true);
+				break;
+			}
+			while (skb_array_produce_spsc(&b->queue, skb) < 0)
+				cpu_relax(); /* full */
+			loops_cnt++;
+		} else {
+			n = min_t(uint64_t, b->nr, rec->loops - loops_cnt);
+			n = skb_array_consume_batched_spsc(&b->queue, skbs, n);
+			if (n == 0) {
+				cpu_relax(); /* empty */
+				continue;
+			}
+			skb_free_bulk(b, skbs, n);
+			loops_cnt += n;
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+	local_bh_enable();
+
+	/* Hack: use "step" to mark enq/deq, as "step" gets printed */
+	rec->step = enq_CPU;
+	return loops_cnt;
+}
+
+static void run_single(struct skb_bench *b, const char *desc,
+		       enum skb_src src, enum skb_free how, unsigned int nr)
+{
+	b->src = src;
+	b->how = how;
+	b->nr  = nr;
+	time_bench_loop(loops, nr, (char *)desc, b, time_skb_lifecycle);
+}
+
+static void run_xcpu(struct skb_bench *b, const char *desc,
+		     enum skb_src src, enum skb_free how,
+		     const cpumask_t *cpumask)
+{
+	struct time_bench_cpu *cpu_tasks;
+	struct time_bench_sync sync;
+
+	cpu_tasks = kcalloc(num_possible_cpus(), sizeof(*cpu_tasks),
+			    GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+	if (skb_array_init(&b->queue, XCPU_QUEUE_SZ, GFP_KERNEL) < 0)
+		goto out;
+	b->src   = src;
+	b->how   = how;
+	b->nr    = bulk;
+	b->abort = false;
+
+	time_bench_run_concurrent(loops, 0, b, cpumask, &sync, cpu_tasks,
+				  time_skb_xcpu);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+
+	skb_array_cleanup(&b->queue); /* Frees SKBs left in queue */
+out:
+	kfree(cpu_tasks);
+}
+
+static int run_benchmark_tests(void)
+{
+	struct skb_bench b = {};
+	cpumask_t cpumask;
+
+	b.pp = pp_create();
+	if (!b.pp)
+		return -ENOMEM;
+
+	/* Baseline: slab SKB and kmalloc'ed head, no NAPI caches */
+	if (enabled(bit_run_bench_alloc_skb))
+		run_single(&b, "alloc_skb_consume_skb",
+			   SRC_ALLOC_SKB, FREE_SINGLE, 1);
+
+	/* SKB from napi_skb_cache, but freed back to slab */
+	if (enabled(bit_run_bench_napi_alloc_skb))
+		run_single(&b, "napi_alloc_skb_consume_skb",
+			   SRC_NAPI, FREE_SINGLE, 1);
+
+	/* Best case: SKB reused via napi_skb_cache */
+	if (enabled(bit_run_bench_napi_consume))
+		run_single(&b, "napi_alloc_skb_napi_consume",
+			   SRC_NAPI, FREE_NAPI, 1);
+
+	/* Bulk rounds, napi_skb_cache refill/flush and list free */
+	if (enabled(bit_run_bench_napi_consume_bulk))
+		run_single(&b, "napi_alloc_skb_bulk_napi_consume",
+			   SRC_NAPI, FREE_NAPI, bulk);
+
+	if (enabled(bit_run_bench_free_list_bulk))
+		run_single(&b, "napi_alloc_skb_bulk_free_list",
+			   SRC_NAPI, FREE_LIST, bulk);
+
+	/* Driver RX: build_skb around page_pool pages */
+	if (enabled(bit_run_bench_pp_napi_consume))
+		run_single(&b, "pp_build_skb_napi_consume",
+			   SRC_PP, FREE_NAPI, 1);
+
+	if (enabled(bit_run_bench_pp_free_list_bulk))
+		run_single(&b, "pp_build_skb_bulk_free_list",
+			   SRC_PP, FREE_LIST, bulk);
+
+	/* Cross-CPU, step = enq(1)/deq(0), cost is alloc or free */
+	if (time_bench_cpumask_select(&cpumask, topology, 2) < 2)
+		goto out;
+
+	if (enabled(bit_run_bench_xcpu_napi_consume))
+		run_xcpu(&b, "xcpu_napi_alloc_skb_napi_consume",
+			 SRC_NAPI, FREE_NAPI, &cpumask);
+
+	if (enabled(bit_run_bench_xcpu_free_list))
+		run_xcpu(&b, "xcpu_napi_alloc_skb_free_list",
+			 SRC_NAPI, FREE_LIST, &cpumask);
+
+	if (enabled(bit_run_bench_xcpu_pp_napi_consume))
+		run_xcpu(&b, "xcpu_pp_build_skb_napi_consume",
+			 SRC_PP, FREE_NAPI, &cpumask);
+
+	if (enabled(bit_run_bench_xcpu_pp_free_list))
+		run_xcpu(&b, "xcpu_pp_build_skb_free_list",
+			 SRC_PP, FREE_LIST, &cpumask);
+out:
+	page_pool_destroy(b.pp);
+	return 0;
+}
+
+static int __init bench_skb_alloc_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!bulk || bulk > BULK_MAX) {
+		pr_err("Invalid bulk:%u (max %d)\n", bulk, BULK_MAX);
+		return -EINVAL;
+	}
+	if (skb_len > PAGE_SIZE - PP_HEADROOM -
+	    SKB_DATA_ALIGN(sizeof(struct skb_shared_info))) {
+		pr_err("Invalid skb_len:%u, must fit page_pool page\n",
+		       skb_len);
+		return -EINVAL;
+	}
+
+	return run_benchmark_tests();
+}
+module_init(bench_skb_alloc_module_init);
+
+static void __exit bench_skb_alloc_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(bench_skb_alloc_module_exit);
+
+MODULE_DESCRIPTION("Benchmark of SKB alloc and free, single and cross-CPU");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
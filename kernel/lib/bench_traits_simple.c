@@ -29,11 +29,14 @@ enum benchmark_bit {
 	bit_run_bench_func_ptr,
 	bit_run_bench_trait_set,
 	bit_run_bench_trait_get,
+	bit_run_bench_trait_set_multi,
+	bit_run_bench_trait_get_multi,
+	bit_run_bench_data_meta_write,
+	bit_run_bench_data_meta_read,
 };
 #define bit(b)		(1 << (b))
 #define enabled(b)	((run_flags & (bit(b))))
 
-/* notice time_bench is limited to U32_MAX nr loops */
 static unsigned long loops = 10000000;
 module_param(loops, ulong, 0);
 MODULE_PARM_DESC(loops, "Specify loops bench will run");
@@ -42,13 +45,21 @@ static unsigned long stay_loaded = 0;
 module_param(stay_loaded, ulong, 0);
 MODULE_PARM_DESC(stay_loaded, "For perf report keep module loaded");
 
+/* XDP-hints use case sets several traits per packet, e.g. RX hash,
+ * timestamp, VLAN and checksum info.
+ */
+#define NR_TRAITS_MAX 8
+static unsigned int nr_traits = 4;
+module_param(nr_traits, uint, 0);
+MODULE_PARM_DESC(nr_traits, "Traits set/get per packet in multi benches (max 8)");
+
 /* Timing at the nanosec level, we need to know the overhead
  * introduced by the for loop itself */
 static int time_bench_for_loop(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
@@ -67,7 +78,8 @@ static void noinline measured_function(volatile int *var)
 static int time_func(
 	struct time_bench_record *rec, void *data)
 {
-	int i, tmp;
+	uint64_t i;
+	int tmp;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -90,7 +102,8 @@ static struct func_ptr_ops my_func_ptr __read_mostly = {
 static int time_func_ptr(
 	struct time_bench_record *rec, void *data)
 {
-	int i, tmp;
+	uint64_t i;
+	int tmp;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -112,7 +125,7 @@ int bpf_xdp_trait_get(const struct xdp_buff *xdp, u64 key,
 static int time_trait_set(struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	u64 key = 1;
 	u64 val = 42;
@@ -150,7 +163,7 @@ static int time_trait_set(struct time_bench_record *rec, void *data)
 static int time_trait_get(struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	u64 key = 1;
 	u64 val = 42;
@@ -187,9 +200,173 @@ static int time_trait_get(struct time_bench_record *rec, void *data)
 	return loops_cnt;
 }
 
+/* XDP setup fake packet, in a zeroed page */
+static struct page *xdp_fake_pkt(struct xdp_buff *xdp)
+{
+	struct page *page;
+
+	page = alloc_page(__GFP_ZERO);
+	if (!page)
+		return NULL;
+	xdp_init_buff(xdp, PAGE_SIZE, NULL);
+	xdp_prepare_buff(xdp, page_address(page), XDP_PACKET_HEADROOM,
+			 1024, true);
+	return page;
+}
+
+/* Per packet cost of setting nr_traits different keys, as an XDP prog
+ * would do for a packet.  The trait API has no batch call, thus this
+ * is nr_traits calls back-to-back.  Result is per packet, step
+ * records nr_traits.
+ */
+static int time_trait_set_multi(struct time_bench_record *rec, void *data)
+{
+	struct xdp_buff xdp_buff = {};
+	struct xdp_buff *xdp = &xdp_buff;
+	uint64_t loops_cnt = 0;
+	struct page *page;
+	u64 val = 42;
+	uint64_t i;
+	u64 key;
+
+	page = xdp_fake_pkt(xdp);
+	if (!page)
+		return 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		for (key = 1; key <= nr_traits; key++)
+			bpf_xdp_trait_set(xdp, key, &val, sizeof(val), 0);
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	__free_page(page);
+
+	return loops_cnt;
+}
+
+static int time_trait_get_multi(struct time_bench_record *rec, void *data)
+{
+	struct xdp_buff xdp_buff = {};
+	struct xdp_buff *xdp = &xdp_buff;
+	uint64_t loops_cnt = 0;
+	struct page *page;
+	u64 val = 42;
+	u64 sum = 0;
+	uint64_t i;
+	u64 key;
+
+	page = xdp_fake_pkt(xdp);
+	if (!page)
+		return 0;
+
+	for (key = 1; key <= nr_traits; key++)
+		bpf_xdp_trait_set(xdp, key, &val, sizeof(val), 0);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		for (key = 1; key <= nr_traits; key++) {
+			bpf_xdp_trait_get(xdp, key, &val, sizeof(val));
+			sum += val;
+		}
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	__free_page(page);
+
+	/* Keep the compiler from dropping the reads */
+	if (sum == 0)
+		pr_info("%s(): sum is zero\n", __func__);
+
+	return loops_cnt;
+}
+
+/* The alternative to traits: a fixed struct in the metadata area in
+ * front of the packet (xdp->data_meta), agreed upon by the XDP prog
+ * and the consumer.  No key lookup, thus the lower bound of the cost.
+ * (BPF progs are limited to 32 bytes data_meta, here only the memory
+ * access is measured, see samples/bpf/xdp_traits_bench_kern.c).
+ */
+struct meta_hints {
+	u64 field[NR_TRAITS_MAX];
+};
+
+static int time_data_meta_write(struct time_bench_record *rec, void *data)
+{
+	struct xdp_buff xdp_buff = {};
+	struct xdp_buff *xdp = &xdp_buff;
+	uint64_t loops_cnt = 0;
+	struct meta_hints *meta;
+	struct page *page;
+	unsigned int j;
+	uint64_t i;
+
+	page = xdp_fake_pkt(xdp);
+	if (!page)
+		return 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		/* Like bpf_xdp_adjust_meta(), then write via pointer */
+		xdp->data_meta = xdp->data - sizeof(*meta);
+		meta = READ_ONCE(xdp->data_meta);
+		for (j = 0; j < nr_traits; j++)
+			WRITE_ONCE(meta->field[j], 42);
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	__free_page(page);
+
+	return loops_cnt;
+}
+
+static int time_data_meta_read(struct time_bench_record *rec, void *data)
+{
+	struct xdp_buff xdp_buff = {};
+	struct xdp_buff *xdp = &xdp_buff;
+	uint64_t loops_cnt = 0;
+	struct meta_hints *meta;
+	struct page *page;
+	unsigned int j;
+	u64 sum = 0;
+	uint64_t i;
+
+	page = xdp_fake_pkt(xdp);
+	if (!page)
+		return 0;
+
+	xdp->data_meta = xdp->data - sizeof(*meta);
+	meta = xdp->data_meta;
+	for (j = 0; j < NR_TRAITS_MAX; j++)
+		meta->field[j] = 42;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		meta = READ_ONCE(xdp->data_meta);
+		for (j = 0; j < nr_traits; j++)
+			sum += READ_ONCE(meta->field[j]);
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	__free_page(page);
+
+	if (sum == 0)
+		pr_info("%s(): sum is zero\n", __func__);
+
+	return loops_cnt;
+}
+
 static int run_benchmark_tests(void)
 {
-	uint32_t nr_loops = loops;
+	uint64_t nr_loops = loops;
 
 	/* Baseline tests */
 	if (enabled(bit_run_bench_baseline))
@@ -218,6 +395,23 @@ static int run_benchmark_tests(void)
 				NULL, time_trait_get);
 	}
 
+	/* Per packet cost of nr_traits, compared to data_meta struct */
+	if (enabled(bit_run_bench_trait_set_multi))
+		time_bench_loop(loops, nr_traits, "trait_set_multi",
+				NULL, time_trait_set_multi);
+
+	if (enabled(bit_run_bench_trait_get_multi))
+		time_bench_loop(loops, nr_traits, "trait_get_multi",
+				NULL, time_trait_get_multi);
+
+	if (enabled(bit_run_bench_data_meta_write))
+		time_bench_loop(loops, nr_traits, "data_meta_write",
+				NULL, time_data_meta_write);
+
+	if (enabled(bit_run_bench_data_meta_read))
+		time_bench_loop(loops, nr_traits, "data_meta_read",
+				NULL, time_data_meta_read);
+
 	return 0;
 }
 
@@ -226,10 +420,10 @@ static int __init bench_traits_simple_module_init(void)
 	if (verbose)
 		pr_info("Loaded\n");
 
-	if (loops > U32_MAX) {
-		pr_err("Module param loops(%lu) exceeded U32_MAX(%u)\n",
-		       loops, U32_MAX);
-		return -ECHRNG;
+	if (!nr_traits || nr_traits > NR_TRAITS_MAX) {
+		pr_err("Invalid nr_traits:%u (max %d)\n",
+		       nr_traits, NR_TRAITS_MAX);
+		return -EINVAL;
 	}
 
 	run_benchmark_tests();
@@ -0,0 +1,292 @@
+/*
+ * lib/mem_clear.c
+ *
+ * Size class dispatcher for zero clearing, see include/linux/mem_clear.h
+ *
+ * The method per size class is selected by a load-time calibration,
+ * clearing a pool bigger than the L2 cache (rotating through it), to
+ * avoid the all-cache-hot numbers of a fixed buffer benchmark.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/mem_clear.h>
+#ifdef CONFIG_X86_64
+#include <asm/fpu/api.h>
+#include <asm/cpufeature.h>
+#endif
+
+static unsigned int calibrate_loops = 2000;
+module_param(calibrate_loops, uint, 0444);
+MODULE_PARM_DESC(calibrate_loops, "Loops per method and size class in load-time calibration (0=disable)");
+
+static unsigned int calibrate_pool_kb = 2048;
+module_param(calibrate_pool_kb, uint, 0444);
+MODULE_PARM_DESC(calibrate_pool_kb, "Size of buffer pool cleared during calibration");
+
+static const char *mem_clear_names[MEM_CLEAR_METHOD_MAX] = {
+	[MEM_CLEAR_MEMSET]	= "memset",
+	[MEM_CLEAR_ERMS]	= "erms",
+	[MEM_CLEAR_MOVNTI]	= "movnti",
+	[MEM_CLEAR_AVX_NT]	= "avx_nt",
+};
+
+/* Size classes, upper bound and the size used for calibrating it */
+static const size_t class_max[]   = { 128, 512, 2048, 8192, SIZE_MAX };
+static const size_t class_calib[] = { 128, 512, 2048, 8192, 32768 };
+#define NR_CLASSES ARRAY_SIZE(class_max)
+
+static u8 class_method[NR_CLASSES]; /* Default memset, until calibrated */
+static u64 class_ps[NR_CLASSES][MEM_CLEAR_METHOD_MAX]; /* picosec/byte */
+static bool mem_clear_override;
+static DEFINE_MUTEX(mem_clear_mutex);
+static struct dentry *mem_clear_debugfs_dir;
+
+#ifdef CONFIG_X86_64
+void __mem_clear_avx_nt(void *ptr, size_t len)
+{
+	size_t head = -(unsigned long)ptr & 31;
+	size_t i, chunks;
+
+	if (!irq_fpu_usable() || len < head + 128) {
+		__mem_clear_movnti(ptr, len);
+		return;
+	}
+	memset(ptr, 0, head);
+	ptr += head;
+	len -= head;
+	chunks = len / 128;
+
+	kernel_fpu_begin();
+	/* vxorps not vpxor, 256-bit vpxor is AVX2, this needs only AVX */
+	asm volatile("vxorps %ymm0, %ymm0, %ymm0");
+	for (i = 0; i < chunks; i++, ptr += 128) {
+		asm volatile("vmovntdq %%ymm0, (%0)\n\t"
+			     "vmovntdq %%ymm0, 32(%0)\n\t"
+			     "vmovntdq %%ymm0, 64(%0)\n\t"
+			     "vmovntdq %%ymm0, 96(%0)"
+			     : : "r" (ptr) : "memory");
+	}
+	asm volatile("sfence" ::: "memory");
+	kernel_fpu_end();
+
+	memset(ptr, 0, len & 127);
+}
+EXPORT_SYMBOL_GPL(__mem_clear_avx_nt);
+#endif
+
+static bool mem_clear_method_avail(enum mem_clear_method m)
+{
+#ifdef CONFIG_X86_64
+	switch (m) {
+	case MEM_CLEAR_ERMS:
+		return boot_cpu_has(X86_FEATURE_ERMS);
+	case MEM_CLEAR_AVX_NT:
+		return boot_cpu_has(X86_FEATURE_AVX);
+	default:
+		return true;
+	}
+#else
+	return m == MEM_CLEAR_MEMSET;
+#endif
+}
+
+static __always_inline
+void __mem_clear_method(u8 method, void *ptr, size_t len)
+{
+	switch (method) {
+	case MEM_CLEAR_ERMS:
+		__mem_clear_erms(ptr, len);
+		break;
+	case MEM_CLEAR_MOVNTI:
+		__mem_clear_movnti(ptr, len);
+		break;
+	case MEM_CLEAR_AVX_NT:
+		__mem_clear_avx_nt(ptr, len);
+		break;
+	default:
+		memset(ptr, 0, len);
+	}
+}
+
+void mem_clear(void *ptr, size_t len)
+{
+	unsigned int c = 0;
+
+	while (len > class_max[c]) /* Last class is SIZE_MAX */
+		c++;
+	__mem_clear_method(READ_ONCE(class_method[c]), ptr, len);
+}
+EXPORT_SYMBOL_GPL(mem_clear);
+
+/* Returns picosec per byte, clearing size bytes at a time while
+ * walking the pool, thus mostly clearing lines not in the L1/L2.
+ */
+static u64 mem_clear_measure(void *pool, size_t pool_size, u8 method,
+			     size_t size)
+{
+	size_t off = 0;
+	u64 start, stop;
+	unsigned int i;
+
+	preempt_disable();
+	start = ktime_get_ns();
+	for (i = 0; i < calibrate_loops; i++) {
+		__mem_clear_method(method, pool + off, size);
+		off += size;
+		if (off + size > pool_size)
+			off = 0;
+	}
+	stop = ktime_get_ns();
+	preempt_enable();
+
+	return div64_u64((stop - start) * 1000, (u64)calibrate_loops * size);
+}
+
+static int mem_clear_calibrate(void)
+{
+	size_t pool_size = (size_t)calibrate_pool_kb * 1024;
+	unsigned int c, m;
+	void *pool;
+
+	if (!calibrate_loops)
+		return 0;
+	if (pool_size < class_calib[NR_CLASSES - 1])
+		return -EINVAL;
+
+	pool = vmalloc(pool_size);
+	if (!pool)
+		return -ENOMEM;
+	memset(pool, 0xAA, pool_size); /* Fault-in pages */
+
+	for (c = 0; c < NR_CLASSES; c++) {
+		u64 best = U64_MAX;
+
+		for (m = 0; m < MEM_CLEAR_METHOD_MAX; m++) {
+			if (!mem_clear_method_avail(m)) {
+				class_ps[c][m] = 0;
+				continue;
+			}
+			class_ps[c][m] = mem_clear_measure(pool, pool_size, m,
+							   class_calib[c]);
+			if (class_ps[c][m] < best) {
+				best = class_ps[c][m];
+				WRITE_ONCE(class_method[c], m);
+			}
+			cond_resched();
+		}
+		pr_info("Size class <= %zu: selected %s\n", class_calib[c],
+			mem_clear_names[class_method[c]]);
+	}
+	vfree(pool);
+	return 0;
+}
+
+static int mem_clear_show(struct seq_file *m, void *v)
+{
+	unsigned int c, i;
+
+	mutex_lock(&mem_clear_mutex);
+	seq_printf(m, "mode: %s\n", mem_clear_override ? "override" : "auto");
+	seq_puts(m, "# size-max   selected ps/byte:");
+	for (i = 0; i < MEM_CLEAR_METHOD_MAX; i++)
+		seq_printf(m, " %s", mem_clear_names[i]);
+	seq_puts(m, "\n");
+	for (c = 0; c < NR_CLASSES; c++) {
+		if (class_max[c] == SIZE_MAX)
+			seq_printf(m, "%-10s", "max");
+		else
+			seq_printf(m, "%-10zu", class_max[c]);
+		seq_printf(m, " %-8s        ", mem_clear_names[class_method[c]]);
+		for (i = 0; i < MEM_CLEAR_METHOD_MAX; i++)
+			seq_printf(m, " %llu", class_ps[c][i]);
+		seq_puts(m, "\n");
+	}
+	mutex_unlock(&mem_clear_mutex);
+	return 0;
+}
+
+static int mem_clear_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mem_clear_show, NULL);
+}
+
+/* Write a method name to use it for all classes, or "auto" to re-run
+ * calibration.
+ */
+static ssize_t mem_clear_write(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	unsigned int c, i;
+	char buf[32];
+	int err = -EINVAL;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	strim(buf);
+
+	mutex_lock(&mem_clear_mutex);
+	if (!strcmp(buf, "auto")) {
+		err = mem_clear_calibrate();
+		mem_clear_override = false;
+	} else {
+		for (i = 0; i < MEM_CLEAR_METHOD_MAX; i++) {
+			if (strcmp(buf, mem_clear_names[i]) ||
+			    !mem_clear_method_avail(i))
+				continue;
+			for (c = 0; c < NR_CLASSES; c++)
+				WRITE_ONCE(class_method[c], i);
+			mem_clear_override = true;
+			err = 0;
+			break;
+		}
+	}
+	mutex_unlock(&mem_clear_mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations mem_clear_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mem_clear_open,
+	.read		= seq_read,
+	.write		= mem_clear_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init mem_clear_module_init(void)
+{
+	int err;
+
+	mutex_lock(&mem_clear_mutex);
+	err = mem_clear_calibrate();
+	mutex_unlock(&mem_clear_mutex);
+	if (err)
+		pr_warn("Calibration failed (%d), using memset\n", err);
+
+	mem_clear_debugfs_dir = debugfs_create_dir("mem_clear", NULL);
+	debugfs_create_file("classes", 0644, mem_clear_debugfs_dir, NULL,
+			    &mem_clear_fops);
+	return 0;
+}
+module_init(mem_clear_module_init);
+
+static void __exit mem_clear_module_exit(void)
+{
+	debugfs_remove_recursive(mem_clear_debugfs_dir);
+}
+module_exit(mem_clear_module_exit);
+
+MODULE_DESCRIPTION("Size class dispatcher for zero clearing");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
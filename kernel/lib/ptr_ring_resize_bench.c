@@ -0,0 +1,274 @@
+/*
+ * Benchmark of the datapath stall caused by ptr_ring resize
+ *
+ * ptr_ring_resize_multiple() copies all entries while holding both
+ * locks of a ring, and ptr_ring_resize_multiple_lazy() only swaps the
+ * queue, letting the consumer drain the old one.  One CPU runs the
+ * "datapath", produce+consume pairs round-robin on the rings (like
+ * tun/tap queues), keeping them half full, while another CPU resizes
+ * all rings back and forth between size and 2*size.  The worst case
+ * time of a datapath produce+consume pair is the stall.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h> /* missing in ptr_ring.h on >= v4.16 */
+#include <linux/ptr_ring.h>
+#include <linux/ktime.h>
+
+static int verbose=1;
+
+static unsigned int nrings = 4;
+module_param(nrings, uint, 0);
+MODULE_PARM_DESC(nrings, "Number of rings resized together (default 4)");
+
+static unsigned int resizes = 32;
+module_param(resizes, uint, 0);
+MODULE_PARM_DESC(resizes, "Resizes per ring size and mode (default 32)");
+
+static unsigned int size_min = 256;
+module_param(size_min, uint, 0);
+MODULE_PARM_DESC(size_min, "Smallest ring size, doubled up to size_max (default 256)");
+
+static unsigned int size_max = 16384;
+module_param(size_max, uint, 0);
+MODULE_PARM_DESC(size_max, "Largest ring size (default 16384)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+struct resize_bench {
+	struct ptr_ring **rings;
+	int size;
+	bool lazy;
+	bool done;	/* Resizer finished, datapath stops */
+	/* Datapath produce+consume pair */
+	u64 dp_max_ns;
+	u64 dp_total_ns;
+	u64 dp_pairs;
+	/* Resize calls */
+	u64 rs_max_ns;
+	u64 rs_total_ns;
+	unsigned int rs_busy;	/* Lazy resize -EBUSY, old not drained */
+};
+
+static int time_resize_datapath(struct time_bench_record *rec,
+				struct resize_bench *b)
+{
+	void *fake = (void *)(unsigned long)42;
+	uint64_t loops_cnt = 0;
+	struct ptr_ring *r;
+	u64 start, ns;
+	int i = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (!READ_ONCE(b->done)) {
+		r = b->rings[i];
+		if (++i >= nrings)
+			i = 0;
+
+		start = ktime_get_ns();
+		if (ptr_ring_produce_bh(r, fake) < 0) {
+			pr_err("%s(): ring full\n", __func__);
+			break;
+		}
+		if (!ptr_ring_consume_bh(r)) {
+			pr_err("%s(): ring empty\n", __func__);
+			break;
+		}
+		ns = ktime_get_ns() - start;
+
+		b->dp_total_ns += ns;
+		if (ns > b->dp_max_ns)
+			b->dp_max_ns = ns;
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+	b->dp_pairs = loops_cnt;
+	WRITE_ONCE(b->done, true); /* Also stop resizer on error */
+
+	return loops_cnt;
+}
+
+static int time_resize_resizer(struct time_bench_record *rec,
+			       struct resize_bench *b)
+{
+	uint64_t loops_cnt = 0;
+	u64 start, ns;
+	int size, err;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < resizes && !READ_ONCE(b->done)) {
+		/* Grow and shrink, entries (size/2) always fit */
+		size = (loops_cnt & 1) ? b->size : b->size * 2;
+
+		start = ktime_get_ns();
+		if (b->lazy)
+			err = ptr_ring_resize_multiple_lazy(b->rings, nrings,
+							    size, GFP_KERNEL);
+		else
+			err = ptr_ring_resize_multiple(b->rings, nrings, size,
+						       GFP_KERNEL, NULL);
+		ns = ktime_get_ns() - start;
+
+		if (err == -EBUSY) {
+			b->rs_busy++;
+			cond_resched();
+			continue;
+		}
+		if (err) {
+			pr_err("%s(): resize failed (%d)\n", __func__, err);
+			break;
+		}
+		b->rs_total_ns += ns;
+		if (ns > b->rs_max_ns)
+			b->rs_max_ns = ns;
+		loops_cnt++;
+		cond_resched();
+	}
+	time_bench_stop(rec, loops_cnt);
+	WRITE_ONCE(b->done, true);
+
+	return loops_cnt;
+}
+
+/* cpu_idx 0 is the datapath CPU, cpu_idx 1 the resizer */
+static int time_resize(struct time_bench_record *rec, void *data)
+{
+	struct resize_bench *b = data;
+
+	/* Hack: use "step" to mark datapath(0)/resizer(1) */
+	rec->step = rec->cpu_idx;
+	if (rec->cpu_idx == 0)
+		return time_resize_datapath(rec, b);
+	return time_resize_resizer(rec, b);
+}
+
+static bool init_rings(struct resize_bench *b, int size)
+{
+	void *fake = (void *)(unsigned long)42;
+	int i, j;
+
+	for (i = 0; i < nrings; i++) {
+		if (ptr_ring_init(b->rings[i], size, GFP_KERNEL) < 0)
+			goto fail;
+		/* Half full, thus the full resize has entries to copy */
+		for (j = 0; j < size / 2; j++)
+			ptr_ring_produce(b->rings[i], fake);
+	}
+	return true;
+fail:
+	while (--i >= 0)
+		ptr_ring_cleanup(b->rings[i], NULL);
+	return false;
+}
+
+static void cleanup_rings(struct resize_bench *b)
+{
+	int i;
+
+	for (i = 0; i < nrings; i++)
+		ptr_ring_cleanup(b->rings[i], NULL); /* fake ptrs, no destroy */
+}
+
+static void run_resize(struct resize_bench *b, int size, bool lazy,
+		       const cpumask_t *cpumask)
+{
+	struct time_bench_cpu *cpu_tasks;
+	struct time_bench_sync sync;
+	char desc[48];
+
+	cpu_tasks = kcalloc(num_possible_cpus(), sizeof(*cpu_tasks),
+			    GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+	if (!init_rings(b, size))
+		goto out;
+
+	b->size = size;
+	b->lazy = lazy;
+	b->done = false;
+	b->dp_max_ns = b->dp_total_ns = b->dp_pairs = 0;
+	b->rs_max_ns = b->rs_total_ns = 0;
+	b->rs_busy = 0;
+
+	snprintf(desc, sizeof(desc), "ptr_ring_resize_%s_%d",
+		 lazy ? "lazy" : "full", size);
+	time_bench_run_concurrent(resizes, 0, b, cpumask, &sync, cpu_tasks,
+				  time_resize);
+	if (verbose >= 2)
+		time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+
+	pr_info("%s: nrings:%u datapath stall max:%llu ns avg:%llu ns"
+		" (pairs:%llu) resize max:%llu ns avg:%llu ns busy:%u\n",
+		desc, nrings, b->dp_max_ns,
+		b->dp_pairs ? div64_u64(b->dp_total_ns, b->dp_pairs) : 0,
+		b->dp_pairs, b->rs_max_ns,
+		div64_u64(b->rs_total_ns, resizes), b->rs_busy);
+
+	cleanup_rings(b);
+out:
+	kfree(cpu_tasks);
+}
+
+static int run_benchmark_tests(void)
+{
+	struct resize_bench b = {};
+	cpumask_t cpumask;
+	int i, size;
+
+	if (time_bench_cpumask_select(&cpumask, topology, 2) < 2)
+		return -EINVAL;
+
+	b.rings = kcalloc(nrings, sizeof(*b.rings), GFP_KERNEL);
+	if (!b.rings)
+		return -ENOMEM;
+	for (i = 0; i < nrings; i++) {
+		b.rings[i] = kzalloc(sizeof(struct ptr_ring), GFP_KERNEL);
+		if (!b.rings[i])
+			goto out;
+	}
+
+	for (size = size_min; size <= size_max; size *= 2) {
+		run_resize(&b, size, false, &cpumask);
+		run_resize(&b, size, true, &cpumask);
+	}
+out:
+	for (i = 0; i < nrings; i++)
+		kfree(b.rings[i]);
+	kfree(b.rings);
+	return 0;
+}
+
+static int __init ptr_ring_resize_bench_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!nrings || !resizes || size_min < 2 || size_min > size_max) {
+		pr_err("Invalid params nrings:%u resizes:%u size:%u-%u\n",
+		       nrings, resizes, size_min, size_max);
+		return -EINVAL;
+	}
+
+	if (run_benchmark_tests() < 0)
+		return -ECANCELED;
+
+	return 0;
+}
+module_init(ptr_ring_resize_bench_module_init);
+
+static void __exit ptr_ring_resize_bench_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(ptr_ring_resize_bench_module_exit);
+
+MODULE_DESCRIPTION("Benchmark of datapath stall during ptr_ring resize");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -91,6 +91,10 @@
 #include <linux/list.h>
 #include <linux/mm.h>
 #include <linux/cache.h> /* SMP_CACHE_BYTES */
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
 
 #include <linux/ring_queue.h>
 
@@ -102,6 +106,26 @@
 #endif
 #define CACHE_LINE_MASK (CACHE_LINE_SIZE-1) /* Cache line mask */
 
+/* Select the head/tail placement in r->idx[], see RING_F_LAYOUT_* */
+static void ring_queue_layout_init(struct ring_queue *r, unsigned int flags)
+{
+	const unsigned int line = RING_IDX_PER_LINE;
+	int i;
+
+	for (i = 0; i < RING_IDX_NR; i++) {
+		if (flags & RING_F_LAYOUT_COMPACT)
+			r->off[i] = i;
+		else if (flags & RING_F_LAYOUT_PAD)
+			r->off[i] = i * line;
+		else /* split: prod pair on line 0, cons pair on line 1 */
+			r->off[i] = (i / 2) * line + (i % 2);
+	}
+}
+
+/* Default backoff, exponential 1,2,4..64 cpu_relax() then 64 per round */
+#define RING_BACKOFF_PAUSE_MAX	64
+#define RING_BACKOFF_ROUNDS	32
+
 /* Create/allocate a new ring
  *
  * This function allocate memory for the ring. Its size is
@@ -120,12 +144,34 @@
  *    - RING_F_SC_DEQ: If this flag is set, the default behavior when
  *      using ``ring_queue_dequeue()`` or ``ring_queue_dequeue_bulk()``
  *      is "single-consumer". Otherwise, it is "multi-consumers".
+ *    - RING_F_LAYOUT_COMPACT: Place producer and consumer head/tail
+ *      on the same cache-line.  Smaller footprint, but producers and
+ *      consumers bounce the same line.
+ *    - RING_F_LAYOUT_PAD: Place every head/tail on its own cache-line.
+ *      Without any layout flag, producer head+tail and consumer
+ *      head+tail get a cache-line each (split layout).
+ *    - RING_F_WAIT_STATS: Count MP/MC waits on the tail, per-CPU.
+ *    - RING_F_WAIT_YIELD: MP/MC waiters can yield the CPU, after the
+ *      backoff rounds.  Only for rings used from process context.
  * @return
  *   On success, the pointer to the new allocated ring.
  *   NULL on error
  */
 struct ring_queue *
 ring_queue_create(unsigned int count, unsigned int flags)
+{
+	return ring_queue_create_elem(count, sizeof(void *), flags);
+}
+EXPORT_SYMBOL(ring_queue_create);
+
+/* Create a ring storing elements of *esize* bytes inline, see
+ * ring_queue_create() for *count* and *flags*.  The esize must be a
+ * multiple of sizeof(u32).  Only the *_elem_* enqueue/dequeue functions
+ * can be used on the ring, unless esize == sizeof(void *).
+ */
+struct ring_queue *
+ring_queue_create_elem(unsigned int count, unsigned int esize,
+		       unsigned int flags)
 {
 	struct ring_queue *r;
 	size_t ring_size;
@@ -136,12 +182,11 @@ ring_queue_create(unsigned int count, unsigned int flags)
 // perhaps use ____cacheline_aligned instead?
 	BUILD_BUG_ON((sizeof(struct ring_queue) &
 		      CACHE_LINE_MASK) != 0);
-#ifdef CONFIG_LIB_RING_QUEUE_SPLIT_PROD_CONS
-	BUILD_BUG_ON((offsetof(struct ring_queue, cons) &
+	BUILD_BUG_ON((offsetof(struct ring_queue, idx) &
 		      CACHE_LINE_MASK) != 0);
-#endif
-	BUILD_BUG_ON((offsetof(struct ring_queue, prod) &
+	BUILD_BUG_ON((offsetof(struct ring_queue, ring) &
 		      CACHE_LINE_MASK) != 0);
+	BUILD_BUG_ON(offsetof(struct ring_queue, idx) > CACHE_LINE_SIZE);
 
 	/* count must be a power of 2 */
 	if ((!POWEROF2(count)) || (count > RING_QUEUE_SZ_MASK)) {
@@ -149,8 +194,17 @@ ring_queue_create(unsigned int count, unsigned int flags)
 		       "do not exceed the size limit %u\n", RING_QUEUE_SZ_MASK);
 		return NULL;
 	}
+	if (esize == 0 || (esize % sizeof(u32)) != 0) {
+		pr_err("Element size %u invalid, must be multiple of %zu\n",
+		       esize, sizeof(u32));
+		return NULL;
+	}
+	if ((flags & RING_F_LAYOUT_COMPACT) && (flags & RING_F_LAYOUT_PAD)) {
+		pr_err("Layout flags COMPACT and PAD are exclusive\n");
+		return NULL;
+	}
 
-	ring_size = count * sizeof(void *) + sizeof(struct ring_queue);
+	ring_size = (size_t)count * esize + sizeof(struct ring_queue);
 	//ring_size = PAGE_ALIGN(ring_size);
 	// TODO: This might be suboptimal use of pages, look at improving
 	r = alloc_pages_exact(ring_size, GFP_KERNEL|__GFP_ZERO|__GFP_NOWARN);
@@ -163,17 +217,26 @@ ring_queue_create(unsigned int count, unsigned int flags)
 	/* init the ring structure */
 	memset(r, 0, sizeof(*r));
 	r->flags = flags;
+	r->esize = esize;
 	r->prod.watermark = count;
 	r->prod.sp_enqueue = !!(flags & RING_F_SP_ENQ);
 	r->cons.sc_dequeue = !!(flags & RING_F_SC_DEQ);
 	r->prod.size = r->cons.size = count;
 	r->prod.mask = r->cons.mask = count-1;
-	r->prod.head = r->cons.head = 0;
-	r->prod.tail = r->cons.tail = 0;
+	ring_queue_layout_init(r, flags);
+	r->backoff_pause_max = RING_BACKOFF_PAUSE_MAX;
+	r->backoff_rounds    = RING_BACKOFF_ROUNDS;
+	if (flags & RING_F_WAIT_STATS) {
+		r->wait_stats = alloc_percpu(struct ring_queue_wait_stats);
+		if (!r->wait_stats) {
+			free_pages_exact(r, ring_size);
+			return NULL;
+		}
+	}
 
 	return r;
 }
-EXPORT_SYMBOL(ring_queue_create);
+EXPORT_SYMBOL(ring_queue_create_elem);
 
 /* free memory allocated to the ring */
 bool ring_queue_free(struct ring_queue *r)
@@ -182,7 +245,9 @@ bool ring_queue_free(struct ring_queue *r)
 	unsigned int count = r->prod.size;
 	//TODO: Add sanity checks e.g. if queue is empty...
 
-	ring_size = count * sizeof(void *) + sizeof(struct ring_queue);
+	free_percpu(r->wait_stats);
+	kfree(r->fc);
+	ring_size = (size_t)count * r->esize + sizeof(struct ring_queue);
 	free_pages_exact(r, ring_size);
 	return true;
 }
@@ -207,6 +272,131 @@ ring_queue_set_water_mark(struct ring_queue *r, unsigned count)
 	return 0;
 }
 
+/* Change the MP/MC tail wait backoff.  A waiter does rounds of
+ * cpu_relax(), doubling from 1 up to *pause_max* per round.  After
+ * *rounds* rounds, it yields the CPU each round, if the ring was created
+ * with RING_F_WAIT_YIELD, else keep spinning at *pause_max*.
+ * A *pause_max* of 1 gives a plain cpu_relax() spin.
+ */
+void ring_queue_set_backoff(struct ring_queue *r, unsigned int pause_max,
+			    unsigned int rounds)
+{
+	r->backoff_pause_max = clamp(pause_max, 1U, (unsigned)U16_MAX);
+	r->backoff_rounds    = min(rounds, (unsigned)U16_MAX);
+}
+EXPORT_SYMBOL(ring_queue_set_backoff);
+
+void __ring_queue_wait_tail_slow(struct ring_queue *r, u32 *tail, u32 head)
+{
+	const unsigned int pause_max = r->backoff_pause_max;
+	unsigned int pause = 1, rounds = 0, yields = 0, i;
+	u64 start = 0;
+
+	if (r->wait_stats)
+		start = ktime_get_ns();
+
+	while (READ_ONCE(*tail) != head) {
+		if (++rounds > r->backoff_rounds &&
+		    (r->flags & RING_F_WAIT_YIELD)) {
+			yields++;
+			yield();
+			continue;
+		}
+		for (i = 0; i < pause; i++)
+			cpu_relax();
+		if (pause < pause_max)
+			pause = min(pause << 1, pause_max);
+	}
+
+	if (r->wait_stats) {
+		struct ring_queue_wait_stats *st = get_cpu_ptr(r->wait_stats);
+
+		st->waits++;
+		st->rounds  += rounds;
+		st->yields  += yields;
+		st->wait_ns += ktime_get_ns() - start;
+		put_cpu_ptr(r->wait_stats);
+	}
+}
+EXPORT_SYMBOL(__ring_queue_wait_tail_slow);
+
+/* Sum the per-CPU wait counters, zero if no RING_F_WAIT_STATS */
+void ring_queue_get_wait_stats(struct ring_queue *r,
+			       struct ring_queue_wait_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	if (!r->wait_stats)
+		return;
+	for_each_possible_cpu(cpu) {
+		struct ring_queue_wait_stats *st = per_cpu_ptr(r->wait_stats, cpu);
+
+		sum->waits   += st->waits;
+		sum->rounds  += st->rounds;
+		sum->yields  += st->yields;
+		sum->wait_ns += st->wait_ns;
+	}
+}
+EXPORT_SYMBOL(ring_queue_get_wait_stats);
+
+/* Flow control with hysteresis, on top of the element count.
+ *
+ * The ring enters "congested" state when an enqueue sees >= *high*
+ * elements, and leaves it when a dequeue sees <= *low* elements.  On
+ * each transition *notify* (optional) is called, from the enqueue or
+ * dequeue context, thus it must not sleep.  Producers can also poll
+ * ring_queue_congested().  A *high* of 0 disables flow control.
+ *
+ * Like ring_queue_set_water_mark(), call this before the ring is used,
+ * the flow control state is not protected against concurrent users.
+ */
+int ring_queue_set_flow_control(struct ring_queue *r, u32 high, u32 low,
+				void (*notify)(struct ring_queue *r,
+					       bool congested, void *data),
+				void *data)
+{
+	struct ring_queue_fc *fc = r->fc;
+
+	if (high == 0) {
+		r->fc = NULL;
+		kfree(fc);
+		return 0;
+	}
+	if (high >= r->prod.size || low >= high)
+		return -EINVAL;
+
+	if (!fc) {
+		fc = kzalloc(sizeof(*fc), GFP_KERNEL);
+		if (!fc)
+			return -ENOMEM;
+	}
+	fc->high   = high;
+	fc->low    = low;
+	fc->notify = notify;
+	fc->data   = data;
+	fc->state  = 0;
+	r->fc = fc;
+	return 0;
+}
+EXPORT_SYMBOL(ring_queue_set_flow_control);
+
+/* Slow-path on congestion transition, only one CPU wins each transition */
+void __ring_queue_fc_change(struct ring_queue *r, bool congested)
+{
+	struct ring_queue_fc *fc = r->fc;
+	bool changed;
+
+	if (congested)
+		changed = !test_and_set_bit(RING_FC_CONGESTED, &fc->state);
+	else
+		changed = test_and_clear_bit(RING_FC_CONGESTED, &fc->state);
+
+	if (changed && fc->notify)
+		fc->notify(r, congested, fc->data);
+}
+EXPORT_SYMBOL(__ring_queue_fc_change);
+
  //TODO: remove
 static int __init ring_queue_init(void)
 {
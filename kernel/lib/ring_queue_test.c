@@ -13,12 +13,26 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/skbuff.h>
+#include <linux/kthread.h>
+#include <linux/jiffies.h>
 #include <asm/msr.h>
 
 #include <linux/time_bench.h>
 
 static int verbose=1;
 
+static int parallel_cpus = 4;
+module_param(parallel_cpus, uint, 0);
+MODULE_PARM_DESC(parallel_cpus, "CPUs for the concurrent MPMC layout bench, 0 disables (default 4)");
+
+static int oversubscribe = 1;
+module_param(oversubscribe, uint, 0);
+MODULE_PARM_DESC(oversubscribe, "Run MPMC backoff bench with a CPU hog per bench CPU (default 1)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
 /*** Basic functionality true/false test functions ***/
 
 static bool test_detect_not_power_of_two(void)
@@ -168,6 +182,154 @@ fail:
 	return false;
 }
 
+/* Zero-copy reserve/commit + peek/release, crossing the ring wrap */
+static bool test_zc_wrap_around(unsigned int flags)
+{
+	struct ring_queue *queue;
+	struct ring_queue_zc zc;
+	void *objs[8];
+	unsigned int i, n;
+	bool sp = flags & RING_F_SP_ENQ;
+	bool sc = flags & RING_F_SC_DEQ;
+
+	queue = ring_queue_create(16, flags);
+	if (queue == NULL)
+		return false;
+	/* Move indexes close to end of ring[] */
+	objs[0] = (void *)42UL;
+	for (i = 0; i < 12; i++) {
+		if (ring_queue_enqueue(queue, objs[0]) < 0 ||
+		    ring_queue_dequeue(queue, &objs[1]) < 0)
+			goto fail;
+	}
+	n = sp ? ring_queue_sp_enqueue_reserve(queue, 8, &zc) :
+		 ring_queue_mp_enqueue_reserve(queue, 8, &zc);
+	if (n != 8 || zc.n1 != 4 || zc.ptr2 == NULL)
+		goto fail;
+	for (i = 0; i < n; i++)
+		ring_queue_zc_store(&zc, i, (void *)(unsigned long)(i+20));
+	if (sp)
+		ring_queue_sp_enqueue_commit(queue, &zc);
+	else
+		ring_queue_mp_enqueue_commit(queue, &zc);
+	if (ring_queue_count(queue) != 8)
+		goto fail;
+
+	/* Peek at more than available */
+	n = sc ? ring_queue_sc_dequeue_peek(queue, 10, &zc) :
+		 ring_queue_mc_dequeue_peek(queue, 10, &zc);
+	if (n != 8)
+		goto fail;
+	for (i = 0; i < n; i++) {
+		if (ring_queue_zc_load(&zc, i) != (void *)(unsigned long)(i+20))
+			goto fail;
+	}
+	if (sc)
+		ring_queue_sc_dequeue_release(queue, &zc);
+	else
+		ring_queue_mc_dequeue_release(queue, &zc);
+	if (!ring_queue_empty(queue))
+		goto fail;
+	return ring_queue_free(queue);
+fail:
+	ring_queue_free(queue);
+	return false;
+}
+
+/* Inline element mode, descriptor copied in and out of ring memory */
+struct test_desc {
+	u64 addr;
+	u32 len;
+	u32 flags;
+	u64 data[2];
+};
+
+static bool test_elem_inline_wrap_around(unsigned int flags)
+{
+	struct ring_queue *queue;
+	struct test_desc descs[8], deq[8];
+	unsigned int i;
+
+	queue = ring_queue_create_elem(16, sizeof(struct test_desc), flags);
+	if (queue == NULL)
+		return false;
+	memset(descs, 0, sizeof(descs));
+	/* Move indexes close to end of ring memory */
+	for (i = 0; i < 12; i++) {
+		if (ring_queue_enqueue_elem_bulk(queue, descs, 1) < 0 ||
+		    ring_queue_dequeue_elem_bulk(queue, deq, 1) < 0)
+			goto fail;
+	}
+	for (i = 0; i < 8; i++) {
+		descs[i].addr = 0x1000 * i;
+		descs[i].len  = 64 + i;
+	}
+	if (ring_queue_enqueue_elem_bulk(queue, descs, 8) < 0)
+		goto fail;
+	if (ring_queue_count(queue) != 8)
+		goto fail;
+	/* Fixed bulk must fail when not enough elements */
+	if (ring_queue_dequeue_elem_bulk(queue, deq, 9) != -ENOENT)
+		goto fail;
+	if (ring_queue_dequeue_elem_bulk(queue, deq, 8) < 0)
+		goto fail;
+	if (memcmp(descs, deq, sizeof(descs)) != 0)
+		goto fail;
+	if (!ring_queue_empty(queue))
+		goto fail;
+	return ring_queue_free(queue);
+fail:
+	ring_queue_free(queue);
+	return false;
+}
+
+/* Flow control: high/low watermark with hysteresis */
+static void test_fc_notify(struct ring_queue *r, bool congested, void *data)
+{
+	int *transitions = data;
+
+	(*transitions)++;
+}
+
+static bool test_flow_control_hysteresis(void)
+{
+	struct ring_queue *queue;
+	void *objs[16];
+	int transitions = 0;
+	unsigned int i;
+
+	queue = ring_queue_create(16, 0);
+	if (queue == NULL)
+		return false;
+	if (ring_queue_set_flow_control(queue, 8, 2, test_fc_notify,
+					&transitions) < 0)
+		goto fail;
+	for (i = 0; i < 16; i++)
+		objs[i] = (void *)(unsigned long)(i+20);
+
+	if (ring_queue_enqueue_bulk(queue, objs, 7) < 0 ||
+	    ring_queue_congested(queue) || transitions != 0)
+		goto fail;
+	/* Crossing high enters congested, once */
+	if (ring_queue_enqueue_bulk(queue, objs, 2) < 0 ||
+	    !ring_queue_congested(queue) || transitions != 1)
+		goto fail;
+	if (ring_queue_enqueue(queue, objs[0]) < 0 || transitions != 1)
+		goto fail;
+	/* Below high, but above low, stays congested */
+	if (ring_queue_dequeue_bulk(queue, objs, 6) < 0 ||
+	    !ring_queue_congested(queue) || transitions != 1)
+		goto fail;
+	/* Reaching low leaves congested */
+	if (ring_queue_dequeue_bulk(queue, objs, 2) < 0 ||
+	    ring_queue_congested(queue) || transitions != 2)
+		goto fail;
+	return ring_queue_free(queue);
+fail:
+	ring_queue_free(queue);
+	return false;
+}
+
 #define TEST_FUNC(func) 					\
 do {								\
 	if (!(func)) {						\
@@ -188,6 +350,11 @@ int run_basic_tests(void)
 	TEST_FUNC(test_SPSC_add_and_remove_elem());
 	TEST_FUNC(test_SPSC_add_and_remove_elems_BULK());
 	TEST_FUNC(test_late_void_ptr_cast_BULK());
+	TEST_FUNC(test_zc_wrap_around(RING_F_SP_ENQ|RING_F_SC_DEQ));
+	TEST_FUNC(test_zc_wrap_around(0));
+	TEST_FUNC(test_elem_inline_wrap_around(RING_F_SP_ENQ|RING_F_SC_DEQ));
+	TEST_FUNC(test_elem_inline_wrap_around(0));
+	TEST_FUNC(test_flow_control_hysteresis());
 	return passed_count;
 }
 
@@ -198,7 +365,7 @@ int run_basic_tests(void)
 static int time_bench_for_loop(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -227,7 +394,7 @@ static struct func_ptr_ops my_func_ptr __read_mostly = {
 };
 static int time_call_func_ptr(struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	unsigned int tmp, tmp2;
 	struct func_ptr_ops *func_ptr = &my_func_ptr;
@@ -255,7 +422,7 @@ static const struct net_device_ops my_netdev_ops = {
 static int time_ndo_func_ptr(struct time_bench_record *rec, void *data)
 {
 	struct net_device *netdev;
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	unsigned int tmp;
 
@@ -276,7 +443,7 @@ static int time_ndo_func_ptr(struct time_bench_record *rec, void *data)
 static int time_ndo_func_ptr_null_tst(struct time_bench_record *rec, void *data)
 {
 	struct net_device *netdev;
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	unsigned int tmp = 0;
 
@@ -303,7 +470,7 @@ static int time_bench_single_enqueue_dequeue(
 	int on_stack = 123;
 	int *obj = &on_stack;
 	int *deq_obj = NULL;
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	struct ring_queue *queue = (struct ring_queue*)data;
 
@@ -311,12 +478,6 @@ static int time_bench_single_enqueue_dequeue(
 		pr_err("Need ring_queue as input\n");
 		return -1;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
@@ -342,7 +503,7 @@ static int time_BULK_enqueue_dequeue(
 {
 	int *objs[MAX_BULK];
 	int *deq_objs[MAX_BULK];
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	int bulk = rec->step;
 	struct ring_queue* queue = (struct ring_queue*)data;
@@ -356,11 +517,6 @@ static int time_BULK_enqueue_dequeue(
 			__func__, bulk, MAX_BULK);
 		bulk = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
 	/* fake init pointers to a number */
 	for (i = 0; i < MAX_BULK; i++)
 		objs[i] = (void *)(unsigned long)(i+20);
@@ -385,6 +541,136 @@ fail:
 	return -1;
 }
 
+/* Zero-copy variant of time_BULK_enqueue_dequeue, the ring slots are
+ * written/read in place instead of via an obj_table copy
+ */
+static int time_BULK_zc_enqueue_dequeue(
+	struct time_bench_record *rec, void *data)
+{
+	struct ring_queue *queue = (struct ring_queue *)data;
+	struct ring_queue_zc zc;
+	uint64_t loops_cnt = 0;
+	int bulk = rec->step;
+	unsigned int n, j;
+	void *obj;
+	uint64_t i;
+
+	if (queue == NULL) {
+		pr_err("Need ring_queue as input\n");
+		return -1;
+	}
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		n = queue->prod.sp_enqueue ?
+			ring_queue_sp_enqueue_reserve(queue, bulk, &zc) :
+			ring_queue_mp_enqueue_reserve(queue, bulk, &zc);
+		if (n != bulk)
+			goto fail;
+		for (j = 0; j < n; j++)
+			ring_queue_zc_store(&zc, j, (void *)(unsigned long)j);
+		if (queue->prod.sp_enqueue)
+			ring_queue_sp_enqueue_commit(queue, &zc);
+		else
+			ring_queue_mp_enqueue_commit(queue, &zc);
+		loops_cnt += bulk;
+		barrier(); /* compiler barrier */
+		n = queue->cons.sc_dequeue ?
+			ring_queue_sc_dequeue_peek(queue, bulk, &zc) :
+			ring_queue_mc_dequeue_peek(queue, bulk, &zc);
+		if (n != bulk)
+			goto fail;
+		for (j = 0; j < n; j++) {
+			obj = ring_queue_zc_load(&zc, j);
+			OPTIMIZER_HIDE_VAR(obj); /* keep the loads */
+		}
+		if (queue->cons.sc_dequeue)
+			ring_queue_sc_dequeue_release(queue, &zc);
+		else
+			ring_queue_mc_dequeue_release(queue, &zc);
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	return loops_cnt;
+fail:
+	return -1;
+}
+
+/* Inline element variant: enqueue/dequeue "step" 32 byte descriptors
+ * stored in the ring, compare against pointer rings where the consumer
+ * need to deref each pointer (time_BULK_deref_enqueue_dequeue)
+ */
+static int time_BULK_elem_enqueue_dequeue(
+	struct time_bench_record *rec, void *data)
+{
+	struct ring_queue *queue = (struct ring_queue *)data;
+	struct test_desc descs[MAX_BULK], deq[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int bulk = min_t(int, rec->step, MAX_BULK);
+	u64 sum = 0;
+	uint64_t i;
+	int j;
+
+	memset(descs, 0, sizeof(descs));
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (ring_queue_enqueue_elem_bulk(queue, descs, bulk) < 0)
+			goto fail;
+		loops_cnt += bulk;
+		barrier(); /* compiler barrier */
+		if (ring_queue_dequeue_elem_bulk(queue, deq, bulk) < 0)
+			goto fail;
+		for (j = 0; j < bulk; j++)
+			sum += deq[j].len;
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	OPTIMIZER_HIDE_VAR(sum);
+	return loops_cnt;
+fail:
+	return -1;
+}
+
+static int time_BULK_deref_enqueue_dequeue(
+	struct time_bench_record *rec, void *data)
+{
+	struct ring_queue *queue = (struct ring_queue *)data;
+	struct test_desc *descs, *objs[MAX_BULK], *deq[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int bulk = min_t(int, rec->step, MAX_BULK);
+	u64 sum = 0;
+	uint64_t i;
+	int j;
+
+	descs = kcalloc(MAX_BULK, sizeof(*descs), GFP_KERNEL);
+	if (!descs)
+		return -1;
+	for (j = 0; j < MAX_BULK; j++)
+		objs[j] = &descs[j];
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (ring_queue_enqueue_bulk(queue, (void **)objs, bulk) < 0)
+			goto fail;
+		loops_cnt += bulk;
+		barrier(); /* compiler barrier */
+		if (ring_queue_dequeue_bulk(queue, (void **)deq, bulk) < 0)
+			goto fail;
+		for (j = 0; j < bulk; j++)
+			sum += deq[j]->len;
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	OPTIMIZER_HIDE_VAR(sum);
+	kfree(descs);
+	return loops_cnt;
+fail:
+	kfree(descs);
+	return -1;
+}
+
 /* Multi enqueue before dequeue
  * - strange test as bulk is normal solution, but want to see
  *   if we didn't have/use bulk, and touch more of ring array
@@ -395,7 +681,8 @@ static int time_multi_enqueue_dequeue(
 	int on_stack = 123;
 	int *obj = &on_stack;
 	int *deq_obj = NULL;
-	int i, n;
+	uint64_t i;
+	int n;
 	uint64_t loops_cnt = 0;
 	int elems = rec->step;
 	struct ring_queue* queue = (struct ring_queue*)data;
@@ -404,12 +691,6 @@ static int time_multi_enqueue_dequeue(
 		pr_err("Need ring_queue as input\n");
 		return -1;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2 * elems) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 
 	/** Loop to measure **/
@@ -449,7 +730,7 @@ static int time_list_head(
 {
 	struct list_head list;
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_list_elem *elem;
 	//struct my_list_elem *pos;
 	//int cnt=0;
@@ -518,7 +799,7 @@ static int time_list_locked(
 {
 	struct list_head list;
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_list_elem *elem;
 	INIT_LIST_HEAD(&list);
 	spin_lock_init(&my_list_lock);
@@ -575,7 +856,7 @@ static int time_bench_kmem_cache_reuse(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	//struct my_elem *elem;
 	struct sk_buff *elem;
 
@@ -610,7 +891,8 @@ static int time_bench_kmem_cache_test2(
 {
 #define KMEM_MAX_ELEMS 128
 	uint64_t loops_cnt = 0;
-	int i, n;
+	uint64_t i;
+	int n;
 	//struct my_elem *elem;
 	struct sk_buff *elems[KMEM_MAX_ELEMS];
 
@@ -650,7 +932,7 @@ static int time_bench_kmalloc_test1(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct sk_buff *elem;
 	size_t elem_sz = sizeof(*elem);
 
@@ -677,7 +959,8 @@ static int time_bench_kmalloc_test2(
 {
 # define KMALLOC_MAX_ELEMS 128
 	uint64_t loops_cnt = 0;
-	int i, n;
+	uint64_t i;
+	int n;
 	struct sk_buff *elems[KMALLOC_MAX_ELEMS];
 	size_t elem_sz = sizeof(*elems[0]);
 
@@ -719,6 +1002,189 @@ void run_timing_bulksize(int bulk, uint32_t loops,
 	time_bench_loop(loops, bulk, "MPMC", MPMC, time_BULK_enqueue_dequeue);
 	time_bench_loop(loops, bulk, "SPSC", SPSC, time_BULK_enqueue_dequeue);
 	time_bench_loop(loops, bulk, "MPSC", MPSC, time_BULK_enqueue_dequeue);
+	time_bench_loop(loops, bulk, "MPMC-zc", MPMC,
+			time_BULK_zc_enqueue_dequeue);
+	time_bench_loop(loops, bulk, "SPSC-zc", SPSC,
+			time_BULK_zc_enqueue_dequeue);
+}
+
+/* Concurrent MPMC: every CPU enqueue then dequeue "step" elems on the
+ * same ring, thus head/tail cache-lines get contended by all CPUs.
+ */
+static int time_MPMC_concurrent(struct time_bench_record *rec, void *data)
+{
+	struct ring_queue *queue = data;
+	void *objs[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int bulk = min_t(int, max_t(int, rec->step, 1), MAX_BULK);
+	uint64_t i;
+
+	for (i = 0; i < MAX_BULK; i++)
+		objs[i] = (void *)(unsigned long)(i+20);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (ring_queue_mp_enqueue_bulk(queue, objs, bulk) < 0)
+			continue; /* full, due to other CPUs */
+		loops_cnt += bulk;
+		while (ring_queue_mc_dequeue_bulk(queue, objs, bulk) < 0)
+			cpu_relax(); /* others stole our elems, wait for more */
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+static void run_MPMC_parallel(const char *desc, struct ring_queue *queue,
+			      uint32_t loops, int bulk,
+			      const cpumask_t *cpumask)
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+
+	cpu_tasks = kzalloc(sizeof(*cpu_tasks) * num_possible_cpus(),
+			    GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+	time_bench_run_concurrent(loops, bulk, queue, cpumask, &sync,
+				  cpu_tasks, time_MPMC_concurrent);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+	kfree(cpu_tasks);
+}
+
+static void run_layout_parallel(const char *desc, unsigned int layout,
+				uint32_t loops, int bulk,
+				const cpumask_t *cpumask)
+{
+	struct ring_queue *queue = ring_queue_create(512, layout);
+
+	if (!queue)
+		return;
+	run_MPMC_parallel(desc, queue, loops, bulk, cpumask);
+	ring_queue_free(queue);
+}
+
+/* The MPMC delta between head/tail layouts, see RING_F_LAYOUT_* */
+void run_timing_layouts(uint32_t loops)
+{
+	struct ring_queue *compact, *split, *pad;
+	cpumask_t cpumask;
+	int bulk;
+
+	compact = ring_queue_create(512, RING_F_LAYOUT_COMPACT);
+	split   = ring_queue_create(512, 0);
+	pad     = ring_queue_create(512, RING_F_LAYOUT_PAD);
+	if (compact && split && pad) {
+		time_bench_loop(loops, 0, "MPMC-compact", compact,
+				time_bench_single_enqueue_dequeue);
+		time_bench_loop(loops, 0, "MPMC-split", split,
+				time_bench_single_enqueue_dequeue);
+		time_bench_loop(loops, 0, "MPMC-pad", pad,
+				time_bench_single_enqueue_dequeue);
+		for (bulk = 8; bulk <= MAX_BULK; bulk *= 2) {
+			pr_info("*** Layout timing with BULK=%d ***\n", bulk);
+			time_bench_loop(loops, bulk, "MPMC-compact", compact,
+					time_BULK_enqueue_dequeue);
+			time_bench_loop(loops, bulk, "MPMC-split", split,
+					time_BULK_enqueue_dequeue);
+			time_bench_loop(loops, bulk, "MPMC-pad", pad,
+					time_BULK_enqueue_dequeue);
+		}
+	}
+	if (compact)
+		ring_queue_free(compact);
+	if (split)
+		ring_queue_free(split);
+	if (pad)
+		ring_queue_free(pad);
+
+	if (!parallel_cpus)
+		return;
+	if (time_bench_cpumask_select(&cpumask, topology, parallel_cpus) < 2)
+		return;
+	run_layout_parallel("MPMC-compact-parallel", RING_F_LAYOUT_COMPACT,
+			    loops/10, 8, &cpumask);
+	run_layout_parallel("MPMC-split-parallel", 0,
+			    loops/10, 8, &cpumask);
+	run_layout_parallel("MPMC-pad-parallel", RING_F_LAYOUT_PAD,
+			    loops/10, 8, &cpumask);
+}
+
+/* Oversubscribed: a CPU hog kthread per bench CPU, preempting the bench
+ * threads, also while they hold a head reservation, making MP/MC
+ * waiters spin on the tail.  Compare tail wait backoff policies.
+ */
+static int cpu_hog_thread(void *arg)
+{
+	unsigned long end;
+
+	while (!kthread_should_stop()) {
+		end = jiffies + 1;
+		while (time_before(jiffies, end))
+			cpu_relax();
+		cond_resched();
+	}
+	return 0;
+}
+
+static void run_oversub_policy(const char *desc, unsigned int flags,
+			       unsigned int pause_max, unsigned int rounds,
+			       uint32_t loops, const cpumask_t *cpumask)
+{
+	struct ring_queue_wait_stats st;
+	struct task_struct **hogs;
+	struct ring_queue *queue;
+	int cpu;
+
+	hogs = kcalloc(nr_cpu_ids, sizeof(*hogs), GFP_KERNEL);
+	if (!hogs)
+		return;
+	queue = ring_queue_create(512, flags | RING_F_WAIT_STATS);
+	if (!queue) {
+		kfree(hogs);
+		return;
+	}
+	ring_queue_set_backoff(queue, pause_max, rounds);
+
+	for_each_cpu(cpu, cpumask) {
+		hogs[cpu] = kthread_create(cpu_hog_thread, NULL, "rq_hog%d", cpu);
+		if (IS_ERR(hogs[cpu])) {
+			hogs[cpu] = NULL;
+			continue;
+		}
+		kthread_bind(hogs[cpu], cpu);
+		wake_up_process(hogs[cpu]);
+	}
+
+	run_MPMC_parallel(desc, queue, loops, 8, cpumask);
+
+	for_each_cpu(cpu, cpumask) {
+		if (hogs[cpu])
+			kthread_stop(hogs[cpu]);
+	}
+	kfree(hogs);
+
+	ring_queue_get_wait_stats(queue, &st);
+	pr_info("%s: waits:%llu rounds:%llu yields:%llu wait_ns:%llu\n",
+		desc, st.waits, st.rounds, st.yields, st.wait_ns);
+	ring_queue_free(queue);
+}
+
+void run_timing_oversubscribed(uint32_t loops)
+{
+	cpumask_t cpumask;
+
+	if (!parallel_cpus || !oversubscribe)
+		return;
+	if (time_bench_cpumask_select(&cpumask, topology, parallel_cpus) < 2)
+		return;
+	run_oversub_policy("MPMC-oversub-spin", 0, 1, 0,
+			   loops, &cpumask);
+	run_oversub_policy("MPMC-oversub-backoff", 0, 64, 32,
+			   loops, &cpumask);
+	run_oversub_policy("MPMC-oversub-yield", RING_F_WAIT_YIELD, 64, 32,
+			   loops, &cpumask);
 }
 
 int run_timing_tests(void)
@@ -728,6 +1194,7 @@ int run_timing_tests(void)
 	struct ring_queue *MPMC;
 	struct ring_queue *SPSC;
 	struct ring_queue *MPSC;
+	struct ring_queue *ELEM;
 	uint32_t loops = 10000000;
 
 	time_bench_loop(loops*1000, 0, "for_loop", NULL, time_bench_for_loop);
@@ -781,6 +1248,19 @@ int run_timing_tests(void)
 	run_timing_bulksize(16, loops, MPMC, SPSC, MPSC);
 	run_timing_bulksize(32, loops, MPMC, SPSC, MPSC);
 
+	run_timing_layouts(loops);
+	run_timing_oversubscribed(loops/100);
+
+	ELEM = ring_queue_create_elem(ring_size, sizeof(struct test_desc),
+				      RING_F_SP_ENQ|RING_F_SC_DEQ);
+	if (ELEM) {
+		time_bench_loop(loops, 8, "SPSC-elem32", ELEM,
+				time_BULK_elem_enqueue_dequeue);
+		time_bench_loop(loops, 8, "SPSC-deref32", SPSC,
+				time_BULK_deref_enqueue_dequeue);
+		ring_queue_free(ELEM);
+	}
+
 	ring_queue_free(MPMC);
 	ring_queue_free(SPSC);
 	ring_queue_free(MPSC);
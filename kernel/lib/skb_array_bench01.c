@@ -24,7 +24,7 @@ static int time_bench_one_enq_deq(
 	struct skb_array *queue = (struct skb_array*)data;
 	struct sk_buff *skb, *nskb;
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	/* Fake pointer value to enqueue */
 	skb = (struct sk_buff *)(unsigned long)42;
@@ -33,12 +33,6 @@ static int time_bench_one_enq_deq(
 		pr_err("Need queue struct ptr as input\n");
 		return -1;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
@@ -65,6 +59,60 @@ fail:
 	return 0;
 }
 
+/* Bulk of "step" objects, produced one at a time (lock per element)
+ * versus with skb_array_produce_batched() (lock once), both consumed
+ * with skb_array_consume_batched().  Cost is per element enq+deq.
+ */
+#define MAX_BULK 64
+
+static __always_inline int time_bench_bulk_enq_deq(
+	struct time_bench_record *rec, void *data, bool batched)
+{
+	struct skb_array *queue = (struct skb_array*)data;
+	struct sk_buff *skbs[MAX_BULK], *nskbs[MAX_BULK];
+	int bulk = min_t(int, rec->step, MAX_BULK);
+	uint64_t loops_cnt = 0;
+	uint64_t i;
+	int j, n;
+
+	for (j = 0; j < MAX_BULK; j++)
+		skbs[j] = (struct sk_buff *)(unsigned long)(j+42);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (batched) {
+			if (skb_array_produce_batched(queue, skbs, bulk) != bulk)
+				goto fail;
+		} else {
+			for (j = 0; j < bulk; j++)
+				if (skb_array_produce(queue, skbs[j]) < 0)
+					goto fail;
+		}
+		barrier(); /* compiler barrier */
+
+		n = skb_array_consume_batched(queue, nskbs, bulk);
+		if (n != bulk || nskbs[0] != skbs[0])
+			goto fail;
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	return loops_cnt;
+fail:
+	return 0;
+}
+static int time_bench_bulk_produce_single(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_bulk_enq_deq(rec, data, false);
+}
+static int time_bench_bulk_produce_batched(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_bulk_enq_deq(rec, data, true);
+}
+
 /* Helper for emptying the queue before calling skb_array_cleanup(),
  * because we are using fake SKB pointers, which will Oops the kernel
  * if the destructor kfree_skb() is invoked.
@@ -141,6 +189,33 @@ out:
 	kfree(queue);
 }
 
+void noinline run_bench_produce_batched(uint32_t loops, int q_size)
+{
+	struct skb_array *queue;
+	int bulk;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if (!queue)
+		return;
+	if (skb_array_init(queue, q_size, GFP_KERNEL) < 0) {
+		pr_err("%s() err creating skb_array queue size:%d\n",
+		       __func__, q_size);
+		kfree(queue);
+		return;
+	}
+
+	for (bulk = 1; bulk <= MAX_BULK; bulk *= 2) {
+		time_bench_loop(loops / bulk, bulk, "skb_array_produce_single",
+				queue, time_bench_bulk_produce_single);
+		time_bench_loop(loops / bulk, bulk, "skb_array_produce_batched",
+				queue, time_bench_bulk_produce_batched);
+	}
+
+	helper_empty_queue(queue);
+	skb_array_cleanup(queue);
+	kfree(queue);
+}
+
 int run_benchmark_tests(void)
 {
 	uint32_t loops = 10000000;
@@ -162,6 +237,11 @@ int run_benchmark_tests(void)
 			", cost is enqueue+dequeue\n");
 	run_bench_prefillq(loops, 1000, 64);
 
+	if (verbose)
+		pr_info("For 'skb_array_produce_*' step = bulk"
+			", cost is per element enqueue+dequeue\n");
+	run_bench_produce_batched(loops, 1024);
+
 	return 0;
 }
 
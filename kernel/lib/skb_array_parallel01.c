@@ -15,6 +15,22 @@ static int parallel_cpus = 4;
 module_param(parallel_cpus, uint, 0);
 MODULE_PARM_DESC(parallel_cpus, "Number of parallel CPUs (default 4)");
 
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+static int prefetch_dist = 8;
+module_param(prefetch_dist, uint, 0);
+MODULE_PARM_DESC(prefetch_dist, "Prefetch distance for consume_batched_prefetch bench (default 8)");
+
+static int prefetch_bulk = 16;
+module_param(prefetch_bulk, uint, 0);
+MODULE_PARM_DESC(prefetch_bulk, "Consumer bulk for consume_batched_prefetch bench (default 16)");
+
+static int batch_max = 128;
+module_param(batch_max, uint, 0);
+MODULE_PARM_DESC(batch_max, "Max consumer discard batch in sweep, powers of two from 1 (default 128)");
+
 /* This is the main benchmark function.
  *
  *  lib/time_bench.c:time_bench_run_concurrent() sync concurrent execution
@@ -22,18 +38,18 @@ MODULE_PARM_DESC(parallel_cpus, "Number of parallel CPUs (default 4)");
  * Notice this function is called by different CPUs, and the enq/deq
  * behavior is dependend on CPU id number.
  */
-static int time_bench_CPU_enq_or_deq(
-	struct time_bench_record *rec, void *data)
+static __always_inline int time_bench_CPU_enq_or_deq_mode(
+	struct time_bench_record *rec, void *data, bool spsc)
 {
 	struct skb_array *queue = (struct skb_array*)data;
 	struct sk_buff *skb, *nskb;
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	bool enq_CPU = false;
 
-	/* Split CPU between enq/deq based on even/odd */
-	if ((smp_processor_id() % 2)== 0)
+	/* Split CPU between enq/deq based on even/odd index in cpumask */
+	if ((rec->cpu_idx % 2) == 0)
 		enq_CPU = true;
 
 	/* Hack: use "step" to mark enq/deq, as "step" gets printed */
@@ -46,28 +62,24 @@ static int time_bench_CPU_enq_or_deq(
 		pr_err("Need queue ptr as input\n");
 		return 0;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
 
 		if (enq_CPU) {
 			/* enqueue side */
-			if (skb_array_produce(queue, skb) < 0) {
-				pr_err("%s() WARN: enq fullq(CPU:%d) i:%d\n",
+			if ((spsc ? skb_array_produce_spsc(queue, skb) :
+				    skb_array_produce(queue, skb)) < 0) {
+				pr_err("%s() WARN: enq fullq(CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
 		} else {
 			/* dequeue side */
-			nskb = skb_array_consume(queue);
+			nskb = spsc ? skb_array_consume_spsc(queue) :
+				      skb_array_consume(queue);
 			if (nskb == NULL) {
-				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%d\n",
+				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -80,6 +92,17 @@ finish_early:
 
 	return loops_cnt;
 }
+static int time_bench_CPU_enq_or_deq(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_CPU_enq_or_deq_mode(rec, data, false);
+}
+/* Only valid with exactly one enq CPU and one deq CPU */
+static int time_bench_CPU_enq_or_deq_spsc(
+	struct time_bench_record *rec, void *data)
+{
+	return time_bench_CPU_enq_or_deq_mode(rec, data, true);
+}
 
 
 int run_parallel(const char *desc, uint32_t loops, const cpumask_t *cpumask,
@@ -155,11 +178,10 @@ void noinline run_parallel_two_CPUs(uint32_t loops, int q_size, int prefill)
 
 	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
 
-	/* Restrict the CPUs to run on
+	/* Restrict the CPUs to run on, two CPUs of selected topology
 	 */
-	cpumask_clear(&cpumask);
-	cpumask_set_cpu(0, &cpumask);
-	cpumask_set_cpu(1, &cpumask);
+	if (time_bench_cpumask_select(&cpumask, topology, 2) < 2)
+		goto fail;
 
 	if (!init_queue(queue, q_size, prefill))
 	    goto fail;
@@ -170,6 +192,17 @@ void noinline run_parallel_two_CPUs(uint32_t loops, int q_size, int prefill)
 
 	helper_empty_queue(queue); /* dequeue fake pointers before cleanup */
 	skb_array_cleanup(queue);
+
+	/* Same pair of CPUs, lockless SPSC mode */
+	if (!init_queue(queue, q_size, prefill))
+	    goto fail;
+
+	run_parallel("skb_array_parallel_two_CPUs_spsc",
+		     loops, &cpumask, 0, queue,
+		     time_bench_CPU_enq_or_deq_spsc);
+
+	helper_empty_queue(queue);
+	skb_array_cleanup(queue);
 fail:
 	kfree(queue);
 }
@@ -178,7 +211,6 @@ void noinline run_parallel_many_CPUs(uint32_t loops, int q_size, int prefill)
 {
 	struct skb_array *queue;
 	cpumask_t cpumask;
-	int i;
 
 	/* This test is dependend on module parm */
 	if (parallel_cpus == 0)
@@ -191,10 +223,8 @@ void noinline run_parallel_many_CPUs(uint32_t loops, int q_size, int prefill)
 	 */
 	if (verbose)
 		pr_info("Limit to %d parallel CPUs\n", parallel_cpus);
-	cpumask_clear(&cpumask);
-	for (i = 0; i < parallel_cpus ; i++) {
-		cpumask_set_cpu(i, &cpumask);
-	}
+	if (time_bench_cpumask_select(&cpumask, topology, parallel_cpus) < 0)
+		goto fail;
 
 	if (!init_queue(queue, q_size, prefill))
 	    goto fail;
@@ -210,6 +240,183 @@ fail:
 }
 
 
+/* Cross-CPU handoff of skb-like objects, written by the producer CPU,
+ * and read (head and data) by the consumer CPU, with and without
+ * prefetch.  The skbs are not real, only ->len and ->data are used.
+ */
+#define PF_POOL		4096
+#define PF_MAX_BULK	64
+#define PF_DATA_SZ	SMP_CACHE_BYTES
+
+struct pf_bench {
+	struct skb_array queue;
+	struct sk_buff *pool;
+	u8 *data;
+	int dist;
+	bool prefetch_data;
+};
+
+static int time_bench_CPU_prefetch(struct time_bench_record *rec, void *arg)
+{
+	struct pf_bench *pf = arg;
+	struct sk_buff *skbs[PF_MAX_BULK];
+	int bulk = min_t(int, prefetch_bulk, PF_MAX_BULK);
+	bool enq_CPU = ((rec->cpu_idx % 2) == 0);
+	uint64_t loops_cnt = 0;
+	unsigned long sum = 0;
+	unsigned int idx = 0;
+	struct sk_buff *skb;
+	int i, n;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (enq_CPU) {
+			skb = &pf->pool[idx++ % PF_POOL];
+			skb->len = loops_cnt;
+			skb->data[0] = (u8)loops_cnt;
+			while (skb_array_produce_spsc(&pf->queue, skb) < 0)
+				cpu_relax(); /* full */
+			loops_cnt++;
+		} else {
+			n = min_t(uint64_t, bulk, rec->loops - loops_cnt);
+			n = skb_array_consume_batched_prefetch_spsc(
+				&pf->queue, skbs, n, pf->dist,
+				pf->prefetch_data);
+			if (n == 0) {
+				cpu_relax(); /* empty */
+				continue;
+			}
+			for (i = 0; i < n; i++)
+				sum += skbs[i]->len + skbs[i]->data[0];
+			loops_cnt += n;
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+	OPTIMIZER_HIDE_VAR(sum);
+
+	/* Hack: use "step" to mark enq/deq, as "step" gets printed */
+	rec->step = enq_CPU;
+	return loops_cnt;
+}
+
+void noinline run_parallel_prefetch(uint32_t loops, int q_size)
+{
+	const struct {
+		const char *desc;
+		bool dist;
+		bool data;
+	} runs[] = {
+		{ "skb_array_prefetch_none",      false, false },
+		{ "skb_array_prefetch_head",      true,  false },
+		{ "skb_array_prefetch_head_data", true,  true  },
+	};
+	struct pf_bench *pf;
+	cpumask_t cpumask;
+	int i, r;
+
+	if (time_bench_cpumask_select(&cpumask, topology, 2) < 2)
+		return;
+
+	pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+	if (!pf)
+		return;
+	pf->pool = kcalloc(PF_POOL, sizeof(*pf->pool), GFP_KERNEL);
+	pf->data = kcalloc(PF_POOL, PF_DATA_SZ, GFP_KERNEL);
+	if (!pf->pool || !pf->data)
+		goto out;
+	for (i = 0; i < PF_POOL; i++)
+		pf->pool[i].data = &pf->data[i * PF_DATA_SZ];
+
+	for (r = 0; r < ARRAY_SIZE(runs); r++) {
+		if (skb_array_init(&pf->queue, q_size, GFP_KERNEL) < 0)
+			goto out;
+		pf->dist = runs[r].dist ? prefetch_dist : 0;
+		pf->prefetch_data = runs[r].data;
+		if (verbose)
+			pr_info("%s: dist:%d bulk:%d\n", runs[r].desc,
+				pf->dist, prefetch_bulk);
+		run_parallel(runs[r].desc, loops, &cpumask, 0, pf,
+			     time_bench_CPU_prefetch);
+		helper_empty_queue(&pf->queue);
+		skb_array_cleanup(&pf->queue);
+	}
+out:
+	kfree(pf->data);
+	kfree(pf->pool);
+	kfree(pf);
+}
+
+/* Cross-CPU SPSC handoff on a small ring, where producer and consumer
+ * run close to each other, thus the consumer's deferred zeroing
+ * (discard batch) decides how often they share a cache-line.
+ */
+static int time_bench_CPU_handoff(struct time_bench_record *rec, void *data)
+{
+	struct skb_array *queue = data;
+	struct sk_buff *skb, *nskb = (struct sk_buff *)(unsigned long)42;
+	bool enq_CPU = ((rec->cpu_idx % 2) == 0);
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (enq_CPU) {
+			if (skb_array_produce_spsc(queue, nskb) < 0) {
+				cpu_relax(); /* full */
+				continue;
+			}
+		} else {
+			skb = skb_array_consume_spsc(queue);
+			if (!skb) {
+				cpu_relax(); /* empty */
+				continue;
+			}
+		}
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark enq/deq, as "step" gets printed */
+	rec->step = enq_CPU;
+	return loops_cnt;
+}
+
+void noinline run_parallel_batch_sweep(uint32_t loops, int q_size)
+{
+	struct ptr_ring_stats st;
+	struct skb_array *queue;
+	cpumask_t cpumask;
+	char desc[48];
+	int batch;
+
+	if (time_bench_cpumask_select(&cpumask, topology, 2) < 2)
+		return;
+
+	queue = kzalloc(sizeof(*queue), GFP_KERNEL);
+	if (!queue)
+		return;
+
+	for (batch = 1; batch <= batch_max; batch <<= 1) {
+		if (skb_array_init_batch(queue, q_size, batch, GFP_KERNEL) < 0)
+			break;
+		snprintf(desc, sizeof(desc), "skb_array_discard_batch_%d",
+			 queue->ring.batch);
+		run_parallel(desc, loops, &cpumask, 0, queue,
+			     time_bench_CPU_handoff);
+		skb_array_get_stats(queue, &st);
+		if (verbose)
+			pr_info("%s: prod_full:%lu cons_flush:%lu shared:%lu\n",
+				desc, st.prod_full, st.cons_flush,
+				st.cons_flush_shared);
+		helper_empty_queue(queue);
+		skb_array_cleanup(queue);
+		if (queue->ring.batch != batch)
+			break; /* clamped to ring size */
+	}
+	kfree(queue);
+}
+
 int run_benchmark_tests(void)
 {
 	/* ADJUST: These likely need some adjustments on different
@@ -238,6 +445,14 @@ int run_benchmark_tests(void)
 
 	run_parallel_many_CPUs(loops, q_size, prefill);
 
+	/* Ring smaller than the object pool, thus objects in the ring
+	 * are not overwritten by the producer before consumed
+	 */
+	run_parallel_prefetch(loops, 1024);
+
+	/* Counters need CONFIG_PTR_RING_STATS, else reported as zero */
+	run_parallel_batch_sweep(loops, 512);
+
 	return 0;
 }
 
@@ -12,18 +12,158 @@
 
 #include <linux/perf_event.h> /* perf_event_create_kernel_counter() */
 
+/* For machine-readable result export */
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+
+#include <linux/delay.h> /* mdelay() for clock calibration */
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/math64.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h> /* boot_cpu_has() */
+#include <asm/msr.h> /* APERF/MPERF */
+#include <asm/tsc.h> /* tsc_khz */
+#endif
+
 /* For concurrency testing */
 #include <linux/completion.h>
 #include <linux/sched.h>
 #include <linux/workqueue.h>
 #include <linux/kthread.h>
+#include <linux/topology.h>
+
+/* For interference detection */
+#include <linux/kernel_stat.h>
+#include <linux/interrupt.h>
 
 static int verbose=1;
 
+static bool hist = false;
+module_param(hist, bool, 0644);
+MODULE_PARM_DESC(hist, "Record per-iteration latency histograms (if bench supports it)");
+
+static uint pmu_events = 0;
+module_param(pmu_events, uint, 0644);
+MODULE_PARM_DESC(pmu_events, "Bitmask of PMU events to count (see enum time_bench_pmu_event)");
+
+static int warmup = 0;
+module_param(warmup, int, 0644);
+MODULE_PARM_DESC(warmup, "Warmup passes before time_bench_loop() measures");
+
+static int repeat = 1;
+module_param(repeat, int, 0644);
+MODULE_PARM_DESC(repeat, "Repetitions of time_bench_loop(), reports min/median/stddev (max 32)");
+
+static uint cv_warn = 50;
+module_param(cv_warn, uint, 0644);
+MODULE_PARM_DESC(cv_warn, "Warn if coefficient of variation above (permille)");
+
+static bool spin_start = false;
+module_param(spin_start, bool, 0644);
+MODULE_PARM_DESC(spin_start, "Release concurrent benchmarks via spin-barrier (less start skew)");
+
+static int noise = 0;
+module_param(noise, int, 0644);
+MODULE_PARM_DESC(noise, "IRQ/preempt interference detection: 0=off 1=report 2=discard and rerun");
+
+static int noise_retries = 3;
+module_param(noise_retries, int, 0644);
+MODULE_PARM_DESC(noise_retries, "Max reruns of a disturbed measurement (noise=2)");
+
+static bool exclusive = false;
+module_param(exclusive, bool, 0644);
+MODULE_PARM_DESC(exclusive, "Run bench with preempt+IRQs disabled (bench must not sleep)");
+
+static bool freq = true;
+module_param(freq, bool, 0644);
+MODULE_PARM_DESC(freq, "Record APERF/MPERF effective core frequency and C0 residency (x86)");
+
+static uint freq_warn = 50;
+module_param(freq_warn, uint, 0644);
+MODULE_PARM_DESC(freq_warn, "Warn if core frequency varies above (permille), or idle above");
+
+/* Histogram storage per CPU, avoids any allocation in bench loops */
+static DEFINE_PER_CPU(struct time_bench_hist, time_bench_hist_pcpu);
+
 /** TSC (Time-Stamp Counter) based **
  * See: linux/time_bench.h
  *  tsc_start_clock() and tsc_stop_clock()
  */
+int time_bench_clock = TIME_BENCH_CLOCK_DEFAULT;
+EXPORT_SYMBOL_GPL(time_bench_clock);
+module_param_named(clock, time_bench_clock, int, 0444);
+MODULE_PARM_DESC(clock, "Cycle counter backend: 0=native(tsc/cntvct) 1=get_cycles 2=ktime");
+
+static uint32_t clock_khz;
+
+static const char *clock_names[] = {
+	[TIME_BENCH_CLOCK_NATIVE]     = "native",
+	[TIME_BENCH_CLOCK_GET_CYCLES] = "get_cycles",
+	[TIME_BENCH_CLOCK_KTIME]      = "ktime",
+};
+
+const char *time_bench_clock_name(void)
+{
+	return clock_names[time_bench_clock];
+}
+EXPORT_SYMBOL_GPL(time_bench_clock_name);
+
+/* Calibrated frequency of the selected clock backend */
+uint32_t time_bench_clock_khz(void)
+{
+	return clock_khz;
+}
+EXPORT_SYMBOL_GPL(time_bench_clock_khz);
+
+static void time_bench_clock_select(void)
+{
+	if (time_bench_clock < TIME_BENCH_CLOCK_NATIVE ||
+	    time_bench_clock > TIME_BENCH_CLOCK_KTIME) {
+		pr_warn("Invalid clock=%d, fallback to ktime\n",
+			time_bench_clock);
+		time_bench_clock = TIME_BENCH_CLOCK_KTIME;
+	}
+#ifdef CONFIG_X86
+	/* Guests can have wrong cpu-flags, avoid faulting on RDTSCP */
+	if (time_bench_clock == TIME_BENCH_CLOCK_NATIVE &&
+	    !(boot_cpu_has(X86_FEATURE_TSC) &&
+	      boot_cpu_has(X86_FEATURE_RDTSCP))) {
+		pr_warn("CPU lacks TSC/RDTSCP, fallback to ktime clock\n");
+		time_bench_clock = TIME_BENCH_CLOCK_KTIME;
+	}
+#endif
+	/* Some archs have no usable get_cycles() (returns zero) */
+	if (time_bench_clock == TIME_BENCH_CLOCK_GET_CYCLES && !get_cycles()) {
+		pr_warn("get_cycles() not supported, fallback to ktime\n");
+		time_bench_clock = TIME_BENCH_CLOCK_KTIME;
+	}
+}
+
+/* Measure counter frequency against ktime over approx 10 ms */
+static void time_bench_clock_calibrate(void)
+{
+	uint64_t t_start, t_stop, c_start, c_stop;
+
+	if (time_bench_clock == TIME_BENCH_CLOCK_KTIME) {
+		clock_khz = 1000000; /* 1 GHz, counter is ns */
+		return;
+	}
+
+	preempt_disable();
+	t_start = ktime_get_ns();
+	c_start = tsc_start_clock();
+	mdelay(10);
+	c_stop  = tsc_stop_clock();
+	t_stop  = ktime_get_ns();
+	preempt_enable();
+
+	clock_khz = div64_u64((c_stop - c_start) * NSEC_PER_MSEC,
+			      t_stop - t_start);
+}
 
 /** Wall-clock based **
  */
@@ -104,20 +244,636 @@ bool time_bench_PMU_config(bool enable)
 }
 EXPORT_SYMBOL_GPL(time_bench_PMU_config);
 
+/* Generalized PMU events via perf_event kernel counters */
+#define HW_CACHE_EVT(id, op, res) \
+	((PERF_COUNT_HW_CACHE_##id) | (PERF_COUNT_HW_CACHE_OP_##op << 8) | \
+	 (PERF_COUNT_HW_CACHE_RESULT_##res << 16))
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} pmu_event_tbl[TIME_BENCH_PMU_NR] = {
+	[TIME_BENCH_PMU_CYCLES] = {
+		"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[TIME_BENCH_PMU_INSTRUCTIONS] = {
+		"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[TIME_BENCH_PMU_LLC_MISSES] = {
+		"llc-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[TIME_BENCH_PMU_BRANCH_MISSES] = {
+		"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[TIME_BENCH_PMU_L1D_MISSES] = {
+		"l1d-misses", PERF_TYPE_HW_CACHE, HW_CACHE_EVT(L1D, READ, MISS) },
+	[TIME_BENCH_PMU_DTLB_MISSES] = {
+		"dtlb-misses", PERF_TYPE_HW_CACHE, HW_CACHE_EVT(DTLB, READ, MISS) },
+	[TIME_BENCH_PMU_STALLS_BACKEND] = {
+		"stalled-cycles-backend", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+};
+
+/* Change event set for following runs, same as pmu_events parameter */
+void time_bench_pmu_set_events(uint32_t mask)
+{
+	pmu_events = mask & ((1U << TIME_BENCH_PMU_NR) - 1);
+}
+EXPORT_SYMBOL_GPL(time_bench_pmu_set_events);
+
+/* Create counters for current task, need to be called by the task
+ * running the benchmark function, from task context (can sleep).
+ * Events that cannot be created (e.g. unsupported by CPU or guest)
+ * are dropped from rec->pmu_mask.
+ */
+bool time_bench_pmu_setup(struct time_bench_record *rec)
+{
+	struct perf_event_attr attr;
+	struct perf_event *evt;
+	int i;
+
+	if (!(rec->flags & TIME_BENCH_PMU_EVENTS))
+		return false;
+	if (!in_task()) { /* Can sleep, see time_bench_pmu_init_rec() */
+		rec->flags &= ~TIME_BENCH_PMU_EVENTS;
+		rec->pmu_mask = 0;
+		return false;
+	}
+
+	for (i = 0; i < TIME_BENCH_PMU_NR; i++) {
+		rec->pmu_evt[i] = NULL;
+		if (!(rec->pmu_mask & (1U << i)))
+			continue;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.type         = pmu_event_tbl[i].type;
+		attr.config       = pmu_event_tbl[i].config;
+		attr.size         = sizeof(attr);
+		attr.exclude_user = 1; /* No userspace events */
+		attr.exclude_hv   = 1;
+
+		evt = perf_event_create_kernel_counter(&attr, -1, current,
+						       NULL, NULL);
+		if (IS_ERR(evt)) {
+			pr_warn("%s(): PMU event %s unavailable (%ld)\n",
+				__func__, pmu_event_tbl[i].name, PTR_ERR(evt));
+			rec->pmu_mask &= ~(1U << i);
+			continue;
+		}
+		rec->pmu_evt[i] = evt;
+	}
+	if (!rec->pmu_mask)
+		rec->flags &= ~TIME_BENCH_PMU_EVENTS;
+
+	return !!rec->pmu_mask;
+}
+EXPORT_SYMBOL_GPL(time_bench_pmu_setup);
+
+void time_bench_pmu_teardown(struct time_bench_record *rec)
+{
+	int i;
+
+	for (i = 0; i < TIME_BENCH_PMU_NR; i++) {
+		if (!rec->pmu_evt[i])
+			continue;
+		perf_event_release_kernel(rec->pmu_evt[i]);
+		rec->pmu_evt[i] = NULL;
+	}
+}
+EXPORT_SYMBOL_GPL(time_bench_pmu_teardown);
+
+void time_bench_pmu_read(struct time_bench_record *rec, uint64_t *vals)
+{
+	u64 enabled, running;
+	int i;
+
+	for (i = 0; i < TIME_BENCH_PMU_NR; i++) {
+		if (rec->pmu_evt[i])
+			vals[i] = perf_event_read_value(rec->pmu_evt[i],
+							&enabled, &running);
+	}
+}
+EXPORT_SYMBOL_GPL(time_bench_pmu_read);
+
+/* Convert PMU event set into enabled record (per run) */
+static void time_bench_pmu_init_rec(struct time_bench_record *rec)
+{
+	if (!pmu_events)
+		return;
+	if (exclusive) {
+		/* perf_event_read_value() can sleep */
+		pr_warn_once("PMU events not supported in exclusive mode\n");
+		return;
+	}
+	if (!in_task()) {
+		/* Counter create/release can sleep, e.g. tasklet benches */
+		pr_warn_once("PMU events not supported in softirq/IRQ context\n");
+		return;
+	}
+	rec->pmu_mask = pmu_events;
+	rec->flags |= TIME_BENCH_PMU_EVENTS;
+}
+
+static void time_bench_pmu_print(const char *txt, int cpu,
+				 struct time_bench_record *rec)
+{
+	char buf[256];
+	int i, len = 0;
+
+	if (!(rec->flags & TIME_BENCH_PMU_EVENTS))
+		return;
+
+	for (i = 0; i < TIME_BENCH_PMU_NR; i++) {
+		if (!(rec->pmu_mask & (1U << i)))
+			continue;
+		len += scnprintf(buf + len, sizeof(buf) - len, " %s:%llu.%03llu",
+				 pmu_event_tbl[i].name,
+				 rec->pmu_per_call_quotient[i],
+				 rec->pmu_per_call_decimal[i]);
+	}
+	pr_info("Type:%s CPU(%d) PMU per call:%s\n", txt, cpu, buf);
+}
+
+/** Interrupt/preemption noise detection **
+ */
+static void time_bench_noise_snapshot(int cpu, uint64_t *irqs,
+				      uint64_t *softirqs, uint64_t *ctxsw)
+{
+	int i;
+
+	*irqs = kstat_cpu_irqs_sum(cpu);
+	*softirqs = 0;
+	for (i = 0; i < NR_SOFTIRQS; i++) {
+		/* Tick related softirqs are expected */
+		if (i == TIMER_SOFTIRQ || i == SCHED_SOFTIRQ ||
+		    i == HRTIMER_SOFTIRQ || i == RCU_SOFTIRQ)
+			continue;
+		*softirqs += kstat_softirqs_cpu(i, cpu);
+	}
+	*ctxsw = current->nvcsw + current->nivcsw;
+}
+
+void time_bench_noise_start(struct time_bench_record *rec)
+{
+	rec->noise_cpu = raw_smp_processor_id();
+	time_bench_noise_snapshot(rec->noise_cpu, &rec->irqs_start,
+				  &rec->softirqs_start, &rec->ctxsw_start);
+}
+EXPORT_SYMBOL_GPL(time_bench_noise_start);
+
+void time_bench_noise_stop(struct time_bench_record *rec)
+{
+	uint64_t irqs, softirqs, ctxsw;
+
+	rec->migrated = (raw_smp_processor_id() != rec->noise_cpu);
+	time_bench_noise_snapshot(rec->noise_cpu, &irqs, &softirqs, &ctxsw);
+	rec->irqs     = irqs     - rec->irqs_start;
+	rec->softirqs = softirqs - rec->softirqs_start;
+	rec->ctxsw    = ctxsw    - rec->ctxsw_start;
+}
+EXPORT_SYMBOL_GPL(time_bench_noise_stop);
+
+/* Approx timer ticks expected during the measurement period */
+static uint64_t time_bench_noise_ticks(struct time_bench_record *rec)
+{
+	uint64_t ns = (rec->ts_stop.tv_sec - rec->ts_start.tv_sec) *
+		NSEC_PER_SEC + (rec->ts_stop.tv_nsec - rec->ts_start.tv_nsec);
+
+	return div_u64(ns, NSEC_PER_SEC / HZ) + 1;
+}
+
+bool time_bench_noise_detected(struct time_bench_record *rec)
+{
+	if (!(rec->flags & TIME_BENCH_NOISE))
+		return false;
+
+	return (rec->irqs > time_bench_noise_ticks(rec)) || rec->softirqs ||
+		rec->ctxsw || rec->migrated;
+}
+EXPORT_SYMBOL_GPL(time_bench_noise_detected);
+
+static void time_bench_noise_init_rec(struct time_bench_record *rec)
+{
+	if (noise)
+		rec->flags |= TIME_BENCH_NOISE;
+}
+
+static void time_bench_noise_print(const char *txt, int cpu,
+				   struct time_bench_record *rec)
+{
+	if (!(rec->flags & TIME_BENCH_NOISE))
+		return;
+
+	pr_info("Type:%s CPU(%d) noise: irqs:%llu (ticks:~%llu) softirqs:%llu"
+		" ctxsw:%llu%s%s\n", txt, cpu, rec->irqs,
+		time_bench_noise_ticks(rec), rec->softirqs, rec->ctxsw,
+		rec->migrated ? " MIGRATED" : "",
+		time_bench_noise_detected(rec) ? " - INTERFERENCE" : "");
+}
+
+/** Core frequency via APERF/MPERF **
+ */
+void time_bench_freq_start(struct time_bench_record *rec)
+{
+#ifdef CONFIG_X86
+	/* MPERF is read closest to the TSC reads, start and stop */
+	if (rdmsrl_safe(MSR_IA32_APERF, &rec->aperf_start) ||
+	    rdmsrl_safe(MSR_IA32_MPERF, &rec->mperf_start))
+		rec->flags &= ~TIME_BENCH_FREQ;
+#endif
+}
+EXPORT_SYMBOL_GPL(time_bench_freq_start);
+
+void time_bench_freq_stop(struct time_bench_record *rec)
+{
+#ifdef CONFIG_X86
+	uint64_t aperf, mperf;
+
+	if (rdmsrl_safe(MSR_IA32_MPERF, &mperf) ||
+	    rdmsrl_safe(MSR_IA32_APERF, &aperf)) {
+		rec->flags &= ~TIME_BENCH_FREQ;
+		return;
+	}
+	rec->aperf = aperf - rec->aperf_start;
+	rec->mperf = mperf - rec->mperf_start;
+#endif
+}
+EXPORT_SYMBOL_GPL(time_bench_freq_stop);
+
+static void time_bench_freq_init_rec(struct time_bench_record *rec)
+{
+#ifdef CONFIG_X86
+	if (freq && boot_cpu_has(X86_FEATURE_APERFMPERF))
+		rec->flags |= TIME_BENCH_FREQ;
+#endif
+}
+
+/* Derive per call core cycles, frequency (MHz is cycles per usec) and
+ * C0 residency.  MPERF ticks at the TSC rate, but only while in C0.
+ */
+static void time_bench_freq_calc(struct time_bench_record *rec,
+				 uint64_t invoked_cnt)
+{
+	uint64_t cycles = 0;
+
+	if (rec->flags & TIME_BENCH_FREQ) {
+		cycles = rec->aperf;
+#ifdef CONFIG_X86
+		if (tsc_khz && rec->time_interval) {
+			uint64_t tsc = mul_u64_u64_div_u64(tsc_khz,
+							   rec->time_interval,
+							   NSEC_PER_MSEC);
+			if (tsc)
+				rec->c0_permille = min_t(uint64_t, 1000,
+					div64_u64(rec->mperf * 1000, tsc));
+		}
+#endif
+	} else if ((rec->flags & TIME_BENCH_PMU_EVENTS) &&
+		   (rec->pmu_mask & (1U << TIME_BENCH_PMU_CYCLES))) {
+		cycles = rec->pmu_delta[TIME_BENCH_PMU_CYCLES];
+	}
+	if (!cycles)
+		return;
+	rec->core_cycles = invoked_cnt ? div64_u64(cycles, invoked_cnt) : cycles;
+	if (rec->time_interval)
+		rec->freq_mhz = div64_u64(cycles * 1000, rec->time_interval);
+}
+
+static void time_bench_freq_print(const char *txt, int cpu,
+				  struct time_bench_record *rec)
+{
+	if (!rec->freq_mhz)
+		return;
+
+	if (!(rec->flags & TIME_BENCH_FREQ)) {
+		pr_info("Type:%s CPU(%d) core: %llu cycles %u MHz (PMU)\n",
+			txt, cpu, rec->core_cycles, rec->freq_mhz);
+		return;
+	}
+	pr_info("Type:%s CPU(%d) core: %llu cycles %u MHz (tsc: %llu cycles"
+		" %u MHz) C0:%u.%u%%\n", txt, cpu, rec->core_cycles,
+		rec->freq_mhz, rec->tsc_cycles, time_bench_clock_khz() / 1000,
+		rec->c0_permille / 10, rec->c0_permille % 10);
+	if (rec->c0_permille && rec->c0_permille < 1000 - freq_warn)
+		pr_warn("WARNING: Type:%s CPU(%d) idle (C-states) %u.%u%% of"
+			" the run, tsc cycles are not core cycles\n",
+			txt, cpu, (1000 - rec->c0_permille) / 10,
+			(1000 - rec->c0_permille) % 10);
+}
+
+/* Warn when the core frequency differed between repetitions or CPUs */
+static void time_bench_freq_range_check(const char *txt, const char *what,
+					uint32_t min_mhz, uint32_t max_mhz)
+{
+	uint32_t var;
+
+	if (!min_mhz || min_mhz == U32_MAX)
+		return;
+	var = div_u64((uint64_t)(max_mhz - min_mhz) * 1000, min_mhz);
+	if (var > freq_warn)
+		pr_warn("WARNING: Type:%s core frequency varied %u-%u MHz"
+			" across %s (%u.%u%%), compare core cycles\n",
+			txt, min_mhz, max_mhz, what, var / 10, var % 10);
+}
+
+/* Invoke bench function, in exclusive mode own the CPU by disabling
+ * preemption and IRQs (see linux/time_bench.h).  Keep such runs short
+ * to avoid triggering RCU stall or lockup detectors.
+ *
+ * Bench functions return their loop count as int, which truncates
+ * (possibly to zero) for 64-bit loop counts, thus a run also succeeded
+ * if time_bench_stop() recorded invocations.
+ */
+static bool time_bench_invoke(int (*func)(struct time_bench_record *rec,
+					  void *data),
+			      struct time_bench_record *rec, void *data)
+{
+	unsigned long flags;
+	int ret;
+
+	if (!exclusive) {
+		ret = func(rec, data);
+	} else {
+		preempt_disable();
+		raw_local_irq_save(flags);
+		ret = func(rec, data);
+		raw_local_irq_restore(flags);
+		preempt_enable();
+	}
+	return ret || rec->invoked_cnt;
+}
+
+/** Latency histogram **
+ */
+void time_bench_hist_init(struct time_bench_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = U64_MAX;
+}
+EXPORT_SYMBOL_GPL(time_bench_hist_init);
+
+static void time_bench_hist_setup(struct time_bench_record *rec, int cpu)
+{
+	struct time_bench_hist *h;
+
+	if (!hist)
+		return;
+
+	h = per_cpu_ptr(&time_bench_hist_pcpu, cpu);
+	time_bench_hist_init(h);
+	rec->hist   = h;
+	rec->flags |= TIME_BENCH_HIST;
+}
+
+/* Lower bound value of bucket index, inverse of time_bench_hist_idx() */
+static uint64_t time_bench_hist_value(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < TIME_BENCH_HIST_SUB)
+		return idx;
+
+	shift = (idx >> TIME_BENCH_HIST_SUB_BITS) - 1;
+	return ((uint64_t)(TIME_BENCH_HIST_SUB |
+			   (idx & (TIME_BENCH_HIST_SUB - 1)))) << shift;
+}
+
+static uint64_t time_bench_hist_percentile(struct time_bench_hist *h,
+					   uint32_t permille)
+{
+	uint64_t target = div_u64(h->count * permille, 1000);
+	uint64_t cum = 0;
+	unsigned int i;
+
+	for (i = 0; i < TIME_BENCH_HIST_BUCKETS; i++) {
+		cum += h->buckets[i];
+		if (cum > target)
+			return clamp(time_bench_hist_value(i), h->min, h->max);
+	}
+	return h->max;
+}
+
+void time_bench_hist_calc(struct time_bench_hist *h)
+{
+	if (!h->count)
+		return;
+	h->p50  = time_bench_hist_percentile(h, 500);
+	h->p99  = time_bench_hist_percentile(h, 990);
+	h->p999 = time_bench_hist_percentile(h, 999);
+}
+EXPORT_SYMBOL_GPL(time_bench_hist_calc);
+
+static void time_bench_hist_print(const char *txt, int cpu,
+				  struct time_bench_record *rec)
+{
+	struct time_bench_hist *h = rec->hist;
+
+	if (!(rec->flags & TIME_BENCH_HIST) || !h->count)
+		return;
+
+	pr_info("Type:%s CPU(%d) latency cycles(tsc) p50:%llu p99:%llu"
+		" p99.9:%llu max:%llu min:%llu (samples:%llu)\n",
+		txt, cpu, h->p50, h->p99, h->p999, h->max, h->min, h->count);
+}
+
+/** Machine-readable result export via debugfs **
+ *
+ * Every completed record gets appended to a fixed size log, which is
+ * exported as one line per record in:
+ *   /sys/kernel/debug/time_bench/results
+ *
+ * Records from time_bench_run_concurrent() get one line per CPU, plus
+ * a summary line with cpu=-1.  With "repeat" each repetition gets a
+ * line, which scripts/time_bench_compare.py uses as samples when
+ * comparing a baseline against a new run.  Writing anything to the
+ * file clears the log.  When the log is full the oldest record gets
+ * overwritten.
+ */
+#define TIME_BENCH_RESULTS_MAX	512
+#define TIME_BENCH_NAME_LEN	48
+
+struct time_bench_result {
+	char		name[TIME_BENCH_NAME_LEN];
+	int		cpu;
+	uint32_t	step;
+	uint64_t	loops;
+	uint64_t	invoked_cnt;
+	uint64_t	tsc_cycles;
+	uint64_t	ns_per_call_quotient, ns_per_call_decimal;
+	uint64_t	time_interval;
+	uint64_t	pmc_ipc_quotient, pmc_ipc_decimal;
+	uint64_t	p50, p99, p999, max; /* Only if TIME_BENCH_HIST */
+	uint64_t	ops_per_sec, bytes_per_sec;
+	uint64_t	core_cycles;
+	uint32_t	freq_mhz;
+	uint32_t	flags;
+};
+
+/* Records are added from the bench context, which can be softirq
+ * (tasklet benches) or with IRQs disabled (exclusive mode), thus a
+ * spinlock taken with irqsave.
+ */
+static struct {
+	spinlock_t lock;
+	uint64_t seq;	/* Total records, log index is seq % MAX */
+	struct time_bench_result log[TIME_BENCH_RESULTS_MAX];
+} results = {
+	.lock = __SPIN_LOCK_UNLOCKED(results.lock),
+};
+
+static struct dentry *time_bench_debugfs_dir;
+
+static void time_bench_result_add(const char *name, int cpu,
+				  struct time_bench_record *rec)
+{
+	struct time_bench_result *r;
+	unsigned long flags;
+
+	spin_lock_irqsave(&results.lock, flags);
+	r = &results.log[results.seq % TIME_BENCH_RESULTS_MAX];
+	results.seq++;
+
+	memset(r, 0, sizeof(*r));
+	strscpy(r->name, name ? name : "(none)", sizeof(r->name));
+	r->cpu         = cpu;
+	r->step        = rec->step;
+	r->loops       = rec->loops;
+	r->invoked_cnt = rec->invoked_cnt;
+	r->tsc_cycles  = rec->tsc_cycles;
+	r->ns_per_call_quotient = rec->ns_per_call_quotient;
+	r->ns_per_call_decimal  = rec->ns_per_call_decimal;
+	r->time_interval        = rec->time_interval;
+	r->pmc_ipc_quotient     = rec->pmc_ipc_quotient;
+	r->pmc_ipc_decimal      = rec->pmc_ipc_decimal;
+	r->ops_per_sec   = rec->ops_per_sec;
+	r->bytes_per_sec = rec->bytes_per_sec;
+	r->core_cycles = rec->core_cycles;
+	r->freq_mhz    = rec->freq_mhz;
+	r->flags       = rec->flags;
+	if (rec->flags & TIME_BENCH_HIST) {
+		r->p50  = rec->hist->p50;
+		r->p99  = rec->hist->p99;
+		r->p999 = rec->hist->p999;
+		r->max  = rec->hist->max;
+	}
+	spin_unlock_irqrestore(&results.lock, flags);
+}
+
+static int time_bench_results_show(struct seq_file *m, void *v)
+{
+	struct time_bench_result res, *r = &res;
+	uint64_t i, first = 0, seq;
+	unsigned long flags;
+
+	seq_printf(m, "# clock:%s khz:%u\n",
+		   time_bench_clock_name(), clock_khz);
+	seq_puts(m, "# version:3 name cpu step loops invoked cycles ns"
+		 " time_interval ipc p50 p99 p99.9 max flags"
+		 " ops_per_sec bytes_per_sec core_cycles freq_mhz\n");
+
+	spin_lock_irqsave(&results.lock, flags);
+	seq = results.seq;
+	spin_unlock_irqrestore(&results.lock, flags);
+	if (seq > TIME_BENCH_RESULTS_MAX)
+		first = seq - TIME_BENCH_RESULTS_MAX;
+
+	for (i = first; i < seq; i++) {
+		/* Copy out one record, print without the lock held */
+		spin_lock_irqsave(&results.lock, flags);
+		if (i >= results.seq) { /* Reset meanwhile */
+			spin_unlock_irqrestore(&results.lock, flags);
+			break;
+		}
+		res = results.log[i % TIME_BENCH_RESULTS_MAX];
+		spin_unlock_irqrestore(&results.lock, flags);
+		seq_printf(m, "%s %d %u %llu %llu %llu %llu.%03llu %llu"
+			   " %llu.%03llu %llu %llu %llu %llu 0x%x %llu %llu"
+			   " %llu %u\n",
+			   r->name, r->cpu, r->step, r->loops,
+			   r->invoked_cnt, r->tsc_cycles,
+			   r->ns_per_call_quotient, r->ns_per_call_decimal,
+			   r->time_interval,
+			   r->pmc_ipc_quotient, r->pmc_ipc_decimal,
+			   r->p50, r->p99, r->p999, r->max, r->flags,
+			   r->ops_per_sec, r->bytes_per_sec,
+			   r->core_cycles, r->freq_mhz);
+	}
+	return 0;
+}
+
+static int time_bench_results_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, time_bench_results_show, NULL);
+}
+
+static ssize_t time_bench_results_write(struct file *file,
+					const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&results.lock, flags);
+	results.seq = 0;
+	spin_unlock_irqrestore(&results.lock, flags);
+	return count;
+}
+
+static const struct file_operations time_bench_results_fops = {
+	.owner   = THIS_MODULE,
+	.open    = time_bench_results_open,
+	.read    = seq_read,
+	.write   = time_bench_results_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
 /** Generic functions **
  */
 
+/* 64-bit division, returning quotient and three decimals .xxx
+ * (truncated), overflow safe for the full 64-bit range.
+ */
+static uint64_t time_bench_div(uint64_t dividend, uint64_t divisor,
+			       uint64_t *decimal)
+{
+	uint64_t quotient, rem;
+
+	if (!divisor) {
+		*decimal = 0;
+		return 0;
+	}
+	quotient = div64_u64_rem(dividend, divisor, &rem);
+	/* rem < divisor, thus only risk overflow for huge divisors */
+	if (rem <= div64_u64(U64_MAX, 1000))
+		*decimal = div64_u64(rem * 1000, divisor);
+	else
+		*decimal = div64_u64(rem, div64_u64(divisor, 1000));
+	return quotient;
+}
+
+/* Print throughput in Mops/sec and, if bench declared bytes-per-op,
+ * as GB/sec bandwidth (GB=10^9 bytes)
+ */
+static void time_bench_throughput_print(const char *prefix, const char *txt,
+					uint64_t ops_per_sec,
+					uint64_t bytes_per_sec)
+{
+	uint64_t mops, mops_dec, gbs, gbs_dec;
+
+	mops = time_bench_div(ops_per_sec, 1000000, &mops_dec);
+	if (!bytes_per_sec) {
+		pr_info("%sType:%s throughput: %llu.%03llu Mops/sec\n",
+			prefix, txt, mops, mops_dec);
+		return;
+	}
+	gbs = time_bench_div(bytes_per_sec, 1000000000, &gbs_dec);
+	pr_info("%sType:%s throughput: %llu.%03llu Mops/sec %llu.%03llu GB/sec\n",
+		prefix, txt, mops, mops_dec, gbs, gbs_dec);
+}
+
 /* Calculate stats, store results in record */
 bool time_bench_calc_stats(struct time_bench_record *rec)
 {
 #define NANOSEC_PER_SEC 1000000000 /* 10^9 */
-	uint64_t ns_per_call_tmp_rem   = 0;
-	uint32_t ns_per_call_remainder = 0;
-	uint64_t pmc_ipc_tmp_rem   = 0;
-	uint32_t pmc_ipc_remainder = 0;
-	uint32_t pmc_ipc_div = 0;
-	uint32_t invoked_cnt_precision = 0;
-	uint32_t invoked_cnt = 0; /* 32-bit due to div_u64_rem() */
+	uint64_t invoked_cnt = 0;
+	uint64_t unused;
 
 	if (rec->flags & TIME_BENCH_LOOP) {
 		if (rec->invoked_cnt < 1000) {
@@ -125,13 +881,7 @@ bool time_bench_calc_stats(struct time_bench_record *rec)
 			       rec->invoked_cnt);
 			return false;
 		}
-		if (rec->invoked_cnt > ((1ULL<<32)-1)) {
-			/* div_u64_rem() can only support div with 32bit*/
-			pr_err("ERR: Invoke cnt(%llu) too big overflow 32bit\n",
-			       rec->invoked_cnt);
-			return false;
-		}
-		invoked_cnt = (uint32_t)rec->invoked_cnt;
+		invoked_cnt = rec->invoked_cnt;
 	}
 
 	/* TSC (Time-Stamp Counter) records */
@@ -143,7 +893,8 @@ bool time_bench_calc_stats(struct time_bench_record *rec)
 		}
 		/* Calculate stats */
 		if (rec->flags & TIME_BENCH_LOOP)
-			rec->tsc_cycles = rec->tsc_interval / invoked_cnt;
+			rec->tsc_cycles = time_bench_div(rec->tsc_interval,
+							 invoked_cnt, &unused);
 		else
 			rec->tsc_cycles = rec->tsc_interval;
 	}
@@ -168,22 +919,18 @@ bool time_bench_calc_stats(struct time_bench_record *rec)
 		//TODO: use existing struct timespec records instead of div?
 
 		if (rec->flags & TIME_BENCH_LOOP) {
-			/*** Division in kernel it tricky ***/
 			/* Orig: ns = ((double)time_interval / invoked_cnt); */
-			/* First get quotient */
 			rec->ns_per_call_quotient =
-				div_u64_rem(rec->time_interval,
-					    invoked_cnt,
-					    &ns_per_call_remainder);
-			/* Now get decimals .xxx precision (incorrect roundup)*/
-			ns_per_call_tmp_rem = ns_per_call_remainder;
-			invoked_cnt_precision = invoked_cnt/1000;
-			if (invoked_cnt_precision > 0) {
-				rec->ns_per_call_decimal =
-					div_u64_rem(ns_per_call_tmp_rem,
-						    invoked_cnt_precision,
-						    &ns_per_call_remainder);
-			}
+				time_bench_div(rec->time_interval, invoked_cnt,
+					       &rec->ns_per_call_decimal);
+
+			/* Throughput mode, ops/sec and bytes/sec */
+			rec->ops_per_sec = mul_u64_u64_div_u64(invoked_cnt,
+							       NANOSEC_PER_SEC,
+							       rec->time_interval);
+			if (rec->flags & TIME_BENCH_STEP_BYTES)
+				rec->bytes_per_sec =
+					rec->ops_per_sec * rec->step;
 		}
 	}
 
@@ -194,57 +941,182 @@ bool time_bench_calc_stats(struct time_bench_record *rec)
 		rec->pmc_clk  = rec->pmc_clk_stop  - rec->pmc_clk_start;
 
 		/* Calc Instruction Per Cycle (IPC) */
-		/* First get quotient */
 		rec->pmc_ipc_quotient =
-			div_u64_rem(rec->pmc_inst, rec->pmc_clk,
-				    &pmc_ipc_remainder);
-		/* Now get decimals .xxx precision (incorrect roundup)*/
- 		pmc_ipc_tmp_rem = pmc_ipc_remainder;
-		pmc_ipc_div = rec->pmc_clk/1000;
-		if (pmc_ipc_div > 0) {
-			rec->pmc_ipc_decimal =
-				div_u64_rem(pmc_ipc_tmp_rem, pmc_ipc_div,
-					    &pmc_ipc_remainder);
+			time_bench_div(rec->pmc_inst, rec->pmc_clk,
+				       &rec->pmc_ipc_decimal);
+	}
+
+	/* PMU events via perf_event, reported per call */
+	if (rec->flags & TIME_BENCH_PMU_EVENTS) {
+		int i;
+
+		for (i = 0; i < TIME_BENCH_PMU_NR; i++) {
+			if (!(rec->pmu_mask & (1U << i)))
+				continue;
+			rec->pmu_delta[i] = rec->pmu_stop[i] - rec->pmu_start[i];
+			if (!invoked_cnt) {
+				rec->pmu_per_call_quotient[i] = rec->pmu_delta[i];
+				continue;
+			}
+			rec->pmu_per_call_quotient[i] =
+				time_bench_div(rec->pmu_delta[i], invoked_cnt,
+					       &rec->pmu_per_call_decimal[i]);
+		}
+		/* IPC from perf counters, when both events are enabled */
+		if ((rec->pmu_mask & (1U << TIME_BENCH_PMU_CYCLES)) &&
+		    (rec->pmu_mask & (1U << TIME_BENCH_PMU_INSTRUCTIONS))) {
+			rec->pmc_clk  = rec->pmu_delta[TIME_BENCH_PMU_CYCLES];
+			rec->pmc_inst = rec->pmu_delta[TIME_BENCH_PMU_INSTRUCTIONS];
+			rec->pmc_ipc_quotient =
+				time_bench_div(rec->pmc_inst, rec->pmc_clk,
+					       &rec->pmc_ipc_decimal);
 		}
 	}
 
+	/* Per-iteration latency histogram */
+	if (rec->flags & TIME_BENCH_HIST)
+		time_bench_hist_calc(rec->hist);
+
+	time_bench_freq_calc(rec, invoked_cnt);
 	return true;
 }
 EXPORT_SYMBOL_GPL(time_bench_calc_stats);
 
-/* Generic function for invoking a loop function and calculating
- * execution time stats.  The function being called/timed is assumed
- * to perform a tight loop, and update the timing record struct.
- */
-bool time_bench_loop(uint32_t loops, int step, char *txt, void *data,
-		     int (*func)(struct time_bench_record *record, void *data)
-	)
+static bool time_bench_loop_once(struct time_bench_record *rec,
+				 uint64_t loops, int step, void *data,
+				 int (*func)(struct time_bench_record *rec,
+					     void *data))
 {
-	struct time_bench_record rec;
-
 	/* Setup record */
-	memset(&rec, 0, sizeof(rec)); /* zero func might not update all */
-	rec.version_abi = 1;
-	rec.loops       = loops;
-	rec.step        = step;
-	rec.flags       = (TIME_BENCH_LOOP|TIME_BENCH_TSC|TIME_BENCH_WALLCLOCK);
-//	rec.flags       = (TIME_BENCH_LOOP|TIME_BENCH_TSC|
-//			   TIME_BENCH_WALLCLOCK|TIME_BENCH_PMU);
-	//TODO: Add/copy txt to rec
+	memset(rec, 0, sizeof(*rec)); /* zero func might not update all */
+	rec->version_abi = 1;
+	rec->loops       = loops;
+	rec->step        = step;
+	rec->flags       = (TIME_BENCH_LOOP|TIME_BENCH_TSC|TIME_BENCH_WALLCLOCK);
+//	rec->flags       = (TIME_BENCH_LOOP|TIME_BENCH_TSC|
+//			    TIME_BENCH_WALLCLOCK|TIME_BENCH_PMU);
+	time_bench_hist_setup(rec, raw_smp_processor_id());
+	time_bench_pmu_init_rec(rec);
+	time_bench_pmu_setup(rec);
+	time_bench_noise_init_rec(rec);
+	time_bench_freq_init_rec(rec);
 
 	/*** Loop function being timed ***/
-	if (!func(&rec, data)) {
+	if (!time_bench_invoke(func, rec, data)) {
 		pr_err("ABORT: function being timed failed\n");
+		time_bench_pmu_teardown(rec);
 		return false;
 	}
+	time_bench_pmu_teardown(rec);
 
-	if (rec.invoked_cnt < loops)
-		pr_warn("WARNING: Invoke count(%llu) smaller than loops(%d)\n",
-			rec.invoked_cnt, loops);
+	if (rec->invoked_cnt < loops)
+		pr_warn("WARNING: Invoke count(%llu) smaller than loops(%llu)\n",
+			rec->invoked_cnt, loops);
 
 	/* Calculate stats */
-	time_bench_calc_stats(&rec);
+	return time_bench_calc_stats(rec);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
 
+	return (x > y) - (x < y);
+}
+
+/* Stats across repetitions, based on per call cost in picosec */
+static void time_bench_repeat_stats(const char *txt, uint64_t *ps, int n)
+{
+	uint64_t sum = 0, mean, var = 0, stddev, median;
+	uint32_t cv = 0; /* coefficient of variation, in permille */
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum += ps[i];
+	mean = div_u64(sum, n);
+	for (i = 0; i < n; i++) {
+		int64_t d = ps[i] - mean;
+
+		var += d * d;
+	}
+	stddev = int_sqrt64(div_u64(var, n));
+	if (mean)
+		cv = div64_u64(stddev * 1000, mean);
+
+	sort(ps, n, sizeof(*ps), cmp_u64, NULL);
+	median = ps[n / 2];
+
+	pr_info("Type:%s repeat:%d ns per elem min:%llu.%03llu"
+		" median:%llu.%03llu stddev:%llu.%03llu (cv:%u.%u%%)\n",
+		txt, n, ps[0] / 1000, ps[0] % 1000,
+		median / 1000, median % 1000, stddev / 1000, stddev % 1000,
+		cv / 10, cv % 10);
+	if (cv > cv_warn)
+		pr_warn("WARNING: Type:%s too noisy, cv:%u.%u%% > %u.%u%%\n",
+			txt, cv / 10, cv % 10, cv_warn / 10, cv_warn % 10);
+}
+
+/* Generic function for invoking a loop function and calculating
+ * execution time stats.  The function being called/timed is assumed
+ * to perform a tight loop, and update the timing record struct.
+ *
+ * The function is first invoked @warmup times (results discarded),
+ * and then @repeat times.  When repeating, the min/median/stddev of
+ * the per call cost is reported, and a warning is given when the
+ * coefficient of variation is above the "cv_warn" threshold.
+ * @repeat is capped at TIME_BENCH_REPEAT_MAX, as this can be called
+ * from softirq context (no sleeping allocation).
+ */
+bool time_bench_loop_repeat(uint64_t loops, int step, char *txt, void *data,
+			    int (*func)(struct time_bench_record *record,
+					void *data),
+			    int warmup, int repeat)
+{
+	struct time_bench_record rec;
+	uint64_t ps[TIME_BENCH_REPEAT_MAX];
+	uint32_t min_mhz = U32_MAX, max_mhz = 0;
+	int i;
+
+	for (i = 0; i < warmup; i++) {
+		if (!time_bench_loop_once(&rec, loops, step, data, func))
+			return false;
+	}
+
+	if (repeat < 1)
+		repeat = 1;
+	if (repeat > TIME_BENCH_REPEAT_MAX) {
+		pr_warn("Type:%s repeat:%d capped to %d\n",
+			txt, repeat, TIME_BENCH_REPEAT_MAX);
+		repeat = TIME_BENCH_REPEAT_MAX;
+	}
+
+	for (i = 0; i < repeat; i++) {
+		int retry = 0;
+	again:
+		if (!time_bench_loop_once(&rec, loops, step, data, func))
+			return false;
+		if (noise == 2 && time_bench_noise_detected(&rec)) {
+			if (retry++ < noise_retries) {
+				time_bench_noise_print(txt, rec.noise_cpu, &rec);
+				pr_info("Type:%s discard disturbed run (retry:%d)\n",
+					txt, retry);
+				goto again;
+			}
+			pr_warn("WARNING: Type:%s still disturbed after %d retries\n",
+				txt, noise_retries);
+		}
+		ps[i] = rec.ns_per_call_quotient * 1000 +
+			rec.ns_per_call_decimal;
+		/* Export each repetition, as samples for comparing runs */
+		time_bench_result_add(txt, raw_smp_processor_id(), &rec);
+		if (rec.freq_mhz) {
+			min_mhz = min(min_mhz, rec.freq_mhz);
+			max_mhz = max(max_mhz, rec.freq_mhz);
+		}
+	}
+
+	/* Report the last repetition */
 	pr_info("Type:%s Per elem: %llu cycles(tsc) %llu.%03llu ns (step:%d)"
 		" - (measurement period time:%llu.%09u sec time_interval:%llu)"
 		" - (invoke count:%llu tsc_interval:%llu)\n",
@@ -256,16 +1128,263 @@ bool time_bench_loop(uint32_t loops, int step, char *txt, void *data,
 		rec.time_interval, rec.invoked_cnt,
 		rec.ns_per_call_quotient, rec.ns_per_call_decimal);
 */
-	if (rec.flags & TIME_BENCH_PMU) {
+	if ((rec.flags & TIME_BENCH_PMU) || rec.pmc_clk) {
 		pr_info("Type:%s PMU inst/clock"
 			"%llu/%llu = %llu.%03llu IPC (inst per cycle)\n",
 			txt, rec.pmc_inst, rec.pmc_clk,
 			rec.pmc_ipc_quotient, rec.pmc_ipc_decimal);
 	}
+	time_bench_throughput_print("", txt, rec.ops_per_sec, rec.bytes_per_sec);
+	time_bench_pmu_print(txt, raw_smp_processor_id(), &rec);
+	time_bench_hist_print(txt, raw_smp_processor_id(), &rec);
+	time_bench_noise_print(txt, rec.noise_cpu, &rec);
+	time_bench_freq_print(txt, raw_smp_processor_id(), &rec);
+
+	if (repeat > 1) {
+		time_bench_repeat_stats(txt, ps, repeat);
+		time_bench_freq_range_check(txt, "repetitions",
+					    min_mhz, max_mhz);
+	}
 	return true;
 }
+EXPORT_SYMBOL_GPL(time_bench_loop_repeat);
+
+bool time_bench_loop(uint64_t loops, int step, char *txt, void *data,
+		     int (*func)(struct time_bench_record *record, void *data)
+	)
+{
+	return time_bench_loop_repeat(loops, step, txt, data, func,
+				      warmup, repeat);
+}
 EXPORT_SYMBOL_GPL(time_bench_loop);
 
+/** Registry of runtime triggerable benchmarks **
+ *
+ * See linux/time_bench.h.  The registry mutex is held while a bench
+ * runs, thus time_bench_unregister() waits for running benches to
+ * finish, and only one bench runs at a time.
+ */
+static LIST_HEAD(bench_registry);
+static DEFINE_MUTEX(bench_registry_lock);
+
+static int time_bench_entry_fullname(struct time_bench_entry *b,
+				     char *buf, size_t len)
+{
+	return snprintf(buf, len, "%s/%s",
+			b->owner ? module_name(b->owner) : "kernel", b->name);
+}
+
+static struct time_bench_entry *time_bench_entry_find(const char *fullname)
+{
+	struct time_bench_entry *b;
+	char name[TIME_BENCH_NAME_LEN];
+
+	list_for_each_entry(b, &bench_registry, list) {
+		time_bench_entry_fullname(b, name, sizeof(name));
+		if (!strcmp(name, fullname))
+			return b;
+	}
+	return NULL;
+}
+
+int __time_bench_register(struct time_bench_entry *benches, int nr,
+			  struct module *owner)
+{
+	char name[TIME_BENCH_NAME_LEN];
+	int i, err = 0;
+
+	mutex_lock(&bench_registry_lock);
+	for (i = 0; i < nr; i++) {
+		struct time_bench_entry *b = &benches[i];
+
+		b->owner = owner;
+		b->cpu   = -1;
+		b->runs  = 0;
+		time_bench_entry_fullname(b, name, sizeof(name));
+		if (!b->func || time_bench_entry_find(name)) {
+			err = -EEXIST;
+			break;
+		}
+		list_add_tail(&b->list, &bench_registry);
+	}
+	/* All or nothing */
+	while (err && i--)
+		list_del_init(&benches[i].list);
+	mutex_unlock(&bench_registry_lock);
+	return err;
+}
+EXPORT_SYMBOL_GPL(__time_bench_register);
+
+void time_bench_unregister(struct time_bench_entry *benches, int nr)
+{
+	int i;
+
+	mutex_lock(&bench_registry_lock);
+	for (i = 0; i < nr; i++) {
+		/* Safe for never or failed registered entries */
+		if (benches[i].list.next && !list_empty(&benches[i].list))
+			list_del_init(&benches[i].list);
+	}
+	mutex_unlock(&bench_registry_lock);
+}
+EXPORT_SYMBOL_GPL(time_bench_unregister);
+
+struct time_bench_control_run {
+	struct time_bench_entry *b;
+	char name[TIME_BENCH_NAME_LEN];
+	uint64_t loops;
+	int step;
+	int repeat;
+};
+
+static long time_bench_control_run_func(void *arg)
+{
+	struct time_bench_control_run *r = arg;
+
+	if (!time_bench_loop_repeat(r->loops, r->step, r->name, r->b->data,
+				    r->b->func, warmup, r->repeat))
+		return -EIO;
+	return 0;
+}
+
+static int time_bench_control_show(struct seq_file *m, void *v)
+{
+	struct time_bench_entry *b;
+	char name[TIME_BENCH_NAME_LEN];
+
+	seq_puts(m, "# name loops step cpu runs\n");
+	mutex_lock(&bench_registry_lock);
+	list_for_each_entry(b, &bench_registry, list) {
+		time_bench_entry_fullname(b, name, sizeof(name));
+		seq_printf(m, "%s %llu %d %d %llu\n",
+			   name, b->loops, b->step, b->cpu, b->runs);
+	}
+	mutex_unlock(&bench_registry_lock);
+	return 0;
+}
+
+static int time_bench_control_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, time_bench_control_show, NULL);
+}
+
+static ssize_t time_bench_control_write(struct file *file,
+					const char __user *ubuf,
+					size_t count, loff_t *ppos)
+{
+	struct time_bench_control_run run = { .repeat = repeat };
+	char buf[128], *cur, *cmd, *name, *tok;
+	struct time_bench_entry *b;
+	int cpu, err = 0;
+	bool do_run;
+	long val;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	cur = strim(buf);
+
+	cmd  = strsep(&cur, " \t");
+	name = strsep(&cur, " \t");
+	if (!cmd || !name)
+		return -EINVAL;
+	if (!strcmp(cmd, "run"))
+		do_run = true;
+	else if (!strcmp(cmd, "set"))
+		do_run = false;
+	else
+		return -EINVAL;
+
+	mutex_lock(&bench_registry_lock);
+	b = time_bench_entry_find(name);
+	if (!b) {
+		err = -ENOENT;
+		goto out;
+	}
+	run.b     = b;
+	run.loops = b->loops;
+	run.step  = b->step;
+	cpu       = b->cpu;
+
+	while ((tok = strsep(&cur, " \t"))) {
+		char *eq = strchr(tok, '=');
+
+		if (!*tok)
+			continue;
+		if (!eq || kstrtol(eq + 1, 0, &val)) {
+			err = -EINVAL;
+			goto out;
+		}
+		*eq = '\0';
+		if (!strcmp(tok, "loops") && val > 0)
+			run.loops = val;
+		else if (!strcmp(tok, "step"))
+			run.step = val;
+		else if (!strcmp(tok, "cpu") && val >= -1 && val < nr_cpu_ids)
+			cpu = val;
+		else if (!strcmp(tok, "repeat") && do_run && val > 0)
+			run.repeat = val;
+		else {
+			err = -EINVAL;
+			goto out;
+		}
+	}
+	if (cpu >= 0 && !cpu_online(cpu)) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	if (!do_run) {
+		b->loops = run.loops;
+		b->step  = run.step;
+		b->cpu   = cpu;
+		goto out;
+	}
+
+	/* Bench runs in this (sleepable) context or a kworker on cpu */
+	strscpy(run.name, name, sizeof(run.name));
+	if (cpu >= 0)
+		err = work_on_cpu(cpu, time_bench_control_run_func, &run);
+	else
+		err = time_bench_control_run_func(&run);
+	b->runs++;
+out:
+	mutex_unlock(&bench_registry_lock);
+	return err ? err : count;
+}
+
+static const struct file_operations time_bench_control_fops = {
+	.owner   = THIS_MODULE,
+	.open    = time_bench_control_open,
+	.read    = seq_read,
+	.write   = time_bench_control_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+/* Spin-barrier: the last CPU to arrive releases all the others.
+ *
+ * The spinning CPUs call cond_resched(), as the CPU that launches the
+ * kthreads might need to run on one of the benchmark CPUs.  This only
+ * yields when something else needs the CPU, which is not expected at
+ * the moment of release.
+ */
+static void time_bench_spin_barrier(struct time_bench_sync *sync)
+{
+	unsigned int gen = READ_ONCE(sync->start_gen);
+
+	if (atomic_inc_return(&sync->nr_arrived) == sync->nr_cpus) {
+		smp_store_release(&sync->start_gen, gen + 1);
+		return;
+	}
+	while (smp_load_acquire(&sync->start_gen) == gen) {
+		cpu_relax();
+		cond_resched();
+	}
+}
+
 /* Function getting invoked by kthread */
 static int invoke_test_on_cpu_func(void *private)
 {
@@ -278,12 +1397,20 @@ static int invoke_test_on_cpu_func(void *private)
 	cpumask_set_cpu(cpu->rec.cpu, &newmask);
 	set_cpus_allowed_ptr(current, &newmask);
 
+	/* PMU counters follow this task */
+	time_bench_pmu_setup(&cpu->rec);
+
 	/* Synchronize start of concurrency test */
 	atomic_inc(&sync->nr_tests_running);
-	wait_for_completion(&sync->start_event);
+	if (sync->spin_release) {
+		time_bench_spin_barrier(sync);
+	} else {
+		atomic_inc(&sync->nr_arrived);
+		wait_for_completion(&sync->start_event);
+	}
 
 	/* Start benchmark function */
-	if (!cpu->bench_func(&cpu->rec, data)) {
+	if (!time_bench_invoke(cpu->bench_func, &cpu->rec, data)) {
 		pr_err("ERROR: function being timed failed on CPU:%d(%d)\n",
 		       cpu->rec.cpu, smp_processor_id());
 	} else {
@@ -291,6 +1418,7 @@ static int invoke_test_on_cpu_func(void *private)
 			pr_info("SUCCESS: ran on CPU:%d(%d)\n",
 				cpu->rec.cpu, smp_processor_id());
 	}
+	time_bench_pmu_teardown(&cpu->rec);
 	cpu->did_bench_run = true;
 
 	/* End test */
@@ -311,10 +1439,18 @@ void time_bench_print_stats_cpumask(const char *desc,
 	uint64_t average = 0;
 	int cpu;
 	int step = 0;
+	struct time_bench_record sum_rec;
 	struct sum {
 		uint64_t tsc_cycles;
+		uint64_t invoked_cnt;
+		uint64_t ops_per_sec; /* Aggregate over all CPUs */
+		uint64_t bytes_per_sec;
 		int records;
 	} sum = {0};
+	/* Start/stop skew across CPUs, in nanosec wall-clock */
+	uint64_t first_start = U64_MAX, last_start = 0;
+	uint64_t first_stop  = U64_MAX, last_stop  = 0;
+	uint32_t min_mhz = U32_MAX, max_mhz = 0;
 
 	/* Get stats */
 	for_each_cpu(cpu, mask) {
@@ -332,23 +1468,177 @@ void time_bench_print_stats_cpumask(const char *desc,
 		rec->ns_per_call_quotient, rec->ns_per_call_decimal, rec->step,
 		rec->time_sec, rec->time_sec_remainder, rec->time_interval,
 		rec->invoked_cnt, rec->tsc_interval);
+		time_bench_hist_print(desc, cpu, rec);
+		time_bench_pmu_print(desc, cpu, rec);
+		time_bench_noise_print(desc, cpu, rec);
+		time_bench_freq_print(desc, cpu, rec);
+		time_bench_result_add(desc, cpu, rec);
+		if (rec->freq_mhz) {
+			min_mhz = min(min_mhz, rec->freq_mhz);
+			max_mhz = max(max_mhz, rec->freq_mhz);
+		}
 
 		/* Collect average */
 		sum.records++;
 		sum.tsc_cycles += rec->tsc_cycles;
+		sum.invoked_cnt += rec->invoked_cnt;
+		sum.ops_per_sec += rec->ops_per_sec;
+		sum.bytes_per_sec += rec->bytes_per_sec;
 		step = rec->step;
+
+		first_start = min(first_start, rec->time_start);
+		last_start  = max(last_start,  rec->time_start);
+		first_stop  = min(first_stop,  rec->time_stop);
+		last_stop   = max(last_stop,   rec->time_stop);
 	}
 
 	if (sum.records) /* avoid div-by-zero */
 		average = sum.tsc_cycles / sum.records;
 	pr_info("Sum Type:%s Average: %llu cycles(tsc) CPUs:%d step:%d\n",
 		desc, average, sum.records, step);
+	time_bench_throughput_print("Sum ", desc, sum.ops_per_sec,
+				    sum.bytes_per_sec);
+	if (sum.records > 1)
+		pr_info("Sum Type:%s skew start:%llu ns stop:%llu ns"
+			" (all CPUs overlap:%lld ns)\n",
+			desc, last_start - first_start, last_stop - first_stop,
+			(int64_t)(first_stop - last_start));
+	time_bench_freq_range_check(desc, "CPUs", min_mhz, max_mhz);
 
+	/* Summary record (cpu=-1), average cycles over all CPUs */
+	memset(&sum_rec, 0, sizeof(sum_rec));
+	sum_rec.step        = step;
+	sum_rec.tsc_cycles  = average;
+	sum_rec.invoked_cnt = sum.invoked_cnt;
+	sum_rec.ops_per_sec   = sum.ops_per_sec;
+	sum_rec.bytes_per_sec = sum.bytes_per_sec;
+	time_bench_result_add(desc, -1, &sum_rec);
 }
 EXPORT_SYMBOL_GPL(time_bench_print_stats_cpumask);
 
+/** CPU topology selection for parallel benchmarks **
+ */
+void time_bench_print_topology(const char *desc, const struct cpumask *mask)
+{
+	int cpu;
+
+	pr_info("Topology:%s CPUs:%*pbl (nodes online:%d)\n",
+		desc, cpumask_pr_args(mask), num_online_nodes());
+	if (!verbose)
+		return;
+	for_each_cpu(cpu, mask) {
+		pr_info(" CPU(%d) node:%d package:%d core:%d SMT-siblings:%*pbl\n",
+			cpu, cpu_to_node(cpu),
+			topology_physical_package_id(cpu),
+			topology_core_id(cpu),
+			cpumask_pr_args(topology_sibling_cpumask(cpu)));
+	}
+}
+EXPORT_SYMBOL_GPL(time_bench_print_topology);
+
+/* Pick next online CPU on @node not already in @mask */
+static int time_bench_next_cpu_on_node(int node, const struct cpumask *mask)
+{
+	int cpu;
+
+	for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+		if (!cpumask_test_cpu(cpu, mask))
+			return cpu;
+	}
+	return -1;
+}
+
+int time_bench_cpumask_select(struct cpumask *mask, const char *topology,
+			      int nr_cpus)
+{
+	int cpu, node, cnt = 0;
+	bool progress = true;
+
+	if (nr_cpus <= 0)
+		nr_cpus = num_online_cpus();
+
+	cpumask_clear(mask);
+
+	if (!topology || !*topology || !strcmp(topology, "first")) {
+		topology = "first";
+		for_each_online_cpu(cpu) {
+			if (cnt++ >= nr_cpus)
+				break;
+			cpumask_set_cpu(cpu, mask);
+		}
+	} else if (!strcmp(topology, "core")) {
+		for_each_online_cpu(cpu) {
+			/* Only first SMT thread of each core */
+			if (cpumask_first(topology_sibling_cpumask(cpu)) != cpu)
+				continue;
+			if (cnt++ >= nr_cpus)
+				break;
+			cpumask_set_cpu(cpu, mask);
+		}
+	} else if (!strcmp(topology, "smt")) {
+		/* Fill whole cores, thus consecutive CPUs are SMT siblings */
+		for_each_online_cpu(cpu) {
+			const struct cpumask *sib = topology_sibling_cpumask(cpu);
+			int sibling;
+
+			if (cpumask_first(sib) != cpu)
+				continue;
+			for_each_cpu_and(sibling, sib, cpu_online_mask) {
+				if (cnt >= nr_cpus)
+					break;
+				cpumask_set_cpu(sibling, mask);
+				cnt++;
+			}
+			if (cnt >= nr_cpus)
+				break;
+		}
+		if (cnt > 1 && cpumask_weight(topology_sibling_cpumask(
+				     cpumask_first(mask))) < 2)
+			pr_warn("Topology:smt but CPUs have no SMT siblings\n");
+	} else if (!strcmp(topology, "node")) {
+		node = cpu_to_node(cpumask_first(cpu_online_mask));
+		for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+			if (cnt++ >= nr_cpus)
+				break;
+			cpumask_set_cpu(cpu, mask);
+		}
+		if (cnt < nr_cpus)
+			pr_warn("Topology:node only %d CPUs on node %d\n",
+				cnt, node);
+	} else if (!strcmp(topology, "cross")) {
+		if (num_online_nodes() < 2)
+			pr_warn("Topology:cross but only one NUMA node\n");
+		while (cnt < nr_cpus && progress) {
+			progress = false;
+			for_each_online_node(node) {
+				cpu = time_bench_next_cpu_on_node(node, mask);
+				if (cpu < 0)
+					continue;
+				cpumask_set_cpu(cpu, mask);
+				progress = true;
+				if (++cnt >= nr_cpus)
+					break;
+			}
+		}
+	} else {
+		if (cpulist_parse(topology, mask)) {
+			pr_err("Topology: invalid cpulist \"%s\"\n", topology);
+			return -EINVAL;
+		}
+		cpumask_and(mask, mask, cpu_online_mask);
+	}
+
+	if (cpumask_empty(mask)) {
+		pr_err("Topology:%s no CPUs selected\n", topology);
+		return -ENODEV;
+	}
+	time_bench_print_topology(topology, mask);
+	return cpumask_weight(mask);
+}
+EXPORT_SYMBOL_GPL(time_bench_cpumask_select);
+
 void time_bench_run_concurrent(
-		uint32_t loops, int step, void *data,
+		uint64_t loops, int step, void *data,
 		const struct cpumask *mask, /* Support masking outsome CPUs*/
 		struct time_bench_sync *sync,
 		struct time_bench_cpu *cpu_tasks,
@@ -364,6 +1654,10 @@ void time_bench_run_concurrent(
 	/* Reset sync conditions */
 	atomic_set(&sync->nr_tests_running, 0);
 	init_completion(&sync->start_event);
+	sync->spin_release = spin_start;
+	sync->nr_cpus      = cpumask_weight(mask);
+	sync->start_gen    = 0;
+	atomic_set(&sync->nr_arrived, 0);
 
 	/* Spawn off jobs on all CPUs */
 	for_each_cpu(cpu, mask) {
@@ -381,6 +1675,11 @@ void time_bench_run_concurrent(
 		c->rec.flags       = (TIME_BENCH_LOOP|TIME_BENCH_TSC|
 				      TIME_BENCH_WALLCLOCK);
 		c->rec.cpu = cpu;
+		c->rec.cpu_idx = running - 1;
+		time_bench_hist_setup(&c->rec, cpu);
+		time_bench_pmu_init_rec(&c->rec);
+		time_bench_noise_init_rec(&c->rec);
+		time_bench_freq_init_rec(&c->rec);
 		c->bench_func = func;
 		c->task = kthread_run(invoke_test_on_cpu_func, c,
 				      "time_bench%d", cpu);
@@ -390,13 +1689,19 @@ void time_bench_run_concurrent(
 		}
 	}
 
-	/* Wait until all processes are running */
-	while (atomic_read(&sync->nr_tests_running) < running) {
+	/* Wait until all processes are running.  Not via
+	 * nr_tests_running, in spin mode a short bench can already
+	 * have finished and decremented it before we look.
+	 */
+	while (atomic_read(&sync->nr_arrived) < running) {
 		set_current_state(TASK_UNINTERRUPTIBLE);
 		schedule_timeout(10);
 	}
-	/* Kick off all CPU concurrently on completion event */
-	complete_all(&sync->start_event);
+	/* Kick off all CPU concurrently on completion event, in spin
+	 * mode the last CPU arriving have already released the others
+	 */
+	if (!sync->spin_release)
+		complete_all(&sync->start_event);
 
 	/* Wait for CPUs to finish */
 	while (atomic_read(&sync->nr_tests_running)) {
@@ -425,12 +1730,25 @@ static int __init time_bench_module_init(void)
 	pr_warn("WARN: CONFIG_DEBUG_PREEMPT is enabled: this affect results\n");
 #endif
 
+	time_bench_clock_select();
+	time_bench_clock_calibrate();
+	pr_info("Clock backend:%s frequency:%u kHz\n",
+		time_bench_clock_name(), clock_khz);
+
+	/* Failing to create debugfs entries is not fatal */
+	time_bench_debugfs_dir = debugfs_create_dir("time_bench", NULL);
+	debugfs_create_file("results", 0600, time_bench_debugfs_dir,
+			    NULL, &time_bench_results_fops);
+	debugfs_create_file("control", 0600, time_bench_debugfs_dir,
+			    NULL, &time_bench_control_fops);
+
 	return 0;
 }
 module_init(time_bench_module_init);
 
 static void __exit time_bench_module_exit(void)
 {
+	debugfs_remove_recursive(time_bench_debugfs_dir);
 	if (verbose)
 		pr_info("Unloaded\n");
 }
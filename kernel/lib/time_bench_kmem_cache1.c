@@ -23,7 +23,7 @@ static int benchmark_kmem_cache_fastpath_reuse(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_elem *elem;
 	struct kmem_cache *slab;
 
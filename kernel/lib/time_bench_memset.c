@@ -31,9 +31,13 @@
 #include <linux/time_bench.h>
 #include <linux/spinlock.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <asm/fpu/api.h>
+#include <asm/cpufeature.h>
+#include <asm/cacheflush.h>
 
 #include <linux/skbuff.h>
+#include <linux/mem_clear.h>
 
 // #include <asm/mmx.h> // mmx_clear_page -> fast_clear_page
 
@@ -63,7 +67,7 @@ static char global_buf[GLOBAL_BUF_SIZE];
 static int time_bench_for_loop(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -81,7 +85,7 @@ static int time_memset_32(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 32
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -102,7 +106,7 @@ static int time_memset_64(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 64
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -122,7 +126,7 @@ static int time_memset_128(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 128
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -141,7 +145,7 @@ static int time_memset_128(
 static int time_memset_skb_tail(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	preempt_disable();
@@ -165,7 +169,7 @@ static int time_memset_skb_tail_roundup(
 {
 #define CONST_CLEAR_SIZE roundup(offsetof(struct sk_buff, tail), SMP_CACHE_BYTES)
 
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	preempt_disable();
@@ -189,7 +193,7 @@ static int time_memset_199(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 199
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -211,7 +215,7 @@ static int time_memset_192(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 192
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -233,7 +237,7 @@ static int time_memset_201(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 201
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -254,7 +258,7 @@ static int time_memset_204(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 204
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -278,7 +282,7 @@ static int time_memset_200(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 200
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -299,7 +303,7 @@ static int time_memset_208(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 208
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -320,7 +324,7 @@ static int time_memset_256(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 256
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -340,7 +344,7 @@ static int time_memset_512(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 512
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -360,7 +364,7 @@ static int time_memset_768(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 768
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -380,7 +384,7 @@ static int time_memset_1024(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 1024
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -400,7 +404,7 @@ static int time_memset_2048(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 2048
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -421,7 +425,7 @@ static int time_memset_4096(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 4096
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -441,7 +445,7 @@ static int time_memset_8192(
 	struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 8192
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -468,7 +472,7 @@ noinline static void callmemset(void *buf, int size)
 static int time_memset_variable_step(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	int size = rec->step;
 
@@ -476,6 +480,8 @@ static int time_memset_variable_step(
 		return 0;
 
 	printk(KERN_INFO "TEST: size:%d\n", size);
+	/* Step is memset size, report bandwidth */
+	rec->flags |= TIME_BENCH_STEP_BYTES;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
@@ -534,7 +540,8 @@ void mem_zero_crazy_loop_unroll2(void *ptr, const unsigned int qword)
 static int time_mem_zero_hacks(
 	struct time_bench_record *rec, void *data)
 {
-	int i, bytes_rounded_up;
+	uint64_t i;
+	int bytes_rounded_up;
 	uint64_t loops_cnt = 0;
 	int size = rec->step;
 	size = DIV_ROUND_UP(size, 8); // convert to qwords
@@ -545,6 +552,7 @@ static int time_mem_zero_hacks(
 
 	printk(KERN_INFO "Rounded %d up to size:%d\n",
 	       rec->step, bytes_rounded_up);
+	rec->flags |= TIME_BENCH_STEP_BYTES;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
@@ -610,7 +618,7 @@ static void fast_clear_mmx_256(void *page)
 static int time_memset_mmx_256(struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 256
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -633,7 +641,8 @@ static int time_memset_mmx_256(struct time_bench_record *rec, void *data)
 static int time_memset_avx2_256(struct time_bench_record *rec, void *data)
 {
 #define CONST_CLEAR_SIZE 256
-	int i, j;
+	uint64_t i;
+	int j;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -697,7 +706,7 @@ static void fast_clear_movq_256(void *page)
 
 static int time_memset_movq_192(struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -715,7 +724,7 @@ static int time_memset_movq_192(struct time_bench_record *rec, void *data)
 
 static int time_memset_movq_256(struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -761,7 +770,7 @@ inline static void alternative_clear_movq_256(void *page)
 
 static int time_alternative_movq_256(struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -817,7 +826,7 @@ static void fast_clear_page(void *page)
 
 static int time_fast_clear_page(struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	if (!irq_fpu_usable())
@@ -837,6 +846,174 @@ static int time_fast_clear_page(struct time_bench_record *rec, void *data)
 	return loops_cnt;
 }
 
+/* Clearing variants from mem_clear.h, step is clear size in bytes */
+enum clear_variant {
+	CLEAR_MEMSET = 0,
+	CLEAR_ERMS,
+	CLEAR_MOVNTI,
+	CLEAR_AVX_NT,
+	CLEAR_DISPATCH, /* mem_clear() */
+	COPY_MEMCPY,	/* memcpy from a hot source, into the target */
+	MODE_BASELINE,	/* No op, only the cache mode overhead */
+	NR_VARIANTS
+};
+
+/* Cache state of the target buffer, before each op.  The data loops at
+ * global_buf are L1 resident (hot), which make non-temporal stores look
+ * bad, while real zeroing targets (e.g. skb tails) are cold.
+ *  hot:     same global_buf each op
+ *  cold:    rotate through pool, bigger than LLC (pool_mb)
+ *  clflush: global_buf, flushed out of all caches before each op
+ *  consume: as cold, plus the cost of reading the result afterwards
+ * Compare against MODE_BASELINE of same mode, which include the
+ * flush/read costs but no clearing.
+ */
+enum cache_mode {
+	CACHE_HOT = 0,
+	CACHE_COLD,
+	CACHE_CLFLUSH,
+	CACHE_CONSUME,
+	NR_CACHE_MODES
+};
+static const char *cache_mode_names[NR_CACHE_MODES] = {
+	"hot", "cold", "clflush", "consume"
+};
+
+static unsigned int cache_modes = (1 << NR_CACHE_MODES) - 1;
+module_param(cache_modes, uint, 0444);
+MODULE_PARM_DESC(cache_modes, "Bitmask of cache modes 0=hot 1=cold 2=clflush 3=consume");
+
+static unsigned int pool_mb = 64;
+module_param(pool_mb, uint, 0444);
+MODULE_PARM_DESC(pool_mb, "Buffer pool for cold modes, must exceed LLC size");
+
+static char *cold_pool;
+static size_t cold_pool_size;
+static char copy_src[GLOBAL_BUF_SIZE];
+
+#define CLEAR_DATA(mode, variant) ((void *)(unsigned long)((mode) << 8 | (variant)))
+
+static int time_clear_variant_step(
+	struct time_bench_record *rec, void *data)
+{
+	enum clear_variant variant = (unsigned long)data & 0xFF;
+	enum cache_mode mode = (unsigned long)data >> 8;
+	int size = rec->step;
+	uint64_t loops_cnt = 0;
+	u64 sum = 0;
+	size_t off = 0;
+	char *buf;
+	uint64_t i;
+	int j;
+
+	if (size > GLOBAL_BUF_SIZE)
+		return 0;
+	if (variant == CLEAR_ERMS && !boot_cpu_has(X86_FEATURE_ERMS))
+		return 0;
+	/* __mem_clear_avx_nt() uses only AVX (vxorps+vmovntdq), no AVX2 */
+	if (variant == CLEAR_AVX_NT && !boot_cpu_has(X86_FEATURE_AVX))
+		return 0;
+#ifndef BENCH_MEM_CLEAR
+	if (variant == CLEAR_AVX_NT || variant == CLEAR_DISPATCH)
+		return 0; /* Needs lib/mem_clear.ko (CONFIG_MEM_CLEAR) */
+#endif
+	if ((mode == CACHE_COLD || mode == CACHE_CONSUME) && !cold_pool)
+		return 0;
+	rec->flags |= TIME_BENCH_STEP_BYTES;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		loops_cnt++;
+		buf = global_buf;
+		if (mode == CACHE_COLD || mode == CACHE_CONSUME) {
+			/* Cache line aligned steps through the pool */
+			buf = cold_pool + off;
+			off += ALIGN(size, SMP_CACHE_BYTES);
+			if (off + size > cold_pool_size)
+				off = 0;
+		} else if (mode == CACHE_CLFLUSH) {
+			clflush_cache_range(buf, size);
+		}
+		barrier();
+		switch (variant) {
+		case CLEAR_ERMS:
+			__mem_clear_erms(buf, size);
+			break;
+		case CLEAR_MOVNTI:
+			__mem_clear_movnti(buf, size);
+			break;
+#ifdef BENCH_MEM_CLEAR
+		case CLEAR_AVX_NT:
+			__mem_clear_avx_nt(buf, size);
+			break;
+		case CLEAR_DISPATCH:
+			mem_clear(buf, size);
+			break;
+#endif
+		case COPY_MEMCPY:
+			memcpy(buf, copy_src, size);
+			break;
+		case MODE_BASELINE:
+			break;
+		default:
+			memset(buf, 0, size);
+		}
+		barrier();
+		if (mode == CACHE_CONSUME) {
+			/* Consumer reads each cache line of the result */
+			for (j = 0; j < size; j += SMP_CACHE_BYTES)
+				sum += READ_ONCE(*(u64 *)(buf + j));
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+	/* Use sum, pool lines not cleared yet still hold 0xAA */
+	pr_debug("consume sum:%llu\n", sum);
+	return loops_cnt;
+}
+
+/* Same size matrix as the fixed size tests in run_timing_tests(), for
+ * each cache mode enabled in cache_modes.
+ */
+static void run_clear_variants(uint32_t loops)
+{
+	static const int sizes[] = { 32, 64, 128, 192, 200, 208, 256, 512,
+				     768, 1024, 2048, 4096, 8192 };
+	static const char *names[NR_VARIANTS] = {
+		[CLEAR_MEMSET]	 = "clear_memset",
+		[CLEAR_ERMS]	 = "clear_erms_stosb",
+		[CLEAR_MOVNTI]	 = "clear_movnti",
+		[CLEAR_AVX_NT]	 = "clear_avx_nt",
+		[CLEAR_DISPATCH] = "clear_mem_clear",
+		[COPY_MEMCPY]	 = "copy_memcpy",
+		[MODE_BASELINE]	 = "mode_baseline",
+	};
+	char txt[64];
+	uint32_t n;
+	int i, m, v;
+
+	for (m = 0; m < NR_CACHE_MODES; m++) {
+		if (!(cache_modes & (1 << m)))
+			continue;
+		for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+			/* Scale loops down for bigger sizes, like the fixed
+			 * tests, and for the slower cold modes.
+			 */
+			n = sizes[i] >= 4096 ? loops / 100 :
+			    sizes[i] >= 1024 ? loops / 10 : loops;
+			if (m != CACHE_HOT)
+				n /= 10;
+			for (v = 0; v < NR_VARIANTS; v++) {
+				snprintf(txt, sizeof(txt), "%s_%s", names[v],
+					 cache_mode_names[m]);
+				time_bench_loop(n, sizes[i], txt,
+						CLEAR_DATA(m, v),
+						time_clear_variant_step);
+			}
+		}
+	}
+}
+
 int run_timing_tests(void)
 {
 	uint32_t loops = 10000000;
@@ -967,6 +1144,8 @@ int run_timing_tests(void)
 	time_bench_loop(loops/200, 8192, "memset_variable_step",
 			NULL,   time_memset_variable_step);
 
+	run_clear_variants(loops);
+
 	return 0;
 }
 
@@ -975,9 +1154,22 @@ static int __init time_bench_sample_module_init(void)
 	if (verbose)
 		pr_info("Loaded: fpu_usable %d\n", irq_fpu_usable());
 
+	if (cache_modes & (1 << CACHE_COLD | 1 << CACHE_CONSUME)) {
+		cold_pool_size = (size_t)pool_mb << 20;
+		cold_pool = vmalloc(cold_pool_size);
+		if (cold_pool)
+			memset(cold_pool, 0xAA, cold_pool_size); /* Fault-in */
+		else
+			pr_warn("Cannot alloc %u MB pool, skip cold modes\n",
+				pool_mb);
+	}
+
 	if (run_timing_tests() < 0) {
+		vfree(cold_pool);
 		return -ECANCELED;
 	}
+	vfree(cold_pool);
+	cold_pool = NULL;
 
 	return 0;
 }
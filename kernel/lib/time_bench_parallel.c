@@ -18,6 +18,10 @@ static int parallel_cpus = 0;
 module_param(parallel_cpus, uint, 0);
 MODULE_PARM_DESC(parallel_cpus, "Number of parallel CPUs (default ALL)");
 
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
 /* Quick and dirty way to unselect some of the benchmark tests, by
  * encoding this in a module parameter flag.  This is useful when
  * wanting to perf benchmark a specific benchmark test.
@@ -49,7 +53,7 @@ static atomic_t global_atomic;
 static int time_lock_unlock_local(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	spinlock_t local_lock;
 	spin_lock_init(&local_lock);
@@ -69,7 +73,7 @@ static int time_lock_unlock_local(
 static int time_lock_unlock_global(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -88,7 +92,7 @@ static int time_lock_unlock_global(
 static int time_atomic_inc_dec_local(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	atomic_t atomic;
 
@@ -108,7 +112,7 @@ static atomic_t global_atomic;
 static int time_atomic_inc_dec_global(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -126,7 +130,7 @@ static int time_atomic_inc_dec_global(
 static int time_atomic_read_local(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	atomic_t atomic;
 
@@ -144,7 +148,7 @@ static int time_atomic_read_local(
 static int time_atomic_read_global(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -164,10 +168,10 @@ static int time_atomic_read_N_writers_global(
 	uint64_t loops_cnt = 0;
 	bool writer = false;
 	int N = rec->step;
-	int i;
+	uint64_t i;
 
 	/* Select N CPUs to be come writers, atomic updaters */
-	if (smp_processor_id() < N) {
+	if (rec->cpu_idx < N) {
 		writer = true;
 	}
 
@@ -189,7 +193,7 @@ static int time_atomic_read_N_writers_global(
 static int time_local_bh(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -207,7 +211,7 @@ static int time_local_bh(
 static int time_local_irq(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -225,7 +229,7 @@ static int time_local_irq(
 static int time_local_irq_save(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	unsigned long flags;
 
@@ -244,7 +248,7 @@ static int time_local_irq_save(
 static int time_preempt(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -361,20 +365,14 @@ int run_timing_tests(void)
 {
 	uint32_t loops = 1000000;
 	cpumask_t cpumask;
-	int i;
-
-	/* Default run on all (online) CPUs */
-	cpumask_copy(&cpumask, cpu_online_mask);
-
-	/* Reduce CPUs to run on, via module parameter parallel_cpus */
-	if (parallel_cpus != 0) {
-		if (verbose)
-			pr_info("Limit to %d parallel CPUs\n", parallel_cpus);
-		cpumask_clear(&cpumask);
-		for (i = 0; i < parallel_cpus ; i++) {
-			cpumask_set_cpu(i, &cpumask);
-		}
-	}
+
+	/* Default run on all (online) CPUs, reduce CPUs to run on via
+	 * module parameter parallel_cpus, and select via topology
+	 */
+	if (verbose && parallel_cpus)
+		pr_info("Limit to %d parallel CPUs\n", parallel_cpus);
+	if (time_bench_cpumask_select(&cpumask, topology, parallel_cpus) < 0)
+		return -EINVAL;
 
 	/* Selectable test types, see run_flags module parameter */
 	run_bench_bh_preempt(loops, cpumask);
@@ -9,15 +9,31 @@
 #include <linux/time_bench.h>
 #include <linux/spinlock.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/rcupdate.h>
+#include <linux/local_lock.h>
+#include <linux/seqlock.h>
+#include <linux/jump_label.h>
+#include <linux/static_call.h>
+#include <linux/refcount.h>
+#include <linux/atomic.h>
 
 static int verbose=1;
 
+static int parallel_cpus = 2;
+module_param(parallel_cpus, uint, 0);
+MODULE_PARM_DESC(parallel_cpus, "CPUs contending on atomic64 in parallel benches (default 2)");
+
+static char *topologies = "smt:core:cross";
+module_param(topologies, charp, 0);
+MODULE_PARM_DESC(topologies, "Colon separated time_bench topologies for contended atomic64 (default smt:core:cross)");
+
 /* Timing at the nanosec level, we need to know the overhead
  * introduced by the for loop itself */
 static int time_bench_for_loop(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -34,7 +50,7 @@ static DEFINE_SPINLOCK(my_lock);
 static int time_lock_unlock(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -52,7 +68,7 @@ static int time_lock_unlock(
 static int time_lock_unlock_irqsave(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	unsigned long flags;
 	uint64_t loops_cnt = 0;
 
@@ -71,7 +87,7 @@ static int time_lock_unlock_irqsave(
 static int time_lock_unlock_irq(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -93,7 +109,7 @@ static int time_lock_unlock_irq(
 static int time_irqsave_before_lock(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	unsigned long flags;
 	uint64_t loops_cnt = 0;
 
@@ -116,7 +132,7 @@ static int time_irqsave_before_lock(
 static int time_simple_irq_disable_before_lock(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -136,7 +152,7 @@ static int time_simple_irq_disable_before_lock(
 static int time_local_bh(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -154,7 +170,7 @@ static int time_local_bh(
 static int time_local_irq(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -172,7 +188,7 @@ static int time_local_irq(
 static int time_local_irq_save(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 	unsigned long flags;
 
@@ -191,7 +207,7 @@ static int time_local_irq_save(
 static int time_preempt(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -211,7 +227,7 @@ static DEFINE_PER_CPU(struct page *, per_cpu_data);
 static int time_this_cpu_cmpxchg(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	struct page *page=(void*)1, *oldpage=(void*)2;
@@ -232,7 +248,7 @@ static int time_this_cpu_cmpxchg(
 static int time_cmpxchg(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	struct page *p, *page=(void*)1, *oldpage=(void*)2;
@@ -257,7 +273,8 @@ static void noinline measured_function(volatile int *var)
 static int time_func(
 	struct time_bench_record *rec, void *data)
 {
-	int i, tmp;
+	uint64_t i;
+	int tmp;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -280,7 +297,8 @@ static struct func_ptr_ops my_func_ptr __read_mostly = {
 static int time_func_ptr(
 	struct time_bench_record *rec, void *data)
 {
-	int i, tmp;
+	uint64_t i;
+	int tmp;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -293,34 +311,234 @@ static int time_func_ptr(
 	return loops_cnt;
 }
 
+/* Direct call patched at runtime, versus above func_ptr, which is a
+ * retpoline (or other indirect branch mitigation) call when
+ * CONFIG_MITIGATION_RETPOLINE is enabled.
+ */
+DEFINE_STATIC_CALL(sample_static_call, measured_function);
+
+static int time_static_call(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	int tmp;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		static_call(sample_static_call)(&tmp);
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+/* Object get+put, refcount_t saturation checks vs plain atomic_t */
+static refcount_t sample_ref = REFCOUNT_INIT(1);
+static atomic_t sample_atomic = ATOMIC_INIT(1);
+
+static int time_refcount(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		refcount_inc(&sample_ref);
+		if (refcount_dec_and_test(&sample_ref))
+			break;
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+static int time_atomic_ref(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		atomic_inc(&sample_atomic);
+		if (atomic_dec_and_test(&sample_atomic))
+			break;
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+/* Passed via data: uncontended when run on one CPU, contended when
+ * run concurrently via run_parallel()
+ */
+static atomic64_t sample_atomic64 ____cacheline_aligned_in_smp;
+
+static int time_atomic64_inc(
+	struct time_bench_record *rec, void *data)
+{
+	atomic64_t *cnt = data;
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		atomic64_inc(cnt);
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+static int time_rcu_read_lock(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		rcu_read_lock();
+		loops_cnt++;
+		barrier();
+		rcu_read_unlock();
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+struct sample_pcpu {
+	local_lock_t lock;
+};
+static DEFINE_PER_CPU(struct sample_pcpu, sample_pcpu) = {
+	.lock = INIT_LOCAL_LOCK(lock),
+};
+
+/* Maps to preempt_disable on !PREEMPT_RT, a per CPU spinlock on RT */
+static int time_local_lock(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		local_lock(&sample_pcpu.lock);
+		loops_cnt++;
+		barrier();
+		local_unlock(&sample_pcpu.lock);
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+static seqcount_t sample_seqcount = SEQCNT_ZERO(sample_seqcount);
+static int sample_seq_data;
+
+/* Uncontended reader side, no writer running */
+static int time_seqcount_read(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	int val;
+	unsigned int seq;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		do {
+			seq = read_seqcount_begin(&sample_seqcount);
+			val = READ_ONCE(sample_seq_data);
+		} while (read_seqcount_retry(&sample_seqcount, seq));
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return val < 0 ? 0 : loops_cnt;
+}
+
+/* Disabled static key is a NOP in the fast-path, compare against
+ * testing a __read_mostly bool (load+branch).
+ */
+static DEFINE_STATIC_KEY_FALSE(sample_key);
+static bool sample_bool __read_mostly;
+
+static int time_static_branch(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (static_branch_unlikely(&sample_key))
+			loops_cnt += 2;
+		loops_cnt++;
+		barrier();
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+static int time_bool_branch(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t i;
+	uint64_t loops_cnt = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (unlikely(READ_ONCE(sample_bool)))
+			loops_cnt += 2;
+		loops_cnt++;
+		barrier();
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
 static int time_page_alloc(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	struct page *my_page;
 	gfp_t gfp_mask = (GFP_ATOMIC | ___GFP_NORETRY);
 
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_page(gfp_mask);
 		if (unlikely(my_page == NULL))
 			return 0;
 		put_page(my_page);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
 }
 
-int run_timing_tests(void)
-{
-	uint32_t loops = 100000000;
-
-	/* Results listed below for a E5-2695 CPU */
+#define LOOPS 100000000
 
+/* Registered with time_bench, thus also runnable via debugfs file
+ * /sys/kernel/debug/time_bench/control after module load.
+ * Results listed below for a E5-2695 CPU.
+ */
+static struct time_bench_entry sample_benches[] = {
 	/*  0.360 ns cost overhead of the for loop */
-	time_bench_loop(loops*10, 0, "for_loop", /*  0.360 ns */
-			NULL, time_bench_for_loop);
+	{ .name = "for_loop", .loops = LOOPS*10,
+	  .func = time_bench_for_loop },
 
 	/* Cost for spin_lock+spin_unlock
 	 * 13.946 ns with CONFIG_PREEMPT=n PREEMPT_COUNT=n
@@ -328,20 +546,16 @@ int run_timing_tests(void)
 	 * 16.449 ns with CONFIG_PREEMPT=y PREEMPT_COUNT=y
 	 * 22.177 ns with CONFIG_PREEMPT=y PREEMPT_COUNT=y DEBUG_PREEMPT=y
 	 */
-	time_bench_loop(loops, 0, "spin_lock_unlock",
-			NULL, time_lock_unlock);
-
-	time_bench_loop(loops/2, 0, "spin_lock_unlock_irqsave",
-			NULL, time_lock_unlock_irqsave);
-
-	time_bench_loop(loops/2, 0, "irqsave_before_lock",
-			NULL, time_irqsave_before_lock);
-
-	time_bench_loop(loops/2, 0, "spin_lock_unlock_irq",
-			NULL, time_lock_unlock_irq);
-
-	time_bench_loop(loops/2, 0, "simple_irq_disable_before_lock",
-			NULL, time_simple_irq_disable_before_lock);
+	{ .name = "spin_lock_unlock", .loops = LOOPS,
+	  .func = time_lock_unlock },
+	{ .name = "spin_lock_unlock_irqsave", .loops = LOOPS/2,
+	  .func = time_lock_unlock_irqsave },
+	{ .name = "irqsave_before_lock", .loops = LOOPS/2,
+	  .func = time_irqsave_before_lock },
+	{ .name = "spin_lock_unlock_irq", .loops = LOOPS/2,
+	  .func = time_lock_unlock_irq },
+	{ .name = "simple_irq_disable_before_lock", .loops = LOOPS/2,
+	  .func = time_simple_irq_disable_before_lock },
 
 	/* Cost for local_bh_{disable,enable}
 	 *  7.387 ns with CONFIG_PREEMPT=n PREEMPT_COUNT=n
@@ -349,16 +563,16 @@ int run_timing_tests(void)
 	 *  7.462 ns with CONFIG_PREEMPT=y PREEMPT_COUNT=y
 	 * 21.691 ns with CONFIG_PREEMPT=y PREEMPT_COUNT=y DEBUG_PREEMPT=y
 	 */
-	time_bench_loop(loops, 0, "local_BH_disable_enable",
-			NULL, time_local_bh);
+	{ .name = "local_BH_disable_enable", .loops = LOOPS,
+	  .func = time_local_bh },
 
 	/*  2.860 ns cost for local_irq_{disable,enable} */
-	time_bench_loop(loops, 0, "local_IRQ_disable_enable",
-			NULL, time_local_irq);
+	{ .name = "local_IRQ_disable_enable", .loops = LOOPS,
+	  .func = time_local_irq },
 
 	/* 14.840 ns cost for local_irq_save()+local_irq_restore() */
-	time_bench_loop(loops, 0, "local_irq_save_restore",
-			NULL, time_local_irq_save);
+	{ .name = "local_irq_save_restore", .loops = LOOPS,
+	  .func = time_local_irq_save },
 
 	/* Cost for preempt_{disable,enable}:
 	 *   0.360 ns with CONFIG_PREEMPT=n PREEMPT_COUNT=n
@@ -366,26 +580,170 @@ int run_timing_tests(void)
 	 *   4.291 ns with CONFIG_PREEMPT=n PREEMPT_COUNT=y
 	 *  12.294 ns with CONFIG_PREEMPT=y PREEMPT_COUNT=y DEBUG_PREEMPT=y
 	 */
-	time_bench_loop(loops, 0, "preempt_disable_enable",
-			NULL, time_preempt);
+	{ .name = "preempt_disable_enable", .loops = LOOPS,
+	  .func = time_preempt },
 
-	time_bench_loop(loops, 0, "this_cpu_cmpxchg",
-			NULL, time_this_cpu_cmpxchg);
-
-	time_bench_loop(loops/2, 0, "cmpxchg",
-			NULL,   time_cmpxchg);
+	{ .name = "this_cpu_cmpxchg", .loops = LOOPS,
+	  .func = time_this_cpu_cmpxchg },
+	{ .name = "cmpxchg", .loops = LOOPS/2,
+	  .func = time_cmpxchg },
 
 	/*  2.145 ns cost for a local function call */
-	time_bench_loop(loops, 0, "funcion_call_cost",
-			NULL, time_func);
+	{ .name = "funcion_call_cost", .loops = LOOPS,
+	  .func = time_func },
 
 	/*  2.503 ns cost for a function pointer invocation */
-	time_bench_loop(loops, 0, "func_ptr_call_cost",
-			NULL, time_func_ptr);
+	{ .name = "func_ptr_call_cost", .loops = LOOPS,
+	  .func = time_func_ptr },
+	{ .name = "static_call_cost", .loops = LOOPS,
+	  .func = time_static_call },
+
+	/* Primitives to choose between in hot paths */
+	{ .name = "rcu_read_lock_unlock", .loops = LOOPS,
+	  .func = time_rcu_read_lock },
+	{ .name = "local_lock_unlock", .loops = LOOPS,
+	  .func = time_local_lock },
+	{ .name = "seqcount_read", .loops = LOOPS,
+	  .func = time_seqcount_read },
+	{ .name = "static_branch_unlikely", .loops = LOOPS*10,
+	  .func = time_static_branch },
+	{ .name = "read_mostly_bool_branch", .loops = LOOPS*10,
+	  .func = time_bool_branch },
+	{ .name = "refcount_inc_dec_and_test", .loops = LOOPS,
+	  .func = time_refcount },
+	{ .name = "atomic_inc_dec_and_test", .loops = LOOPS,
+	  .func = time_atomic_ref },
+	{ .name = "atomic64_inc", .loops = LOOPS,
+	  .func = time_atomic64_inc, .data = &sample_atomic64 },
 
 	/*  Approx 141.488 ns cost for alloc_page()+put_page() */
-	time_bench_loop(loops/100, 0, "page_alloc_put",
-			NULL, time_page_alloc);
+	{ .name = "page_alloc_put", .loops = LOOPS/100,
+	  .func = time_page_alloc },
+};
+
+/* Collected for the comparison table printed after all runs */
+#define MAX_TOPOLOGIES 8
+static struct sample_result {
+	char name[48];
+	uint64_t cycles; /* tsc */
+	uint64_t ns, ns_dec;
+	uint64_t core_cycles;
+} sample_results[ARRAY_SIZE(sample_benches) + MAX_TOPOLOGIES];
+static int nr_results;
+
+static void sample_result_add(const char *name, uint64_t cycles,
+			      uint64_t ns, uint64_t ns_dec,
+			      uint64_t core_cycles)
+{
+	struct sample_result *r;
+
+	if (nr_results >= ARRAY_SIZE(sample_results))
+		return;
+	r = &sample_results[nr_results++];
+	strscpy(r->name, name, sizeof(r->name));
+	r->cycles = cycles;
+	r->ns = ns;
+	r->ns_dec = ns_dec;
+	r->core_cycles = core_cycles;
+}
+
+/* Wraps a bench func (data is the entry), to capture the record of
+ * the last run for the table.
+ */
+static int time_sample_capture(struct time_bench_record *rec, void *data)
+{
+	struct time_bench_entry *b = data;
+	int ret;
+
+	ret = b->func(rec, b->data);
+	if (ret && time_bench_calc_stats(rec))
+		sample_result_add(b->name, rec->tsc_cycles,
+				  rec->ns_per_call_quotient,
+				  rec->ns_per_call_decimal, rec->core_cycles);
+	return ret;
+}
+
+/* Contended atomic64_inc on a shared cacheline, cost per CPU */
+static void run_parallel_atomic64(const char *topology)
+{
+	struct time_bench_cpu *cpu_tasks;
+	struct time_bench_sync sync;
+	uint64_t cycles = 0, ns = 0, core = 0;
+	cpumask_t cpumask;
+	char desc[48];
+	int cpu, cpus;
+
+	cpus = time_bench_cpumask_select(&cpumask, topology, parallel_cpus);
+	if (cpus < 2) {
+		pr_warn("Topology:%s need at least two CPUs\n", topology);
+		return;
+	}
+	cpu_tasks = kcalloc(num_possible_cpus(), sizeof(*cpu_tasks),
+			    GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	snprintf(desc, sizeof(desc), "atomic64_inc-contended-%s", topology);
+	time_bench_run_concurrent(LOOPS/10, 0, &sample_atomic64, &cpumask,
+				  &sync, cpu_tasks, time_atomic64_inc);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, &cpumask);
+
+	/* Average per CPU, records got calculated by print_stats */
+	for_each_cpu(cpu, &cpumask) {
+		struct time_bench_record *rec = &cpu_tasks[cpu].rec;
+
+		cycles += rec->tsc_cycles;
+		ns += rec->ns_per_call_quotient * 1000 +
+			rec->ns_per_call_decimal;
+		core += rec->core_cycles;
+	}
+	ns = div_u64(ns, cpus);
+	sample_result_add(desc, div_u64(cycles, cpus), ns / 1000, ns % 1000,
+			  div_u64(core, cpus));
+	kfree(cpu_tasks);
+}
+
+static void print_result_table(void)
+{
+	int i;
+
+	pr_info("Comparison table (per op, last run):\n");
+	pr_info(" %-36s %10s %12s %12s\n", "bench", "ns", "cycles(tsc)",
+		"core-cycles");
+	for (i = 0; i < nr_results; i++) {
+		struct sample_result *r = &sample_results[i];
+
+		pr_info(" %-36s %6llu.%03llu %12llu %12llu\n", r->name,
+			r->ns, r->ns_dec, r->cycles, r->core_cycles);
+	}
+}
+
+int run_timing_tests(void)
+{
+	char *list, *p, *topology;
+	int i, n = 0;
+
+	for (i = 0; i < ARRAY_SIZE(sample_benches); i++) {
+		struct time_bench_entry *b = &sample_benches[i];
+
+		time_bench_loop(b->loops, b->step, (char *)b->name,
+				b, time_sample_capture);
+	}
+
+	list = kstrdup(topologies, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+	p = list;
+	while ((topology = strsep(&p, ":")) != NULL) {
+		if (!*topology)
+			continue;
+		if (n++ >= MAX_TOPOLOGIES)
+			break;
+		run_parallel_atomic64(topology);
+	}
+	kfree(list);
+
+	print_result_table();
 	return 0;
 }
 
@@ -401,12 +759,14 @@ static int __init time_bench_sample_module_init(void)
 		return -ECANCELED;
 	}
 
-	return 0;
+	return time_bench_register(sample_benches,
+				   ARRAY_SIZE(sample_benches));
 }
 module_init(time_bench_sample_module_init);
 
 static void __exit time_bench_sample_module_exit(void)
 {
+	time_bench_unregister(sample_benches, ARRAY_SIZE(sample_benches));
 	if (verbose)
 		pr_info("Unloaded\n");
 }
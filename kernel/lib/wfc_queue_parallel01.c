@@ -0,0 +1,312 @@
+/*
+* Concurrency/parallel benchmark module for linux/wfc_queue.h
+*  Many producer CPUs enqueue into a single consumer CPU, comparing the
+*  wait-free wfcq_enqueue() with alf_mp_enqueue().
+*
+*  The first CPU in the cpumask (cpu_idx 0) is the consumer, all other
+*  CPUs are producers.  The number of producers is doubled from one up
+*  to max_cpus-1 (default all online CPUs).
+*
+*  The wfcq is intrusive, thus every producer owns an array of nodes it
+*  recycles.  A node is only re-enqueued after the consumer released
+*  it, which also bound the queue length (like a full alf_queue).
+*/
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/alf_queue.h>
+#include <linux/wfc_queue.h>
+#include <linux/time_bench.h>
+#include <linux/slab.h>
+
+static int verbose=1;
+
+static int max_cpus;
+module_param(max_cpus, uint, 0);
+MODULE_PARM_DESC(max_cpus, "Max parallel CPUs, one consumer (default 0 = all online)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+static uint loops = 1000000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Elements enqueued per producer (default 1000000)");
+
+#define NODES_PER_CPU	1024	/* Power of two */
+#define Q_SIZE		1024
+
+struct bench_node {
+	struct wfcq_node node;
+	unsigned int busy;	/* Set by producer, cleared by consumer */
+};
+
+enum bench_type {
+	WFCQ_BLOCKING,		/* __wfcq_dequeue() */
+	WFCQ_NONBLOCKING,	/* __wfcq_dequeue_nonblocking() */
+	WFCQ_SPLICE,		/* __wfcq_splice() into a local queue */
+	ALF_MPSC,		/* alf_mp_enqueue() + alf_sc_dequeue() */
+};
+
+struct wfcq_bench {
+	struct wfcq_head head;
+	/* Producers write the tail, keep it off the head cache-line */
+	struct wfcq_tail tail ____cacheline_aligned_in_smp;
+	struct alf_queue *alf;
+	struct bench_node *nodes;	/* NODES_PER_CPU per producer */
+	int nr_producers;
+	uint64_t wouldblock;		/* Written by consumer */
+};
+
+static __always_inline void release_node(struct wfcq_node *node)
+{
+	struct bench_node *n = container_of(node, struct bench_node, node);
+
+	/* Order dequeue reading node->next before producer reuse */
+	smp_store_release(&n->busy, 0);
+}
+
+static __always_inline uint64_t consumer_loop(struct wfcq_bench *b,
+					      uint64_t target,
+					      enum bench_type type)
+{
+	struct wfcq_head local_head;
+	struct wfcq_tail local_tail;
+	struct wfcq_node *node;
+	uint64_t wouldblock = 0;
+	uint64_t cnt = 0;
+	void *obj;
+
+	wfcq_init(&local_head, &local_tail);
+
+	while (cnt < target) {
+		switch (type) {
+		case WFCQ_BLOCKING:
+			node = __wfcq_dequeue(&b->head, &b->tail);
+			if (!node)
+				goto empty;
+			release_node(node);
+			cnt++;
+			break;
+		case WFCQ_NONBLOCKING:
+			node = __wfcq_dequeue_nonblocking(&b->head, &b->tail);
+			if (node == WFCQ_WOULDBLOCK) {
+				wouldblock++;
+				goto empty;
+			}
+			if (!node)
+				goto empty;
+			release_node(node);
+			cnt++;
+			break;
+		case WFCQ_SPLICE:
+			if (__wfcq_splice(&local_head, &local_tail,
+					  &b->head, &b->tail)
+			    == WFCQ_RET_SRC_EMPTY)
+				goto empty;
+			while ((node = __wfcq_dequeue(&local_head,
+						      &local_tail))) {
+				release_node(node);
+				cnt++;
+			}
+			break;
+		case ALF_MPSC:
+			if (alf_sc_dequeue(b->alf, &obj, 1) != 1)
+				goto empty;
+			cnt++;
+			break;
+		default:
+			BUILD_BUG();
+		}
+		continue;
+	empty:
+		cpu_relax(); /* wait for producers */
+	}
+	b->wouldblock = wouldblock;
+	return cnt;
+}
+
+static __always_inline uint64_t producer_loop(struct wfcq_bench *b,
+					      unsigned int idx,
+					      uint64_t target,
+					      enum bench_type type)
+{
+	struct bench_node *nodes = &b->nodes[idx * NODES_PER_CPU];
+	void *obj = (void *)(unsigned long)(idx + 42);
+	struct bench_node *n;
+	uint64_t cnt;
+
+	for (cnt = 0; cnt < target; cnt++) {
+		if (type == ALF_MPSC) {
+			while (alf_mp_enqueue(b->alf, &obj, 1) != 1)
+				cpu_relax(); /* full, wait for consumer */
+			continue;
+		}
+		n = &nodes[cnt & (NODES_PER_CPU - 1)];
+		while (smp_load_acquire(&n->busy))
+			cpu_relax(); /* still queued, wait for consumer */
+		n->busy = 1;
+		wfcq_node_init(&n->node);
+		wfcq_enqueue(&b->head, &b->tail, &n->node);
+	}
+	return cnt;
+}
+
+static __always_inline int time_bench_wfcq(
+	struct time_bench_record *rec, void *data, enum bench_type type)
+{
+	struct wfcq_bench *b = data;
+	bool consumer = (rec->cpu_idx == 0);
+	uint64_t loops_cnt;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	if (consumer)
+		loops_cnt = consumer_loop(b, rec->loops * b->nr_producers,
+					  type);
+	else
+		loops_cnt = producer_loop(b, rec->cpu_idx - 1, rec->loops,
+					  type);
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark consumer, as "step" gets printed */
+	rec->step = consumer;
+	return loops_cnt;
+}
+/* Compiler should inline optimize other function calls out */
+static int time_bench_wfcq_blocking(struct time_bench_record *rec, void *data)
+{
+	return time_bench_wfcq(rec, data, WFCQ_BLOCKING);
+}
+static int time_bench_wfcq_nonblocking(struct time_bench_record *rec,
+				       void *data)
+{
+	return time_bench_wfcq(rec, data, WFCQ_NONBLOCKING);
+}
+static int time_bench_wfcq_splice(struct time_bench_record *rec, void *data)
+{
+	return time_bench_wfcq(rec, data, WFCQ_SPLICE);
+}
+static int time_bench_alf_mpsc(struct time_bench_record *rec, void *data)
+{
+	return time_bench_wfcq(rec, data, ALF_MPSC);
+}
+
+static void run_parallel(const char *desc, uint32_t loops,
+			 const cpumask_t *cpumask, int step, void *data,
+			 int (*func)(struct time_bench_record *record,
+				     void *data))
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	size_t size;
+
+	/* Allocate records for every CPU */
+	size = sizeof(*cpu_tasks) * num_possible_cpus();
+	cpu_tasks = kzalloc(size, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	time_bench_run_concurrent(loops, step, data,
+				  cpumask, &sync, cpu_tasks, func);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+
+	kfree(cpu_tasks);
+}
+
+static int run_producers(struct wfcq_bench *b, int nr_producers)
+{
+	cpumask_t cpumask;
+	int cpus;
+
+	cpus = time_bench_cpumask_select(&cpumask, topology, nr_producers + 1);
+	if (cpus < 2)
+		return -EINVAL;
+	b->nr_producers = cpus - 1;
+	if (verbose)
+		pr_info("Producers:%d enqueue %u elements each\n",
+			b->nr_producers, loops);
+
+	/* Queues are empty and all nodes released between runs */
+	memset(b->nodes, 0, sizeof(*b->nodes) * NODES_PER_CPU * nr_producers);
+	wfcq_init(&b->head, &b->tail);
+
+	run_parallel("wfcq_MPSC_blocking", loops, &cpumask, 0, b,
+		     time_bench_wfcq_blocking);
+	run_parallel("wfcq_MPSC_nonblocking", loops, &cpumask, 0, b,
+		     time_bench_wfcq_nonblocking);
+	if (verbose)
+		pr_info("Nonblocking dequeue would have blocked %llu times\n",
+			b->wouldblock);
+	run_parallel("wfcq_MPSC_splice", loops, &cpumask, 0, b,
+		     time_bench_wfcq_splice);
+	run_parallel("alf_queue_MPSC", loops, &cpumask, 0, b,
+		     time_bench_alf_mpsc);
+	return 0;
+}
+
+int run_benchmark_tests(void)
+{
+	struct wfcq_bench *b;
+	int max_producers;
+	int nr, err = 0;
+
+	max_producers = (max_cpus ? : num_online_cpus()) - 1;
+	if (max_producers < 1) {
+		pr_err("Need at least two CPUs\n");
+		return -EINVAL;
+	}
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	b->nodes = kvcalloc(max_producers * NODES_PER_CPU, sizeof(*b->nodes),
+			    GFP_KERNEL);
+	if (!b->nodes) {
+		err = -ENOMEM;
+		goto out;
+	}
+	b->alf = alf_queue_alloc(Q_SIZE, GFP_KERNEL);
+	if (IS_ERR(b->alf)) {
+		err = PTR_ERR(b->alf);
+		goto out_nodes;
+	}
+
+	/* Single producer first, then doubling up to all CPUs */
+	for (nr = 1; ; nr = min(nr * 2, max_producers)) {
+		err = run_producers(b, nr);
+		if (err || nr == max_producers)
+			break;
+	}
+
+	alf_queue_free(b->alf);
+out_nodes:
+	kvfree(b->nodes);
+out:
+	kfree(b);
+	return err;
+}
+
+static int __init wfc_queue_parallel01_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (run_benchmark_tests() < 0) {
+		return -ECANCELED;
+	}
+
+	return 0;
+}
+module_init(wfc_queue_parallel01_module_init);
+
+static void __exit wfc_queue_parallel01_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(wfc_queue_parallel01_module_exit);
+
+MODULE_DESCRIPTION("Concurrency/parallel benchmarking of wfc_queue vs. alf_queue");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,265 @@
+/*
+ * Test module for linux/wfc_queue.h usage
+ *  a Concurrent Queue with Wait-Free Enqueue/Busy-Waiting Dequeue
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/wfc_queue.h>
+
+static int verbose=1;
+
+/* Test objects embedding the intrusive queue node */
+struct test_obj {
+	struct wfcq_node node;
+	unsigned long nr;
+};
+
+#define NR_OBJS 128
+static struct test_obj objs[NR_OBJS];
+
+static void init_objs(void)
+{
+	int i;
+
+	for (i = 0; i < NR_OBJS; i++) {
+		wfcq_node_init(&objs[i].node);
+		objs[i].nr = i;
+	}
+}
+
+static unsigned long node_nr(struct wfcq_node *node)
+{
+	return container_of(node, struct test_obj, node)->nr;
+}
+
+/*** Basic functionality true/false test functions ***/
+
+static bool test_init_empty(void)
+{
+	struct wfcq_head head;
+	struct wfcq_tail tail;
+
+	wfcq_init(&head, &tail);
+	if (!wfcq_empty(&head, &tail))
+		return false;
+	if (__wfcq_dequeue(&head, &tail) != NULL)
+		return false;
+	if (__wfcq_dequeue_nonblocking(&head, &tail) != NULL)
+		return false;
+	if (__wfcq_first(&head, &tail) != NULL)
+		return false;
+	return true;
+}
+
+static noinline bool test_enqueue_dequeue_fifo(void)
+{
+	struct wfcq_head head;
+	struct wfcq_tail tail;
+	struct wfcq_node *node;
+	unsigned long next = 0;
+	int i;
+
+	wfcq_init(&head, &tail);
+	init_objs();
+
+	/* First enqueue report empty queue, rest non-empty */
+	if (wfcq_enqueue(&head, &tail, &objs[0].node))
+		return false;
+	for (i = 1; i < NR_OBJS; i++) {
+		if (!wfcq_enqueue(&head, &tail, &objs[i].node))
+			return false;
+	}
+	while ((node = __wfcq_dequeue(&head, &tail)) != NULL) {
+		if (node_nr(node) != next++)
+			return false;
+	}
+	if (verbose)
+		pr_info("%s(): dequeued %lu of %d in order\n",
+			__func__, next, NR_OBJS);
+	if (next != NR_OBJS)
+		return false;
+	return wfcq_empty(&head, &tail);
+}
+
+static noinline bool test_dequeue_nonblocking(void)
+{
+	struct wfcq_head head;
+	struct wfcq_tail tail;
+	struct wfcq_node *node;
+
+	wfcq_init(&head, &tail);
+	init_objs();
+
+	wfcq_enqueue(&head, &tail, &objs[0].node);
+
+	/* Simulate an enqueuer between xchg() of tail and linking
+	 * the node, see __wfcq_append()
+	 */
+	xchg(&tail.p, &objs[1].node);
+	/* objs[0] cannot be dequeued before its next pointer is set */
+	if (__wfcq_dequeue_nonblocking(&head, &tail) != WFCQ_WOULDBLOCK)
+		return false;
+	if (wfcq_empty(&head, &tail))
+		return false;
+
+	/* Complete the enqueue, both nodes can be dequeued */
+	WRITE_ONCE(objs[0].node.next, &objs[1].node);
+	node = __wfcq_dequeue_nonblocking(&head, &tail);
+	if (node != &objs[0].node)
+		return false;
+	node = __wfcq_dequeue_nonblocking(&head, &tail);
+	if (node != &objs[1].node)
+		return false;
+	return wfcq_empty(&head, &tail);
+}
+
+static noinline bool test_dequeue_bulk(void)
+{
+	struct wfcq_node *nodes[16];
+	struct wfcq_head head;
+	struct wfcq_tail tail;
+	unsigned long next = 0;
+	int i, cnt, calls = 0;
+
+	wfcq_init(&head, &tail);
+	init_objs();
+
+	/* Odd count, last bulk is partial */
+	for (i = 0; i < 100; i++)
+		wfcq_enqueue(&head, &tail, &objs[i].node);
+
+	while ((cnt = __wfcq_dequeue_bulk(&head, &tail, nodes, 16)) > 0) {
+		calls++;
+		for (i = 0; i < cnt; i++) {
+			if (node_nr(nodes[i]) != next++)
+				return false;
+		}
+	}
+	if (verbose)
+		pr_info("%s(): dequeued %lu in %d calls\n",
+			__func__, next, calls);
+	if (next != 100 || calls != 7)
+		return false;
+	if (!wfcq_empty(&head, &tail))
+		return false;
+
+	/* Queue must be usable after a bulk emptied it */
+	wfcq_enqueue(&head, &tail, &objs[0].node);
+	if (__wfcq_dequeue_bulk(&head, &tail, nodes, 16) != 1)
+		return false;
+	return nodes[0] == &objs[0].node && wfcq_empty(&head, &tail);
+}
+
+static noinline bool test_splice(void)
+{
+	struct wfcq_head src_head, dst_head;
+	struct wfcq_tail src_tail, dst_tail;
+	struct wfcq_node *node;
+	unsigned long next = 0;
+	int i;
+
+	wfcq_init(&src_head, &src_tail);
+	wfcq_init(&dst_head, &dst_tail);
+	init_objs();
+
+	if (__wfcq_splice(&dst_head, &dst_tail, &src_head, &src_tail)
+	    != WFCQ_RET_SRC_EMPTY)
+		return false;
+
+	for (i = 0; i < NR_OBJS / 2; i++)
+		wfcq_enqueue(&src_head, &src_tail, &objs[i].node);
+	if (__wfcq_splice(&dst_head, &dst_tail, &src_head, &src_tail)
+	    != WFCQ_RET_DEST_EMPTY)
+		return false;
+	if (!wfcq_empty(&src_head, &src_tail))
+		return false;
+
+	for (; i < NR_OBJS; i++)
+		wfcq_enqueue(&src_head, &src_tail, &objs[i].node);
+	if (__wfcq_splice(&dst_head, &dst_tail, &src_head, &src_tail)
+	    != WFCQ_RET_DEST_NON_EMPTY)
+		return false;
+
+	/* Spliced content is appended in order */
+	while ((node = __wfcq_dequeue(&dst_head, &dst_tail)) != NULL) {
+		if (node_nr(node) != next++)
+			return false;
+	}
+	return next == NR_OBJS;
+}
+
+static noinline bool test_for_each(void)
+{
+	struct wfcq_head head;
+	struct wfcq_tail tail;
+	struct wfcq_node *node, *n;
+	unsigned long next = 0;
+	int i;
+
+	wfcq_init(&head, &tail);
+	init_objs();
+	for (i = 0; i < NR_OBJS; i++)
+		wfcq_enqueue(&head, &tail, &objs[i].node);
+
+	__wfcq_for_each(&head, &tail, node) {
+		if (node_nr(node) != next++)
+			return false;
+	}
+	if (next != NR_OBJS)
+		return false;
+
+	/* Iteration does not dequeue */
+	next = 0;
+	__wfcq_for_each_safe(&head, &tail, node, n)
+		next++;
+	return next == NR_OBJS && !wfcq_empty(&head, &tail);
+}
+
+#define TEST_FUNC(func) 					\
+do {								\
+	if (!(func)) {						\
+		pr_info("FAILED - " #func "\n");		\
+		return -1;					\
+	} else {						\
+		if (verbose)					\
+			pr_info("PASSED - " #func "\n");	\
+		passed_count++;					\
+	}							\
+} while (0)
+
+int run_basic_tests(void)
+{
+	int passed_count = 0;
+	TEST_FUNC(test_init_empty());
+	TEST_FUNC(test_enqueue_dequeue_fifo());
+	TEST_FUNC(test_dequeue_nonblocking());
+	TEST_FUNC(test_dequeue_bulk());
+	TEST_FUNC(test_splice());
+	TEST_FUNC(test_for_each());
+	return passed_count;
+}
+
+static int __init wfc_queue_test_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (run_basic_tests() < 0)
+		return -ECANCELED;
+
+	return 0;
+}
+module_init(wfc_queue_test_module_init);
+
+static void __exit wfc_queue_test_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(wfc_queue_test_module_exit);
+
+MODULE_DESCRIPTION("Test of wait-free concurrent queue (wfcq)");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
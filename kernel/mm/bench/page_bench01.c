@@ -21,15 +21,18 @@ static int time_single_page_alloc_free(
 {
 	gfp_t gfp_mask = (GFP_ATOMIC | ___GFP_NORETRY);
 	struct page *my_page;
-	int i;
+	uint64_t i;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_page(gfp_mask);
 		if (unlikely(my_page == NULL))
 			return 0;
 		__free_page(my_page);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
@@ -43,7 +46,7 @@ static int time_alloc_pages(
 	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_COMP);
 	struct page *my_page;
 	int order = rec->step;
-	int i;
+	uint64_t i;
 
 	/* Drop WARN on failures, time_bench will invalidate test */
 	gfp_mask |= __GFP_NOWARN;
@@ -51,10 +54,13 @@ static int time_alloc_pages(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_pages(gfp_mask, order);
 		if (unlikely(my_page == NULL))
 			return 0;
 		__free_pages(my_page, order);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 
@@ -78,7 +84,7 @@ static int time_alloc_put_pages(
 	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_COMP);
 	struct page *page;
 	int order = rec->step;
-	int i;
+	uint64_t i;
 
 	/* Drop WARN on failures, time_bench will invalidate test */
 	gfp_mask |= __GFP_NOWARN;
@@ -86,6 +92,8 @@ static int time_alloc_put_pages(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		page = alloc_pages(gfp_mask, order);
 		if (unlikely(page == NULL))
 			return 0;
@@ -94,6 +102,7 @@ static int time_alloc_put_pages(
 		 * prep_new_page() -> post_alloc_hook() -> set_page_refcounted()
 		 */
 		put_page(page);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
@@ -112,12 +121,14 @@ static int time_alloc_pages_with_fallback(
 	gfp_t gfp_mask = GFP_ATOMIC;
 	struct page *page;
 	int preferred_order = rec->step;
-	int i, order;
+	uint64_t i;
+	int order;
 	int histogram_order[MAX_ORDER] = {0};
 
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		/* Simulate system in mlx4_alloc_pages() */
 		for (order = preferred_order; ;) {
@@ -136,6 +147,7 @@ static int time_alloc_pages_with_fallback(
 		if (unlikely(page == NULL))
 			return 0;
 		__free_pages(page, order);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 
@@ -59,15 +59,18 @@ static int time_single_page_alloc_put(
 {
 	gfp_t gfp_mask = (GFP_ATOMIC | ___GFP_NORETRY);
 	struct page *my_page;
-	int i;
+	uint64_t i;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_page(gfp_mask);
 		if (unlikely(my_page == NULL))
 			return 0;
 		put_page(my_page);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
@@ -81,7 +84,7 @@ static int time_alloc_pages(
 	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_COMP);
 	struct page *my_page;
 	int order = rec->step;
-	int i;
+	uint64_t i;
 
 	/* Drop WARN on failures, time_bench will invalidate test */
 	gfp_mask |= __GFP_NOWARN;
@@ -89,10 +92,13 @@ static int time_alloc_pages(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_pages(gfp_mask, order);
 		if (unlikely(my_page == NULL))
 			return 0;
 		__free_pages(my_page, order);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 
@@ -131,7 +137,8 @@ static int time_alloc_pages_outstanding(
 	struct page *page;
 	int allocs_before_free = rec->step;
 	int order = page_order; /* <-- GLOBAL variable */
-	int i = 0, j = 0;
+	uint64_t i = 0;
+	int j = 0;
 
 	/* Need seperately allocated store to support parallel use.
 	 * Temp store for "outstanding" pages
@@ -155,6 +162,7 @@ static int time_alloc_pages_outstanding(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; /* inc in loop */) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		for (j = 0; j < allocs_before_free; j++) {
 			page = alloc_pages(gfp_mask, order);
@@ -167,6 +175,7 @@ static int time_alloc_pages_outstanding(
 
 		for (j = 0; j < allocs_before_free; j++)
 			__free_pages(store[j], order);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 
@@ -183,7 +192,7 @@ static int time_alloc_pages_outstanding(
 	return i;
 out:
 	/* Error handling: Free remaining objects */
-	pr_info("FAILED N=%d outstanding pages order:%d i:%d j:%d\n",
+	pr_info("FAILED N=%d outstanding pages order:%d i:%llu j:%d\n",
 		allocs_before_free, order, i, j);
 	for (i = 0; i < j; i++)
 		__free_pages(store[i], order);
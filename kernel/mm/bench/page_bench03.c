@@ -52,7 +52,7 @@ static int time_alloc_pages(
 	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_COMP);
 	struct page *page;
 	int order = rec->step;
-	int i;
+	uint64_t i;
 
 	/* Drop WARN on failures, time_bench will invalidate test */
 	gfp_mask |= __GFP_NOWARN;
@@ -60,10 +60,13 @@ static int time_alloc_pages(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		page = alloc_pages(gfp_mask, order);
 		if (unlikely(page == NULL))
 			return 0;
 		__free_pages(page, order);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
@@ -50,15 +50,18 @@ static int time_single_page_alloc_put(
 {
 	gfp_t gfp_mask = (GFP_ATOMIC | ___GFP_NORETRY);
 	struct page *my_page;
-	int i;
+	uint64_t i;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_page(gfp_mask);
 		if (unlikely(my_page == NULL))
 			return 0;
 		put_page(my_page);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
@@ -84,7 +87,7 @@ static int time_bulk_page_alloc_free_list(
 {
 	gfp_t gfp = (GFP_ATOMIC | ___GFP_NORETRY);
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	/* Bulk size setup from "step" */
 	size_t bulk = rec->step;
@@ -94,17 +97,12 @@ static int time_bulk_page_alloc_free_list(
 			__func__, bulk, MAX_BULK);
 		bulk = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
 		struct list_head list;
 		unsigned long n;
+		uint64_t t = time_bench_hist_begin(rec);
 		INIT_LIST_HEAD(&list);
 
 		//n = alloc_pages_bulk(gfp, order, bulk, &list);
@@ -119,6 +117,7 @@ static int time_bulk_page_alloc_free_list(
 
 		/* NOTICE THIS COUNTS (bulk) alloc+free together */
 		loops_cnt+= n;
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, loops_cnt);
 	return loops_cnt;
@@ -132,7 +131,7 @@ static int time_bulk_page_alloc_free_array(
 {
 	gfp_t gfp = (GFP_ATOMIC | ___GFP_NORETRY);
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct page *array[ARRAY_SZ] = {}; /* Zero array */
 
 	/* Bulk size setup from "step" */
@@ -143,12 +142,6 @@ static int time_bulk_page_alloc_free_array(
 			__func__, bulk, (ARRAY_SZ - 1));
 		bulk = ARRAY_SZ;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	/* Zero array as bulk alloc API depend on it */
 	for (i = 0; i < bulk; i++)
 		array[i] = NULL;
@@ -158,6 +151,7 @@ static int time_bulk_page_alloc_free_array(
 	for (i = 0; i < rec->loops; i++) {
 		unsigned long n;
 		int j;
+		uint64_t t = time_bench_hist_begin(rec);
 
 		n = alloc_pages_bulk_array(gfp, bulk, array);
 
@@ -180,6 +174,7 @@ static int time_bulk_page_alloc_free_array(
 
 		/* NOTICE THIS COUNTS (bulk) alloc+free together */
 		loops_cnt+= n;
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, loops_cnt);
 	return loops_cnt;
@@ -59,7 +59,7 @@ static int time_single_cpu_page_alloc_put(
 	gfp_t gfp_mask = (GFP_ATOMIC | ___GFP_NORETRY);
 //	gfp_t gfp_mask = GFP_KERNEL;
 	struct page *my_page;
-	int i;
+	uint64_t i;
 
 	if (page_order) /* set: __GFP_COMP for compound pages */
 		gfp_mask |= __GFP_COMP;
@@ -67,10 +67,13 @@ static int time_single_cpu_page_alloc_put(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_pages(gfp_mask, page_order);
 		if (unlikely(my_page == NULL))
 			return 0;
 		put_page(my_page);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
@@ -103,7 +106,7 @@ static int time_cross_cpu_ptr_ring(
 	//gfp_t gfp_mask = (GFP_ATOMIC | ___GFP_NORETRY);
 	struct page *page, *npage;
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	bool enq_CPU = false;
 
@@ -125,20 +128,15 @@ static int time_cross_cpu_ptr_ring(
 		pr_err("Need queue ptr as input\n");
 		return 0;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		if (enq_CPU) {
 			/* enqueue side */
 			if (ptr_ring_produce(queue, page) < 0) {
-				pr_err("%s() WARN: enq fullq(CPU:%d) i:%d\n",
+				pr_err("%s() WARN: enq fullq(CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -146,13 +144,14 @@ static int time_cross_cpu_ptr_ring(
 			/* dequeue side */
 			npage = ptr_ring_consume(queue);
 			if (npage == NULL) {
-				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%d\n",
+				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
 		}
 		loops_cnt++;
 		barrier(); /* compiler barrier */
+		time_bench_hist_end(rec, t);
 	}
 finish_early:
 	time_bench_stop(rec, loops_cnt);
@@ -168,7 +167,7 @@ static int time_cross_cpu_page_alloc_put(
 //	gfp_t gfp_mask = (GFP_KERNEL);
 	struct page *page, *npage;
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 
 	bool enq_CPU = false;
 
@@ -186,21 +185,16 @@ static int time_cross_cpu_page_alloc_put(
 		pr_err("Need queue ptr as input\n");
 		return 0;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		if (enq_CPU) {
 			/* enqueue side */
 			page = alloc_pages(gfp_mask, page_order);
 			if (ptr_ring_produce(queue, page) < 0) {
-				pr_err("%s() WARN: enq fullq(CPU:%d) i:%d\n",
+				pr_err("%s() WARN: enq fullq(CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -209,7 +203,7 @@ static int time_cross_cpu_page_alloc_put(
 			npage = ptr_ring_consume(queue);
 			//prefetchw(npage);
 			if (npage == NULL) {
-				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%d\n",
+				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -217,6 +211,7 @@ static int time_cross_cpu_page_alloc_put(
 		}
 		loops_cnt++;
 		barrier(); /* compiler barrier */
+		time_bench_hist_end(rec, t);
 	}
 finish_early:
 	time_bench_stop(rec, loops_cnt);
@@ -235,7 +230,7 @@ static int time_cross_cpu_page_experiment1(
 #define ARRAY_SZ 64
 	struct page *array[ARRAY_SZ];
 	int stack_cnt = 0;
-	int i;
+	uint64_t i;
 
 	bool enq_CPU = false;
 
@@ -253,21 +248,16 @@ static int time_cross_cpu_page_experiment1(
 		pr_err("Need queue ptr as input\n");
 		return 0;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		if (enq_CPU) {
 			/* enqueue side */
 			page = alloc_pages(gfp_mask, page_order);
 			if (ptr_ring_produce(queue, page) < 0) {
-				pr_err("%s() WARN: enq fullq(CPU:%d) i:%d\n",
+				pr_err("%s() WARN: enq fullq(CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -277,7 +267,7 @@ static int time_cross_cpu_page_experiment1(
 			/* dequeue side */
 			npage = ptr_ring_consume(queue);
 			if (npage == NULL) {
-				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%d\n",
+				pr_err("%s() WARN: deq emptyq (CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -298,6 +288,7 @@ static int time_cross_cpu_page_experiment1(
 		}
 		loops_cnt++;
 		barrier(); /* compiler barrier */
+		time_bench_hist_end(rec, t);
 	}
 finish_early:
 	time_bench_stop(rec, loops_cnt);
@@ -321,7 +312,7 @@ static int time_cross_cpu_page_experiment3(
 //	gfp_t gfp_mask = (GFP_KERNEL);
 	struct page *page;
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	bool enq_CPU = false;
 	struct ptr_ring *queue1;
 	struct ptr_ring *queue2;
@@ -348,12 +339,6 @@ static int time_cross_cpu_page_experiment3(
 	/* Hack: use "step" to mark enq/deq, as "step" gets printed */
 	rec->step = enq_CPU;
 
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * 2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	/* Need to adjust refcnt to keep consistent invarians.
 	 * As queue1 must get inited to have refcnt==2
 	 */
@@ -369,6 +354,7 @@ static int time_cross_cpu_page_experiment3(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		if (enq_CPU) {
 //			atomic_inc(&queues->atom);
@@ -376,7 +362,7 @@ static int time_cross_cpu_page_experiment3(
 //			queues->false_sharing = 42;
 			page = ptr_ring_consume(queue2);
 			if (page == NULL) {
-				pr_err("%s() WARN: deq2 emptyq (CPU:%d) i:%d\n",
+				pr_err("%s() WARN: deq2 emptyq (CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -384,7 +370,7 @@ static int time_cross_cpu_page_experiment3(
 			flags = page->flags;
 			page_ref_inc(page);
 			if (page && ptr_ring_produce(queue1, page) < 0) {
-				pr_err("%s() WARN: enq1 fullq(CPU:%d) i:%d\n",
+				pr_err("%s() WARN: enq1 fullq(CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -394,7 +380,7 @@ static int time_cross_cpu_page_experiment3(
 //			queues->false_sharing = 43;
 			page = ptr_ring_consume(queue1);
 			if (page == NULL) {
-				pr_err("%s() WARN: deq1 emptyq (CPU:%d) i:%d\n",
+				pr_err("%s() WARN: deq1 emptyq (CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
@@ -402,13 +388,14 @@ static int time_cross_cpu_page_experiment3(
 			flags = page->flags;
 			page_ref_dec(page);
 			if (page && ptr_ring_produce(queue2, page) < 0) {
-				pr_err("%s() WARN: enq1 fullq(CPU:%d) i:%d\n",
+				pr_err("%s() WARN: enq1 fullq(CPU:%d) i:%llu\n",
 				       __func__, smp_processor_id(), i);
 				goto finish_early;
 			}
 		}
 		loops_cnt++;
 		barrier(); /* compiler barrier */
+		time_bench_hist_end(rec, t);
 	}
 finish_early:
 	time_bench_stop(rec, loops_cnt);
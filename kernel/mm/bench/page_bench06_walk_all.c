@@ -1,6 +1,8 @@
 /*
  * Benchmarking page allocator execution time inside the kernel
  *  - PoC for walking all pages in the kernel
+ *  - Scaling of the parallel page_scan iterator (mm/page_scan.c)
+ *    with number of CPUs, against the single threaded PoC walk
  */
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
@@ -12,6 +14,8 @@
 
 #include <linux/mmzone.h>
 #include <linux/memory_hotplug.h>
+#include <linux/slab.h>
+#include <linux/page_scan.h>
 
 static int verbose=1;
 
@@ -19,20 +23,35 @@ static uint32_t loops = 100000;
 module_param(loops, uint, 0);
 MODULE_PARM_DESC(loops, "Iteration loops");
 
+static int max_cpus;
+module_param(max_cpus, uint, 0);
+MODULE_PARM_DESC(max_cpus, "Sweep page_scan CPU count 1,2,4.. up to this (default 0 = all online)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+static unsigned int prefetch_ahead = PAGE_SCAN_PREFETCH;
+module_param(prefetch_ahead, uint, 0);
+MODULE_PARM_DESC(prefetch_ahead, "page_scan struct page prefetch distance");
+
 static int time_single_page_alloc_free(
 	struct time_bench_record *rec, void *data)
 {
 	gfp_t gfp_mask = (GFP_ATOMIC | ___GFP_NORETRY);
 	struct page *my_page;
-	int i;
+	uint64_t i;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
 		my_page = alloc_page(gfp_mask);
 		if (unlikely(my_page == NULL))
 			return 0;
 		__free_page(my_page);
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, i);
 	return i;
@@ -103,6 +122,98 @@ static int time_walk_all_pages(
 	return i;
 }
 
+/* Per page_scan worker counters */
+struct scan_count {
+	unsigned long in_use;
+	unsigned long page_pool;
+} ____cacheline_aligned_in_smp;
+
+struct scan_bench {
+	cpumask_t cpumask;
+	struct scan_count *cnt;	/* Per worker */
+	int cpus;
+};
+
+static int scan_cb(struct page **pages, unsigned int nr,
+		   unsigned int worker, void *data)
+{
+	struct scan_bench *sb = data;
+	struct scan_count *c = &sb->cnt[worker];
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+
+		/* only scan if page is in use */
+		if (page_count(page) == 0)
+			continue;
+		c->in_use++;
+		if ((page->pp_magic & ~0x3UL) == PP_SIGNATURE)
+			c->page_pool++;
+	}
+	return 0;
+}
+
+static int time_page_scan(struct time_bench_record *rec, void *data)
+{
+	struct scan_bench *sb = data;
+	struct page_scan_params params = {
+		.fn = scan_cb,
+		.data = sb,
+		.cpumask = &sb->cpumask,
+		.prefetch = prefetch_ahead,
+	};
+	unsigned long in_use = 0, pp = 0;
+	long pages;
+	int i;
+
+	memset(sb->cnt, 0, sizeof(*sb->cnt) * sb->cpus);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	pages = page_scan_run(&params);
+	if (pages < 0)
+		pages = 0;
+	time_bench_stop(rec, pages);
+
+	for (i = 0; i < sb->cpus; i++) {
+		in_use += sb->cnt[i].in_use;
+		pp += sb->cnt[i].page_pool;
+	}
+	pr_info("%s(): cpus:%d pages:%ld in-use:%lu page_pool:%lu\n",
+		__func__, sb->cpus, pages, in_use, pp);
+	return pages;
+}
+
+static void run_page_scan_sweep(void)
+{
+	int max = max_cpus ? : num_online_cpus();
+	struct scan_bench *sb;
+	char desc[32];
+	int nr;
+
+	sb = kzalloc(sizeof(*sb), GFP_KERNEL);
+	if (!sb)
+		return;
+	sb->cnt = kcalloc(max, sizeof(*sb->cnt), GFP_KERNEL);
+	if (!sb->cnt)
+		goto out;
+
+	for (nr = 1; ; nr = min(nr * 2, max)) {
+		sb->cpus = time_bench_cpumask_select(&sb->cpumask, topology, nr);
+		if (sb->cpus <= 0)
+			break;
+		/* Loops=1, time_bench reports cost per page */
+		snprintf(desc, sizeof(desc), "page_scan_%dcpus", sb->cpus);
+		time_bench_loop(1, sb->cpus, desc, sb, time_page_scan);
+		if (nr == max)
+			break;
+	}
+	kfree(sb->cnt);
+out:
+	kfree(sb);
+}
+
 int run_timing_tests(void)
 {
 	time_bench_loop(loops*10, 0, "single_page_alloc_free",
@@ -111,6 +222,8 @@ int run_timing_tests(void)
 	time_bench_loop(loops, 0, "walk_all_pages",
 			NULL, time_walk_all_pages);
 
+	run_page_scan_sweep();
+
 	return 0;
 }
 
@@ -0,0 +1,291 @@
+/*
+ * Benchmarking page allocator: parallel scaling matrix
+ *
+ * Combines page_bench03 (parallel CPUs, single page_order) and the
+ * page_bench02 "outstanding" test, sweeping every combination of
+ *   order 0..max_order x outstanding pages x CPU count x GFP flags
+ * Purpose is sizing page_pool rings per NIC queue count, e.g. how
+ * many pages can each RX-queue CPU keep in flight before the per-CPU
+ * page lists (pcp) overflow and the zone lock gets contended.
+ *
+ * Per cell reported:
+ *  - cycles per 4K (averaged over CPUs), and scaling relative to the
+ *    single CPU cell of same order/outstanding/GFP.  Zone lock
+ *    contention is not exposed to modules, growth of this factor with
+ *    CPU count is the contention.
+ *  - slow%: allocs taking more than "slow_cycles".  A pcp hit is
+ *    cheap, while a pcp miss refills from the buddy under zone lock,
+ *    thus 100-slow% estimates the pcp hit rate.
+ *  - vmstat deltas of the run: pgalloc (normal zone) and pgfree events,
+ *    and the change of NR_FREE_PAGES (pages parked on pcp lists are
+ *    not counted as free).
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time.h>
+#include <linux/time_bench.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/vmstat.h>
+#include <linux/cpumask.h>
+
+static int verbose=1;
+
+static uint32_t loops = 100000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Pages per CPU per matrix cell");
+
+static int max_order = 3;
+module_param(max_order, uint, 0);
+MODULE_PARM_DESC(max_order, "Sweep page order 0..max_order (default 3)");
+
+#define MAX_OUTSTANDING 4096
+#define NR_OUT_STEPS	5	/* 1,8,64,512,4096 */
+static int max_outstanding = 512;
+module_param(max_outstanding, uint, 0);
+MODULE_PARM_DESC(max_outstanding, "Sweep outstanding pages 1,8,64.. up to this (max 4096)");
+
+static int max_cpus;
+module_param(max_cpus, uint, 0);
+MODULE_PARM_DESC(max_cpus, "Sweep CPU count 1,2,4.. up to this (default 0 = all online)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+static int slow_cycles = 1000;
+module_param(slow_cycles, uint, 0);
+MODULE_PARM_DESC(slow_cycles, "Alloc slower than this counts as pcp miss");
+
+/* Quick and dirty way to unselect GFP flags of the sweep */
+static unsigned long gfp_flags = 0xFFFFFFFF;
+module_param(gfp_flags, ulong, 0);
+MODULE_PARM_DESC(gfp_flags, "Bitmask of GFP flag sets to sweep (bit0 ATOMIC, bit1 KERNEL)");
+
+static const struct {
+	const char *name;
+	gfp_t gfp;
+} gfp_sets[] = {
+	{ "ATOMIC", GFP_ATOMIC },
+	{ "KERNEL", GFP_KERNEL },
+};
+
+struct matrix_cpu {
+	struct page **store;	/* Outstanding pages */
+	uint64_t slow;		/* Allocs above slow_cycles */
+	uint64_t allocs;
+} ____cacheline_aligned_in_smp;
+
+struct matrix {
+	struct matrix_cpu *cpu;		/* Per cpu_idx */
+	gfp_t gfp;
+	int outstanding;
+};
+
+static int time_alloc_pages_matrix(struct time_bench_record *rec, void *data)
+{
+	struct matrix *m = data;
+	struct matrix_cpu *c = &m->cpu[rec->cpu_idx];
+	gfp_t gfp_mask = m->gfp | __GFP_COMP | __GFP_NOWARN;
+	int order = rec->step;
+	uint64_t loops_cnt = 0;
+	uint64_t t;
+	int i, n;
+
+	c->slow = c->allocs = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		for (n = 0; n < m->outstanding; n++) {
+			t = tsc_start_clock();
+			c->store[n] = alloc_pages(gfp_mask, order);
+			t = tsc_stop_clock() - t;
+			if (unlikely(!c->store[n]))
+				break;
+			time_bench_hist_sample(rec, t);
+			if (t > slow_cycles)
+				c->slow++;
+		}
+		c->allocs += n;
+		for (i = 0; i < n; i++)
+			__free_pages(c->store[i], order);
+		if (unlikely(n < m->outstanding))
+			break; /* Cell reported as invalid */
+		loops_cnt += n;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+static unsigned long vm_ev_before[NR_VM_EVENT_ITEMS];
+static unsigned long vm_ev_after[NR_VM_EVENT_ITEMS];
+#endif
+
+/* Returns average cycles per 4K page of the cell, zero on failure */
+static uint64_t run_cell(struct matrix *m, const cpumask_t *cpumask,
+			 int cpus, int order, const char *gfp_name,
+			 uint64_t base)
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	uint64_t sum = 0, slow = 0, allocs = 0, per4k;
+	unsigned long pgalloc = 0, pgfree = 0;
+	long free_before, free_diff;
+	int cpu, i, records = 0;
+	size_t size;
+
+	/* Allocate records for every CPU */
+	size = sizeof(*cpu_tasks) * num_possible_cpus();
+	cpu_tasks = kzalloc(size, GFP_KERNEL);
+	if (!cpu_tasks)
+		return 0;
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	all_vm_events(vm_ev_before);
+#endif
+	free_before = global_zone_page_state(NR_FREE_PAGES);
+
+	time_bench_run_concurrent(loops, order, m, cpumask, &sync,
+				  cpu_tasks, time_alloc_pages_matrix);
+
+	free_diff = global_zone_page_state(NR_FREE_PAGES) - free_before;
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	all_vm_events(vm_ev_after);
+	pgalloc = vm_ev_after[PGALLOC_NORMAL] - vm_ev_before[PGALLOC_NORMAL];
+	pgfree  = vm_ev_after[PGFREE] - vm_ev_before[PGFREE];
+#endif
+
+	for_each_cpu(cpu, cpumask) {
+		struct time_bench_record *rec = &cpu_tasks[cpu].rec;
+
+		time_bench_calc_stats(rec);
+		if (rec->invoked_cnt < rec->loops) {
+			pr_warn("order:%d out:%d cpus:%d gfp:%s invalid, alloc failed\n",
+				order, m->outstanding, cpus, gfp_name);
+			kfree(cpu_tasks);
+			return 0;
+		}
+		sum += rec->tsc_cycles;
+		records++;
+	}
+	for (i = 0; i < cpus; i++) {
+		slow += m->cpu[i].slow;
+		allocs += m->cpu[i].allocs;
+	}
+	kfree(cpu_tasks);
+
+	per4k = (records ? sum / records : 0) >> order;
+	if (!base)
+		base = per4k;
+	if (!allocs)
+		allocs = 1;
+
+	pr_info("order:%d out:%d cpus:%d gfp:%s cycles-per-4K:%llu scale:%llu.%02llux"
+		" slow:%llu.%02llu%% pgalloc:%lu pgfree:%lu free_pages_diff:%ld\n",
+		order, m->outstanding, cpus, gfp_name, per4k,
+		div64_u64(per4k, base ? : 1),
+		div64_u64(per4k * 100, base ? : 1) % 100,
+		div64_u64(slow * 100, allocs),
+		div64_u64(slow * 10000, allocs) % 100,
+		pgalloc, pgfree, free_diff);
+	return per4k;
+}
+
+static int run_matrix(struct matrix *m, int max)
+{
+	/* Single CPU result per order x outstanding x gfp, for scale */
+	uint64_t base[NR_OUT_STEPS][ARRAY_SIZE(gfp_sets)];
+	cpumask_t cpumask;
+	int order, out, nr, cpus, g, o_idx;
+	uint64_t res;
+
+	for (order = 0; order <= max_order; order++) {
+		memset(base, 0, sizeof(base));
+		for (nr = 1; ; nr = min(nr * 2, max)) {
+			cpus = time_bench_cpumask_select(&cpumask, topology, nr);
+			if (cpus <= 0)
+				break;
+			for (out = 1, o_idx = 0; out <= max_outstanding;
+			     out *= 8, o_idx++) {
+				m->outstanding = out;
+				for (g = 0; g < ARRAY_SIZE(gfp_sets); g++) {
+					if (!(gfp_flags & (1 << g)))
+						continue;
+					m->gfp = gfp_sets[g].gfp;
+					res = run_cell(m, &cpumask, cpus, order,
+						       gfp_sets[g].name,
+						       base[o_idx][g]);
+					if (!base[o_idx][g])
+						base[o_idx][g] = res;
+				}
+				cond_resched();
+			}
+			if (nr == max)
+				break;
+		}
+	}
+	return 0;
+}
+
+int run_timing_tests(void)
+{
+	struct matrix m = {};
+	int max, i, err;
+
+	max = max_cpus ? : num_online_cpus();
+
+	m.cpu = kcalloc(max, sizeof(*m.cpu), GFP_KERNEL);
+	if (!m.cpu)
+		return -ENOMEM;
+	for (i = 0; i < max; i++) {
+		m.cpu[i].store = vzalloc(sizeof(struct page *) * max_outstanding);
+		if (!m.cpu[i].store) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	err = run_matrix(&m, max);
+out:
+	for (i = 0; i < max; i++)
+		vfree(m.cpu[i].store);
+	kfree(m.cpu);
+	return err;
+}
+
+static int __init page_bench07_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	/* Orders above PAGE_ALLOC_COSTLY_ORDER never use the pcp lists */
+	if (max_order > PAGE_ALLOC_COSTLY_ORDER || !max_outstanding ||
+	    max_outstanding > MAX_OUTSTANDING) {
+		pr_err("Invalid max_order:%d (max %d) or max_outstanding:%d (max %d)\n",
+		       max_order, PAGE_ALLOC_COSTLY_ORDER, max_outstanding,
+		       MAX_OUTSTANDING);
+		return -EINVAL;
+	}
+
+	if (run_timing_tests() < 0) {
+		return -ECANCELED;
+	}
+
+	return 0;
+}
+module_init(page_bench07_module_init);
+
+static void __exit page_bench07_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(page_bench07_module_exit);
+
+MODULE_DESCRIPTION("Benchmarking page allocator parallel scaling matrix");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,258 @@
+/*
+ * Benchmarking page allocator bulk API, upstream version
+ *
+ * page_bench04_bulk targets the non-upstream patch by Mel Gorman.
+ * Upstream kernel v5.13 got the bulk API in the variants:
+ *   alloc_pages_bulk_list()  - pages on a list (removed in v6.14)
+ *   alloc_pages_bulk_array() - fill NULL entries of an array
+ *                              (renamed alloc_pages_bulk() in v6.14)
+ * This benchmark compares the per page cost of both variants, for
+ * bulk sizes 1..512, against calling alloc_pages() bulk times.
+ * Available variants are selected by LINUX_VERSION_CODE.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/list.h>
+#include <linux/net.h> /* net_warn_ratelimited */
+
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+#define HAVE_BULK_ARRAY
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0) && \
+	LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+#define HAVE_BULK_LIST
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+#define my_alloc_pages_bulk_array(gfp, nr, array) \
+	alloc_pages_bulk(gfp, nr, array)
+#else
+#define my_alloc_pages_bulk_array(gfp, nr, array) \
+	alloc_pages_bulk_array(gfp, nr, array)
+#endif
+
+static int verbose=1;
+
+/* Quick and dirty way to unselect some of the benchmark tests, by
+ * encoding this in a module parameter flag.  This is useful when
+ * wanting to perf benchmark a specific benchmark test.
+ *
+ * Hint: Bash shells support writing binary number like: $((2#101010))
+ * Use like:
+ *  modprobe page_bench08_bulk_upstream loops=$((10**7)) run_flags=$((2#100))
+ */
+static unsigned long run_flags = 0xFFFFFFFF;
+module_param(run_flags, ulong, 0);
+MODULE_PARM_DESC(run_flags, "Hack way to limit bench to run");
+/* Count the bit number from the enum */
+enum benchmark_bit {
+	bit_run_bench_single,
+	bit_run_bench_bulk_list,
+	bit_run_bench_bulk_array,
+};
+#define bit(b)	(1 << (b))
+#define run_or_return(b) do { if (!(run_flags & (bit(b)))) return; } while (0)
+
+static uint32_t loops = 1000000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Iteration loops (pages per bulk size)");
+
+#define MAX_BULK 512
+static unsigned int bulk_max = MAX_BULK;
+module_param(bulk_max, uint, 0);
+MODULE_PARM_DESC(bulk_max, "Sweep bulk sizes 1,2,4.. up to this (max 512)");
+
+/* Single threaded benchmark, keep array off the stack */
+static struct page *array[MAX_BULK];
+
+/* Baseline: alloc_pages() called bulk times, then free */
+static int time_single_alloc_pages(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp = (GFP_ATOMIC | __GFP_NORETRY | __GFP_NOWARN);
+	uint64_t loops_cnt = 0;
+	size_t bulk = rec->step;
+	uint64_t i;
+	int j;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		for (j = 0; j < bulk; j++) {
+			array[j] = alloc_pages(gfp, 0);
+			if (unlikely(!array[j]))
+				break;
+		}
+		barrier();
+		loops_cnt += j;
+		while (j--) {
+			__free_pages(array[j], 0);
+			array[j] = NULL;
+		}
+		time_bench_hist_end(rec, t);
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+#ifdef HAVE_BULK_LIST
+static int time_bulk_list(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp = (GFP_ATOMIC | __GFP_NORETRY | __GFP_NOWARN);
+	struct page *page, *next;
+	uint64_t loops_cnt = 0;
+	size_t bulk = rec->step;
+	uint64_t i;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		struct list_head list;
+		unsigned long n;
+		uint64_t t = time_bench_hist_begin(rec);
+
+		INIT_LIST_HEAD(&list);
+		n = alloc_pages_bulk_list(gfp, bulk, &list);
+
+		if (verbose && unlikely(n < bulk))
+			net_warn_ratelimited(
+				"%s(): got less pages: %lu/%lu\n",
+				__func__, n, bulk);
+		barrier();
+		list_for_each_entry_safe(page, next, &list, lru) {
+			list_del(&page->lru);
+			__free_pages(page, 0);
+		}
+
+		/* NOTICE THIS COUNTS (bulk) alloc+free together */
+		loops_cnt += n;
+		time_bench_hist_end(rec, t);
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+#endif
+
+#ifdef HAVE_BULK_ARRAY
+static int time_bulk_array(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp = (GFP_ATOMIC | __GFP_NORETRY | __GFP_NOWARN);
+	uint64_t loops_cnt = 0;
+	size_t bulk = rec->step;
+	uint64_t i;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		unsigned long n;
+		int j;
+		uint64_t t = time_bench_hist_begin(rec);
+
+		/* Only NULL entries are populated, returns populated count */
+		n = my_alloc_pages_bulk_array(gfp, bulk, array);
+
+		if (verbose && unlikely(n < bulk))
+			net_warn_ratelimited(
+				"%s(): got less pages: %lu/%lu\n",
+				__func__, n, bulk);
+		barrier();
+		for (j = 0; j < n; j++) {
+			__free_pages(array[j], 0);
+			array[j] = NULL; /* Important to clear */
+		}
+
+		/* NOTICE THIS COUNTS (bulk) alloc+free together */
+		loops_cnt += n;
+		time_bench_hist_end(rec, t);
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+#endif
+
+/*
+ * Adjust loops according to bulk value, as each test should run
+ * approx same amount of time.  time_bench_loop() will complain if
+ * adjusting inside test func.
+ */
+void noinline run_bench_single(uint32_t loops, int bulk)
+{
+	run_or_return(bit_run_bench_single);
+	time_bench_loop(loops / bulk, bulk, "single_alloc_pages",
+			NULL, time_single_alloc_pages);
+}
+
+void noinline run_bench_bulk_list(uint32_t loops, int bulk)
+{
+	run_or_return(bit_run_bench_bulk_list);
+#ifdef HAVE_BULK_LIST
+	time_bench_loop(loops / bulk, bulk, "alloc_pages_bulk_list",
+			NULL, time_bulk_list);
+#endif
+}
+
+void noinline run_bench_bulk_array(uint32_t loops, int bulk)
+{
+	run_or_return(bit_run_bench_bulk_array);
+#ifdef HAVE_BULK_ARRAY
+	time_bench_loop(loops / bulk, bulk, "alloc_pages_bulk_array",
+			NULL, time_bulk_array);
+#endif
+}
+
+int run_timing_tests(void)
+{
+	int bulk;
+
+	for (bulk = 1; bulk <= bulk_max; bulk *= 2) {
+		run_bench_single(loops, bulk);
+		run_bench_bulk_list(loops, bulk);
+		run_bench_bulk_array(loops, bulk);
+		cond_resched();
+	}
+	return 0;
+}
+
+static int __init page_bench08_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!bulk_max || bulk_max > MAX_BULK) {
+		pr_err("Invalid bulk_max:%u (max %d)\n", bulk_max, MAX_BULK);
+		return -EINVAL;
+	}
+#ifndef HAVE_BULK_ARRAY
+	pr_warn("Kernel without alloc_pages_bulk API (v5.13), only baseline\n");
+#endif
+#ifdef CONFIG_DEBUG_PREEMPT
+	pr_warn("WARN: CONFIG_DEBUG_PREEMPT is enabled: this affect results\n");
+#endif
+	if (run_timing_tests() < 0) {
+		return -ECANCELED;
+	}
+
+	return 0;
+}
+module_init(page_bench08_module_init);
+
+static void __exit page_bench08_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(page_bench08_module_exit);
+
+MODULE_DESCRIPTION("Benchmarking upstream page allocator bulk API");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
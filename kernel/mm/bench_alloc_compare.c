@@ -0,0 +1,543 @@
+/*
+ * Allocator shootout: qmempool vs ring_mempool vs slab (and slab bulk)
+ * vs page_pool, as candidates for the buffer allocator of a driver
+ *
+ * All allocators are driven through the same ops table, and run the
+ * same workloads with the same loop count and time_bench reporting:
+ *  reuse:     single CPU, alloc one object and free it again
+ *  bulk16/64: single CPU, alloc a bulk of objects and free them again
+ *  pair:      producer/consumer CPU pair (different cores, same node),
+ *             e.g. RX CPU allocating, TX completion CPU freeing.
+ *             Objects are handed over in bulks of 16 via an SPSC
+ *             ring_queue, the same transfer cost for all allocators.
+ *  pair-node: the pair on different NUMA nodes (skipped on one node)
+ *
+ * At the end a single table is printed, cost in ns per object, alloc
+ * plus free for the single CPU workloads, and the slowest CPU (the
+ * throughput limit) for the pairs.
+ *
+ * qmempool and ring_mempool are not preemption safe and page_pool
+ * depends on softirq context, thus all run with BH disabled (the
+ * single CPU loops entirely, the pairs per bulk).  The object
+ * allocators share a kmem_cache of obj_size, page_pool objects are
+ * order-0 pages.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/slab.h>
+#include <linux/nodemask.h>
+#include <linux/qmempool.h>
+#include <linux/ring_queue.h>
+#ifdef BENCH_RING_MEMPOOL
+#include <linux/ring_mempool.h>
+#endif
+
+#include <linux/page_pool_compat.h>
+
+static int verbose=1;
+
+static unsigned long loops = 1000000;
+module_param(loops, ulong, 0);
+MODULE_PARM_DESC(loops, "Objects per CPU per workload (default 1000000)");
+
+static unsigned int obj_size = 256;
+module_param(obj_size, uint, 0);
+MODULE_PARM_DESC(obj_size, "Object size of the kmem_cache backed allocators (default 256)");
+
+static unsigned long alloc_mask = 0xFFFFFFFF;
+module_param(alloc_mask, ulong, 0);
+MODULE_PARM_DESC(alloc_mask, "Bitmask of allocators: slab=1 slab_bulk=2 qmempool=4 ring_mempool=8 page_pool=16");
+
+static unsigned long workload_mask = 0xFFFFFFFF;
+module_param(workload_mask, ulong, 0);
+MODULE_PARM_DESC(workload_mask, "Bitmask of workloads: reuse=1 bulk16=2 bulk64=4 pair=8 pair-node=16");
+
+#define ACMP_BULK_MAX	64
+#define ACMP_XFER_SIZE	1024	/* SPSC ring_queue between a CPU pair */
+#define ACMP_POOL_SIZE	4096	/* ring_mempool and page_pool */
+
+/* Shared by the kmem_cache backed allocators */
+static struct kmem_cache *acmp_slab;
+
+struct acmp_ops {
+	const char *name;
+	void *(*create)(void);
+	void  (*destroy)(void *pool);
+	/* Called with BH disabled.  Alloc all n objects or none, return n
+	 * or 0.  Free is told if the objects were allocated on another
+	 * CPU, as page_pool can only recycle direct on the same CPU.
+	 */
+	int   (*alloc_bulk)(void *pool, void **objs, int n);
+	void  (*free_bulk)(void *pool, void **objs, int n, bool remote);
+};
+
+/*** slab, one object at a time ***/
+static void *acmp_slab_create(void)
+{
+	return acmp_slab;
+}
+static void acmp_slab_destroy(void *pool)
+{
+}
+static int acmp_slab_alloc(void *pool, void **objs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		objs[i] = kmem_cache_alloc(pool, GFP_ATOMIC);
+		if (unlikely(!objs[i]))
+			goto fail;
+	}
+	return n;
+fail:
+	while (--i >= 0)
+		kmem_cache_free(pool, objs[i]);
+	return 0;
+}
+static void acmp_slab_free(void *pool, void **objs, int n, bool remote)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		kmem_cache_free(pool, objs[i]);
+}
+
+/*** slab bulk API ***/
+static int acmp_slab_bulk_alloc(void *pool, void **objs, int n)
+{
+	return kmem_cache_alloc_bulk(pool, GFP_ATOMIC, n, objs) ? n : 0;
+}
+static void acmp_slab_bulk_free(void *pool, void **objs, int n, bool remote)
+{
+	kmem_cache_free_bulk(pool, n, objs);
+}
+
+/*** qmempool, softirq variants as BH is disabled ***/
+static void *acmp_qmempool_create(void)
+{
+	return qmempool_create(64, 1024, 0, acmp_slab, GFP_KERNEL);
+}
+static void acmp_qmempool_destroy(void *pool)
+{
+	qmempool_destroy(pool);
+}
+static int acmp_qmempool_alloc(void *pool, void **objs, int n)
+{
+	int num = __qmempool_alloc_bulk_softirq(pool, objs, n, GFP_ATOMIC);
+
+	if (likely(num == n))
+		return n;
+	if (num > 0)
+		__qmempool_free_bulk_softirq(pool, objs, num);
+	return 0;
+}
+static void acmp_qmempool_free(void *pool, void **objs, int n, bool remote)
+{
+	__qmempool_free_bulk_softirq(pool, objs, n);
+}
+
+#ifdef BENCH_RING_MEMPOOL
+/*** ring_mempool, fixed population, per CPU cache of 32 ***/
+static void *acmp_ring_mempool_create(void)
+{
+	return ring_mempool_create(ACMP_POOL_SIZE, 32, acmp_slab, GFP_KERNEL);
+}
+static void acmp_ring_mempool_destroy(void *pool)
+{
+	ring_mempool_destroy(pool);
+}
+static int acmp_ring_mempool_alloc(void *pool, void **objs, int n)
+{
+	return ring_mempool_get_bulk(pool, objs, n) ? 0 : n;
+}
+static void acmp_ring_mempool_free(void *pool, void **objs, int n,
+				   bool remote)
+{
+	ring_mempool_put_bulk(pool, objs, n);
+}
+#endif
+
+/*** page_pool, a per RX-queue pool of pages ***/
+static void *acmp_page_pool_create(void)
+{
+	struct page_pool_params pp_params = {
+		.order = 0,
+		.flags = 0,
+		.pool_size = ACMP_POOL_SIZE,
+		.nid = NUMA_NO_NODE,
+		.dev = NULL, /* Only use for DMA mapping */
+		.dma_dir = DMA_BIDIRECTIONAL,
+	};
+	struct page_pool *pp;
+
+	pp = page_pool_create(&pp_params);
+	if (IS_ERR(pp)) {
+		pr_warn("%s: Error(%ld) creating page_pool\n",
+			__func__, PTR_ERR(pp));
+		return NULL;
+	}
+	return pp;
+}
+static void acmp_page_pool_destroy(void *pool)
+{
+	page_pool_destroy(pool);
+}
+static int acmp_page_pool_alloc(void *pool, void **objs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		objs[i] = page_pool_alloc_pages(pool, GFP_ATOMIC);
+		if (unlikely(!objs[i]))
+			goto fail;
+	}
+	return n;
+fail:
+	while (--i >= 0)
+		page_pool_recycle_direct(pool, objs[i]);
+	return 0;
+}
+static void acmp_page_pool_free(void *pool, void **objs, int n, bool remote)
+{
+	int i;
+
+	/* Remote CPU returns into the ptr_ring, like TX completion */
+	for (i = 0; i < n; i++) {
+		if (remote)
+			_page_pool_put_page(pool, objs[i], false);
+		else
+			page_pool_recycle_direct(pool, objs[i]);
+	}
+}
+
+/* Index is the alloc_mask bit, keep entries when compiled out */
+static const struct acmp_ops acmp_allocators[] = {
+	{
+		.name       = "slab",
+		.create     = acmp_slab_create,
+		.destroy    = acmp_slab_destroy,
+		.alloc_bulk = acmp_slab_alloc,
+		.free_bulk  = acmp_slab_free,
+	}, {
+		.name       = "slab_bulk",
+		.create     = acmp_slab_create,
+		.destroy    = acmp_slab_destroy,
+		.alloc_bulk = acmp_slab_bulk_alloc,
+		.free_bulk  = acmp_slab_bulk_free,
+	}, {
+		.name       = "qmempool",
+		.create     = acmp_qmempool_create,
+		.destroy    = acmp_qmempool_destroy,
+		.alloc_bulk = acmp_qmempool_alloc,
+		.free_bulk  = acmp_qmempool_free,
+	}, {
+		.name       = "ring_mempool",
+#ifdef BENCH_RING_MEMPOOL
+		.create     = acmp_ring_mempool_create,
+		.destroy    = acmp_ring_mempool_destroy,
+		.alloc_bulk = acmp_ring_mempool_alloc,
+		.free_bulk  = acmp_ring_mempool_free,
+#endif
+	}, {
+		.name       = "page_pool",
+		.create     = acmp_page_pool_create,
+		.destroy    = acmp_page_pool_destroy,
+		.alloc_bulk = acmp_page_pool_alloc,
+		.free_bulk  = acmp_page_pool_free,
+	},
+};
+#define ACMP_NR_ALLOCATORS	ARRAY_SIZE(acmp_allocators)
+
+struct acmp_workload {
+	const char *name;
+	int bulk;
+	bool pair;		/* Else single CPU */
+	const char *topology;	/* time_bench_cpumask_select() */
+};
+
+/* Index is the workload_mask bit */
+static const struct acmp_workload acmp_workloads[] = {
+	{ .name = "reuse",     .bulk = 1,  .pair = false, .topology = "first" },
+	{ .name = "bulk16",    .bulk = 16, .pair = false, .topology = "first" },
+	{ .name = "bulk64",    .bulk = 64, .pair = false, .topology = "first" },
+	{ .name = "pair",      .bulk = 16, .pair = true,  .topology = "core"  },
+	{ .name = "pair-node", .bulk = 16, .pair = true,  .topology = "cross" },
+};
+#define ACMP_NR_WORKLOADS	ARRAY_SIZE(acmp_workloads)
+
+/* Cost in ns * 1000 per object, zero if not run or failed */
+static u64 acmp_result[ACMP_NR_ALLOCATORS][ACMP_NR_WORKLOADS];
+
+struct acmp_run {
+	const struct acmp_ops *ops;
+	void *pool;
+	int bulk;
+	struct ring_queue *xfer;	/* Pair only */
+	bool abort;
+};
+
+static int time_bench_acmp_single(struct time_bench_record *rec, void *data)
+{
+	struct acmp_run *run = data;
+	const struct acmp_ops *ops = run->ops;
+	void *objs[ACMP_BULK_MAX];
+	uint64_t loops_cnt = 0;
+	int bulk = run->bulk;
+
+	local_bh_disable();
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (!ops->alloc_bulk(run->pool, objs, bulk)) {
+			pr_err("%s: out of objects\n", ops->name);
+			break;
+		}
+		barrier(); /* avoid compiler to optimize this loop */
+		ops->free_bulk(run->pool, objs, bulk, false);
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	local_bh_enable();
+
+	return loops_cnt;
+}
+
+/* cpu_idx 0 allocates and hands over objects, cpu_idx 1 frees them */
+static int time_bench_acmp_pair(struct time_bench_record *rec, void *data)
+{
+	struct acmp_run *run = data;
+	const struct acmp_ops *ops = run->ops;
+	bool producer = (rec->cpu_idx == 0);
+	uint64_t retry_max = rec->loops * 100;
+	void *objs[ACMP_BULK_MAX];
+	uint64_t loops_cnt = 0;
+	uint64_t retry_cnt = 0;
+	int n, enq;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops && !READ_ONCE(run->abort)) {
+		n = min_t(uint64_t, run->bulk, rec->loops - loops_cnt);
+		if (producer) {
+			local_bh_disable();
+			n = ops->alloc_bulk(run->pool, objs, n);
+			local_bh_enable();
+		} else {
+			n = ring_queue_sc_dequeue_burst(run->xfer, objs, n);
+		}
+		if (n == 0) {
+			/* Empty transfer ring (consumer), or objects held
+			 * in transfer ring and remote caches (producer)
+			 */
+			if (++retry_cnt > retry_max) {
+				pr_err("%s: abort on retries (cpu_idx:%d)\n",
+				       ops->name, rec->cpu_idx);
+				WRITE_ONCE(run->abort, true);
+			}
+			cpu_relax();
+			continue;
+		}
+
+		if (producer) {
+			for (enq = 0; enq < n && !READ_ONCE(run->abort); ) {
+				enq += ring_queue_sp_enqueue_burst(run->xfer,
+							&objs[enq], n - enq)
+					& RING_QUEUE_SZ_MASK;
+			}
+			if (enq < n) { /* Aborted, free what is left */
+				local_bh_disable();
+				ops->free_bulk(run->pool, &objs[enq], n - enq,
+					       false);
+				local_bh_enable();
+			}
+		} else {
+			local_bh_disable();
+			ops->free_bulk(run->pool, objs, n, true);
+			local_bh_enable();
+		}
+		loops_cnt += n;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark producer, as "step" gets printed */
+	rec->step = producer;
+	return loops_cnt;
+}
+
+/* Collect the slowest CPU, as time_bench_print_stats_cpumask() has
+ * calculated the per CPU stats.
+ */
+static u64 acmp_collect(struct time_bench_cpu *cpu_tasks,
+			const cpumask_t *cpumask)
+{
+	struct time_bench_record *rec;
+	u64 cost, max = 0;
+	int cpu;
+
+	for_each_cpu(cpu, cpumask) {
+		rec = &cpu_tasks[cpu].rec;
+		if (rec->invoked_cnt < loops)
+			return 0; /* Failed or aborted */
+		cost = rec->ns_per_call_quotient * 1000 +
+			rec->ns_per_call_decimal;
+		max = max(max, cost);
+	}
+	return max;
+}
+
+static void run_one(int a, int w)
+{
+	const struct acmp_workload *wl = &acmp_workloads[w];
+	const struct acmp_ops *ops = &acmp_allocators[a];
+	struct time_bench_cpu *cpu_tasks;
+	struct time_bench_sync sync;
+	struct acmp_run run = {};
+	void *objs[ACMP_BULK_MAX];
+	cpumask_t cpumask;
+	char desc[48];
+	int n;
+
+	if (wl->pair && !strcmp(wl->topology, "cross") &&
+	    num_online_nodes() < 2) {
+		if (verbose)
+			pr_info("Skip %s-%s, single NUMA node\n",
+				ops->name, wl->name);
+		return;
+	}
+	if (time_bench_cpumask_select(&cpumask, wl->topology,
+				      wl->pair ? 2 : 1) < (wl->pair ? 2 : 1))
+		return;
+
+	cpu_tasks = kcalloc(num_possible_cpus(), sizeof(*cpu_tasks),
+			    GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	run.ops = ops;
+	run.bulk = wl->bulk;
+	run.pool = ops->create();
+	if (!run.pool) {
+		pr_err("%s: cannot create pool\n", ops->name);
+		goto out;
+	}
+	if (wl->pair) {
+		run.xfer = ring_queue_create(ACMP_XFER_SIZE,
+					     RING_F_SP_ENQ | RING_F_SC_DEQ);
+		if (!run.xfer)
+			goto out_pool;
+	}
+
+	snprintf(desc, sizeof(desc), "%s-%s", ops->name, wl->name);
+	time_bench_run_concurrent(loops, wl->bulk, &run, &cpumask, &sync,
+				  cpu_tasks, wl->pair ? time_bench_acmp_pair :
+							time_bench_acmp_single);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, &cpumask);
+	acmp_result[a][w] = acmp_collect(cpu_tasks, &cpumask);
+
+	if (run.xfer) {
+		/* Objects left on abort */
+		local_bh_disable();
+		while ((n = ring_queue_sc_dequeue_burst(run.xfer, objs,
+							ACMP_BULK_MAX)))
+			ops->free_bulk(run.pool, objs, n, true);
+		local_bh_enable();
+		ring_queue_free(run.xfer);
+	}
+out_pool:
+	ops->destroy(run.pool);
+out:
+	kfree(cpu_tasks);
+}
+
+static void print_table(void)
+{
+	char line[128];
+	int a, w, len;
+	u64 cost;
+
+	pr_info("Allocator shootout, ns per object (obj_size:%u loops:%lu)\n",
+		obj_size, loops);
+	len = scnprintf(line, sizeof(line), "%-14s", "allocator");
+	for (w = 0; w < ACMP_NR_WORKLOADS; w++)
+		len += scnprintf(line + len, sizeof(line) - len, " %10s",
+				 acmp_workloads[w].name);
+	pr_info("%s\n", line);
+
+	for (a = 0; a < ACMP_NR_ALLOCATORS; a++) {
+		if (!(alloc_mask & (1UL << a)) || !acmp_allocators[a].create)
+			continue;
+		len = scnprintf(line, sizeof(line), "%-14s",
+				acmp_allocators[a].name);
+		for (w = 0; w < ACMP_NR_WORKLOADS; w++) {
+			cost = acmp_result[a][w];
+			if (cost)
+				len += scnprintf(line + len, sizeof(line) - len,
+						 " %6llu.%03llu",
+						 cost / 1000, cost % 1000);
+			else
+				len += scnprintf(line + len, sizeof(line) - len,
+						 " %10s", "-");
+		}
+		pr_info("%s\n", line);
+	}
+}
+
+static int run_benchmark_tests(void)
+{
+	int a, w;
+
+	if (obj_size < sizeof(void *) || obj_size > PAGE_SIZE) {
+		pr_err("Invalid obj_size:%u\n", obj_size);
+		return -EINVAL;
+	}
+
+	acmp_slab = kmem_cache_create("bench_alloc_compare", obj_size, 0,
+				      SLAB_HWCACHE_ALIGN, NULL);
+	if (!acmp_slab)
+		return -ENOMEM;
+
+	for (w = 0; w < ACMP_NR_WORKLOADS; w++) {
+		if (!(workload_mask & (1UL << w)))
+			continue;
+		for (a = 0; a < ACMP_NR_ALLOCATORS; a++) {
+			if (!(alloc_mask & (1UL << a)))
+				continue;
+			if (!acmp_allocators[a].create) {
+				if (verbose && w == 0)
+					pr_info("Skip %s, not compiled in\n",
+						acmp_allocators[a].name);
+				continue;
+			}
+			run_one(a, w);
+		}
+	}
+	print_table();
+
+	kmem_cache_destroy(acmp_slab);
+	return 0;
+}
+
+static int __init bench_alloc_compare_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (run_benchmark_tests() < 0)
+		return -ECANCELED;
+
+	return 0;
+}
+module_init(bench_alloc_compare_module_init);
+
+static void __exit bench_alloc_compare_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(bench_alloc_compare_module_exit);
+
+MODULE_DESCRIPTION("Allocator shootout: qmempool, ring_mempool, slab, slab bulk and page_pool");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,232 @@
+/*
+ * page_scan - parallel walk of all struct page's
+ *
+ * See include/linux/page_scan.h
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/memory_hotplug.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/prefetch.h>
+#include <linux/atomic.h>
+#include <linux/page_scan.h>
+
+static struct workqueue_struct *page_scan_wq;
+
+struct page_scan_chunk {
+	struct zone *zone;
+	unsigned long start_pfn;
+	unsigned long end_pfn;
+};
+
+struct page_scan_ctx {
+	const struct page_scan_params *p;
+	unsigned long chunk_pfns;
+	unsigned int batch;
+	unsigned int prefetch;
+
+	struct page_scan_chunk *chunks;
+	unsigned int nr_chunks;
+	atomic_t next_chunk;	/* Dynamic distribution over workers */
+	atomic_long_t yielded;
+	bool stop;
+};
+
+struct page_scan_worker {
+	struct work_struct work;
+	struct page_scan_ctx *ctx;
+	unsigned int idx;
+	struct page *pages[PAGE_SCAN_MAX_BATCH];
+};
+
+/* Prefetching ahead computes pfn_to_page() of PFNs not yet checked,
+ * which is only safe when that is plain arithmetic.
+ */
+#if defined(CONFIG_SPARSEMEM_VMEMMAP) || defined(CONFIG_FLATMEM)
+#define PAGE_SCAN_CAN_PREFETCH 1
+#else
+#define PAGE_SCAN_CAN_PREFETCH 0
+#endif
+
+static unsigned int page_scan_nr_chunks(unsigned long chunk_pfns)
+{
+	struct zone *zone;
+	unsigned int nr = 0;
+
+	for_each_populated_zone(zone)
+		nr += DIV_ROUND_UP(zone->spanned_pages, chunk_pfns);
+	return nr;
+}
+
+static void page_scan_build_chunks(struct page_scan_ctx *ctx)
+{
+	struct zone *zone;
+	unsigned int i = 0;
+
+	for_each_populated_zone(zone) {
+		unsigned long pfn = zone->zone_start_pfn;
+		unsigned long end_pfn = zone_end_pfn(zone);
+
+		for (; pfn < end_pfn && i < ctx->nr_chunks;
+		     pfn += ctx->chunk_pfns) {
+			ctx->chunks[i].zone = zone;
+			ctx->chunks[i].start_pfn = pfn;
+			ctx->chunks[i].end_pfn = min(pfn + ctx->chunk_pfns,
+						     end_pfn);
+			i++;
+		}
+	}
+	/* Zones spanning can change (hotplug) between count and build */
+	ctx->nr_chunks = i;
+}
+
+/* Returns false when the scan must stop */
+static bool page_scan_chunk(struct page_scan_worker *w,
+			    struct page_scan_chunk *c)
+{
+	struct page_scan_ctx *ctx = w->ctx;
+	const struct page_scan_params *p = ctx->p;
+	unsigned long pfn, ahead = ctx->prefetch;
+	unsigned int n = 0;
+	long cnt = 0;
+	bool ret = true;
+
+	for (pfn = c->start_pfn; pfn < c->end_pfn; pfn++) {
+		struct page *page;
+
+		if (PAGE_SCAN_CAN_PREFETCH && ahead && pfn + ahead < c->end_pfn)
+			prefetch(pfn_to_page(pfn + ahead));
+
+		page = pfn_to_online_page(pfn);
+		if (!page)
+			continue;
+		/* Only yield pages belonging to this zone */
+		if (page_zone(page) != c->zone)
+			continue;
+
+		w->pages[n++] = page;
+		if (n < ctx->batch)
+			continue;
+		cnt += n;
+		if (p->fn(w->pages, n, w->idx, p->data) ||
+		    READ_ONCE(ctx->stop)) {
+			n = 0;
+			ret = false;
+			break;
+		}
+		n = 0;
+	}
+	if (n) {
+		cnt += n;
+		if (p->fn(w->pages, n, w->idx, p->data))
+			ret = false;
+	}
+	atomic_long_add(cnt, &ctx->yielded);
+	return ret;
+}
+
+static void page_scan_work_fn(struct work_struct *work)
+{
+	struct page_scan_worker *w =
+		container_of(work, struct page_scan_worker, work);
+	struct page_scan_ctx *ctx = w->ctx;
+	unsigned int i;
+
+	while (!READ_ONCE(ctx->stop)) {
+		i = atomic_inc_return(&ctx->next_chunk) - 1;
+		if (i >= ctx->nr_chunks)
+			break;
+		if (!page_scan_chunk(w, &ctx->chunks[i]))
+			WRITE_ONCE(ctx->stop, true);
+		cond_resched();
+	}
+}
+
+long page_scan_run(const struct page_scan_params *params)
+{
+	const struct cpumask *mask = params->cpumask ? : cpu_online_mask;
+	struct page_scan_worker *workers;
+	struct page_scan_ctx ctx = {};
+	unsigned int nr_workers = 0, i;
+	long ret;
+	int cpu;
+
+	if (!params->fn)
+		return -EINVAL;
+
+	ctx.p = params;
+	ctx.chunk_pfns = params->chunk_pfns ? : PAGE_SCAN_CHUNK_PFNS;
+	ctx.batch = clamp_t(unsigned int, params->batch ? : PAGE_SCAN_MAX_BATCH,
+			    1, PAGE_SCAN_MAX_BATCH);
+	ctx.prefetch = params->prefetch ? : PAGE_SCAN_PREFETCH;
+	atomic_set(&ctx.next_chunk, 0);
+	atomic_long_set(&ctx.yielded, 0);
+
+	cpus_read_lock();
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		nr_workers++;
+	if (!nr_workers) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	ctx.nr_chunks = page_scan_nr_chunks(ctx.chunk_pfns);
+	ctx.chunks = vmalloc(sizeof(*ctx.chunks) * (ctx.nr_chunks ? : 1));
+	if (!ctx.chunks) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+	page_scan_build_chunks(&ctx);
+
+	workers = kcalloc(nr_workers, sizeof(*workers), GFP_KERNEL);
+	if (!workers) {
+		ret = -ENOMEM;
+		goto out_chunks;
+	}
+
+	i = 0;
+	for_each_cpu_and(cpu, mask, cpu_online_mask) {
+		struct page_scan_worker *w = &workers[i];
+
+		INIT_WORK(&w->work, page_scan_work_fn);
+		w->ctx = &ctx;
+		w->idx = i++;
+		queue_work_on(cpu, page_scan_wq, &w->work);
+	}
+	for (i = 0; i < nr_workers; i++)
+		flush_work(&workers[i].work);
+
+	ret = atomic_long_read(&ctx.yielded);
+	kfree(workers);
+out_chunks:
+	vfree(ctx.chunks);
+out_unlock:
+	cpus_read_unlock();
+	return ret;
+}
+EXPORT_SYMBOL_GPL(page_scan_run);
+
+static int __init page_scan_module_init(void)
+{
+	/* Bound (per CPU) workqueue, scans can run for a long time */
+	page_scan_wq = alloc_workqueue("page_scan", WQ_CPU_INTENSIVE, 0);
+	if (!page_scan_wq)
+		return -ENOMEM;
+	return 0;
+}
+module_init(page_scan_module_init);
+
+static void __exit page_scan_module_exit(void)
+{
+	destroy_workqueue(page_scan_wq);
+}
+module_exit(page_scan_module_exit);
+
+MODULE_DESCRIPTION("Parallel walk of all struct page's (page_scan)");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -13,61 +13,328 @@
 #include <linux/percpu.h>
 #include <linux/qmempool.h>
 #include <linux/log2.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+#include <linux/jump_label.h>
+#include <linux/poison.h>
+#include <linux/ratelimit.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/shrinker.h>
+#endif
+#ifdef QMEMPOOL_STATS
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+static struct dentry *qmempool_debugfs_dir;
+#endif
 
-/* Due to hotplug CPU support, we need access to all qmempools
+/* All qmempools, for the shrinker to drain cached elements back to
+ * slab under memory pressure.  Also needed by hotplug CPU support,
  * in-order to cleanup elements in localq for the CPU going offline.
  *
  * TODO: implement HOTPLUG_CPU
-#ifdef CONFIG_HOTPLUG_CPU
+ */
 static LIST_HEAD(qmempool_list);
-static DEFINE_SPINLOCK(qmempool_list_lock);
-#endif
+static DEFINE_MUTEX(qmempool_list_mutex);
+
+/* Debug mode, see qmempool_debug_alloc() in qmempool.h.  The magic
+ * marking a poisoned element is mixed with an epoch, bumped every time
+ * debug gets enabled, as elements stay marked after turning it off.
+ */
+DEFINE_STATIC_KEY_FALSE(qmempool_debug_key);
+EXPORT_SYMBOL(qmempool_debug_key);
+
+#define QMEMPOOL_DEBUG_MAGIC	((unsigned long)0x71f7ee0d71f7ee0dULL)
+#define QMEMPOOL_DEBUG_OFFSET	(2 * sizeof(void *))
+
+static unsigned long qmempool_debug_epoch;
+
+static int qmempool_debug_set(const char *val, const struct kernel_param *kp)
+{
+	bool on;
+	int err;
+
+	err = kstrtobool(val, &on);
+	if (err)
+		return err;
+	if (on && !static_key_enabled(&qmempool_debug_key)) {
+		WRITE_ONCE(qmempool_debug_epoch, qmempool_debug_epoch + 1);
+		static_branch_enable(&qmempool_debug_key);
+	} else if (!on) {
+		static_branch_disable(&qmempool_debug_key);
+	}
+	return 0;
+}
+
+static int qmempool_debug_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%d\n", static_key_enabled(&qmempool_debug_key));
+}
+
+static const struct kernel_param_ops qmempool_debug_ops = {
+	.set = qmempool_debug_set,
+	.get = qmempool_debug_get,
+};
+module_param_cb(debug, &qmempool_debug_ops, NULL, 0644);
+MODULE_PARM_DESC(debug, "Poison cached elements, detect double free and use-after-free");
+
+static inline unsigned long qmempool_debug_magic(void)
+{
+	return QMEMPOOL_DEBUG_MAGIC ^ READ_ONCE(qmempool_debug_epoch);
+}
+
+static void qmempool_debug_report(struct qmempool *pool, void *elem,
+				  const char *what, void *at)
+{
+	static DEFINE_RATELIMIT_STATE(rs, DEFAULT_RATELIMIT_INTERVAL,
+				      DEFAULT_RATELIMIT_BURST);
+
+	atomic_inc(&pool->debug_errors);
+	if (!__ratelimit(&rs))
+		return;
+	pr_err("%s: pool %p elem %p size %u offset %ld\n", what, pool, elem,
+	       pool->elem_size, at ? (long)(at - elem) : 0L);
+	print_hex_dump(KERN_ERR, "elem: ", DUMP_PREFIX_OFFSET, 16, 1, elem,
+		       min_t(uint32_t, pool->elem_size, 64), false);
+	WARN_ONCE(1, "qmempool: %s\n", what);
+}
+
+/* Marks the element poisoned, thus a 2nd free while cached is seen */
+bool __qmempool_debug_free(struct qmempool *pool, void *elem)
+{
+	unsigned long *magic = (unsigned long *)elem + 1;
+
+	if (unlikely(pool->elem_size <= QMEMPOOL_DEBUG_OFFSET))
+		return true;
+	if (unlikely(*magic == qmempool_debug_magic())) {
+		qmempool_debug_report(pool, elem, "double free", NULL);
+		return false; /* don't cache it twice */
+	}
+	memset(elem + QMEMPOOL_DEBUG_OFFSET, POISON_FREE,
+	       pool->elem_size - QMEMPOOL_DEBUG_OFFSET);
+	*magic = qmempool_debug_magic();
+	return true;
+}
+EXPORT_SYMBOL(__qmempool_debug_free);
+
+void __qmempool_debug_alloc(struct qmempool *pool, void *elem)
+{
+	unsigned long *magic = (unsigned long *)elem + 1;
+	void *bad;
+
+	if (unlikely(pool->elem_size <= QMEMPOOL_DEBUG_OFFSET))
+		return;
+	if (*magic != qmempool_debug_magic())
+		return; /* fresh from backend, or freed while debug off */
+	*magic = 0;
+	bad = memchr_inv(elem + QMEMPOOL_DEBUG_OFFSET, POISON_FREE,
+			 pool->elem_size - QMEMPOOL_DEBUG_OFFSET);
+	if (unlikely(bad))
+		qmempool_debug_report(pool, elem, "use-after-free", bad);
+}
+EXPORT_SYMBOL(__qmempool_debug_alloc);
+
+/* Leaving the pool, unmark, else a later owner of the memory could
+ * hit a false double free
  */
+static inline void __qmempool_debug_release(struct qmempool *pool, void *elem)
+{
+	if (static_branch_unlikely(&qmempool_debug_key) &&
+	    pool->elem_size > QMEMPOOL_DEBUG_OFFSET)
+		((unsigned long *)elem)[1] = 0;
+}
+
+/* Backend: elements come from pool->kmem, or for page backed pools
+ * (kmem == NULL) are the page_address() of order-N pages.
+ */
+static void *__qmempool_backend_alloc(struct qmempool *pool, gfp_t gfp_mask,
+				      int nid)
+{
+	struct page *page;
+
+	if (likely(pool->kmem))
+		return kmem_cache_alloc_node(pool->kmem, gfp_mask, nid);
+
+	page = alloc_pages_node(nid, gfp_mask | __GFP_NOWARN |
+				(pool->page_order ? __GFP_COMP : 0),
+				pool->page_order);
+	return page ? page_address(page) : NULL;
+}
+
+/* Returns the number of elements stored in @elems, zero or @n for
+ * kmem_cache backed pools (the slab bulk API is all-or-nothing).
+ */
+static int __qmempool_backend_alloc_bulk(struct qmempool *pool,
+					 gfp_t gfp_mask, int nid,
+					 int n, void **elems)
+{
+	int i;
+
+	/* The slab bulk API has no node argument, but allocates from
+	 * this CPU's slab, thus from nid (the caller's cpu_to_mem()
+	 * node) unless slab falls back, same as kmem_cache_alloc_node().
+	 */
+	if (likely(pool->kmem))
+		return kmem_cache_alloc_bulk(pool->kmem, gfp_mask, n, elems) ?
+			n : 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+	if (pool->page_order == 0) {
+		struct page **pages = (struct page **)elems;
+		int num;
+
+		/* The page bulk API only fills NULL entries */
+		memset(elems, 0, n * sizeof(*elems));
+# if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+		num = alloc_pages_bulk_node(gfp_mask | __GFP_NOWARN, nid,
+					    n, pages);
+# else
+		num = alloc_pages_bulk_array_node(gfp_mask | __GFP_NOWARN,
+						  nid, n, pages);
+# endif
+		for (i = 0; i < num; i++)
+			elems[i] = page_address(pages[i]);
+		return num;
+	}
+#endif
+	for (i = 0; i < n; i++) {
+		elems[i] = __qmempool_backend_alloc(pool, gfp_mask, nid);
+		if (!elems[i])
+			break;
+	}
+	return i;
+}
+
+static inline void __qmempool_backend_free(struct qmempool *pool, void *elem)
+{
+	__qmempool_debug_release(pool, elem);
+	if (likely(pool->kmem))
+		kmem_cache_free(pool->kmem, elem);
+	else
+		__free_pages(virt_to_page(elem), pool->page_order);
+}
+
+static void __qmempool_backend_free_bulk(struct qmempool *pool, int n,
+					 void **elems)
+{
+	int i;
+
+	if (static_branch_unlikely(&qmempool_debug_key)) {
+		for (i = 0; i < n; i++)
+			__qmempool_debug_release(pool, elems[i]);
+	}
+	if (likely(pool->kmem)) {
+		kmem_cache_free_bulk(pool->kmem, n, elems);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		__free_pages(virt_to_page(elems[i]), pool->page_order);
+}
 
 void qmempool_destroy(struct qmempool *pool)
 {
 	void *elem = NULL;
-	int j;
+	int i, j, nid;
+
+	mutex_lock(&qmempool_list_mutex);
+	if (!list_empty(&pool->list))
+		list_del_init(&pool->list);
+	mutex_unlock(&qmempool_list_mutex);
+
+#ifdef QMEMPOOL_STATS
+	debugfs_remove_recursive(pool->stats_dentry);
+#endif
 
 	if (pool->percpu) {
 		for_each_possible_cpu(j) {
 			struct qmempool_percpu *cpu =
 				per_cpu_ptr(pool->percpu, j);
 
+			for (i = 0; i < cpu->remote_cnt; i++)
+				__qmempool_backend_free(pool, cpu->remote[i]);
+			cpu->remote_cnt = 0;
+			for (i = 0; i < cpu->xcpu_cnt; i++)
+				__qmempool_backend_free(pool, cpu->xcpu[i]);
+			cpu->xcpu_cnt = 0;
+			if (cpu->xset) {
+				while (alf_queue_set_dequeue(cpu->xset,
+							     &elem, 1) == 1)
+					__qmempool_backend_free(pool, elem);
+				alf_queue_set_free(cpu->xset);
+				cpu->xset = NULL;
+			}
+
+			if (!cpu->localq)
+				continue;
 			while (alf_mc_dequeue(cpu->localq, &elem, 1) == 1)
-				kmem_cache_free(pool->kmem, elem);
+				__qmempool_backend_free(pool, elem);
 			BUG_ON(!alf_queue_empty(cpu->localq));
 			alf_queue_free(cpu->localq);
 		}
 		free_percpu(pool->percpu);
 	}
 
+	if (pool->any) {
+		for_each_possible_cpu(j) {
+			struct qmempool_any_cpu *c = per_cpu_ptr(pool->any, j);
+
+			while ((elem = c->freelist)) {
+				c->freelist = *(void **)elem;
+				__qmempool_backend_free(pool, elem);
+			}
+		}
+		free_percpu(pool->any);
+	}
+
 	if (pool->sharedq) {
-		while (alf_mc_dequeue(pool->sharedq, &elem, 1) == 1)
-			kmem_cache_free(pool->kmem, elem);
-		BUG_ON(!alf_queue_empty(pool->sharedq));
-		alf_queue_free(pool->sharedq);
+		for_each_node(nid) {
+			struct alf_queue *sharedq = pool->sharedq[nid];
+
+			if (!sharedq)
+				continue;
+			while (alf_mc_dequeue(sharedq, &elem, 1) == 1)
+				__qmempool_backend_free(pool, elem);
+			BUG_ON(!alf_queue_empty(sharedq));
+			alf_queue_free(sharedq);
+		}
+		kfree(pool->sharedq);
 	}
 
+#ifdef QMEMPOOL_STATS
+	free_percpu(pool->stats);
+#endif
 	kfree(pool);
 }
 EXPORT_SYMBOL(qmempool_destroy);
 
-struct qmempool *
-qmempool_create(uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
-		struct kmem_cache *kmem, gfp_t gfp_mask)
+static struct qmempool *
+__qmempool_create(uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
+		  struct kmem_cache *kmem, unsigned int page_order,
+		  gfp_t gfp_mask, unsigned int bulk, unsigned int refill_mult)
 {
 	struct qmempool *pool;
-	int i, j, num;
+	int i, j, nid, num;
 	void *elem;
 
 	/* Validate constraints, e.g. due to bulking */
-	if (localq_sz < QMEMPOOL_BULK) {
+	if (bulk < 2 || bulk > QMEMPOOL_BULK_MAX) {
+		pr_err("%s() bulk(%u) outside 2..%d\n",
+		       __func__, bulk, QMEMPOOL_BULK_MAX);
+		return NULL;
+	}
+	if (refill_mult < 1 || refill_mult > QMEMPOOL_REFILL_MULTIPLIER_MAX) {
+		pr_err("%s() refill multiplier(%u) outside 1..%d\n",
+		       __func__, refill_mult, QMEMPOOL_REFILL_MULTIPLIER_MAX);
+		return NULL;
+	}
+	if (localq_sz < bulk) {
 		pr_err("%s() localq size(%d) too small for bulking\n",
 		       __func__, localq_sz);
 		return NULL;
 	}
-	if (sharedq_sz < (QMEMPOOL_BULK * QMEMPOOL_REFILL_MULTIPLIER)) {
+	if (sharedq_sz < bulk * refill_mult) {
 		pr_err("%s() sharedq size(%d) too small for bulk refill\n",
 		       __func__, sharedq_sz);
 		return NULL;
@@ -82,41 +349,65 @@ qmempool_create(uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
 		       __func__, prealloc, sharedq_sz);
 		return NULL;
 	}
-	if ((prealloc % QMEMPOOL_BULK) != 0) {
+	if ((prealloc % bulk) != 0) {
 		pr_warn("%s() prealloc(%d) should be div by BULK size(%d)\n",
-			__func__, prealloc, QMEMPOOL_BULK);
-	}
-	if (!kmem) {
-		pr_err("%s() kmem_cache is a NULL ptr\n",  __func__);
-		return NULL;
+			__func__, prealloc, bulk);
 	}
 
 	pool = kzalloc(sizeof(*pool), gfp_mask);
 	if (!pool)
 		return NULL;
 	pool->kmem     = kmem;
+	pool->page_order = page_order;
+	pool->elem_size = kmem ? kmem_cache_size(kmem) : PAGE_SIZE << page_order;
 	pool->gfp_mask = gfp_mask;
+	pool->localq_sz = localq_sz;
+	pool->bulk     = bulk;
+	pool->refill_mult = refill_mult;
+	INIT_LIST_HEAD(&pool->list);
 
-	/* MPMC (Multi-Producer-Multi-Consumer) queue */
-	pool->sharedq = alf_queue_alloc(sharedq_sz, gfp_mask);
-	if (IS_ERR_OR_NULL(pool->sharedq)) {
-		pr_err("%s() failed to create shared queue(%d) ERR_PTR:0x%p\n",
-		       __func__, sharedq_sz, pool->sharedq);
+#ifdef QMEMPOOL_STATS
+	pool->stats = alloc_percpu_gfp(struct qmempool_stats, gfp_mask);
+	if (!pool->stats) {
 		qmempool_destroy(pool);
 		return NULL;
 	}
+#endif
 
-	pool->prealloc = prealloc;
-	for (i = 0; i < prealloc; i++) {
-		elem = kmem_cache_alloc(pool->kmem, gfp_mask);
-		if (!elem) {
-			pr_err("%s() kmem_cache out of memory?!\n",  __func__);
+	pool->sharedq = kcalloc(nr_node_ids, sizeof(*pool->sharedq), gfp_mask);
+	if (!pool->sharedq) {
+		qmempool_destroy(pool);
+		return NULL;
+	}
+
+	/* MPMC (Multi-Producer-Multi-Consumer) queue per node */
+	for_each_node(nid) {
+		struct alf_queue *sharedq = alf_queue_alloc(sharedq_sz, gfp_mask);
+
+		if (IS_ERR_OR_NULL(sharedq)) {
+			pr_err("%s() failed to create shared queue(%d) node:%d\n",
+			       __func__, sharedq_sz, nid);
 			qmempool_destroy(pool);
 			return NULL;
 		}
-		/* Could use the SP version given it is not visible yet */
-		num = alf_mp_enqueue(pool->sharedq, &elem, 1);
-		BUG_ON(num <= 0);
+		pool->sharedq[nid] = sharedq;
+	}
+
+	/* Prealloc is per node having memory */
+	pool->prealloc = prealloc;
+	for_each_node_state(nid, N_MEMORY) {
+		for (i = 0; i < prealloc; i++) {
+			elem = __qmempool_backend_alloc(pool, gfp_mask, nid);
+			if (!elem) {
+				pr_err("%s() kmem_cache out of memory?!\n",
+				       __func__);
+				qmempool_destroy(pool);
+				return NULL;
+			}
+			/* Could use the SP version given it is not visible yet */
+			num = alf_mp_enqueue(pool->sharedq[nid], &elem, 1);
+			BUG_ON(num <= 0);
+		}
 	}
 
 	pool->percpu = alloc_percpu(struct qmempool_percpu);
@@ -126,37 +417,136 @@ qmempool_create(uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
 		return NULL;
 	}
 
+	/* Any context variant, freelist depth same as localq */
+	pool->any_max = min_t(uint32_t, localq_sz, QMEMPOOL_ANY_CNT_MASK);
+	pool->any = alloc_percpu(struct qmempool_any_cpu);
+	if (pool->any == NULL) {
+		pr_err("%s() failed to alloc percpu any\n", __func__);
+		qmempool_destroy(pool);
+		return NULL;
+	}
+	for_each_possible_cpu(j)
+		per_cpu_ptr(pool->any, j)->tid = (unsigned long)j
+			<< QMEMPOOL_ANY_CNT_BITS;
+
 	/* SPSC (Single-Consumer-Single-Producer) queue per CPU */
 	for_each_possible_cpu(j) {
 		struct qmempool_percpu *cpu = per_cpu_ptr(pool->percpu, j);
 
+		cpu->nid = cpu_to_mem(j);
+		/* Start shallow, grown when the CPU needs it */
+		cpu->depth = min_t(uint32_t, localq_sz, bulk * refill_mult);
 		cpu->localq = alf_queue_alloc(localq_sz, gfp_mask);
 		if (IS_ERR_OR_NULL(cpu->localq)) {
 			pr_err("%s() failed alloc localq(sz:%d) on cpu:%d\n",
 			       __func__, localq_sz, j);
+			cpu->localq = NULL;
 			qmempool_destroy(pool);
 			return NULL;
 		}
 	}
 
+	mutex_lock(&qmempool_list_mutex);
+	list_add(&pool->list, &qmempool_list);
+	mutex_unlock(&qmempool_list_mutex);
+
 	return pool;
 }
+
+struct qmempool *
+qmempool_create_tuned(uint32_t localq_sz, uint32_t sharedq_sz,
+		      uint32_t prealloc, struct kmem_cache *kmem,
+		      gfp_t gfp_mask, unsigned int bulk,
+		      unsigned int refill_mult)
+{
+	if (!kmem) {
+		pr_err("%s() kmem_cache is a NULL ptr\n",  __func__);
+		return NULL;
+	}
+	return __qmempool_create(localq_sz, sharedq_sz, prealloc, kmem, 0,
+				 gfp_mask, bulk, refill_mult);
+}
+EXPORT_SYMBOL(qmempool_create_tuned);
+
+struct qmempool *
+qmempool_create(uint32_t localq_sz, uint32_t sharedq_sz, uint32_t prealloc,
+		struct kmem_cache *kmem, gfp_t gfp_mask)
+{
+	return qmempool_create_tuned(localq_sz, sharedq_sz, prealloc, kmem,
+				     gfp_mask, QMEMPOOL_BULK,
+				     QMEMPOOL_REFILL_MULTIPLIER);
+}
 EXPORT_SYMBOL(qmempool_create);
 
+/* Page backed pool, caching order @order pages.  The pages must be
+ * in the linear mapping, thus no __GFP_HIGHMEM.
+ */
+struct qmempool *
+qmempool_create_pages(uint32_t localq_sz, uint32_t sharedq_sz,
+		      uint32_t prealloc, unsigned int order, gfp_t gfp_mask)
+{
+	if (order > PAGE_ALLOC_COSTLY_ORDER) {
+		pr_err("%s() page order(%u) above %d\n",
+		       __func__, order, PAGE_ALLOC_COSTLY_ORDER);
+		return NULL;
+	}
+	if (gfp_mask & __GFP_HIGHMEM) {
+		pr_err("%s() highmem pages not supported\n", __func__);
+		return NULL;
+	}
+	return __qmempool_create(localq_sz, sharedq_sz, prealloc, NULL, order,
+				 gfp_mask, QMEMPOOL_BULK,
+				 QMEMPOOL_REFILL_MULTIPLIER);
+}
+EXPORT_SYMBOL(qmempool_create_pages);
+
+/* Adaptive localq depth
+ *
+ * Every QMEMPOOL_ADAPT_EVENTS slow-path events (localq empty refills
+ * and localq full overflows) the CPU's depth is re-evaluated:
+ *  - Both kinds seen: alloc/free swings exceed the depth, double it
+ *    (up to localq size) to absorb them locally.
+ *  - Mostly one kind: the CPU is a net allocator or a net freer, here
+ *    a deep localq only hoards elements, halve it (down to bulk).
+ * Thus, an idle pool or one-sided CPUs keep few elements cached.
+ */
+#define QMEMPOOL_ADAPT_EVENTS	32
+
+static void __qmempool_adapt(struct qmempool *pool,
+			     struct qmempool_percpu *cpu)
+{
+	unsigned int r = cpu->refills, o = cpu->overflows;
+
+	if (likely(r + o < QMEMPOOL_ADAPT_EVENTS))
+		return;
+
+	if (r >= QMEMPOOL_ADAPT_EVENTS / 4 && o >= QMEMPOOL_ADAPT_EVENTS / 4)
+		cpu->depth = min(cpu->depth * 2, pool->localq_sz);
+	else
+		cpu->depth = max_t(unsigned int, cpu->depth / 2,
+				   qmempool_bulk(pool));
+	cpu->refills = cpu->overflows = 0;
+}
+
 /* Element handling
  */
 
 /* This function is called when sharedq runs-out of elements.
- * Thus, sharedq needs to be refilled (enq) with elems from slab.
+ * Thus, sharedq of node @nid needs to be refilled (enq) with elems
+ * from slab, allocated on that node.
  *
  * Caller must assure this is called in an preemptive safe context due
  * to alf_mp_enqueue() call.
  */
-void *__qmempool_alloc_from_slab(struct qmempool *pool, gfp_t gfp_mask)
+void *__qmempool_alloc_from_slab(struct qmempool *pool, gfp_t gfp_mask,
+				 int nid)
 {
-	void *elems[QMEMPOOL_BULK]; /* on stack variable */
-	void *elem;
-	int num, i, j;
+	/* One element returned, the rest refills sharedq */
+	int n = qmempool_bulk(pool) * qmempool_refill_mult(pool) + 1;
+	struct alf_queue *sharedq = pool->sharedq[nid];
+	void *elems[QMEMPOOL_BULK_MAX + 1]; /* on stack variable */
+	void *elem = NULL;
+	int num, chunk, got, i;
 
 	/* Cannot use SLAB that can sleep if (gfp_mask & __GFP_WAIT),
 	 * else preemption disable/enable scheme becomes too complicated
@@ -167,35 +557,39 @@ void *__qmempool_alloc_from_slab(struct qmempool *pool, gfp_t gfp_mask)
 	/* 71baba4b92d ("mm, page_alloc: rename __GFP_WAIT to __GFP_RECLAIM") */
 	BUG_ON(gfp_mask & __GFP_DIRECT_RECLAIM);
 #endif
+	qmempool_stat_inc(pool, slab_alloc);
 
-	elem = kmem_cache_alloc(pool->kmem, gfp_mask);
-	if (elem == NULL) /* slab depleted, no reason to call below allocs */
-		return NULL;
-
-	/* SLAB considerations, we need a kmem_cache interface that
-	 * supports allocating a bulk of elements.
+	/* Default tuned pools do this in a single backend bulk call,
+	 * larger refills are split in chunks of the on-stack array.
 	 */
+	while (n > 0) {
+		chunk = min(n, QMEMPOOL_BULK_MAX + 1);
+		got = __qmempool_backend_alloc_bulk(pool, gfp_mask, nid,
+						    chunk, elems);
+		if (unlikely(got == 0))
+			break;
+		n -= got;
+		i = 0;
+		if (!elem)
+			elem = elems[i++];
 
-	for (i = 0; i < QMEMPOOL_REFILL_MULTIPLIER; i++) {
-		for (j = 0; j < QMEMPOOL_BULK; j++) {
-			elems[j] = kmem_cache_alloc(pool->kmem, gfp_mask);
-			/* Handle if slab gives us NULL elem */
-			if (elems[j] == NULL) {
-				pr_err("%s() ARGH - slab returned NULL",
-				       __func__);
-				num = alf_mp_enqueue(pool->sharedq, elems, j-1);
-				BUG_ON(num == 0); //FIXME handle
-				return elem;
-			}
-		}
-		num = alf_mp_enqueue(pool->sharedq, elems, QMEMPOOL_BULK);
-		/* FIXME: There is a theoretical chance that multiple
-		 * CPU enter here, refilling sharedq at the same time,
-		 * thus we must handle "full" situation, for now die
-		 * hard so someone will need to fix this.
+		/* Multiple CPUs can refill sharedq at the same time,
+		 * thus it can be full, give back what did not fit.
 		 */
-		BUG_ON(num == 0); /* sharedq should have room */
+		num = alf_mp_enqueue_burst(sharedq, &elems[i], got - i);
+		if (unlikely(num < got - i)) {
+			qmempool_stat_add(pool, sharedq_overflow,
+					  got - i - num);
+			__qmempool_backend_free_bulk(pool, got - i - num,
+						     &elems[i + num]);
+			break;
+		}
+		if (unlikely(got < chunk)) /* backend low */
+			break;
 	}
+	/* Backend low, try a single elem */
+	if (unlikely(!elem))
+		elem = __qmempool_backend_alloc(pool, gfp_mask, nid);
 
 	/* What about refilling localq here? (else it will happen on
 	 * next cycle, and will cost an extra cmpxchg).
@@ -210,14 +604,32 @@ void *__qmempool_alloc_from_slab(struct qmempool *pool, gfp_t gfp_mask)
  * to alf_mp_dequeue() call.
  */
 void *__qmempool_alloc_from_sharedq(struct qmempool *pool, gfp_t gfp_mask,
-				    struct alf_queue *localq)
+				    struct qmempool_percpu *cpu)
 {
-	void *elems[QMEMPOOL_BULK]; /* on stack variable */
+	struct alf_queue *localq = cpu->localq;
+	void *elems[QMEMPOOL_BULK_MAX]; /* on stack variable */
 	void *elem;
 	int num;
 
+	cpu->refills++;
+	__qmempool_adapt(pool, cpu);
+
+	/* Elements other CPUs freed back to this CPU, no atomic ops */
+	num = 0;
+	if (cpu->xset) {
+		num = alf_queue_set_dequeue(cpu->xset, elems,
+					    qmempool_bulk(pool));
+		if (num > 0)
+			qmempool_stat_inc(pool, remote_cpu_refill);
+	}
+
 	/* Costs atomic "cmpxchg", but amortize cost by bulk dequeue */
-	num = alf_mc_dequeue(pool->sharedq, elems, QMEMPOOL_BULK);
+	if (num == 0) {
+		num = alf_mc_dequeue(pool->sharedq[cpu->nid], elems,
+				     qmempool_bulk(pool));
+		if (num > 0)
+			qmempool_stat_inc(pool, sharedq_refill);
+	}
 	if (likely(num > 0)) {
 		/* Consider prefetching data part of elements here, it
 		 * should be an optimal place to hide memory prefetching.
@@ -233,7 +645,7 @@ void *__qmempool_alloc_from_sharedq(struct qmempool *pool, gfp_t gfp_mask,
 		return elem;
 	}
 	/* Use slab if sharedq runs out of elements */
-	elem = __qmempool_alloc_from_slab(pool, gfp_mask);
+	elem = __qmempool_alloc_from_slab(pool, gfp_mask, cpu->nid);
 	return elem;
 }
 EXPORT_SYMBOL(__qmempool_alloc_from_sharedq);
@@ -241,22 +653,21 @@ EXPORT_SYMBOL(__qmempool_alloc_from_sharedq);
 /* Called when sharedq is full. Thus also make room in sharedq,
  * besides also freeing the "elems" given.
  */
-bool __qmempool_free_to_slab(struct qmempool *pool, void **elems, int n)
+bool __qmempool_free_to_slab(struct qmempool *pool, void **elems, int n,
+			     struct alf_queue *sharedq)
 {
-	int num, i, j;
-	/* SLAB considerations, we could use kmem_cache interface that
-	 * supports returning a bulk of elements.
-	 */
+	int num, i;
 
 	/* free these elements for real */
-	for (i = 0; i < n; i++)
-		kmem_cache_free(pool->kmem, elems[i]);
+	qmempool_stat_add(pool, sharedq_overflow, n);
+	__qmempool_backend_free_bulk(pool, n, elems);
 
-	/* Make room in sharedq for next round */
-	for (i = 0; i < QMEMPOOL_REFILL_MULTIPLIER; i++) {
-		num = alf_mc_dequeue(pool->sharedq, elems, QMEMPOOL_BULK);
-		for (j = 0; j < num; j++)
-			kmem_cache_free(pool->kmem, elems[j]);
+	/* Make room in sharedq for next round, elems holds a pool bulk */
+	for (i = 0; i < qmempool_refill_mult(pool); i++) {
+		num = alf_mc_dequeue(sharedq, elems, qmempool_bulk(pool));
+		if (num == 0)
+			break;
+		__qmempool_backend_free_bulk(pool, num, elems);
 	}
 	return true;
 }
@@ -268,14 +679,20 @@ bool __qmempool_free_to_slab(struct qmempool *pool, void **elems, int n)
  * MUST be called from a preemptive safe context.
  */
 void __qmempool_free_to_sharedq(void *elem, struct qmempool *pool,
-				struct alf_queue *localq)
+				struct qmempool_percpu *cpu)
 {
-	void *elems[QMEMPOOL_BULK]; /* on stack variable */
+	struct alf_queue *localq = cpu->localq;
+	struct alf_queue *sharedq = pool->sharedq[cpu->nid];
+	void *elems[QMEMPOOL_BULK_MAX]; /* on stack variable */
 	int num_enq, num_deq;
 
+	cpu->overflows++;
+	__qmempool_adapt(pool, cpu);
+	qmempool_stat_inc(pool, localq_overflow);
+
 	elems[0] = elem;
 	/* Make room in localq */
-	num_deq = alf_sc_dequeue(localq, &elems[1], QMEMPOOL_BULK-1);
+	num_deq = alf_sc_dequeue(localq, &elems[1], qmempool_bulk(pool) - 1);
 	if (unlikely(num_deq == 0))
 		goto failed;
 	num_deq++; /* count first 'elem' */
@@ -283,7 +700,7 @@ void __qmempool_free_to_sharedq(void *elem, struct qmempool *pool,
 	/* Successful dequeued 'num_deq' elements from localq, "free"
 	 * these elems by enqueuing to sharedq
 	 */
-	num_enq = alf_mp_enqueue(pool->sharedq, elems, num_deq);
+	num_enq = alf_mp_enqueue(sharedq, elems, num_deq);
 	if (likely(num_enq == num_deq)) /* Success enqueued to sharedq */
 		return;
 
@@ -295,7 +712,7 @@ void __qmempool_free_to_sharedq(void *elem, struct qmempool *pool,
 	 * is an API that might change.
 	 */
 
-	__qmempool_free_to_slab(pool, elems, num_deq);
+	__qmempool_free_to_slab(pool, elems, num_deq, sharedq);
 	return;
 failed:
 	/* dequeing from a full localq should always be possible */
@@ -303,6 +720,328 @@ failed:
 }
 EXPORT_SYMBOL(__qmempool_free_to_sharedq);
 
+/* Return the pending remote elements to their node's sharedq, in a
+ * single bulk enqueue.  If that sharedq is full, free them to slab.
+ */
+static void __qmempool_flush_remote(struct qmempool *pool,
+				    struct qmempool_percpu *cpu)
+{
+	int n = cpu->remote_cnt;
+
+	cpu->remote_cnt = 0;
+	if (alf_mp_enqueue(pool->sharedq[cpu->remote_nid], cpu->remote, n) == n)
+		return;
+
+	qmempool_stat_add(pool, sharedq_overflow, n);
+	__qmempool_backend_free_bulk(pool, n, cpu->remote);
+}
+
+/* Free of an element belonging to another node than this CPU's.
+ * Remote elements are collected per CPU, while they belong to the
+ * same node, and returned to the owning node's sharedq in bulk.  Thus,
+ * they never end-up in a localq serving this node.
+ *
+ * MUST be called from a preemptive safe context.
+ */
+void __qmempool_free_remote(void *elem, struct qmempool *pool,
+			    struct qmempool_percpu *cpu)
+{
+	int nid = qmempool_elem_nid(elem);
+
+	qmempool_stat_inc(pool, free_remote);
+	if (cpu->remote_cnt && cpu->remote_nid != nid)
+		__qmempool_flush_remote(pool, cpu);
+
+	cpu->remote_nid = nid;
+	cpu->remote[cpu->remote_cnt++] = elem;
+	if (cpu->remote_cnt == qmempool_bulk(pool))
+		__qmempool_flush_remote(pool, cpu);
+}
+EXPORT_SYMBOL(__qmempool_free_remote);
+
+/* Return the pending elements to their owner CPU, in a single SPSC
+ * enqueue into the owner's xset.  If the owner is not keeping up
+ * (queue full), free them the normal way on this CPU.
+ */
+static void __qmempool_flush_xcpu(struct qmempool *pool,
+				  struct qmempool_percpu *cpu)
+{
+	struct qmempool_percpu *owner;
+	int n = cpu->xcpu_cnt;
+
+	cpu->xcpu_cnt = 0;
+	owner = per_cpu_ptr(pool->percpu, cpu->xcpu_owner);
+	if (alf_queue_set_enqueue(owner->xset, smp_processor_id(),
+				  cpu->xcpu, n) == n)
+		return;
+
+	/* Already passed the debug free check */
+	__qmempool_free_bulk_to_sharedq(pool, cpu, cpu->xcpu, n);
+}
+
+/* Free of an element allocated by CPU @owner, another CPU than this.
+ * Collected per CPU while they belong to the same owner, and handed
+ * back in bulk.  Each (freeing CPU, owner CPU) pair has its own SPSC
+ * queue, avoiding the sharedq cmpxchg on both sides.
+ *
+ * MUST be called from a preemptive safe context.
+ */
+void __qmempool_free_remote_cpu(void *elem, struct qmempool *pool,
+				struct qmempool_percpu *cpu, int owner)
+{
+	qmempool_stat_inc(pool, free_remote_cpu);
+	if (cpu->xcpu_cnt && cpu->xcpu_owner != owner)
+		__qmempool_flush_xcpu(pool, cpu);
+
+	cpu->xcpu_owner = owner;
+	cpu->xcpu[cpu->xcpu_cnt++] = elem;
+	if (cpu->xcpu_cnt == qmempool_bulk(pool))
+		__qmempool_flush_xcpu(pool, cpu);
+}
+EXPORT_SYMBOL(__qmempool_free_remote_cpu);
+
+/* Enable qmempool_free_to_cpu() returning elements to their owner CPU.
+ * Allocates per CPU a set of nr_cpu_ids SPSC queues of @qsize elements
+ * (power-of-2, at least the pool bulk size), thus memory grows with
+ * the square of CPUs.  Must be called from sleepable context, before
+ * the pool is used.
+ */
+int qmempool_remote_cpu_enable(struct qmempool *pool, u32 qsize)
+{
+	struct alf_queue_set *set;
+	int j;
+
+	if (qsize < qmempool_bulk(pool) || !is_power_of_2(qsize)) {
+		pr_err("%s() remote CPU queue size(%u) invalid\n",
+		       __func__, qsize);
+		return -EINVAL;
+	}
+
+	for_each_possible_cpu(j) {
+		set = alf_queue_set_alloc(nr_cpu_ids, qsize, GFP_KERNEL);
+		if (IS_ERR(set)) {
+			for_each_possible_cpu(j) {
+				struct qmempool_percpu *cpu =
+					per_cpu_ptr(pool->percpu, j);
+
+				if (cpu->xset)
+					alf_queue_set_free(cpu->xset);
+				cpu->xset = NULL;
+			}
+			return PTR_ERR(set);
+		}
+		per_cpu_ptr(pool->percpu, j)->xset = set;
+	}
+	pool->remote_cpu = true;
+	return 0;
+}
+EXPORT_SYMBOL(qmempool_remote_cpu_enable);
+
+/* Called by bulk alloc when localq could not satisfy the request.
+ * Dequeue straight into the caller's array, skipping localq, and
+ * refill sharedq from slab when it runs empty.
+ *
+ * Caller must assure this is called in an preemptive safe context.
+ */
+int __qmempool_alloc_bulk_from_sharedq(struct qmempool *pool, gfp_t gfp_mask,
+				       struct qmempool_percpu *cpu,
+				       void **elems, int n)
+{
+	struct alf_queue *sharedq = pool->sharedq[cpu->nid];
+	int num = 0, got;
+	void *elem;
+
+	cpu->refills++;
+	__qmempool_adapt(pool, cpu);
+
+	if (cpu->xset) {
+		num = alf_queue_set_dequeue(cpu->xset, elems, n);
+		if (num)
+			qmempool_stat_inc(pool, remote_cpu_refill);
+	}
+
+	while (num < n) {
+		/* Costs atomic "cmpxchg", once per (up to) n elements */
+		got = alf_mc_dequeue(sharedq, &elems[num], n - num);
+		if (got)
+			qmempool_stat_inc(pool, sharedq_refill);
+		num += got;
+		if (num == n)
+			break;
+
+		/* sharedq empty, refill it from slab (returns one) */
+		elem = __qmempool_alloc_from_slab(pool, gfp_mask, cpu->nid);
+		if (elem == NULL)
+			break;
+		elems[num++] = elem;
+	}
+	return num;
+}
+EXPORT_SYMBOL(__qmempool_alloc_bulk_from_sharedq);
+
+/* Called by bulk free when the elements did not all fit in localq,
+ * or may contain remote node elements.  Fill localq as far as
+ * possible, the rest goes to sharedq in bulk, and to slab if sharedq
+ * is full.
+ *
+ * MUST be called from a preemptive safe context.
+ */
+void __qmempool_free_bulk_to_sharedq(struct qmempool *pool,
+				     struct qmempool_percpu *cpu,
+				     void **elems, int n)
+{
+	struct alf_queue *sharedq = pool->sharedq[cpu->nid];
+	int i, num, local;
+
+	/* Hand remote elements to their node, compact local ones */
+	if (nr_node_ids > 1) {
+		for (i = 0, local = 0; i < n; i++) {
+			if (qmempool_elem_nid(elems[i]) != cpu->nid)
+				__qmempool_free_remote(elems[i], pool, cpu);
+			else
+				elems[local++] = elems[i];
+		}
+		n = local;
+	}
+
+	/* Fill localq up to its depth */
+	local = (int)cpu->depth - (int)alf_queue_count(cpu->localq);
+	num = 0;
+	if (local > 0)
+		num = alf_sp_enqueue_burst(cpu->localq, elems, min(n, local));
+	elems += num;
+	n     -= num;
+	if (n > 0) {
+		cpu->overflows++;
+		__qmempool_adapt(pool, cpu);
+		qmempool_stat_inc(pool, localq_overflow);
+	}
+
+	while (n > 0) {
+		num = alf_mp_enqueue_burst(sharedq, elems, n);
+		if (num == 0)
+			break;
+		elems += num;
+		n     -= num;
+	}
+
+	/* sharedq full, free remaining elements for real */
+	if (n > 0) {
+		qmempool_stat_add(pool, sharedq_overflow, n);
+		__qmempool_backend_free_bulk(pool, n, elems);
+	}
+}
+EXPORT_SYMBOL(__qmempool_free_bulk_to_sharedq);
+
+/* Any context variant, slow-paths
+ *
+ * With IRQs disabled nothing else on this CPU updates its freelist, a
+ * task preempted in the middle of the fast-path retries as the tid is
+ * still updated.  NMI context is not supported.
+ */
+static inline void __qmempool_any_push_locked(struct qmempool_any_cpu *c,
+					      void *elem)
+{
+	*(void **)elem = c->freelist;
+	c->freelist = elem;
+	c->tid = __qmempool_any_tid(c->tid, 1);
+}
+
+static inline void *__qmempool_any_pop_locked(struct qmempool_any_cpu *c)
+{
+	void *elem = c->freelist;
+
+	if (elem) {
+		c->freelist = *(void **)elem;
+		c->tid = __qmempool_any_tid(c->tid, -1);
+	}
+	return elem;
+}
+
+/* Freelist empty: refill a bulk from this node's sharedq (or slab).
+ * Also the IRQ disabled alloc without double-word cmpxchg.
+ */
+void *__qmempool_alloc_any_slow(struct qmempool *pool, gfp_t gfp_mask)
+{
+	void *elems[QMEMPOOL_BULK_MAX]; /* on stack variable */
+	struct qmempool_any_cpu *c;
+	struct alf_queue *sharedq;
+	unsigned long flags;
+	void *elem;
+	int num, i;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(pool->any);
+	elem = __qmempool_any_pop_locked(c);
+	if (elem) { /* !qmempool_any_has_cmpxchg(), or refilled meanwhile */
+		qmempool_stat_inc(pool, localq_hit);
+		goto out;
+	}
+
+	sharedq = pool->sharedq[numa_mem_id()];
+	num = alf_mc_dequeue(sharedq, elems, qmempool_bulk(pool));
+	if (num == 0) {
+		elem = __qmempool_alloc_from_slab(pool, gfp_mask,
+						  numa_mem_id());
+		goto out;
+	}
+	qmempool_stat_inc(pool, sharedq_refill);
+	elem = elems[0];
+	for (i = 1; i < num; i++)
+		__qmempool_any_push_locked(c, elems[i]);
+out:
+	local_irq_restore(flags);
+	return elem;
+}
+EXPORT_SYMBOL(__qmempool_alloc_any_slow);
+
+/* Freelist full, or remote node element: return a bulk to sharedq.
+ * Also the IRQ disabled free without double-word cmpxchg.
+ */
+void __qmempool_free_any_slow(struct qmempool *pool, void *elem)
+{
+	void *elems[QMEMPOOL_BULK_MAX]; /* on stack variable */
+	struct qmempool_any_cpu *c;
+	struct alf_queue *sharedq;
+	unsigned long flags;
+	int nid, num, n;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(pool->any);
+	nid = qmempool_elem_nid(elem);
+	if (unlikely(nid != numa_mem_id())) {
+		/* Remote, directly to owning node */
+		qmempool_stat_inc(pool, free_remote);
+		if (alf_mp_enqueue(pool->sharedq[nid], &elem, 1) != 1) {
+			qmempool_stat_inc(pool, sharedq_overflow);
+			__qmempool_backend_free(pool, elem);
+		}
+		goto out;
+	}
+	if ((c->tid & QMEMPOOL_ANY_CNT_MASK) < pool->any_max) {
+		__qmempool_any_push_locked(c, elem);
+		goto out;
+	}
+
+	/* Full, move elem and a bulk off the freelist to sharedq */
+	qmempool_stat_inc(pool, localq_overflow);
+	sharedq = pool->sharedq[nid];
+	elems[0] = elem;
+	for (num = 1; num < qmempool_bulk(pool); num++) {
+		elems[num] = __qmempool_any_pop_locked(c);
+		if (!elems[num])
+			break;
+	}
+	n = alf_mp_enqueue_burst(sharedq, elems, num);
+	if (n < num) { /* sharedq full */
+		qmempool_stat_add(pool, sharedq_overflow, num - n);
+		__qmempool_backend_free_bulk(pool, num - n, &elems[n]);
+	}
+out:
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(__qmempool_free_any_slow);
+
 /* API users can choose to use "__" prefixed versions for inlining */
 void *qmempool_alloc(struct qmempool *pool, gfp_t gfp_mask)
 {
@@ -328,6 +1067,322 @@ void qmempool_free_softirq(struct qmempool *pool, void *elem)
 }
 EXPORT_SYMBOL(qmempool_free_softirq);
 
+void qmempool_free_to_cpu(struct qmempool *pool, void *elem, int owner)
+{
+	__qmempool_free_to_cpu(pool, elem, owner);
+}
+EXPORT_SYMBOL(qmempool_free_to_cpu);
+
+int qmempool_alloc_bulk(struct qmempool *pool, void **elems, int n,
+			gfp_t gfp_mask)
+{
+	return __qmempool_alloc_bulk(pool, elems, n, gfp_mask);
+}
+EXPORT_SYMBOL(qmempool_alloc_bulk);
+
+void qmempool_free_bulk(struct qmempool *pool, void **elems, int n)
+{
+	__qmempool_free_bulk(pool, elems, n);
+}
+EXPORT_SYMBOL(qmempool_free_bulk);
+
+void *qmempool_alloc_any(struct qmempool *pool, gfp_t gfp_mask)
+{
+	return __qmempool_alloc_any(pool, gfp_mask);
+}
+EXPORT_SYMBOL(qmempool_alloc_any);
+
+void qmempool_free_any(struct qmempool *pool, void *elem)
+{
+	__qmempool_free_any(pool, elem);
+}
+EXPORT_SYMBOL(qmempool_free_any);
+
+struct page *qmempool_alloc_page(struct qmempool *pool, gfp_t gfp_mask)
+{
+	void *elem = __qmempool_alloc(pool, gfp_mask);
+
+	return elem ? virt_to_page(elem) : NULL;
+}
+EXPORT_SYMBOL(qmempool_alloc_page);
+
+void qmempool_free_page(struct qmempool *pool, struct page *page)
+{
+	if (likely(__qmempool_page_recyclable(page)))
+		__qmempool_free(pool, page_address(page));
+	else
+		put_page(page);
+}
+EXPORT_SYMBOL(qmempool_free_page);
+
+#ifdef QMEMPOOL_STATS
+void qmempool_stats_sum(struct qmempool *pool, struct qmempool_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct qmempool_stats *st = per_cpu_ptr(pool->stats, cpu);
+
+		sum->localq_hit       += st->localq_hit;
+		sum->sharedq_refill   += st->sharedq_refill;
+		sum->slab_alloc       += st->slab_alloc;
+		sum->localq_overflow  += st->localq_overflow;
+		sum->sharedq_overflow += st->sharedq_overflow;
+		sum->free_remote      += st->free_remote;
+		sum->free_remote_cpu  += st->free_remote_cpu;
+		sum->remote_cpu_refill += st->remote_cpu_refill;
+	}
+}
+EXPORT_SYMBOL(qmempool_stats_sum);
+
+static int qmempool_stats_show(struct seq_file *m, void *v)
+{
+	struct qmempool *pool = m->private;
+	struct qmempool_stats sum;
+	unsigned int depth_min = UINT_MAX, depth_max = 0;
+	int cpu, nid;
+
+	qmempool_stats_sum(pool, &sum);
+	for_each_possible_cpu(cpu) {
+		unsigned int d = per_cpu_ptr(pool->percpu, cpu)->depth;
+
+		depth_min = min(depth_min, d);
+		depth_max = max(depth_max, d);
+	}
+	seq_printf(m, "bulk:%d refill_multiplier:%d localq_sz:%u depth:%u-%u\n",
+		   pool->bulk, pool->refill_mult, pool->localq_sz,
+		   depth_min, depth_max);
+	seq_printf(m, "localq_hit:%llu sharedq_refill:%llu slab_alloc:%llu\n",
+		   sum.localq_hit, sum.sharedq_refill, sum.slab_alloc);
+	seq_printf(m, "localq_overflow:%llu sharedq_overflow:%llu free_remote:%llu\n",
+		   sum.localq_overflow, sum.sharedq_overflow, sum.free_remote);
+	if (pool->remote_cpu)
+		seq_printf(m, "free_remote_cpu:%llu remote_cpu_refill:%llu\n",
+			   sum.free_remote_cpu, sum.remote_cpu_refill);
+	for_each_node(nid)
+		seq_printf(m, "sharedq node:%d count:%d\n", nid,
+			   alf_queue_count(pool->sharedq[nid]));
+	return 0;
+}
+
+static int qmempool_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, qmempool_stats_show, inode->i_private);
+}
+
+static const struct file_operations qmempool_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= qmempool_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Expose pool stats as /sys/kernel/debug/qmempool/<name>/stats,
+ * removed again by qmempool_destroy()
+ */
+int qmempool_stats_register(struct qmempool *pool, const char *name)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(name, qmempool_debugfs_dir);
+	if (IS_ERR(dir))
+		return PTR_ERR(dir);
+	debugfs_create_file("stats", 0444, dir, pool, &qmempool_stats_fops);
+	pool->stats_dentry = dir;
+	return 0;
+}
+EXPORT_SYMBOL(qmempool_stats_register);
+#endif /* QMEMPOOL_STATS */
+
+/* Memory pressure: shrinker drains sharedq elements to slab, and
+ * queues a work on every CPU that drains its localq (and any context
+ * freelist) and resets its depth.  The per CPU caches can only be
+ * touched from their own CPU, thus the work.  IRQs are disabled around
+ * each queue access, as pool users can run in softirq (and hardirq,
+ * any context variant) on the same CPU.
+ */
+static DEFINE_PER_CPU(struct work_struct, qmempool_trim_work);
+
+static void __qmempool_trim_this_cpu(struct qmempool *pool)
+{
+	void *elems[QMEMPOOL_BULK_MAX]; /* on stack variable */
+	struct qmempool_percpu *cpu;
+	struct qmempool_any_cpu *c;
+	unsigned long flags;
+	int num;
+
+	do {
+		local_irq_save(flags);
+		cpu = this_cpu_ptr(pool->percpu);
+		cpu->depth = qmempool_bulk(pool);
+		cpu->refills = cpu->overflows = 0;
+		num = alf_sc_dequeue(cpu->localq, elems, qmempool_bulk(pool));
+		if (num == 0 && cpu->xset)
+			num = alf_queue_set_dequeue(cpu->xset, elems,
+						    qmempool_bulk(pool));
+		if (num == 0 && cpu->remote_cnt)
+			__qmempool_flush_remote(pool, cpu);
+		if (num == 0 && cpu->xcpu_cnt)
+			__qmempool_flush_xcpu(pool, cpu);
+		local_irq_restore(flags);
+		if (num)
+			__qmempool_backend_free_bulk(pool, num, elems);
+		cond_resched();
+	} while (num);
+
+	do {
+		local_irq_save(flags);
+		c = this_cpu_ptr(pool->any);
+		for (num = 0; num < QMEMPOOL_BULK; num++) {
+			elems[num] = __qmempool_any_pop_locked(c);
+			if (!elems[num])
+				break;
+		}
+		local_irq_restore(flags);
+		if (num)
+			__qmempool_backend_free_bulk(pool, num, elems);
+		cond_resched();
+	} while (num);
+}
+
+static void qmempool_trim_work_fn(struct work_struct *work)
+{
+	struct qmempool *pool;
+
+	mutex_lock(&qmempool_list_mutex);
+	list_for_each_entry(pool, &qmempool_list, list)
+		__qmempool_trim_this_cpu(pool);
+	mutex_unlock(&qmempool_list_mutex);
+}
+
+static unsigned long qmempool_shrink_count(struct shrinker *shrink,
+					   struct shrink_control *sc)
+{
+	struct qmempool *pool;
+	unsigned long count = 0;
+	int cpu, nid;
+
+	/* Racy reads, only an estimate is needed */
+	mutex_lock(&qmempool_list_mutex);
+	list_for_each_entry(pool, &qmempool_list, list) {
+		for_each_node(nid)
+			count += alf_queue_count(pool->sharedq[nid]);
+		for_each_possible_cpu(cpu) {
+			count += alf_queue_count(
+				per_cpu_ptr(pool->percpu, cpu)->localq);
+			count += READ_ONCE(per_cpu_ptr(pool->any, cpu)->tid) &
+				QMEMPOOL_ANY_CNT_MASK;
+		}
+	}
+	mutex_unlock(&qmempool_list_mutex);
+
+	return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long qmempool_shrink_scan(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	void *elems[QMEMPOOL_BULK_MAX]; /* on stack variable */
+	struct qmempool *pool;
+	unsigned long freed = 0;
+	unsigned long flags;
+	int cpu, nid, num;
+
+	if (!mutex_trylock(&qmempool_list_mutex))
+		return SHRINK_STOP;
+	list_for_each_entry(pool, &qmempool_list, list) {
+		for_each_node(nid) {
+			do {
+				local_irq_save(flags);
+				num = alf_mc_dequeue(pool->sharedq[nid], elems,
+						     QMEMPOOL_BULK);
+				local_irq_restore(flags);
+				if (num)
+					__qmempool_backend_free_bulk(pool, num,
+							     elems);
+				freed += num;
+			} while (num && freed < sc->nr_to_scan);
+		}
+	}
+	mutex_unlock(&qmempool_list_mutex);
+
+	/* The per CPU caches drain asynchronously */
+	for_each_online_cpu(cpu)
+		schedule_work_on(cpu, per_cpu_ptr(&qmempool_trim_work, cpu));
+
+	return freed;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct shrinker *qmempool_shrinker;
+
+static int qmempool_shrinker_register(void)
+{
+	qmempool_shrinker = shrinker_alloc(0, "qmempool");
+	if (!qmempool_shrinker)
+		return -ENOMEM;
+	qmempool_shrinker->count_objects = qmempool_shrink_count;
+	qmempool_shrinker->scan_objects  = qmempool_shrink_scan;
+	shrinker_register(qmempool_shrinker);
+	return 0;
+}
+
+static void qmempool_shrinker_unregister(void)
+{
+	shrinker_free(qmempool_shrinker);
+}
+#else
+static struct shrinker qmempool_shrinker = {
+	.count_objects	= qmempool_shrink_count,
+	.scan_objects	= qmempool_shrink_scan,
+	.seeks		= DEFAULT_SEEKS,
+};
+
+static int qmempool_shrinker_register(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	return register_shrinker(&qmempool_shrinker, "qmempool");
+#else
+	return register_shrinker(&qmempool_shrinker);
+#endif
+}
+
+static void qmempool_shrinker_unregister(void)
+{
+	unregister_shrinker(&qmempool_shrinker);
+}
+#endif
+
+static int __init qmempool_module_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		INIT_WORK(per_cpu_ptr(&qmempool_trim_work, cpu),
+			  qmempool_trim_work_fn);
+#ifdef QMEMPOOL_STATS
+	qmempool_debugfs_dir = debugfs_create_dir("qmempool", NULL);
+#endif
+
+	return qmempool_shrinker_register();
+}
+module_init(qmempool_module_init);
+
+static void __exit qmempool_module_exit(void)
+{
+	int cpu;
+
+	qmempool_shrinker_unregister();
+	for_each_possible_cpu(cpu)
+		cancel_work_sync(per_cpu_ptr(&qmempool_trim_work, cpu));
+#ifdef QMEMPOOL_STATS
+	debugfs_remove_recursive(qmempool_debugfs_dir);
+#endif
+}
+module_exit(qmempool_module_exit);
+
 MODULE_DESCRIPTION("Quick queue based mempool (qmempool)");
 MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
 MODULE_LICENSE("GPL");
@@ -10,6 +10,9 @@
 #include <linux/skbuff.h>
 
 #include <linux/qmempool.h>
+#ifdef BENCH_RING_MEMPOOL
+#include <linux/ring_mempool.h>
+#endif
 
 static int verbose=1;
 
@@ -22,7 +25,7 @@ static void print_qstats(struct qmempool *pool,
 	preempt_disable();
 	cpu = this_cpu_ptr(pool->percpu);
 	localq_sz  = alf_queue_count(cpu->localq);
-	sharedq_sz = alf_queue_count(pool->sharedq);
+	sharedq_sz = alf_queue_count(pool->sharedq[cpu->nid]);
 	if (verbose >= 2)
 		pr_info("%s() qstats localq:%d sharedq:%d (%s)\n", func,
 			localq_sz, sharedq_sz, msg);
@@ -41,6 +44,8 @@ enum behavior_type {
 	NORMAL_INLINE,
 	SOFTIRQ,
 	SOFTIRQ_INLINE,
+	ANY,		/* Any context variant, this_cpu cmpxchg */
+	ANY_INLINE,
 };
 
 /* For comparison benchmark against the fastpath of the
@@ -50,7 +55,7 @@ static int benchmark_kmem_cache_fastpath_reuse(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_elem *elem;
 	struct kmem_cache *slab;
 
@@ -59,6 +64,7 @@ static int benchmark_kmem_cache_fastpath_reuse(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		/* request new elem */
 		elem = kmem_cache_alloc(slab, GFP_ATOMIC);
@@ -70,6 +76,7 @@ static int benchmark_kmem_cache_fastpath_reuse(
 		/* return elem */
 		kmem_cache_free(slab, elem);
 		loops_cnt++;
+		time_bench_hist_end(rec, t);
 	}
 out:
 	time_bench_stop(rec, loops_cnt);
@@ -83,7 +90,7 @@ static __always_inline int __benchmark_qmempool_fastpath_reuse(
 	enum behavior_type type)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_elem *elem, *elem2;
 	struct kmem_cache *slab;
 	struct qmempool *pool;
@@ -106,6 +113,7 @@ static __always_inline int __benchmark_qmempool_fastpath_reuse(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		/* request new elem */
 		if (type == NORMAL) {
@@ -116,6 +124,10 @@ static __always_inline int __benchmark_qmempool_fastpath_reuse(
 			elem = qmempool_alloc_softirq(pool, GFP_ATOMIC);
 		} else if (type == SOFTIRQ_INLINE) {
 			elem = __qmempool_alloc_softirq(pool, GFP_ATOMIC);
+		} else if (type == ANY) {
+			elem = qmempool_alloc_any(pool, GFP_ATOMIC);
+		} else if (type == ANY_INLINE) {
+			elem = __qmempool_alloc_any(pool, GFP_ATOMIC);
 		} else {
 			BUILD_BUG();
 		}
@@ -133,10 +145,15 @@ static __always_inline int __benchmark_qmempool_fastpath_reuse(
 			qmempool_free_softirq(pool, elem);
 		} else if (type == SOFTIRQ_INLINE) {
 			__qmempool_free_softirq(pool, elem);
+		} else if (type == ANY) {
+			qmempool_free_any(pool, elem);
+		} else if (type == ANY_INLINE) {
+			__qmempool_free_any(pool, elem);
 		} else {
 			BUILD_BUG();
 		}
 		loops_cnt++;
+		time_bench_hist_end(rec, t);
 	}
 out:
 	time_bench_stop(rec, loops_cnt);
@@ -166,6 +183,16 @@ int benchmark_qmempool_fastpath_reuse_softirq_inline(
 {
 	return __benchmark_qmempool_fastpath_reuse(rec, data, SOFTIRQ_INLINE);
 }
+int benchmark_qmempool_fastpath_reuse_any(
+	struct time_bench_record *rec, void *data)
+{
+	return __benchmark_qmempool_fastpath_reuse(rec, data, ANY);
+}
+int benchmark_qmempool_fastpath_reuse_any_inline(
+	struct time_bench_record *rec, void *data)
+{
+	return __benchmark_qmempool_fastpath_reuse(rec, data, ANY_INLINE);
+}
 
 /* Keeping elements in a simple array to avoid too much interference
  * with test */
@@ -179,7 +206,8 @@ static int benchmark_kmem_cache_pattern(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i, n;
+	uint64_t i;
+	int n;
 	//size_t elem_sz = sizeof(*elems[0]); // == 232 bytes
 	struct kmem_cache *slab;
 
@@ -191,6 +219,7 @@ static int benchmark_kmem_cache_pattern(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		/* alloc N new elems */
 		for (n = 0; n < ARRAY_MAX_ELEMS; n++) {
@@ -204,6 +233,7 @@ static int benchmark_kmem_cache_pattern(
 			kmem_cache_free(slab, elems[n]);
 			loops_cnt++;
 		}
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, loops_cnt);
 
@@ -218,7 +248,8 @@ static __always_inline int __benchmark_qmempool_pattern(
 	enum behavior_type type)
 {
 	uint64_t loops_cnt = 0;
-	int i, n;
+	uint64_t i;
+	int n;
 	struct kmem_cache *slab;
 	struct qmempool *pool;
 
@@ -227,7 +258,10 @@ static __always_inline int __benchmark_qmempool_pattern(
 	if (!slab)
 		return 0;
 	//pool = qmempool_create(32, 128, 0, slab, GFP_ATOMIC);
-	pool = qmempool_create(32, 256, 0, slab, GFP_ATOMIC);
+	/* Non-zero "step" selects a smaller sharedq, to make the
+	 * N-pattern miss and refill/drain from/to slab
+	 */
+	pool = qmempool_create(32, rec->step ? : 256, 0, slab, GFP_ATOMIC);
 	//pool = qmempool_create(32, 1024, 0, slab, GFP_ATOMIC);
 	if (pool == NULL) {
 		kmem_cache_destroy(slab);
@@ -237,6 +271,7 @@ static __always_inline int __benchmark_qmempool_pattern(
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
 
 		/* alloc N new elems */
 		for (n = 0; n < ARRAY_MAX_ELEMS; n++) {
@@ -250,6 +285,9 @@ static __always_inline int __benchmark_qmempool_pattern(
 			} else if (type == SOFTIRQ_INLINE) {
 				elems[n] =
 				__qmempool_alloc_softirq(pool, GFP_ATOMIC);
+			} else if (type == ANY_INLINE) {
+				elems[n] =
+				__qmempool_alloc_any(pool, GFP_ATOMIC);
 			} else {
 				BUILD_BUG();
 			}
@@ -268,12 +306,15 @@ static __always_inline int __benchmark_qmempool_pattern(
 				qmempool_free_softirq(pool, elems[n]);
 			} else if (type == SOFTIRQ_INLINE) {
 				__qmempool_free_softirq(pool, elems[n]);
+			} else if (type == ANY_INLINE) {
+				__qmempool_free_any(pool, elems[n]);
 			} else {
 				BUILD_BUG();
 			}
 			barrier(); /* compiler barrier */
 			loops_cnt++;
 		}
+		time_bench_hist_end(rec, t);
 	}
 	time_bench_stop(rec, loops_cnt);
 
@@ -304,7 +345,375 @@ int benchmark_qmempool_pattern_softirq_inline(
 {
 	return __benchmark_qmempool_pattern(rec, data, SOFTIRQ_INLINE);
 }
+int benchmark_qmempool_pattern_any_inline(
+	struct time_bench_record *rec, void *data)
+{
+	return __benchmark_qmempool_pattern(rec, data, ANY_INLINE);
+}
+
+/* Per pool tuning sweep (qmempool_create_tuned()), N-pattern with
+ * softirq+inline API.  A non-zero "step" gives a sharedq that only
+ * holds a single refill (bulk * multiplier), making every round
+ * refill and drain via slab.
+ */
+struct qmempool_tuning {
+	unsigned int bulk;
+	unsigned int refill_mult;
+};
+
+static int benchmark_qmempool_pattern_tuned(
+	struct time_bench_record *rec, void *data)
+{
+	struct qmempool_tuning *t = data;
+	uint64_t loops_cnt = 0;
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	uint32_t sharedq_sz;
+	uint64_t i;
+	int n;
+
+	slab = kmem_cache_create("qmempool_test", sizeof(*elems[0]),
+				 0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!slab)
+		return 0;
+	sharedq_sz = rec->step ?
+		roundup_pow_of_two(t->bulk * t->refill_mult) : 1024;
+	pool = qmempool_create_tuned(QMEMPOOL_BULK_MAX, sharedq_sz, 0, slab,
+				     GFP_ATOMIC, t->bulk, t->refill_mult);
+	if (pool == NULL) {
+		kmem_cache_destroy(slab);
+		return 0;
+	}
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		for (n = 0; n < ARRAY_MAX_ELEMS; n++) {
+			elems[n] = __qmempool_alloc_softirq(pool, GFP_ATOMIC);
+			barrier(); /* compiler barrier */
+		}
+		barrier(); /* compiler barrier */
+		for (n = 0; n < ARRAY_MAX_ELEMS; n++) {
+			__qmempool_free_softirq(pool, elems[n]);
+			barrier(); /* compiler barrier */
+			loops_cnt++;
+		}
+		time_bench_hist_end(rec, t);
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	print_qstats(pool, __func__, "tuned");
+
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	return loops_cnt;
+}
+
+static void tuning_sweep(uint32_t loops, int slab_miss)
+{
+	static const unsigned int bulks[] = { 4, 8, 16, 32, 64 };
+	static const unsigned int mults[] = { 1, 2, 4 };
+	struct qmempool_tuning t;
+	char desc[64];
+	int b, m;
+
+	for (b = 0; b < ARRAY_SIZE(bulks); b++) {
+		for (m = 0; m < ARRAY_SIZE(mults); m++) {
+			t.bulk        = bulks[b];
+			t.refill_mult = mults[m];
+			snprintf(desc, sizeof(desc),
+				 "qmempool N-pattern%s bulk:%u mult:%u",
+				 slab_miss ? " slab-miss" : "",
+				 t.bulk, t.refill_mult);
+			time_bench_loop(loops, slab_miss, desc, &t,
+					benchmark_qmempool_pattern_tuned);
+		}
+	}
+}
+
+/* Bulk alloc+free, bulk size given by rec->step */
+#define BULK_MAX 128
+
+static int benchmark_kmem_cache_bulk(
+	struct time_bench_record *rec, void *data)
+{
+	void *objs[BULK_MAX];
+	uint64_t loops_cnt = 0;
+	struct kmem_cache *slab;
+	int bulk = min_t(int, rec->step, BULK_MAX);
+	uint64_t i;
 
+	slab = kmem_cache_create("qmempool_test5", sizeof(struct my_elem),
+				 0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!slab)
+		return 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		if (!kmem_cache_alloc_bulk(slab, GFP_ATOMIC, bulk, objs))
+			goto out;
+
+		barrier(); /* compiler barrier */
+
+		kmem_cache_free_bulk(slab, bulk, objs);
+		loops_cnt += bulk;
+		time_bench_hist_end(rec, t);
+	}
+out:
+	time_bench_stop(rec, loops_cnt);
+	kmem_cache_destroy(slab);
+	return loops_cnt;
+}
+
+static __always_inline int __benchmark_qmempool_bulk(
+	struct time_bench_record *rec, void *data, enum behavior_type type)
+{
+	void *objs[BULK_MAX];
+	uint64_t loops_cnt = 0;
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	int bulk = min_t(int, rec->step, BULK_MAX);
+	uint64_t i;
+	int num;
+
+	slab = kmem_cache_create("qmempool_test5", sizeof(struct my_elem),
+				 0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!slab)
+		return 0;
+	/* localq holds a full bulk, thus the steady state avoids sharedq */
+	pool = qmempool_create(roundup_pow_of_two(max(bulk, QMEMPOOL_BULK)),
+			       512, 0, slab, GFP_ATOMIC);
+	if (pool == NULL) {
+		kmem_cache_destroy(slab);
+		return 0;
+	}
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		if (type == NORMAL)
+			num = qmempool_alloc_bulk(pool, objs, bulk, GFP_ATOMIC);
+		else if (type == SOFTIRQ_INLINE)
+			num = __qmempool_alloc_bulk_softirq(pool, objs, bulk,
+							    GFP_ATOMIC);
+		else
+			BUILD_BUG();
+		if (num != bulk)
+			goto out;
+
+		barrier(); /* compiler barrier */
+
+		if (type == NORMAL)
+			qmempool_free_bulk(pool, objs, bulk);
+		else if (type == SOFTIRQ_INLINE)
+			__qmempool_free_bulk_softirq(pool, objs, bulk);
+		else
+			BUILD_BUG();
+		loops_cnt += bulk;
+		time_bench_hist_end(rec, t);
+	}
+out:
+	time_bench_stop(rec, loops_cnt);
+	print_qstats(pool, __func__, "bulk");
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	return loops_cnt;
+}
+int benchmark_qmempool_bulk(struct time_bench_record *rec, void *data)
+{
+	return __benchmark_qmempool_bulk(rec, data, NORMAL);
+}
+int benchmark_qmempool_bulk_softirq_inline(
+	struct time_bench_record *rec, void *data)
+{
+	return __benchmark_qmempool_bulk(rec, data, SOFTIRQ_INLINE);
+}
+
+#ifdef BENCH_RING_MEMPOOL
+/* ring_mempool (ring_queue backed, DPDK rte_mempool like) head-to-head
+ * with qmempool (alf_queue backed).  The pool is not preemption safe,
+ * thus the measured loop runs with BH disabled, comparable to the
+ * qmempool softirq variants.  Fixed population, sized for N-pattern
+ * plus a full per CPU cache.
+ */
+#define RING_MEMPOOL_SIZE 4096
+
+static struct ring_mempool *rmp_setup(struct kmem_cache **slab,
+				      unsigned int cache_size)
+{
+	struct ring_mempool *pool;
+
+	*slab = kmem_cache_create("ring_mempool_test", sizeof(struct my_elem),
+				  0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!*slab)
+		return NULL;
+	pool = ring_mempool_create(RING_MEMPOOL_SIZE, cache_size, *slab,
+				   GFP_KERNEL);
+	if (!pool)
+		kmem_cache_destroy(*slab);
+	return pool;
+}
+
+static void rmp_teardown(struct ring_mempool *pool, struct kmem_cache *slab)
+{
+	ring_mempool_destroy(pool);
+	kmem_cache_destroy(slab);
+}
+
+/* Cache size given by rec->step */
+static int benchmark_ring_mempool_fastpath_reuse(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t loops_cnt = 0;
+	struct ring_mempool *pool;
+	struct kmem_cache *slab;
+	void *elem;
+	uint64_t i;
+
+	pool = rmp_setup(&slab, rec->step);
+	if (!pool)
+		return 0;
+
+	local_bh_disable();
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		elem = ring_mempool_get(pool);
+		if (elem == NULL)
+			goto out;
+
+		barrier(); /* compiler barrier */
+
+		ring_mempool_put(pool, elem);
+		loops_cnt++;
+		time_bench_hist_end(rec, t);
+	}
+out:
+	time_bench_stop(rec, loops_cnt);
+	local_bh_enable();
+	rmp_teardown(pool, slab);
+	return loops_cnt;
+}
+
+/* Cache size given by rec->step */
+static int benchmark_ring_mempool_pattern(
+	struct time_bench_record *rec, void *data)
+{
+	uint64_t loops_cnt = 0;
+	struct ring_mempool *pool;
+	struct kmem_cache *slab;
+	uint64_t i;
+	int n;
+
+	pool = rmp_setup(&slab, rec->step);
+	if (!pool)
+		return 0;
+
+	local_bh_disable();
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		/* alloc N new elems */
+		for (n = 0; n < ARRAY_MAX_ELEMS; n++) {
+			elems[n] = ring_mempool_get(pool);
+			barrier(); /* compiler barrier */
+		}
+
+		barrier(); /* compiler barrier */
+
+		/* free N elems */
+		for (n = 0; n < ARRAY_MAX_ELEMS; n++) {
+			ring_mempool_put(pool, elems[n]);
+			barrier(); /* compiler barrier */
+			loops_cnt++;
+		}
+		time_bench_hist_end(rec, t);
+	}
+	time_bench_stop(rec, loops_cnt);
+	local_bh_enable();
+	rmp_teardown(pool, slab);
+	return loops_cnt;
+}
+
+/* Bulk size given by rec->step, cache holds a full bulk like the
+ * qmempool localq in __benchmark_qmempool_bulk()
+ */
+static int benchmark_ring_mempool_bulk(
+	struct time_bench_record *rec, void *data)
+{
+	int bulk = min_t(int, rec->step, BULK_MAX);
+	uint64_t loops_cnt = 0;
+	struct ring_mempool *pool;
+	struct kmem_cache *slab;
+	void *objs[BULK_MAX];
+	uint64_t i;
+
+	pool = rmp_setup(&slab, roundup_pow_of_two(max(bulk, QMEMPOOL_BULK)));
+	if (!pool)
+		return 0;
+
+	local_bh_disable();
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		uint64_t t = time_bench_hist_begin(rec);
+
+		if (ring_mempool_get_bulk(pool, objs, bulk))
+			goto out;
+
+		barrier(); /* compiler barrier */
+
+		ring_mempool_put_bulk(pool, objs, bulk);
+		loops_cnt += bulk;
+		time_bench_hist_end(rec, t);
+	}
+out:
+	time_bench_stop(rec, loops_cnt);
+	local_bh_enable();
+	rmp_teardown(pool, slab);
+	return loops_cnt;
+}
+
+/* Per CPU cache size vs N-pattern, 0 is ring_queue access only */
+static void ring_mempool_cache_sweep(uint32_t loops)
+{
+	static const unsigned int cache_sizes[] = { 0, 32, 128, 256, 512 };
+	char desc[48];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache_sizes); i++) {
+		snprintf(desc, sizeof(desc), "ring_mempool N-pattern cache:%u",
+			 cache_sizes[i]);
+		time_bench_loop(loops, cache_sizes[i], desc, NULL,
+				benchmark_ring_mempool_pattern);
+	}
+}
+#endif /* BENCH_RING_MEMPOOL */
+
+static void bulk_compare(uint32_t loops, int bulk)
+{
+	time_bench_loop(loops/bulk, bulk, "kmem_cache bulk alloc+free", NULL,
+			benchmark_kmem_cache_bulk);
+	time_bench_loop(loops/bulk, bulk, "qmempool bulk alloc+free", NULL,
+			benchmark_qmempool_bulk);
+	time_bench_loop(loops/bulk, bulk, "qmempool bulk softirq+inline",
+			NULL, benchmark_qmempool_bulk_softirq_inline);
+#ifdef BENCH_RING_MEMPOOL
+	time_bench_loop(loops/bulk, bulk, "ring_mempool bulk get+put", NULL,
+			benchmark_ring_mempool_bulk);
+#endif
+}
 
 bool run_micro_benchmark_tests(void)
 {
@@ -330,6 +739,16 @@ bool run_micro_benchmark_tests(void)
 			benchmark_qmempool_fastpath_reuse_softirq);
 	time_bench_loop(loops*30, 0, "qmempool fastpath SOFTIRQ+inline", NULL,
 			benchmark_qmempool_fastpath_reuse_softirq_inline);
+	/* Any context variant, overhead vs. softirq variant */
+	time_bench_loop(loops*30, 0, "qmempool fastpath ANY", NULL,
+			benchmark_qmempool_fastpath_reuse_any);
+	time_bench_loop(loops*30, 0, "qmempool fastpath ANY+inline", NULL,
+			benchmark_qmempool_fastpath_reuse_any_inline);
+#ifdef BENCH_RING_MEMPOOL
+	/* Same per CPU cache size as the qmempool localq above */
+	time_bench_loop(loops*30, 32, "ring_mempool fastpath BH-disabled",
+			NULL, benchmark_ring_mempool_fastpath_reuse);
+#endif
 
 	pr_info("N-pattern with %d elements\n", ARRAY_MAX_ELEMS);
 
@@ -349,6 +768,36 @@ bool run_micro_benchmark_tests(void)
 			NULL, benchmark_qmempool_pattern_softirq);
 	time_bench_loop(loops/10, 0, "qmempool N-pattern softirq+inline",
 			NULL, benchmark_qmempool_pattern_softirq_inline);
+	time_bench_loop(loops/10, 0, "qmempool N-pattern ANY+inline",
+			NULL, benchmark_qmempool_pattern_any_inline);
+#ifdef BENCH_RING_MEMPOOL
+	ring_mempool_cache_sweep(loops/10);
+#endif
+
+	/* Slab-miss: localq(32)+sharedq(32) cannot hold N elements, thus
+	 * every round refills and drains sharedq via slab bulk API
+	 */
+	pr_info("N-pattern with %d elements, slab-miss sharedq:%d\n",
+		ARRAY_MAX_ELEMS, QMEMPOOL_BULK * QMEMPOOL_REFILL_MULTIPLIER);
+	time_bench_loop(loops/10, QMEMPOOL_BULK * QMEMPOOL_REFILL_MULTIPLIER,
+			"qmempool N-pattern slab-miss",
+			NULL, benchmark_qmempool_pattern);
+	time_bench_loop(loops/10, QMEMPOOL_BULK * QMEMPOOL_REFILL_MULTIPLIER,
+			"qmempool N-pattern slab-miss softirq+inline",
+			NULL, benchmark_qmempool_pattern_softirq_inline);
+
+	pr_info("N-pattern with %d elements, per pool bulk/multiplier\n",
+		ARRAY_MAX_ELEMS);
+	tuning_sweep(loops/10, 0);
+	tuning_sweep(loops/10, 1);
+
+	pr_info("Bulk alloc+free, cost per element\n");
+	bulk_compare(loops*10, 1);
+	bulk_compare(loops*10, 8);
+	bulk_compare(loops*10, 16);
+	bulk_compare(loops*10, 32);
+	bulk_compare(loops*10, 64);
+	bulk_compare(loops*10, 128);
 
 	return true;
 }
@@ -17,6 +17,10 @@ static int parallel_cpus = 0;
 module_param(parallel_cpus, uint, 0);
 MODULE_PARM_DESC(parallel_cpus, "Number of parallel CPUs (default ALL)");
 
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
 /* Quick and dirty way to unselect some of the benchmark tests, by
  * encoding this in a module parameter flag.  This is useful when
  * wanting to perf benchmark a specific benchmark test.
@@ -34,6 +38,8 @@ enum benchmark_bit {
 	bit_run_bench_fastpath_qmempool,
 	bit_run_bench_N_pattern_slab,
 	bit_run_bench_N_pattern_qmempool,
+	bit_run_bench_cross_node,
+	bit_run_bench_cross_cpu,
 };
 #define bit(b)	(1 << (b))
 #define run_or_return(b) do { if (!(run_flags & (bit(b)))) return; } while (0)
@@ -47,7 +53,7 @@ static void print_qstats(struct qmempool *pool,
 	preempt_disable();
 	cpu = this_cpu_ptr(pool->percpu);
 	localq_sz  = alf_queue_count(cpu->localq);
-	sharedq_sz = alf_queue_count(pool->sharedq);
+	sharedq_sz = alf_queue_count(pool->sharedq[cpu->nid]);
 	if (verbose >= 2)
 		pr_info("%s() qstats localq:%d sharedq:%d (%s)\n", func,
 			localq_sz, sharedq_sz, msg);
@@ -75,7 +81,7 @@ static int benchmark_kmem_cache_fastpath_reuse(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_elem *elem;
 	struct kmem_cache *slab = data;
 
@@ -104,7 +110,7 @@ static __always_inline int __benchmark_qmempool_fastpath_reuse(
 	enum behavior_type type)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_elem *elem, *elem2;
 	struct qmempool *pool = data;
 
@@ -187,7 +193,8 @@ static int benchmark_kmem_cache_pattern(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i, n;
+	uint64_t i;
+	int n;
 	//size_t elem_sz = sizeof(*elems[0]); // == 232 bytes
 	struct kmem_cache *slab = data;
 	struct my_elem **elems;
@@ -226,7 +233,8 @@ static __always_inline int __benchmark_qmempool_pattern(
 	struct qmempool *pool = data;
 	struct my_elem **elems;
 	uint64_t loops_cnt = 0;
-	int i, n;
+	uint64_t i;
+	int n;
 
 	elems = kzalloc(sizeof(void*) * ARRAY_MAX_ELEMS, GFP_KERNEL);
 
@@ -321,6 +329,232 @@ int run_parallel(const char *desc, uint32_t loops, const cpumask_t *cpumask,
 	return 1;
 }
 
+/* Cross-node handoff: even cpu_idx allocate and pass elements, via an
+ * MPMC transfer queue, to odd cpu_idx that free them.  With topology
+ * "cross" neighbouring cpu_idx are on different nodes, thus every free
+ * is a remote free.
+ */
+struct cross_node {
+	struct alf_queue *xfer;
+	struct qmempool *pool;		/* Used if non-NULL */
+	struct kmem_cache *slab;
+};
+
+static int benchmark_cross_node_handoff(
+	struct time_bench_record *rec, void *data)
+{
+	struct cross_node *x = data;
+	bool alloc_CPU = ((rec->cpu_idx % 2) == 0);
+	uint64_t loops_cnt = 0;
+	void *elem;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (alloc_CPU) {
+			if (x->pool)
+				elem = qmempool_alloc(x->pool, GFP_ATOMIC);
+			else
+				elem = kmem_cache_alloc(x->slab, GFP_ATOMIC);
+			if (elem == NULL)
+				break;
+			while (alf_mp_enqueue(x->xfer, &elem, 1) == 0)
+				cpu_relax(); /* full */
+		} else {
+			if (alf_mc_dequeue(x->xfer, &elem, 1) == 0) {
+				cpu_relax(); /* empty */
+				continue;
+			}
+			if (x->pool)
+				qmempool_free(x->pool, elem);
+			else
+				kmem_cache_free(x->slab, elem);
+		}
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark alloc/free, as "step" gets printed */
+	rec->step = alloc_CPU;
+	return loops_cnt;
+}
+
+void noinline run_bench_cross_node(uint32_t loops)
+{
+	struct cross_node x = {};
+	cpumask_t cpumask;
+	int cpus, nid;
+
+	run_or_return(bit_run_bench_cross_node);
+
+	if (num_online_nodes() < 2) {
+		pr_info("Cross-node bench needs two NUMA nodes, skipping\n");
+		return;
+	}
+	cpus = time_bench_cpumask_select(&cpumask, "cross",
+					 parallel_cpus ? : 2 * num_online_nodes());
+	if (cpus < 2)
+		return;
+	if (cpus & 1) /* alloc/free CPUs in pairs */
+		cpumask_clear_cpu(cpumask_last(&cpumask), &cpumask);
+
+	x.xfer = alf_queue_alloc(1024, GFP_KERNEL);
+	if (IS_ERR_OR_NULL(x.xfer))
+		return;
+	x.slab = kmem_cache_create("qmempool_xnode", sizeof(struct my_elem),
+				   0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!x.slab)
+		goto out;
+
+	run_parallel("cross_node_kmem_cache", loops, &cpumask, 0, &x,
+		     benchmark_cross_node_handoff);
+
+	x.pool = qmempool_create(64, 1024, 0, x.slab, GFP_ATOMIC);
+	if (x.pool) {
+		run_parallel("cross_node_qmempool", loops, &cpumask, 0, &x,
+			     benchmark_cross_node_handoff);
+		/* Remote frees should have filled the allocating nodes */
+		for_each_node_state(nid, N_MEMORY)
+			pr_info("cross_node_qmempool sharedq node:%d elems:%d\n",
+				nid, alf_queue_count(x.pool->sharedq[nid]));
+		qmempool_destroy(x.pool);
+	}
+	kmem_cache_destroy(x.slab);
+out:
+	alf_queue_free(x.xfer);
+}
+
+/* Cross CPU: producer/consumer CPU pairs, like RX->TX redirect and
+ * mm/bench/page_bench05_cross_cpu.c.  Even cpu_idx allocate and hand
+ * elements over a per pair SPSC queue to the next (odd) cpu_idx that
+ * frees them.  With remote_cpu the free returns elements to the
+ * allocating CPU (qmempool_free_to_cpu()), else they end-up in the
+ * freeing CPU's localq and travel back via sharedq.
+ */
+#define CROSS_CPU_MAX_PAIRS 64
+
+struct cross_cpu {
+	struct alf_queue *xfer[CROSS_CPU_MAX_PAIRS];
+	int owner[CROSS_CPU_MAX_PAIRS];	/* CPU id of the allocating CPU */
+	struct qmempool *pool;		/* Used if non-NULL */
+	struct kmem_cache *slab;
+	bool remote_cpu;
+};
+
+static int benchmark_cross_cpu_handoff(
+	struct time_bench_record *rec, void *data)
+{
+	struct cross_cpu *x = data;
+	bool alloc_CPU = ((rec->cpu_idx % 2) == 0);
+	unsigned int pair = rec->cpu_idx / 2;
+	struct alf_queue *xfer = x->xfer[pair];
+	uint64_t loops_cnt = 0;
+	void *elem;
+	int owner;
+
+	if (alloc_CPU)
+		WRITE_ONCE(x->owner[pair], smp_processor_id());
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (alloc_CPU) {
+			if (x->pool)
+				elem = qmempool_alloc(x->pool, GFP_ATOMIC);
+			else
+				elem = kmem_cache_alloc(x->slab, GFP_ATOMIC);
+			if (elem == NULL)
+				break;
+			while (alf_sp_enqueue(xfer, &elem, 1) == 0)
+				cpu_relax(); /* full */
+		} else {
+			if (alf_sc_dequeue(xfer, &elem, 1) == 0) {
+				cpu_relax(); /* empty */
+				continue;
+			}
+			/* Set before the first element got enqueued */
+			owner = READ_ONCE(x->owner[pair]);
+			if (x->pool && x->remote_cpu)
+				qmempool_free_to_cpu(x->pool, elem, owner);
+			else if (x->pool)
+				qmempool_free(x->pool, elem);
+			else
+				kmem_cache_free(x->slab, elem);
+		}
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark alloc/free, as "step" gets printed */
+	rec->step = alloc_CPU;
+	return loops_cnt;
+}
+
+void noinline run_bench_cross_cpu(uint32_t loops, cpumask_t cpumask)
+{
+	struct qmempool_stats st;
+	struct cross_cpu x = {};
+	int cpus, i, pairs;
+
+	run_or_return(bit_run_bench_cross_cpu);
+
+	if (cpumask_weight(&cpumask) & 1) /* alloc/free CPUs in pairs */
+		cpumask_clear_cpu(cpumask_last(&cpumask), &cpumask);
+	cpus = cpumask_weight(&cpumask);
+	if (cpus < 2) {
+		pr_info("Cross-CPU bench needs two CPUs, skipping\n");
+		return;
+	}
+	pairs = min(cpus / 2, CROSS_CPU_MAX_PAIRS);
+
+	for (i = 0; i < pairs; i++) {
+		x.xfer[i] = alf_queue_alloc(1024, GFP_KERNEL);
+		if (IS_ERR_OR_NULL(x.xfer[i])) {
+			x.xfer[i] = NULL;
+			goto out;
+		}
+	}
+	/* Pairs beyond the transfer queues would have none, drop them */
+	while (cpumask_weight(&cpumask) > pairs * 2)
+		cpumask_clear_cpu(cpumask_last(&cpumask), &cpumask);
+
+	x.slab = kmem_cache_create("qmempool_xcpu", sizeof(struct my_elem),
+				   0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!x.slab)
+		goto out;
+
+	run_parallel("cross_cpu_kmem_cache", loops, &cpumask, 0, &x,
+		     benchmark_cross_cpu_handoff);
+
+	x.pool = qmempool_create(64, 1024, 0, x.slab, GFP_ATOMIC);
+	if (x.pool) {
+		run_parallel("cross_cpu_qmempool", loops, &cpumask, 0, &x,
+			     benchmark_cross_cpu_handoff);
+		qmempool_destroy(x.pool);
+	}
+
+	x.pool = qmempool_create(64, 1024, 0, x.slab, GFP_ATOMIC);
+	if (x.pool && qmempool_remote_cpu_enable(x.pool, 256) == 0) {
+		qmempool_stats_register(x.pool, "bench_cross_cpu");
+		x.remote_cpu = true;
+		run_parallel("cross_cpu_qmempool_remote_cpu", loops, &cpumask,
+			     0, &x, benchmark_cross_cpu_handoff);
+		qmempool_stats_sum(x.pool, &st);
+		if (verbose)
+			pr_info("cross_cpu_qmempool_remote_cpu free_remote_cpu:%llu remote_cpu_refill:%llu sharedq_refill:%llu\n",
+				st.free_remote_cpu, st.remote_cpu_refill,
+				st.sharedq_refill);
+	}
+	if (x.pool)
+		qmempool_destroy(x.pool);
+	kmem_cache_destroy(x.slab);
+out:
+	for (i = 0; i < pairs; i++) {
+		if (x.xfer[i])
+			alf_queue_free(x.xfer[i]);
+	}
+}
+
 void noinline run_bench_fastpath_slab(uint32_t loops, cpumask_t cpumask)
 {
 	struct kmem_cache *slab;
@@ -440,20 +674,14 @@ bool run_micro_benchmark_tests(void)
 {
 	uint32_t loops = 100000;
 	cpumask_t cpumask;
-	int i;
 
-	/* Default run on all (online) CPUs */
-	cpumask_copy(&cpumask, cpu_online_mask);
-
-	/* Reduce CPUs to run on, via module parameter parallel_cpus */
-	if (parallel_cpus != 0) {
-		if (verbose)
-			pr_info("Limit to %d parallel CPUs\n", parallel_cpus);
-		cpumask_clear(&cpumask);
-		for (i = 0; i < parallel_cpus ; i++) {
-			cpumask_set_cpu(i, &cpumask);
-		}
-	}
+	/* Default run on all (online) CPUs, reduce CPUs to run on via
+	 * module parameter parallel_cpus, and select via topology
+	 */
+	if (verbose && parallel_cpus)
+		pr_info("Limit to %d parallel CPUs\n", parallel_cpus);
+	if (time_bench_cpumask_select(&cpumask, topology, parallel_cpus) < 0)
+		return false;
 
 	/* Selectable test types, see run_flags module parameter */
 	run_bench_fastpath_slab(loops, cpumask);
@@ -463,6 +691,9 @@ bool run_micro_benchmark_tests(void)
 	run_bench_N_pattern_slab(loops, cpumask);
 	run_bench_N_pattern_qmempool(loops, cpumask);
 
+	run_bench_cross_node(loops);
+	run_bench_cross_cpu(loops, cpumask);
+
 	return true;
 }
 
@@ -84,7 +84,7 @@ static bool test_basic_req_elem(void)
 		result = false;
 	if (verbose >= 2)
 		pr_info("%s() localq:%d sharedq:%d\n", __func__,
-			queue_sz, alf_queue_count(pool->sharedq));
+			queue_sz, alf_queue_count(pool->sharedq[cpu->nid]));
 	preempt_enable();
 
 	qmempool_destroy(pool);
@@ -101,7 +101,7 @@ static void print_qstats(struct qmempool *pool,
 	preempt_disable();
 	cpu = this_cpu_ptr(pool->percpu);
 	localq_sz  = alf_queue_count(cpu->localq);
-	sharedq_sz = alf_queue_count(pool->sharedq);
+	sharedq_sz = alf_queue_count(pool->sharedq[cpu->nid]);
 	if (verbose >= 2)
 		pr_info("%s() qstats localq:%d sharedq:%d (%s)\n", func,
 			localq_sz, sharedq_sz, msg);
@@ -156,6 +156,417 @@ static bool test_alloc_and_free_nr(int nr)
 	return result;
 }
 
+/* Per pool bulk/refill multiplier, outside the limits is rejected */
+static bool test_tuned_limits(void)
+{
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	bool result = true;
+
+	slab = kmem_cache_create("qmempool_test_tuned", 256, 0,
+				 SLAB_HWCACHE_ALIGN, NULL);
+	if (!slab)
+		return false;
+	pool = qmempool_create_tuned(256, 512, 0, slab, GFP_ATOMIC,
+				     QMEMPOOL_BULK_MAX + 1, 1);
+	if (pool) {
+		result = false;
+		qmempool_destroy(pool);
+	}
+	pool = qmempool_create_tuned(256, 512, 0, slab, GFP_ATOMIC, 16,
+				     QMEMPOOL_REFILL_MULTIPLIER_MAX + 1);
+	if (pool) {
+		result = false;
+		qmempool_destroy(pool);
+	}
+	/* sharedq must hold a full refill (bulk * multiplier) */
+	pool = qmempool_create_tuned(256, 128, 0, slab, GFP_ATOMIC, 64, 4);
+	if (pool) {
+		result = false;
+		qmempool_destroy(pool);
+	}
+	kmem_cache_destroy(slab);
+	return result;
+}
+
+/* Tuned pool with a slab refill larger than one kmem_cache bulk chunk:
+ * first alloc refills sharedq with bulk * multiplier elements.
+ */
+static bool test_tuned_refill(unsigned int bulk, unsigned int mult)
+{
+	struct qmempool_percpu *cpu;
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	bool result = true;
+	void *elem;
+	int cnt;
+
+	slab = kmem_cache_create("qmempool_test_tuned", 256, 0,
+				 SLAB_HWCACHE_ALIGN, NULL);
+	if (!slab)
+		return false;
+	pool = qmempool_create_tuned(256, 1024, 0, slab, GFP_ATOMIC,
+				     bulk, mult);
+	if (pool == NULL) {
+		kmem_cache_destroy(slab);
+		return false;
+	}
+
+	preempt_disable();
+	cpu = this_cpu_ptr(pool->percpu);
+	elem = qmempool_alloc(pool, GFP_ATOMIC);
+	cnt = alf_queue_count(pool->sharedq[cpu->nid]);
+	preempt_enable();
+	if (!elem || cnt != bulk * mult) {
+		pr_err("%s() bulk:%u mult:%u sharedq:%d\n", __func__,
+		       bulk, mult, cnt);
+		result = false;
+	}
+	if (elem)
+		qmempool_free(pool, elem);
+
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	return result;
+}
+
+/* Page backed pool: pages are recycled, unless someone else still
+ * holds a reference on the page
+ */
+static bool test_page_backed(unsigned int order)
+{
+	struct qmempool_percpu *cpu;
+	struct qmempool *pool;
+	struct page *page;
+	bool result = true;
+	int cnt;
+
+	pool = qmempool_create_pages(32, 128, 16, order, GFP_ATOMIC);
+	if (pool == NULL)
+		return false;
+
+	local_bh_disable(); /* stay on this CPU, for checking its localq */
+	cpu = this_cpu_ptr(pool->percpu);
+	page = qmempool_alloc_page(pool, GFP_ATOMIC);
+	if (!page || (order && compound_order(page) != order)) {
+		result = false;
+		goto out;
+	}
+	cnt = alf_queue_count(cpu->localq);
+	qmempool_free_page(pool, page);
+	if (alf_queue_count(cpu->localq) != cnt + 1) /* recycled */
+		result = false;
+
+	/* Extra ref (e.g. skb frag), not recycled, only ref dropped */
+	page = qmempool_alloc_page(pool, GFP_ATOMIC);
+	get_page(page);
+	cnt = alf_queue_count(cpu->localq);
+	qmempool_free_page(pool, page);
+	if (page_ref_count(page) != 1 ||
+	    alf_queue_count(cpu->localq) != cnt)
+		result = false;
+	put_page(page);
+out:
+	local_bh_enable();
+	qmempool_destroy(pool);
+	return result;
+}
+
+/* Frees to another owner CPU are batched, and a full bulk lands in
+ * the owner's xset queue of this CPU, not in this CPU's localq
+ */
+static bool test_remote_cpu_free(void)
+{
+	void *elems[QMEMPOOL_BULK];
+	struct qmempool_percpu *cpu, *owner_cpu;
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	bool result = true;
+	int i, this, owner, localq_cnt;
+
+	if (num_online_cpus() < 2)
+		return true; /* nothing to test */
+
+	slab = kmem_cache_create("qmempool_test_xcpu", 256, 0,
+				 SLAB_HWCACHE_ALIGN, NULL);
+	if (!slab)
+		return false;
+	pool = qmempool_create(32, 128, 0, slab, GFP_ATOMIC);
+	if (pool == NULL || qmempool_remote_cpu_enable(pool, 64)) {
+		if (pool)
+			qmempool_destroy(pool);
+		kmem_cache_destroy(slab);
+		return false;
+	}
+
+	local_bh_disable();
+	this = smp_processor_id();
+	owner = cpumask_next(this, cpu_online_mask);
+	if (owner >= nr_cpu_ids)
+		owner = cpumask_first(cpu_online_mask);
+	cpu = this_cpu_ptr(pool->percpu);
+	owner_cpu = per_cpu_ptr(pool->percpu, owner);
+
+	for (i = 0; i < QMEMPOOL_BULK; i++)
+		elems[i] = qmempool_alloc(pool, GFP_ATOMIC);
+	localq_cnt = alf_queue_count(cpu->localq);
+	for (i = 0; i < QMEMPOOL_BULK - 1; i++)
+		qmempool_free_to_cpu(pool, elems[i], owner);
+	if (cpu->xcpu_cnt != QMEMPOOL_BULK - 1) /* pending, not flushed */
+		result = false;
+	qmempool_free_to_cpu(pool, elems[i], owner);
+	if (cpu->xcpu_cnt != 0 ||
+	    alf_queue_count(owner_cpu->xset->queues[this]) != QMEMPOOL_BULK ||
+	    alf_queue_count(cpu->localq) != localq_cnt)
+		result = false;
+	local_bh_enable();
+
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	return result;
+}
+
+/* Debug mode: double free is reported and not cached twice, a write
+ * to a cached element is reported on alloc
+ */
+static bool test_debug_mode(void)
+{
+	void *elems[QMEMPOOL_BULK];
+	struct qmempool_percpu *cpu;
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	bool was_on = static_key_enabled(&qmempool_debug_key);
+	bool result = true;
+	void *elem;
+	int i, cnt;
+
+	slab = kmem_cache_create("qmempool_test_debug", 256, 0,
+				 SLAB_HWCACHE_ALIGN, NULL);
+	if (!slab)
+		return false;
+	pool = qmempool_create(32, 128, 0, slab, GFP_ATOMIC);
+	if (pool == NULL) {
+		kmem_cache_destroy(slab);
+		return false;
+	}
+	if (!was_on)
+		static_branch_enable(&qmempool_debug_key);
+
+	local_bh_disable();
+	cpu = this_cpu_ptr(pool->percpu);
+	/* Empty localq: first alloc refills it with a bulk minus one */
+	for (i = 0; i < QMEMPOOL_BULK; i++)
+		elems[i] = qmempool_alloc(pool, GFP_ATOMIC);
+	if (alf_queue_count(cpu->localq) != 0)
+		result = false;
+
+	/* Double free */
+	qmempool_free(pool, elems[0]);
+	qmempool_free(pool, elems[0]);
+	if (atomic_read(&pool->debug_errors) != 1 ||
+	    alf_queue_count(cpu->localq) != 1)
+		result = false;
+
+	/* Use-after-free, elems[0] is the only cached element */
+	cnt = atomic_read(&pool->debug_errors);
+	((char *)elems[0])[100] = 42;
+	elem = qmempool_alloc(pool, GFP_ATOMIC);
+	if (elem != elems[0] || atomic_read(&pool->debug_errors) != cnt + 1)
+		result = false;
+
+	/* Clean free and alloc, no report */
+	qmempool_free(pool, elem);
+	elem = qmempool_alloc(pool, GFP_ATOMIC);
+	if (atomic_read(&pool->debug_errors) != cnt + 1)
+		result = false;
+	elems[0] = elem;
+	for (i = 0; i < QMEMPOOL_BULK; i++)
+		qmempool_free(pool, elems[i]);
+	local_bh_enable();
+
+	if (!was_on)
+		static_branch_disable(&qmempool_debug_key);
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	return result;
+}
+
+/* Adaptive depth: alloc/free swings larger than the depth grow it, a
+ * CPU only freeing (net freer) shrinks it back down to QMEMPOOL_BULK.
+ */
+static bool test_adaptive_depth(void)
+{
+	void *elems[128];
+	struct qmempool_percpu *cpu;
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	unsigned int grown, shrunk;
+	bool result = true;
+	int i, round;
+
+	slab = kmem_cache_create("qmempool_test_adapt", 256, 0,
+				 SLAB_HWCACHE_ALIGN, NULL);
+	pool = qmempool_create(256, 1024, 0, slab, GFP_ATOMIC);
+	if (pool == NULL) {
+		kmem_cache_destroy(slab);
+		return false;
+	}
+
+	/* Stay on this CPU, depth is per CPU */
+	local_bh_disable();
+	cpu = this_cpu_ptr(pool->percpu);
+
+	/* Swings of 128 elements, both refills and overflows */
+	for (round = 0; round < 64; round++) {
+		for (i = 0; i < ARRAY_SIZE(elems); i++)
+			elems[i] = qmempool_alloc(pool, GFP_ATOMIC);
+		for (i = 0; i < ARRAY_SIZE(elems); i++)
+			if (elems[i])
+				qmempool_free(pool, elems[i]);
+	}
+	grown = cpu->depth;
+	if (grown < 128)
+		result = false;
+
+	/* Only freeing elements from slab, overflows only */
+	for (round = 0; round < 64; round++) {
+		for (i = 0; i < ARRAY_SIZE(elems); i++)
+			elems[i] = kmem_cache_alloc(slab, GFP_ATOMIC);
+		for (i = 0; i < ARRAY_SIZE(elems); i++)
+			if (elems[i])
+				qmempool_free(pool, elems[i]);
+	}
+	shrunk = cpu->depth;
+	if (shrunk != QMEMPOOL_BULK ||
+	    alf_queue_count(cpu->localq) > QMEMPOOL_BULK)
+		result = false;
+	local_bh_enable();
+
+	if (verbose >= 2)
+		pr_info("%s() depth grown:%u shrunk:%u\n", __func__,
+			grown, shrunk);
+
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	return result;
+}
+
+/* Any context variant, elements beyond the freelist depth go through
+ * sharedq and slab.  Optionally with IRQs disabled, like from hardirq.
+ */
+static bool test_any_alloc_and_free_nr(int nr, bool irqs_off)
+{
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	unsigned long flags = 0;
+	void **elems;
+	bool result = true;
+	int i;
+
+	elems = kcalloc(nr, sizeof(void *), GFP_KERNEL);
+	if (!elems)
+		return false;
+	slab = kmem_cache_create("qmempool_test_any", 256, 0,
+				 SLAB_HWCACHE_ALIGN, NULL);
+	pool = qmempool_create(32, 128, 0, slab, GFP_ATOMIC);
+	if (pool == NULL) {
+		kmem_cache_destroy(slab);
+		kfree(elems);
+		return false;
+	}
+
+	if (irqs_off)
+		local_irq_save(flags);
+	for (i = 0; i < nr; i++) {
+		elems[i] = qmempool_alloc_any(pool, GFP_ATOMIC);
+		if (!elems[i])
+			result = false;
+	}
+	/* No element handed out twice, as it stays in use */
+	for (i = 1; i < nr; i++)
+		if (elems[i] && elems[i] == elems[i - 1])
+			result = false;
+	for (i = 0; i < nr; i++)
+		if (elems[i])
+			qmempool_free_any(pool, elems[i]);
+	if (irqs_off)
+		local_irq_restore(flags);
+
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	kfree(elems);
+	return result;
+}
+
+/* Elements from another node must bypass localq, and get returned in
+ * bulk to the owning node's sharedq.  Trivially passes on one node.
+ */
+static bool test_remote_free_to_owner_node(void)
+{
+	void *elems[QMEMPOOL_BULK];
+	struct qmempool_percpu *cpu;
+	struct kmem_cache *slab;
+	struct qmempool *pool;
+	int nid, remote = NUMA_NO_NODE;
+	int localq_sz, sharedq_sz;
+	bool result = true;
+	int i;
+
+	if (num_node_state(N_MEMORY) < 2) {
+		if (verbose)
+			pr_info("%s() single memory node, skipping\n",
+				__func__);
+		return true;
+	}
+
+	slab = kmem_cache_create("qmempool_test_remote", 256, 0,
+				 SLAB_HWCACHE_ALIGN, NULL);
+	pool = qmempool_create(32, 128, 0, slab, GFP_ATOMIC);
+	if (pool == NULL) {
+		kmem_cache_destroy(slab);
+		return false;
+	}
+
+	/* Stay on this CPU, the remote batch is per CPU */
+	local_bh_disable();
+	cpu = this_cpu_ptr(pool->percpu);
+	for_each_node_state(nid, N_MEMORY) {
+		if (nid != cpu->nid) {
+			remote = nid;
+			break;
+		}
+	}
+	for (i = 0; i < QMEMPOOL_BULK; i++) {
+		elems[i] = kmem_cache_alloc_node(slab, GFP_ATOMIC, remote);
+		if (!elems[i] || qmempool_elem_nid(elems[i]) != remote) {
+			/* Slab fell back to another node, cannot test */
+			while (i >= 0) {
+				if (elems[i])
+					kmem_cache_free(slab, elems[i]);
+				i--;
+			}
+			goto out;
+		}
+	}
+	localq_sz = alf_queue_count(cpu->localq);
+	for (i = 0; i < QMEMPOOL_BULK; i++)
+		qmempool_free(pool, elems[i]);
+
+	sharedq_sz = alf_queue_count(pool->sharedq[remote]);
+	if (alf_queue_count(cpu->localq) != localq_sz)
+		result = false;
+	if (sharedq_sz != QMEMPOOL_BULK || cpu->remote_cnt != 0)
+		result = false;
+	if (verbose >= 2)
+		pr_info("%s() node:%d remote:%d sharedq[remote]:%d\n",
+			__func__, cpu->nid, remote, sharedq_sz);
+out:
+	local_bh_enable();
+	qmempool_destroy(pool);
+	kmem_cache_destroy(slab);
+	return result;
+}
+
 #define TEST_FUNC(func) 					\
 do {								\
 	if (!(func)) {						\
@@ -178,6 +589,19 @@ int run_basic_tests(void)
 	TEST_FUNC(test_alloc_and_free_nr(129));
 	TEST_FUNC(test_alloc_and_free_nr((128+(128/(QMEMPOOL_BULK*QMEMPOOL_REFILL_MULTIPLIER)))));
 	TEST_FUNC(test_alloc_and_free_nr((128+(128/(QMEMPOOL_BULK*QMEMPOOL_REFILL_MULTIPLIER)))+1));
+	TEST_FUNC(test_remote_free_to_owner_node());
+	TEST_FUNC(test_remote_cpu_free());
+	TEST_FUNC(test_debug_mode());
+	TEST_FUNC(test_adaptive_depth());
+	TEST_FUNC(test_tuned_limits());
+	TEST_FUNC(test_tuned_refill(QMEMPOOL_BULK, QMEMPOOL_REFILL_MULTIPLIER));
+	TEST_FUNC(test_tuned_refill(64, 4));
+	TEST_FUNC(test_tuned_refill(8, 1));
+	TEST_FUNC(test_page_backed(0));
+	TEST_FUNC(test_page_backed(2));
+	TEST_FUNC(test_any_alloc_and_free_nr(16, false));
+	TEST_FUNC(test_any_alloc_and_free_nr(200, false));
+	TEST_FUNC(test_any_alloc_and_free_nr(200, true));
 	return failed_count;
 }
 
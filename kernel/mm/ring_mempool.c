@@ -0,0 +1,145 @@
+/*
+ * ring_mempool - object pool on top of ring_queue, see
+ *  include/linux/ring_mempool.h
+ *
+ * Copyright (C) 2014, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/export.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/ring_mempool.h>
+
+/* Objects are moved in chunks of this size at create/destroy time */
+#define RING_MEMPOOL_CHUNK 64
+
+static void ring_mempool_free_objs(struct ring_mempool *pool)
+{
+	void *objs[RING_MEMPOOL_CHUNK];
+	unsigned int n;
+
+	while ((n = ring_queue_mc_dequeue_burst(pool->ring, objs,
+						RING_MEMPOOL_CHUNK)))
+		kmem_cache_free_bulk(pool->kmem, n, objs);
+}
+
+/* Caller must make sure no CPU uses the pool anymore */
+void ring_mempool_destroy(struct ring_mempool *pool)
+{
+	struct ring_mempool_cache *cache;
+	unsigned int freed, cpu;
+
+	if (!pool)
+		return;
+
+	if (pool->cache) {
+		for_each_possible_cpu(cpu) {
+			cache = per_cpu_ptr(pool->cache, cpu);
+			if (cache->len)
+				ring_queue_mp_enqueue_bulk(pool->ring,
+							   cache->objs,
+							   cache->len);
+			cache->len = 0;
+		}
+		free_percpu(pool->cache);
+	}
+
+	freed = ring_queue_count(pool->ring);
+	if (freed != pool->size)
+		pr_err("%s() pool lost %u objects (still in use?)\n",
+		       __func__, pool->size - freed);
+	ring_mempool_free_objs(pool);
+	ring_queue_free(pool->ring);
+	kfree(pool);
+}
+EXPORT_SYMBOL(ring_mempool_destroy);
+
+/* Create a pool of size objects from kmem, with a per CPU cache of
+ * cache_size objects (0 disables the caches).  All objects are
+ * allocated here, gfp_mask is only used at create time.
+ *
+ * Return NULL on error.
+ */
+struct ring_mempool *
+ring_mempool_create(unsigned int size, unsigned int cache_size,
+		    struct kmem_cache *kmem, gfp_t gfp_mask)
+{
+	struct ring_mempool_cache *cache;
+	void *objs[RING_MEMPOOL_CHUNK];
+	struct ring_mempool *pool;
+	unsigned int n, cpu;
+	size_t cache_bytes;
+	int done;
+
+	if (!kmem || !size || cache_size > RING_MEMPOOL_CACHE_MAX) {
+		pr_err("%s() invalid size:%u cache_size:%u\n",
+		       __func__, size, cache_size);
+		return NULL;
+	}
+
+	pool = kzalloc(sizeof(*pool), gfp_mask);
+	if (!pool)
+		return NULL;
+	pool->size = size;
+	pool->cache_size = cache_size;
+	pool->kmem = kmem;
+
+	/* Usable ring size is count-1 */
+	pool->ring = ring_queue_create(roundup_pow_of_two(size + 1), 0);
+	if (!pool->ring)
+		goto err;
+
+	if (cache_size) {
+		cache_bytes = struct_size(cache, objs, 2 * cache_size);
+		pool->cache = __alloc_percpu_gfp(cache_bytes, SMP_CACHE_BYTES,
+						 gfp_mask);
+		if (!pool->cache)
+			goto err;
+		for_each_possible_cpu(cpu) {
+			cache = per_cpu_ptr(pool->cache, cpu);
+			cache->size = cache_size;
+			cache->flushthresh = cache_size * 3 / 2;
+			cache->len = 0;
+		}
+	}
+
+	for (n = 0; n < size; n += done) {
+		done = min_t(unsigned int, size - n, RING_MEMPOOL_CHUNK);
+		if (!kmem_cache_alloc_bulk(kmem, gfp_mask, done, objs))
+			goto err_objs;
+		ring_queue_sp_enqueue_bulk(pool->ring, objs, done);
+	}
+	return pool;
+
+err_objs:
+	ring_mempool_free_objs(pool);
+err:
+	free_percpu(pool->cache);
+	if (pool->ring)
+		ring_queue_free(pool->ring);
+	kfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL(ring_mempool_create);
+
+/* Objects in ring and caches, racy while the pool is in use */
+unsigned int ring_mempool_avail_count(struct ring_mempool *pool)
+{
+	unsigned int count = ring_queue_count(pool->ring);
+	unsigned int cpu;
+
+	if (pool->cache) {
+		for_each_possible_cpu(cpu)
+			count += READ_ONCE(per_cpu_ptr(pool->cache, cpu)->len);
+	}
+	return min(count, pool->size);
+}
+EXPORT_SYMBOL(ring_mempool_avail_count);
+
+MODULE_DESCRIPTION("Object pool on top of ring_queue (ring_mempool)");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
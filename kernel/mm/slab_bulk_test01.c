@@ -37,7 +37,7 @@ struct my_elem {
 static int time_bench_for_loop(
 	struct time_bench_record *rec, void *data)
 {
-	int i;
+	uint64_t i;
 	uint64_t loops_cnt = 0;
 
 	time_bench_start(rec);
@@ -57,7 +57,7 @@ static int benchmark_kmem_cache_fastpath_reuse(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	struct my_elem *elem;
 	struct kmem_cache *slab;
 
@@ -123,7 +123,7 @@ static int benchmark_slab_fallback_bulk(
 #define MAX_BULK 250
 	void *objs[MAX_BULK];
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	bool success;
 	struct kmem_cache *slab;
 	size_t bulk = rec->step;
@@ -133,12 +133,6 @@ static int benchmark_slab_fallback_bulk(
 			__func__, bulk, MAX_BULK);
 		bulk = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	slab = kmem_cache_create("slab_bench_test2", sizeof(struct my_elem),
 				 0, SLAB_HWCACHE_ALIGN, NULL);
 	time_bench_start(rec);
@@ -172,7 +166,7 @@ static int benchmark_slab_bulk01(
 #define MAX_BULK 250
 	void *objs[MAX_BULK];
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	bool success;
 	struct kmem_cache *slab;
 	size_t bulk = rec->step;
@@ -182,12 +176,6 @@ static int benchmark_slab_bulk01(
 			__func__, bulk, MAX_BULK);
 		bulk = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	slab = kmem_cache_create("slab_bench_test3", sizeof(struct my_elem),
 				 0, SLAB_HWCACHE_ALIGN, NULL);
 	time_bench_start(rec);
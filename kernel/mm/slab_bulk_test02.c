@@ -39,7 +39,7 @@ static int benchmark_slab_bulk(
 	struct time_bench_record *rec, void *data)
 {
 	uint64_t loops_cnt = 0;
-	int i;
+	uint64_t i;
 	bool success;
 	struct kmem_cache *slab;
 	size_t bulk = rec->step;
@@ -49,12 +49,6 @@ static int benchmark_slab_bulk(
 			__func__, bulk, MAX_BULK);
 		bulk = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	slab = kmem_cache_create("slab_bulk_test02", sizeof(struct my_elem),
 				 0, SLAB_HWCACHE_ALIGN, NULL);
 	time_bench_start(rec);
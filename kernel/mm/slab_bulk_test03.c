@@ -212,7 +212,8 @@ static __always_inline int __benchmark_slab_bulk(
 	enum test_type type)
 {
 	uint64_t loops_cnt = 0;
-	int i, j;
+	uint64_t i;
+	int j;
 	bool success;
 	size_t bulk = rec->step;
 	struct my_obj *last_obj = NULL;
@@ -234,12 +235,6 @@ static __always_inline int __benchmark_slab_bulk(
 			__func__, bulk, MAX_BULK);
 		bulk = MAX_BULK;
 	}
-	/* loop count is limited to 32-bit due to div_u64_rem() use */
-	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
-		pr_err("Loop cnt too big will overflow 32-bit\n");
-		return 0;
-	}
-
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
@@ -1,5 +1,11 @@
 /*
  * Slab memory exhaustion test, alloc lots of memory to get failures
+ *
+ * Stress mode (stress=1) records the latency of every alloc attempt,
+ * including its retries, in a time_bench histogram per memory pressure
+ * band.  Bands are 10% steps of the free pages at start, that have
+ * been consumed when the attempt started.  Thus, the latency cliff of
+ * (bulk) allocs as memory runs out and reclaim kicks in gets visible.
  */
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
@@ -8,6 +14,9 @@
 #include <linux/slab.h>
 #include <linux/list.h>
 #include <linux/delay.h>
+#include <linux/vmstat.h>
+#include <linux/vmalloc.h>
+#include <linux/time_bench.h>
 
 /* For testing normal SLUB single alloc API use this module option */
 static int no_bulk=0;
@@ -17,7 +26,16 @@ MODULE_PARM_DESC(no_bulk, "Disable use of BULK alloc API");
 /* Retries can exhaust more memory, easier leading to OOM activation */
 static uint32_t retries = 0;
 module_param(retries, uint, 0);
-MODULE_PARM_DESC(retries, "Number of retries after first memory exhaust");
+MODULE_PARM_DESC(retries, "Number of retries after first memory exhaust (stress: per attempt)");
+
+static int stress=0;
+module_param(stress, uint, 0);
+MODULE_PARM_DESC(stress, "Record alloc latency histograms per memory pressure band");
+
+static int gfp_reclaim=0;
+module_param(gfp_reclaim, uint, 0);
+MODULE_PARM_DESC(gfp_reclaim, "Alloc with GFP_KERNEL|__GFP_NORETRY (direct reclaim) instead of GFP_ATOMIC");
+static gfp_t alloc_gfp = GFP_ATOMIC;
 
 #define MAX_BULK 128
 static unsigned int bulksz = 16;
@@ -58,9 +76,9 @@ bool obj_alloc_and_list_add(struct kmem_cache *s, struct my_queue *q)
 {
 	struct my_elem *object;
 
-	object = kmem_cache_alloc(s, GFP_ATOMIC);
+	object = kmem_cache_alloc(s, alloc_gfp);
 	if (!object) {
-		if (verbose)
+		if (verbose > 1 || (verbose && !stress))
 			pr_err("Could not alloc more objects\n");
 		return false;
 	}
@@ -77,9 +95,9 @@ bool obj_bulk_alloc_and_list_add(struct kmem_cache *s, struct my_queue *q)
 	bool success;
 	int i;
 
-	success = kmem_cache_alloc_bulk(s, GFP_ATOMIC, bulksz, objs);
+	success = kmem_cache_alloc_bulk(s, alloc_gfp, bulksz, objs);
 	if (!success) {
-		if (verbose)
+		if (verbose > 1 || (verbose && !stress))
 			pr_err("Could not bulk(%d) alloc objects\n", bulksz);
 		return false;
 	}
@@ -116,6 +134,97 @@ bool alloc_mem_loop(struct kmem_cache *s, struct my_queue *q)
 	return success;
 }
 
+/*** Stress mode ***/
+#define NR_BANDS 10
+
+struct pressure_band {
+	struct time_bench_hist hist;	/* Latency of attempts, in cycles */
+	u64 attempts;
+	u64 failed;			/* Attempts failing all retries */
+	u64 retries;
+	u64 max_retries;
+};
+static struct pressure_band *bands;
+static unsigned long free_pages_start;
+
+static int pressure_band(void)
+{
+	unsigned long free = global_zone_page_state(NR_FREE_PAGES);
+	unsigned long used;
+
+	if (free >= free_pages_start)
+		return 0;
+	used = free_pages_start - free;
+	return min_t(unsigned long, used * NR_BANDS / free_pages_start,
+		     NR_BANDS - 1);
+}
+
+bool stress_mem_loop(struct kmem_cache *s, struct my_queue *q)
+{
+	struct pressure_band *b;
+	bool success = true;
+	u64 attempt_retries;
+	u64 start;
+
+	free_pages_start = global_zone_page_state(NR_FREE_PAGES);
+
+	while (success && q->len < max_objects) {
+		b = &bands[pressure_band()];
+		attempt_retries = 0;
+
+		start = get_cycles();
+		for (;;) {
+			if (no_bulk == 1)
+				success = obj_alloc_and_list_add(s, q);
+			else
+				success = obj_bulk_alloc_and_list_add(s, q);
+			if (success || attempt_retries == retries)
+				break;
+			attempt_retries++;
+		}
+		time_bench_hist_add(&b->hist, get_cycles() - start);
+
+		b->attempts++;
+		b->retries += attempt_retries;
+		if (attempt_retries > b->max_retries)
+			b->max_retries = attempt_retries;
+		if (!success)
+			b->failed++;
+
+		if (verbose > 1 && ((q->len % progress_every_n)==0))
+			pr_info("Progress allocated: %llu objects\n", q->len);
+		cond_resched(); /* outside the measured attempt */
+	}
+	if (verbose)
+		pr_info("Allocated: %llu objects (last success:%d)\n",
+			q->len, success);
+	return success;
+}
+
+void stress_report(void)
+{
+	struct pressure_band *b;
+	int i;
+
+	pr_info("Stress: %s %s alloc of %d objs, start free pages:%lu\n",
+		gfp_reclaim ? "GFP_KERNEL|__GFP_NORETRY" : "GFP_ATOMIC",
+		no_bulk ? "single" : "bulk", no_bulk ? 1 : bulksz,
+		free_pages_start);
+
+	for (i = 0; i < NR_BANDS; i++) {
+		b = &bands[i];
+		if (!b->attempts)
+			continue;
+		time_bench_hist_calc(&b->hist);
+		pr_info("Pressure %3d-%3d%%: attempts:%llu failed:%llu "
+			"retries:%llu (max:%llu) cycles p50:%llu p99:%llu "
+			"p99.9:%llu max:%llu\n",
+			i * 100 / NR_BANDS, (i + 1) * 100 / NR_BANDS,
+			b->attempts, b->failed, b->retries, b->max_retries,
+			b->hist.p50, b->hist.p99, b->hist.p999, b->hist.max);
+	}
+}
+
 void free_all(struct kmem_cache *s, struct my_queue *q)
 {
 	struct my_elem *obj, *obj_tmp;
@@ -139,6 +248,8 @@ void free_all(struct kmem_cache *s, struct my_queue *q)
 static int __init slab_bulk_test04_module_init(void)
 {
 	struct my_elem *object;
+	bool exhausted;
+	int i;
 
 	INIT_LIST_HEAD(&global_q.list);
 	global_q.len = 0;
@@ -168,8 +279,25 @@ static int __init slab_bulk_test04_module_init(void)
 	}
 	kmem_cache_free(slab, object);
 
+	if (gfp_reclaim)
+		alloc_gfp = GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN;
+
+	if (stress) {
+		bands = vzalloc(sizeof(*bands) * NR_BANDS);
+		if (!bands) {
+			kmem_cache_destroy(slab);
+			return -ENOMEM;
+		}
+		for (i = 0; i < NR_BANDS; i++)
+			time_bench_hist_init(&bands[i].hist);
+	}
+
 	/* Try to exhaust slab memory */
-	if (!alloc_mem_loop(slab, &global_q)) {
+	if (stress)
+		exhausted = !stress_mem_loop(slab, &global_q);
+	else
+		exhausted = !alloc_mem_loop(slab, &global_q);
+	if (exhausted) {
 		pr_info("Successful test: Alloc exceeded memory limit");
 	} else {
 		pr_err("Invalid test: not exceeded memory limit");
@@ -180,6 +308,11 @@ static int __init slab_bulk_test04_module_init(void)
 
 	free_all(slab, &global_q);
 
+	if (stress) {
+		stress_report();
+		vfree(bands);
+	}
+
 	if (global_q.len != 0) {
 		pr_err("ERROR: some objects remain in the global queue");
 	}
@@ -0,0 +1,418 @@
+/*
+ * Object-lifetime workload benchmarking of slab bulk
+ *
+ * The other slab_bulk_test modules free objects right after
+ * allocating them (or in a synthetic page order).  This module
+ * replays a mixture of object lifetimes, like a network stack with
+ * many short-lived skb heads and fewer long-lived sockets, where the
+ * objects freed together have been allocated at different times.
+ *
+ * Time is simulated in "ticks".  Every tick allocates bulksz objects,
+ * each being a long-lived object with probability long_pct percent,
+ * else short-lived.  The lifetime (in ticks) is drawn uniformly from
+ * [1, 2*life] of the class, and objects are freed when their tick
+ * comes around (a timer wheel).  Expired objects are freed either with
+ * kmem_cache_free_bulk() or one by one, matching the alloc side.
+ *
+ * Reported besides the time_bench throughput:
+ *  - fragmentation, live objects per slab and partial slabs
+ *  - free_bulk coalescing ratio, objects per run of adjacent objects
+ *    on the same slab in the free arrays (a lower bound for what
+ *    SLUB's detached freelist can coalesce)
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
+
+static int verbose=1;
+
+static uint32_t ticks = 100000;
+module_param(ticks, uint, 0);
+MODULE_PARM_DESC(ticks, "Simulated ticks to measure (after a warmup)");
+
+static unsigned int bulksz = 16;
+module_param(bulksz, uint, 0);
+MODULE_PARM_DESC(bulksz, "Objects allocated per tick");
+
+static unsigned int long_pct = 5;
+module_param(long_pct, uint, 0);
+MODULE_PARM_DESC(long_pct, "Percent of allocations being long-lived");
+
+static unsigned int short_life = 4;
+module_param(short_life, uint, 0);
+MODULE_PARM_DESC(short_life, "Mean lifetime in ticks of short-lived objects");
+
+static unsigned int long_life = 1024;
+module_param(long_life, uint, 0);
+MODULE_PARM_DESC(long_life, "Mean lifetime in ticks of long-lived objects");
+
+static unsigned int short_size = 256;
+module_param(short_size, uint, 0);
+MODULE_PARM_DESC(short_size, "Object size of short-lived objects (skb head like)");
+
+static unsigned int long_size = 1024;
+module_param(long_size, uint, 0);
+MODULE_PARM_DESC(long_size, "Object size of long-lived objects (socket like)");
+
+static unsigned long seed = 42;
+module_param(seed, ulong, 0);
+MODULE_PARM_DESC(seed, "Random seed, same seed replays the same workload");
+
+enum obj_class {
+	CLS_SHORT = 0,
+	CLS_LONG,
+	CLS_NR
+};
+
+static const char *cls_name[CLS_NR] = { "short", "long" };
+
+/* Header of objects, rest of object is padding */
+struct life_obj {
+	struct hlist_node node;	/* In timer wheel bucket */
+	u8 cls;
+};
+
+#define MAX_BULK 256
+
+struct lifetime {
+	struct kmem_cache *slab[CLS_NR];
+	struct hlist_head *wheel;
+	unsigned int wheel_mask;
+	u64 now;
+	u64 rnd;
+	unsigned long live[CLS_NR];
+
+	/* Alloc arrays per class, too large for the stack */
+	void *alloc_objs[CLS_NR][MAX_BULK];
+
+	/* Free arrays per class, flushed when full or at end of tick */
+	void *free_objs[CLS_NR][MAX_BULK];
+	unsigned int free_cnt[CLS_NR];
+
+	/* Coalescing stats */
+	u64 freed_bulk;
+	u64 free_runs;
+};
+
+/* Local PRNG (xorshift64), reproducible across kernels */
+static __always_inline u32 life_rand(struct lifetime *lt, u32 range)
+{
+	u64 x = lt->rnd;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	lt->rnd = x;
+	return ((x >> 32) * range) >> 32;
+}
+
+static __always_inline unsigned int life_draw(struct lifetime *lt,
+					      enum obj_class cls)
+{
+	unsigned int life = (cls == CLS_LONG) ? long_life : short_life;
+
+	return 1 + life_rand(lt, 2 * life);
+}
+
+static void free_flush(struct lifetime *lt, enum obj_class cls, bool bulk)
+{
+	unsigned int n = lt->free_cnt[cls];
+	void **objs = lt->free_objs[cls];
+	struct page *prev = NULL, *page;
+	unsigned int i;
+
+	if (!n)
+		return;
+
+	if (bulk) {
+		/* Coalescing runs, as free_bulk sees the array */
+		for (i = 0; i < n; i++) {
+			page = virt_to_head_page(objs[i]);
+			if (page != prev)
+				lt->free_runs++;
+			prev = page;
+		}
+		lt->freed_bulk += n;
+		kmem_cache_free_bulk(lt->slab[cls], n, objs);
+	} else {
+		for (i = 0; i < n; i++)
+			kmem_cache_free(lt->slab[cls], objs[i]);
+	}
+	lt->free_cnt[cls] = 0;
+}
+
+static __always_inline void expire_tick(struct lifetime *lt, bool bulk)
+{
+	struct hlist_head *bucket = &lt->wheel[lt->now & lt->wheel_mask];
+	struct hlist_node *tmp;
+	struct life_obj *obj;
+	int cls;
+
+	hlist_for_each_entry_safe(obj, tmp, bucket, node) {
+		hlist_del(&obj->node);
+		cls = obj->cls;
+		lt->live[cls]--;
+		lt->free_objs[cls][lt->free_cnt[cls]++] = obj;
+		if (lt->free_cnt[cls] == MAX_BULK)
+			free_flush(lt, cls, bulk);
+	}
+	for (cls = 0; cls < CLS_NR; cls++)
+		free_flush(lt, cls, bulk);
+}
+
+static __always_inline void place_obj(struct lifetime *lt,
+				      struct life_obj *obj,
+				      enum obj_class cls)
+{
+	u64 expire = lt->now + life_draw(lt, cls);
+
+	obj->cls = cls;
+	hlist_add_head(&obj->node, &lt->wheel[expire & lt->wheel_mask]);
+	lt->live[cls]++;
+}
+
+static __always_inline int alloc_tick(struct lifetime *lt, bool bulk)
+{
+	void *(*objs)[MAX_BULK] = lt->alloc_objs;
+	unsigned int n[CLS_NR] = { 0, 0 };
+	unsigned int i;
+	int cls;
+
+	/* Draw the class mix of this tick */
+	for (i = 0; i < bulksz; i++) {
+		cls = life_rand(lt, 100) < long_pct ? CLS_LONG : CLS_SHORT;
+		n[cls]++;
+	}
+	for (cls = 0; cls < CLS_NR; cls++) {
+		if (!n[cls])
+			continue;
+		if (bulk) {
+			if (!kmem_cache_alloc_bulk(lt->slab[cls], GFP_ATOMIC,
+						   n[cls], objs[cls]))
+				return -ENOMEM;
+		} else {
+			for (i = 0; i < n[cls]; i++) {
+				objs[cls][i] = kmem_cache_alloc(lt->slab[cls],
+								GFP_ATOMIC);
+				if (!objs[cls][i]) {
+					while (i--)
+						kmem_cache_free(lt->slab[cls],
+								objs[cls][i]);
+					return -ENOMEM;
+				}
+			}
+		}
+		for (i = 0; i < n[cls]; i++)
+			place_obj(lt, objs[cls][i], cls);
+	}
+	return 0;
+}
+
+static __always_inline int run_ticks(struct lifetime *lt, u64 nr, bool bulk)
+{
+	u64 i;
+
+	for (i = 0; i < nr; i++) {
+		lt->now++;
+		expire_tick(lt, bulk);
+		if (alloc_tick(lt, bulk))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static int cmp_ptr(const void *a, const void *b)
+{
+	unsigned long x = *(unsigned long *)a, y = *(unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Walk live objects, and count slabs they occupy (outside timing) */
+static void report_fragmentation(struct lifetime *lt)
+{
+	unsigned long total = lt->live[CLS_SHORT] + lt->live[CLS_LONG];
+	unsigned long n[CLS_NR] = { 0, 0 };
+	struct page **pages[CLS_NR] = { NULL, NULL };
+	struct life_obj *obj;
+	unsigned int i;
+	int cls;
+
+	for (cls = 0; cls < CLS_NR; cls++) {
+		pages[cls] = vmalloc(sizeof(struct page *) * (total + 1));
+		if (!pages[cls])
+			goto out;
+	}
+	for (i = 0; i <= lt->wheel_mask; i++) {
+		hlist_for_each_entry(obj, &lt->wheel[i], node)
+			pages[obj->cls][n[obj->cls]++] = virt_to_head_page(obj);
+	}
+
+	for (cls = 0; cls < CLS_NR; cls++) {
+		unsigned long slabs = 0, partial = 0, run = 0, j;
+		unsigned int size = kmem_cache_size(lt->slab[cls]);
+		unsigned long capacity;
+
+		if (!n[cls])
+			continue;
+		sort(pages[cls], n[cls], sizeof(struct page *), cmp_ptr, NULL);
+		for (j = 0; j < n[cls]; j++) {
+			run++;
+			if (j + 1 < n[cls] && pages[cls][j + 1] == pages[cls][j])
+				continue;
+			/* Last object of this slab */
+			capacity = page_size(pages[cls][j]) / size;
+			slabs++;
+			if (run < capacity)
+				partial++;
+			run = 0;
+		}
+		pr_info("Fragmentation %s: live %lu objs in %lu slabs "
+			"(%lu.%02lu objs/slab), partial slabs %lu\n",
+			cls_name[cls], n[cls], slabs,
+			n[cls] / slabs, (n[cls] * 100 / slabs) % 100, partial);
+	}
+out:
+	for (cls = 0; cls < CLS_NR; cls++)
+		vfree(pages[cls]);
+}
+
+static void lifetime_drain(struct lifetime *lt)
+{
+	unsigned int i;
+
+	for (i = 0; i <= lt->wheel_mask; i++) {
+		lt->now++;
+		expire_tick(lt, true);
+	}
+	WARN_ON(lt->live[CLS_SHORT] || lt->live[CLS_LONG]);
+}
+
+static __always_inline int __benchmark_lifetime(
+	struct time_bench_record *rec, void *data, bool bulk)
+{
+	struct lifetime *lt = data;
+	uint64_t loops_cnt = 0;
+
+	lt->rnd = seed ? : 1;
+	lt->freed_bulk = lt->free_runs = 0;
+
+	/* Warmup, reach steady state of live long-lived objects */
+	if (run_ticks(lt, 2 * long_life, bulk))
+		goto out;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	if (!run_ticks(lt, rec->loops, bulk))
+		loops_cnt = rec->loops * bulksz;
+	time_bench_stop(rec, loops_cnt);
+
+	report_fragmentation(lt);
+	if (bulk && lt->free_runs)
+		pr_info("free_bulk coalescing: %llu objs in %llu runs "
+			"(%llu.%02llu objs/run)\n",
+			lt->freed_bulk, lt->free_runs,
+			lt->freed_bulk / lt->free_runs,
+			(lt->freed_bulk * 100 / lt->free_runs) % 100);
+out:
+	lifetime_drain(lt);
+	return loops_cnt;
+}
+static int benchmark_lifetime_bulk(struct time_bench_record *rec, void *data)
+{
+	return __benchmark_lifetime(rec, data, true);
+}
+static int benchmark_lifetime_single(struct time_bench_record *rec, void *data)
+{
+	return __benchmark_lifetime(rec, data, false);
+}
+
+static int run_timing_tests(struct lifetime *lt)
+{
+	pr_info("Lifetime mix: %u%% long (life %u, size %u), "
+		"short (life %u, size %u), %u objs/tick\n",
+		long_pct, long_life, long_size, short_life, short_size,
+		bulksz);
+
+	time_bench_loop(ticks, bulksz, "lifetime-bulk", lt,
+			benchmark_lifetime_bulk);
+	time_bench_loop(ticks, bulksz, "lifetime-single", lt,
+			benchmark_lifetime_single);
+	return 0;
+}
+
+static int __init slab_bulk_test06_module_init(void)
+{
+	unsigned int sizes[CLS_NR] = { short_size, long_size };
+	struct lifetime *lt;
+	int cls, err = 0;
+
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!bulksz || bulksz > MAX_BULK || long_pct > 100 ||
+	    !short_life || !long_life) {
+		pr_err("Invalid parameters\n");
+		return -EINVAL;
+	}
+
+	lt = vzalloc(sizeof(*lt));
+	if (!lt)
+		return -ENOMEM;
+	/* Max lifetime 2*life must not wrap the wheel */
+	lt->wheel_mask = roundup_pow_of_two(2 * max(long_life, short_life) + 1)
+			 - 1;
+	lt->wheel = vzalloc(sizeof(*lt->wheel) * (lt->wheel_mask + 1));
+	if (!lt->wheel) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (cls = 0; cls < CLS_NR; cls++) {
+		lt->slab[cls] = kmem_cache_create(
+			cls == CLS_LONG ? "slab_bulk_test06_long" :
+					  "slab_bulk_test06_short",
+			max_t(unsigned int, sizes[cls], sizeof(struct life_obj)),
+			0, SLAB_HWCACHE_ALIGN, NULL);
+		if (!lt->slab[cls]) {
+			err = -ENOMEM;
+			goto out_slab;
+		}
+	}
+
+	if (verbose) {
+		preempt_disable();
+		pr_info("DEBUG: cpu:%d\n", smp_processor_id());
+		preempt_enable();
+		pr_info("NOTICE: Measurements include the timer wheel\n");
+	}
+
+	run_timing_tests(lt);
+
+out_slab:
+	for (cls = 0; cls < CLS_NR; cls++)
+		if (lt->slab[cls])
+			kmem_cache_destroy(lt->slab[cls]);
+	vfree(lt->wheel);
+out:
+	vfree(lt);
+	return err;
+}
+module_init(slab_bulk_test06_module_init);
+
+static void __exit slab_bulk_test06_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(slab_bulk_test06_module_exit);
+
+MODULE_DESCRIPTION("Object-lifetime workload benchmarking of slab bulk");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
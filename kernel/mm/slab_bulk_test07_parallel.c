@@ -0,0 +1,242 @@
+/*
+ * Parallel multi-CPU scaling benchmark of slab bulk
+ *
+ * The other slab_bulk_test modules run on a single CPU, thus never
+ * see contention on the node partial list.  This module sweeps
+ *   bulk size x CPU count x (local | cross-CPU free)
+ * running kmem_cache_alloc_bulk()/kmem_cache_free_bulk() concurrently
+ * on all selected CPUs via time_bench_run_concurrent().
+ *
+ * Local: every CPU allocates and frees its own bulks.
+ *
+ * Cross: CPUs are paired (cpu_idx even/odd).  The even CPU allocates
+ *  bulks and hands the objects over a SPSC alf_queue to its partner,
+ *  which bulk frees them, thus every free is a remote free.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/alf_queue.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+
+static int verbose=1;
+
+static uint32_t loops = 1000000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Objects per CPU per measurement");
+
+static unsigned int bulk_max = 128;
+module_param(bulk_max, uint, 0);
+MODULE_PARM_DESC(bulk_max, "Sweep bulk sizes 1,2,4.. up to this (max 128)");
+
+static int max_cpus;
+module_param(max_cpus, uint, 0);
+MODULE_PARM_DESC(max_cpus, "Sweep CPU count 1,2,4.. up to this (default 0 = all online)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+static unsigned int obj_size = 256;
+module_param(obj_size, uint, 0);
+MODULE_PARM_DESC(obj_size, "Object size of the kmem_cache (default 256)");
+
+#define MAX_BULK 128	/* On stack */
+#define Q_SIZE	 1024	/* Per CPU pair, must be >= MAX_BULK */
+
+struct slab_par {
+	struct kmem_cache *slab;
+	struct alf_queue **pairq;	/* Per CPU pair, cross mode */
+	int nr_pairs;
+	bool abort;	/* Alloc CPU failed, free CPU must not wait */
+};
+
+static int time_bulk_local(struct time_bench_record *rec, void *data)
+{
+	struct slab_par *p = data;
+	void *objs[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int bulk = rec->step;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (!kmem_cache_alloc_bulk(p->slab, GFP_ATOMIC, bulk, objs))
+			break;
+		barrier(); /* compiler barrier */
+		kmem_cache_free_bulk(p->slab, bulk, objs);
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+
+static int time_bulk_cross(struct time_bench_record *rec, void *data)
+{
+	struct slab_par *p = data;
+	struct alf_queue *q = p->pairq[rec->cpu_idx / 2];
+	bool alloc_CPU = (rec->cpu_idx % 2) == 0;
+	void *objs[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int bulk = rec->step;
+	int n;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	while (loops_cnt < rec->loops) {
+		if (alloc_CPU) {
+			if (!kmem_cache_alloc_bulk(p->slab, GFP_ATOMIC,
+						   bulk, objs)) {
+				WRITE_ONCE(p->abort, true);
+				break;
+			}
+			while (alf_sp_enqueue(q, objs, bulk) != bulk)
+				cpu_relax(); /* full, wait for free CPU */
+			loops_cnt += bulk;
+		} else {
+			n = alf_sc_dequeue(q, objs, bulk);
+			if (!n) {
+				if (READ_ONCE(p->abort))
+					break;
+				cpu_relax(); /* empty, wait for alloc CPU */
+				continue;
+			}
+			kmem_cache_free_bulk(p->slab, n, objs);
+			loops_cnt += n;
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark alloc/free, as "step" gets printed */
+	rec->step = alloc_CPU;
+	return loops_cnt;
+}
+
+static void run_parallel(const char *desc, const cpumask_t *cpumask,
+			 int bulk, struct slab_par *p,
+			 int (*func)(struct time_bench_record *record,
+				     void *data))
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	size_t size;
+
+	/* Allocate records for every CPU */
+	size = sizeof(*cpu_tasks) * num_possible_cpus();
+	cpu_tasks = kzalloc(size, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	p->abort = false;
+	/* Round down to a multiple of bulk, cross CPUs must agree */
+	time_bench_run_concurrent(loops / bulk * bulk, bulk, p,
+				  cpumask, &sync, cpu_tasks, func);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+
+	kfree(cpu_tasks);
+}
+
+static void drain_pairq(struct slab_par *p)
+{
+	void *obj;
+	int i;
+
+	/* Only if a run stopped early (alloc failure) */
+	for (i = 0; i < p->nr_pairs; i++)
+		while (alf_sc_dequeue(p->pairq[i], &obj, 1) == 1)
+			kmem_cache_free(p->slab, obj);
+}
+
+static void run_sweep(struct slab_par *p, int max)
+{
+	cpumask_t cpumask, pairmask;
+	int cpus, nr, bulk;
+	char desc[64];
+
+	for (nr = 1; ; nr = min(nr * 2, max)) {
+		cpus = time_bench_cpumask_select(&cpumask, topology, nr);
+		if (cpus <= 0)
+			break;
+		for (bulk = 1; bulk <= bulk_max; bulk *= 2) {
+			if (verbose)
+				pr_info("CPUs:%d bulk:%d\n", cpus, bulk);
+			snprintf(desc, sizeof(desc), "slab_bulk_local_%dcpus_b%d",
+				 cpus, bulk);
+			run_parallel(desc, &cpumask, bulk, p, time_bulk_local);
+
+			/* Cross needs pairs, odd CPU left out */
+			if (cpus < 2)
+				continue;
+			cpumask_copy(&pairmask, &cpumask);
+			if (cpus % 2)
+				cpumask_clear_cpu(cpumask_last(&pairmask),
+						  &pairmask);
+			snprintf(desc, sizeof(desc), "slab_bulk_cross_%dcpus_b%d",
+				 cpus & ~1, bulk);
+			run_parallel(desc, &pairmask, bulk, p, time_bulk_cross);
+			drain_pairq(p);
+		}
+		if (nr == max)
+			break;
+	}
+}
+
+static int __init slab_bulk_test07_module_init(void)
+{
+	struct slab_par p = {};
+	int max, i, err = 0;
+
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!bulk_max || bulk_max > MAX_BULK) {
+		pr_err("Invalid bulk_max:%u (max %d)\n", bulk_max, MAX_BULK);
+		return -EINVAL;
+	}
+	max = max_cpus ? : num_online_cpus();
+
+	p.slab = kmem_cache_create("slab_bulk_test07", obj_size, 0,
+				   SLAB_HWCACHE_ALIGN, NULL);
+	if (!p.slab)
+		return -ENOMEM;
+
+	p.nr_pairs = (max + 1) / 2;
+	p.pairq = kcalloc(p.nr_pairs, sizeof(*p.pairq), GFP_KERNEL);
+	if (!p.pairq) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < p.nr_pairs; i++) {
+		p.pairq[i] = alf_queue_alloc(Q_SIZE, GFP_KERNEL);
+		if (IS_ERR(p.pairq[i])) {
+			err = PTR_ERR(p.pairq[i]);
+			p.pairq[i] = NULL;
+			goto out_q;
+		}
+	}
+
+	run_sweep(&p, max);
+
+out_q:
+	for (i = 0; i < p.nr_pairs; i++)
+		if (p.pairq[i])
+			alf_queue_free(p.pairq[i]);
+	kfree(p.pairq);
+out:
+	kmem_cache_destroy(p.slab);
+	return err;
+}
+module_init(slab_bulk_test07_module_init);
+
+static void __exit slab_bulk_test07_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(slab_bulk_test07_module_exit);
+
+MODULE_DESCRIPTION("Parallel multi-CPU scaling benchmark of slab bulk");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
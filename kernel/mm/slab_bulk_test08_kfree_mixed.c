@@ -0,0 +1,262 @@
+/*
+ * Micro-benchmarking of kfree_bulk() on objects from mixed caches
+ *
+ * slab_bulk_test05 benchmarks kfree_bulk() on objects from a single
+ * cache.  Deferred free lists in e.g. the network stack mix objects
+ * from kmalloc-64/256/1k and skbuff_head_cache.  kfree_bulk() looks
+ * up the cache per object, and builds a detached freelist only from
+ * objects of the same slab, thus interleaving reduce what it can
+ * coalesce.
+ *
+ * The free arrays are built as runs of "run" consecutive objects from
+ * the same cache, cycling through the caches.  run=1 is fully
+ * interleaved, run=bulksz per cache homogeneous.  Compared are:
+ *  - kfree() loop
+ *  - kfree_bulk() on the array as is
+ *  - caller regroups by cache (counting sort), then kfree_bulk()
+ *  - caller regroups by cache, then a free_bulk call per cache
+ * The regroup cost is included, to tell whether callers should
+ * pre-sort.  Alloc cost is the same for all variants.
+ *
+ * The skbuff_head_cache is not exported, a local cache of the same
+ * object size is used instead.  Using kfree() on kmem_cache_alloc()
+ * objects needs kernel v6.4+ (and not SLOB).
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+
+static int verbose=1;
+
+static uint32_t loops = 1000000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Objects per measurement");
+
+static unsigned int bulksz = 64;
+module_param(bulksz, uint, 0);
+MODULE_PARM_DESC(bulksz, "Objects per free array (max 256)");
+
+static unsigned int run;
+module_param(run, uint, 0);
+MODULE_PARM_DESC(run, "Only bench this run length of same-cache objects (default sweep)");
+
+#define MAX_BULK 256
+
+enum mix_cache {
+	MIX_KMALLOC_64 = 0,
+	MIX_KMALLOC_256,
+	MIX_KMALLOC_1K,
+	MIX_SKB_HEAD,
+	MIX_NR
+};
+
+static const size_t mix_size[MIX_NR] = {
+	[MIX_KMALLOC_64]  = 64,
+	[MIX_KMALLOC_256] = 256,
+	[MIX_KMALLOC_1K]  = 1024,
+	[MIX_SKB_HEAD]	  = sizeof(struct sk_buff),
+};
+
+static struct kmem_cache *skb_head_cache;
+
+/* Single threaded benchmark, keep large arrays off the stack */
+static void *objs[MAX_BULK];
+static void *grouped[MAX_BULK];
+static u8 pattern[MAX_BULK];	/* Cache of objs[i] */
+
+enum free_type {
+	FREE_KFREE_LOOP = 1,
+	FREE_KFREE_BULK,
+	FREE_REGROUP_KFREE_BULK,
+	FREE_REGROUP_CACHE_BULK,
+};
+
+static void build_pattern(unsigned int bulk, unsigned int run_len)
+{
+	unsigned int i;
+
+	for (i = 0; i < bulk; i++)
+		pattern[i] = (i / run_len) % MIX_NR;
+}
+
+static __always_inline void *mix_alloc(int cache)
+{
+	if (cache == MIX_SKB_HEAD)
+		return kmem_cache_alloc(skb_head_cache, GFP_ATOMIC);
+	return kmalloc(mix_size[cache], GFP_ATOMIC);
+}
+
+/* Counting sort objs into grouped by cache, keeping order per cache.
+ * Returns start index of every cache group in @start.
+ */
+static __always_inline void regroup(unsigned int bulk,
+				    unsigned int start[MIX_NR + 1])
+{
+	unsigned int pos[MIX_NR];
+	unsigned int i, c;
+
+	memset(start, 0, sizeof(unsigned int) * (MIX_NR + 1));
+	for (i = 0; i < bulk; i++)
+		start[pattern[i] + 1]++;
+	for (c = 0; c < MIX_NR; c++) {
+		start[c + 1] += start[c];
+		pos[c] = start[c];
+	}
+	for (i = 0; i < bulk; i++)
+		grouped[pos[pattern[i]]++] = objs[i];
+}
+
+static __always_inline int __benchmark_kfree_mixed(
+	struct time_bench_record *rec, void *data, enum free_type type)
+{
+	unsigned int start[MIX_NR + 1];
+	unsigned int bulk = rec->step;
+	uint64_t loops_cnt = 0;
+	unsigned int i, c;
+	uint64_t j;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (j = 0; j < rec->loops; j++) {
+		for (i = 0; i < bulk; i++) {
+			objs[i] = mix_alloc(pattern[i]);
+			if (unlikely(!objs[i])) {
+				kfree_bulk(i, objs);
+				goto out;
+			}
+		}
+		barrier(); /* compiler barrier */
+
+		switch (type) {
+		case FREE_KFREE_LOOP:
+			for (i = 0; i < bulk; i++)
+				kfree(objs[i]);
+			break;
+		case FREE_KFREE_BULK:
+			kfree_bulk(bulk, objs);
+			break;
+		case FREE_REGROUP_KFREE_BULK:
+			regroup(bulk, start);
+			kfree_bulk(bulk, grouped);
+			break;
+		case FREE_REGROUP_CACHE_BULK:
+			regroup(bulk, start);
+			for (c = 0; c < MIX_NR; c++) {
+				unsigned int n = start[c + 1] - start[c];
+
+				if (!n)
+					continue;
+				/* Caller knows the cache for the group, the
+				 * kmalloc caches are not exported (and can
+				 * be per memcg), thus kfree_bulk() for them
+				 */
+				if (c == MIX_SKB_HEAD)
+					kmem_cache_free_bulk(skb_head_cache, n,
+							     &grouped[start[c]]);
+				else
+					kfree_bulk(n, &grouped[start[c]]);
+			}
+			break;
+		default:
+			BUILD_BUG();
+		}
+
+		/* NOTICE THIS COUNTS (bulk) alloc+free together*/
+		loops_cnt += bulk;
+	}
+out:
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+/* Compiler should inline optimize other function calls out */
+static int benchmark_kfree_loop(struct time_bench_record *rec, void *data)
+{
+	return __benchmark_kfree_mixed(rec, data, FREE_KFREE_LOOP);
+}
+static int benchmark_kfree_bulk(struct time_bench_record *rec, void *data)
+{
+	return __benchmark_kfree_mixed(rec, data, FREE_KFREE_BULK);
+}
+static int benchmark_regroup_kfree_bulk(struct time_bench_record *rec,
+					void *data)
+{
+	return __benchmark_kfree_mixed(rec, data, FREE_REGROUP_KFREE_BULK);
+}
+static int benchmark_regroup_cache_bulk(struct time_bench_record *rec,
+					void *data)
+{
+	return __benchmark_kfree_mixed(rec, data, FREE_REGROUP_CACHE_BULK);
+}
+
+static void mixed_test(unsigned int bulk, unsigned int run_len)
+{
+	build_pattern(bulk, run_len);
+	pr_info("Bulk:%u run:%u (caches interleaved every %u objs)\n",
+		bulk, run_len, run_len);
+
+	time_bench_loop(loops / bulk, bulk, "mixed kfree loop", NULL,
+			benchmark_kfree_loop);
+	time_bench_loop(loops / bulk, bulk, "mixed kfree_bulk", NULL,
+			benchmark_kfree_bulk);
+	time_bench_loop(loops / bulk, bulk, "mixed regroup+kfree_bulk", NULL,
+			benchmark_regroup_kfree_bulk);
+	time_bench_loop(loops / bulk, bulk, "mixed regroup+cache_free_bulk",
+			NULL, benchmark_regroup_cache_bulk);
+	cond_resched();
+}
+
+int run_timing_tests(void)
+{
+	unsigned int run_len;
+
+	if (run) {
+		mixed_test(bulksz, run);
+		return 0;
+	}
+	for (run_len = 1; run_len < bulksz; run_len *= 2)
+		mixed_test(bulksz, run_len);
+	mixed_test(bulksz, bulksz); /* Homogeneous arrays */
+	return 0;
+}
+
+static int __init slab_bulk_test08_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!bulksz || bulksz > MAX_BULK) {
+		pr_err("Invalid bulksz:%u (max %d)\n", bulksz, MAX_BULK);
+		return -EINVAL;
+	}
+
+	skb_head_cache = kmem_cache_create("slab_bulk_test08_skb",
+					   mix_size[MIX_SKB_HEAD], 0,
+					   SLAB_HWCACHE_ALIGN, NULL);
+	if (!skb_head_cache)
+		return -ENOMEM;
+
+	preempt_disable();
+	pr_info("DEBUG: cpu:%d\n", smp_processor_id());
+	preempt_enable();
+
+	run_timing_tests();
+
+	kmem_cache_destroy(skb_head_cache);
+	return 0;
+}
+module_init(slab_bulk_test08_module_init);
+
+static void __exit slab_bulk_test08_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(slab_bulk_test08_module_exit);
+
+MODULE_DESCRIPTION("Micro-benchmarking of kfree_bulk() on mixed caches");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,230 @@
+/*
+ * Benchmark of slab bulk alloc under injected allocation failures
+ *
+ * The fault-inject scripts (tests/fault-inject/) only check that the
+ * kmem_cache_alloc_bulk() error path is correct.  This module measures
+ * what failures cost: throughput, and per call latency histograms of
+ * successful versus failed (rolled back) bulk allocs.
+ *
+ * Objects are held (up to "hold" objects) before being bulk freed, so
+ * the cache keeps needing new slab pages, where fail_page_alloc can
+ * fail the bulk half-way (the partial-bulk rollback path).  With
+ * failslab the whole bulk fails up front instead.
+ *
+ * Fault injection is configured by bench01_kmem_cache_alloc_bulk.sh
+ * with task-filter enabled.  With inject=1 the module only marks its
+ * own task (make-it-fail) around the measured loop, thus module load
+ * and setup never see injected failures.  Each run is done without
+ * and with injection.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+
+static int verbose=1;
+
+static uint32_t loops = 100000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Bulk alloc calls per measurement");
+
+#define MAX_BULK 128
+static unsigned int bulksz = 16;
+module_param(bulksz, uint, 0);
+MODULE_PARM_DESC(bulksz, "Parameter for setting bulk size to bench");
+
+static unsigned int hold = 65536;
+module_param(hold, uint, 0);
+MODULE_PARM_DESC(hold, "Objects held before bulk freeing them all");
+
+static int inject = 1;
+module_param(inject, uint, 0);
+MODULE_PARM_DESC(inject, "Mark own task make-it-fail during the injected run");
+
+static int no_bulk=0;
+module_param(no_bulk, uint, 0);
+MODULE_PARM_DESC(no_bulk, "Use an alloc loop with rollback instead of the BULK API");
+
+struct my_elem {
+	char pad[256];
+};
+
+struct fault_bench {
+	struct kmem_cache *slab;
+	void **held;
+	unsigned int nheld;
+	bool inject;
+
+	/* Results of the last run */
+	u64 ok, failed;
+	struct time_bench_hist hist_ok, hist_fail;	/* Cycles per call */
+};
+
+/* Same as slab_common fallback, for the no_bulk comparison */
+noinline
+bool my__kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t nr,
+			       void **p)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		void *x = p[i] = kmem_cache_alloc(s, flags);
+		if (!x) {
+			while (i--)
+				kmem_cache_free(s, p[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void fault_inject_self(bool on)
+{
+#ifdef CONFIG_FAULT_INJECTION
+	current->make_it_fail = on;
+#endif
+}
+
+static void free_held(struct fault_bench *fb)
+{
+	kmem_cache_free_bulk(fb->slab, fb->nheld, fb->held);
+	fb->nheld = 0;
+}
+
+static int benchmark_fault_bulk(struct time_bench_record *rec, void *data)
+{
+	struct fault_bench *fb = data;
+	uint64_t loops_cnt = 0;
+	size_t bulk = rec->step;
+	uint64_t t;
+	bool ok;
+	uint64_t i;
+
+	fb->ok = fb->failed = 0;
+	time_bench_hist_init(&fb->hist_ok);
+	time_bench_hist_init(&fb->hist_fail);
+
+	if (fb->inject)
+		fault_inject_self(true);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		if (fb->nheld + bulk > hold)
+			free_held(fb);
+
+		t = get_cycles();
+		if (no_bulk)
+			ok = my__kmem_cache_alloc_bulk(fb->slab, GFP_ATOMIC,
+						       bulk,
+						       &fb->held[fb->nheld]);
+		else
+			ok = kmem_cache_alloc_bulk(fb->slab, GFP_ATOMIC, bulk,
+						   &fb->held[fb->nheld]);
+		t = get_cycles() - t;
+
+		if (ok) {
+			fb->ok++;
+			fb->nheld += bulk;
+			time_bench_hist_add(&fb->hist_ok, t);
+		} else {
+			fb->failed++;
+			time_bench_hist_add(&fb->hist_fail, t);
+		}
+		loops_cnt++;
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	fault_inject_self(false);
+	free_held(fb);
+	return loops_cnt;
+}
+
+static void report(struct fault_bench *fb, const char *txt)
+{
+	struct time_bench_hist *h;
+
+	pr_info("%s: calls ok:%llu failed:%llu (fail rate %llu.%02llu%%)\n",
+		txt, fb->ok, fb->failed,
+		div64_u64(fb->failed * 100, fb->ok + fb->failed ? : 1),
+		div64_u64(fb->failed * 10000, fb->ok + fb->failed ? : 1) % 100);
+
+	h = &fb->hist_ok;
+	time_bench_hist_calc(h);
+	if (h->count)
+		pr_info("%s: ok   cycles p50:%llu p99:%llu p99.9:%llu max:%llu\n",
+			txt, h->p50, h->p99, h->p999, h->max);
+	h = &fb->hist_fail;
+	time_bench_hist_calc(h);
+	if (h->count)
+		pr_info("%s: fail cycles p50:%llu p99:%llu p99.9:%llu max:%llu\n",
+			txt, h->p50, h->p99, h->p999, h->max);
+}
+
+static int __init slab_bulk_test09_module_init(void)
+{
+	struct fault_bench *fb;
+	int err = 0;
+
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (!bulksz || bulksz > MAX_BULK || hold < bulksz) {
+		pr_err("Invalid bulksz:%u or hold:%u\n", bulksz, hold);
+		return -EINVAL;
+	}
+#ifndef CONFIG_FAULT_INJECTION
+	if (inject)
+		pr_warn("Kernel without CONFIG_FAULT_INJECTION, no failures\n");
+#endif
+
+	fb = vzalloc(sizeof(*fb));
+	if (!fb)
+		return -ENOMEM;
+	fb->held = vmalloc(sizeof(void *) * hold);
+	if (!fb->held) {
+		err = -ENOMEM;
+		goto out;
+	}
+	fb->slab = kmem_cache_create("slab_bulk_test09", sizeof(struct my_elem),
+				     0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!fb->slab) {
+		err = -ENOMEM;
+		goto out_held;
+	}
+
+	fb->inject = false;
+	time_bench_loop(loops, bulksz, "alloc_bulk no-inject", fb,
+			benchmark_fault_bulk);
+	report(fb, "no-inject");
+
+	if (inject) {
+		fb->inject = true;
+		time_bench_loop(loops, bulksz, "alloc_bulk fault-inject", fb,
+				benchmark_fault_bulk);
+		report(fb, "fault-inject");
+	}
+
+	kmem_cache_destroy(fb->slab);
+out_held:
+	vfree(fb->held);
+out:
+	vfree(fb);
+	return err;
+}
+module_init(slab_bulk_test09_module_init);
+
+static void __exit slab_bulk_test09_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(slab_bulk_test09_module_exit);
+
+MODULE_DESCRIPTION("Benchmark of slab bulk alloc under fault injection");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,338 @@
+/*
+ * Benchmark module for linux/wfcq_pool.h
+ *  End-to-end cost of message passing over a wfcq, when every message
+ *  is allocated per enqueue (kmalloc/kmem_cache) versus recycled
+ *  through a per CPU qmempool cache (wfcq_pool).
+ *
+ *  Single CPU: alloc+enqueue, dequeue+free on the same CPU.
+ *  Parallel:   producer CPUs alloc+enqueue, consumer CPU (cpu_idx 0)
+ *              dequeue+free, thus every object is freed remotely.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/time_bench.h>
+#include <linux/wfcq_pool.h>
+
+static int verbose=1;
+
+static int parallel_cpus = 4;
+module_param(parallel_cpus, uint, 0);
+MODULE_PARM_DESC(parallel_cpus, "Number of parallel CPUs, one consumer (default 4)");
+
+static char *topology = NULL;
+module_param(topology, charp, 0);
+MODULE_PARM_DESC(topology, "CPU selection: first|core|node|cross|<cpulist> (default first)");
+
+struct bench_msg {
+	struct wfcq_pool_node qnode;
+	int src;		/* Producer index */
+	u64 payload[4];
+};
+DEFINE_WFCQ_POOL(bench_msg, struct bench_msg, qnode);
+
+enum alloc_type {
+	ALLOC_KMALLOC,
+	ALLOC_KMEM_CACHE,
+	ALLOC_WFCQ_POOL,
+};
+
+/* Per producer messages freed by consumer, for flow control */
+struct msg_credit {
+	unsigned long done;
+} ____cacheline_aligned_in_smp;
+
+struct msg_bench {
+	struct wfcq_head head;
+	struct wfcq_tail tail ____cacheline_aligned_in_smp;
+	struct kmem_cache *kmem;
+	struct wfcq_pool pool;
+	int nr_producers;
+	struct msg_credit *credit;	/* Per producer */
+};
+
+/* Max messages a producer has in flight, keeps the pool from missing
+ * only because producers outrun the consumer
+ */
+#define WINDOW 1024
+#define BULK   16
+
+static __always_inline struct bench_msg *msg_alloc(struct msg_bench *b,
+						   enum alloc_type type)
+{
+	struct bench_msg *msg;
+
+	switch (type) {
+	case ALLOC_KMALLOC:
+		msg = kmalloc(sizeof(*msg), GFP_ATOMIC);
+		break;
+	case ALLOC_KMEM_CACHE:
+		msg = kmem_cache_alloc(b->kmem, GFP_ATOMIC);
+		break;
+	case ALLOC_WFCQ_POOL:
+		return bench_msg_alloc(&b->pool, GFP_ATOMIC);
+	default:
+		BUILD_BUG();
+	}
+	if (likely(msg))
+		wfcq_node_init(&msg->qnode.node);
+	return msg;
+}
+
+static __always_inline void msg_free(struct msg_bench *b,
+				     struct bench_msg *msg,
+				     enum alloc_type type)
+{
+	switch (type) {
+	case ALLOC_KMALLOC:
+		kfree(msg);
+		break;
+	case ALLOC_KMEM_CACHE:
+		kmem_cache_free(b->kmem, msg);
+		break;
+	case ALLOC_WFCQ_POOL:
+		bench_msg_free(&b->pool, msg);
+		break;
+	default:
+		BUILD_BUG();
+	}
+}
+
+/*** Single CPU, enqueue and dequeue @step messages per round ***/
+
+static __always_inline int time_msg_same_cpu(
+	struct time_bench_record *rec, void *data, enum alloc_type type)
+{
+	struct bench_msg *msgs[BULK];
+	struct msg_bench *b = data;
+	struct bench_msg *msg;
+	uint64_t loops_cnt = 0;
+	uint64_t i;
+	int j, cnt;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		for (j = 0; j < BULK; j++) {
+			msg = msg_alloc(b, type);
+			if (unlikely(!msg))
+				goto out;
+			msg->payload[0] = j;
+			bench_msg_enqueue(&b->head, &b->tail, msg);
+		}
+		cnt = __bench_msg_dequeue_bulk(&b->head, &b->tail, msgs, BULK);
+		for (j = 0; j < cnt; j++)
+			msg_free(b, msgs[j], type);
+		loops_cnt += cnt;
+	}
+out:
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+}
+static int time_same_cpu_kmalloc(struct time_bench_record *rec, void *data)
+{
+	return time_msg_same_cpu(rec, data, ALLOC_KMALLOC);
+}
+static int time_same_cpu_kmem_cache(struct time_bench_record *rec, void *data)
+{
+	return time_msg_same_cpu(rec, data, ALLOC_KMEM_CACHE);
+}
+static int time_same_cpu_wfcq_pool(struct time_bench_record *rec, void *data)
+{
+	return time_msg_same_cpu(rec, data, ALLOC_WFCQ_POOL);
+}
+
+/*** Parallel, producers to a single consumer ***/
+
+static __always_inline uint64_t consumer_loop(struct msg_bench *b,
+					      uint64_t target,
+					      enum alloc_type type)
+{
+	struct bench_msg *msgs[BULK];
+	uint64_t cnt = 0;
+	int i, n;
+
+	while (cnt < target) {
+		n = __bench_msg_dequeue_bulk(&b->head, &b->tail, msgs, BULK);
+		if (!n) {
+			cpu_relax(); /* wait for producers */
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			int src = msgs[i]->src;
+
+			msg_free(b, msgs[i], type);
+			WRITE_ONCE(b->credit[src].done, b->credit[src].done + 1);
+		}
+		cnt += n;
+	}
+	return cnt;
+}
+
+static __always_inline uint64_t producer_loop(struct msg_bench *b, int idx,
+					      uint64_t target,
+					      enum alloc_type type)
+{
+	unsigned long done = 0;
+	struct bench_msg *msg;
+	uint64_t cnt;
+
+	for (cnt = 0; cnt < target; cnt++) {
+		/* Only re-read the consumer written credit when needed */
+		while (cnt - done >= WINDOW) {
+			done = READ_ONCE(b->credit[idx].done);
+			cpu_relax();
+		}
+		msg = msg_alloc(b, type);
+		if (unlikely(!msg))
+			break;
+		msg->src = idx;
+		bench_msg_enqueue(&b->head, &b->tail, msg);
+	}
+	return cnt;
+}
+
+static __always_inline int time_msg_parallel(
+	struct time_bench_record *rec, void *data, enum alloc_type type)
+{
+	struct msg_bench *b = data;
+	bool consumer = (rec->cpu_idx == 0);
+	uint64_t loops_cnt;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	if (consumer)
+		loops_cnt = consumer_loop(b, rec->loops * b->nr_producers,
+					  type);
+	else
+		loops_cnt = producer_loop(b, rec->cpu_idx - 1, rec->loops,
+					  type);
+	time_bench_stop(rec, loops_cnt);
+
+	/* Hack: use "step" to mark consumer, as "step" gets printed */
+	rec->step = consumer;
+	return loops_cnt;
+}
+static int time_parallel_kmalloc(struct time_bench_record *rec, void *data)
+{
+	return time_msg_parallel(rec, data, ALLOC_KMALLOC);
+}
+static int time_parallel_kmem_cache(struct time_bench_record *rec, void *data)
+{
+	return time_msg_parallel(rec, data, ALLOC_KMEM_CACHE);
+}
+static int time_parallel_wfcq_pool(struct time_bench_record *rec, void *data)
+{
+	return time_msg_parallel(rec, data, ALLOC_WFCQ_POOL);
+}
+
+static void run_parallel(const char *desc, uint32_t loops,
+			 const cpumask_t *cpumask, struct msg_bench *b,
+			 int (*func)(struct time_bench_record *record,
+				     void *data))
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	size_t size;
+
+	/* Allocate records for every CPU */
+	size = sizeof(*cpu_tasks) * num_possible_cpus();
+	cpu_tasks = kzalloc(size, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	memset(b->credit, 0, sizeof(*b->credit) * b->nr_producers);
+	time_bench_run_concurrent(loops, 0, b,
+				  cpumask, &sync, cpu_tasks, func);
+	time_bench_print_stats_cpumask(desc, cpu_tasks, cpumask);
+
+	kfree(cpu_tasks);
+}
+
+int run_benchmark_tests(void)
+{
+	uint32_t loops = 100000;
+	struct msg_bench *b;
+	cpumask_t cpumask;
+	int cpus, err;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+	wfcq_init(&b->head, &b->tail);
+
+	b->kmem = kmem_cache_create("wfcq_bench_msg", sizeof(struct bench_msg),
+				    0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!b->kmem) {
+		err = -ENOMEM;
+		goto out;
+	}
+	/* Remote CPU returns, as the consumer frees all objects */
+	err = wfcq_pool_init(&b->pool, "wfcq_bench_pool",
+			     sizeof(struct bench_msg), 64, 1024, true);
+	if (err)
+		goto out_kmem;
+
+	time_bench_loop(loops, BULK, "kmalloc+wfcq same CPU", b,
+			time_same_cpu_kmalloc);
+	time_bench_loop(loops, BULK, "kmem_cache+wfcq same CPU", b,
+			time_same_cpu_kmem_cache);
+	time_bench_loop(loops, BULK, "wfcq_pool same CPU", b,
+			time_same_cpu_wfcq_pool);
+
+	cpus = time_bench_cpumask_select(&cpumask, topology, parallel_cpus);
+	if (cpus < 2) {
+		pr_err("Need at least two CPUs (got %d)\n", cpus);
+		err = -EINVAL;
+		goto out_pool;
+	}
+	b->nr_producers = cpus - 1;
+	b->credit = kcalloc(b->nr_producers, sizeof(*b->credit), GFP_KERNEL);
+	if (!b->credit) {
+		err = -ENOMEM;
+		goto out_pool;
+	}
+	if (verbose)
+		pr_info("Parallel: %d producers, one consumer\n",
+			b->nr_producers);
+
+	run_parallel("kmalloc+wfcq_parallel", loops, &cpumask, b,
+		     time_parallel_kmalloc);
+	run_parallel("kmem_cache+wfcq_parallel", loops, &cpumask, b,
+		     time_parallel_kmem_cache);
+	run_parallel("wfcq_pool_parallel", loops, &cpumask, b,
+		     time_parallel_wfcq_pool);
+	kfree(b->credit);
+
+out_pool:
+	wfcq_pool_destroy(&b->pool);
+out_kmem:
+	kmem_cache_destroy(b->kmem);
+out:
+	kfree(b);
+	return err;
+}
+
+static int __init wfcq_pool_bench_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (run_benchmark_tests() < 0)
+		return -ECANCELED;
+
+	return 0;
+}
+module_init(wfcq_pool_bench_module_init);
+
+static void __exit wfcq_pool_bench_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(wfcq_pool_bench_module_exit);
+
+MODULE_DESCRIPTION("Benchmark of wfcq message recycling via qmempool");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
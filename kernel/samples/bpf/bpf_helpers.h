@@ -12,6 +12,55 @@
 static int (*bpf_skb_vlan_push)(void *ctx, __be16 vlan_proto, u16 vlan_tci) =
 	(void *) BPF_FUNC_skb_vlan_push;
 
+/* helper functions newer than the uapi bpf.h used here (see
+ * ./kernel/include/), thus defined by their BPF_FUNC_xxx number.  The
+ * defines are safe with a newer uapi bpf.h, as it is included first.
+ */
+#define BPF_MAP_TYPE_RINGBUF	27	/* v5.8 */
+#define BPF_RB_NO_WAKEUP	(1ULL << 0)
+#define BPF_RB_FORCE_WAKEUP	(1ULL << 1)
+#define BPF_MAP_TYPE_DEVMAP_HASH	25	/* v5.4 */
+#define BPF_F_BROADCAST		(1ULL << 3)	/* v5.13 */
+#define BPF_F_EXCLUDE_INGRESS	(1ULL << 4)	/* v5.13 */
+static void *(*bpf_ringbuf_reserve)(void *ringbuf, unsigned long long size,
+				    unsigned long long flags) =
+	(void *) 131; /* v5.8 */
+static void (*bpf_ringbuf_submit)(void *data, unsigned long long flags) =
+	(void *) 132; /* v5.8 */
+static void (*bpf_ringbuf_discard)(void *data, unsigned long long flags) =
+	(void *) 133; /* v5.8 */
+static unsigned long long (*bpf_xdp_get_buff_len)(void *ctx) =
+	(void *) 188; /* v5.18 */
+static int (*bpf_xdp_load_bytes)(void *ctx, unsigned int offset,
+				 void *buf, unsigned int len) =
+	(void *) 189; /* v5.18 */
+#define BPF_F_CURRENT_NETNS	(-1L)
+static int (*bpf_sk_release)(void *sk) =
+	(void *) 86; /* v4.20 */
+/* tuple is struct bpf_sock_tuple, returns struct bpf_sock or NULL */
+static void *(*bpf_skc_lookup_tcp)(void *ctx, void *tuple, int size,
+				   unsigned long long netns_id,
+				   unsigned long long flags) =
+	(void *) 99; /* v5.2 */
+static int (*bpf_tcp_check_syncookie)(void *sk, void *iph, int iph_len,
+				      void *th, int th_len) =
+	(void *) 100; /* v5.2 */
+/* Returns cookie | (u64)mss << 32, or negative error */
+static long long (*bpf_tcp_gen_syncookie)(void *sk, void *iph, int iph_len,
+					  void *th, int th_len) =
+	(void *) 110; /* v5.3 */
+
+/* kfuncs (kernel functions) are not helpers with a fixed number, but
+ * extern symbols resolved by bpf_load.c against the BTF ID of the
+ * function in /sys/kernel/btf/vmlinux.  An unresolved kfunc call is
+ * replaced by "return -EOPNOTSUPP", thus callers must handle that.
+ */
+#define __ksym __attribute__((section(".ksyms")))
+
+/* XDP RX metadata (v6.3, rss_type arg v6.4), needs a device bound prog */
+extern int bpf_xdp_metadata_rx_hash(const struct xdp_md *ctx, __u32 *hash,
+				    __u32 *rss_type) __ksym;
+
 /* helper functions called from eBPF programs written in C */
 static void *(*bpf_map_lookup_elem)(void *map, void *key) =
 	(void *) BPF_FUNC_map_lookup_elem;
@@ -162,6 +211,19 @@ struct bpf_map_def {
 	unsigned int numa_node;
 };
 
+/* BTF-defined maps, loaded by bpf_load.c from SEC(".maps") with the
+ * attributes encoded in the BTF type (needs clang -g), e.g.:
+ *
+ * struct {
+ *	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+ *	__type(key, u32);
+ *	__type(value, u64);
+ *	__uint(max_entries, 1);
+ * } rx_cnt SEC(".maps");
+ */
+#define __uint(name, val) int (*name)[val]
+#define __type(name, val) typeof(val) *name
+
 #define BPF_ANNOTATE_KV_PAIR(name, type_key, type_val)		\
 	struct ____btf_map_##name {				\
 		type_key key;					\
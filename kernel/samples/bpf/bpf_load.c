@@ -5,6 +5,12 @@
  *
  * Added features:
  *  - Fixed load order of prog_fd[] program sections
+ *  - kfunc calls resolved via /sys/kernel/btf/vmlinux
+ *  - Device bound XDP progs, see load_bpf_file_dev_bound()
+ *  - Multi-buffer XDP progs, SEC("xdp.frags...") like libbpf
+ *  - BTF-defined maps (SEC(".maps")) and global data (.data, .rodata
+ *    and .bss), map resize and global data config before load
+ *  - Maps pinned by name and reused on reload, see bpf_load_pin_maps()
  */
 #include <stdio.h>
 #include <sys/types.h>
@@ -29,6 +35,7 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <poll.h>
+#include <limits.h>
 #include <ctype.h>
 #include <assert.h>
 #include "libbpf.h"
@@ -43,6 +50,7 @@ static bool processed_sec[128];
 char bpf_log_buf[BPF_LOG_BUF_SIZE];
 int map_fd[MAX_MAPS];
 int prog_fd[MAX_PROGS];
+char *prog_sec[MAX_PROGS];
 int event_fd[MAX_PROGS];
 int prog_cnt;
 int prog_array_fd = -1;
@@ -50,6 +58,51 @@ int prog_array_fd = -1;
 struct bpf_map_data map_data[MAX_MAPS];
 int map_data_count = 0;
 
+/* When set, XDP progs are loaded bound to this net_device */
+static int dev_bound_ifindex;
+
+/* Map resizes and global data values set before load, applied and
+ * cleared by the next load_bpf_file*() call.
+ */
+#define MAX_PENDING 32
+
+static struct {
+	char *name;
+	__u32 max_entries;
+} pending_resize[MAX_PENDING];
+static int pending_resize_cnt;
+
+static struct {
+	char *name;
+	void *val;
+	size_t size;
+} pending_global[MAX_PENDING];
+static int pending_global_cnt;
+
+/* Global data variables of the last loaded ELF file */
+struct global_var {
+	char *name;
+	int map_idx;	/* map_data[] of its section */
+	__u32 offset;
+	__u32 size;
+};
+static struct global_var *global_vars;
+static int global_var_cnt;
+
+/* Initial value of the global data maps, NULL for other map_data[] */
+static void *global_image[MAX_MAPS];
+
+/* Map pin directory for the next load, and maps not created by it */
+static char pin_maps_dir[PATH_MAX];
+static bool map_reused[MAX_MAPS];
+
+/* Since v5.2: global data, as ld_imm64 of a map value pointer, and
+ * .rodata maps frozen and read-only for progs.
+ */
+#define BPF_LOAD_PSEUDO_MAP_VALUE	2
+#define BPF_LOAD_F_RDONLY_PROG		(1U << 7)
+#define BPF_LOAD_MAP_FREEZE		22
+
 static int populate_prog_array(const char *event, int prog_fd)
 {
 	int ind = atoi(event), err;
@@ -62,6 +115,55 @@ static int populate_prog_array(const char *event, int prog_fd)
 	return 0;
 }
 
+/* XDP prog loaded with prog_flags: device bound (dev_bound_ifindex),
+ * needed for calling the XDP RX metadata kfuncs, and/or frags aware
+ * (BPF_F_XDP_HAS_FRAGS).  The bpf_load_program_attr of the libbpf used
+ * here lacks prog_flags and prog_ifindex, thus use the bpf syscall
+ * directly.
+ */
+static int load_xdp_flags(struct bpf_insn *prog, size_t insns_cnt,
+			  bool frags)
+{
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type	  = BPF_PROG_TYPE_XDP;
+	attr.insns	  = (unsigned long)prog;
+	attr.insn_cnt	  = insns_cnt;
+	attr.license	  = (unsigned long)license;
+	attr.kern_version = kern_version;
+	if (dev_bound_ifindex) {
+		attr.prog_flags	  = BPF_LOAD_F_XDP_DEV_BOUND_ONLY;
+		attr.prog_ifindex = dev_bound_ifindex;
+	}
+	if (frags)
+		attr.prog_flags |= BPF_LOAD_F_XDP_HAS_FRAGS;
+
+	fd = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+	if (fd >= 0)
+		return fd;
+
+	/* Like bpf_load_program(), retry with verifier log on failure */
+	attr.log_buf	  = (unsigned long)bpf_log_buf;
+	attr.log_size	  = BPF_LOG_BUF_SIZE;
+	attr.log_level	  = 1;
+	bpf_log_buf[0] = 0;
+	fd = syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+	if (fd >= 0 || errno != EINVAL || bpf_log_buf[0])
+		return fd;
+
+	/* EINVAL without verifier log: kernel without the flag, device
+	 * bound < v6.3 and frags < v5.18.  A frags prog still works on
+	 * single buffer (MTU below a page) devices.
+	 */
+	printf("Notice: %s XDP not supported, normal load\n",
+	       dev_bound_ifindex ? "device bound" : "frags");
+	dev_bound_ifindex = 0;
+	return bpf_load_program(BPF_PROG_TYPE_XDP, prog, insns_cnt, license,
+				kern_version, bpf_log_buf, BPF_LOG_BUF_SIZE);
+}
+
 static int load_and_attach(const char *event, struct bpf_insn *prog, int size)
 {
 	bool is_socket = strncmp(event, "socket", 6) == 0;
@@ -69,6 +171,8 @@ static int load_and_attach(const char *event, struct bpf_insn *prog, int size)
 	bool is_kretprobe = strncmp(event, "kretprobe/", 10) == 0;
 	bool is_tracepoint = strncmp(event, "tracepoint/", 11) == 0;
 	bool is_xdp = strncmp(event, "xdp", 3) == 0;
+	bool is_xdp_cpumap = strncmp(event, "xdp_cpumap", 10) == 0;
+	bool is_xdp_frags = strncmp(event, "xdp.frags", 9) == 0;
 	bool is_perf_event = strncmp(event, "perf_event", 10) == 0;
 	bool is_cgroup_skb = strncmp(event, "cgroup/skb", 10) == 0;
 	bool is_cgroup_sk = strncmp(event, "cgroup/sock", 11) == 0;
@@ -108,14 +212,37 @@ static int load_and_attach(const char *event, struct bpf_insn *prog, int size)
 		return -1;
 	}
 
-	fd = bpf_load_program(prog_type, prog, insns_cnt, license, kern_version,
-			      bpf_log_buf, BPF_LOG_BUF_SIZE);
+	if (prog_cnt >= MAX_PROGS) {
+		printf("Too many programs, max %d\n", MAX_PROGS);
+		return -1;
+	}
+
+	if (is_xdp_cpumap) {
+		/* XDP prog for cpumap entries, needs expected_attach_type */
+		struct bpf_load_program_attr load_attr = {};
+
+		load_attr.prog_type = prog_type;
+		load_attr.expected_attach_type = BPF_LOAD_XDP_CPUMAP;
+		load_attr.insns = prog;
+		load_attr.insns_cnt = insns_cnt;
+		load_attr.license = license;
+		load_attr.kern_version = kern_version;
+		fd = bpf_load_program_xattr(&load_attr, bpf_log_buf,
+					    BPF_LOG_BUF_SIZE);
+	} else if (is_xdp && (dev_bound_ifindex || is_xdp_frags)) {
+		fd = load_xdp_flags(prog, insns_cnt, is_xdp_frags);
+	} else {
+		fd = bpf_load_program(prog_type, prog, insns_cnt, license,
+				      kern_version, bpf_log_buf,
+				      BPF_LOG_BUF_SIZE);
+	}
 	if (fd < 0) {
 		printf("bpf_load_program(prog_cnt=%d) err=%d\n%s",
 		       prog_cnt, errno, bpf_log_buf);
 		return -1;
 	}
 
+	prog_sec[prog_cnt] = strdup(event);
 	prog_fd[prog_cnt++] = fd;
 
 	if (is_xdp || is_perf_event || is_cgroup_skb || is_cgroup_sk)
@@ -217,17 +344,122 @@ static int load_and_attach(const char *event, struct bpf_insn *prog, int size)
 	return 0;
 }
 
+static int global_map_init(struct bpf_map_data *map, void *image)
+{
+	union bpf_attr attr;
+	__u32 key = 0;
+
+	if (bpf_map_update_elem(map->fd, &key, image, 0)) {
+		printf("failed to init global data map %s: %s\n",
+		       map->name, strerror(errno));
+		return -1;
+	}
+	if (!(map->def.map_flags & BPF_LOAD_F_RDONLY_PROG))
+		return 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map->fd;
+	if (syscall(__NR_bpf, BPF_LOAD_MAP_FREEZE, &attr, sizeof(attr))) {
+		printf("failed to freeze map %s: %s\n",
+		       map->name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int bpf_load_map_check(int fd, const struct bpf_map_data *map)
+{
+	struct bpf_map_info info = {};
+	__u32 len = sizeof(info);
+
+	if (bpf_obj_get_info_by_fd(fd, &info, &len)) {
+		printf("map %s: get info failed: %s\n", map->name,
+		       strerror(errno));
+		return -errno;
+	}
+	/* max_entries of a reused map wins, e.g. resized to the CPUs */
+	if (info.type != map->def.type ||
+	    info.key_size != map->def.key_size ||
+	    info.value_size != map->def.value_size) {
+		printf("map %s: type:%u key:%u value:%u, ELF wants"
+		       " type:%u key:%u value:%u\n", map->name,
+		       info.type, info.key_size, info.value_size,
+		       map->def.type, map->def.key_size, map->def.value_size);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int pin_path_get(char *path, const char *name)
+{
+	int len;
+
+	len = snprintf(path, PATH_MAX, "%s/%s", pin_maps_dir, name);
+	return len >= PATH_MAX ? -ENAMETOOLONG : 0;
+}
+
+/* Reuse the map pinned under its name, if any */
+static int load_map_pinned(struct bpf_map_data *map)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (pin_path_get(path, map->name))
+		return -ENAMETOOLONG;
+	fd = bpf_obj_get(path);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -errno;
+	if (bpf_load_map_check(fd, map)) {
+		close(fd);
+		return -EINVAL;
+	}
+	map->fd = fd;
+	return 0;
+}
+
+static int pin_map(struct bpf_map_data *map)
+{
+	char path[PATH_MAX];
+
+	if (pin_path_get(path, map->name))
+		return -ENAMETOOLONG;
+	if (bpf_obj_pin(map->fd, path)) {
+		printf("failed to pin map %s at %s: %s\n", map->name,
+		       path, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
 static int load_maps(struct bpf_map_data *maps, int nr_maps,
 		     fixup_map_cb fixup_map)
 {
-	int i, numa_node;
+	int i, j, numa_node;
 
 	for (i = 0; i < nr_maps; i++) {
+		for (j = 0; j < pending_resize_cnt; j++)
+			if (!strcmp(maps[i].name, pending_resize[j].name))
+				maps[i].def.max_entries =
+					pending_resize[j].max_entries;
+
 		if (fixup_map) {
 			fixup_map(&maps[i], i);
 			/* Allow userspace to assign map FD prior to creation */
 			if (maps[i].fd != -1) {
 				map_fd[i] = maps[i].fd;
+				map_reused[i] = true;
+				continue;
+			}
+		}
+
+		if (pin_maps_dir[0]) {
+			if (load_map_pinned(&maps[i]))
+				return 1;
+			if (maps[i].fd != -1) {
+				map_fd[i] = maps[i].fd;
+				map_reused[i] = true;
+				if (maps[i].def.type == BPF_MAP_TYPE_PROG_ARRAY)
+					prog_array_fd = map_fd[i];
 				continue;
 			}
 		}
@@ -262,6 +494,11 @@ static int load_maps(struct bpf_map_data *maps, int nr_maps,
 		}
 		maps[i].fd = map_fd[i];
 
+		if (global_image[i] && global_map_init(&maps[i], global_image[i]))
+			return 1;
+		if (pin_maps_dir[0] && pin_map(&maps[i]))
+			return 1;
+
 		if (maps[i].def.type == BPF_MAP_TYPE_PROG_ARRAY)
 			prog_array_fd = map_fd[i];
 	}
@@ -291,7 +528,409 @@ static int get_sec(Elf *elf, int i, GElf_Ehdr *ehdr, char **shname,
 	return 0;
 }
 
-static int parse_relo_and_apply(Elf_Data *data, Elf_Data *symbols,
+/* Minimal BTF parsing, only to find the BTF ID of a kernel function
+ * (kfunc) in /sys/kernel/btf/vmlinux.  The uapi headers used here
+ * lack linux/btf.h, thus the needed layout is defined here.
+ */
+#define BTF_LOAD_MAGIC		0xeB9F
+#define BTF_LOAD_KIND_FUNC	12
+
+struct btf_load_header {
+	__u16 magic;
+	__u8  version;
+	__u8  flags;
+	__u32 hdr_len;
+	__u32 type_off;
+	__u32 type_len;
+	__u32 str_off;
+	__u32 str_len;
+};
+
+struct btf_load_type {
+	__u32 name_off;
+	__u32 info;	/* vlen: bits 0-15, kind: bits 24-28 */
+	__u32 size_type;
+};
+
+/* Bytes following struct btf_load_type, per BTF_KIND */
+static int btf_type_extra_size(__u32 info)
+{
+	int vlen = info & 0xffff;
+
+	switch ((info >> 24) & 0x1f) {
+	case 1:		/* INT */
+	case 14:	/* VAR */
+	case 17:	/* DECL_TAG */
+		return 4;
+	case 3:		/* ARRAY */
+		return 12;
+	case 4:		/* STRUCT */
+	case 5:		/* UNION */
+	case 15:	/* DATASEC */
+	case 19:	/* ENUM64 */
+		return vlen * 12;
+	case 6:		/* ENUM */
+	case 13:	/* FUNC_PROTO */
+		return vlen * 8;
+	case 2: case 7: case 8: case 9: case 10: case 11: case 12:
+	case 16: case 18:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static char *btf_vmlinux;
+static size_t btf_vmlinux_size;
+
+static int btf_vmlinux_load(void)
+{
+	size_t alloc = 0;
+	ssize_t sz;
+	char *buf;
+	int fd;
+
+	if (btf_vmlinux)
+		return 0;
+
+	fd = open("/sys/kernel/btf/vmlinux", O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	/* The sysfs file size is not reliable, read until EOF */
+	do {
+		if (btf_vmlinux_size == alloc) {
+			alloc += 1 << 20;
+			buf = realloc(btf_vmlinux, alloc);
+			if (!buf) {
+				close(fd);
+				return -ENOMEM;
+			}
+			btf_vmlinux = buf;
+		}
+		sz = read(fd, btf_vmlinux + btf_vmlinux_size,
+			  alloc - btf_vmlinux_size);
+		if (sz > 0)
+			btf_vmlinux_size += sz;
+	} while (sz > 0);
+	close(fd);
+
+	if (sz < 0 || btf_vmlinux_size < sizeof(struct btf_load_header) ||
+	    ((struct btf_load_header *)btf_vmlinux)->magic != BTF_LOAD_MAGIC) {
+		free(btf_vmlinux);
+		btf_vmlinux = NULL;
+		btf_vmlinux_size = 0;
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* Returns BTF ID of kernel function @name, or negative errno */
+static int btf_vmlinux_find_func(const char *name)
+{
+	struct btf_load_header *hdr;
+	char *types, *strs, *p;
+	int id = 1, extra, err;
+
+	err = btf_vmlinux_load();
+	if (err)
+		return err;
+
+	hdr   = (struct btf_load_header *)btf_vmlinux;
+	types = btf_vmlinux + hdr->hdr_len + hdr->type_off;
+	strs  = btf_vmlinux + hdr->hdr_len + hdr->str_off;
+	if (hdr->hdr_len + hdr->str_off + hdr->str_len > btf_vmlinux_size ||
+	    hdr->hdr_len + hdr->type_off + hdr->type_len > btf_vmlinux_size)
+		return -EINVAL;
+
+	/* Type IDs start at 1, ID zero is the implicit "void" type */
+	for (p = types; p + sizeof(struct btf_load_type) <= types + hdr->type_len;
+	     id++) {
+		struct btf_load_type *t = (struct btf_load_type *)p;
+
+		if (((t->info >> 24) & 0x1f) == BTF_LOAD_KIND_FUNC &&
+		    t->name_off < hdr->str_len &&
+		    strcmp(strs + t->name_off, name) == 0)
+			return id;
+
+		extra = btf_type_extra_size(t->info);
+		if (extra < 0)
+			return -EINVAL;
+		p += sizeof(*t) + extra;
+	}
+	return -ENOENT;
+}
+
+/* BTF of the ELF file itself (.BTF section, needs clang -g), only for
+ * the map definitions in SEC(".maps").
+ */
+#define BTF_LOAD_KIND_INT	1
+#define BTF_LOAD_KIND_PTR	2
+#define BTF_LOAD_KIND_ARRAY	3
+#define BTF_LOAD_KIND_STRUCT	4
+#define BTF_LOAD_KIND_UNION	5
+#define BTF_LOAD_KIND_ENUM	6
+#define BTF_LOAD_KIND_TYPEDEF	8
+#define BTF_LOAD_KIND_VOLATILE	9
+#define BTF_LOAD_KIND_CONST	10
+#define BTF_LOAD_KIND_RESTRICT	11
+#define BTF_LOAD_KIND_VAR	14
+#define BTF_LOAD_KIND_FLOAT	16
+#define BTF_LOAD_KIND_TYPE_TAG	18
+#define BTF_LOAD_KIND_ENUM64	19
+
+#define BTF_KIND(t)	(((t)->info >> 24) & 0x1f)
+#define BTF_VLEN(t)	((t)->info & 0xffff)
+
+struct btf_load_member {
+	__u32 name_off;
+	__u32 type;
+	__u32 offset;
+};
+
+struct btf_load_array {
+	__u32 type;
+	__u32 index_type;
+	__u32 nelems;
+};
+
+struct btf_obj {
+	const char *strs;
+	__u32 str_len;
+	struct btf_load_type **types;	/* By type ID, ID 0 is void */
+	__u32 nr_types;
+};
+
+static void btf_obj_free(struct btf_obj *btf)
+{
+	free(btf->types);
+	memset(btf, 0, sizeof(*btf));
+}
+
+static int btf_obj_parse(struct btf_obj *btf, char *data, size_t size)
+{
+	struct btf_load_header *hdr = (struct btf_load_header *)data;
+	__u32 alloc = 256;
+	char *types, *p;
+	int extra;
+
+	memset(btf, 0, sizeof(*btf));
+	if (size < sizeof(*hdr) || hdr->magic != BTF_LOAD_MAGIC ||
+	    hdr->hdr_len + hdr->type_off + hdr->type_len > size ||
+	    hdr->hdr_len + hdr->str_off + hdr->str_len > size)
+		return -EINVAL;
+
+	types = data + hdr->hdr_len + hdr->type_off;
+	btf->strs = data + hdr->hdr_len + hdr->str_off;
+	btf->str_len = hdr->str_len;
+	btf->types = calloc(alloc, sizeof(*btf->types));
+	if (!btf->types)
+		return -ENOMEM;
+	btf->nr_types = 1;
+
+	for (p = types; p + sizeof(struct btf_load_type) <= types + hdr->type_len;
+	     p += sizeof(struct btf_load_type) + extra) {
+		if (btf->nr_types == alloc) {
+			struct btf_load_type **t;
+
+			alloc *= 2;
+			t = realloc(btf->types, alloc * sizeof(*t));
+			if (!t) {
+				btf_obj_free(btf);
+				return -ENOMEM;
+			}
+			btf->types = t;
+		}
+		btf->types[btf->nr_types++] = (struct btf_load_type *)p;
+		extra = btf_type_extra_size(((struct btf_load_type *)p)->info);
+		if (extra < 0) {
+			btf_obj_free(btf);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static struct btf_load_type *btf_obj_type(const struct btf_obj *btf, __u32 id)
+{
+	return id && id < btf->nr_types ? btf->types[id] : NULL;
+}
+
+static const char *btf_obj_str(const struct btf_obj *btf, __u32 off)
+{
+	return off < btf->str_len ? btf->strs + off : "";
+}
+
+/* Skip typedefs and type modifiers */
+static struct btf_load_type *btf_obj_skip_mods(const struct btf_obj *btf,
+					       __u32 id)
+{
+	struct btf_load_type *t;
+	int depth;
+
+	for (depth = 0; depth < 32; depth++) {
+		t = btf_obj_type(btf, id);
+		if (!t)
+			return NULL;
+		switch (BTF_KIND(t)) {
+		case BTF_LOAD_KIND_TYPEDEF:
+		case BTF_LOAD_KIND_VOLATILE:
+		case BTF_LOAD_KIND_CONST:
+		case BTF_LOAD_KIND_RESTRICT:
+		case BTF_LOAD_KIND_TYPE_TAG:
+			id = t->size_type;
+			continue;
+		default:
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static int btf_obj_type_size(const struct btf_obj *btf, __u32 id, int depth)
+{
+	struct btf_load_type *t = btf_obj_skip_mods(btf, id);
+	struct btf_load_array *arr;
+	int elem;
+
+	if (!t || depth > 32)
+		return -EINVAL;
+
+	switch (BTF_KIND(t)) {
+	case BTF_LOAD_KIND_INT:
+	case BTF_LOAD_KIND_STRUCT:
+	case BTF_LOAD_KIND_UNION:
+	case BTF_LOAD_KIND_ENUM:
+	case BTF_LOAD_KIND_FLOAT:
+	case BTF_LOAD_KIND_ENUM64:
+		return t->size_type;
+	case BTF_LOAD_KIND_PTR:
+		return 8; /* BPF target */
+	case BTF_LOAD_KIND_ARRAY:
+		arr = (struct btf_load_array *)(t + 1);
+		elem = btf_obj_type_size(btf, arr->type, depth + 1);
+		return elem < 0 ? elem : elem * arr->nelems;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* __uint(name, val) in bpf_helpers.h is "int (*name)[val]" */
+static int btf_obj_map_uint(const struct btf_obj *btf, __u32 id,
+			    unsigned int *val)
+{
+	struct btf_load_type *t = btf_obj_type(btf, id);
+
+	if (!t || BTF_KIND(t) != BTF_LOAD_KIND_PTR)
+		return -EINVAL;
+	t = btf_obj_skip_mods(btf, t->size_type);
+	if (!t || BTF_KIND(t) != BTF_LOAD_KIND_ARRAY)
+		return -EINVAL;
+	*val = ((struct btf_load_array *)(t + 1))->nelems;
+	return 0;
+}
+
+/* __type(name, T) is "typeof(T) *name" */
+static int btf_obj_map_type_size(const struct btf_obj *btf, __u32 id,
+				 unsigned int *size)
+{
+	struct btf_load_type *t = btf_obj_type(btf, id);
+	int sz;
+
+	if (!t || BTF_KIND(t) != BTF_LOAD_KIND_PTR)
+		return -EINVAL;
+	sz = btf_obj_type_size(btf, t->size_type, 0);
+	if (sz <= 0)
+		return -EINVAL;
+	*size = sz;
+	return 0;
+}
+
+static int btf_obj_map_def(const struct btf_obj *btf, const char *name,
+			   struct bpf_map_def *def)
+{
+	struct btf_load_type *t, *var = NULL;
+	struct btf_load_member *m;
+	__u32 id;
+	int i, err;
+
+	for (id = 1; id < btf->nr_types; id++) {
+		t = btf->types[id];
+		if (BTF_KIND(t) == BTF_LOAD_KIND_VAR &&
+		    !strcmp(btf_obj_str(btf, t->name_off), name)) {
+			var = t;
+			break;
+		}
+	}
+	if (!var)
+		return -ENOENT;
+	t = btf_obj_skip_mods(btf, var->size_type);
+	if (!t || BTF_KIND(t) != BTF_LOAD_KIND_STRUCT)
+		return -EINVAL;
+
+	memset(def, 0, sizeof(*def));
+	m = (struct btf_load_member *)(t + 1);
+	for (i = 0; i < BTF_VLEN(t); i++, m++) {
+		const char *attr = btf_obj_str(btf, m->name_off);
+
+		if (!strcmp(attr, "type"))
+			err = btf_obj_map_uint(btf, m->type, &def->type);
+		else if (!strcmp(attr, "max_entries"))
+			err = btf_obj_map_uint(btf, m->type, &def->max_entries);
+		else if (!strcmp(attr, "map_flags"))
+			err = btf_obj_map_uint(btf, m->type, &def->map_flags);
+		else if (!strcmp(attr, "key_size"))
+			err = btf_obj_map_uint(btf, m->type, &def->key_size);
+		else if (!strcmp(attr, "value_size"))
+			err = btf_obj_map_uint(btf, m->type, &def->value_size);
+		else if (!strcmp(attr, "key"))
+			err = btf_obj_map_type_size(btf, m->type, &def->key_size);
+		else if (!strcmp(attr, "value"))
+			err = btf_obj_map_type_size(btf, m->type,
+						    &def->value_size);
+		else {
+			/* E.g. pinning and inner maps, use SEC("maps") */
+			printf("BTF map %s: unsupported attribute %s\n",
+			       name, attr);
+			return -EOPNOTSUPP;
+		}
+		if (err) {
+			printf("BTF map %s: invalid attribute %s\n", name, attr);
+			return err;
+		}
+	}
+	return 0;
+}
+
+/* Since v5.13: call insn with src_reg BPF_PSEUDO_KFUNC_CALL and the
+ * BTF ID of the kernel function in imm.
+ */
+#define BPF_LOAD_PSEUDO_KFUNC_CALL	2
+
+/* Kernel without the kfunc: do like libbpf and let the call
+ * return -EOPNOTSUPP, thus the BPF prog can take a fallback path.
+ */
+static void relo_kfunc_call(struct bpf_insn *insn, const char *name)
+{
+	int id = btf_vmlinux_find_func(name);
+
+	if (id > 0) {
+		insn->src_reg = BPF_LOAD_PSEUDO_KFUNC_CALL;
+		insn->off = 0;
+		insn->imm = id;
+		return;
+	}
+	printf("Notice: kfunc %s not found in kernel BTF (%s),"
+	       " call returns -EOPNOTSUPP\n", name, strerror(-id));
+	insn->code    = BPF_ALU64 | BPF_MOV | BPF_K;
+	insn->dst_reg = BPF_REG_0;
+	insn->src_reg = 0;
+	insn->off     = 0;
+	insn->imm     = -EOPNOTSUPP;
+}
+
+static int parse_relo_and_apply(Elf *elf, int strtabidx,
+				Elf_Data *data, Elf_Data *symbols,
 				GElf_Shdr *shdr, struct bpf_insn *insn,
 				struct bpf_map_data *maps, int nr_maps)
 {
@@ -312,27 +951,49 @@ static int parse_relo_and_apply(Elf_Data *data, Elf_Data *symbols,
 
 		gelf_getsym(symbols, GELF_R_SYM(rel.r_info), &sym);
 
+		/* Call to extern (undefined) symbol, declared with __ksym */
+		if (insn[insn_idx].code == (BPF_JMP | BPF_CALL) &&
+		    sym.st_shndx == SHN_UNDEF) {
+			relo_kfunc_call(&insn[insn_idx],
+					elf_strptr(elf, strtabidx, sym.st_name));
+			continue;
+		}
+
 		if (insn[insn_idx].code != (BPF_LD | BPF_IMM | BPF_DW)) {
 			printf("invalid relo for insn[%d].code 0x%x\n",
 			       insn_idx, insn[insn_idx].code);
 			return 1;
 		}
-		insn[insn_idx].src_reg = BPF_PSEUDO_MAP_FD;
 
-		/* Match FD relocation against recorded map_data[] offset */
+		/* Match relocation against recorded map_data[] section
+		 * and offset, a global data map is the whole section.
+		 */
 		for (map_idx = 0; map_idx < nr_maps; map_idx++) {
-			if (maps[map_idx].elf_offset == sym.st_value) {
+			if (maps[map_idx].elf_shndx != sym.st_shndx)
+				continue;
+			if (global_image[map_idx] ||
+			    maps[map_idx].elf_offset == sym.st_value) {
 				match = true;
 				break;
 			}
 		}
-		if (match) {
-			insn[insn_idx].imm = maps[map_idx].fd;
-		} else {
+		if (!match) {
 			printf("invalid relo for insn[%d] no map_data match\n",
 			       insn_idx);
 			return 1;
 		}
+
+		if (global_image[map_idx]) {
+			/* Offset of the variable, via the symbol or
+			 * (section symbol) the insn itself.
+			 */
+			insn[insn_idx].src_reg = BPF_LOAD_PSEUDO_MAP_VALUE;
+			insn[insn_idx + 1].imm = insn[insn_idx].imm +
+						 sym.st_value;
+		} else {
+			insn[insn_idx].src_reg = BPF_PSEUDO_MAP_FD;
+		}
+		insn[insn_idx].imm = maps[map_idx].fd;
 	}
 
 	return 0;
@@ -438,6 +1099,7 @@ static int load_elf_maps_section(struct bpf_map_data *maps, int maps_shndx,
 		/* Symbol value is offset into ELF maps section data area */
 		offset = sym[i].st_value;
 		def = (struct bpf_map_def *)(data_maps->d_buf + offset);
+		maps[i].elf_shndx = maps_shndx;
 		maps[i].elf_offset = offset;
 		memset(&maps[i].def, 0, sizeof(struct bpf_map_def));
 		memcpy(&maps[i].def, def, map_sz_copy);
@@ -459,6 +1121,198 @@ static int load_elf_maps_section(struct bpf_map_data *maps, int maps_shndx,
 	return nr_maps;
 }
 
+/* Same map_data[] as SEC("maps"), with the definitions from BTF */
+static int load_elf_btf_maps(struct bpf_map_data *maps, int max_maps,
+			     int shndx, Elf *elf, Elf_Data *symbols,
+			     int strtabidx, const struct btf_obj *btf)
+{
+	int i, nr_maps = 0, err = 0;
+	GElf_Sym *sym;
+
+	if (!btf->nr_types) {
+		printf("SEC(\".maps\") needs a .BTF section (clang -g)\n");
+		return -EINVAL;
+	}
+
+	sym = calloc(MAX_MAPS, sizeof(GElf_Sym));
+	if (!sym)
+		return -ENOMEM;
+	for (i = 0; i < symbols->d_size / sizeof(GElf_Sym); i++) {
+		if (!gelf_getsym(symbols, i, &sym[nr_maps]) ||
+		    sym[nr_maps].st_shndx != shndx ||
+		    GELF_ST_TYPE(sym[nr_maps].st_info) == STT_SECTION)
+			continue;
+		if (nr_maps == max_maps) {
+			err = -E2BIG;
+			goto out;
+		}
+		nr_maps++;
+	}
+
+	/* Align to map_fd[] order, via sort on offset in sym.st_value */
+	qsort(sym, nr_maps, sizeof(GElf_Sym), cmp_symbols);
+
+	for (i = 0; i < nr_maps; i++) {
+		const char *map_name = elf_strptr(elf, strtabidx,
+						  sym[i].st_name);
+
+		err = btf_obj_map_def(btf, map_name, &maps[i].def);
+		if (err)
+			goto out;
+		maps[i].name = strdup(map_name);
+		if (!maps[i].name) {
+			err = -ENOMEM;
+			goto out;
+		}
+		maps[i].elf_shndx = shndx;
+		maps[i].elf_offset = sym[i].st_value;
+	}
+out:
+	free(sym);
+	return err ? err : nr_maps;
+}
+
+/* As libbpf, each global data section is a single entry ARRAY map,
+ * with the section contents as value.
+ */
+static bool is_global_data_sec(const char *shname)
+{
+	return strcmp(shname, ".data") == 0 ||
+	       strcmp(shname, ".bss") == 0 ||
+	       strncmp(shname, ".rodata", 7) == 0;
+}
+
+static struct global_var *global_var_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < global_var_cnt; i++)
+		if (!strcmp(global_vars[i].name, name))
+			return &global_vars[i];
+	return NULL;
+}
+
+static int global_var_add(const char *name, int map_idx, GElf_Sym *sym)
+{
+	struct global_var *v;
+
+	v = realloc(global_vars, (global_var_cnt + 1) * sizeof(*v));
+	if (!v)
+		return -ENOMEM;
+	global_vars = v;
+	v += global_var_cnt;
+	v->name = strdup(name);
+	if (!v->name)
+		return -ENOMEM;
+	v->map_idx = map_idx;
+	v->offset = sym->st_value;
+	v->size = sym->st_size;
+	global_var_cnt++;
+	return 0;
+}
+
+/* Returns the new number of maps */
+static int load_elf_global_data(struct bpf_map_data *maps, int nr_maps,
+				Elf *elf, GElf_Ehdr *ehdr, Elf_Data *symbols,
+				int strtabidx, int *shndx, int nr_sec)
+{
+	int i, j, first = nr_maps, err;
+	Elf_Data *data;
+	char *shname;
+	GElf_Shdr shdr;
+	GElf_Sym sym;
+
+	for (i = 0; i < nr_sec; i++, nr_maps++) {
+		struct bpf_map_data *map = &maps[nr_maps];
+
+		if (nr_maps == MAX_MAPS)
+			return -E2BIG;
+		if (get_sec(elf, shndx[i], ehdr, &shname, &shdr, &data))
+			return -EINVAL;
+
+		global_image[nr_maps] = calloc(1, shdr.sh_size);
+		map->name = strndup(shname, BPF_OBJ_NAME_LEN - 1);
+		if (!global_image[nr_maps] || !map->name)
+			return -ENOMEM;
+		if (shdr.sh_type != SHT_NOBITS)
+			memcpy(global_image[nr_maps], data->d_buf,
+			       shdr.sh_size);
+
+		memset(&map->def, 0, sizeof(map->def));
+		map->def.type = BPF_MAP_TYPE_ARRAY;
+		map->def.key_size = sizeof(__u32);
+		map->def.value_size = shdr.sh_size;
+		map->def.max_entries = 1;
+		if (strncmp(shname, ".rodata", 7) == 0)
+			map->def.map_flags = BPF_LOAD_F_RDONLY_PROG;
+		map->elf_shndx = shndx[i];
+		map->elf_offset = 0;
+		processed_sec[shndx[i]] = true;
+	}
+
+	/* Variables, for bpf_load_global_set() and _update() */
+	for (i = 0; i < symbols->d_size / sizeof(GElf_Sym); i++) {
+		if (!gelf_getsym(symbols, i, &sym) ||
+		    GELF_ST_TYPE(sym.st_info) != STT_OBJECT)
+			continue;
+		for (j = first; j < nr_maps; j++)
+			if (maps[j].elf_shndx == sym.st_shndx)
+				break;
+		if (j == nr_maps)
+			continue;
+		err = global_var_add(elf_strptr(elf, strtabidx, sym.st_name),
+				     j, &sym);
+		if (err)
+			return err;
+	}
+
+	/* Values set before load, into the initial map values */
+	for (i = 0; i < pending_global_cnt; i++) {
+		struct global_var *v = global_var_find(pending_global[i].name);
+
+		if (!v || v->size != pending_global[i].size) {
+			printf("global data %s: %s\n", pending_global[i].name,
+			       v ? "size mismatch" : "not found");
+			return -EINVAL;
+		}
+		memcpy(global_image[v->map_idx] + v->offset,
+		       pending_global[i].val, v->size);
+	}
+	return nr_maps;
+}
+
+static void load_state_reset(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_MAPS; i++) {
+		free(global_image[i]);
+		global_image[i] = NULL;
+		map_data[i].fd = -1;
+		map_reused[i] = false;
+	}
+	for (i = 0; i < global_var_cnt; i++)
+		free(global_vars[i].name);
+	free(global_vars);
+	global_vars = NULL;
+	global_var_cnt = 0;
+}
+
+static void pending_reset(void)
+{
+	int i;
+
+	for (i = 0; i < pending_resize_cnt; i++)
+		free(pending_resize[i].name);
+	for (i = 0; i < pending_global_cnt; i++) {
+		free(pending_global[i].name);
+		free(pending_global[i].val);
+	}
+	pending_resize_cnt = 0;
+	pending_global_cnt = 0;
+	pin_maps_dir[0] = '\0';
+}
+
 static int do_load_bpf_file(const char *path, fixup_map_cb fixup_map)
 {
 	int fd, i, ret, maps_shndx = -1, strtabidx = -1;
@@ -467,12 +1321,18 @@ static int do_load_bpf_file(const char *path, fixup_map_cb fixup_map)
 	GElf_Shdr shdr, shdr_prog;
 	Elf_Data *data, *data_prog, *data_maps = NULL, *symbols = NULL;
 	char *shname, *shname_prog;
+	int global_shndx[MAX_MAPS];
+	int btf_maps_shndx = -1;
+	int nr_global = 0;
+	struct btf_obj btf;
 	int nr_maps = 0;
 
 	/* reset global variables */
 	kern_version = 0;
 	memset(license, 0, sizeof(license));
 	memset(processed_sec, 0, sizeof(processed_sec));
+	memset(&btf, 0, sizeof(btf));
+	load_state_reset();
 
 	if (elf_version(EV_CURRENT) == EV_NONE)
 		return 1;
@@ -515,12 +1375,17 @@ static int do_load_bpf_file(const char *path, fixup_map_cb fixup_map)
 			}
 			memcpy(&kern_version, data->d_buf, sizeof(int));
 		} else if (strcmp(shname, "maps") == 0) {
-			int j;
-
 			maps_shndx = i;
 			data_maps = data;
-			for (j = 0; j < MAX_MAPS; j++)
-				map_data[j].fd = -1;
+		} else if (strcmp(shname, ".maps") == 0) {
+			btf_maps_shndx = i;
+		} else if (strcmp(shname, ".BTF") == 0) {
+			processed_sec[i] = true;
+			if (btf_obj_parse(&btf, data->d_buf, data->d_size))
+				printf("Warning: invalid .BTF section\n");
+		} else if (is_global_data_sec(shname) &&
+			   nr_global < MAX_MAPS) {
+			global_shndx[nr_global++] = i;
 		} else if (shdr.sh_type == SHT_SYMTAB) {
 			strtabidx = shdr.sh_link;
 			symbols = data;
@@ -543,12 +1408,37 @@ static int do_load_bpf_file(const char *path, fixup_map_cb fixup_map)
 			ret = 1;
 			goto done;
 		}
-		if (load_maps(map_data, nr_maps, fixup_map))
+		processed_sec[maps_shndx] = true;
+	}
+
+	if (btf_maps_shndx > 0) {
+		ret = load_elf_btf_maps(map_data + nr_maps, MAX_MAPS - nr_maps,
+					btf_maps_shndx, elf, symbols,
+					strtabidx, &btf);
+		if (ret < 0) {
+			printf("Error: Failed loading BTF maps (errno:%d):%s\n",
+			       ret, strerror(-ret));
+			ret = 1;
 			goto done;
-		map_data_count = nr_maps;
+		}
+		nr_maps += ret;
+		processed_sec[btf_maps_shndx] = true;
+	}
 
-		processed_sec[maps_shndx] = true;
+	ret = load_elf_global_data(map_data, nr_maps, elf, &ehdr, symbols,
+				   strtabidx, global_shndx, nr_global);
+	if (ret < 0) {
+		printf("Error: Failed loading global data (errno:%d):%s\n",
+		       ret, strerror(-ret));
+		ret = 1;
+		goto done;
 	}
+	nr_maps = ret;
+	ret = 1;
+
+	if (load_maps(map_data, nr_maps, fixup_map))
+		goto done;
+	map_data_count = nr_maps;
 
 	/* process all relo sections, and rewrite bpf insns for maps */
 	for (i = 1; i < ehdr.e_shnum; i++) {
@@ -573,8 +1463,8 @@ static int do_load_bpf_file(const char *path, fixup_map_cb fixup_map)
 			insns = (struct bpf_insn *) data_prog->d_buf;
 			processed_sec[i] = true; /* relo section */
 
-			if (parse_relo_and_apply(data, symbols, &shdr, insns,
-						 map_data, nr_maps))
+			if (parse_relo_and_apply(elf, strtabidx, data, symbols,
+						 &shdr, insns, map_data, nr_maps))
 				continue;
 		}
 	}
@@ -606,6 +1496,8 @@ static int do_load_bpf_file(const char *path, fixup_map_cb fixup_map)
 
 	ret = 0;
 done:
+	btf_obj_free(&btf);
+	pending_reset();
 	close(fd);
 	return ret;
 }
@@ -620,6 +1512,145 @@ int load_bpf_file_fixup_map(const char *path, fixup_map_cb fixup_map)
 	return do_load_bpf_file(path, fixup_map);
 }
 
+int load_bpf_file_dev_bound(const char *path, int ifindex,
+			    fixup_map_cb fixup_map)
+{
+	int ret;
+
+	dev_bound_ifindex = ifindex;
+	ret = do_load_bpf_file(path, fixup_map);
+	dev_bound_ifindex = 0;
+	return ret;
+}
+
+int bpf_load_map_resize(const char *name, __u32 max_entries)
+{
+	if (pending_resize_cnt == MAX_PENDING)
+		return -E2BIG;
+	pending_resize[pending_resize_cnt].name = strdup(name);
+	if (!pending_resize[pending_resize_cnt].name)
+		return -ENOMEM;
+	pending_resize[pending_resize_cnt++].max_entries = max_entries;
+	return 0;
+}
+
+int bpf_load_global_set(const char *name, const void *val, size_t size)
+{
+	int i = pending_global_cnt;
+
+	if (i == MAX_PENDING)
+		return -E2BIG;
+	pending_global[i].name = strdup(name);
+	pending_global[i].val = malloc(size);
+	if (!pending_global[i].name || !pending_global[i].val) {
+		free(pending_global[i].name);
+		free(pending_global[i].val);
+		return -ENOMEM;
+	}
+	memcpy(pending_global[i].val, val, size);
+	pending_global[i].size = size;
+	pending_global_cnt++;
+	return 0;
+}
+
+int bpf_load_global_update(const char *name, const void *val, size_t size)
+{
+	struct global_var *v = global_var_find(name);
+	struct bpf_map_data *map;
+	__u32 key = 0;
+	char *value;
+	int err = 0;
+
+	if (!v)
+		return -ENOENT;
+	if (v->size != size)
+		return -EINVAL;
+	map = &map_data[v->map_idx];
+	if (map->def.map_flags & BPF_LOAD_F_RDONLY_PROG)
+		return -EPERM;
+
+	value = malloc(map->def.value_size);
+	if (!value)
+		return -ENOMEM;
+	if (bpf_map_lookup_elem(map->fd, &key, value)) {
+		err = -errno;
+		goto out;
+	}
+	memcpy(value + v->offset, val, size);
+	if (bpf_map_update_elem(map->fd, &key, value, 0))
+		err = -errno;
+out:
+	free(value);
+	return err;
+}
+
+/* Create the directories of @dir, as "mkdir -p" */
+static int mkdir_path(const char *dir)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	if (strlen(dir) >= sizeof(path))
+		return -ENAMETOOLONG;
+	strcpy(path, dir);
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+int bpf_load_pin_maps(const char *dir)
+{
+	int err;
+
+	if (strlen(dir) >= sizeof(pin_maps_dir) - BPF_OBJ_NAME_LEN - 1)
+		return -ENAMETOOLONG;
+	err = mkdir_path(dir);
+	if (err) {
+		printf("cannot create pin dir %s: %s\n", dir, strerror(-err));
+		return err;
+	}
+	strcpy(pin_maps_dir, dir);
+	return 0;
+}
+
+bool bpf_load_map_reused(const char *name)
+{
+	int i;
+
+	for (i = 0; i < map_data_count; i++)
+		if (map_data[i].name && !strcmp(map_data[i].name, name))
+			return map_reused[i];
+	return false;
+}
+
+int bpf_load_map_fd(const char *name)
+{
+	int i;
+
+	for (i = 0; i < map_data_count; i++)
+		if (map_data[i].name && !strcmp(map_data[i].name, name))
+			return map_data[i].fd;
+	return -ENOENT;
+}
+
+int bpf_load_prog_fd(const char *sec)
+{
+	int i;
+
+	for (i = 0; i < prog_cnt; i++)
+		if (prog_sec[i] && !strcmp(prog_sec[i], sec))
+			return prog_fd[i];
+	return -ENOENT;
+}
+
 void read_trace_pipe(void)
 {
 	int trace_fd;
@@ -702,7 +1733,7 @@ struct ksym *ksym_search(long key)
 	return &syms[0];
 }
 
-int set_link_xdp_fd(int ifindex, int fd, __u32 flags)
+static int do_set_link_xdp_fd(int ifindex, int fd, int old_fd, __u32 flags)
 {
 	struct sockaddr_nl sa;
 	int sock, seq = 0, len, ret = -1;
@@ -761,6 +1792,14 @@ int set_link_xdp_fd(int ifindex, int fd, __u32 flags)
 		nla->nla_len += nla_xdp->nla_len;
 	}
 
+	if (flags & XDP_FLAGS_REPLACE) {
+		nla_xdp = (struct nlattr *)((char *)nla + nla->nla_len);
+		nla_xdp->nla_type = 8/*IFLA_XDP_EXPECTED_FD*/;
+		nla_xdp->nla_len = NLA_HDRLEN + sizeof(old_fd);
+		memcpy((char *)nla_xdp + NLA_HDRLEN, &old_fd, sizeof(old_fd));
+		nla->nla_len += nla_xdp->nla_len;
+	}
+
 	req.nh.nlmsg_len += NLA_ALIGN(nla->nla_len);
 
 	if (send(sock, &req, req.nh.nlmsg_len, 0) < 0) {
@@ -792,6 +1831,7 @@ int set_link_xdp_fd(int ifindex, int fd, __u32 flags)
 			if (!err->error)
 				continue;
 			printf("nlmsg error %s\n", strerror(-err->error));
+			ret = err->error;
 			goto cleanup;
 		case NLMSG_DONE:
 			break;
@@ -804,3 +1844,14 @@ cleanup:
 	close(sock);
 	return ret;
 }
+
+int set_link_xdp_fd(int ifindex, int fd, __u32 flags)
+{
+	return do_set_link_xdp_fd(ifindex, fd, -1, flags);
+}
+
+int set_link_xdp_fd_replace(int ifindex, int fd, int old_fd, __u32 flags)
+{
+	return do_set_link_xdp_fd(ifindex, fd, old_fd,
+				  flags | XDP_FLAGS_REPLACE);
+}
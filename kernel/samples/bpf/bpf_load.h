@@ -2,6 +2,7 @@
 #ifndef __BPF_LOAD_H
 #define __BPF_LOAD_H
 
+#include <stdbool.h>
 #include "libbpf.h"
 
 #define MAX_MAPS 32
@@ -22,11 +23,13 @@ struct bpf_map_data {
 	char *name;
 	size_t elf_offset;
 	struct bpf_map_def def;
+	int elf_shndx;	/* ELF section: "maps", ".maps" or global data */
 };
 
 typedef void (*fixup_map_cb)(struct bpf_map_data *map, int idx);
 
 extern int prog_fd[MAX_PROGS];
+extern char *prog_sec[MAX_PROGS]; /* ELF section name of prog_fd[] */
 extern int event_fd[MAX_PROGS];
 extern char bpf_log_buf[BPF_LOG_BUF_SIZE];
 extern int prog_cnt;
@@ -53,6 +56,53 @@ extern int map_data_count;
 int load_bpf_file(char *path);
 int load_bpf_file_fixup_map(const char *path, fixup_map_cb fixup_map);
 
+/* Same, but XDP progs (not "xdp_cpumap") are loaded bound to @ifindex,
+ * which is needed for the XDP RX metadata kfuncs (e.g. RX hash).  A
+ * device bound prog can only be attached to that device in native XDP
+ * mode, not in skb mode.  Falls back to normal load on kernels < v6.3.
+ */
+int load_bpf_file_dev_bound(const char *path, int ifindex,
+			    fixup_map_cb fixup_map);
+
+/* Maps are created in ELF order: SEC("maps"), then the BTF-defined
+ * SEC(".maps"), then a map per global data section (.rodata*, .data,
+ * .bss, named as the section), all in map_fd[] and map_data[].
+ *
+ * Before load, by name, applied to the next load_bpf_file*() call:
+ *  - bpf_load_map_resize(): the max_entries of a map, e.g. to the
+ *    number of possible CPUs (the fixup_map_cb runs after this)
+ *  - bpf_load_global_set(): initial value of a global variable.  In
+ *    .rodata ("const volatile"), it is a constant for the verifier,
+ *    which then also removes the dead code.
+ *
+ * After load, bpf_load_global_update() changes a .data/.bss variable.
+ * This rewrites the whole section value, thus is only for variables
+ * written by userspace, like config.  The BPF prog reads it without a
+ * map lookup helper call.
+ *
+ * All return zero or negative errno.  Global data needs kernel v5.2.
+ */
+int bpf_load_map_resize(const char *name, __u32 max_entries);
+int bpf_load_global_set(const char *name, const void *val, size_t size);
+int bpf_load_global_update(const char *name, const void *val, size_t size);
+
+/* Maps are pinned as @dir/<map name> (created as with "mkdir -p") by
+ * the next load_bpf_file*() call.  A map already pinned there is
+ * reused instead of created, keeping its state, if type, key and
+ * value size match the ELF definition (bpf_load_map_check()).  With
+ * set_link_xdp_fd_replace() this allows hitless prog upgrades.  A
+ * fixup_map_cb assigning a map fd has precedence.
+ */
+int bpf_load_pin_maps(const char *dir);
+bool bpf_load_map_reused(const char *name);
+int bpf_load_map_check(int fd, const struct bpf_map_data *map);
+
+/* Lookup by map name or prog ELF section name, after load, instead of
+ * the map_fd[] and prog_fd[] index.  Returns the fd or -ENOENT.
+ */
+int bpf_load_map_fd(const char *name);
+int bpf_load_prog_fd(const char *sec);
+
 void read_trace_pipe(void);
 struct ksym {
 	long addr;
@@ -62,6 +112,23 @@ struct ksym {
 int load_kallsyms(void);
 struct ksym *ksym_search(long key);
 
+/* Since v5.9: enum bpf_attach_type value BPF_XDP_CPUMAP, for XDP progs
+ * attached to cpumap entries ("xdp_cpumap" ELF sections).  The uapi
+ * headers used here are older, thus not avail as enum.
+ */
+#define BPF_LOAD_XDP_CPUMAP	((enum bpf_attach_type)35)
+
+/* Since v6.3: prog_flags BPF_F_XDP_DEV_BOUND_ONLY, for XDP progs using
+ * the XDP RX metadata kfuncs, see load_bpf_file_dev_bound().
+ */
+#define BPF_LOAD_F_XDP_DEV_BOUND_ONLY	(1U << 6)
+
+/* Since v5.18: prog_flags BPF_F_XDP_HAS_FRAGS, for multi-buffer (e.g.
+ * jumbo frame) aware XDP progs.  bpf_load.c sets it for ELF sections
+ * named "xdp.frags...", as libbpf does.
+ */
+#define BPF_LOAD_F_XDP_HAS_FRAGS	(1U << 5)
+
 /* UAPI XDP_FLAGS avail in include/linux/if_link.h, but distro are
  * lacking behind.
  */
@@ -87,6 +154,17 @@ struct ksym *ksym_search(long key);
 #define XDP_FLAGS_MASK                  (XDP_FLAGS_UPDATE_IF_NOEXIST |	\
                                          XDP_FLAGS_MODES)
 #endif
+/* Since: v5.7 / 92234c8f15c8 ("xdp: Support specifying expected existing program when attaching XDP") */
+#ifndef XDP_FLAGS_REPLACE
+#define XDP_FLAGS_REPLACE		(1U << 4)
+#endif
 
+/* Returns negative on error, the netlink errno when available */
 int set_link_xdp_fd(int ifindex, int fd, __u32 flags);
+
+/* Atomically replace the XDP prog @old_fd of the device by @fd, fails
+ * with -EEXIST when @old_fd is no longer attached, e.g. replaced by
+ * another loader.  @old_fd -1 expects no prog, @fd -1 detaches.
+ */
+int set_link_xdp_fd_replace(int ifindex, int fd, int old_fd, __u32 flags);
 #endif
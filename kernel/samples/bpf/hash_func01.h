@@ -18,7 +18,9 @@ uint32_t SuperFastHash (const char *data, int len, uint32_t initval) {
 	len >>= 2;
 
 	/* Main loop */
+#ifdef __clang__
 #pragma clang loop unroll(full)
+#endif
 	for (;len > 0; len--) {
 		hash  += get16bits (data);
 		tmp    = (get16bits (data+2) << 11) ^ hash;
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * Fixed-length hash functions for flow keys of u32 words, usable from
+ * both the BPF _kern.c programs and userspace.  Unlike SuperFastHash
+ * (hash_func01.h), which walks the key 16-bit at a time, these mix a
+ * full word (or two) per round, and the key length is a compile time
+ * constant, thus the loops unroll into straight-line code.
+ *
+ * Typical flow keys: IPv4 L3 (1 word), IPv4 L4 (2 words), IPv6 L3
+ * (4 words) IPv6 L4 XOR-folded (5 words), IPv6 5-tuple (9 words).
+ * See xdp_hash_bench for the cost (BPF_PROG_TEST_RUN), and
+ * xdp_hash_quality for the bucket spread over pcap traces.
+ */
+#ifndef __HASH_FUNC02_H
+#define __HASH_FUNC02_H
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+
+/* jhash: Bob Jenkins lookup3 (public domain), as include/linux/jhash.h */
+#define JHASH_INITVAL		0xdeadbeef
+
+#define __jhash_rol32(x, k)	(((x) << (k)) | ((x) >> (32 - (k))))
+
+#define __jhash_mix(a, b, c)				\
+{							\
+	a -= c;  a ^= __jhash_rol32(c, 4);  c += b;	\
+	b -= a;  b ^= __jhash_rol32(a, 6);  a += c;	\
+	c -= b;  c ^= __jhash_rol32(b, 8);  b += a;	\
+	a -= c;  a ^= __jhash_rol32(c, 16); c += b;	\
+	b -= a;  b ^= __jhash_rol32(a, 19); a += c;	\
+	c -= b;  c ^= __jhash_rol32(b, 4);  b += a;	\
+}
+
+#define __jhash_final(a, b, c)				\
+{							\
+	c ^= b; c -= __jhash_rol32(b, 14);		\
+	a ^= c; a -= __jhash_rol32(c, 11);		\
+	b ^= a; b -= __jhash_rol32(a, 25);		\
+	c ^= b; c -= __jhash_rol32(b, 16);		\
+	a ^= c; a -= __jhash_rol32(c, 4);		\
+	b ^= a; b -= __jhash_rol32(a, 14);		\
+	c ^= b; c -= __jhash_rol32(b, 24);		\
+}
+
+static __always_inline
+uint32_t __jhash_nwords(uint32_t a, uint32_t b, uint32_t c, uint32_t initval)
+{
+	a += initval;
+	b += initval;
+	c += initval;
+	__jhash_final(a, b, c);
+	return c;
+}
+
+static __always_inline
+uint32_t jhash_3words(uint32_t a, uint32_t b, uint32_t c, uint32_t initval)
+{
+	return __jhash_nwords(a, b, c, initval + JHASH_INITVAL + (3 << 2));
+}
+
+static __always_inline
+uint32_t jhash_2words(uint32_t a, uint32_t b, uint32_t initval)
+{
+	return __jhash_nwords(a, b, 0, initval + JHASH_INITVAL + (2 << 2));
+}
+
+static __always_inline
+uint32_t jhash_1word(uint32_t a, uint32_t initval)
+{
+	return __jhash_nwords(a, 0, 0, initval + JHASH_INITVAL + (1 << 2));
+}
+
+/* As jhash2() in include/linux/jhash.h, @len in u32 words */
+static __always_inline
+uint32_t jhash_words(const uint32_t *k, int len, uint32_t initval)
+{
+	uint32_t a, b, c;
+
+	a = b = c = JHASH_INITVAL + (len << 2) + initval;
+
+#ifdef __clang__
+#pragma clang loop unroll(full)
+#endif
+	for (; len > 3; len -= 3, k += 3) {
+		a += k[0];
+		b += k[1];
+		c += k[2];
+		__jhash_mix(a, b, c);
+	}
+
+	switch (len) {
+	case 3: c += k[2];
+		/* fall through */
+	case 2: b += k[1];
+		/* fall through */
+	case 1: a += k[0];
+		__jhash_final(a, b, c);
+		break;
+	}
+	return c;
+}
+
+/* mxhash: multiply-xorshift, two words per multiply, with a 2-round
+ * (multiply + xorshift) finalizer.  Cheapest of the three, as a 64-bit
+ * multiply is a single BPF insn, but unlike jhash not designed for
+ * hash-flooding resistance beyond what a secret seed gives.
+ */
+#define MXHASH_M1	0x9e3779b97f4a7c15ULL	/* 2^64 / golden ratio */
+#define MXHASH_M2	0xd6e8feb86659fd93ULL
+
+static __always_inline
+uint32_t mxhash_final(uint64_t h)
+{
+	h ^= h >> 32;
+	h *= MXHASH_M2;
+	h ^= h >> 32;
+	h *= MXHASH_M2;
+	h ^= h >> 32;
+	return h;
+}
+
+static __always_inline
+uint32_t mxhash_1word(uint32_t a, uint32_t seed)
+{
+	return mxhash_final(((uint64_t)seed << 32) | a);
+}
+
+/* @len in u32 words */
+static __always_inline
+uint32_t mxhash_words(const uint32_t *k, int len, uint32_t seed)
+{
+	uint64_t h = ((uint64_t)seed << 32) ^ (len << 2);
+	int i;
+
+#ifdef __clang__
+#pragma clang loop unroll(full)
+#endif
+	for (i = 0; i + 1 < len; i += 2) {
+		h ^= k[i] | ((uint64_t)k[i + 1] << 32);
+		h *= MXHASH_M1;
+		h ^= h >> 29;
+	}
+	if (len & 1) {
+		h ^= k[len - 1];
+		h *= MXHASH_M1;
+		h ^= h >> 29;
+	}
+	return mxhash_final(h);
+}
+
+#endif /* __HASH_FUNC02_H */
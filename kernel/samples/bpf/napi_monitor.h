@@ -20,6 +20,38 @@ struct napi_bulk_histogram {
 	struct bulk_event_type type[3];
 };
 
+/* Per RX-queue breakdown, keyed by device and NAPI instance */
+#define NAPI_QUEUE_MAX	256
+struct napi_queue_key {
+	unsigned int ifindex;
+	unsigned int napi_id;
+};
+
+/* Limit (per queue) stats to a device and/or NAPI id, zero is any */
+struct napi_filter {
+	unsigned int ifindex;
+	unsigned int napi_id;
+};
+
+/* Latency histograms, log2 buckets of nanosec (bucket N is the
+ * range [2^N, 2^(N+1)) ns), last bucket contains everything above
+ */
+#define LAT_HIST_MAX	32
+enum lat_t {
+	LAT_NAPI_POLL=0,	/* Time of a napi->poll call */
+	LAT_NAPI_POLL_BUDGET,	/* Same, but only polls using full budget */
+	LAT_NET_RX,		/* NET_RX softirq, entry to exit */
+	LAT_MAX
+};
+struct lat_histogram {
+	unsigned long hist[LAT_HIST_MAX];
+	unsigned long cnt;
+	unsigned long sum_ns;
+};
+struct lat_data {
+	struct lat_histogram lat[LAT_MAX];
+};
+
 /* SOFTIRQ tracepoint data structures */
 enum vec_nr_t {
 	SOFTIRQ_HI,
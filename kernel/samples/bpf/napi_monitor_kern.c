@@ -31,6 +31,111 @@ struct bpf_map_def SEC("maps") cnt_map = { /* For debugging */
 	.max_entries = 1,
 };
 
+struct bpf_map_def SEC("maps") lat_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct lat_data),
+	.max_entries = 1,
+};
+
+/* The napi_poll tracepoint is only invoked after the poll call, thus
+ * a poll's duration is measured from NET_RX softirq entry or from the
+ * previous poll in same softirq run (net_rx_action loop).  Polls
+ * outside NET_RX softirq (e.g. busy-polling) are not timed.
+ */
+struct lat_state {
+	u64 softirq_ts;
+	u64 last_ts;
+};
+
+struct bpf_map_def SEC("maps") lat_state_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct lat_state),
+	.max_entries = 1,
+};
+
+/* Per queue histograms, value is same as napi_hist_map */
+struct bpf_map_def SEC("maps") napi_queue_map = {
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size = sizeof(struct napi_queue_key),
+	.value_size = sizeof(struct napi_bulk_histogram),
+	.max_entries = NAPI_QUEUE_MAX,
+};
+
+struct bpf_map_def SEC("maps") napi_filter_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct napi_filter),
+	.max_entries = 1,
+};
+
+/* Same as samples/bpf/tracex2_kern.c */
+static __always_inline unsigned int log2(unsigned int v)
+{
+	unsigned int r;
+	unsigned int shift;
+
+	r = (v > 0xFFFF) << 4; v >>= r;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static __always_inline unsigned int log2l(unsigned long v)
+{
+	unsigned int hi = v >> 32;
+
+	if (hi)
+		return log2(hi) + 32;
+	else
+		return log2(v);
+}
+
+static __always_inline void lat_record(enum lat_t type, u64 ns)
+{
+	struct lat_histogram *h;
+	struct lat_data *data;
+	unsigned int slot;
+	u32 key = 0;
+
+	data = bpf_map_lookup_elem(&lat_map, &key);
+	if (!data)
+		return;
+
+	slot = log2l(ns);
+	if (slot >= LAT_HIST_MAX)
+		slot = LAT_HIST_MAX - 1;
+	h = &data->lat[type];
+	h->hist[slot]++;
+	h->cnt++;
+	h->sum_ns += ns;
+}
+
+static __always_inline void lat_napi_poll(unsigned int work,
+					  unsigned int budget, bool record)
+{
+	struct lat_state *state;
+	u32 key = 0;
+	u64 now, ns;
+
+	state = bpf_map_lookup_elem(&lat_state_map, &key);
+	if (!state || !state->last_ts)
+		return;
+
+	now = bpf_ktime_get_ns();
+	ns = now - state->last_ts;
+	state->last_ts = now;
+	if (!record)
+		return;
+
+	lat_record(LAT_NAPI_POLL, ns);
+	if (work >= budget)
+		lat_record(LAT_NAPI_POLL_BUDGET, ns);
+}
+
 /* Tracepoint format: /sys/kernel/debug/tracing/events/napi/napi_poll/format
  * Code in:                kernel/include/trace/events/napi.h
  */
@@ -73,14 +178,13 @@ int napi_poll(struct napi_poll_ctx *ctx)
 	unsigned int	napi_id = 0;
 
 	struct napi_bulk_histogram *napi_work;
+	struct napi_queue_key qkey = {};
+	struct napi_filter *filter;
+	struct net_device *dev = NULL;
+	bool match = true;
 
-	napi_work = bpf_map_lookup_elem(&napi_hist_map, &key);
-	if (!napi_work)
-		return 0;
-
-	/* TODO: Want to implement limiting tool to collect from a
-	 * specific interface, but I cannot figure out howto extract
-	 * the ifindex here.
+	/* Limiting collection to a specific interface is done via
+	 * napi_filter_map, for which the ifindex is extracted below.
 	 */
 	// Cannot deref napi pointer directly :-(
 	//if (ctx->napi->dev)
@@ -98,6 +202,28 @@ int napi_poll(struct napi_poll_ctx *ctx)
 //              (NOT WORKING: rejected by verifier)
 //		bpf_probe_read(&ifindex, sizeof(ifindex), &(napi->dev->ifindex));
 //	}
+	/* Works when reading the dev pointer as a separate step */
+	if (napi)
+		bpf_probe_read(&dev, sizeof(dev), &napi->dev);
+	if (dev)
+		bpf_probe_read(&qkey.ifindex, sizeof(qkey.ifindex),
+			       &dev->ifindex);
+	qkey.napi_id = napi_id;
+
+	filter = bpf_map_lookup_elem(&napi_filter_map, &key);
+	if (filter &&
+	    ((filter->ifindex && filter->ifindex != qkey.ifindex) ||
+	     (filter->napi_id && filter->napi_id != qkey.napi_id)))
+		match = false;
+
+	/* Poll timestamps are needed, even for polls not recorded */
+	lat_napi_poll(work, budget, match);
+	if (!match)
+		return 0;
+
+	napi_work = bpf_map_lookup_elem(&napi_hist_map, &key);
+	if (!napi_work)
+		return 0;
 
 #ifdef DEBUG
 	/* Counter that keeps state across invocations (for hacks) */
@@ -153,6 +279,23 @@ record_event_type:
 	if (!work)
 		napi_work->type[event_type].cnt_bulk0++;
 
+	/* Same accounting per queue, entry created on first poll */
+	napi_work = bpf_map_lookup_elem(&napi_queue_map, &qkey);
+	if (!napi_work) {
+		struct napi_bulk_histogram zero = {};
+
+		bpf_map_update_elem(&napi_queue_map, &qkey, &zero, BPF_NOEXIST);
+		napi_work = bpf_map_lookup_elem(&napi_queue_map, &qkey);
+		if (!napi_work)
+			return 0; /* Map full */
+	}
+	if (event_type != TYPE_VIOLATE && work < 65)
+		napi_work->hist[work]++;
+	napi_work->type[event_type].cnt++;
+	napi_work->type[event_type].pkts += work;
+	if (!work)
+		napi_work->type[event_type].cnt_bulk0++;
+
 	return 0;
 }
 
@@ -190,6 +333,15 @@ int softirq_entry(struct irq_ctx *ctx)
 	if (vec_nr < SOFTIRQ_MAX)
 		data->counters[vec_nr].enter++;
 
+	if (vec_nr == SOFTIRQ_NET_RX) {
+		struct lat_state *state;
+
+		state = bpf_map_lookup_elem(&lat_state_map, &key);
+		if (state) {
+			state->softirq_ts = bpf_ktime_get_ns();
+			state->last_ts = state->softirq_ts;
+		}
+	}
 	return 0;
 }
 
@@ -207,6 +359,17 @@ int softirq_exit(struct irq_ctx *ctx)
 	if (vec_nr < SOFTIRQ_MAX)
 		data->counters[vec_nr].exit++;
 
+	if (vec_nr == SOFTIRQ_NET_RX) {
+		struct lat_state *state;
+
+		state = bpf_map_lookup_elem(&lat_state_map, &key);
+		if (state && state->softirq_ts) {
+			lat_record(LAT_NET_RX,
+				   bpf_ktime_get_ns() - state->softirq_ts);
+			state->softirq_ts = 0;
+			state->last_ts = 0;
+		}
+	}
 	return 0;
 }
 
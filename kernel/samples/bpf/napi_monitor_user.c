@@ -6,6 +6,15 @@ static const char *__doc__=
  "NOTICE: Counter for bulk 64 can be higher than actual processed\n"
  " packets.  Drivers can signal the NAPI API to keep polling via\n"
  " returning the full budget (64)\n"
+"\n"
+"Latency histograms are log2 buckets, of time per NAPI poll (measured\n"
+" from NET_RX softirq entry or the previous poll) and per NET_RX softirq.\n"
+" The 'budget' histogram only contains polls that used the full budget.\n"
+"\n"
+"Per RX-queue (device:napi_id) the polls are classified as from idle\n"
+" task, ksoftirqd(softirq) or API violation.  Limit all NAPI stats to\n"
+" one device/queue via --dev and --napi-id (latency of NET_RX softirq\n"
+" is not per device, thus not limited).\n"
 ;
 
 #include <errno.h>
@@ -27,19 +36,32 @@ static const char *__doc__=
 #include "bpf_load.h"
 #include "bpf_util.h"
 #include "napi_monitor.h" /* Shared structs between _user & _kern */
+#include "xdp_stats.h"
 
 static int verbose = 1;
+static struct stats_output stats_out;
 
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"debug",	no_argument,		NULL, 'D' },
 	{"sec", 	required_argument,	NULL, 's' },
+	{"dev", 	required_argument,	NULL, 'd' },
+	{"napi-id",	required_argument,	NULL, 'n' },
+	{"format",	required_argument,	NULL, 'F' },
 	{0, 0, NULL,  0 }
 };
 
 struct stats_record {
 	struct napi_bulk_histogram napi_bulk;
 	struct softirq_data softirq;
+	struct lat_data lat;		/* Sum of all CPUs */
+	struct lat_data *lat_cpu;	/* Per CPU */
+};
+
+static const char *lat_names[LAT_MAX] = {
+	[LAT_NAPI_POLL]		= "NAPI poll",
+	[LAT_NAPI_POLL_BUDGET]	= "NAPI poll (budget)",
+	[LAT_NET_RX]		= "NET_RX softirq",
 };
 
 static void usage(char *argv[])
@@ -63,77 +85,211 @@ static void usage(char *argv[])
 	printf("\n");
 }
 
-#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
-uint64_t gettime(void)
+static bool stats_collect_napi(struct stats_record *record)
 {
-	struct timespec t;
-	int res;
+	__u32 key = 0;
 
-	res = clock_gettime(CLOCK_MONOTONIC, &t);
-	if (res < 0) {
-		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
-		exit(EXIT_FAILURE);
+	/* Notice map is percpu: BPF_MAP_TYPE_PERCPU_ARRAY */
+	if (stats_percpu_sum(map_fd[0], &key, &record->napi_bulk,
+			     sizeof(record->napi_bulk))) {
+		fprintf(stderr, "WARN: bpf_map_lookup_elem failed\n");
+		return false;
 	}
-	return (uint64_t) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+	return true;
 }
 
-static bool stats_collect_napi(struct stats_record *record)
+static bool stats_collect_softirq(struct stats_record *record)
 {
-	unsigned int nr_cpus = bpf_num_possible_cpus();
-	struct napi_bulk_histogram values[nr_cpus];
-	struct napi_bulk_histogram sum = { 0 };
 	__u32 key = 0;
-	int i, j;
 
 	/* Notice map is percpu: BPF_MAP_TYPE_PERCPU_ARRAY */
-	if ((bpf_map_lookup_elem(map_fd[0], &key, values)) != 0) {
+	// TODO: add total counters, idea: avoid displaying
+	// every softirq, but instead show total, which allows
+	// users to see if total's is significantly higher
+	// than RX+TX softirq counters
+	if (stats_percpu_sum(map_fd[1], &key, &record->softirq,
+			     sizeof(record->softirq))) {
 		fprintf(stderr, "WARN: bpf_map_lookup_elem failed\n");
 		return false;
 	}
-	/* Sum values from each CPU */
-	for (i = 0; i < nr_cpus; i++) {
-		for (j = 0; j < 65; j++) {
-			sum.hist[j] += values[i].hist[j];
-		}
-		for (j = 0; j < 3; j++) {
-			sum.type[j].cnt       += values[i].type[j].cnt;
-			sum.type[j].cnt_bulk0 += values[i].type[j].cnt_bulk0;
-			sum.type[j].pkts      += values[i].type[j].pkts;
-		}
-	}
-	memcpy(&record->napi_bulk, &sum, sizeof(sum));
 	return true;
 }
 
-static bool stats_collect_softirq(struct stats_record *record)
+static bool stats_collect_lat(struct stats_record *record)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
-	struct softirq_data cpu[nr_cpus];
-	struct softirq_data sum = { 0 };
+	struct lat_data *cpu = record->lat_cpu;
+	struct lat_data *sum = &record->lat;
 	__u32 key = 0;
-	int i, j;
+	int i, t, j;
 
 	/* Notice map is percpu: BPF_MAP_TYPE_PERCPU_ARRAY */
-	if ((bpf_map_lookup_elem(map_fd[1], &key, cpu)) != 0) {
+	if ((bpf_map_lookup_elem(map_fd[3], &key, cpu)) != 0) {
 		fprintf(stderr, "WARN: bpf_map_lookup_elem failed\n");
 		return false;
 	}
+	memset(sum, 0, sizeof(*sum));
 	/* Sum values from each CPU */
 	for (i = 0; i < nr_cpus; i++) {
-		for (j = 0; j < SOFTIRQ_MAX; j++) {
-			sum.counters[j].enter += cpu[i].counters[j].enter;
-			sum.counters[j].exit  += cpu[i].counters[j].exit;
-			sum.counters[j].raise += cpu[i].counters[j].raise;
+		for (t = 0; t < LAT_MAX; t++) {
+			for (j = 0; j < LAT_HIST_MAX; j++)
+				sum->lat[t].hist[j] += cpu[i].lat[t].hist[j];
+			sum->lat[t].cnt    += cpu[i].lat[t].cnt;
+			sum->lat[t].sum_ns += cpu[i].lat[t].sum_ns;
 		}
-		// TODO: add total counters, idea: avoid displaying
-		// every softirq, but instead show total, which allows
-		// users to see if total's is significantly higher
-		// than RX+TX softirq counters
 	}
-	memcpy(&record->softirq, &sum, sizeof(sum));
 	return true;
 }
 
+/* Human readable log2 bucket start, e.g. 512ns 1us 2ms */
+static const char *lat2str(char *buf, size_t len, int slot)
+{
+	unsigned long ns = 1UL << slot;
+
+	if (ns < 1000)
+		snprintf(buf, len, "%luns", ns);
+	else if (ns < 1000000)
+		snprintf(buf, len, "%luus", ns / 1000);
+	else if (ns < 1000000000)
+		snprintf(buf, len, "%lums", ns / 1000000);
+	else
+		snprintf(buf, len, "%lus", ns / 1000000000);
+	return buf;
+}
+
+static void stats_lat(enum lat_t type,
+		      struct stats_record *rec, struct stats_record *prev)
+{
+	struct lat_histogram *r = &rec->lat.lat[type];
+	struct lat_histogram *p = &prev->lat.lat[type];
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	unsigned long cnt, total, ns;
+	char lo[16], hi[16];
+	int i;
+
+	total = r->cnt - p->cnt;
+	if (!total)
+		return;
+
+	printf("\n%s latency\n", lat_names[type]);
+	for (i = 0; i < LAT_HIST_MAX; i++) {
+		cnt = r->hist[i] - p->hist[i];
+		if (!cnt)
+			continue;
+		printf("lat[%5s - %5s)\t%lu\t(%5.1f%%)\n",
+		       lat2str(lo, sizeof(lo), i),
+		       i == LAT_HIST_MAX - 1 ? "" :
+		       lat2str(hi, sizeof(hi), i + 1),
+		       cnt, 100.0 * cnt / total);
+	}
+	ns = r->sum_ns - p->sum_ns;
+	printf("\t%lu\taverage\t%.0f ns\n", total, (double)ns / total);
+
+	/* Per CPU average, spikes tend to be local to a RX-queue CPU */
+	for (i = 0; i < nr_cpus; i++) {
+		struct lat_histogram *rc = &rec->lat_cpu[i].lat[type];
+		struct lat_histogram *pc = &prev->lat_cpu[i].lat[type];
+
+		cnt = rc->cnt - pc->cnt;
+		if (!cnt)
+			continue;
+		printf("\tcpu:%d\t%lu\taverage\t%.0f ns\n", i, cnt,
+		       (double)(rc->sum_ns - pc->sum_ns) / cnt);
+	}
+}
+
+static void stats_record_alloc(struct stats_record *rec)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+
+	memset(rec, 0, sizeof(*rec));
+	rec->lat_cpu = calloc(nr_cpus, sizeof(struct lat_data));
+	if (!rec->lat_cpu) {
+		fprintf(stderr, "ERR: cannot alloc per CPU stats\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Previous sample per queue, for calculating the delta */
+struct queue_prev {
+	struct napi_queue_key key;
+	struct napi_bulk_histogram prev;
+};
+static struct queue_prev queues[NAPI_QUEUE_MAX];
+static int nr_queues;
+
+static struct napi_bulk_histogram *queue_prev_get(struct napi_queue_key *key)
+{
+	int i;
+
+	for (i = 0; i < nr_queues; i++)
+		if (!memcmp(&queues[i].key, key, sizeof(*key)))
+			return &queues[i].prev;
+	if (nr_queues >= NAPI_QUEUE_MAX)
+		return NULL;
+	queues[nr_queues].key = *key;
+	return &queues[nr_queues++].prev;
+}
+
+static void stats_queues(double period)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	struct napi_bulk_histogram values[nr_cpus];
+	struct napi_bulk_histogram sum, *prev;
+	struct napi_queue_key key, next;
+	unsigned long cnt[3], pkts, full, total;
+	char ifname[IF_NAMESIZE];
+	int fd = map_fd[5];
+	int i, j, err;
+
+	printf("\nPer RX-queue stats:\n%25s %10s %11s %13s %8s %8s %7s %11s\n",
+	       "dev:napi_id", "polls/s", "avg-bulk", "pps",
+	       "idle", "softirq", "violate", "full-budget");
+
+	err = bpf_map_get_next_key(fd, NULL, &next);
+	while (!err) {
+		key = next;
+		err = bpf_map_get_next_key(fd, &key, &next);
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+
+		memset(&sum, 0, sizeof(sum));
+		for (i = 0; i < nr_cpus; i++) {
+			for (j = 0; j < 65; j++)
+				sum.hist[j] += values[i].hist[j];
+			for (j = 0; j < 3; j++) {
+				sum.type[j].cnt  += values[i].type[j].cnt;
+				sum.type[j].pkts += values[i].type[j].pkts;
+				sum.type[j].cnt_bulk0 +=
+					values[i].type[j].cnt_bulk0;
+			}
+		}
+		prev = queue_prev_get(&key);
+		if (!prev)
+			continue;
+
+		pkts = 0;
+		total = 0;
+		for (j = 0; j < 3; j++) {
+			cnt[j] = sum.type[j].cnt - prev->type[j].cnt;
+			pkts  += sum.type[j].pkts - prev->type[j].pkts;
+			total += cnt[j];
+		}
+		full = sum.hist[64] - prev->hist[64];
+		memcpy(prev, &sum, sizeof(sum));
+		if (!total)
+			continue;
+
+		if (!if_indextoname(key.ifindex, ifname))
+			snprintf(ifname, sizeof(ifname), "if%u", key.ifindex);
+		printf("%14s:%-10u %'10.0f %11.2f %'13.0f %7.1f%% %7.1f%% %7lu %11lu\n",
+		       ifname, key.napi_id, total / period,
+		       (double)pkts / total, pkts / period,
+		       100.0 * cnt[TYPE_IDLE_TASK] / total,
+		       100.0 * cnt[TYPE_SOFTIRQ] / total,
+		       cnt[TYPE_VIOLATE], full);
+	}
+}
 
 static inline
 void stats_type(
@@ -203,21 +359,65 @@ static void stats_softirq_selective(
 	stats_softirq(SOFTIRQ_TIMER, rec, prev, p);
 }
 
+static const char *napi_type_names[3] = {
+	[TYPE_IDLE_TASK]	= "idle",
+	[TYPE_SOFTIRQ]		= "softirq",
+	[TYPE_VIOLATE]		= "violate",
+};
+
+/* Machine readable output, via --format */
+static void stats_export(struct stats_record *rec, struct stats_record *prev,
+			 __u64 period)
+{
+	struct bulk_event_type *r, *p;
+	int i;
+
+	stats_output_begin(&stats_out, period);
+	for (i = 0; i < 3; i++) {
+		r = &rec->napi_bulk.type[i];
+		p = &prev->napi_bulk.type[i];
+		stats_output_metric(&stats_out, "polls", "type",
+				    napi_type_names[i], r->cnt, r->cnt - p->cnt);
+	}
+	for (i = 0; i < 3; i++) {
+		r = &rec->napi_bulk.type[i];
+		p = &prev->napi_bulk.type[i];
+		stats_output_metric(&stats_out, "packets", "type",
+				    napi_type_names[i], r->pkts,
+				    r->pkts - p->pkts);
+	}
+	for (i = 0; i < SOFTIRQ_MAX; i++)
+		stats_output_metric(&stats_out, "softirq_enter", "vec",
+				    softirq2str(i),
+				    rec->softirq.counters[i].enter,
+				    rec->softirq.counters[i].enter -
+				    prev->softirq.counters[i].enter);
+	for (i = 0; i < LAT_MAX; i++)
+		stats_output_metric(&stats_out, "latency_ns", "type",
+				    lat_names[i], rec->lat.lat[i].sum_ns,
+				    rec->lat.lat[i].sum_ns -
+				    prev->lat.lat[i].sum_ns);
+	stats_output_end(&stats_out);
+}
+
 static void stats_poll(int interval)
 {
-	struct stats_record rec, prev;
+	struct stats_record records[2], *rec, *prev, *tmp;
 	__u64 prev_timestamp;
 	__u64 timestamp;
 	__u64 period;
 
-	memset(&rec, 0, sizeof(rec));
-	timestamp = gettime();
+	stats_record_alloc(&records[0]);
+	stats_record_alloc(&records[1]);
+	rec  = &records[0];
+	prev = &records[1];
+	timestamp = stats_gettime();
 
 	/* Trick to pretty printf with thousands separators use %' */
 	setlocale(LC_NUMERIC, "en_US");
 
 	/* Header */
-	if (verbose)
+	if (verbose && stats_out.fmt == STATS_FMT_TEXT)
 		printf("%s\n", __doc__);
 	fflush(stdout);
 
@@ -229,33 +429,49 @@ static void stats_poll(int interval)
 
 		sleep(interval);
 		prev_timestamp = timestamp;
-		memcpy(&prev, &rec, sizeof(rec));
-		timestamp = gettime();
+		/* Swap, as records own their per CPU arrays */
+		tmp = prev;
+		prev = rec;
+		rec = tmp;
+		timestamp = stats_gettime();
 
-		if (!stats_collect_napi(&rec))
+		if (!stats_collect_napi(rec))
+			exit(EXIT_FAILURE);
+		if (!stats_collect_softirq(rec))
 			exit(EXIT_FAILURE);
-		if (!stats_collect_softirq(&rec))
+		if (!stats_collect_lat(rec))
 			exit(EXIT_FAILURE);
 
 		period = timestamp - prev_timestamp;
 		period_ = ((double) period / NANOSEC_PER_SEC);
 
+		if (stats_out.fmt != STATS_FMT_TEXT) {
+			stats_export(rec, prev, period);
+			continue;
+		}
+
 		printf("\nNAPI RX bulking (measurement period: %f)\n", period_);
 		for (i = 0; i < 65; i++) {
 
-			cnt = (signed long) rec.napi_bulk.hist[i]
-			    - (signed long)prev.napi_bulk.hist[i];
+			cnt = (signed long) rec->napi_bulk.hist[i]
+			    - (signed long)prev->napi_bulk.hist[i];
 			if (cnt) {
 				pps = (cnt * i) / period_;
 				printf("bulk[%02d]\t%lu\t( %'11.0f pps)\n",
 				       i, cnt, pps);
 			}
 		}
-		stats_type(TYPE_IDLE_TASK, &rec, &prev, period_);
-		stats_type(TYPE_SOFTIRQ,   &rec, &prev, period_);
-		stats_type(TYPE_VIOLATE,   &rec, &prev, period_);
+		stats_type(TYPE_IDLE_TASK, rec, prev, period_);
+		stats_type(TYPE_SOFTIRQ,   rec, prev, period_);
+		stats_type(TYPE_VIOLATE,   rec, prev, period_);
+
+		stats_lat(LAT_NAPI_POLL,        rec, prev);
+		stats_lat(LAT_NAPI_POLL_BUDGET, rec, prev);
+		stats_lat(LAT_NET_RX,           rec, prev);
 
-		stats_softirq_selective(&rec, &prev, period_);
+		stats_queues(period_);
+
+		stats_softirq_selective(rec, prev, period_);
 
 		fflush(stdout);
 	}
@@ -267,11 +483,14 @@ int main(int argc, char **argv)
 	int longindex = 0, opt;
 	int ret = EXIT_SUCCESS;
 	char bpf_obj_file[256];
+	struct napi_filter filter = { 0 };
 	bool debug = false;
 	int interval = 2;
+	__u32 key = 0;
 	// size_t len;
 
 	snprintf(bpf_obj_file, sizeof(bpf_obj_file), "%s_kern.o", argv[0]);
+	stats_output_init(&stats_out, "napi_monitor", NULL);
 
 	/* Parse commands line args */
 	while ((opt = getopt_long(argc, argv, "h",
@@ -287,6 +506,21 @@ int main(int argc, char **argv)
 		case 's':
 			interval = atoi(optarg);
 			break;
+		case 'd':
+			filter.ifindex = if_nametoindex(optarg);
+			if (!filter.ifindex) {
+				fprintf(stderr, "ERR: --dev unknown: %s\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			filter.napi_id = atoi(optarg);
+			break;
+		case 'F':
+			if (stats_output_init(&stats_out, "napi_monitor", optarg))
+				return EXIT_FAILURE;
+			break;
 		case 'h':
 		default:
 			usage(argv);
@@ -308,6 +542,12 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	/* map_fd[6]: napi_filter_map */
+	if (bpf_map_update_elem(map_fd[6], &key, &filter, 0)) {
+		fprintf(stderr, "ERR: cannot set napi_filter_map\n");
+		return 1;
+	}
+
 	if (debug) {
 		if (verbose)
 			printf("Read: /sys/kernel/debug/tracing/trace_pipe\n");
@@ -45,6 +45,25 @@ struct bpf_elf_map SEC("maps") egress_ifindex = {
 	.max_elem = 1,
 };
 
+/* Handled packets (also the ifindex 42 drops), read by --stats via
+ *  /sys/fs/bpf/tc/globals/bench_stats
+ * (WARNING - same layout as bench_stats in _xdp_kern.c)
+ */
+struct bpf_elf_map SEC("maps") bench_stats = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.size_key = sizeof(u32),
+	.size_value = sizeof(u64),
+	.pinning = PIN_GLOBAL_NS,
+	.max_elem = 1,
+};
+
+/* Newer than the uapi bpf.h used here, see bpf_helpers.h */
+static int (*bpf_redirect_neigh)(int ifindex, void *params, int plen,
+				 unsigned long long flags) =
+	(void *) 152; /* v5.10, params since v5.11 */
+static int (*bpf_redirect_peer)(int ifindex, unsigned long long flags) =
+	(void *) 155; /* v5.10 */
+
 static void swap_src_dst_mac(void *data)
 {
 	unsigned short *p = data;
@@ -61,42 +80,64 @@ static void swap_src_dst_mac(void *data)
 	p[5] = dst[2];
 }
 
-/* Notice this section name is used when attaching TC filter
- *
- * Like:
- *  $TC qdisc   add dev $DEV clsact
- *  $TC filter  add dev $DEV ingress bpf da obj $BPF_OBJ sec ingress_redirect
- *  $TC filter show dev $DEV ingress
- *  $TC filter  del dev $DEV ingress
- *
- * Does TC redirect respect IP-forward settings?
- *
+/* Returns the egress ifindex, or 0 with the TC action in *action
+ * when this packet is not forwarded.
  */
-SEC("ingress_redirect")
-int _ingress_redirect(struct __sk_buff *skb)
+static __always_inline int fwd_ifindex(struct __sk_buff *skb, int *action)
 {
 	void *data     = (void *)(long)skb->data;
 	void *data_end = (void *)(long)skb->data_end;
 	struct ethhdr *eth = data;
 	int key = 0, *ifindex;
+	u64 *cnt;
 
+	*action = TC_ACT_OK;
 	if (data + sizeof(*eth) > data_end)
-		return TC_ACT_OK;
+		return 0;
 
 	/* Keep ARP resolution working */
 	if (eth->h_proto == htons(ETH_P_ARP))
-		return TC_ACT_OK;
+		return 0;
 
 	/* Lookup what ifindex to redirect packets to */
 	ifindex = bpf_map_lookup_elem(&egress_ifindex, &key);
 	if (!ifindex)
-		return TC_ACT_OK;
+		return 0;
 
 	if (*ifindex == 0)
-		return TC_ACT_OK; // or TC_ACT_SHOT ?
+		return 0; // or TC_ACT_SHOT ?
+
+	cnt = bpf_map_lookup_elem(&bench_stats, &key);
+	if (cnt)
+		*cnt += 1;
 
-	if (*ifindex == 42)  /* Hack: use ifindex==42 as DROP switch */
-		return TC_ACT_SHOT;
+	if (*ifindex == 42) {  /* Hack: use ifindex==42 as DROP switch */
+		*action = TC_ACT_SHOT;
+		return 0;
+	}
+	return *ifindex;
+}
+
+/* Notice this section name is used when attaching TC filter
+ *
+ * Like:
+ *  $TC qdisc   add dev $DEV clsact
+ *  $TC filter  add dev $DEV ingress bpf da obj $BPF_OBJ sec ingress_redirect
+ *  $TC filter show dev $DEV ingress
+ *  $TC filter  del dev $DEV ingress
+ *
+ * Does TC redirect respect IP-forward settings?
+ *
+ */
+SEC("ingress_redirect")
+int _ingress_redirect(struct __sk_buff *skb)
+{
+	void *data = (void *)(long)skb->data;
+	int action, ifindex;
+
+	ifindex = fwd_ifindex(skb, &action);
+	if (!ifindex)
+		return action;
 
 	/* Swap src and dst mac-addr if ingress==egress
 	 * --------------------------------------------
@@ -110,11 +151,42 @@ int _ingress_redirect(struct __sk_buff *skb)
 	 *  __sk_buff->ifindex == skb->dev->ifindex
 	 *   (which is translated into BPF insns that deref dev->ifindex)
 	 */
-	if (*ifindex == skb->ingress_ifindex)
+	if (ifindex == skb->ingress_ifindex)
 		swap_src_dst_mac(data);
 
-	//return bpf_redirect(*ifindex, BPF_F_INGRESS); // __bpf_rx_skb
-	return bpf_redirect(*ifindex, 0); // __bpf_tx_skb / __dev_xmit_skb
+	//return bpf_redirect(ifindex, BPF_F_INGRESS); // __bpf_rx_skb
+	return bpf_redirect(ifindex, 0); // __bpf_tx_skb / __dev_xmit_skb
+}
+
+/* Into the ingress of the netns peer of a veth (or netkit) egress
+ * dev, skipping the backlog queue of a plain redirect into a veth.
+ * The frame is not altered, thus its dst MAC must be the peer's.
+ */
+SEC("ingress_redirect_peer")
+int _ingress_redirect_peer(struct __sk_buff *skb)
+{
+	int action, ifindex;
+
+	ifindex = fwd_ifindex(skb, &action);
+	if (!ifindex)
+		return action;
+
+	return bpf_redirect_peer(ifindex, 0);
+}
+
+/* L3 forwarding, the kernel fills in the MAC-addrs from the neighbour
+ * table, via a FIB lookup of the dst IP on the egress dev.
+ */
+SEC("ingress_redirect_neigh")
+int _ingress_redirect_neigh(struct __sk_buff *skb)
+{
+	int action, ifindex;
+
+	ifindex = fwd_ifindex(skb, &action);
+	if (!ifindex)
+		return action;
+
+	return bpf_redirect_neigh(ifindex, 0, 0, 0);
 }
 
 char _license[] SEC("license") = "GPL";
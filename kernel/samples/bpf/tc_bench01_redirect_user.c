@@ -3,6 +3,16 @@
 static const char *__doc__=
  " TC redirect benchmark\n\n"
  "  The bpf-object gets attached via TC cmdline tool\n"
+ "\n"
+ "  For comparing forwarding layers, --mode selects (default tc):\n"
+ "   tc           : TC ingress bpf_redirect()\n"
+ "   tc-peer      : TC ingress bpf_redirect_peer(), egress must be veth\n"
+ "   tc-neigh     : TC ingress bpf_redirect_neigh(), L3 via neighbour\n"
+ "   xdp-redirect : XDP bpf_redirect_map() into a devmap\n"
+ "   xdp-tx       : XDP_TX out the ingress dev\n"
+ "  The XDP modes are attached via bpf_load.c and need --ingress.\n"
+ "  --stats reports pps and the CPU cost per packet, from /proc/stat\n"
+ "  busy time (thus run it on an otherwise idle machine).\n"
 ;
 
 #include <errno.h>
@@ -18,10 +28,41 @@ static const char *__doc__=
 #include <net/if.h>
 #include <time.h>
 
+#include <linux/if_link.h>
+
 #include "libbpf.h"
+#include "bpf_load.h"
+#include "xdp_stats.h"
 
 static int verbose = 1;
 static const char *mapfile = "/sys/fs/bpf/tc/globals/egress_ifindex";
+static const char *statsfile = "/sys/fs/bpf/tc/globals/bench_stats";
+
+enum fwd_mode {
+	MODE_TC = 0,
+	MODE_TC_PEER,
+	MODE_TC_NEIGH,
+	MODE_XDP_REDIRECT,
+	MODE_XDP_TX,
+	MODE_MAX
+};
+
+/* WARNING - xdp prog index is the prog order in _xdp_kern.c */
+static const struct {
+	const char *name;
+	const char *sec;	/* TC section, or NULL for XDP */
+	int xdp_prog;
+} modes[MODE_MAX] = {
+	[MODE_TC]		= { "tc",	    "ingress_redirect",	      -1 },
+	[MODE_TC_PEER]		= { "tc-peer",	    "ingress_redirect_peer",  -1 },
+	[MODE_TC_NEIGH]		= { "tc-neigh",	    "ingress_redirect_neigh", -1 },
+	[MODE_XDP_REDIRECT]	= { "xdp-redirect", NULL,		       0 },
+	[MODE_XDP_TX]		= { "xdp-tx",	    NULL,		       1 },
+};
+
+/* map_fd[] of _xdp_kern.c */
+#define MAP_IDX_TX_PORT		0
+#define MAP_IDX_BENCH_STATS	1
 
 #define CMD_MAX 	2048
 #define CMD_MAX_TC	256
@@ -38,6 +79,10 @@ static const struct option long_options[] = {
 	{"list",	optional_argument,	NULL, 'l' },
 	{"remove",	optional_argument,	NULL, 'r' },
 	{"quiet",	no_argument,		NULL, 'q' },
+	{"mode",	required_argument,	NULL, 'm' },
+	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"stats",	no_argument,		NULL, 's' },
+	{"interval",	required_argument,	NULL, 'I' },
 	{0, 0, NULL,  0 }
 };
 
@@ -74,7 +119,8 @@ static void usage(char *argv[])
  *
  * (The tc "replace" command does not seem to work as expected)
  */
-static int tc_ingress_attach_bpf(const char* dev, const char* bpf_obj)
+static int tc_ingress_attach_bpf(const char* dev, const char* bpf_obj,
+				 const char *sec)
 {
 	char cmd[CMD_MAX];
 	int ret = 0;
@@ -114,8 +160,8 @@ static int tc_ingress_attach_bpf(const char* dev, const char* bpf_obj)
 	memset(&cmd, 0, CMD_MAX);
 	snprintf(cmd, CMD_MAX,
 		 "%s filter add dev %s "
-		 "ingress prio 1 handle 1 bpf da obj %s sec ingress_redirect",
-		 tc_cmd, dev, bpf_obj);
+		 "ingress prio 1 handle 1 bpf da obj %s sec %s",
+		 tc_cmd, dev, bpf_obj, sec);
 	if (verbose) printf(" - Run: %s\n", cmd);
 	ret = system(cmd);
 	if (ret) {
@@ -173,6 +219,104 @@ static int tc_remove_ingress_filter(const char* dev)
 }
 
 
+/* Returns the fd of the bench_stats map */
+static int xdp_attach(int ingress_ifindex, int egress_ifindex,
+		      const char *bpf_obj, enum fwd_mode mode, __u32 xdp_flags)
+{
+	int key = 0;
+
+	if (load_bpf_file((char *)bpf_obj)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		exit(EXIT_FAILURE);
+	}
+	if (mode == MODE_XDP_REDIRECT) {
+		if (egress_ifindex <= 0) {
+			fprintf(stderr, "ERR: --mode xdp-redirect needs --egress\n");
+			exit(EXIT_FAILURE);
+		}
+		if (bpf_map_update_elem(map_fd[MAP_IDX_TX_PORT], &key,
+					&egress_ifindex, 0)) {
+			perror("ERROR: devmap bpf_map_update_elem");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (set_link_xdp_fd(ingress_ifindex, prog_fd[modes[mode].xdp_prog],
+			    xdp_flags) < 0) {
+		fprintf(stderr, "ERR: link set xdp fd failed\n");
+		exit(EXIT_FAILURE);
+	}
+	return map_fd[MAP_IDX_BENCH_STATS];
+}
+
+/* Busy (non idle, non iowait) and softirq time of all CPUs */
+struct cpu_time {
+	__u64 busy_ns;
+	__u64 softirq_ns;
+};
+
+static int cpu_time_get(struct cpu_time *t)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq, steal;
+	long hz = sysconf(_SC_CLK_TCK);
+	FILE *fp;
+	int n;
+
+	fp = fopen("/proc/stat", "r");
+	if (!fp)
+		return -1;
+	n = fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &user, &nice, &sys, &idle, &iowait, &irq, &softirq, &steal);
+	fclose(fp);
+	if (n != 8)
+		return -1;
+	t->busy_ns = (user + nice + sys + irq + softirq + steal) *
+		     (NANOSEC_PER_SEC / hz);
+	t->softirq_ns = softirq * (NANOSEC_PER_SEC / hz);
+	return 0;
+}
+
+/* CPU percentages are of one CPU, so can go above 100% */
+static void stats_poll(int fd, int interval, enum fwd_mode mode)
+{
+	struct cpu_time c_prev, c_now;
+	__u64 t_prev, t_now, p_prev, p_now;
+
+	setlocale(LC_NUMERIC, "en_US");
+	printf("%-12s %-14s %-8s %-10s %-10s\n", "mode", "pps",
+	       "cpu%", "softirq%", "ns/pkt");
+
+	p_prev = stats_percpu_sum_u64(fd, 0);
+	t_prev = stats_gettime();
+	if (cpu_time_get(&c_prev)) {
+		fprintf(stderr, "ERR: cannot read /proc/stat\n");
+		exit(EXIT_FAILURE);
+	}
+	while (1) {
+		__u64 period, pkts, busy;
+
+		sleep(interval);
+		p_now = stats_percpu_sum_u64(fd, 0);
+		t_now = stats_gettime();
+		if (cpu_time_get(&c_now)) {
+			fprintf(stderr, "ERR: cannot read /proc/stat\n");
+			exit(EXIT_FAILURE);
+		}
+		period = t_now - t_prev;
+		pkts = p_now - p_prev;
+		busy = c_now.busy_ns - c_prev.busy_ns;
+
+		printf("%-12s %'-14llu %-8.1f %-10.1f %-10.1f\n",
+		       modes[mode].name, stats_rate(pkts, period),
+		       100.0 * busy / period,
+		       100.0 * (c_now.softirq_ns - c_prev.softirq_ns) / period,
+		       pkts ? (double)busy / pkts : 0);
+		fflush(stdout);
+
+		p_prev = p_now;
+		t_prev = t_now;
+		c_prev = c_now;
+	}
+}
 
 static char ingress_ifname[IF_NAMESIZE];
 static char egress_ifname[IF_NAMESIZE];
@@ -201,6 +345,11 @@ int main(int argc, char **argv)
 {
 	bool list_ingress_tc_filter = false;
 	bool remove_ingress_tc_filter = false;
+	enum fwd_mode mode = MODE_TC;
+	bool stats = false;
+	__u32 xdp_flags = 0;
+	int interval = 2;
+	int stats_fd = -1;
 	int longindex = 0, opt, fd = -1;
 	int egress_ifindex = -1;
 	int ingress_ifindex = 0;
@@ -209,12 +358,14 @@ int main(int argc, char **argv)
 	size_t len;
 
 	char bpf_obj[256];
+	char xdp_obj[256];
 	snprintf(bpf_obj, sizeof(bpf_obj), "%s_kern.o", argv[0]);
+	snprintf(xdp_obj, sizeof(xdp_obj), "%s_xdp_kern.o", argv[0]);
 
 	memset(ingress_ifname, 0, IF_NAMESIZE); /* Can be used uninitialized */
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hq",
+	while ((opt = getopt_long(argc, argv, "hi:e:x:t:l::r::qm:SsI:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'x':
@@ -285,6 +436,27 @@ int main(int argc, char **argv)
 		case 'q':
 			verbose = 0;
 			break;
+		case 'm':
+			for (mode = 0; mode < MODE_MAX; mode++)
+				if (!strcmp(optarg, modes[mode].name))
+					break;
+			if (mode == MODE_MAX) {
+				fprintf(stderr, "ERR: unknown --mode %s\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 's':
+			stats = true;
+			break;
+		case 'I':
+			interval = atoi(optarg);
+			if (interval <= 0)
+				return EXIT_FAILURE;
+			break;
 		case 'h':
 		default:
 			usage(argv);
@@ -292,14 +464,25 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (ingress_ifindex) {
+	if (ingress_ifindex && !modes[mode].sec) {
+		if (verbose)
+			printf("XDP attach BPF object %s (%s) to device %s\n",
+			       xdp_obj, modes[mode].name, ingress_ifname);
+		stats_fd = xdp_attach(ingress_ifindex, egress_ifindex,
+				      xdp_obj, mode, xdp_flags);
+	} else if (ingress_ifindex) {
 		if (verbose)
-			printf("TC attach BPF object %s to device %s\n",
-			       bpf_obj, ingress_ifname);
-		if (tc_ingress_attach_bpf(ingress_ifname, bpf_obj)) {
+			printf("TC attach BPF object %s sec %s to device %s\n",
+			       bpf_obj, modes[mode].sec, ingress_ifname);
+		if (tc_ingress_attach_bpf(ingress_ifname, bpf_obj,
+					  modes[mode].sec)) {
 			fprintf(stderr, "ERR: TC attach failed\n");
 			exit(EXIT_FAILURE);
 		}
+	} else if (!modes[mode].sec && !remove_ingress_tc_filter) {
+		fprintf(stderr, "ERR: --mode %s needs --ingress\n",
+			modes[mode].name);
+		return EXIT_FAILURE;
 	}
 
 	if (list_ingress_tc_filter) {
@@ -310,6 +493,14 @@ int main(int argc, char **argv)
 	}
 
 	if (remove_ingress_tc_filter) {
+		if (!modes[mode].sec) {
+			if (verbose)
+				printf("XDP remove prog on device %s\n",
+				       ingress_ifname);
+			set_link_xdp_fd(if_nametoindex(ingress_ifname), -1,
+					xdp_flags);
+			return EXIT_SUCCESS;
+		}
 		if (verbose)
 			printf("TC remove ingress filters on device %s\n",
 			       ingress_ifname);
@@ -317,6 +508,13 @@ int main(int argc, char **argv)
 		return EXIT_SUCCESS;
 	}
 
+	/* The XDP egress is in the devmap, set at attach */
+	if (stats_fd >= 0) {
+		if (stats)
+			stats_poll(stats_fd, interval, mode);
+		return EXIT_SUCCESS;
+	}
+
 	fd = bpf_obj_get(mapfile);
 	if (fd < 0) {
 		fprintf(stderr, "ERROR: cannot open bpf_obj_get(%s): %s(%d)\n",
@@ -351,6 +549,18 @@ int main(int argc, char **argv)
 			       buf_ifname, egress_ifindex);
 		}
 	}
+
+	if (stats) {
+		stats_fd = bpf_obj_get(statsfile);
+		if (stats_fd < 0) {
+			fprintf(stderr,
+				"ERROR: cannot open bpf_obj_get(%s): %s(%d)\n",
+				statsfile, strerror(errno), errno);
+			ret = EXIT_FAILURE;
+			goto out;
+		}
+		stats_poll(stats_fd, interval, mode);
+	}
 out:
 	if (fd != -1)
 		close(fd);
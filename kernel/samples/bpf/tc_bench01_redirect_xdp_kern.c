@@ -0,0 +1,100 @@
+/*  XDP side of the TC redirect benchmark, same forwarding at the XDP
+ *  layer for comparing with the TC progs in tc_bench01_redirect_kern.c
+ *
+ *  Loaded and attached by tc_bench01_redirect --mode xdp-redirect or
+ *  xdp-tx, via bpf_load.c (not tc).
+ *
+ *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat Inc.
+ */
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+
+#include "bpf_helpers.h"
+
+/* Key 0: egress ifindex, set by _user */
+struct bpf_map_def SEC("maps") tx_port = {
+	.type = BPF_MAP_TYPE_DEVMAP,
+	.key_size = sizeof(int),
+	.value_size = sizeof(int),
+	.max_entries = 1,
+};
+
+/* WARNING - same layout as bench_stats in tc_bench01_redirect_kern.c */
+struct bpf_map_def SEC("maps") bench_stats = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = 1,
+};
+
+static __always_inline void swap_src_dst_mac(void *data)
+{
+	unsigned short *p = data;
+	unsigned short dst[3];
+
+	dst[0] = p[0];
+	dst[1] = p[1];
+	dst[2] = p[2];
+	p[0] = p[3];
+	p[1] = p[4];
+	p[2] = p[5];
+	p[3] = dst[0];
+	p[4] = dst[1];
+	p[5] = dst[2];
+}
+
+/* Same checks and packet counting as fwd_ifindex() of the TC progs */
+static __always_inline bool fwd_packet(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	u32 key = 0;
+	u64 *cnt;
+
+	if (data + sizeof(*eth) > data_end)
+		return false;
+
+	/* Keep ARP resolution working */
+	if (eth->h_proto == htons(ETH_P_ARP))
+		return false;
+
+	cnt = bpf_map_lookup_elem(&bench_stats, &key);
+	if (cnt)
+		*cnt += 1;
+	return true;
+}
+
+/* The devmap egress dev needs ndo_xdp_xmit in native XDP mode.  As
+ * the TC prog, the MAC-addrs are swapped when bouncing out ingress.
+ */
+SEC("xdp_redirect_map")
+int xdp_redirect_map_prog(struct xdp_md *ctx)
+{
+	void *data = (void *)(long)ctx->data;
+	int *ifindex, key = 0;
+
+	if (!fwd_packet(ctx))
+		return XDP_PASS;
+
+	ifindex = bpf_map_lookup_elem(&tx_port, &key);
+	if (ifindex && *ifindex == ctx->ingress_ifindex)
+		swap_src_dst_mac(data);
+
+	return bpf_redirect_map(&tx_port, key, 0);
+}
+
+/* Bounce out the ingress dev, the --egress setting is ignored */
+SEC("xdp_tx")
+int xdp_tx_prog(struct xdp_md *ctx)
+{
+	void *data = (void *)(long)ctx->data;
+
+	if (!fwd_packet(ctx))
+		return XDP_PASS;
+
+	swap_src_dst_mac(data);
+	return XDP_TX;
+}
+
+char _license[] SEC("license") = "GPL";
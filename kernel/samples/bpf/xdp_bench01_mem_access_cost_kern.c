@@ -3,6 +3,7 @@
 #include <uapi/linux/if_ether.h>
 #include <uapi/linux/in.h>
 #include "bpf_helpers.h"
+#include "xdp_frags_kern.h"
 
 struct bpf_map_def SEC("maps") rx_cnt = {
 	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
@@ -25,6 +26,111 @@ struct bpf_map_def SEC("maps") touch_memory = {
 	.max_entries = 1,
 };
 
+/* Per packet state lookups, modelling e.g. a connection table whose
+ * working set outgrows L1/L2/LLC.  WARNING - sync with _user.c
+ */
+enum state_type {
+	STATE_NONE = 0,
+	STATE_ARRAY,
+	STATE_HASH,
+};
+
+struct state_config {
+	u32 type;
+	u32 nr_entries;	/* Working set, can be below map max_entries */
+	u32 stride;	/* In entries, 0 for random */
+	u32 lookups;	/* Per packet, max STATE_LOOKUPS_MAX */
+	u32 write;
+};
+#define STATE_LOOKUPS_MAX 8
+
+struct state_value {
+	u64 data[8]; /* One cache-line */
+};
+
+struct bpf_map_def SEC("maps") state_config = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct state_config),
+	.max_entries = 1,
+};
+
+/* Sized by _user.c at load time from --state-size */
+struct bpf_map_def SEC("maps") state_array = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct state_value),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") state_hash = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct state_value),
+	.max_entries = 1,
+};
+
+/* Next index, per CPU to avoid bouncing this cache-line */
+struct bpf_map_def SEC("maps") state_cursor = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u32),
+	.max_entries = 1,
+};
+
+/* Bytes incl. fragments, for GB/s of single vs multi-buffer frames.
+ * Last of SEC("maps"), as _user.c use the map_fd[] index of the others.
+ */
+struct bpf_map_def SEC("maps") rx_bytes = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = 1,
+};
+
+static __always_inline void state_access(void)
+{
+	struct state_config *cfg;
+	struct state_value *val;
+	u32 key = 0, *cursor, idx;
+	volatile u64 data;
+	int i;
+
+	cfg = bpf_map_lookup_elem(&state_config, &key);
+	if (!cfg || cfg->type == STATE_NONE || !cfg->nr_entries)
+		return;
+
+	cursor = bpf_map_lookup_elem(&state_cursor, &key);
+	if (!cursor)
+		return;
+	idx = *cursor;
+
+#pragma unroll
+	for (i = 0; i < STATE_LOOKUPS_MAX; i++) {
+		if (i >= cfg->lookups)
+			break;
+
+		/* Random defeats the HW prefetcher, a stride might not */
+		if (cfg->stride)
+			idx = (idx + cfg->stride) % cfg->nr_entries;
+		else
+			idx = bpf_get_prandom_u32() % cfg->nr_entries;
+
+		if (cfg->type == STATE_HASH)
+			val = bpf_map_lookup_elem(&state_hash, &idx);
+		else
+			val = bpf_map_lookup_elem(&state_array, &idx);
+		if (!val)
+			continue;
+
+		if (cfg->write)
+			val->data[0]++; /* Dirty the cache-line */
+		else
+			data = val->data[0];
+	}
+	*cursor = idx;
+}
+
 static void swap_src_dst_mac(void *data)
 {
 	unsigned short *p = data;
@@ -41,15 +147,21 @@ static void swap_src_dst_mac(void *data)
 	p[5] = dst[2];
 }
 
-SEC("xdp_bench01")
-int xdp_prog(struct xdp_md *ctx)
+/* touch_memory bits, WARNING - sync with _user.c */
+#define READ_MEM	0x1
+#define SWAP_MAC	0x2
+#define READ_TAIL	0x4
+
+static __always_inline
+int bench01(struct xdp_md *ctx, int frags)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data = (void *)(long)ctx->data;
 	struct ethhdr *eth = data;
+	u8 tail[FRAME_TAIL_LEN];
 	volatile u16 eth_type;
 	long *value;
-	u64 offset;
+	u64 offset, len;
 	u32 key = 0;
 	int *action;
 	u64 *touch_mem;
@@ -64,11 +176,13 @@ int xdp_prog(struct xdp_md *ctx)
 	if (!action)
 		return XDP_DROP;
 
+	len = frame_len(ctx, frags);
+
 	/* Default: Don't touch packet data, only count packets */
 	touch_mem = bpf_map_lookup_elem(&touch_memory, &key);
 	if (touch_mem && (*touch_mem > 0)) {
 
-		if (*touch_mem & 1) { /* Enable via --readmem */
+		if (*touch_mem & READ_MEM) { /* Enable via --readmem */
 			struct ethhdr *eth = data;
 
 			eth_type = eth->h_proto;
@@ -79,23 +193,47 @@ int xdp_prog(struct xdp_md *ctx)
 				return XDP_DROP;
 		}
 
+		/* Enable via --readtail, the payload end of jumbo frames */
+		if (*touch_mem & READ_TAIL) {
+			if (frame_tail_read(ctx, len, tail))
+				return XDP_DROP;
+		}
+
 		/* If touch_mem, also swap MACs for XDP_TX.  This is
 		 * needed for action XDP_TX, else HW will not TX packet
 		 * (this was observed with mlx5 driver).
 		 *
 		 * Can also be enabled with --swapmac
 		 */
-		if (*action == XDP_TX || (*touch_mem & 2))
+		if (*action == XDP_TX || (*touch_mem & SWAP_MAC))
 			swap_src_dst_mac(data);
 	}
 
+	state_access();
+
 	value = bpf_map_lookup_elem(&rx_cnt, &key);
 	if (value)
 		*value += 1;
+	value = bpf_map_lookup_elem(&rx_bytes, &key);
+	if (value)
+		*value += len;
 
 	return *action;
 }
 
+SEC("xdp_bench01")
+int xdp_prog(struct xdp_md *ctx)
+{
+	return bench01(ctx, false);
+}
+
+/* Multi-buffer aware variant, selected by _user.c --frags */
+SEC("xdp.frags/xdp_bench01")
+int xdp_prog_frags(struct xdp_md *ctx)
+{
+	return bench01(ctx, true);
+}
+
 char _license[] SEC("license") = "GPL";
 
 /* Hack as libbpf require a "version" section */
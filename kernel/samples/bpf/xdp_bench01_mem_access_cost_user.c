@@ -1,7 +1,18 @@
 /* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
 static const char *__doc__=
- " XDP bench01: Measure cost of touching vs. not-touching packet memory";
+ " XDP bench01: Measure cost of touching vs. not-touching packet memory\n"
+ "\n"
+ " With --state, each packet also does --lookups lookups in an array or\n"
+ " hash map of 64 byte (cache-line) values, covering a working set of\n"
+ " --state-size bytes, with --stride entries between lookups (0 for\n"
+ " random).  Use --sweep to double the working set each --sec period,\n"
+ " producing the pps cost curve as it outgrows L1/L2/LLC.\n"
+ "\n"
+ " --frags loads the multi-buffer (BPF_F_XDP_HAS_FRAGS) variant, needed\n"
+ " for e.g. 9000 MTU, and --readtail reads the last 64 bytes of each\n"
+ " frame via bpf_xdp_load_bytes(), in the last fragment of a jumbo\n"
+ " frame.  Compare pps and GB/s against the single buffer program.";
 
 #include <assert.h>
 #include <errno.h>
@@ -24,6 +35,7 @@ static const char *__doc__=
 #include "libbpf.h"
 #include "bpf_load.h"
 #include "bpf_util.h"
+#include "xdp_stats.h"
 
 static int ifindex = -1;
 static char ifname_buf[IF_NAMESIZE];
@@ -54,9 +66,20 @@ static const struct option long_options[] = {
 	{"readmem", 	no_argument,		NULL, 'r' },
 	{"swapmac", 	no_argument,		NULL, 'm' },
 	{"skb-mode", 	no_argument,		NULL, 'S' },
+	{"format",	required_argument,	NULL, 'F' },
+	{"state",	required_argument,	NULL, 't' },
+	{"state-size",	required_argument,	NULL, 'z' },
+	{"stride",	required_argument,	NULL, 'e' },
+	{"lookups",	required_argument,	NULL, 'l' },
+	{"state-write",	no_argument,		NULL, 'w' },
+	{"sweep",	no_argument,		NULL, 'W' },
+	{"frags",	no_argument,		NULL, 'f' },
+	{"readtail",	no_argument,		NULL, 'T' },
 	{0, 0, NULL,  0 }
 };
 
+static struct stats_output stats_out;
+
 static void usage(char *argv[])
 {
 	int i;
@@ -80,6 +103,7 @@ static void usage(char *argv[])
 
 struct stats_record {
 	__u64 counter;
+	__u64 bytes;
 	__u64 action;
 	__u64 touch_mem;
 };
@@ -99,6 +123,122 @@ static const char *action2str(int action)
 	return NULL;
 }
 
+/* Per packet state lookups, WARNING - sync with _kern.c */
+enum state_type {
+	STATE_NONE = 0,
+	STATE_ARRAY,
+	STATE_HASH,
+};
+
+struct state_config {
+	__u32 type;
+	__u32 nr_entries;
+	__u32 stride;
+	__u32 lookups;
+	__u32 write;
+};
+#define STATE_LOOKUPS_MAX 8
+
+struct state_value {
+	__u64 data[8];
+};
+
+/* Index into map_fd[], ELF map order of _kern.c */
+#define MAP_IDX_STATE_CONFIG	3
+#define MAP_IDX_STATE_HASH	5
+
+#define STATE_SIZE_DEFAULT	(1ULL << 20)	/* 1 MiB */
+#define STATE_SWEEP_MIN		(16ULL << 10)	/* 16 KiB, below L1d */
+
+static struct state_config state_cfg = {
+	.type    = STATE_NONE,
+	.stride  = 0,
+	.lookups = 1,
+};
+static __u32 state_max_entries = 1;
+
+static const char *state_type2str(__u32 type)
+{
+	if (type == STATE_ARRAY)
+		return "array";
+	if (type == STATE_HASH)
+		return "hash";
+	return "none";
+}
+
+/* Size in bytes with optional K, M or G suffix (base 1024) */
+static int parse_size(const char *str, __u64 *size)
+{
+	char *end;
+
+	*size = strtoull(str, &end, 0);
+	switch (*end) {
+	case 'G': case 'g':
+		*size <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		*size <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		*size <<= 10;
+		end++;
+		break;
+	}
+	return (*end || !*size) ? -EINVAL : 0;
+}
+
+static const char *size2str(__u64 size, char *buf, size_t len)
+{
+	if (size >= (1ULL << 30) && !(size & ((1ULL << 30) - 1)))
+		snprintf(buf, len, "%lluG", size >> 30);
+	else if (size >= (1ULL << 20) && !(size & ((1ULL << 20) - 1)))
+		snprintf(buf, len, "%lluM", size >> 20);
+	else if (size >= (1ULL << 10) && !(size & ((1ULL << 10) - 1)))
+		snprintf(buf, len, "%lluK", size >> 10);
+	else
+		snprintf(buf, len, "%llu", size);
+	return buf;
+}
+
+static bool set_state_config(struct state_config *cfg)
+{
+	__u32 key = 0;
+
+	if (bpf_map_update_elem(map_fd[MAP_IDX_STATE_CONFIG], &key, cfg,
+				BPF_ANY) != 0) {
+		fprintf(stderr, "ERR: %s(): bpf_map_update_elem failed\n",
+			__func__);
+		return false;
+	}
+	return true;
+}
+
+/* The array map is zero initialized, hash needs all keys inserted */
+static bool state_hash_fill(__u32 nr_entries)
+{
+	struct state_value value;
+	__u32 key;
+
+	memset(&value, 0, sizeof(value));
+	for (key = 0; key < nr_entries; key++) {
+		if (bpf_map_update_elem(map_fd[MAP_IDX_STATE_HASH], &key,
+					&value, BPF_ANY) != 0) {
+			fprintf(stderr, "ERR: state hash insert %u err(%d):%s\n",
+				key, errno, strerror(errno));
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Size state maps from --state-size, instead of max_entries in _kern.c */
+static void fixup_map_state(struct bpf_map_data *map, int idx)
+{
+	if (!strcmp(map->name, "state_array") ||
+	    !strcmp(map->name, "state_hash"))
+		map->def.max_entries = state_max_entries;
+}
+
 static __u64 get_xdp_action(void)
 {
 	__u64 value;
@@ -158,6 +298,7 @@ enum touch_mem_type {
 	NO_TOUCH = 0x0ULL,
 	READ_MEM = 0x1ULL,
 	SWAP_MAC = 0x2ULL, /* Used as bit */
+	READ_TAIL = 0x4ULL, /* Used as bit, WARNING - sync with _kern.c */
 };
 
 static char* mem2str(enum touch_mem_type touch_mem)
@@ -168,6 +309,8 @@ static char* mem2str(enum touch_mem_type touch_mem)
 		return "read";
 	if ((touch_mem & SWAP_MAC))
 		return "swap_mac";
+	if ((touch_mem & READ_TAIL))
+		return "read_tail";
 	fprintf(stderr, "ERR: Unknown memory touch type");
 	exit(EXIT_FAIL);
 }
@@ -207,86 +350,103 @@ static bool set_touch_mem(__u64 action)
 	return true;
 }
 
-/* gettime returns the current time of day in nanoseconds.
- * Cost: clock_gettime (ns) => 26ns (CLOCK_MONOTONIC)
- *       clock_gettime (ns) =>  9ns (CLOCK_MONOTONIC_COARSE)
- */
-#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
-uint64_t gettime(void)
-{
-	struct timespec t;
-	int res;
-
-	res = clock_gettime(CLOCK_MONOTONIC, &t);
-	if (res < 0) {
-		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
-		exit(EXIT_FAIL);
-	}
-	return (uint64_t) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
-}
-
 static bool stats_collect(struct stats_record *record)
 {
-	unsigned int nr_cpus = bpf_num_possible_cpus();
-	__u64 values[nr_cpus];
+	__u64 sum;
 	__u32 key = 0;
-	__u64 sum = 0;
-	int i;
 
 	/* Notice map is percpu: BPF_MAP_TYPE_PERCPU_ARRAY */
-	if ((bpf_map_lookup_elem(map_fd[0], &key, values)) != 0) {
+	if (stats_percpu_sum(map_fd[0], &key, &sum, sizeof(sum))) {
 		fprintf(stderr, "WARN: bpf_map_lookup_elem failed\n");
 		return false;
 	}
-	/* Sum values from each CPU */
-	for (i = 0; i < nr_cpus; i++) {
-		sum += values[i];
-	}
 	record->counter = sum;
+	record->bytes = stats_percpu_sum_u64(bpf_load_map_fd("rx_bytes"), 0);
 
 	return true;
 }
 
-static void stats_poll(int interval)
+static void stats_poll(int interval, bool sweep, bool frags)
 {
+	char wset[16], state_str[32];
 	struct stats_record record;
-	__u64 prev = 0, count;
+	__u64 prev = 0, count, prev_bytes;
 	__u64 prev_timestamp;
 	__u64 timestamp;
 	__u64 period;
-	double pps_ = 0;
+	double pps_ = 0, gbps;
 
 	memset(&record, 0, sizeof(record));
-	timestamp = gettime();
+	timestamp = stats_gettime();
 
 	/* Read current XDP action and touch mem setting */
 	record.action    = get_xdp_action();
 	record.touch_mem = get_touch_mem();
 
+	if (sweep)
+		state_cfg.nr_entries = STATE_SWEEP_MIN / sizeof(struct state_value);
+	if (state_cfg.type != STATE_NONE && !set_state_config(&state_cfg))
+		exit(EXIT_FAIL_XDP);
+
 	/* Trick to pretty printf with thousands separators use %' */
 	setlocale(LC_NUMERIC, "en_US");
 
 	/* Header */
-	printf("%-12s %-10s %-18s %-9s\n",
-	       "XDP_action", "pps ", "pps-human-readable", "mem");
+	if (stats_out.fmt == STATS_FMT_TEXT)
+		printf("%-12s %-10s %-18s %-7s %-9s %-12s\n",
+		       "XDP_action", "pps ", "pps-human-readable", "GB/s",
+		       "mem", state_cfg.type != STATE_NONE ? "state" : "");
 
 	while (1) {
 		sleep(interval);
 		prev_timestamp = timestamp;
 		prev = record.counter;
-		timestamp = gettime();
+		prev_bytes = record.bytes;
+		timestamp = stats_gettime();
 		if (!stats_collect(&record))
 			exit(EXIT_FAIL_XDP);
 
 		period = timestamp - prev_timestamp;
 		count = record.counter;
+		if (stats_out.fmt != STATS_FMT_TEXT) {
+			stats_output_begin(&stats_out, period);
+			stats_output_metric(&stats_out, "rx_packets", "action",
+					    action2str(record.action),
+					    count, count - prev);
+			stats_output_metric(&stats_out, "rx_bytes", "action",
+					    action2str(record.action),
+					    record.bytes,
+					    record.bytes - prev_bytes);
+			stats_output_end(&stats_out);
+			continue;
+		}
 		/* pps  = (count - prev)/interval; */
 		pps_ = (count - prev) / ((double) period / NANOSEC_PER_SEC);
-
-		printf("%-12s %-10.0f %'-18.0f %-9s %s\n",
-		       action2str(record.action), pps_, pps_,
-		       mem2str(record.touch_mem),
-		       flags2str(xdp_flags));
+		gbps = (record.bytes - prev_bytes) / (double)period;
+
+		state_str[0] = '\0';
+		if (state_cfg.type != STATE_NONE)
+			snprintf(state_str, sizeof(state_str), "%s:%s",
+				 state_type2str(state_cfg.type),
+				 size2str((__u64)state_cfg.nr_entries *
+					  sizeof(struct state_value),
+					  wset, sizeof(wset)));
+
+		printf("%-12s %-10.0f %'-18.0f %-7.2f %-9s %-12s %s %s\n",
+		       action2str(record.action), pps_, pps_, gbps,
+		       mem2str(record.touch_mem), state_str,
+		       flags2str(xdp_flags), frags ? "frags" : "");
+
+		/* Double working set, first period after includes warm-up */
+		if (sweep) {
+			if (state_cfg.nr_entries >= state_max_entries)
+				exit(EXIT_OK);
+			state_cfg.nr_entries *= 2;
+			if (state_cfg.nr_entries > state_max_entries)
+				state_cfg.nr_entries = state_max_entries;
+			if (!set_state_config(&state_cfg))
+				exit(EXIT_FAIL_XDP);
+		}
 
 		// TODO: add nanosec variation measurement to assess accuracy
 	}
@@ -302,12 +462,16 @@ int main(int argc, char **argv)
 	int longindex = 0;
 	int interval = 1;
 	__u64 touch_mem = 0; /* Default: Don't touch packet memory */
-	int opt;
+	__u64 state_size = STATE_SIZE_DEFAULT;
+	bool sweep = false;
+	bool frags = false;
+	int opt, fd;
 
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+	stats_output_init(&stats_out, "xdp_bench01", NULL);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hSd:s:",
+	while ((opt = getopt_long(argc, argv, "hSd:s:a:rmF:t:z:e:l:wWfT",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'd':
@@ -328,6 +492,10 @@ int main(int argc, char **argv)
 		case 's':
 			interval = atoi(optarg);
 			break;
+		case 'F':
+			if (stats_output_init(&stats_out, "xdp_bench01", optarg))
+				goto error;
+			break;
 		case 'a':
 			action_str = (char *)&action_str_buf;
 			strncpy(action_str, optarg, XDP_ACTION_MAX_STRLEN);
@@ -341,6 +509,40 @@ int main(int argc, char **argv)
 		case 'S':
 			xdp_flags |= XDP_FLAGS_SKB_MODE;
 			break;
+		case 't':
+			if (!strcmp(optarg, "array"))
+				state_cfg.type = STATE_ARRAY;
+			else if (!strcmp(optarg, "hash"))
+				state_cfg.type = STATE_HASH;
+			else {
+				fprintf(stderr, "ERR: --state array|hash\n");
+				goto error;
+			}
+			break;
+		case 'z':
+			if (parse_size(optarg, &state_size)) {
+				fprintf(stderr, "ERR: --state-size invalid\n");
+				goto error;
+			}
+			break;
+		case 'e':
+			state_cfg.stride = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			state_cfg.lookups = atoi(optarg);
+			break;
+		case 'w':
+			state_cfg.write = 1;
+			break;
+		case 'W':
+			sweep = true;
+			break;
+		case 'f':
+			frags = true;
+			break;
+		case 'T':
+			touch_mem |= READ_TAIL;
+			break;
 		case 'h':
 		error:
 		default:
@@ -356,6 +558,23 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_OPTION;
 	}
 
+	if (state_cfg.type != STATE_NONE) {
+		__u64 nr = state_size / sizeof(struct state_value);
+
+		if (!nr || nr > 0xFFFFFFFF || state_cfg.lookups < 1 ||
+		    state_cfg.lookups > STATE_LOOKUPS_MAX) {
+			fprintf(stderr, "ERR: need --state-size >= %zu and"
+				" --lookups 1-%d\n", sizeof(struct state_value),
+				STATE_LOOKUPS_MAX);
+			return EXIT_FAIL_OPTION;
+		}
+		state_max_entries = nr;
+		state_cfg.nr_entries = nr;
+	} else if (sweep) {
+		fprintf(stderr, "ERR: --sweep requires --state\n");
+		return EXIT_FAIL_OPTION;
+	}
+
 	/* Parse action string */
 	if (action_str) {
 		action = parse_xdp_action(action_str);
@@ -374,7 +593,7 @@ int main(int argc, char **argv)
 		return EXIT_FAIL;
 	}
 
-	if (load_bpf_file(filename)) {
+	if (load_bpf_file_fixup_map(filename, fixup_map_state)) {
 		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
 		return EXIT_FAIL;
 	}
@@ -384,9 +603,18 @@ int main(int argc, char **argv)
 		return EXIT_FAIL;
 	}
 
+	/* Both variants are in the ELF file, same maps */
+	fd = frags ? bpf_load_prog_fd("xdp.frags/xdp_bench01") : prog_fd[0];
+	if (fd < 0) {
+		fprintf(stderr, "ERR: frags prog not found\n");
+		return EXIT_FAIL;
+	}
+
 	/* Control behavior of XDP program */
 	set_xdp_action(action);
 	set_touch_mem(touch_mem);
+	if (state_cfg.type == STATE_HASH && !state_hash_fill(state_max_entries))
+		return EXIT_FAIL;
 
 	/* Some NIC drop packets on XDP_TX if MAC-addr isn't changed */
 	if ((action == XDP_TX) && !(touch_mem))
@@ -396,12 +624,13 @@ int main(int argc, char **argv)
 	/* Remove XDP program when program is interrupted */
 	signal(SIGINT, int_exit);
 
-	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
-		fprintf(stderr, "link set xdp fd failed\n");
+	if (set_link_xdp_fd(ifindex, fd, xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed%s\n",
+			frags ? "" : ", MTU above a page needs --frags");
 		return EXIT_FAIL_XDP;
 	}
 
-	stats_poll(interval);
+	stats_poll(interval, sweep, frags);
 
 	return EXIT_OK;
 }
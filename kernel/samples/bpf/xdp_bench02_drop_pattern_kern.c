@@ -9,6 +9,7 @@
 #include <uapi/linux/udp.h>
 
 #include "bpf_helpers.h"
+#include "xdp_frags_kern.h"
 
 struct vlan_hdr {
 	__be16 h_vlan_TCI;
@@ -47,7 +48,7 @@ struct bpf_map_def SEC("maps") touch_memory = {
 	.max_entries = 1,
 };
 
-#define XDP_ACTION_MAX (XDP_TX + 1)
+#define XDP_ACTION_MAX (XDP_REDIRECT + 1)
 
 /* Counter per XDP "action" verdict */
 struct bpf_map_def SEC("maps") verdict_cnt = {
@@ -94,6 +95,60 @@ struct bpf_map_def SEC("maps") xdp_action = {
 	.max_entries = 1,
 };
 
+/* Pattern types, remember: sync with _user.c */
+#define PATTERN_N_DROP_N_ACCEPT	1
+#define PATTERN_RANDOM_DROP	2
+#define PATTERN_FLOW_BURST	3
+#define PATTERN_MIX		4
+
+/* Weight per XDP action for PATTERN_MIX */
+struct verdict_ratio {
+	u32 weight[XDP_ACTION_MAX];
+	u32 total;
+};
+
+struct bpf_map_def SEC("maps") verdict_ratio = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct verdict_ratio),
+	.max_entries = 1,
+};
+
+struct flow_key {
+	u32 saddr;
+	u32 daddr;
+	u32 ports;
+	u32 proto;
+};
+
+/* Packet counter per flow for PATTERN_FLOW_BURST */
+struct bpf_map_def SEC("maps") flow_state = {
+	.type = BPF_MAP_TYPE_LRU_HASH,
+	.key_size = sizeof(struct flow_key),
+	.value_size = sizeof(u64),
+	.max_entries = 65536,
+};
+
+/* XDP_REDIRECT target, key 0, defaults to the RX device itself */
+struct bpf_map_def SEC("maps") tx_port = {
+	.type = BPF_MAP_TYPE_DEVMAP,
+	.key_size = sizeof(int),
+	.value_size = sizeof(int),
+	.max_entries = 1,
+};
+
+/* Bytes incl. fragments, of the packets counted in rx_cnt */
+struct bpf_map_def SEC("maps") rx_bytes = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = 1,
+};
+
+/* touch_memory bits, remember: sync with _user.c */
+#define READ_MEM	0x1
+#define READ_TAIL	0x4
+
 /*
  * Pattern1: N-drop + N-accept
  *
@@ -128,6 +183,86 @@ u32 N_drop_N_accept(u64 N)
 	}
 }
 
+/*
+ * Pattern2: Random drop with probability arg/1000
+ *
+ * Drops are spread evenly, thus verdicts are mixed within a NAPI poll.
+ */
+static __always_inline
+u32 random_drop(u32 permille)
+{
+	if ((bpf_get_prandom_u32() % 1000) < permille)
+		return XDP_DROP;
+	return XDP_PASS;
+}
+
+/*
+ * Pattern4: Mixed DROP/PASS/TX/REDIRECT by weight
+ */
+static __always_inline
+u32 verdict_mix(void)
+{
+	struct verdict_ratio *ratio;
+	u32 key = 0, r, i;
+
+	ratio = bpf_map_lookup_elem(&verdict_ratio, &key);
+	if (!ratio || !ratio->total)
+		return XDP_PASS;
+
+	r = bpf_get_prandom_u32() % ratio->total;
+#pragma unroll
+	for (i = XDP_DROP; i < XDP_ACTION_MAX; i++) {
+		if (r < ratio->weight[i])
+			return i;
+		r -= ratio->weight[i];
+	}
+	return XDP_PASS;
+}
+
+/*
+ * Pattern3: Per flow N-drop + N-accept
+ *
+ * Like pattern1 but per flow, resembling e.g. a DDoS filter kicking
+ * in for a burst of a flow.  The verdict mix seen per NAPI poll
+ * thus depends on how flows are interleaved on the wire.
+ */
+static __always_inline
+u32 flow_burst(struct xdp_md *ctx, u16 eth_proto, u64 l3_offset, u64 N)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct iphdr *iph = data + l3_offset;
+	struct flow_key flow = {};
+	u64 *value, val, init = 1;
+	struct udphdr *udph;
+
+	if (eth_proto != ETH_P_IP || N == 0)
+		return XDP_PASS;
+	if (iph + 1 > data_end)
+		return XDP_ABORTED;
+
+	flow.saddr = iph->saddr;
+	flow.daddr = iph->daddr;
+	flow.proto = iph->protocol;
+	/* TCP and UDP ports are at same offset, ignore IP options */
+	if (iph->protocol == IPPROTO_UDP || iph->protocol == IPPROTO_TCP) {
+		udph = (void *)(iph + 1);
+		if (udph + 1 > data_end)
+			return XDP_ABORTED;
+		flow.ports = (udph->source << 16) | udph->dest;
+	}
+
+	value = bpf_map_lookup_elem(&flow_state, &flow);
+	if (!value) {
+		bpf_map_update_elem(&flow_state, &flow, &init, BPF_ANY);
+		return XDP_DROP;
+	}
+	/* Flow normally lands on a single RX-queue, thus a single CPU */
+	val = (*value)++;
+	if ((val % (N * 2)) < N)
+		return XDP_DROP;
+	return XDP_PASS;
+}
 
 static __always_inline
 u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
@@ -208,8 +343,8 @@ u32 handle_eth_protocol(struct xdp_md *ctx, u16 eth_proto, u64 l3_offset)
 	return XDP_PASS;
 }
 
-SEC("xdp_bench02")
-int xdp_prog(struct xdp_md *ctx)
+static __always_inline
+u32 bench02(struct xdp_md *ctx, int frags)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data = (void *)(long)ctx->data;
@@ -221,6 +356,10 @@ int xdp_prog(struct xdp_md *ctx)
 	struct pattern *pattern;
 	u32 key = 0;
 	u64 *touch_mem;
+	u16 eth_proto = 0;
+	u64 l3_offset = 0;
+	u8 tail[FRAME_TAIL_LEN];
+	u64 len;
 
 	/* Validate packet length is minimum Eth header size */
 	offset = sizeof(*eth);
@@ -234,10 +373,8 @@ int xdp_prog(struct xdp_md *ctx)
 
 	/* Default: Don't touch packet data, only count packets */
 	touch_mem = bpf_map_lookup_elem(&touch_memory, &key);
-	if (touch_mem && (*touch_mem == 1)) {
+	if (touch_mem && (*touch_mem & READ_MEM)) {
 		struct ethhdr *eth = data;
-		u16 eth_proto = 0;
-		u64 l3_offset = 0;
 
 		if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset)))
 			return XDP_PASS; /* Skip */
@@ -249,12 +386,33 @@ int xdp_prog(struct xdp_md *ctx)
 		}
 	}
 
+	len = frame_len(ctx, frags);
+	if (touch_mem && (*touch_mem & READ_TAIL) &&
+	    frame_tail_read(ctx, len, tail))
+		return XDP_ABORTED;
+
 	value = bpf_map_lookup_elem(&rx_cnt, &key);
 	if (value)
 		*value += 1;
+	value = bpf_map_lookup_elem(&rx_bytes, &key);
+	if (value)
+		*value += len;
 
-	if (pattern->type == 1)
+	switch (pattern->type) {
+	case PATTERN_N_DROP_N_ACCEPT:
 		action = N_drop_N_accept(pattern->arg);
+		break;
+	case PATTERN_RANDOM_DROP:
+		action = random_drop(pattern->arg);
+		break;
+	case PATTERN_FLOW_BURST:
+		/* Need parsed headers, _user.c ensures touch_mem */
+		action = flow_burst(ctx, eth_proto, l3_offset, pattern->arg);
+		break;
+	case PATTERN_MIX:
+		action = verdict_mix();
+		break;
+	}
 
 	/* Override action option: allows measure baseline cost of program */
 	a3 = bpf_map_lookup_elem(&xdp_action, &key);
@@ -262,8 +420,25 @@ int xdp_prog(struct xdp_md *ctx)
 		action = *a3;
 	}
 out:
+	if (action == XDP_REDIRECT)
+		action = bpf_redirect_map(&tx_port, 0, 0);
 	stats_action_verdict(action);
 	return action;
 }
 
+SEC("xdp_bench02")
+int xdp_prog(struct xdp_md *ctx)
+{
+	return bench02(ctx, 0);
+}
+
+/* Multi-buffer aware variant, selected by _user.c --frags.  Headers are
+ * parsed in the linear part, which multi-buffer drivers fill first.
+ */
+SEC("xdp.frags/xdp_bench02")
+int xdp_prog_frags(struct xdp_md *ctx)
+{
+	return bench02(ctx, 1);
+}
+
 char _license[] SEC("license") = "GPL";
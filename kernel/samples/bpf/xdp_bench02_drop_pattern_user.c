@@ -6,7 +6,19 @@ static const char *__doc__=
 "  Instead of dropping every second packet, half of the packets can also\n"
 "  be dropped by dropping N-packets followed by accepting N-packets.\n"
 "  Such a N-drop-N-accept pattern, resembles what RX-stages can achieve\n"
-"  by handling the XDP stage before netstack stage.\n";
+"  by handling the XDP stage before netstack stage.\n"
+"\n"
+" Patterns mirroring production: --random-drop drops with probability\n"
+"  PERMILLE/1000, --flow-burst does N-drop-N-accept per flow, and --mix\n"
+"  spreads verdicts by DROP:PASS:TX:REDIRECT weights.  These measure\n"
+"  how driver bulking (page recycle, TX flush) degrades under mixed\n"
+"  verdicts.  With --baseline SEC, the first SEC seconds are pure\n"
+"  XDP_DROP (after same parsing) and a pps overhead summary is printed\n"
+"  on exit.  The generator must overload the CPU for this to be valid.\n"
+"\n"
+" --frags loads the multi-buffer (BPF_F_XDP_HAS_FRAGS) variant, needed\n"
+"  for e.g. 9000 MTU, and --readtail also reads the frame tail via\n"
+"  bpf_xdp_load_bytes().  rx_bytes GB/s counts the whole frames.\n";
 
 #include <assert.h>
 #include <errno.h>
@@ -28,6 +40,7 @@ static const char *__doc__=
 
 #include "bpf_load.h"
 #include "bpf_util.h"
+#include "xdp_stats.h"
 #include "libbpf.h"
 
 static int ifindex = -1;
@@ -41,8 +54,42 @@ static char *ifname = NULL;
 #define EXIT_FAIL_OPTION        2
 #define EXIT_FAIL_XDP           3
 
+/* Pure XDP_DROP baseline vs pattern, rx_total summed per phase */
+enum phase {
+	PHASE_BASELINE = 0,
+	PHASE_PATTERN,
+	PHASE_MAX,
+};
+static struct {
+	__u64 packets;
+	__u64 period;
+} phase_sum[PHASE_MAX];
+static bool baseline_enabled;
+
+static double phase_pps(enum phase phase)
+{
+	if (!phase_sum[phase].period)
+		return 0;
+	return phase_sum[phase].packets /
+		((double) phase_sum[phase].period / NANOSEC_PER_SEC);
+}
+
+static void summary_print(void)
+{
+	double base = phase_pps(PHASE_BASELINE);
+	double pat  = phase_pps(PHASE_PATTERN);
+
+	if (!baseline_enabled || base <= 0 || pat <= 0)
+		return;
+
+	printf("\nSummary: baseline XDP_DROP %'.0f pps, pattern %'.0f pps\n"
+	       " - overhead %.2f ns/pkt (%.1f%% pps reduction)\n",
+	       base, pat, 1e9 / pat - 1e9 / base, (base - pat) * 100 / base);
+}
+
 static void int_exit(int sig)
 {
+	summary_print();
 	fprintf(stderr,
 		"Interrupted: Removing XDP program on ifindex:%d device:%s\n",
 		ifindex, ifname);
@@ -59,9 +106,19 @@ static const struct option long_options[] = {
 	{"action", 	required_argument,	NULL, 'a' },
 	{"notouch", 	no_argument,		NULL, 'n' },
 	{"skbmode", 	no_argument,		NULL, 'S' },
+	{"format",	required_argument,	NULL, 'F' },
+	{"random-drop",	required_argument,	NULL, 'r' },
+	{"flow-burst",	required_argument,	NULL, 'f' },
+	{"mix",		required_argument,	NULL, 'm' },
+	{"redirect-dev", required_argument,	NULL, 'R' },
+	{"baseline",	required_argument,	NULL, 'b' },
+	{"frags",	no_argument,		NULL, 'M' },
+	{"readtail",	no_argument,		NULL, 'T' },
 	{0, 0, NULL,  0 }
 };
 
+static struct stats_output stats_out;
+
 struct pattern {
 	/* Remember: sync with _kern.c */
 	union {
@@ -73,16 +130,44 @@ struct pattern {
 	};
 };
 
-#define XDP_ACTION_MAX (XDP_TX + 2) /* Extra fake "rx_total" */
-#define RX_TOTAL (XDP_TX + 1)
-#define XDP_ACTION_MAX_STRLEN 11
+/* Pattern types, remember: sync with _kern.c */
+#define PATTERN_N_DROP_N_ACCEPT	1
+#define PATTERN_RANDOM_DROP	2
+#define PATTERN_FLOW_BURST	3
+#define PATTERN_MIX		4
+
+static const char *pattern2str(__u32 type)
+{
+	switch (type) {
+	case PATTERN_N_DROP_N_ACCEPT:	return "patN";
+	case PATTERN_RANDOM_DROP:	return "random";
+	case PATTERN_FLOW_BURST:	return "flowN";
+	case PATTERN_MIX:		return "mix";
+	}
+	return "unknown";
+}
+
+#define XDP_ACTION_MAX (XDP_REDIRECT + 2) /* Extra fake "rx_total" */
+#define RX_TOTAL (XDP_REDIRECT + 1)
+#define XDP_ACTION_MAX_STRLEN 12
 static const char *xdp_action_names[XDP_ACTION_MAX] = {
 	[XDP_ABORTED]	= "XDP_ABORTED",
 	[XDP_DROP]	= "XDP_DROP",
 	[XDP_PASS]	= "XDP_PASS",
 	[XDP_TX]	= "XDP_TX",
+	[XDP_REDIRECT]	= "XDP_REDIRECT",
 	[RX_TOTAL]	= "rx_total",
 };
+
+/* Remember: sync with _kern.c */
+struct verdict_ratio {
+	__u32 weight[RX_TOTAL];
+	__u32 total;
+};
+
+/* Index into map_fd[], ELF map order of _kern.c */
+#define MAP_IDX_VERDICT_RATIO	7
+#define MAP_IDX_TX_PORT		9
 static const char *action2str(int action)
 {
 	if (action < XDP_ACTION_MAX)
@@ -120,6 +205,49 @@ static int parse_xdp_action(char *action_str)
 	return action;
 }
 
+/* Parse DROP:PASS:TX:REDIRECT weights */
+static bool set_verdict_ratio(const char *str)
+{
+	struct verdict_ratio ratio = {};
+	__u32 key = 0;
+	int i;
+
+	if (sscanf(str, "%u:%u:%u:%u", &ratio.weight[XDP_DROP],
+		   &ratio.weight[XDP_PASS], &ratio.weight[XDP_TX],
+		   &ratio.weight[XDP_REDIRECT]) != 4) {
+		fprintf(stderr, "ERR: --mix DROP:PASS:TX:REDIRECT weights\n");
+		return false;
+	}
+	for (i = XDP_DROP; i < RX_TOTAL; i++)
+		ratio.total += ratio.weight[i];
+	if (!ratio.total) {
+		fprintf(stderr, "ERR: --mix weights are all zero\n");
+		return false;
+	}
+
+	if ((bpf_map_update_elem(map_fd[MAP_IDX_VERDICT_RATIO], &key, &ratio,
+				 BPF_ANY)) != 0) {
+		fprintf(stderr, "ERR %s(): bpf_map_update_elem failed\n",
+			__func__);
+		return false;
+	}
+	return true;
+}
+
+static bool set_redirect_dev(int redirect_ifindex)
+{
+	int key = 0;
+
+	/* map_fd[9] == map(tx_port) */
+	if ((bpf_map_update_elem(map_fd[MAP_IDX_TX_PORT], &key,
+				 &redirect_ifindex, BPF_ANY)) != 0) {
+		fprintf(stderr, "ERR %s(): bpf_map_update_elem failed\n",
+			__func__);
+		return false;
+	}
+	return true;
+}
+
 static void list_xdp_action(void)
 {
 	int i;
@@ -160,6 +288,7 @@ struct record {
 
 struct stats_record {
 	struct record xdp_action[XDP_ACTION_MAX];
+	struct record bytes;
 	__u64 touch_mem;
 	struct pattern pattern;
 };
@@ -198,6 +327,7 @@ static bool set_xdp_pattern(__u32 type, __u32 arg)
 enum touch_mem_type {
 	NO_TOUCH = 0x0ULL,
 	READ_MEM = 0x1ULL,
+	READ_TAIL = 0x4ULL, /* Used as bit */
 };
 static char* mem2str(enum touch_mem_type touch_mem)
 {
@@ -205,6 +335,8 @@ static char* mem2str(enum touch_mem_type touch_mem)
 		return "no_touch";
 	if (touch_mem == READ_MEM)
 		return "read";
+	if (touch_mem & READ_TAIL)
+		return "read_tail";
 	fprintf(stderr, "ERR: Unknown memory touch type");
 	exit(EXIT_FAIL);
 }
@@ -236,45 +368,6 @@ static bool set_touch_mem(__u64 value)
 	return true;
 }
 
-/* gettime returns the current time of day in nanoseconds.
- * Cost: clock_gettime (ns) => 26ns (CLOCK_MONOTONIC)
- *       clock_gettime (ns) =>  9ns (CLOCK_MONOTONIC_COARSE)
- */
-#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
-uint64_t gettime(void)
-{
-	struct timespec t;
-	int res;
-
-	res = clock_gettime(CLOCK_MONOTONIC, &t);
-	if (res < 0) {
-		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
-		exit(EXIT_FAIL);
-	}
-	return (uint64_t) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
-}
-
-static __u64 get_key32_value64_percpu(int fd, __u32 key)
-{
-	/* For percpu maps, userspace gets a value per possible CPU */
-	unsigned int nr_cpus = bpf_num_possible_cpus();
-	__u64 values[nr_cpus];
-	__u64 sum = 0;
-	int i;
-
-	if ((bpf_map_lookup_elem(fd, &key, values)) != 0) {
-		fprintf(stderr,
-			"ERR: bpf_map_lookup_elem failed key:0x%X\n", key);
-		return 0;
-	}
-
-	/* Sum values from each CPU */
-	for (i = 0; i < nr_cpus; i++) {
-		sum += values[i];
-	}
-	return sum;
-}
-
 static void stats_print(struct stats_record *record,
 			struct stats_record *prev)
 {
@@ -298,34 +391,75 @@ static void stats_print(struct stats_record *record,
 		}
 
 		printf("%-12s %-10.0f %'-18.0f %f"
-		       "  %s patN:%d\n",
+		       "  %s %s:%d\n",
 		       action2str(i), pps, pps, period_,
-		       mem2str(record->touch_mem), record->pattern.arg
+		       mem2str(record->touch_mem),
+		       pattern2str(record->pattern.type), record->pattern.arg
 			);
 	}
+	if (prev->bytes.timestamp &&
+	    record->bytes.timestamp > prev->bytes.timestamp)
+		printf("%-12s %-10.2f GB/s\n", "rx_bytes",
+		       (record->bytes.counter - prev->bytes.counter) /
+		       (double)(record->bytes.timestamp -
+				prev->bytes.timestamp));
 	printf("\n");
 }
 
 static bool stats_collect(struct stats_record *rec)
 {
+	__u64 sums[XDP_ACTION_MAX - 1];
+	__u64 now;
 	int i, fd;
 
 	fd = map_fd[3]; /* map: verdict_cnt */
+	if (stats_percpu_array_sum(fd, XDP_ACTION_MAX - 1, sums, sizeof(__u64)))
+		return false;
+	now = stats_gettime();
 	for (i = 0; i < (XDP_ACTION_MAX - 1) ; i++) {
-		rec->xdp_action[i].timestamp = gettime();
-		rec->xdp_action[i].counter = get_key32_value64_percpu(fd, i);
+		rec->xdp_action[i].timestamp = now;
+		rec->xdp_action[i].counter = sums[i];
 	}
 	/* Global counter */
 	fd = map_fd[0]; /* map: rx_cnt */
-	rec->xdp_action[RX_TOTAL].timestamp = gettime();
-	rec->xdp_action[RX_TOTAL].counter = get_key32_value64_percpu(fd, 0);
+	rec->xdp_action[RX_TOTAL].timestamp = stats_gettime();
+	rec->xdp_action[RX_TOTAL].counter = stats_percpu_sum_u64(fd, 0);
+	fd = bpf_load_map_fd("rx_bytes");
+	rec->bytes.timestamp = rec->xdp_action[RX_TOTAL].timestamp;
+	rec->bytes.counter = stats_percpu_sum_u64(fd, 0);
 
 	return true;
 }
 
-static void stats_poll(int interval)
+static void stats_export(struct stats_record *rec, struct stats_record *prev)
+{
+	struct record *r, *p;
+	int i;
+
+	r = &rec->xdp_action[RX_TOTAL];
+	p = &prev->xdp_action[RX_TOTAL];
+	stats_output_begin(&stats_out, p->timestamp ?
+			   r->timestamp - p->timestamp : 0);
+	for (i = 0; i < XDP_ACTION_MAX; i++) {
+		r = &rec->xdp_action[i];
+		p = &prev->xdp_action[i];
+		stats_output_metric(&stats_out, "verdict", "action",
+				    action2str(i), r->counter,
+				    r->counter - p->counter);
+	}
+	stats_output_metric(&stats_out, "rx_bytes", NULL, NULL,
+			    rec->bytes.counter,
+			    rec->bytes.counter - prev->bytes.counter);
+	stats_output_end(&stats_out);
+}
+
+static void stats_poll(int interval, int baseline, __u64 override_action)
 {
+	enum phase phase = baseline ? PHASE_BASELINE : PHASE_PATTERN;
 	struct stats_record record, prev;
+	struct record *r, *p;
+	__u64 started;
+	bool skip = false;
 
 	memset(&record, 0, sizeof(record));
 
@@ -337,13 +471,39 @@ static void stats_poll(int interval)
 	setlocale(LC_NUMERIC, "en_US");
 
 	/* Header */
-	printf("%-14s %-10s %-18s %-9s\n",
-	       "pattern type:N", "pps ", "pps-human-readable", "mem");
+	if (stats_out.fmt == STATS_FMT_TEXT)
+		printf("%-14s %-10s %-18s %-9s\n",
+		       "pattern type:N", "pps ", "pps-human-readable", "mem");
 
+	started = stats_gettime();
 	while (1) {
 		memcpy(&prev, &record, sizeof(record));
 		stats_collect(&record);
-		stats_print(&record, &prev);
+		if (stats_out.fmt != STATS_FMT_TEXT)
+			stats_export(&record, &prev);
+		else
+			stats_print(&record, &prev);
+
+		/* Period spanning the phase switch is not accounted */
+		r = &record.xdp_action[RX_TOTAL];
+		p = &prev.xdp_action[RX_TOTAL];
+		if (p->timestamp && !skip) {
+			phase_sum[phase].packets += r->counter - p->counter;
+			phase_sum[phase].period  += r->timestamp - p->timestamp;
+		}
+		skip = false;
+
+		if (phase == PHASE_BASELINE &&
+		    r->timestamp - started >= (__u64)baseline * NANOSEC_PER_SEC) {
+			if (!set_xdp_action(override_action))
+				exit(EXIT_FAIL_XDP);
+			phase = PHASE_PATTERN;
+			skip = true;
+			if (stats_out.fmt == STATS_FMT_TEXT)
+				printf("Baseline XDP_DROP %'.0f pps, "
+				       "switching to pattern\n\n",
+				       phase_pps(PHASE_BASELINE));
+		}
 		sleep(interval);
 	}
 }
@@ -360,12 +520,20 @@ int main(int argc, char **argv)
 	__u64 touch_mem = READ_MEM; /* Default: touch packet memory */
 	int opt;
 
+	__u32 pattern_type = PATTERN_N_DROP_N_ACCEPT;
 	int pattern_arg = 1;
+	char *mix_str = NULL;
+	int redirect_ifindex = 0;
+	int baseline = 0;
+	bool frags = false;
+	bool read_tail = false;
+	int fd;
 
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+	stats_output_init(&stats_out, "xdp_bench02", NULL);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hSd:s:",
+	while ((opt = getopt_long(argc, argv, "hSd:s:1:a:nF:r:f:m:R:b:MT",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'd':
@@ -386,16 +554,58 @@ int main(int argc, char **argv)
 		case 's':
 			interval = atoi(optarg);
 			break;
+		case 'F':
+			if (stats_output_init(&stats_out, "xdp_bench02", optarg))
+				goto error;
+			break;
 		case 'a':
 			action_str = (char *)&action_str_buf;
 			strncpy(action_str, optarg, XDP_ACTION_MAX_STRLEN);
 			break;
 		case '1':
+			pattern_type = PATTERN_N_DROP_N_ACCEPT;
+			pattern_arg = atoi(optarg);
+			break;
+		case 'r':
+			pattern_type = PATTERN_RANDOM_DROP;
+			pattern_arg = atoi(optarg);
+			if (pattern_arg < 0 || pattern_arg > 1000) {
+				fprintf(stderr,
+					"ERR: --random-drop PERMILLE 0-1000\n");
+				goto error;
+			}
+			break;
+		case 'f':
+			pattern_type = PATTERN_FLOW_BURST;
 			pattern_arg = atoi(optarg);
 			break;
+		case 'm':
+			pattern_type = PATTERN_MIX;
+			pattern_arg = 0;
+			mix_str = optarg;
+			break;
+		case 'R':
+			redirect_ifindex = if_nametoindex(optarg);
+			if (redirect_ifindex == 0) {
+				fprintf(stderr,
+					"ERR: --redirect-dev unknown err(%d):%s\n",
+					errno, strerror(errno));
+				goto error;
+			}
+			break;
+		case 'b':
+			baseline = atoi(optarg);
+			baseline_enabled = baseline > 0;
+			break;
 		case 'n':
 			touch_mem = NO_TOUCH;
 			break;
+		case 'M':
+			frags = true;
+			break;
+		case 'T':
+			read_tail = true;
+			break;
 		case 'S':
 			xdp_flags |= XDP_FLAGS_SKB_MODE;
 			break;
@@ -413,6 +623,16 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_OPTION;
 	}
 
+	if (pattern_type == PATTERN_FLOW_BURST && touch_mem == NO_TOUCH) {
+		fprintf(stderr, "ERR: --flow-burst needs packet parsing,"
+			" cannot be combined with --notouch\n");
+		return EXIT_FAIL_OPTION;
+	}
+	if (!redirect_ifindex)
+		redirect_ifindex = ifindex;
+	if (read_tail)
+		touch_mem |= READ_TAIL;
+
 	/* Parse action string */
 	if (action_str) {
 		override_action = parse_xdp_action(action_str);
@@ -441,20 +661,31 @@ int main(int argc, char **argv)
 		return EXIT_FAIL;
 	}
 
+	/* Both variants are in the ELF file, same maps */
+	fd = frags ? bpf_load_prog_fd("xdp.frags/xdp_bench02") : prog_fd[0];
+	if (fd < 0) {
+		fprintf(stderr, "ERR: frags prog not found\n");
+		return EXIT_FAIL;
+	}
+
 	/* Control behavior of XDP program */
-	set_xdp_action(override_action);
+	set_xdp_action(baseline_enabled ? XDP_DROP : override_action);
 	set_touch_mem(touch_mem);
-	set_xdp_pattern(1, pattern_arg);
+	set_xdp_pattern(pattern_type, pattern_arg);
+	if (mix_str && !set_verdict_ratio(mix_str))
+		return EXIT_FAIL_OPTION;
+	set_redirect_dev(redirect_ifindex);
 
 	/* Remove XDP program when program is interrupted */
 	signal(SIGINT, int_exit);
 
-	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
-		fprintf(stderr, "link set xdp fd failed\n");
+	if (set_link_xdp_fd(ifindex, fd, xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed%s\n",
+			frags ? "" : ", MTU above a page needs --frags");
 		return EXIT_FAIL_XDP;
 	}
 
-	stats_poll(interval);
+	stats_poll(interval, baseline, override_action);
 
 	return EXIT_OK;
 }
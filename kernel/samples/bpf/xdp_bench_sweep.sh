@@ -0,0 +1,203 @@
+#!/bin/bash
+#
+# Run xdp_bench01/xdp_bench02 over a parameter matrix and emit a CSV
+#
+# For each combination the bench program is attached, the first
+# --warmup seconds are discarded (steady-state), and pps is averaged
+# over --duration seconds from the programs --format json output.
+# CPU usage (busy and softirq share of all CPUs) is sampled from
+# /proc/stat over the same window.
+#
+# The traffic generator must run during the sweep.
+#
+TESTNAME=xdp_bench_sweep
+
+BENCH=02
+WARMUP=3
+DURATION=10
+MODES="native skb"
+ACTIONS="XDP_DROP XDP_PASS XDP_TX"
+MEMS="none readmem swapmac"
+PATTERNS="pattern1=1 pattern1=64 random-drop=500 flow-burst=32 mix=70:20:5:5"
+TOUCH="read notouch"
+OUTPUT=/dev/stdout
+
+usage() {
+  echo "Run XDP bench programs over a parameter matrix: $TESTNAME"
+  echo ""
+  echo "Usage: $0 --dev DEV [options]"
+  echo "  --dev DEV         : Device to attach to (required)"
+  echo "  --bench 01|02     : xdp_bench01_mem_access_cost or"
+  echo "                      xdp_bench02_drop_pattern (default: $BENCH)"
+  echo "  --modes LIST      : native skb (default: \"$MODES\")"
+  echo "  --actions LIST    : bench01 XDP actions (default: \"$ACTIONS\")"
+  echo "  --mems LIST       : bench01 none readmem swapmac"
+  echo "  --patterns LIST   : bench02 option=arg (default: \"$PATTERNS\")"
+  echo "  --touch LIST      : bench02 read notouch (default: \"$TOUCH\")"
+  echo "  --warmup SEC      : Discarded seconds per run (default: $WARMUP)"
+  echo "  --duration SEC    : Measured seconds per run (default: $DURATION)"
+  echo "  --output FILE     : CSV output file (default: stdout)"
+  echo ""
+}
+
+# Using external program "getopt" to get --long-options
+OPTIONS=$(getopt -o hd:b:w:t:o: \
+    --long help,dev:,bench:,modes:,actions:,mems:,patterns:,touch:,warmup:,duration:,output: \
+    -- "$@")
+if (( $? != 0 )); then
+    usage
+    exit 2
+fi
+eval set -- "$OPTIONS"
+
+##  --- Parse command line arguments / parameters ---
+while true; do
+	case "$1" in
+	    -d | --dev )      DEV=$2;      shift 2 ;;
+	    -b | --bench )    BENCH=$2;    shift 2 ;;
+	    --modes )         MODES=$2;    shift 2 ;;
+	    --actions )       ACTIONS=$2;  shift 2 ;;
+	    --mems )          MEMS=$2;     shift 2 ;;
+	    --patterns )      PATTERNS=$2; shift 2 ;;
+	    --touch )         TOUCH=$2;    shift 2 ;;
+	    -w | --warmup )   WARMUP=$2;   shift 2 ;;
+	    -t | --duration ) DURATION=$2; shift 2 ;;
+	    -o | --output )   OUTPUT=$2;   shift 2 ;;
+	    -h | --help )
+		usage
+		exit 0
+		;;
+	    -- )
+		shift
+		break
+		;;
+	    * )
+		shift
+		break
+		;;
+	esac
+done
+
+if [ -z "$DEV" ]; then
+	echo "ERROR: required option --dev missing" >&2
+	usage
+	exit 2
+fi
+
+if [ "$EUID" -ne 0 ]; then
+	echo "ERROR: need root privileges" >&2
+	exit 1
+fi
+
+DIR=$(dirname "$0")
+case "$BENCH" in
+    01) PROG=$DIR/xdp_bench01_mem_access_cost
+	# Single metric, labeled with the XDP action
+	METRIC='"name":"rx_packets"'
+	;;
+    02) PROG=$DIR/xdp_bench02_drop_pattern
+	METRIC='"action":"rx_total"'
+	;;
+    * ) echo "ERROR: --bench 01 or 02" >&2
+	exit 2
+	;;
+esac
+if [ ! -x "$PROG" ]; then
+	echo "ERROR: $PROG not found, run make first" >&2
+	exit 1
+fi
+
+LOG=$(mktemp /tmp/$TESTNAME.XXXXXX)
+PID=
+
+cleanup()
+{
+	# SIGINT makes the bench program remove its XDP program
+	[ -n "$PID" ] && kill -INT $PID 2> /dev/null && wait $PID
+	rm -f $LOG
+}
+trap cleanup 0 2 3 15
+
+# Aggregate "cpu" line of /proc/stat: all and busy (not idle/iowait)
+# jiffies, and softirq jiffies
+cpu_sample()
+{
+	awk '/^cpu / { t = 0; for (i = 2; i <= NF; i++) t += $i;
+		       print t, t - $5 - $6, $8 }' /proc/stat
+}
+
+# Average "rate" of the matching metric, skipping the warmup lines
+pps_average()
+{
+	local skip=$1
+
+	tail -n +$((skip + 1)) $LOG | grep -o "${METRIC}[^}]*\"rate\":[0-9]*" \
+	    | sed 's/.*"rate"://' \
+	    | awk '{ s += $1; n++ } END { if (n) printf "%.0f", s / n; else print 0 }'
+}
+
+# Run: mode label1 label2 -- prog args
+run_one()
+{
+	local mode=$1 col1=$2 col2=$3
+	local before after lines pps cpu softirq
+	shift 3
+
+	local args="--dev $DEV --sec 1 --format json"
+	# Short option: --skb-mode in bench01 vs --skbmode in bench02
+	[ "$mode" = "skb" ] && args="$args -S"
+
+	$PROG $args "$@" > $LOG 2> /dev/null &
+	PID=$!
+	sleep $WARMUP
+	if ! kill -0 $PID 2> /dev/null; then
+		echo "WARN: $PROG $args $* failed, skipping" >&2
+		PID=
+		return
+	fi
+	lines=$(wc -l < $LOG)
+	before=$(cpu_sample)
+	sleep $DURATION
+	after=$(cpu_sample)
+	kill -INT $PID 2> /dev/null
+	wait $PID 2> /dev/null
+	PID=
+
+	pps=$(pps_average $lines)
+	read cpu softirq <<< $(echo $before $after | awk '{
+		t = $4 - $1; if (t <= 0) t = 1;
+		printf "%.1f %.1f", ($5 - $2) * 100 / t, ($6 - $3) * 100 / t }')
+	echo "$BENCH,$DEV,$mode,$col1,$col2,$pps,$cpu,$softirq" >> $OUTPUT
+}
+
+if [ "$BENCH" = "01" ]; then
+	echo "bench,dev,mode,action,mem,pps,cpu_busy_pct,cpu_softirq_pct" > $OUTPUT
+else
+	echo "bench,dev,mode,pattern,mem,pps,cpu_busy_pct,cpu_softirq_pct" > $OUTPUT
+fi
+
+for mode in $MODES; do
+	if [ "$BENCH" = "01" ]; then
+		for action in $ACTIONS; do
+			for mem in $MEMS; do
+				opt=
+				[ "$mem" != "none" ] && opt="--$mem"
+				run_one $mode $action $mem --action $action $opt
+			done
+		done
+	else
+		for pattern in $PATTERNS; do
+			for touch in $TOUCH; do
+				opt=
+				[ "$touch" = "notouch" ] && opt="--notouch"
+				# flow-burst needs packet parsing
+				case "$pattern" in
+				    flow-burst=*)
+					[ -n "$opt" ] && continue ;;
+				esac
+				run_one $mode $pattern $touch \
+					--${pattern%%=*} ${pattern#*=} $opt
+			done
+		done
+	fi
+done
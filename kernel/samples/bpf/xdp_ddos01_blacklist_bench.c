@@ -0,0 +1,259 @@
+/* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP ddos01: benchmark per packet blacklist lookup cost vs table size\n"
+ "\n"
+ " Loads xdp_ddos01_blacklist_kern.o with private (non-pinned) maps,\n"
+ " fills the exact /32 hash or the CIDR LPM-trie with N entries, and\n"
+ " runs the XDP program via BPF_PROG_TEST_RUN on a UDP packet whose\n"
+ " source IP either hits or misses the blacklist.  The reported ns per\n"
+ " packet is measured by the kernel, thus the drop ceiling per CPU is\n"
+ " approx 1000/ns Mpps (minus driver overhead).";
+
+#include <linux/bpf.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "libbpf.h"
+
+#include "xdp_ddos01_blacklist_common.h"
+
+/* Index into map_fd[], ELF map order of _kern.c */
+#define MAP_IDX_BLACKLIST	0
+#define MAP_IDX_BLACKLIST_CIDR	5
+
+#define HASH_MAX_ENTRIES	100000
+#define CIDR_MAX_ENTRIES	10000
+
+/* Entries are generated from these bases, probes use the first entry */
+#define HASH_BASE	0x0A000000 /* 10.0.0.0 */
+#define CIDR_BASE	0x0B000000 /* 11.0.0.0 */
+#define MISS_ADDR	0xC0000201 /* 192.0.2.1 (TEST-NET-1) */
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{"prefixlen",	required_argument,	NULL, 'p' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n",
+	       argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+struct pkt_v4 {
+	struct ethhdr eth;
+	struct iphdr iph;
+	struct udphdr udph;
+	char payload[18]; /* Minimum size ethernet frame */
+} __attribute__((packed));
+
+static void pkt_init(struct pkt_v4 *pkt, __u32 saddr)
+{
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->eth.h_proto = htons(ETH_P_IP);
+	pkt->iph.ihl = 5;
+	pkt->iph.version = 4;
+	pkt->iph.ttl = 64;
+	pkt->iph.protocol = IPPROTO_UDP;
+	pkt->iph.tot_len = htons(sizeof(*pkt) - sizeof(pkt->eth));
+	pkt->iph.saddr = htonl(saddr);
+	pkt->iph.daddr = htonl(MISS_ADDR + 1);
+	pkt->udph.source = htons(4242);
+	pkt->udph.dest = htons(9); /* discard, not in port_blacklist */
+	pkt->udph.len = htons(sizeof(pkt->udph) + sizeof(pkt->payload));
+}
+
+/* Returns ns per packet, or negative on failure */
+static long long bench_pkt(int prog, __u32 saddr, int repeat, __u32 expect)
+{
+	struct pkt_v4 pkt;
+	__u32 retval = 0, duration = 0;
+	char out[128];
+	__u32 size = sizeof(out);
+
+	pkt_init(&pkt, saddr);
+	if (bpf_prog_test_run(prog, repeat, &pkt, sizeof(pkt),
+			      out, &size, &retval, &duration)) {
+		fprintf(stderr, "ERR: bpf_prog_test_run errno(%d/%s)\n",
+			errno, strerror(errno));
+		return -1;
+	}
+	if (retval != expect) {
+		fprintf(stderr, "ERR: XDP verdict %u expected %u\n",
+			retval, expect);
+		return -1;
+	}
+	return duration;
+}
+
+/* Grow table from *filled to nr entries */
+static int fill_hash(int fd, int *filled, int nr)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u32 key;
+
+	memset(values, 0, sizeof(__u64) * nr_cpus);
+	for (; *filled < nr; (*filled)++) {
+		key = htonl(HASH_BASE + *filled);
+		if (bpf_map_update_elem(fd, &key, values, BPF_NOEXIST)) {
+			fprintf(stderr, "ERR: hash insert %d errno(%d/%s)\n",
+				*filled, errno, strerror(errno));
+			return EXIT_FAIL_MAP_KEY;
+		}
+	}
+	return EXIT_OK;
+}
+
+static int fill_cidr(int fd, int *filled, int nr, int prefixlen)
+{
+	struct blacklist_cidr_key key;
+	__u64 value = 0;
+
+	for (; *filled < nr; (*filled)++) {
+		key.prefixlen = prefixlen;
+		key.addr = htonl(CIDR_BASE + ((__u64)*filled << (32 - prefixlen)));
+		if (bpf_map_update_elem(fd, &key, &value, BPF_NOEXIST)) {
+			fprintf(stderr, "ERR: cidr insert %d errno(%d/%s)\n",
+				*filled, errno, strerror(errno));
+			return EXIT_FAIL_MAP_KEY;
+		}
+	}
+	return EXIT_OK;
+}
+
+static void print_result(const char *type, int entries,
+			 long long hit, long long miss)
+{
+	printf("%-6s entries:%-7d hit:%4lld ns (%6.2f Mpps)"
+	       " miss:%4lld ns (%6.2f Mpps)\n", type, entries,
+	       hit, hit > 0 ? 1000.0 / hit : 0,
+	       miss, miss > 0 ? 1000.0 / miss : 0);
+}
+
+#ifndef ARRAY_SIZE
+# define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+#endif
+
+static const int table_sizes[] = { 1, 10, 100, 1000, 10000, 100000 };
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	int repeat = 1000000, prefixlen = 24;
+	int longindex = 0, opt, i, filled;
+	long long hit, miss;
+	char filename[256];
+	int prog, res;
+
+	/* Shares the bpf-ELF file of the XDP loader program */
+	snprintf(filename, sizeof(filename), "%s", argv[0]);
+	if (strlen(filename) > strlen("_bench"))
+		filename[strlen(filename) - strlen("_bench")] = '\0';
+	strncat(filename, "_kern.o", sizeof(filename) - strlen(filename) - 1);
+
+	while ((opt = getopt_long(argc, argv, "hr:p:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'p':
+			prefixlen = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	/* Need room for CIDR_MAX_ENTRIES distinct prefixes below 11/8 */
+	if (repeat <= 0 || prefixlen < 22 || prefixlen > 32) {
+		fprintf(stderr, "ERR: need --repeat > 0 and --prefixlen 22-32\n");
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(%s): %s",
+			filename, bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	prog = prog_fd[0];
+
+	miss = bench_pkt(prog, MISS_ADDR, repeat, XDP_PASS);
+	if (miss < 0)
+		return EXIT_FAIL_BPF;
+	print_result("empty", 0, 0, miss);
+
+	/* Exact match, miss also includes the (empty) LPM lookup */
+	filled = 0;
+	for (i = 0; i < ARRAY_SIZE(table_sizes); i++) {
+		if (table_sizes[i] > HASH_MAX_ENTRIES)
+			break;
+		res = fill_hash(map_fd[MAP_IDX_BLACKLIST], &filled,
+				table_sizes[i]);
+		if (res)
+			return res;
+		hit  = bench_pkt(prog, HASH_BASE, repeat, XDP_DROP);
+		miss = bench_pkt(prog, MISS_ADDR, repeat, XDP_PASS);
+		if (hit < 0 || miss < 0)
+			return EXIT_FAIL_BPF;
+		print_result("hash", filled, hit, miss);
+	}
+
+	/* Prefix match, with a full exact match table in front */
+	filled = 0;
+	for (i = 0; i < ARRAY_SIZE(table_sizes); i++) {
+		if (table_sizes[i] > CIDR_MAX_ENTRIES)
+			break;
+		res = fill_cidr(map_fd[MAP_IDX_BLACKLIST_CIDR], &filled,
+				table_sizes[i], prefixlen);
+		if (res)
+			return res;
+		hit  = bench_pkt(prog, CIDR_BASE, repeat, XDP_DROP);
+		miss = bench_pkt(prog, MISS_ADDR, repeat, XDP_PASS);
+		if (hit < 0 || miss < 0)
+			return EXIT_FAIL_BPF;
+		print_result("cidr", filled, hit, miss);
+	}
+	return EXIT_OK;
+}
@@ -13,6 +13,7 @@ static const char *__doc__=
 #include <string.h>
 #include <unistd.h>
 #include <locale.h>
+#include <ctype.h>
 
 #include <sys/resource.h>
 #include <getopt.h>
@@ -33,21 +34,33 @@ static const struct option long_options[] = {
 	{"add",		no_argument,		NULL, 'a' },
 	{"del",		no_argument,		NULL, 'x' },
 	{"ip",		required_argument,	NULL, 'i' },
+	{"cidr",	required_argument,	NULL, 'c' },
+	{"file",	required_argument,	NULL, 'f' },
+	{"sync",	no_argument,		NULL, 'y' },
+	{"rate",	required_argument,	NULL, 'r' },
+	{"burst",	required_argument,	NULL, 'b' },
 	{"stats",	no_argument,		NULL, 's' },
 	{"sec",		required_argument,	NULL, 's' },
 	{"list",	no_argument,		NULL, 'l' },
+	{"top",		required_argument,	NULL, 'T' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"shared",	required_argument,	NULL, 'H' },
 	{"udp-dport",	required_argument,	NULL, 'u' },
 	{"tcp-dport",	required_argument,	NULL, 't' },
 	{0, 0, NULL,  0 }
 };
 
 #define XDP_ACTION_MAX (XDP_TX + 1)
-#define XDP_ACTION_MAX_STRLEN 11
-static const char *xdp_action_names[XDP_ACTION_MAX] = {
+#define XDP_ACTION_MAX_STRLEN 13
+/* Pseudo verdict XDP_DROP by rate limit, index in verdict_cnt */
+#define VERDICT_DROP_RATE	XDP_ACTION_MAX
+#define VERDICT_MAX		(XDP_ACTION_MAX + 1)
+static const char *xdp_action_names[VERDICT_MAX] = {
 	[XDP_ABORTED]	= "XDP_ABORTED",
 	[XDP_DROP]	= "XDP_DROP",
 	[XDP_PASS]	= "XDP_PASS",
 	[XDP_TX]	= "XDP_TX",
+	[VERDICT_DROP_RATE] = "XDP_DROP_RATE",
 };
 
 static const char *xdp_proto_filter_names[DDOS_FILTER_MAX] = {
@@ -57,7 +70,7 @@ static const char *xdp_proto_filter_names[DDOS_FILTER_MAX] = {
 
 static const char *action2str(int action)
 {
-	if (action < XDP_ACTION_MAX)
+	if (action < VERDICT_MAX)
 		return xdp_action_names[action];
 	return NULL;
 }
@@ -67,8 +80,15 @@ struct record {
 	__u64 timestamp;
 };
 
+static const char *family_names[DDOS_FAMILY_MAX] = {
+	[DDOS_FAMILY_OTHER]	= "other",
+	[DDOS_FAMILY_IPV4]	= "IPv4",
+	[DDOS_FAMILY_IPV6]	= "IPv6",
+};
+
 struct stats_record {
-	struct record xdp_action[XDP_ACTION_MAX];
+	struct record xdp_action[VERDICT_MAX];
+	struct record family[DDOS_FAMILY_MAX][XDP_ACTION_MAX];
 };
 
 static void usage(char *argv[])
@@ -92,8 +112,12 @@ static void usage(char *argv[])
 	printf("\n");
 }
 
-int open_bpf_map(const char *file)
+/* Pin directory of the maps, selected by --dev or --shared */
+static char pin_dir[PATH_MAX];
+
+int open_bpf_map(const char *name)
 {
+	const char *file = pin_path(pin_dir, name);
 	int fd;
 
 	fd = bpf_obj_get(file);
@@ -130,54 +154,80 @@ static void stats_print_headers(void)
 {
 	/* clear screen */
 	printf("\033[2J");
-	printf("%-12s %-10s %-18s %-9s\n",
-	       "XDP_action", "pps ", "pps-human-readable", "period/sec");
+	printf("%-12s %-6s %-10s %-18s %-9s\n",
+	       "XDP_action", "family", "pps ", "pps-human-readable",
+	       "period/sec");
+}
+
+static void stats_print_record(const char *action, const char *family,
+			       struct record *r, struct record *p)
+{
+	__u64 period  = 0;
+	__u64 packets = 0;
+	double pps = 0;
+	double period_ = 0;
+
+	if (p->timestamp) {
+		packets = r->counter - p->counter;
+		period  = r->timestamp - p->timestamp;
+		if (period > 0) {
+			period_ = ((double) period / NANOSEC_PER_SEC);
+			pps = packets / period_;
+		}
+	}
+
+	printf("%-12s %-6s %-10.0f %'-18.0f %f\n",
+	       action, family, pps, pps, period_);
 }
 
 static void stats_print(struct stats_record *record,
 			struct stats_record *prev)
 {
-	int i;
+	int i, f;
 
 	for (i = 0; i < XDP_ACTION_MAX; i++) {
-		struct record *r = &record->xdp_action[i];
-		struct record *p = &prev->xdp_action[i];
-		__u64 period  = 0;
-		__u64 packets = 0;
-		double pps = 0;
-		double period_ = 0;
-
-		if (p->timestamp) {
-			packets = r->counter - p->counter;
-			period  = r->timestamp - p->timestamp;
-			if (period > 0) {
-				period_ = ((double) period / NANOSEC_PER_SEC);
-				pps = packets / period_;
-			}
-		}
-
-		printf("%-12s %-10.0f %'-18.0f %f\n",
-		       action2str(i), pps, pps, period_);
+		stats_print_record(action2str(i), "total",
+				   &record->xdp_action[i], &prev->xdp_action[i]);
+		for (f = 0; f < DDOS_FAMILY_MAX; f++)
+			stats_print_record("", family_names[f],
+					   &record->family[f][i],
+					   &prev->family[f][i]);
 	}
+	/* Also counted in the per family XDP_DROP */
+	i = VERDICT_DROP_RATE;
+	stats_print_record(action2str(i), "total",
+			   &record->xdp_action[i], &prev->xdp_action[i]);
 }
 
-static void stats_collect(int fd, struct stats_record *rec)
+static void stats_collect(int fd, int fd_family, struct stats_record *rec)
 {
-	int i;
+	int i, f;
 
 	for (i = 0; i < XDP_ACTION_MAX; i++) {
 		rec->xdp_action[i].timestamp = gettime();
 		rec->xdp_action[i].counter = get_key32_value64_percpu(fd, i);
+
+		for (f = 0; f < DDOS_FAMILY_MAX; f++) {
+			struct record *r = &rec->family[f][i];
+
+			r->timestamp = rec->xdp_action[i].timestamp;
+			r->counter = get_key32_value64_percpu(fd_family,
+						f * XDP_ACTION_MAX + i);
+		}
 	}
+	i = VERDICT_DROP_RATE;
+	rec->xdp_action[i].timestamp = gettime();
+	rec->xdp_action[i].counter = get_key32_value64_percpu(fd, i);
 }
 
 static void stats_poll(int interval)
 {
 	struct stats_record record, prev;
-	int fd;
+	int fd, fd_family;
 
 	/* TODO: Howto handle reload and clearing of maps */
 	fd = open_bpf_map(file_verdict);
+	fd_family = open_bpf_map(file_verdict_family);
 
 	memset(&record, 0, sizeof(record));
 
@@ -187,30 +237,399 @@ static void stats_poll(int interval)
 	while (1) {
 		memcpy(&prev, &record, sizeof(record));
 		stats_print_headers();
-		stats_collect(fd, &record);
+		stats_collect(fd, fd_family, &record);
 		stats_print(&record, &prev);
 		sleep(interval);
 	}
 	/* Not reached, but (hint) remember to close fd in other code */
 	close(fd);
+	close(fd_family);
 }
 
-static void blacklist_print_ipv4(__u32 ip, __u64 count)
+static void blacklist_print_proto(int key, __u64 count)
 {
-	char ip_txt[INET_ADDRSTRLEN] = {0};
+	printf("\n\t\"%s\" : %llu", xdp_proto_filter_names[key], count);
+}
 
-	/* Convert IPv4 addresses from binary to text form */
-	if (!inet_ntop(AF_INET, &ip, ip_txt, sizeof(ip_txt))) {
-		fprintf(stderr,
-			"ERR: Cannot convert u32 IP:0x%X to IP-txt\n", ip);
-		exit(EXIT_FAIL_IP);
+/* Loading blacklist from file
+ * ---------------------------
+ * File format is one IPv4/IPv6 address or CIDR per line, '#' starts a
+ * comment.  Instead of a syscall per entry, the file and the current
+ * map content are sorted, and only the difference is applied via
+ * batched map updates/deletes.  Existing entries keep their counters.
+ */
+enum {
+	BL_IPV4 = 0,
+	BL_IPV6,
+	BL_CIDR4,
+	BL_CIDR6,
+	BL_MAX
+};
+
+struct bl_map_desc {
+	const char *name;
+	size_t key_size;
+	size_t value_size; /* Userspace view */
+};
+
+static const char *bl_map_file(int idx)
+{
+	switch (idx) {
+	case BL_IPV4:	return file_blacklist;
+	case BL_IPV6:	return file_blacklist_ipv6;
+	case BL_CIDR4:	return file_blacklist_cidr;
+	case BL_CIDR6:	return file_blacklist_cidr_ipv6;
 	}
-	printf("\n \"%s\" : %llu", ip_txt, count);
+	return NULL;
 }
 
-static void blacklist_print_proto(int key, __u64 count)
+static void bl_map_desc_init(struct bl_map_desc desc[BL_MAX])
 {
-	printf("\n\t\"%s\" : %llu", xdp_proto_filter_names[key], count);
+	desc[BL_IPV4] = (struct bl_map_desc){ "ipv4", sizeof(__u32),
+		map_value_size(sizeof(__u64), true) };
+	desc[BL_IPV6] = (struct bl_map_desc){ "ipv6", sizeof(struct in6_addr),
+		map_value_size(sizeof(__u64), true) };
+	desc[BL_CIDR4] = (struct bl_map_desc){ "cidr4",
+		sizeof(struct blacklist_cidr_key), sizeof(__u64) };
+	desc[BL_CIDR6] = (struct bl_map_desc){ "cidr6",
+		sizeof(struct blacklist_cidr6_key), sizeof(__u64) };
+}
+
+struct key_set {
+	char *keys;
+	size_t nr;
+	size_t cap;
+	size_t key_size;
+};
+
+static int key_set_add(struct key_set *set, const void *key)
+{
+	if (set->nr == set->cap) {
+		size_t cap = set->cap ? set->cap * 2 : 1024;
+		char *keys = realloc(set->keys, cap * set->key_size);
+
+		if (!keys)
+			return -ENOMEM;
+		set->keys = keys;
+		set->cap = cap;
+	}
+	memcpy(set->keys + set->nr * set->key_size, key, set->key_size);
+	set->nr++;
+	return 0;
+}
+
+static size_t key_cmp_size; /* qsort has no context argument */
+
+static int key_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, key_cmp_size);
+}
+
+static void key_set_sort_uniq(struct key_set *set)
+{
+	size_t i, n = 0;
+
+	if (!set->nr)
+		return;
+	key_cmp_size = set->key_size;
+	qsort(set->keys, set->nr, set->key_size, key_cmp);
+	for (i = 1; i < set->nr; i++) {
+		char *prev = set->keys + n * set->key_size;
+		char *cur  = set->keys + i * set->key_size;
+
+		if (memcmp(prev, cur, set->key_size) == 0)
+			continue;
+		memcpy(prev + set->key_size, cur, set->key_size);
+		n++;
+	}
+	set->nr = n + 1;
+}
+
+static int key_set_load_map(struct key_set *set, int fd)
+{
+	char key[set->key_size], prev[set->key_size];
+	void *prev_key = NULL;
+
+	while (bpf_map_get_next_key(fd, prev_key, key) == 0) {
+		if (key_set_add(set, key))
+			return -ENOMEM;
+		memcpy(prev, key, set->key_size);
+		prev_key = prev;
+	}
+	return 0;
+}
+
+/* Merge walk of sorted sets, output sets can be NULL */
+static int key_set_diff(struct key_set *a, struct key_set *b,
+			struct key_set *only_a, struct key_set *only_b,
+			struct key_set *both)
+{
+	size_t ks = a->key_size, i = 0, j = 0;
+	int cmp, res = 0;
+
+	while (!res && (i < a->nr || j < b->nr)) {
+		char *ka = a->keys + i * ks;
+		char *kb = b->keys + j * ks;
+
+		if (i == a->nr)
+			cmp = 1;
+		else if (j == b->nr)
+			cmp = -1;
+		else
+			cmp = memcmp(ka, kb, ks);
+
+		if (cmp < 0) {
+			if (only_a)
+				res = key_set_add(only_a, ka);
+			i++;
+		} else if (cmp > 0) {
+			if (only_b)
+				res = key_set_add(only_b, kb);
+			j++;
+		} else {
+			if (both)
+				res = key_set_add(both, ka);
+			i++;
+			j++;
+		}
+	}
+	return res;
+}
+
+static int blacklist_file_parse(const char *filename, struct key_set sets[BL_MAX])
+{
+	FILE *fp = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+	union {
+		__u32 ipv4;
+		struct in6_addr ipv6;
+		struct blacklist_cidr_key cidr4;
+		struct blacklist_cidr6_key cidr6;
+	} key;
+	char line[256], *p, *end;
+	int lineno = 0, res = 0;
+	int af, idx;
+
+	if (!fp) {
+		fprintf(stderr, "ERR: cannot open file:%s err(%d):%s\n",
+			filename, errno, strerror(errno));
+		return EXIT_FAIL_OPTION;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		p = line;
+		end = strchr(p, '#');
+		if (end)
+			*end = '\0';
+		while (isspace(*p))
+			p++;
+		end = p + strlen(p);
+		while (end > p && isspace(end[-1]))
+			*--end = '\0';
+		if (*p == '\0')
+			continue;
+
+		memset(&key, 0, sizeof(key));
+		af = ip_string_family(p);
+		if (strchr(p, '/')) {
+			idx = (af == AF_INET6) ? BL_CIDR6 : BL_CIDR4;
+			res = cidr_parse(p, af, &key.cidr4.prefixlen,
+					 (af == AF_INET6) ?
+					 (void *)&key.cidr6.addr :
+					 (void *)&key.cidr4.addr);
+		} else {
+			idx = (af == AF_INET6) ? BL_IPV6 : BL_IPV4;
+			res = (inet_pton(af, p, &key) == 1) ? 0 : EXIT_FAIL_IP;
+		}
+		if (res) {
+			fprintf(stderr, "ERR: %s:%d invalid entry \"%s\"\n",
+				filename, lineno, p);
+			break;
+		}
+		if (key_set_add(&sets[idx], &key)) {
+			res = EXIT_FAIL;
+			break;
+		}
+	}
+	if (fp != stdin)
+		fclose(fp);
+	return res;
+}
+
+/* With ACTION_ADD only add missing entries, ACTION_DEL removes the
+ * listed entries, and sync makes the maps equal to the file.
+ */
+static int blacklist_file_load(const char *filename, unsigned int action,
+			       bool sync)
+{
+	struct key_set file_set[BL_MAX], map_set, to_add, to_del;
+	struct bl_map_desc desc[BL_MAX];
+	__u64 start = gettime();
+	int i, fd, res;
+
+	bl_map_desc_init(desc);
+	memset(file_set, 0, sizeof(file_set));
+	for (i = 0; i < BL_MAX; i++)
+		file_set[i].key_size = desc[i].key_size;
+
+	res = blacklist_file_parse(filename, file_set);
+	if (res)
+		goto out;
+
+	for (i = 0; i < BL_MAX; i++) {
+		size_t ks = desc[i].key_size;
+
+		/* Without sync, untouched maps need not be read */
+		if (!sync && !file_set[i].nr)
+			continue;
+
+		map_set = (struct key_set){ .key_size = ks };
+		to_add  = (struct key_set){ .key_size = ks };
+		to_del  = (struct key_set){ .key_size = ks };
+
+		fd = open_bpf_map(bl_map_file(i));
+		key_set_sort_uniq(&file_set[i]);
+		res = key_set_load_map(&map_set, fd);
+		if (!res) {
+			key_set_sort_uniq(&map_set);
+			if (sync)
+				res = key_set_diff(&file_set[i], &map_set,
+						   &to_add, &to_del, NULL);
+			else if (action == ACTION_ADD)
+				res = key_set_diff(&file_set[i], &map_set,
+						   &to_add, NULL, NULL);
+			else
+				res = key_set_diff(&file_set[i], &map_set,
+						   NULL, NULL, &to_del);
+		}
+		if (!res && to_del.nr)
+			res = map_delete_batch(fd, to_del.keys, ks, to_del.nr);
+		if (!res && to_add.nr)
+			res = map_update_zero_batch(fd, to_add.keys, ks,
+						    desc[i].value_size,
+						    to_add.nr);
+		if (res)
+			fprintf(stderr, "ERR: %s update failed err(%d):%s\n",
+				desc[i].name, errno, strerror(errno));
+		else if (verbose)
+			fprintf(stderr, "%s: file:%zu map:%zu added:%zu"
+				" deleted:%zu\n", desc[i].name,
+				file_set[i].nr, map_set.nr,
+				to_add.nr, to_del.nr);
+		close(fd);
+		free(map_set.keys);
+		free(to_add.keys);
+		free(to_del.keys);
+		if (res) {
+			res = EXIT_FAIL_MAP_KEY;
+			goto out;
+		}
+	}
+	if (verbose)
+		fprintf(stderr, "Loaded %s in %.3f sec\n", filename,
+			(double)(gettime() - start) / NANOSEC_PER_SEC);
+out:
+	for (i = 0; i < BL_MAX; i++)
+		free(file_set[i].keys);
+	return res;
+}
+
+/* Listing blacklist
+ * -----------------
+ * Entries are read via map_lookup_all() (batched), percpu counters are
+ * summed, and with --top N only the N entries with most drops are
+ * listed, sorted.  Output is a JSON object.
+ */
+struct list_entry {
+	__u64 count;
+	char txt[INET6_ADDRSTRLEN + 4]; /* Including "/len" */
+};
+
+struct list_entries {
+	struct list_entry *e;
+	size_t nr;
+};
+
+static __u64 sum_percpu(const void *value, bool percpu)
+{
+	const __u64 *v = value;
+	unsigned int i, nr_cpus = percpu ? bpf_num_possible_cpus() : 1;
+	__u64 sum = 0;
+
+	for (i = 0; i < nr_cpus; i++)
+		sum += v[i];
+	return sum;
+}
+
+static void key_to_txt(int idx, const void *key, char *txt, size_t len)
+{
+	const struct blacklist_cidr6_key *c6 = key;
+	const struct blacklist_cidr_key *c4 = key;
+	char ip[INET6_ADDRSTRLEN] = {0};
+
+	switch (idx) {
+	case BL_IPV4:
+		inet_ntop(AF_INET, key, txt, len);
+		break;
+	case BL_IPV6:
+		inet_ntop(AF_INET6, key, txt, len);
+		break;
+	case BL_CIDR4:
+		inet_ntop(AF_INET, &c4->addr, ip, sizeof(ip));
+		snprintf(txt, len, "%s/%u", ip, c4->prefixlen);
+		break;
+	case BL_CIDR6:
+		inet_ntop(AF_INET6, &c6->addr, ip, sizeof(ip));
+		snprintf(txt, len, "%s/%u", ip, c6->prefixlen);
+		break;
+	}
+}
+
+static int blacklist_collect(int idx, struct bl_map_desc *desc,
+			     struct list_entries *list)
+{
+	bool percpu = (idx == BL_IPV4 || idx == BL_IPV6);
+	void *keys, *values;
+	struct list_entry *e;
+	long nr, i;
+	int fd;
+
+	fd = open_bpf_map(bl_map_file(idx));
+	nr = map_lookup_all(fd, desc->key_size, desc->value_size,
+			    &keys, &values);
+	close(fd);
+	if (nr < 0) {
+		fprintf(stderr, "ERR: listing %s failed err(%ld):%s\n",
+			desc->name, -nr, strerror(-nr));
+		return EXIT_FAIL_MAP;
+	}
+
+	e = realloc(list->e, (list->nr + nr) * sizeof(*e));
+	if (!e && nr) {
+		free(keys);
+		free(values);
+		return EXIT_FAIL;
+	}
+	list->e = e;
+	for (i = 0; i < nr; i++) {
+		e = &list->e[list->nr++];
+		e->count = sum_percpu((char *)values + i * desc->value_size,
+				      percpu);
+		key_to_txt(idx, (char *)keys + i * desc->key_size,
+			   e->txt, sizeof(e->txt));
+	}
+	free(keys);
+	free(values);
+	return EXIT_OK;
+}
+
+static int list_entry_cmp(const void *a, const void *b)
+{
+	const struct list_entry *ea = a, *eb = b;
+
+	if (ea->count == eb->count)
+		return 0;
+	return (ea->count < eb->count) ? 1 : -1; /* Descending */
 }
 
 static void blacklist_print_port(int key, __u32 val, int countfds[])
@@ -232,63 +651,112 @@ static void blacklist_print_port(int key, __u32 val, int countfds[])
 		printf("\n }");
 }
 
-static void blacklist_list_all_ipv4(int fd)
+static void blacklist_list_all_ports(int portfd, int countfds[], bool *started)
 {
-	__u32 key, *prev_key = NULL;
-	__u64 value;
-
-	while (bpf_map_get_next_key(fd, prev_key, &key) == 0) {
-		printf("%s", key ? "," : "" );
-		value = get_key32_value64_percpu(fd, key);
-		blacklist_print_ipv4(key, value);
-		prev_key = &key;
+	size_t vsize = map_value_size(sizeof(__u32), true);
+	void *keys, *values;
+	long nr, i;
+
+	nr = map_lookup_all(portfd, sizeof(__u32), vsize, &keys, &values);
+	if (nr < 0) {
+		fprintf(stderr, "ERR: listing ports failed err(%ld):%s\n",
+			-nr, strerror(-nr));
+		return;
+	}
+	for (i = 0; i < nr; i++) {
+		/* Percpu u32 values, padded to 8 bytes per CPU */
+		const __u64 *v = (void *)((char *)values + i * vsize);
+		__u32 key = ((__u32 *)keys)[i];
+		__u32 val = 0;
+		int cpu;
+
+		for (cpu = 0; cpu < bpf_num_possible_cpus(); cpu++)
+			val |= (__u32)v[cpu];
+		if (!val)
+			continue;
+		printf("%s", *started ? "," : "");
+		*started = true;
+		blacklist_print_port(key, val, countfds);
 	}
-	printf("%s", key ? "," : "");
+	free(keys);
+	free(values);
 }
 
-static void blacklist_list_all_ports(int portfd, int countfds[])
+static int blacklist_list(int top)
 {
-	__u32 key, *prev_key = NULL;
-	__u64 value;
+	int fd_port_blacklist_count_array[DDOS_FILTER_MAX];
+	struct list_entries list = { NULL, 0 };
+	struct bl_map_desc desc[BL_MAX];
 	bool started = false;
+	int fd_port_blacklist;
+	size_t i, nr;
+	int res;
+
+	bl_map_desc_init(desc);
+	for (i = 0; i < BL_MAX; i++) {
+		res = blacklist_collect(i, &desc[i], &list);
+		if (res)
+			goto out;
+	}
+	nr = list.nr;
+	if (top > 0) {
+		qsort(list.e, list.nr, sizeof(*list.e), list_entry_cmp);
+		if (nr > top)
+			nr = top;
+	}
 
-	/* printf("{\n"); */
-	while (bpf_map_get_next_key(portfd, prev_key, &key) == 0) {
-		if ((bpf_map_lookup_elem(portfd, &key, &value)) != 0) {
-			fprintf(stderr,
-				"ERR: bpf_map_lookup_elem(%d) failed key:0x%X\n", portfd, key);
-		}
+	printf("{");
+	for (i = 0; i < nr; i++) {
+		printf("%s\n \"%s\" : %llu", started ? "," : "",
+		       list.e[i].txt, list.e[i].count);
+		started = true;
+	}
 
-		if (value) {
-			printf("%s", started ? "," : "");
-			started = true;
-			blacklist_print_port(key, value, countfds);
-		}
-		prev_key = &key;
+	/* Ports are only listed in full listing */
+	if (top <= 0) {
+		fd_port_blacklist = open_bpf_map(file_port_blacklist);
+		for (i = 0; i < DDOS_FILTER_MAX; i++)
+			fd_port_blacklist_count_array[i] = open_bpf_map(file_port_blacklist_count[i]);
+		blacklist_list_all_ports(fd_port_blacklist,
+					 fd_port_blacklist_count_array,
+					 &started);
+		close(fd_port_blacklist);
+		for (i = 0; i < DDOS_FILTER_MAX; i++)
+			close(fd_port_blacklist_count_array[i]);
 	}
+	printf("\n}\n");
+out:
+	free(list.e);
+	return res;
 }
 
 int main(int argc, char **argv)
 {
-#	define STR_MAX 42 /* For trivial input validation */
+#	define STR_MAX 50 /* For trivial input validation, IPv6 CIDR */
 	char _ip_string_buf[STR_MAX] = {};
 	char *ip_string = NULL;
+	char _cidr_string_buf[STR_MAX] = {};
+	char *cidr_string = NULL;
+	char *file_string = NULL;
+	bool sync = false;
+	bool set_rate = false;
+	__u64 rate = 0, burst = 0;
 
 	unsigned int action = 0;
 	bool stats = false;
 	int interval = 1;
 	int fd_blacklist;
-	int fd_verdict;
 	int fd_port_blacklist;
 	int fd_port_blacklist_count;
 	int longindex = 0;
 	bool do_list = false;
+	int top = 0;
 	int opt;
 	int dport = 0;
 	int proto = IPPROTO_TCP;
 	int filter = DDOS_FILTER_TCP;
 
-	while ((opt = getopt_long(argc, argv, "adshi:t:u:",
+	while ((opt = getopt_long(argc, argv, "ad:shi:c:f:r:b:t:u:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'a':
@@ -305,6 +773,27 @@ int main(int argc, char **argv)
 			ip_string = (char *)&_ip_string_buf;
 			strncpy(ip_string, optarg, STR_MAX);
 			break;
+		case 'c':
+			if (!optarg || strlen(optarg) >= STR_MAX) {
+				printf("ERR: src cidr too long or NULL\n");
+				goto fail_opt;
+			}
+			cidr_string = (char *)&_cidr_string_buf;
+			strncpy(cidr_string, optarg, STR_MAX);
+			break;
+		case 'f':
+			file_string = optarg;
+			break;
+		case 'y':
+			sync = true;
+			break;
+		case 'r':
+			set_rate = true;
+			rate = strtoull(optarg, NULL, 10);
+			break;
+		case 'b':
+			burst = strtoull(optarg, NULL, 10);
+			break;
 		case 'u':
 			proto = IPPROTO_UDP;
 			filter = DDOS_FILTER_UDP;
@@ -320,6 +809,20 @@ int main(int argc, char **argv)
 		case 'l':
 			do_list = true;
 			break;
+		case 'd':
+			if (pin_dir_set(pin_dir, sizeof(pin_dir),
+					PIN_BASE_DIR, optarg))
+				goto fail_opt;
+			break;
+		case 'H': /* Only the shared blacklist maps */
+			if (pin_dir_set(pin_dir, sizeof(pin_dir),
+					PIN_SHARED_DIR, optarg))
+				goto fail_opt;
+			break;
+		case 'T': /* implies --list */
+			do_list = true;
+			top = atoi(optarg);
+			break;
 		case 'h':
 		fail_opt:
 		default:
@@ -327,24 +830,61 @@ int main(int argc, char **argv)
 			return EXIT_FAIL_OPTION;
 		}
 	}
-	fd_verdict = open_bpf_map(file_verdict);
+	if (!pin_dir[0]) {
+		fprintf(stderr, "ERR: required option --dev or --shared\n");
+		goto fail_opt;
+	}
+
+	/* Per source rate limit, --rate 0 disables */
+	if (set_rate) {
+		int fd = open_bpf_map(file_ratelimit_config);
+		int res;
+
+		if (!burst)
+			burst = rate; /* Default: one second worth */
+		res = ratelimit_config_set(fd, rate, burst);
+		close(fd);
+		if (res)
+			return res;
+	}
+
+	/* Update blacklist from file */
+	if (file_string) {
+		if (!sync && action != ACTION_ADD && action != ACTION_DEL) {
+			fprintf(stderr,
+			  "ERR: --file require either --add, --del or --sync\n");
+			goto fail_opt;
+		}
+		return blacklist_file_load(file_string, action, sync);
+	}
 
 	/* Update blacklist */
 	if (action) {
 		int res = 0;
 
-		if (!ip_string && !dport) {
+		if (!ip_string && !cidr_string && !dport) {
 			fprintf(stderr,
 			  "ERR: action require type+data, e.g option --ip\n");
 			goto fail_opt;
 		}
 
 		if (ip_string) {
-			fd_blacklist = open_bpf_map(file_blacklist);
+			fd_blacklist = open_bpf_map(
+				ip_string_family(ip_string) == AF_INET6 ?
+				file_blacklist_ipv6 : file_blacklist);
 			res = blacklist_modify(fd_blacklist, ip_string, action);
 			close(fd_blacklist);
 		}
 
+		if (cidr_string) {
+			fd_blacklist = open_bpf_map(
+				ip_string_family(cidr_string) == AF_INET6 ?
+				file_blacklist_cidr_ipv6 : file_blacklist_cidr);
+			res = blacklist_cidr_modify(fd_blacklist, cidr_string,
+						    action);
+			close(fd_blacklist);
+		}
+
 		if (dport) {
 			fd_port_blacklist = open_bpf_map(file_port_blacklist);
 			fd_port_blacklist_count = open_bpf_map(file_port_blacklist_count[filter]);
@@ -363,30 +903,15 @@ int main(int argc, char **argv)
 	}
 
 	if (do_list) {
-		printf("{");
-		int fd_port_blacklist_count_array[DDOS_FILTER_MAX];
-		int i;
-
-		fd_blacklist = open_bpf_map(file_blacklist);
-		blacklist_list_all_ipv4(fd_blacklist);
-		close(fd_blacklist);
+		int res = blacklist_list(top);
 
-		fd_port_blacklist = open_bpf_map(file_port_blacklist);
-		for (i = 0; i < DDOS_FILTER_MAX; i++)
-			fd_port_blacklist_count_array[i] = open_bpf_map(file_port_blacklist_count[i]);
-		blacklist_list_all_ports(fd_port_blacklist, fd_port_blacklist_count_array);
-		close(fd_port_blacklist);
-		printf("\n}\n");
-		for (i = 0; i < DDOS_FILTER_MAX; i++)
-			close(fd_port_blacklist_count_array[i]);
+		if (res)
+			return res;
 	}
 
 	/* Show statistics by polling */
 	if (stats) {
 		stats_poll(interval);
 	}
-
-	// TODO: implement stats for verdicts
-	// Hack: keep it open to inspect /proc/pid/fdinfo/3
-	close(fd_verdict);
+	return EXIT_OK;
 }
@@ -2,6 +2,11 @@
 #define __XDP_DDOS01_BLACKLIST_COMMON_H
 
 #include <time.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/syscall.h>
 
 /* Exit return codes */
 #define	EXIT_OK			0
@@ -20,21 +25,65 @@
 
 static int verbose = 1;
 
-/* Export eBPF map for IPv4 blacklist as a file
+/* Export eBPF maps as files, in a directory per interface, which
+ * allows loading on several interfaces with distinct policies:
+ *   /sys/fs/bpf/ddos/<ifname>/<file>
+ *
+ * The blacklist maps (the feed) can instead be shared between
+ * interfaces (loader option --shared <name>), stored once in
+ *   /sys/fs/bpf/ddos_shared/<name>/<file>
+ * and additionally pinned in each interface directory using them.
+ *
  * Gotcha need to mount:
  *   mount -t bpf bpf /sys/fs/bpf/
  */
-static const char *file_blacklist = "/sys/fs/bpf/ddos_blacklist";
-static const char *file_verdict   = "/sys/fs/bpf/ddos_blacklist_stat_verdict";
-
-static const char *file_port_blacklist = "/sys/fs/bpf/ddos_port_blacklist";
+#define PIN_BASE_DIR	"/sys/fs/bpf/ddos"
+#define PIN_SHARED_DIR	"/sys/fs/bpf/ddos_shared"
+
+static const char *file_blacklist = "ddos_blacklist";
+static const char *file_verdict   = "ddos_blacklist_stat_verdict";
+static const char *file_blacklist_cidr = "ddos_blacklist_cidr";
+static const char *file_blacklist_ipv6 = "ddos_blacklist_ipv6";
+static const char *file_blacklist_cidr_ipv6 = "ddos_blacklist_cidr_ipv6";
+static const char *file_verdict_family = "ddos_blacklist_stat_verdict_family";
+static const char *file_ratelimit_config = "ddos_ratelimit_config";
+static const char *file_ratelimit = "ddos_ratelimit";
+static const char *file_talkers = "ddos_talkers";
+static const char *file_talkers_enabled = "ddos_talkers_enabled";
+
+static const char *file_port_blacklist = "ddos_port_blacklist";
 static const char *file_port_blacklist_count[] = {
-	"/sys/fs/bpf/ddos_port_blacklist_count_tcp",
-	"/sys/fs/bpf/ddos_port_blacklist_count_udp"
+	"ddos_port_blacklist_count_tcp",
+	"ddos_port_blacklist_count_udp"
 };
 
+/* Build pin directory base/name, name is an ifname or shared name */
+static int pin_dir_set(char *dir, size_t len, const char *base,
+		       const char *name)
+{
+	if (!name || !*name || strchr(name, '/') || !strcmp(name, ".") ||
+	    !strcmp(name, "..")) {
+		fprintf(stderr, "ERR: invalid pin directory name \"%s\"\n",
+			name ? name : "");
+		return EXIT_FAIL_OPTION;
+	}
+	if (snprintf(dir, len, "%s/%s", base, name) >= len) {
+		fprintf(stderr, "ERR: pin directory name too long\n");
+		return EXIT_FAIL_OPTION;
+	}
+	return EXIT_OK;
+}
 
-// TODO: create subdir per ifname, to allow more XDP progs
+/* Full path of a map file, a few results can be in use at once */
+static const char *pin_path(const char *dir, const char *file)
+{
+	static char buf[4][PATH_MAX];
+	static unsigned int idx;
+	char *path = buf[idx++ % 4];
+
+	snprintf(path, PATH_MAX, "%s/%s", dir, file);
+	return path;
+}
 
 /* gettime returns the current time of day in nanoseconds.
  * Cost: clock_gettime (ns) => 26ns (CLOCK_MONOTONIC)
@@ -64,26 +113,264 @@ enum {
 	DDOS_FILTER_MAX
 };
 
+/* Index into verdict_family_cnt, must match _kern.c */
+enum {
+	DDOS_FAMILY_OTHER = 0,
+	DDOS_FAMILY_IPV4,
+	DDOS_FAMILY_IPV6,
+	DDOS_FAMILY_MAX
+};
+
+/* Batched map operations (kernel v5.6) are not in the bundled
+ * uapi/linux/bpf.h and libbpf, thus invoke the bpf syscall directly.
+ * All users fallback to per element syscalls, when the kernel or map
+ * type (e.g. LPM_TRIE) does not support batching.
+ */
+#define DDOS_BPF_MAP_LOOKUP_BATCH	24
+#define DDOS_BPF_MAP_UPDATE_BATCH	26
+#define DDOS_BPF_MAP_DELETE_BATCH	27
+
+/* Layout of union bpf_attr member "batch" */
+struct ddos_bpf_batch_attr {
+	__u64 in_batch;
+	__u64 out_batch;
+	__u64 keys;
+	__u64 values;
+	__u32 count;
+	__u32 map_fd;
+	__u64 elem_flags;
+	__u64 flags;
+};
+
+#define BATCH_CHUNK	1024 /* Elements per batch syscall */
+
+/* In/out count, like the kernel API. Returns 0 on success */
+static int map_batch_op(int cmd, int fd, void *in_batch, void *out_batch,
+			void *keys, void *values, __u32 *count)
+{
+	struct ddos_bpf_batch_attr attr;
+	int res;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.in_batch  = (__u64)(unsigned long)in_batch;
+	attr.out_batch = (__u64)(unsigned long)out_batch;
+	attr.keys      = (__u64)(unsigned long)keys;
+	attr.values    = (__u64)(unsigned long)values;
+	attr.count     = *count;
+	attr.map_fd    = fd;
+
+	res = syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+	*count = attr.count;
+	return res;
+}
+
+/* Unknown cmd gives EINVAL, map types without batch ops ENOTSUPP */
+static bool map_batch_unsupported(int err)
+{
+	return err == EINVAL || err == EOPNOTSUPP || err == 524 /*ENOTSUPP*/;
+}
+
+/* Value size as seen by userspace, percpu maps have one per CPU */
+static size_t map_value_size(__u32 value_size, bool percpu)
+{
+	if (!percpu)
+		return value_size;
+	return ((value_size + 7) & ~7) * bpf_num_possible_cpus();
+}
+
+/* Insert (or overwrite) nr keys, all with zero values (counters) */
+static int map_update_zero_batch(int fd, void *keys, size_t key_size,
+				 size_t value_size, size_t nr)
+{
+	bool batch = true;
+	size_t done = 0;
+	void *values;
+	__u32 count;
+	int res = 0;
+
+	values = calloc(BATCH_CHUNK, value_size);
+	if (!values)
+		return -ENOMEM;
+
+	while (done < nr) {
+		char *k = (char *)keys + done * key_size;
+		size_t i, n = nr - done < BATCH_CHUNK ? nr - done : BATCH_CHUNK;
+
+		if (batch) {
+			count = n;
+			res = map_batch_op(DDOS_BPF_MAP_UPDATE_BATCH, fd, NULL,
+					   NULL, k, values, &count);
+			if (res == 0) {
+				done += count;
+				continue;
+			}
+			if (!map_batch_unsupported(errno))
+				break;
+			/* Redo chunk per element, update is idempotent */
+			batch = false;
+			res = 0;
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			res = bpf_map_update_elem(fd, k + i * key_size,
+						  values, BPF_ANY);
+			if (res)
+				goto out;
+		}
+		done += n;
+	}
+out:
+	free(values);
+	return res;
+}
+
+static int map_delete_batch(int fd, void *keys, size_t key_size, size_t nr)
+{
+	bool batch = true;
+	size_t done = 0;
+	__u32 count;
+	int res = 0;
+
+	while (done < nr) {
+		char *k = (char *)keys + done * key_size;
+		size_t i, n = nr - done < BATCH_CHUNK ? nr - done : BATCH_CHUNK;
+
+		if (batch) {
+			count = n;
+			res = map_batch_op(DDOS_BPF_MAP_DELETE_BATCH, fd, NULL,
+					   NULL, k, NULL, &count);
+			if (res == 0) {
+				done += count;
+				continue;
+			}
+			if (!map_batch_unsupported(errno))
+				break;
+			batch = false; /* ENOENT is ignored on redo */
+			res = 0;
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			res = bpf_map_delete_elem(fd, k + i * key_size);
+			if (res && errno != ENOENT)
+				return res;
+			res = 0;
+		}
+		done += n;
+	}
+	return res;
+}
+
+/* Read all entries of a map into arrays (caller frees), returns the
+ * number of entries or negative errno.  Uses BPF_MAP_LOOKUP_BATCH,
+ * a syscall per BATCH_CHUNK entries instead of two per entry.
+ */
+static long map_lookup_all(int fd, size_t key_size, size_t value_size,
+			   void **keys_out, void **values_out)
+{
+	/* Opaque batch position, hash maps use a u32, arrays a key */
+	__u64 in_batch[4], out_batch[4];
+	char *keys = NULL, *values = NULL;
+	size_t nr = 0, cap = 0;
+	bool batch = true;
+	void *in = NULL;
+	__u32 count;
+	int res;
+
+	for (;;) {
+		if (cap - nr < BATCH_CHUNK) {
+			char *k, *v;
+
+			cap = cap ? cap * 2 : BATCH_CHUNK;
+			k = realloc(keys, cap * key_size);
+			if (k)
+				keys = k;
+			v = realloc(values, cap * value_size);
+			if (v)
+				values = v;
+			if (!k || !v) {
+				res = -ENOMEM;
+				goto err;
+			}
+		}
+
+		if (!batch) {
+			void *key = keys + nr * key_size;
+
+			if (bpf_map_get_next_key(fd, nr ? key - key_size : NULL,
+						 key))
+				break;
+			/* Deleted meanwhile, is listed as zero */
+			if (bpf_map_lookup_elem(fd, key,
+						values + nr * value_size))
+				memset(values + nr * value_size, 0, value_size);
+			nr++;
+			continue;
+		}
+
+		count = BATCH_CHUNK;
+		res = map_batch_op(DDOS_BPF_MAP_LOOKUP_BATCH, fd, in, out_batch,
+				   keys + nr * key_size,
+				   values + nr * value_size, &count);
+		if (res && errno != ENOENT) {
+			if (nr == 0 && map_batch_unsupported(errno)) {
+				batch = false;
+				continue;
+			}
+			res = -errno;
+			goto err;
+		}
+		nr += count;
+		if (res) /* ENOENT: no more entries */
+			break;
+		memcpy(in_batch, out_batch, sizeof(in_batch));
+		in = in_batch;
+	}
+	*keys_out = keys;
+	*values_out = values;
+	return nr;
+err:
+	free(keys);
+	free(values);
+	return res;
+}
+
+/* Address family from presentation format, IPv6 contains a colon */
+static int ip_string_family(const char *ip_string)
+{
+	return strchr(ip_string, ':') ? AF_INET6 : AF_INET;
+}
+
 static int blacklist_modify(int fd, char *ip_string, unsigned int action)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
+	int af = ip_string_family(ip_string);
 	__u64 values[nr_cpus];
-	__u32 key;
+	union {
+		__u32 ipv4;
+		struct in6_addr ipv6;
+	} key;
+	char key_txt[16];
 	int res;
 
 	memset(values, 0, sizeof(__u64) * nr_cpus);
 
-	/* Convert IP-string into 32-bit network byte-order value */
-	res = inet_pton(AF_INET, ip_string, &key);
+	/* Convert IP-string into network byte-order value, fd must be
+	 * the blacklist map of the same family
+	 */
+	res = inet_pton(af, ip_string, &key);
 	if (res <= 0) {
 		if (res == 0)
 			fprintf(stderr,
-				"ERR: IPv4 \"%s\" not in presentation format\n",
+				"ERR: IP \"%s\" not in presentation format\n",
 				ip_string);
 		else
 			perror("inet_pton");
 		return EXIT_FAIL_IP;
 	}
+	if (af == AF_INET)
+		snprintf(key_txt, sizeof(key_txt), "0x%X", key.ipv4);
+	else
+		snprintf(key_txt, sizeof(key_txt), "ipv6");
 
 	if (action == ACTION_ADD) {
 		res = bpf_map_update_elem(fd, &key, values, BPF_NOEXIST);
@@ -97,8 +384,8 @@ static int blacklist_modify(int fd, char *ip_string, unsigned int action)
 
 	if (res != 0) { /* 0 == success */
 		fprintf(stderr,
-			"%s() IP:%s key:0x%X errno(%d/%s)",
-			__func__, ip_string, key, errno, strerror(errno));
+			"%s() IP:%s key:%s errno(%d/%s)",
+			__func__, ip_string, key_txt, errno, strerror(errno));
 
 		if (errno == 17) {
 			fprintf(stderr, ": Already in blacklist\n");
@@ -109,7 +396,152 @@ static int blacklist_modify(int fd, char *ip_string, unsigned int action)
 	}
 	if (verbose)
 		fprintf(stderr,
-			"%s() IP:%s key:0x%X\n", __func__, ip_string, key);
+			"%s() IP:%s key:%s\n", __func__, ip_string, key_txt);
+	return EXIT_OK;
+}
+
+/* Keys of the BPF_MAP_TYPE_LPM_TRIE entries, must match _kern.c */
+struct blacklist_cidr_key {
+	__u32 prefixlen;
+	__u32 addr; /* network byte-order */
+};
+
+struct blacklist_cidr6_key {
+	__u32 prefixlen;
+	struct in6_addr addr;
+};
+
+/* Parse "addr/len" of family af into addr (4 or 16 bytes), len
+ * defaults to full length.  Host bits are cleared.
+ */
+static int cidr_parse(const char *cidr_string, int af,
+		      __u32 *prefixlen, void *addr)
+{
+	int max_len = (af == AF_INET6) ? 128 : 32;
+	char buf[INET6_ADDRSTRLEN + 5];
+	unsigned char *bytes = addr;
+	char *slash, *end;
+	long len = max_len;
+	int res, i;
+
+	if (strlen(cidr_string) >= sizeof(buf)) {
+		fprintf(stderr, "ERR: CIDR \"%s\" too long\n", cidr_string);
+		return EXIT_FAIL_IP;
+	}
+	strcpy(buf, cidr_string);
+
+	slash = strchr(buf, '/');
+	if (slash) {
+		*slash = '\0';
+		len = strtol(slash + 1, &end, 10);
+		if (*end != '\0' || end == slash + 1 || len < 0 || len > max_len) {
+			fprintf(stderr,
+				"ERR: CIDR \"%s\" invalid prefix length\n",
+				cidr_string);
+			return EXIT_FAIL_IP;
+		}
+	}
+
+	res = inet_pton(af, buf, addr);
+	if (res <= 0) {
+		if (res == 0)
+			fprintf(stderr,
+				"ERR: IP \"%s\" not in presentation format\n",
+				buf);
+		else
+			perror("inet_pton");
+		return EXIT_FAIL_IP;
+	}
+	*prefixlen = len;
+	for (i = 0; i < max_len / 8; i++) {
+		if (len >= 8) {
+			len -= 8;
+		} else {
+			bytes[i] &= (0xFF00 >> len) & 0xFF;
+			len = 0;
+		}
+	}
+	return EXIT_OK;
+}
+
+/* Handles both families, fd must be the CIDR map of the same family */
+static int blacklist_cidr_modify(int fd, char *cidr_string, unsigned int action)
+{
+	int af = ip_string_family(cidr_string);
+	union {
+		struct blacklist_cidr_key ipv4;
+		struct blacklist_cidr6_key ipv6;
+	} key;
+	__u32 *prefixlen = &key.ipv4.prefixlen; /* First member of both */
+	void *addr = (af == AF_INET) ? (void *)&key.ipv4.addr :
+				       (void *)&key.ipv6.addr;
+	__u64 value = 0;
+	int res;
+
+	memset(&key, 0, sizeof(key));
+	res = cidr_parse(cidr_string, af, prefixlen, addr);
+	if (res)
+		return res;
+
+	if (action == ACTION_ADD) {
+		res = bpf_map_update_elem(fd, &key, &value, BPF_NOEXIST);
+	} else if (action == ACTION_DEL) {
+		res = bpf_map_delete_elem(fd, &key);
+	} else {
+		fprintf(stderr, "ERR: %s() invalid action 0x%x\n",
+			__func__, action);
+		return EXIT_FAIL_OPTION;
+	}
+
+	if (res != 0) { /* 0 == success */
+		fprintf(stderr,
+			"%s() CIDR:%s prefixlen:%u errno(%d/%s)",
+			__func__, cidr_string, *prefixlen,
+			errno, strerror(errno));
+
+		if (errno == 17) {
+			fprintf(stderr, ": Already in blacklist\n");
+			return EXIT_OK;
+		}
+		fprintf(stderr, "\n");
+		return EXIT_FAIL_MAP_KEY;
+	}
+	if (verbose)
+		fprintf(stderr, "%s() CIDR:%s prefixlen:%u\n",
+			__func__, cidr_string, *prefixlen);
+	return EXIT_OK;
+}
+
+/* Per source token bucket rate limit, must match _kern.c */
+struct ratelimit_config {
+	__u64 rate;	/* Packets per sec per source, zero disables */
+	__u64 burst_ns;	/* Bucket depth: burst packets * NSEC_PER_SEC */
+	__u64 fill_ns;	/* Time to refill an empty bucket */
+};
+
+static int ratelimit_config_set(int fd, __u64 rate, __u64 burst)
+{
+	struct ratelimit_config cfg = { 0 };
+	__u32 key = 0;
+
+	if (rate) {
+		if (!burst || burst > UINT32_MAX) {
+			fprintf(stderr, "ERR: --burst must be 1-%u packets\n",
+				UINT32_MAX);
+			return EXIT_FAIL_OPTION;
+		}
+		cfg.rate = rate;
+		cfg.burst_ns = burst * NANOSEC_PER_SEC;
+		cfg.fill_ns = cfg.burst_ns / rate;
+	}
+	if (bpf_map_update_elem(fd, &key, &cfg, BPF_ANY)) {
+		fprintf(stderr, "ERR: %s() errno(%d/%s)\n",
+			__func__, errno, strerror(errno));
+		return EXIT_FAIL_MAP_KEY;
+	}
+	if (verbose)
+		fprintf(stderr, "%s() rate:%llu pps burst:%llu\n", __func__,
+			cfg.rate, rate ? burst : 0);
 	return EXIT_OK;
 }
 
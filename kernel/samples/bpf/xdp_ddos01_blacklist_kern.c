@@ -10,6 +10,7 @@
 #include <uapi/linux/if_vlan.h>
 #include <uapi/linux/ip.h>
 #include <uapi/linux/in.h>
+#include <uapi/linux/ipv6.h>
 #include <uapi/linux/tcp.h>
 #include <uapi/linux/udp.h>
 #include "bpf_helpers.h"
@@ -35,12 +36,16 @@ struct bpf_map_def SEC("maps") blacklist = {
 
 #define XDP_ACTION_MAX (XDP_TX + 1)
 
+/* Pseudo verdict for XDP_DROP by rate limit, counted separately */
+#define VERDICT_DROP_RATE	XDP_ACTION_MAX
+#define VERDICT_MAX		(XDP_ACTION_MAX + 1)
+
 /* Counter per XDP "action" verdict */
 struct bpf_map_def SEC("maps") verdict_cnt = {
 	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
 	.key_size = sizeof(u32),
 	.value_size = sizeof(long),
-	.max_entries = XDP_ACTION_MAX,
+	.max_entries = VERDICT_MAX,
 };
 
 struct bpf_map_def SEC("maps") port_blacklist = {
@@ -68,6 +73,120 @@ struct bpf_map_def SEC("maps") port_blacklist_drop_count_udp = {
 	.max_entries = 65536,
 };
 
+/* Key of an BPF_MAP_TYPE_LPM_TRIE entry, addr in network byte-order */
+struct blacklist_cidr_key {
+	u32 prefixlen;
+	u32 addr;
+};
+
+/* IPv4 prefix blacklist, after exact /32 match in blacklist map.
+ * Notice, not a percpu map (LPM_TRIE). Keep last, as userspace
+ * depend on map_fd[] index of the other maps.
+ */
+struct bpf_map_def SEC("maps") blacklist_cidr = {
+	.type        = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size    = sizeof(struct blacklist_cidr_key),
+	.value_size  = sizeof(u64), /* Drop counter */
+	.max_entries = 10000,
+	.map_flags   = BPF_F_NO_PREALLOC, /* Required by LPM_TRIE */
+};
+
+/* IPv6 exact match blacklist, key is the in6_addr saddr */
+struct bpf_map_def SEC("maps") blacklist_ipv6 = {
+	.type        = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size    = sizeof(struct in6_addr),
+	.value_size  = sizeof(u64), /* Drop counter */
+	.max_entries = 100000,
+	.map_flags   = BPF_F_NO_PREALLOC,
+};
+
+struct blacklist_cidr6_key {
+	u32 prefixlen;
+	struct in6_addr addr;
+};
+
+/* IPv6 prefix blacklist, after exact match in blacklist_ipv6 */
+struct bpf_map_def SEC("maps") blacklist_cidr_ipv6 = {
+	.type        = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size    = sizeof(struct blacklist_cidr6_key),
+	.value_size  = sizeof(u64), /* Drop counter */
+	.max_entries = 10000,
+	.map_flags   = BPF_F_NO_PREALLOC, /* Required by LPM_TRIE */
+};
+
+/* Counter per XDP "action" verdict per L3 family, key is
+ * (family * XDP_ACTION_MAX + action).  The verdict_cnt total is kept,
+ * as existing tools read it.
+ */
+enum {
+	DDOS_FAMILY_OTHER = 0,
+	DDOS_FAMILY_IPV4,
+	DDOS_FAMILY_IPV6,
+	DDOS_FAMILY_MAX,
+};
+
+struct bpf_map_def SEC("maps") verdict_family_cnt = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(long),
+	.max_entries = DDOS_FAMILY_MAX * XDP_ACTION_MAX,
+};
+
+/* Token bucket rate limit per source, for sources that are only
+ * partially abusive.  Tokens are scaled by NSEC_PER_SEC, such that
+ * refill is (delta_ns * rate) without division.
+ */
+#define NSEC_PER_SEC	1000000000ULL
+
+struct ratelimit_config {
+	u64 rate;	/* Packets per sec per source, zero disables */
+	u64 burst_ns;	/* Bucket depth: burst packets * NSEC_PER_SEC */
+	u64 fill_ns;	/* Time to refill an empty bucket */
+};
+
+struct bpf_map_def SEC("maps") ratelimit_config = {
+	.type        = BPF_MAP_TYPE_ARRAY,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(struct ratelimit_config),
+	.max_entries = 1,
+};
+
+struct ratelimit_state {
+	u64 last_ns;
+	u64 tokens;
+};
+
+/* Key is IPv6 saddr, or IPv4-mapped (::ffff:a.b.c.d).  Buckets are
+ * percpu, as RSS usually keeps a source on one RX-queue, thus the
+ * rate applies per CPU.
+ */
+struct bpf_map_def SEC("maps") ratelimit = {
+	.type        = BPF_MAP_TYPE_LRU_PERCPU_HASH,
+	.key_size    = sizeof(struct in6_addr),
+	.value_size  = sizeof(struct ratelimit_state),
+	.max_entries = 100000,
+};
+
+/* Top-talker detection: packets per source, of packets that passed
+ * the blacklists.  Heavy hitters are touched often, and thus stay in
+ * the LRU, while LRU eviction discard the long tail.  Userspace
+ * (xdp_ddos01_blacklist --auto-pps) periodically reads and resets it.
+ */
+struct bpf_map_def SEC("maps") talkers = {
+	.type        = BPF_MAP_TYPE_LRU_PERCPU_HASH,
+	.key_size    = sizeof(struct in6_addr), /* Like ratelimit */
+	.value_size  = sizeof(u64), /* Packet counter */
+	.max_entries = 16384,
+};
+
+/* Non-zero enables talkers accounting */
+struct bpf_map_def SEC("maps") talkers_enabled = {
+	.type        = BPF_MAP_TYPE_ARRAY,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(u32),
+	.max_entries = 1,
+};
+
 static inline struct bpf_map_def *drop_count_by_fproto(int fproto) {
 
 	switch (fproto) {
@@ -98,16 +217,35 @@ static inline struct bpf_map_def *drop_count_by_fproto(int fproto) {
 #define bpf_debug(fmt, ...) { } while (0)
 #endif
 
-/* Keeps stats of XDP_DROP vs XDP_PASS */
+/* Keeps stats of XDP_DROP vs XDP_PASS, total and per family */
 static __always_inline
-void stats_action_verdict(u32 action)
+void stats_action_verdict(u32 verdict, u16 eth_proto)
 {
 	u64 *value;
+	u32 action;
+	u32 key;
 
-	if (action >= XDP_ACTION_MAX)
+	if (verdict >= VERDICT_MAX)
 		return;
 
-	value = bpf_map_lookup_elem(&verdict_cnt, &action);
+	value = bpf_map_lookup_elem(&verdict_cnt, &verdict);
+	if (value)
+		*value += 1;
+
+	action = (verdict == VERDICT_DROP_RATE) ? XDP_DROP : verdict;
+
+	switch (eth_proto) {
+	case ETH_P_IP:
+		key = DDOS_FAMILY_IPV4;
+		break;
+	case ETH_P_IPV6:
+		key = DDOS_FAMILY_IPV6;
+		break;
+	default:
+		key = DDOS_FAMILY_OTHER;
+	}
+	key = key * XDP_ACTION_MAX + action;
+	value = bpf_map_lookup_elem(&verdict_family_cnt, &key);
 	if (value)
 		*value += 1;
 }
@@ -213,12 +351,79 @@ u32 parse_port(struct xdp_md *ctx, u8 proto, void *hdr)
 	return XDP_PASS;
 }
 
+static __always_inline
+u32 ratelimit_src(struct in6_addr *src)
+{
+	struct ratelimit_config *cfg;
+	struct ratelimit_state *st, new;
+	u32 key = 0;
+	u64 now, delta;
+
+	cfg = bpf_map_lookup_elem(&ratelimit_config, &key);
+	if (!cfg || !cfg->rate)
+		return XDP_PASS;
+
+	now = bpf_ktime_get_ns();
+	st = bpf_map_lookup_elem(&ratelimit, src);
+	if (!st) {
+		/* New source starts with full bucket, minus this packet */
+		new.last_ns = now;
+		new.tokens = cfg->burst_ns - NSEC_PER_SEC;
+		bpf_map_update_elem(&ratelimit, src, &new, BPF_NOEXIST);
+		return XDP_PASS;
+	}
+
+	/* Don't need atomics; as percpu map */
+	delta = now - st->last_ns;
+	st->last_ns = now;
+	if (delta >= cfg->fill_ns) {
+		st->tokens = cfg->burst_ns;
+	} else {
+		st->tokens += delta * cfg->rate;
+		if (st->tokens > cfg->burst_ns)
+			st->tokens = cfg->burst_ns;
+	}
+	if (st->tokens < NSEC_PER_SEC)
+		return VERDICT_DROP_RATE;
+	st->tokens -= NSEC_PER_SEC;
+	return XDP_PASS;
+}
+
+static __always_inline
+void talkers_count(struct in6_addr *src)
+{
+	u32 *enabled, key = 0;
+	u64 *cnt, one = 1;
+
+	enabled = bpf_map_lookup_elem(&talkers_enabled, &key);
+	if (!enabled || !*enabled)
+		return;
+
+	cnt = bpf_map_lookup_elem(&talkers, src);
+	if (cnt)
+		*cnt += 1; /* Percpu map, no atomics */
+	else
+		bpf_map_update_elem(&talkers, src, &one, BPF_NOEXIST);
+}
+
+/* Account and rate limit sources that passed the blacklists */
+static __always_inline
+u32 source_verdict(u32 action, struct in6_addr *src)
+{
+	if (action != XDP_PASS)
+		return action;
+	talkers_count(src);
+	return ratelimit_src(src);
+}
+
 static __always_inline
 u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data     = (void *)(long)ctx->data;
 	struct iphdr *iph = data + l3_offset;
+	struct blacklist_cidr_key cidr;
+	struct in6_addr src;
 	u64 *value;
 	u32 ip_src; /* type need to match map */
 
@@ -240,7 +445,57 @@ u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
 		return XDP_DROP;
 	}
 
-	return parse_port(ctx, iph->protocol, iph + 1);
+	/* Exact match is cheaper, only do prefix lookup on miss */
+	cidr.prefixlen = 32;
+	cidr.addr = ip_src;
+	value = bpf_map_lookup_elem(&blacklist_cidr, &cidr);
+	if (value) {
+		/* Shared between CPUs, as LPM_TRIE is not percpu */
+		__sync_fetch_and_add(value, 1);
+		return XDP_DROP;
+	}
+
+	/* IPv4-mapped IPv6 address as rate limit key */
+	src.in6_u.u6_addr32[0] = 0;
+	src.in6_u.u6_addr32[1] = 0;
+	src.in6_u.u6_addr32[2] = htonl(0xffff);
+	src.in6_u.u6_addr32[3] = ip_src;
+	return source_verdict(parse_port(ctx, iph->protocol, iph + 1), &src);
+}
+
+static __always_inline
+u32 parse_ipv6(struct xdp_md *ctx, u64 l3_offset)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ipv6hdr *ip6h = data + l3_offset;
+	struct blacklist_cidr6_key cidr;
+	u64 *value;
+
+	if (ip6h + 1 > data_end) {
+		bpf_debug("Invalid IPv6 packet: L3off:%llu\n", l3_offset);
+		return XDP_ABORTED;
+	}
+
+	value = bpf_map_lookup_elem(&blacklist_ipv6, &ip6h->saddr);
+	if (value) {
+		/* Don't need __sync_fetch_and_add(); as percpu map */
+		*value += 1; /* Keep a counter for drop matches */
+		return XDP_DROP;
+	}
+
+	cidr.prefixlen = 128;
+	cidr.addr = ip6h->saddr;
+	value = bpf_map_lookup_elem(&blacklist_cidr_ipv6, &cidr);
+	if (value) {
+		/* Shared between CPUs, as LPM_TRIE is not percpu */
+		__sync_fetch_and_add(value, 1);
+		return XDP_DROP;
+	}
+
+	/* Extension headers are not walked, only direct L4 */
+	return source_verdict(parse_port(ctx, ip6h->nexthdr, ip6h + 1),
+			      &cidr.addr);
 }
 
 static __always_inline
@@ -250,7 +505,9 @@ u32 handle_eth_protocol(struct xdp_md *ctx, u16 eth_proto, u64 l3_offset)
 	case ETH_P_IP:
 		return parse_ipv4(ctx, l3_offset);
 		break;
-	case ETH_P_IPV6: /* Not handler for IPv6 yet*/
+	case ETH_P_IPV6:
+		return parse_ipv6(ctx, l3_offset);
+		break;
 	case ETH_P_ARP:  /* Let OS handle ARP */
 		/* Fall-through */
 	default:
@@ -268,7 +525,7 @@ int  xdp_program(struct xdp_md *ctx)
 	struct ethhdr *eth = data;
 	u16 eth_proto = 0;
 	u64 l3_offset = 0;
-	u32 action;
+	u32 verdict;
 
 	if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset))) {
 		bpf_debug("Cannot parse L2: L3off:%llu proto:0x%x\n",
@@ -277,9 +534,11 @@ int  xdp_program(struct xdp_md *ctx)
 	}
 	bpf_debug("Reached L3: L3off:%llu proto:0x%x\n", l3_offset, eth_proto);
 
-	action = handle_eth_protocol(ctx, eth_proto, l3_offset);
-	stats_action_verdict(action);
-	return action;
+	verdict = handle_eth_protocol(ctx, eth_proto, l3_offset);
+	stats_action_verdict(verdict, eth_proto);
+	if (verdict == VERDICT_DROP_RATE)
+		return XDP_DROP;
+	return verdict;
 }
 
 char _license[] SEC("license") = "GPL";
@@ -2,11 +2,21 @@
  *  Copyright(c) 2017 Andy Gospodarek, Broadcom Limited, Inc.
  */
 static const char *__doc__=
- " XDP: DDoS protection via IPv4 blacklist\n"
+ " XDP: DDoS protection via IPv4 and IPv6 blacklist\n"
  "\n"
  "This program loads the XDP eBPF program into the kernel.\n"
  "Use the cmdline tool for add/removing source IPs to the blacklist\n"
  "and read statistics.\n"
+ "\n"
+ "Maps are pinned per interface, with --shared <name> the blacklist\n"
+ "maps are shared by all interfaces loaded with the same name.\n"
+ "\n"
+ "With --auto-pps this program stays running, and blacklists sources\n"
+ "exceeding the given pps, for --expire seconds.\n"
+ "\n"
+ "With --replace a new version of the XDP prog replaces the running\n"
+ "one atomically (XDP_FLAGS_REPLACE, kernel v5.7), reusing all pinned\n"
+ "maps, thus no packet drop window and the blacklist state is kept.\n"
  ;
 
 #include <linux/bpf.h>
@@ -45,9 +55,38 @@ static char ifname_buf[IF_NAMESIZE];
 static char *ifname = NULL;
 static int ifindex = -1;
 
-#define NR_MAPS 5
+#define NR_MAPS 13
 int maps_marked_for_export[MAX_MAPS] = { 0 };
 
+/* The attached prog is pinned too, as expected prog for --replace */
+static const char *file_xdp_prog = "ddos_xdp_prog";
+
+/* Pin directories, see xdp_ddos01_blacklist_common.h */
+static char dev_dir[PATH_MAX];
+static char shared_dir[PATH_MAX];
+static bool shared;
+
+/* Maps holding the blacklist feed, can be shared between interfaces */
+static bool map_idx_is_shared(int idx)
+{
+	switch (idx) {
+	case 0: /* blacklist */
+	case 2: /* port_blacklist */
+	case 3: /* port_blacklist_drop_count_tcp */
+	case 4: /* port_blacklist_drop_count_udp */
+	case 5: /* blacklist_cidr */
+	case 6: /* blacklist_ipv6 */
+	case 7: /* blacklist_cidr_ipv6 */
+		return true;
+	}
+	return false;
+}
+
+static const char *map_idx_dir(int idx)
+{
+	return (shared && map_idx_is_shared(idx)) ? shared_dir : dev_dir;
+}
+
 static const char* map_idx_to_export_filename(int idx)
 {
 	const char *file = NULL;
@@ -69,6 +108,30 @@ static const char* map_idx_to_export_filename(int idx)
 	case 4: /* map_fd[4]: port_blacklist_drop_count_udp */
 		file =   file_port_blacklist_count[DDOS_FILTER_UDP];
 		break;
+	case 5: /* map_fd[5]: blacklist_cidr */
+		file =   file_blacklist_cidr;
+		break;
+	case 6: /* map_fd[6]: blacklist_ipv6 */
+		file =   file_blacklist_ipv6;
+		break;
+	case 7: /* map_fd[7]: blacklist_cidr_ipv6 */
+		file =   file_blacklist_cidr_ipv6;
+		break;
+	case 8: /* map_fd[8]: verdict_family_cnt */
+		file =   file_verdict_family;
+		break;
+	case 9: /* map_fd[9]: ratelimit_config */
+		file =   file_ratelimit_config;
+		break;
+	case 10: /* map_fd[10]: ratelimit */
+		file =   file_ratelimit;
+		break;
+	case 11: /* map_fd[11]: talkers */
+		file =   file_talkers;
+		break;
+	case 12: /* map_fd[12]: talkers_enabled */
+		file =   file_talkers_enabled;
+		break;
 	default:
 		break;
 	}
@@ -83,15 +146,24 @@ static void remove_xdp_program(int ifindex, const char *ifname, __u32 xdp_flags)
 	if (ifindex > -1)
 		set_link_xdp_fd(ifindex, -1, xdp_flags);
 
-	/* Remove all exported map file */
+	/* Remove all exported map file of this interface.  Shared maps
+	 * stay pinned in the shared directory, for other interfaces.
+	 */
 	for (i = 0; i < NR_MAPS; i++) {
-		const char *file = map_idx_to_export_filename(i);
+		const char *file = pin_path(dev_dir,
+					    map_idx_to_export_filename(i));
 
 		if (unlink(file) < 0) {
-			printf("WARN: cannot rm map(%s) file:%s err(%d):%s\n",
-			       map_data[i].name, file, errno, strerror(errno));
+			printf("WARN: cannot rm map file:%s err(%d):%s\n",
+			       file, errno, strerror(errno));
 		}
 	}
+	if (unlink(pin_path(dev_dir, file_xdp_prog)) < 0 && errno != ENOENT)
+		printf("WARN: cannot rm prog file err(%d):%s\n",
+		       errno, strerror(errno));
+	if (rmdir(dev_dir) < 0)
+		printf("WARN: cannot rm dir:%s err(%d):%s\n",
+		       dev_dir, errno, strerror(errno));
 }
 
 static const struct option long_options[] = {
@@ -101,6 +173,11 @@ static const struct option long_options[] = {
 	{"quiet",	no_argument,		NULL, 'q' },
 	{"owner",	required_argument,	NULL, 'o' },
 	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"shared",	required_argument,	NULL, 'H' },
+	{"auto-pps",	required_argument,	NULL, 'a' },
+	{"interval",	required_argument,	NULL, 'i' },
+	{"expire",	required_argument,	NULL, 'e' },
+	{"replace",	no_argument,		NULL, 'R' },
 	{0, 0, NULL,  0 }
 };
 
@@ -162,6 +239,29 @@ static int bpf_fs_check_path(const char *path)
 	return err;
 }
 
+static int mkdir_pin(const char *dir)
+{
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "ERR: cannot create dir:%s err(%d):%s\n",
+			dir, errno, strerror(errno));
+		return EXIT_FAIL_MAP_FS;
+	}
+	return 0;
+}
+
+/* Create the pin directories, on the BPF filesystem */
+static int pin_dirs_create(void)
+{
+	if (bpf_fs_check_path(PIN_BASE_DIR) < 0)
+		return EXIT_FAIL_MAP_FS;
+	if (mkdir_pin(PIN_BASE_DIR) || mkdir_pin(dev_dir))
+		return EXIT_FAIL_MAP_FS;
+	if (shared &&
+	    (mkdir_pin(PIN_SHARED_DIR) || mkdir_pin(shared_dir)))
+		return EXIT_FAIL_MAP_FS;
+	return 0;
+}
+
 /* Load existing map via filesystem, if possible */
 int load_map_file(const char *file, struct bpf_map_data *map_data)
 {
@@ -173,8 +273,12 @@ int load_map_file(const char *file, struct bpf_map_data *map_data)
 
 	fd = bpf_obj_get(file);
 	if (fd > 0) { /* Great: map file already existed use it */
-		// FIXME: Verify map size etc is the same before returning it!
-		// data available via map->def.XXX and fdinfo
+		/* A new _kern.c must keep the layout of the reused maps */
+		if (bpf_load_map_check(fd, map_data)) {
+			fprintf(stderr, "ERR: pinned map file:%s incompatible,"
+				" --remove first\n", file);
+			exit(EXIT_FAIL_MAP);
+		}
 		if (verbose)
 			printf(" - Loaded bpf-map:%-30s from file:%s\n",
 			       map_data->name, file);
@@ -202,7 +306,7 @@ void pre_load_maps_via_fs(struct bpf_map_data *map_data, int idx)
 	const char *file;
 	int fd;
 
-	file = map_idx_to_export_filename(idx);
+	file = pin_path(map_idx_dir(idx), map_idx_to_export_filename(idx));
 	fd = load_map_file(file, map_data);
 
 	if (fd > 0) {
@@ -217,12 +321,8 @@ void pre_load_maps_via_fs(struct bpf_map_data *map_data, int idx)
 	}
 }
 
-int export_map_idx(int map_idx)
+int export_map_file(int map_idx, const char *file)
 {
-	const char *file;
-
-	file = map_idx_to_export_filename(map_idx);
-
 	/* Export map as a file */
 	if (bpf_obj_pin(map_fd[map_idx], file) != 0) {
 		fprintf(stderr, "ERR: Cannot pin map(%s) file:%s err(%d):%s\n",
@@ -237,11 +337,26 @@ int export_map_idx(int map_idx)
 
 void export_maps(void)
 {
-	int i;
+	const char *name, *file;
+	int i, fd;
 
 	for (i = 0; i < NR_MAPS; i++) {
+		name = map_idx_to_export_filename(i);
 		if (maps_marked_for_export[i] == 1)
-			export_map_idx(i);
+			export_map_file(i, pin_path(map_idx_dir(i), name));
+
+		/* Shared maps are also pinned in the interface dir, making
+		 * the cmdline tool --dev see the full set
+		 */
+		if (!shared || !map_idx_is_shared(i))
+			continue;
+		file = pin_path(dev_dir, name);
+		fd = bpf_obj_get(file);
+		if (fd >= 0) {
+			close(fd);
+			continue;
+		}
+		export_map_file(i, file);
 	}
 }
 
@@ -251,7 +366,7 @@ void chown_maps(uid_t owner, gid_t group)
 	int i;
 
 	for (i = 0; i < NR_MAPS; i++) {
-		file = map_idx_to_export_filename(i);
+		file = pin_path(map_idx_dir(i), map_idx_to_export_filename(i));
 
 		/* Change permissions and user for the map file, as this allow
 		 * an unpriviliged user to operate the cmdline tool.
@@ -263,22 +378,255 @@ void chown_maps(uid_t owner, gid_t group)
 	}
 }
 
+/* Attach, or atomically replace the prog pinned by a previous run,
+ * and pin the new prog for the next --replace.
+ */
+static int attach_xdp_prog(int fd, __u32 xdp_flags, bool replace)
+{
+	const char *file = pin_path(dev_dir, file_xdp_prog);
+	int old_fd, err;
+
+	if (replace) {
+		old_fd = bpf_obj_get(file);
+		if (old_fd < 0) {
+			fprintf(stderr, "ERR: --replace: no prog file:%s,"
+				" load without --replace first\n", file);
+			return EXIT_FAIL_XDP;
+		}
+		err = set_link_xdp_fd_replace(ifindex, fd, old_fd, xdp_flags);
+		close(old_fd);
+		if (err == -EEXIST)
+			fprintf(stderr, "ERR: --replace: attached prog is not"
+				" the pinned one (changed by another loader)\n");
+		else if (err == -EINVAL || err == -EOPNOTSUPP)
+			fprintf(stderr, "ERR: --replace needs kernel v5.7+\n");
+	} else {
+		err = set_link_xdp_fd(ifindex, fd, xdp_flags);
+	}
+	if (err < 0) {
+		printf("link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+
+	if (unlink(file) < 0 && errno != ENOENT)
+		fprintf(stderr, "WARN: cannot rm prog file:%s err(%d):%s\n",
+			file, errno, strerror(errno));
+	if (bpf_obj_pin(fd, file))
+		fprintf(stderr, "WARN: cannot pin prog file:%s err(%d):%s\n",
+			file, errno, strerror(errno));
+	else if (verbose)
+		printf(" - %s XDP prog, pinned file:%s\n",
+		       replace ? "Replaced" : "Attached", file);
+	return EXIT_OK;
+}
+
+/* Top-talker detection
+ * --------------------
+ * The XDP prog counts packets per source in the talkers map (sources
+ * that passed the blacklists).  Every interval the counts are read and
+ * reset, and sources above the pps threshold are promoted into the
+ * blacklist, with an expiry.  Only promoted entries are aged out,
+ * entries added via the cmdline tool are left alone.
+ */
+#define MAP_IDX_BLACKLIST	0
+#define MAP_IDX_BLACKLIST_IPV6	6
+#define MAP_IDX_TALKERS		11
+#define MAP_IDX_TALKERS_ENABLED	12
+
+struct promoted {
+	struct in6_addr src;
+	__u64 expire; /* gettime() ns */
+};
+
+static struct promoted *promoted;
+static size_t nr_promoted, cap_promoted;
+
+static volatile bool exiting;
+
+static void sig_exit(int sig)
+{
+	exiting = true;
+}
+
+static bool src_is_ipv4(const struct in6_addr *src)
+{
+	return src->s6_addr32[0] == 0 && src->s6_addr32[1] == 0 &&
+		src->s6_addr32[2] == htonl(0xffff);
+}
+
+static void src_to_txt(const struct in6_addr *src, char *txt, size_t len)
+{
+	if (src_is_ipv4(src))
+		inet_ntop(AF_INET, &src->s6_addr32[3], txt, len);
+	else
+		inet_ntop(AF_INET6, src, txt, len);
+}
+
+/* Blacklist map fd and key of the source's family */
+static int src_blacklist(const struct in6_addr *src, const void **key)
+{
+	if (src_is_ipv4(src)) {
+		*key = &src->s6_addr32[3];
+		return map_fd[MAP_IDX_BLACKLIST];
+	}
+	*key = src;
+	return map_fd[MAP_IDX_BLACKLIST_IPV6];
+}
+
+static void promote(const struct in6_addr *src, __u64 pps, __u64 expire)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	char txt[INET6_ADDRSTRLEN] = {0};
+	__u64 values[nr_cpus];
+	const void *key;
+	int fd;
+
+	if (nr_promoted == cap_promoted) {
+		size_t cap = cap_promoted ? cap_promoted * 2 : 256;
+		struct promoted *p = realloc(promoted, cap * sizeof(*p));
+
+		if (!p)
+			return;
+		promoted = p;
+		cap_promoted = cap;
+	}
+
+	memset(values, 0, sizeof(__u64) * nr_cpus);
+	fd = src_blacklist(src, &key);
+	/* Already blacklisted (e.g. manually) is not tracked for expiry */
+	if (bpf_map_update_elem(fd, key, values, BPF_NOEXIST))
+		return;
+
+	promoted[nr_promoted].src = *src;
+	promoted[nr_promoted].expire = expire;
+	nr_promoted++;
+	src_to_txt(src, txt, sizeof(txt));
+	if (verbose)
+		printf("Promoted %s to blacklist (%llu pps)\n", txt, pps);
+}
+
+static void age_promoted(__u64 now, bool all)
+{
+	char txt[INET6_ADDRSTRLEN] = {0};
+	const void *key;
+	size_t i = 0;
+	int fd;
+
+	while (i < nr_promoted) {
+		struct promoted *p = &promoted[i];
+
+		if (!all && now < p->expire) {
+			i++;
+			continue;
+		}
+		fd = src_blacklist(&p->src, &key);
+		bpf_map_delete_elem(fd, key);
+		src_to_txt(&p->src, txt, sizeof(txt));
+		if (verbose)
+			printf("Expired %s from blacklist\n", txt);
+		/* Replace with last entry */
+		*p = promoted[--nr_promoted];
+	}
+}
+
+/* Read and reset talkers, promoting sources above pps_limit */
+static int collect_talkers(__u64 pps_limit, int interval, __u64 expire)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	int fd = map_fd[MAP_IDX_TALKERS];
+	struct in6_addr key, prev, *prev_key = NULL;
+	struct in6_addr *keys = NULL;
+	size_t nr = 0, cap = 0;
+	__u64 values[nr_cpus];
+	__u64 sum;
+	int i, res;
+
+	while (bpf_map_get_next_key(fd, prev_key, &key) == 0) {
+		prev = key;
+		prev_key = &prev;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue; /* LRU evicted meanwhile */
+		for (sum = 0, i = 0; i < nr_cpus; i++)
+			sum += values[i];
+		if (sum / interval > pps_limit)
+			promote(&key, sum / interval, expire);
+
+		if (nr == cap) {
+			struct in6_addr *k;
+
+			cap = cap ? cap * 2 : 1024;
+			k = realloc(keys, cap * sizeof(*keys));
+			if (!k) {
+				free(keys);
+				return -ENOMEM;
+			}
+			keys = k;
+		}
+		keys[nr++] = key;
+	}
+	/* Not deleted while walking, as get_next_key restarts then */
+	res = map_delete_batch(fd, keys, sizeof(*keys), nr);
+	free(keys);
+	return res;
+}
+
+static int auto_blacklist(__u64 pps_limit, int interval, int expire_sec)
+{
+	__u32 key = 0, enabled = 1;
+	__u64 now;
+
+	if (bpf_map_update_elem(map_fd[MAP_IDX_TALKERS_ENABLED], &key,
+				&enabled, BPF_ANY)) {
+		fprintf(stderr, "ERR: Cannot enable talkers err(%d):%s\n",
+			errno, strerror(errno));
+		return EXIT_FAIL_MAP;
+	}
+	signal(SIGINT, sig_exit);
+	signal(SIGTERM, sig_exit);
+	if (verbose)
+		printf(" - Auto blacklist sources above %llu pps"
+		       " (interval:%d sec expire:%d sec)\n",
+		       pps_limit, interval, expire_sec);
+
+	while (!exiting) {
+		sleep(interval);
+		now = gettime();
+		if (collect_talkers(pps_limit, interval,
+				    now + (__u64)expire_sec * NANOSEC_PER_SEC))
+			fprintf(stderr, "WARN: talkers reset failed err(%d):%s\n",
+				errno, strerror(errno));
+		age_promoted(now, false);
+	}
+
+	/* Nobody ages promoted entries after exit */
+	enabled = 0;
+	bpf_map_update_elem(map_fd[MAP_IDX_TALKERS_ENABLED], &key,
+			    &enabled, BPF_ANY);
+	age_promoted(0, true);
+	free(promoted);
+	return EXIT_OK;
+}
+
 int main(int argc, char **argv)
 {
 	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
 	bool rm_xdp_prog = false;
+	bool replace = false;
 	struct passwd *pwd = NULL;
 	__u32 xdp_flags = 0;
 	char filename[256];
 	int longindex = 0;
 	uid_t owner = -1; /* -1 result in no-change of owner */
 	gid_t group = -1;
-	int opt;
+	__u64 auto_pps = 0;
+	int interval = 1;
+	int expire = 300;
+	int opt, err;
 
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hSrqd:",
+	while ((opt = getopt_long(argc, argv, "hSrqRd:H:a:i:e:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'q':
@@ -315,6 +663,24 @@ int main(int argc, char **argv)
 		case 'S':
 			xdp_flags |= XDP_FLAGS_SKB_MODE;
 			break;
+		case 'H':
+			if (pin_dir_set(shared_dir, sizeof(shared_dir),
+					PIN_SHARED_DIR, optarg))
+				goto error;
+			shared = true;
+			break;
+		case 'a':
+			auto_pps = strtoull(optarg, NULL, 10);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'e':
+			expire = atoi(optarg);
+			break;
+		case 'R':
+			replace = true;
+			break;
 		case 'h':
 		error:
 		default:
@@ -322,12 +688,19 @@ int main(int argc, char **argv)
 			return EXIT_FAIL_OPTION;
 		}
 	}
+	if (interval <= 0 || expire <= 0) {
+		fprintf(stderr, "ERR: --interval and --expire must be > 0\n");
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
 	/* Required options */
 	if (ifindex == -1) {
 		printf("ERR: required option --dev missing");
 		usage(argv);
 		return EXIT_FAIL_OPTION;
 	}
+	if (pin_dir_set(dev_dir, sizeof(dev_dir), PIN_BASE_DIR, ifname))
+		return EXIT_FAIL_OPTION;
 	if (rm_xdp_prog) {
 		remove_xdp_program(ifindex, ifname, xdp_flags);
 		return EXIT_OK;
@@ -344,6 +717,9 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (pin_dirs_create())
+		return EXIT_FAIL_MAP_FS;
+
 	/* Load bpf-ELF file with callback for loading maps via filesystem */
 	if (load_bpf_file_fixup_map(filename, pre_load_maps_via_fs)) {
 		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
@@ -361,14 +737,19 @@ int main(int argc, char **argv)
 	if (owner >= 0)
 		chown_maps(owner, group);
 
-	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
-		printf("link set xdp fd failed\n");
-		return EXIT_FAIL_XDP;
+	err = attach_xdp_prog(prog_fd[0], xdp_flags, replace);
+	if (err)
+		return err;
+
+	/* Add something to the map as a test, unless keeping state */
+	if (!replace) {
+		blacklist_modify(map_fd[0], "198.18.50.3", ACTION_ADD);
+		blacklist_port_modify(map_fd[2], map_fd[4], 80, ACTION_ADD,
+				      IPPROTO_UDP);
 	}
 
-	/* Add something to the map as a test */
-	blacklist_modify(map_fd[0], "198.18.50.3", ACTION_ADD);
-	blacklist_port_modify(map_fd[2], map_fd[4], 80, ACTION_ADD, IPPROTO_UDP);
+	if (auto_pps)
+		return auto_blacklist(auto_pps, interval, expire);
 
 	return EXIT_OK;
 }
@@ -0,0 +1,23 @@
+#ifndef __XDP_DDOS02_SYNCOOKIE_H__
+#define __XDP_DDOS02_SYNCOOKIE_H__
+
+/* Shared between xdp_ddos02_syncookie _kern.c and _user.c */
+
+/* Value of protect_ports (ARRAY, key TCP dest port in host order) */
+#define PORT_PROTECT	1
+
+/* Keys of syncookie_stats (PERCPU_ARRAY of __u64) */
+enum syncookie_stat {
+	SC_STAT_RX = 0,
+	SC_STAT_PASS,		/* Not TCP/IPv4, or not a protected port */
+	SC_STAT_SYN,		/* SYN to a protected port */
+	SC_STAT_SYNACK_TX,	/* SYN-ACK with cookie via XDP_TX */
+	SC_STAT_NO_LISTENER,	/* SYN passed, no listen socket */
+	SC_STAT_ACK_VALID,	/* Cookie ACK passed, creates the socket */
+	SC_STAT_ACK_INVALID,	/* Dropped, no socket and a bad cookie */
+	SC_STAT_ACK_OTHER,	/* Passed, existing connection etc. */
+	SC_STAT_ERR,		/* Dropped, syncookie helper error */
+	SC_STAT_MAX
+};
+
+#endif /* __XDP_DDOS02_SYNCOOKIE_H__ */
@@ -0,0 +1,293 @@
+/*  XDP DDoS scrubber: answer TCP SYN floods with SYN cookies
+ *
+ *  SYNs to a protected port get a SYN-ACK, with a cookie generated by
+ *  the kernel for the listen socket (bpf_tcp_gen_syncookie), directly
+ *  via XDP_TX.  Thus a SYN flood never reaches the TCP stack and its
+ *  listen queue.  Returning ACKs without a socket are verified with
+ *  bpf_tcp_check_syncookie: valid ones are passed on, and the stack
+ *  creates the connection from the cookie, invalid ones are dropped.
+ *
+ *  As the kernel own SYN cookies, the SYN-ACK carries only the MSS
+ *  option, no timestamps, SACK and window scaling.
+ *
+ *  Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#define KBUILD_MODNAME "foo"
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/in.h>
+#include <uapi/linux/tcp.h>
+#include <uapi/asm-generic/errno-base.h>
+#include "bpf_helpers.h"
+
+#include "xdp_ddos02_syncookie.h"
+
+/* From include/net/ip.h, not in uapi */
+#define IP_DF		0x4000	/* Flag: "Don't Fragment"	*/
+#define IP_MF		0x2000	/* Flag: "More Fragments"	*/
+#define IP_OFFSET	0x1FFF	/* "Fragment Offset" part	*/
+
+/* From include/net/tcp.h */
+#define TCPOPT_MSS	2
+#define TCPOLEN_MSS	4
+#define TCPHDR_SYN	0x02
+#define TCPHDR_ACK	0x10
+#define tcp_flag_byte(th) (((u8 *)th)[13])
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, 65536);
+} protect_ports SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, SC_STAT_MAX);
+} syncookie_stats SEC(".maps");
+
+/* Set by _user.c before load, non-zero when no ports are given */
+const volatile u32 protect_all = 0;
+
+/* As struct bpf_sock_tuple.ipv4, which the uapi bpf.h here lacks */
+struct sock_tuple_ipv4 {
+	__be32 saddr;
+	__be32 daddr;
+	__be16 sport;
+	__be16 dport;
+};
+
+static __always_inline void stat_inc(u32 key)
+{
+	u64 *cnt = bpf_map_lookup_elem(&syncookie_stats, &key);
+
+	if (cnt)
+		*cnt += 1;
+}
+
+static __always_inline
+u16 csum_fold_helper(u32 csum)
+{
+	csum = (csum & 0xffff) + (csum >> 16);
+	csum = (csum & 0xffff) + (csum >> 16);
+	return ~csum;
+}
+
+static __always_inline
+void ipv4_csum(struct iphdr *iph)
+{
+	u16 *word = (u16 *)iph;
+	u32 csum = 0;
+	int i;
+
+	iph->check = 0;
+#pragma unroll
+	for (i = 0; i < sizeof(*iph) / 2; i++)
+		csum += word[i];
+	iph->check = csum_fold_helper(csum);
+}
+
+/* Full TCP checksum incl. pseudo header, len must be a constant */
+static __always_inline
+void tcp_csum(struct iphdr *iph, struct tcphdr *th, int len)
+{
+	u16 *word = (u16 *)th;
+	u32 csum;
+	int i;
+
+	th->check = 0;
+	csum = (iph->saddr >> 16) + (iph->saddr & 0xffff) +
+	       (iph->daddr >> 16) + (iph->daddr & 0xffff) +
+	       htons(IPPROTO_TCP) + htons(len);
+#pragma unroll
+	for (i = 0; i < len / 2; i++)
+		csum += word[i];
+	th->check = csum_fold_helper(csum);
+}
+
+/* The helper wants th_len == doff * 4, as an ARG_CONST_SIZE.  The
+ * unrolled loop gives the verifier a constant length per header size.
+ */
+static __always_inline
+long long syncookie_gen(void *sk, struct iphdr *iph, struct tcphdr *th,
+			void *data_end)
+{
+	int i;
+
+#pragma unroll
+	for (i = 5; i <= 15; i++) {
+		if (th->doff != i)
+			continue;
+		if ((void *)th + i * 4 > data_end)
+			return -1;
+		return bpf_tcp_gen_syncookie(sk, iph, sizeof(*iph), th, i * 4);
+	}
+	return -1;
+}
+
+static __always_inline
+void swap_macs(struct ethhdr *eth)
+{
+	u8 tmp[ETH_ALEN];
+
+	__builtin_memcpy(tmp, eth->h_source, ETH_ALEN);
+	__builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+	__builtin_memcpy(eth->h_dest, tmp, ETH_ALEN);
+}
+
+/* Turn the SYN in place into the SYN-ACK, and trim the options.  The
+ * MSS option is only sent back when the SYN had options, as the frame
+ * is never grown.
+ */
+static __always_inline
+int synack_tx(struct xdp_md *ctx, struct ethhdr *eth, struct iphdr *iph,
+	      struct tcphdr *th, u32 cookie, u16 mss)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	int tcp_len = th->doff > 5 ? sizeof(*th) + TCPOLEN_MSS : sizeof(*th);
+	int pkt_len = sizeof(*eth) + sizeof(*iph) + tcp_len;
+	__be32 addr;
+	__be16 port;
+	u8 *opt;
+
+	swap_macs(eth);
+
+	addr = iph->saddr;
+	iph->saddr    = iph->daddr;
+	iph->daddr    = addr;
+	iph->tos      = 0;
+	iph->tot_len  = htons(sizeof(*iph) + tcp_len);
+	iph->id       = 0;
+	iph->frag_off = htons(IP_DF);
+	iph->ttl      = 64;
+	ipv4_csum(iph);
+
+	port = th->source;
+	th->source  = th->dest;
+	th->dest    = port;
+	th->ack_seq = htonl(ntohl(th->seq) + 1);
+	th->seq     = htonl(cookie);
+	th->doff    = tcp_len / 4;
+	th->res1    = 0;
+	tcp_flag_byte(th) = TCPHDR_SYN | TCPHDR_ACK;
+	th->window  = htons(65535);
+	th->urg_ptr = 0;
+
+	if (tcp_len > sizeof(*th)) {
+		opt = (void *)(th + 1);
+		if ((void *)(opt + TCPOLEN_MSS) > data_end)
+			return -1;
+		opt[0] = TCPOPT_MSS;
+		opt[1] = TCPOLEN_MSS;
+		opt[2] = mss >> 8;
+		opt[3] = mss & 0xff;
+		tcp_csum(iph, th, sizeof(*th) + TCPOLEN_MSS);
+	} else {
+		tcp_csum(iph, th, sizeof(*th));
+	}
+
+	/* Last, as it invalidates the packet pointers */
+	if (data_end - data > pkt_len &&
+	    bpf_xdp_adjust_tail(ctx, pkt_len - (int)(data_end - data)))
+		return -1;
+	return 0;
+}
+
+SEC("xdp_ddos02_syncookie")
+int xdp_syncookie_prog(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct sock_tuple_ipv4 tup;
+	struct iphdr *iph;
+	struct tcphdr *th;
+	long long seq_mss;
+	u32 port, *val;
+	void *sk;
+	int ret;
+
+	stat_inc(SC_STAT_RX);
+
+	if ((void *)(eth + 1) > data_end || eth->h_proto != htons(ETH_P_IP))
+		goto pass;
+	iph = (void *)(eth + 1);
+	if ((void *)(iph + 1) > data_end)
+		goto pass;
+	if (iph->ihl != 5 || iph->protocol != IPPROTO_TCP ||
+	    iph->frag_off & htons(IP_MF | IP_OFFSET))
+		goto pass;
+	th = (void *)(iph + 1);
+	if ((void *)(th + 1) > data_end)
+		goto pass;
+
+	if (!protect_all) {
+		port = ntohs(th->dest);
+		val = bpf_map_lookup_elem(&protect_ports, &port);
+		if (!val || *val != PORT_PROTECT)
+			goto pass;
+	}
+	if (th->rst || (!th->syn && !th->ack))
+		goto pass;
+
+	tup.saddr = iph->saddr;
+	tup.daddr = iph->daddr;
+	tup.sport = th->source;
+	tup.dport = th->dest;
+	sk = bpf_skc_lookup_tcp(ctx, &tup, sizeof(tup), BPF_F_CURRENT_NETNS, 0);
+
+	if (th->syn && !th->ack) {
+		stat_inc(SC_STAT_SYN);
+		if (!sk) {
+			stat_inc(SC_STAT_NO_LISTENER);
+			goto pass;
+		}
+		seq_mss = syncookie_gen(sk, iph, th, data_end);
+		bpf_sk_release(sk);
+		if (seq_mss < 0) {
+			/* Also with net.ipv4.tcp_syncookies=0 */
+			stat_inc(SC_STAT_ERR);
+			return XDP_DROP;
+		}
+		if (synack_tx(ctx, eth, iph, th, (u32)seq_mss,
+			      (u16)(seq_mss >> 32))) {
+			stat_inc(SC_STAT_ERR);
+			return XDP_DROP;
+		}
+		stat_inc(SC_STAT_SYNACK_TX);
+		return XDP_TX;
+	}
+	if (th->syn)
+		goto release; /* SYN-ACK, we are not the client */
+
+	/* ACK, the stack itself knows established connections */
+	if (!sk)
+		goto pass;
+	ret = bpf_tcp_check_syncookie(sk, iph, sizeof(*iph), th, sizeof(*th));
+	bpf_sk_release(sk);
+	if (ret == 0) {
+		stat_inc(SC_STAT_ACK_VALID);
+		return XDP_PASS;
+	}
+	if (ret == -EACCES) {
+		stat_inc(SC_STAT_ACK_INVALID);
+		return XDP_DROP;
+	}
+	/* -EINVAL not a listen socket, i.e. an existing connection, or
+	 * -ENOENT no cookies sent recently, left to the stack
+	 */
+	stat_inc(SC_STAT_ACK_OTHER);
+	return XDP_PASS;
+release:
+	if (sk)
+		bpf_sk_release(sk);
+pass:
+	stat_inc(SC_STAT_PASS);
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,393 @@
+/* Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP DDoS scrubber, answers TCP SYN floods with SYN cookies\n"
+ "\n"
+ " SYNs to the --port(s) (default all TCP ports) of a local listen\n"
+ " socket are answered with a SYN-ACK cookie via XDP_TX, thus never\n"
+ " reach the listen queue.  Returning ACKs are checked against the\n"
+ " cookie, and bad ones dropped.  Needs net.ipv4.tcp_syncookies=1 or 2.\n"
+ "\n"
+ " --bench runs SYN and ACK floods via BPF_PROG_TEST_RUN against a\n"
+ " listen socket on 127.0.0.1, without a device.  A test run uses a\n"
+ " single CPU, thus the Mpps is per core.";
+
+#include <linux/bpf.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "xdp_stats.h"
+#include "xdp_ddos02_syncookie.h"
+
+static int ifindex = -1;
+static char ifname_buf[IF_NAMESIZE];
+static char *ifname;
+
+static __u32 xdp_flags;
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_XDP		3
+#define EXIT_FAIL_BPF		4
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"port",	required_argument,	NULL, 'p' },
+	{"sec",		required_argument,	NULL, 's' },
+	{"bench",	no_argument,		NULL, 'B' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+#define PORTS_MAX 64
+
+static const char *stat_names[SC_STAT_MAX] = {
+	[SC_STAT_RX]		= "rx",
+	[SC_STAT_PASS]		= "pass",
+	[SC_STAT_SYN]		= "syn",
+	[SC_STAT_SYNACK_TX]	= "synack-tx",
+	[SC_STAT_NO_LISTENER]	= "no-listener",
+	[SC_STAT_ACK_VALID]	= "ack-valid",
+	[SC_STAT_ACK_INVALID]	= "ack-invalid",
+	[SC_STAT_ACK_OTHER]	= "ack-other",
+	[SC_STAT_ERR]		= "error",
+};
+
+static void stats_poll(int interval)
+{
+	int fd = bpf_load_map_fd("syncookie_stats");
+	__u64 cur[SC_STAT_MAX], prev[SC_STAT_MAX];
+	__u64 t_cur, t_prev;
+	int i;
+
+	t_prev = stats_gettime();
+	stats_percpu_array_sum(fd, SC_STAT_MAX, prev, sizeof(prev[0]));
+	while (1) {
+		sleep(interval);
+		t_cur = stats_gettime();
+		stats_percpu_array_sum(fd, SC_STAT_MAX, cur, sizeof(cur[0]));
+		printf("%-14s %-14s %-14s\n", "counter", "pps", "total");
+		for (i = 0; i < SC_STAT_MAX; i++)
+			printf("%-14s %'-14llu %'-14llu\n", stat_names[i],
+			       stats_rate(cur[i] - prev[i], t_cur - t_prev),
+			       cur[i]);
+		printf("\n");
+		memcpy(prev, cur, sizeof(prev));
+		t_prev = t_cur;
+	}
+}
+
+/* The syncookie helpers return -ENOENT with SYN cookies disabled */
+static int syncookies_sysctl(void)
+{
+	FILE *f = fopen("/proc/sys/net/ipv4/tcp_syncookies", "r");
+	int val = -1;
+
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static void int_exit(int sig)
+{
+	fprintf(stderr, "Interrupted: Removing XDP program on ifindex:%d device:%s\n",
+		ifindex, ifname);
+	if (ifindex > -1)
+		set_link_xdp_fd(ifindex, -1, xdp_flags);
+	exit(EXIT_OK);
+}
+
+/* --bench packets: Eth + IPv4 + TCP, with the options of a Linux SYN */
+#define BENCH_TCP_LEN	(sizeof(struct tcphdr) + 20)
+#define BENCH_PKT_LEN	(ETH_HLEN + sizeof(struct iphdr) + BENCH_TCP_LEN)
+#define BENCH_SEQ	0x12345678
+
+static const unsigned char syn_opts[20] = {
+	2, 4, 0x05, 0xb4,		/* MSS 1460 */
+	4, 2,				/* SACK permitted */
+	8, 10, 0, 0, 0, 1, 0, 0, 0, 0,	/* Timestamps */
+	1,				/* NOP */
+	3, 3, 7,			/* Window scale 7 */
+};
+
+static int bench_pkt(unsigned char *pkt, __u16 port, bool syn, __u32 ack_seq)
+{
+	struct ethhdr *eth = (void *)pkt;
+	struct iphdr *iph = (void *)(eth + 1);
+	struct tcphdr *th = (void *)(iph + 1);
+	int tcp_len = syn ? BENCH_TCP_LEN : sizeof(*th);
+
+	memset(pkt, 0, BENCH_PKT_LEN);
+	eth->h_proto = htons(ETH_P_IP);
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->tot_len = htons(sizeof(*iph) + tcp_len);
+	iph->protocol = IPPROTO_TCP;
+	iph->saddr = htonl(0x0a000001);
+	iph->daddr = htonl(INADDR_LOOPBACK);
+	th->source = htons(40000);
+	th->dest = htons(port);
+	th->doff = tcp_len / 4;
+	th->window = htons(64240);
+	if (syn) {
+		th->seq = htonl(BENCH_SEQ);
+		th->syn = 1;
+		memcpy(th + 1, syn_opts, sizeof(syn_opts));
+	} else {
+		th->seq = htonl(BENCH_SEQ + 1);
+		th->ack_seq = htonl(ack_seq);
+		th->ack = 1;
+	}
+	return ETH_HLEN + sizeof(*iph) + tcp_len;
+}
+
+/* Best of 3 runs, as ns per packet */
+static int bench_run(const char *name, unsigned char *pkt, int len,
+		     __u32 expect, int repeat, unsigned char *out)
+{
+	__u32 duration, retval, size, best = ~0U;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (bpf_prog_test_run(prog_fd[0], repeat, pkt, len, out, &size,
+				      &retval, &duration)) {
+			fprintf(stderr, "ERR: BPF_PROG_TEST_RUN err(%d):%s\n",
+				errno, strerror(errno));
+			return -1;
+		}
+		if (retval != expect) {
+			fprintf(stderr, "ERR: %s: retval %u expected %u\n",
+				name, retval, expect);
+			return -1;
+		}
+		if (duration < best)
+			best = duration;
+	}
+	printf("%-12s %-10u %-8.2f\n", name, best,
+	       best ? 1000.0 / best : 0);
+	return 0;
+}
+
+static int bench(int repeat)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	unsigned char pkt[BENCH_PKT_LEN], out[BENCH_PKT_LEN + 64];
+	socklen_t addr_len = sizeof(addr);
+	struct tcphdr *th;
+	__u32 key, val = PORT_PROTECT;
+	__u32 cookie;
+	__u16 port;
+	int sock, len;
+
+	/* Listen socket the SYNs are answered for, in this netns */
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(sock, 16) ||
+	    getsockname(sock, (struct sockaddr *)&addr, &addr_len)) {
+		fprintf(stderr, "ERR: listen socket: %s\n", strerror(errno));
+		return EXIT_FAIL;
+	}
+	port = ntohs(addr.sin_port);
+	key = port;
+	if (bpf_map_update_elem(bpf_load_map_fd("protect_ports"), &key,
+				&val, 0)) {
+		fprintf(stderr, "ERR: protect_ports update: %s\n",
+			strerror(errno));
+		return EXIT_FAIL_BPF;
+	}
+
+	printf("%-12s %-10s %-8s\n", "flood", "ns/pkt", "Mpps/core");
+	len = bench_pkt(pkt, port, true, 0);
+	if (bench_run("syn", pkt, len, XDP_TX, repeat, out))
+		return EXIT_FAIL_BPF;
+
+	/* The SYN-ACK seq is the cookie, valid for the ACK of same flow */
+	th = (void *)(out + ETH_HLEN + sizeof(struct iphdr));
+	cookie = ntohl(th->seq);
+	len = bench_pkt(pkt, port, false, cookie + 1);
+	if (bench_run("ack-valid", pkt, len, XDP_PASS, repeat, out))
+		return EXIT_FAIL_BPF;
+	len = bench_pkt(pkt, port, false, cookie + 0x10000);
+	if (bench_run("ack-invalid", pkt, len, XDP_DROP, repeat, out))
+		return EXIT_FAIL_BPF;
+	len = bench_pkt(pkt, port + 1, true, 0);
+	if (bench_run("unprotected", pkt, len, XDP_PASS, repeat, out))
+		return EXIT_FAIL_BPF;
+
+	close(sock);
+	return EXIT_OK;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	__u32 ports[PORTS_MAX], val;
+	bool do_bench = false;
+	int longindex = 0, opt, i;
+	int nr_ports = 0;
+	int repeat = 1000000;
+	int interval = 2;
+	char filename[256];
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	while ((opt = getopt_long(argc, argv, "hd:Sp:s:Br:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'd':
+			if (strlen(optarg) >= IF_NAMESIZE) {
+				fprintf(stderr, "ERR: --dev name too long\n");
+				goto error;
+			}
+			ifname = (char *)&ifname_buf;
+			strncpy(ifname, optarg, IF_NAMESIZE);
+			ifindex = if_nametoindex(ifname);
+			if (ifindex == 0) {
+				fprintf(stderr,
+					"ERR: --dev name unknown err(%d):%s\n",
+					errno, strerror(errno));
+				goto error;
+			}
+			break;
+		case 'S':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 'p':
+			if (nr_ports == PORTS_MAX) {
+				fprintf(stderr, "ERR: max %d --port\n",
+					PORTS_MAX);
+				goto error;
+			}
+			ports[nr_ports] = atoi(optarg);
+			if (!ports[nr_ports] || ports[nr_ports] > 65535) {
+				fprintf(stderr, "ERR: --port 1-65535\n");
+				goto error;
+			}
+			nr_ports++;
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 'B':
+			do_bench = true;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'h':
+		error:
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	if (!do_bench && ifindex == -1) {
+		fprintf(stderr, "ERR: required option --dev missing\n");
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+	if (syncookies_sysctl() <= 0) {
+		fprintf(stderr,
+			"ERR: needs sysctl net.ipv4.tcp_syncookies=1 (or 2)\n");
+		return EXIT_FAIL;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	/* The bench protects the port of its own listen socket only */
+	val = !nr_ports && !do_bench;
+	if (bpf_load_global_set("protect_all", &val, sizeof(val))) {
+		fprintf(stderr, "ERR: bpf_load config\n");
+		return EXIT_FAIL_BPF;
+	}
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (!prog_fd[0]) {
+		printf("load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL_BPF;
+	}
+
+	setlocale(LC_NUMERIC, "en_US");
+	if (do_bench)
+		return bench(repeat);
+
+	val = PORT_PROTECT;
+	for (i = 0; i < nr_ports; i++) {
+		if (bpf_map_update_elem(bpf_load_map_fd("protect_ports"),
+					&ports[i], &val, 0)) {
+			fprintf(stderr, "ERR: protect_ports update: %s\n",
+				strerror(errno));
+			return EXIT_FAIL_BPF;
+		}
+	}
+
+	signal(SIGINT, int_exit);
+	signal(SIGTERM, int_exit);
+
+	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+
+	stats_poll(interval);
+	return EXIT_OK;
+}
@@ -0,0 +1,26 @@
+#ifndef __XDP_DISPATCHER_H__
+#define __XDP_DISPATCHER_H__
+
+/* Shared between xdp_dispatcher_kern.h and the _user side, which
+ * controls the pipeline via xdp_dispatcher_user.h
+ *
+ * The stages of a pipeline are tail-called in order from the
+ * dispatcher prog.  The prog_array holds two banks of stages, the
+ * active one is selected by a single u32 in map dispatch_active.
+ * Userspace fills the inactive bank and then flips dispatch_active,
+ * thus the whole pipeline is swapped at once, while the dispatcher
+ * stays attached to the device.
+ */
+#define DISPATCH_STAGES_MAX	8
+#define DISPATCH_BANKS		2
+
+/* Index in the prog_array dispatch_stages */
+#define DISPATCH_IDX(bank, stage)	((bank) * DISPATCH_STAGES_MAX + (stage))
+
+/* Value of map dispatch_banks, one per bank */
+struct dispatch_bank {
+	__u32 nr_stages;
+	__u32 verdict;	/* XDP action when the last stage continues */
+};
+
+#endif /* __XDP_DISPATCHER_H__ */
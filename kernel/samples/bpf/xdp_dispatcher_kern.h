@@ -0,0 +1,96 @@
+#ifndef __XDP_DISPATCHER_KERN_H__
+#define __XDP_DISPATCHER_KERN_H__
+
+/* Dispatcher for a pipeline of tail-called XDP stages.  The _kern.c
+ * including this has a root prog that returns dispatch_start(ctx),
+ * and stages, in the same ELF file, that end with:
+ *
+ *	return dispatch_next(ctx, st);
+ *
+ * to continue with the next stage, or return an XDP action directly.
+ */
+#include "xdp_dispatcher.h"
+
+struct bpf_map_def SEC("maps") dispatch_stages = {
+	.type		= BPF_MAP_TYPE_PROG_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u32),
+	.max_entries	= DISPATCH_BANKS * DISPATCH_STAGES_MAX,
+};
+
+struct bpf_map_def SEC("maps") dispatch_active = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u32),
+	.max_entries	= 1,
+};
+
+struct bpf_map_def SEC("maps") dispatch_banks = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct dispatch_bank),
+	.max_entries	= DISPATCH_BANKS,
+};
+
+/* Position of the packet in the pipeline.  A packet runs all its
+ * stages on the same CPU, without being interrupted by the next
+ * packet, thus per CPU state is per packet state.
+ */
+struct dispatch_state {
+	u32 base;	/* DISPATCH_IDX(bank, 0) */
+	u32 next;	/* Stage to run next, current is next - 1 */
+	u32 nr_stages;
+	u32 verdict;
+};
+
+struct bpf_map_def SEC("maps") dispatch_state = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct dispatch_state),
+	.max_entries	= 1,
+};
+
+static __always_inline struct dispatch_state *dispatch_state_get(void)
+{
+	u32 key = 0;
+
+	return bpf_map_lookup_elem(&dispatch_state, &key);
+}
+
+/* An empty slot ends the pipeline like the last stage does */
+static __always_inline int dispatch_next(struct xdp_md *ctx,
+					 struct dispatch_state *st)
+{
+	if (st->next < st->nr_stages && st->next < DISPATCH_STAGES_MAX) {
+		u32 idx = st->base + st->next++;
+
+		bpf_tail_call(ctx, &dispatch_stages, idx);
+	}
+	return st->verdict;
+}
+
+/* The bank is read once per packet, so a packet never sees a mix of
+ * the old and new pipeline.
+ */
+static __always_inline int dispatch_start(struct xdp_md *ctx)
+{
+	struct dispatch_state *st = dispatch_state_get();
+	struct dispatch_bank *bank;
+	u32 key = 0, *active;
+
+	active = bpf_map_lookup_elem(&dispatch_active, &key);
+	if (!active || !st)
+		return XDP_ABORTED;
+	key = *active;
+	bank = bpf_map_lookup_elem(&dispatch_banks, &key);
+	if (!bank)
+		return XDP_ABORTED;
+
+	st->base = DISPATCH_IDX(key, 0);
+	st->next = 0;
+	st->nr_stages = bank->nr_stages;
+	st->verdict = bank->verdict;
+	return dispatch_next(ctx, st);
+}
+
+#endif /* __XDP_DISPATCHER_KERN_H__ */
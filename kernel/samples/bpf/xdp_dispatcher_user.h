@@ -0,0 +1,51 @@
+#ifndef __XDP_DISPATCHER_USER_H__
+#define __XDP_DISPATCHER_USER_H__
+
+/* Userspace control of the pipeline in xdp_dispatcher_kern.h */
+#include <errno.h>
+#include "xdp_dispatcher.h"
+
+/* map_fd[] of the dispatcher maps, in the loading program */
+struct dispatch_maps {
+	int stages;
+	int active;
+	int banks;
+};
+
+/* Install @progs (prog fds) as the pipeline in the inactive bank, then
+ * make it the active bank.  Packets already inside the old pipeline
+ * finish there.  Notice, calling this again before those packets are
+ * done (within a NAPI poll) rewrites the bank they are running in.
+ */
+static int dispatch_set_pipeline(const struct dispatch_maps *m,
+				 const int *progs, int nr, __u32 verdict)
+{
+	struct dispatch_bank bank = { .nr_stages = nr, .verdict = verdict };
+	__u32 key = 0, active, idx;
+	int i;
+
+	if (nr < 0 || nr > DISPATCH_STAGES_MAX)
+		return -EINVAL;
+	if (bpf_map_lookup_elem(m->active, &key, &active))
+		return -errno;
+	active = !active;
+
+	for (i = 0; i < DISPATCH_STAGES_MAX; i++) {
+		idx = DISPATCH_IDX(active, i);
+		if (i < nr) {
+			if (bpf_map_update_elem(m->stages, &idx, &progs[i], 0))
+				return -errno;
+		} else if (bpf_map_delete_elem(m->stages, &idx) &&
+			   errno != ENOENT) {
+			return -errno;
+		}
+	}
+	if (bpf_map_update_elem(m->banks, &active, &bank, 0))
+		return -errno;
+	/* The flip, a single u32 read by the dispatcher per packet */
+	if (bpf_map_update_elem(m->active, &key, &active, 0))
+		return -errno;
+	return 0;
+}
+
+#endif /* __XDP_DISPATCHER_USER_H__ */
@@ -0,0 +1,38 @@
+/* Multi-buffer (XDP frags) helpers for the bench _kern.c programs
+ *
+ * XDP progs in a SEC("xdp.frags...") are loaded with BPF_F_XDP_HAS_FRAGS
+ * by bpf_load.c (v5.18), and can then run on devices with an MTU above
+ * a page, e.g. 9000 jumbo frames.  The driver then delivers a frame as
+ * a linear part, holding at least the headers, plus fragments.  Direct
+ * access via ctx->data only covers the linear part, while
+ * bpf_xdp_load_bytes() also reads across the fragments.
+ */
+#ifndef __XDP_FRAGS_KERN_H
+#define __XDP_FRAGS_KERN_H
+
+/* Last cache-line, in the last fragment of a jumbo frame */
+#define FRAME_TAIL_LEN	64
+
+/* Whole frame length, incl. the fragments */
+static __always_inline
+u64 frame_len(struct xdp_md *ctx, int frags)
+{
+	if (frags)
+		return bpf_xdp_get_buff_len(ctx);
+	return ctx->data_end - ctx->data;
+}
+
+/* Read the frame tail via bpf_xdp_load_bytes() in both variants, thus
+ * the single buffer vs frags difference is the frame layout, and not
+ * the access method.  Returns zero or negative errno.
+ */
+static __always_inline
+int frame_tail_read(struct xdp_md *ctx, u64 len, void *buf)
+{
+	if (len < FRAME_TAIL_LEN)
+		return -1;
+	return bpf_xdp_load_bytes(ctx, len - FRAME_TAIL_LEN, buf,
+				  FRAME_TAIL_LEN);
+}
+
+#endif /* __XDP_FRAGS_KERN_H */
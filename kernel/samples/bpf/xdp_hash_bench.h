@@ -0,0 +1,31 @@
+#ifndef __XDP_HASH_BENCH_H__
+#define __XDP_HASH_BENCH_H__
+
+/* Shared between xdp_hash_bench _kern.c and _user.c */
+
+/* The _kern.c progs are ordered by hash, then key size, thus
+ * prog_fd[hash * KEY_SIZES_MAX + key_size_idx]
+ */
+enum bench_hash {
+	BENCH_HASH_NONE = 0,	/* baseline: packet key copy and loop */
+	BENCH_HASH_SFH,		/* SuperFastHash, hash_func01.h */
+	BENCH_HASH_JHASH,	/* jhash_words, hash_func02.h */
+	BENCH_HASH_MX,		/* mxhash_words, hash_func02.h */
+	BENCH_HASH_MAX
+};
+
+/* Key sizes in u32 words: IPv4 L3, IPv6 L3, IPv6 L4 folded, IPv6 5-tuple */
+#define KEY_SIZES_MAX	4
+#define KEY_WORDS_MAX	9
+
+/* Each prog chains the hash this many times, the output is the seed
+ * of the next, to measure latency rather than throughput.
+ */
+#define HASH_CHAIN	8
+
+/* The key is read from the IPv6 saddr, which together with daddr and
+ * the UDP ports is 36 contiguous bytes.
+ */
+#define KEY_OFFSET	(14 + 8)
+
+#endif /* __XDP_HASH_BENCH_H__ */
@@ -0,0 +1,70 @@
+/*  XDP flow hash function cost, run via BPF_PROG_TEST_RUN
+ *
+ *  GPLv2, Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#include <uapi/linux/bpf.h>
+#include "bpf_helpers.h"
+
+#include "hash_func01.h"
+#include "hash_func02.h"
+#include "xdp_hash_bench.h"
+
+/* Result written here, else the compiler drops the hash calls */
+struct bpf_map_def SEC("maps") hash_result = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u32),
+	.max_entries	= 1,
+};
+
+#define hash_none(key, words, seed)	((seed) + (key)[(words) - 1])
+#define hash_sfh(key, words, seed)	\
+	SuperFastHash((char *)(key), (words) * 4, (seed))
+#define hash_jhash(key, words, seed)	jhash_words((key), (words), (seed))
+#define hash_mx(key, words, seed)	mxhash_words((key), (words), (seed))
+
+#define HASH_PROG(NAME, WORDS)						\
+SEC("xdp_hash_" #NAME "_" #WORDS)					\
+int xdp_hash_##NAME##_##WORDS(struct xdp_md *ctx)			\
+{									\
+	void *data_end = (void *)(long)ctx->data_end;			\
+	void *data     = (void *)(long)ctx->data;			\
+	u32 key[KEY_WORDS_MAX];						\
+	u32 hash = 0, key0 = 0;						\
+	u32 *res;							\
+	int i;								\
+									\
+	if (data + KEY_OFFSET + sizeof(key) > data_end)			\
+		return XDP_ABORTED;					\
+	__builtin_memcpy(key, data + KEY_OFFSET, sizeof(key));		\
+									\
+	_Pragma("clang loop unroll(full)")				\
+	for (i = 0; i < HASH_CHAIN; i++)				\
+		hash = hash_##NAME(key, WORDS, hash);			\
+									\
+	res = bpf_map_lookup_elem(&hash_result, &key0);			\
+	if (!res)							\
+		return XDP_ABORTED;					\
+	*res = hash;							\
+	return XDP_DROP;						\
+}
+
+/* WARNING - sync order with enum bench_hash and key_words[] in _user.c */
+HASH_PROG(none, 1)
+HASH_PROG(none, 4)
+HASH_PROG(none, 5)
+HASH_PROG(none, 9)
+HASH_PROG(sfh, 1)
+HASH_PROG(sfh, 4)
+HASH_PROG(sfh, 5)
+HASH_PROG(sfh, 9)
+HASH_PROG(jhash, 1)
+HASH_PROG(jhash, 4)
+HASH_PROG(jhash, 5)
+HASH_PROG(jhash, 9)
+HASH_PROG(mx, 1)
+HASH_PROG(mx, 4)
+HASH_PROG(mx, 5)
+HASH_PROG(mx, 9)
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,235 @@
+/* GPLv2 Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__ =
+ " XDP flow hash function cost, via BPF_PROG_TEST_RUN (no device needed)\n"
+ "\n"
+ " Runs each hash prog of _kern.c --repeat times on an IPv6 UDP test\n"
+ " packet, for key sizes 4, 16, 20 and 36 bytes.  The cost per hash is\n"
+ " the prog run time minus the 'none' baseline (same key copy), divided\n"
+ " by the chain length.  Cycles are estimated via the TSC on x86, or\n"
+ " from --ghz.  Use together with xdp_hash_quality for the spread.";
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <sys/resource.h>
+#include <getopt.h>
+
+#include <linux/bpf.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "xdp_stats.h"
+#include "xdp_hash_bench.h"
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_BPF		4
+
+static const char *hash_names[BENCH_HASH_MAX] = {
+	[BENCH_HASH_NONE]	= "none",
+	[BENCH_HASH_SFH]	= "SuperFastHash",
+	[BENCH_HASH_JHASH]	= "jhash",
+	[BENCH_HASH_MX]		= "mxhash",
+};
+
+/* WARNING - sync with HASH_PROG() order in _kern.c */
+static const int key_words[KEY_SIZES_MAX] = { 1, 4, 5, 9 };
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{"runs",	required_argument,	NULL, 'n' },
+	{"ghz",		required_argument,	NULL, 'g' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+/* Eth + IPv6 + UDP, the key bytes (addrs and ports) are pseudo random */
+static void build_test_pkt(unsigned char *pkt, int len)
+{
+	int i;
+
+	memset(pkt, 0, len);
+	pkt[12] = 0x86;	/* ETH_P_IPV6 */
+	pkt[13] = 0xdd;
+	pkt[14] = 0x60;	/* version 6 */
+	pkt[18] = 0;	/* payload length */
+	pkt[19] = len - 14 - 40;
+	pkt[20] = 17;	/* IPPROTO_UDP */
+	pkt[21] = 64;	/* hop limit */
+	srandom(42);
+	for (i = KEY_OFFSET; i < KEY_OFFSET + KEY_WORDS_MAX * 4; i++)
+		pkt[i] = random();
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static __u64 rdtsc(void)
+{
+	__u32 lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((__u64)hi << 32) | lo;
+}
+
+/* TSC frequency, which is not the core frequency, e.g. with turbo */
+static double tsc_ghz(void)
+{
+	__u64 t0, t1, c0, c1;
+
+	t0 = stats_gettime();
+	c0 = rdtsc();
+	usleep(100000);
+	c1 = rdtsc();
+	t1 = stats_gettime();
+	return (double)(c1 - c0) / (t1 - t0);
+}
+#else
+static double tsc_ghz(void)
+{
+	return 0;
+}
+#endif
+
+/* Best (lowest) average ns per prog run, out of @runs */
+static int bench_prog(int fd, int repeat, int runs, unsigned char *pkt,
+		      int len, __u32 *best)
+{
+	__u32 duration, retval;
+	int i;
+
+	*best = ~0U;
+	for (i = 0; i < runs; i++) {
+		if (bpf_prog_test_run(fd, repeat, pkt, len, NULL, NULL,
+				      &retval, &duration)) {
+			fprintf(stderr, "ERR: BPF_PROG_TEST_RUN err(%d):%s\n",
+				errno, strerror(errno));
+			return -1;
+		}
+		if (retval != XDP_DROP) {
+			fprintf(stderr, "ERR: unexpected retval %u\n", retval);
+			return -1;
+		}
+		if (duration < *best)
+			*best = duration;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	__u32 base[KEY_SIZES_MAX];
+	unsigned char pkt[128];
+	int repeat = 10000000;
+	char filename[256];
+	int longindex = 0;
+	double ghz = 0;
+	int runs = 3;
+	int opt, h, k;
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	while ((opt = getopt_long(argc, argv, "hr:n:g:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'g':
+			ghz = atof(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	if (repeat <= 0 || runs <= 0) {
+		fprintf(stderr, "ERR: --repeat and --runs must be positive\n");
+		return EXIT_FAIL_OPTION;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (prog_cnt != BENCH_HASH_MAX * KEY_SIZES_MAX) {
+		fprintf(stderr, "ERR: %s: expected %d progs, got %d\n",
+			filename, BENCH_HASH_MAX * KEY_SIZES_MAX, prog_cnt);
+		return EXIT_FAIL_BPF;
+	}
+
+	if (!ghz)
+		ghz = tsc_ghz();
+	build_test_pkt(pkt, sizeof(pkt));
+
+	setlocale(LC_NUMERIC, "en_US");
+	printf("Repeat %'d x best of %d runs, hash chain %d", repeat, runs,
+	       HASH_CHAIN);
+	if (ghz)
+		printf(", cycles @ %.2f GHz", ghz);
+	printf("\n%-14s %-9s %-10s %-10s %-10s\n",
+	       "hash", "key-bytes", "ns/run", "ns/hash", "cycles/hash");
+
+	for (h = 0; h < BENCH_HASH_MAX; h++) {
+		for (k = 0; k < KEY_SIZES_MAX; k++) {
+			int fd = prog_fd[h * KEY_SIZES_MAX + k];
+			double ns_hash;
+			__u32 ns;
+
+			if (bench_prog(fd, repeat, runs, pkt, sizeof(pkt), &ns))
+				return EXIT_FAIL_BPF;
+			if (h == BENCH_HASH_NONE) {
+				base[k] = ns;
+				printf("%-14s %-9d %-10u\n", hash_names[h],
+				       key_words[k] * 4, ns);
+				continue;
+			}
+			/* Below baseline is measurement noise */
+			ns_hash = ns > base[k] ?
+				(double)(ns - base[k]) / HASH_CHAIN : 0;
+			printf("%-14s %-9d %-10u %-10.2f", hash_names[h],
+			       key_words[k] * 4, ns, ns_hash);
+			if (ghz)
+				printf(" %-10.1f", ns_hash * ghz);
+			printf("\n");
+		}
+	}
+	return EXIT_OK;
+}
@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: GPL-2.0
+ * Copyright (c) 2018 Jesper Dangaard Brouer
+ */
+static const char *__doc__ =
+ " Flow hash spread over buckets (CPUs), chi-square per hash function\n"
+ "\n"
+ " Builds the same symmetric (XOR-folded) L3 or L4 flow keys as\n"
+ " get_flow_hash() in xdp_redirect_cpu_kern.c from pcap files, or\n"
+ " pktgen like --synthetic flows, and assigns each unique flow to\n"
+ " bucket hash %% --buckets.  A chi-square/df close to 1.0 is as good\n"
+ " as random, |z| above 3 means the hash spreads these keys badly.\n"
+ " Use together with xdp_hash_bench for the cost of each hash.";
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+
+#define PCAP_DONT_INCLUDE_PCAP_BPF_H
+#include <pcap/pcap.h>
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+#include "hash_func01.h"
+#include "hash_func02.h"
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"buckets",	required_argument,	NULL, 'b' },
+	{"l3",		no_argument,		NULL, '3' },
+	{"synthetic",	required_argument,	NULL, 's' },
+	{0, 0, NULL,  0 }
+};
+
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_MEM		5
+#define EXIT_FAIL_PCAP		6
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf(" Usage: %s [options] IN.pcap...\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+				*long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+				long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+/* As get_l3_hash()/get_l4_hash() in xdp_redirect_cpu_kern.c */
+#define INIT_SEED 15485863
+
+struct flow_key {
+	uint32_t initval;
+	uint32_t words;
+	uint32_t w[5];
+};
+
+struct flows {
+	struct flow_key *keys;
+	size_t cnt;
+	size_t alloc;
+};
+
+static void flow_add(struct flows *f, const struct flow_key *key)
+{
+	if (f->cnt == f->alloc) {
+		f->alloc = f->alloc ? f->alloc * 2 : 65536;
+		f->keys = realloc(f->keys, f->alloc * sizeof(*key));
+		if (!f->keys) {
+			fprintf(stderr, "ERR: Mem alloc error\n");
+			exit(EXIT_FAIL_MEM);
+		}
+	}
+	f->keys[f->cnt++] = *key;
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(struct flow_key));
+}
+
+/* Keep one key per flow, as the spread of packets is dominated by the
+ * elephant flows, whatever the hash function.
+ */
+static void flows_unique(struct flows *f)
+{
+	size_t i, n = 0;
+
+	qsort(f->keys, f->cnt, sizeof(*f->keys), key_cmp);
+	for (i = 0; i < f->cnt; i++)
+		if (!n || key_cmp(&f->keys[n - 1], &f->keys[i]))
+			f->keys[n++] = f->keys[i];
+	f->cnt = n;
+}
+
+static bool l4_ports(const u_char *l4, const u_char *end, uint8_t proto,
+		     uint32_t *ports)
+{
+	uint16_t sport, dport;
+
+	if (proto != IPPROTO_TCP && proto != IPPROTO_UDP)
+		return false;
+	if (l4 + 4 > end)
+		return false;
+	memcpy(&sport, l4, 2);
+	memcpy(&dport, l4 + 2, 2);
+	*ports = sport ^ dport;
+	return true;
+}
+
+/* Returns false for non-IP packets, which are not hashed */
+static bool parse_pkt(const u_char *pkt, const u_char *end, bool l4,
+		      struct flow_key *key)
+{
+	const u_char *p = pkt + sizeof(struct ether_header);
+	uint32_t ports = 0;
+	uint16_t proto;
+	int i;
+
+	if (p > end)
+		return false;
+	memcpy(&proto, pkt + 12, 2);
+	for (i = 0; i < 2; i++) {
+		if (proto != htons(ETHERTYPE_VLAN) && proto != htons(0x88a8))
+			break;
+		if (p + 4 > end)
+			return false;
+		memcpy(&proto, p + 2, 2);
+		p += 4;
+	}
+
+	memset(key, 0, sizeof(*key));
+	if (proto == htons(ETHERTYPE_IP)) {
+		struct iphdr ip4;
+
+		if (p + sizeof(ip4) > end)
+			return false;
+		memcpy(&ip4, p, sizeof(ip4));
+		key->initval = INIT_SEED + ETHERTYPE_IP + ip4.protocol;
+		key->w[0] = ip4.saddr ^ ip4.daddr;
+		key->words = 1;
+		if (l4 && !(ip4.frag_off & htons(IP_MF | IP_OFFMASK)) &&
+		    l4_ports(p + ip4.ihl * 4, end, ip4.protocol, &ports))
+			key->w[key->words++] = ports;
+	} else if (proto == htons(ETHERTYPE_IPV6)) {
+		struct ip6_hdr ip6;
+		uint32_t src[4], dst[4];
+
+		if (p + sizeof(ip6) > end)
+			return false;
+		memcpy(&ip6, p, sizeof(ip6));
+		memcpy(src, &ip6.ip6_src, sizeof(src));
+		memcpy(dst, &ip6.ip6_dst, sizeof(dst));
+		key->initval = INIT_SEED + ETHERTYPE_IPV6 + ip6.ip6_nxt;
+		for (i = 0; i < 4; i++)
+			key->w[i] = src[i] ^ dst[i];
+		key->words = 4;
+		if (l4 && l4_ports(p + sizeof(ip6), end, ip6.ip6_nxt, &ports))
+			key->w[key->words++] = ports;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static int read_pcap(const char *file, bool l4, struct flows *f)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr *hdr;
+	struct flow_key key;
+	const u_char *data;
+	pcap_t *handle;
+
+	handle = pcap_open_offline(file, errbuf);
+	if (!handle) {
+		fprintf(stderr, "ERR: %s\n", errbuf);
+		return -1;
+	}
+	if (pcap_datalink(handle) != DLT_EN10MB) {
+		fprintf(stderr, "ERR: %s: not an Ethernet capture\n", file);
+		pcap_close(handle);
+		return -1;
+	}
+	while (pcap_next_ex(handle, &hdr, &data) == 1)
+		if (parse_pkt(data, data + hdr->caplen, l4, &key))
+			flow_add(f, &key);
+	pcap_close(handle);
+	return 0;
+}
+
+/* Like pktgen with src IP and UDP src port ranges, sequential keys are
+ * the hard case for weak hashes.
+ */
+static void synthetic_flows(int nr, bool l4, struct flows *f)
+{
+	struct flow_key key;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		memset(&key, 0, sizeof(key));
+		key.initval = INIT_SEED + ETHERTYPE_IP + IPPROTO_UDP;
+		key.w[0] = htonl(0xc6120000 + i) ^ htonl(0xc6130001);
+		key.words = 1;
+		if (l4)
+			key.w[key.words++] = htons(1024 + (i & 0x3ff)) ^ htons(9);
+		flow_add(f, &key);
+	}
+}
+
+enum {
+	HASH_SFH = 0,
+	HASH_JHASH,
+	HASH_MX,
+	HASH_MAX
+};
+
+static const char *hash_names[HASH_MAX] = {
+	[HASH_SFH]	= "SuperFastHash",
+	[HASH_JHASH]	= "jhash",
+	[HASH_MX]	= "mxhash",
+};
+
+static uint32_t flow_hash(int hash, const struct flow_key *key)
+{
+	switch (hash) {
+	case HASH_SFH:
+		return SuperFastHash((const char *)key->w, key->words * 4,
+				     key->initval);
+	case HASH_JHASH:
+		return jhash_words(key->w, key->words, key->initval);
+	case HASH_MX:
+		return mxhash_words(key->w, key->words, key->initval);
+	}
+	return 0;
+}
+
+static void spread_print(int hash, const struct flows *f, int buckets)
+{
+	unsigned long *cnt, max = 0;
+	double chi2 = 0, exp, df, z;
+	size_t i;
+
+	cnt = calloc(buckets, sizeof(*cnt));
+	if (!cnt) {
+		fprintf(stderr, "ERR: Mem alloc error\n");
+		exit(EXIT_FAIL_MEM);
+	}
+	for (i = 0; i < f->cnt; i++)
+		cnt[flow_hash(hash, &f->keys[i]) % buckets]++;
+
+	exp = (double)f->cnt / buckets;
+	for (i = 0; i < buckets; i++) {
+		chi2 += (cnt[i] - exp) * (cnt[i] - exp) / exp;
+		if (cnt[i] > max)
+			max = cnt[i];
+	}
+	df = buckets - 1;
+	z = (chi2 - df) / sqrt(2 * df);
+	printf("%-14s %-10.3f %-8.2f %-8.3f\n", hash_names[hash], chi2 / df,
+	       z, max / exp);
+	free(cnt);
+}
+
+int main(int argc, char **argv)
+{
+	struct flows flows = {};
+	int longindex = 0;
+	int buckets = 64;
+	int synthetic = 0;
+	bool l4 = true;
+	int opt, i;
+
+	while ((opt = getopt_long(argc, argv, "hb:3s:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'b':
+			buckets = atoi(optarg);
+			break;
+		case '3':
+			l4 = false;
+			break;
+		case 's':
+			synthetic = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	if (buckets < 2 || (optind >= argc && synthetic <= 0)) {
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+
+	for (i = optind; i < argc; i++)
+		if (read_pcap(argv[i], l4, &flows))
+			return EXIT_FAIL_PCAP;
+	if (synthetic > 0)
+		synthetic_flows(synthetic, l4, &flows);
+	flows_unique(&flows);
+
+	if (flows.cnt < buckets * 5)
+		fprintf(stderr, "WARN: only %zu flows for %d buckets,"
+			" chi-square is unreliable\n", flows.cnt, buckets);
+
+	printf("%s flows: %zu, buckets: %d\n", l4 ? "L4" : "L3",
+	       flows.cnt, buckets);
+	printf("%-14s %-10s %-8s %-8s\n", "hash", "chi2/df", "z", "max/avg");
+	for (i = 0; i < HASH_MAX; i++)
+		spread_print(i, &flows, buckets);
+
+	free(flows.keys);
+	return EXIT_OK;
+}
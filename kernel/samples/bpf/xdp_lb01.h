@@ -0,0 +1,87 @@
+#ifndef __XDP_LB01_H__
+#define __XDP_LB01_H__
+
+/* Shared between xdp_lb01 _kern.c and _user.c
+ *
+ * L4 load balancer, see Documentation/networking/XDP/use-cases/
+ * xdp_use_case_load_balancer.rst.  Packets to a VIP are forwarded,
+ * via XDP_TX, IPIP or GUE encapsulated to a backend ("real server"),
+ * which replies directly to the client (direct server return).
+ */
+
+#define LB_VIPS_MAX	512
+#define LB_BACKENDS_MAX	4096
+#define LB_CONNS_MAX	(1024 * 1024)
+
+/* Maglev lookup table per VIP, of ch_rings[vip_num * LB_RING_SIZE].
+ * Must be prime, and much larger than the backends of a VIP.
+ */
+#define LB_RING_SIZE	4093
+
+/* Default GUE variant 1 (direct IP in UDP) port, as Katran */
+#define LB_GUE_PORT	6080
+
+/* Key of vip_map, port 0 matches all ports of the addr and proto */
+struct vip_key {
+	__be32 addr;
+	__be16 port;
+	__u8 proto;
+	__u8 pad;
+};
+
+/* struct vip_meta flags */
+#define LB_F_GUE	(1U << 0)	/* GUE instead of IPIP encap */
+#define LB_F_NO_PORT	(1U << 1)	/* Hash without L4 ports */
+#define LB_F_NO_CONN	(1U << 2)	/* No conn_table, always hash */
+
+struct vip_meta {
+	__u32 vip_num;		/* Index of ch_rings and vip_stats */
+	__u32 flags;
+};
+
+/* Value of backends, addr 0 is an unused entry */
+struct backend {
+	__be32 addr;
+};
+
+/* Key of conn_table, the LRU keeps established flows on their
+ * backend when the ring changes.
+ */
+struct flow_key {
+	__be32 src;
+	__be32 dst;
+	__be16 sport;
+	__be16 dport;
+	__u8 proto;
+	__u8 pad[3];
+};
+
+struct conn_val {
+	__u32 backend_idx;
+};
+
+/* Global config, .rodata of _kern.c set before load */
+struct lb_config {
+	__u8 gw_mac[6];		/* Next hop to the backends */
+	__be16 gue_port;	/* UDP dest port of LB_F_GUE VIPs */
+	__be32 src_addr;	/* Outer source address */
+};
+
+/* Keys of lb_stats (PERCPU_ARRAY of __u64) */
+enum lb_stat {
+	LB_STAT_RX = 0,
+	LB_STAT_PASS,		/* Not IPv4/VIP, or fragment */
+	LB_STAT_CONN_HIT,
+	LB_STAT_CONN_NEW,	/* Backend from the Maglev table */
+	LB_STAT_NO_BACKEND,	/* Dropped */
+	LB_STAT_ENCAP_ERR,	/* Dropped, bpf_xdp_adjust_head failed */
+	LB_STAT_TX,
+	LB_STAT_MAX
+};
+
+struct vip_stats {
+	__u64 packets;
+	__u64 bytes;
+};
+
+#endif /* __XDP_LB01_H__ */
@@ -0,0 +1,302 @@
+/*  XDP L4 load balancer, IPIP or GUE encap to the backends via XDP_TX
+ *
+ *  Packets to a VIP {addr, port, proto} get a backend from the conntrack
+ *  LRU (conn_table), or on a miss from the Maglev consistent hash table
+ *  of the VIP (ch_rings), written by _user.c.  The backend decapsulates
+ *  and replies directly to the client.  Everything else is XDP_PASS.
+ *
+ *  GPLv2, Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#define KBUILD_MODNAME "foo"
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/in.h>
+#include <uapi/linux/udp.h>
+#include "bpf_helpers.h"
+
+#include "hash_func01.h"
+#include "xdp_lb01.h"
+
+/* From include/net/ip.h, not in uapi */
+#define IP_MF		0x2000	/* Flag: "More Fragments"	*/
+#define IP_OFFSET	0x1FFF	/* "Fragment Offset" part	*/
+
+#define INIT_SEED	15485863
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct vip_key);
+	__type(value, struct vip_meta);
+	__uint(max_entries, LB_VIPS_MAX);
+} vip_map SEC(".maps");
+
+/* Maglev table per VIP, key vip_num * LB_RING_SIZE + slot */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, u32);	/* Index into backends */
+	__uint(max_entries, LB_VIPS_MAX * LB_RING_SIZE);
+} ch_rings SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, struct backend);
+	__uint(max_entries, LB_BACKENDS_MAX);
+} backends SEC(".maps");
+
+/* Not per CPU, the flows of a RSS queue might move to another CPU */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, struct flow_key);
+	__type(value, struct conn_val);
+	__uint(max_entries, LB_CONNS_MAX);
+} conn_table SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, LB_STAT_MAX);
+} lb_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct vip_stats);
+	__uint(max_entries, LB_VIPS_MAX);
+} vip_stats SEC(".maps");
+
+/* Set by _user.c before load, see bpf_load_global_set().  A zero
+ * gue_port means LB_GUE_PORT.
+ */
+const volatile struct lb_config lb_cfg = {};
+
+static __always_inline void stat_inc(u32 key)
+{
+	u64 *cnt = bpf_map_lookup_elem(&lb_stats, &key);
+
+	if (cnt)
+		*cnt += 1;
+}
+
+static __always_inline
+u16 csum_fold_helper(u32 csum)
+{
+	csum = (csum & 0xffff) + (csum >> 16);
+	csum = (csum & 0xffff) + (csum >> 16);
+	return ~csum;
+}
+
+/* Outer header has no options, thus a fixed 10 words, see xdp_ttl_kern.c */
+static __always_inline
+void ipv4_csum_outer(struct iphdr *iph)
+{
+	u16 *word = (u16 *)iph;
+	u32 csum = 0;
+	int i;
+
+	iph->check = 0;
+#pragma unroll
+	for (i = 0; i < sizeof(*iph) / 2; i++)
+		csum += word[i];
+	iph->check = csum_fold_helper(csum);
+}
+
+static __always_inline
+struct backend *backend_get(u32 idx)
+{
+	struct backend *be = bpf_map_lookup_elem(&backends, &idx);
+
+	/* Removed backends are zeroed, and purged from the rings */
+	if (!be || !be->addr)
+		return NULL;
+	return be;
+}
+
+/* Established flows stay on their backend, also when the Maglev table
+ * of the VIP changes.  LB_F_NO_CONN VIPs skip conn_table (for UDP VIPs,
+ * or to avoid the LRU under SYN floods), as Maglev alone already moves
+ * few flows on backend changes.
+ */
+static __always_inline
+struct backend *backend_select(struct vip_meta *vip, struct flow_key *fk,
+			       u32 hash)
+{
+	struct conn_val *conn, new_conn;
+	int use_conn = !(vip->flags & LB_F_NO_CONN);
+	struct backend *be;
+	u32 key, *idx;
+
+	if (use_conn) {
+		conn = bpf_map_lookup_elem(&conn_table, fk);
+		if (conn) {
+			be = backend_get(conn->backend_idx);
+			if (be) {
+				stat_inc(LB_STAT_CONN_HIT);
+				return be;
+			}
+		}
+	}
+
+	key = vip->vip_num * LB_RING_SIZE + hash % LB_RING_SIZE;
+	idx = bpf_map_lookup_elem(&ch_rings, &key);
+	if (!idx)
+		return NULL;
+	be = backend_get(*idx);
+	if (!be)
+		return NULL;
+	stat_inc(LB_STAT_CONN_NEW);
+
+	if (use_conn) {
+		new_conn.backend_idx = *idx;
+		bpf_map_update_elem(&conn_table, fk, &new_conn, BPF_ANY);
+	}
+	return be;
+}
+
+/* Push the outer IPv4 (and UDP for GUE) header in front of the inner
+ * IP header.  The Ethernet header moves up, to the gateway towards the
+ * backends, with our MAC (the original destination) as source.
+ */
+static __always_inline
+int encap(struct xdp_md *ctx, struct backend *be, u32 flags, u32 hash)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct iphdr *inner = data + sizeof(*eth);
+	int hdr_len = sizeof(struct iphdr);
+	u8 src_mac[ETH_ALEN];
+	struct iphdr *outer;
+	u16 inner_len;
+	u8 tos;
+	int i;
+
+	if ((void *)(inner + 1) > data_end)
+		return -1;
+	__builtin_memcpy(src_mac, eth->h_dest, ETH_ALEN);
+	inner_len = ntohs(inner->tot_len);
+	tos = inner->tos;
+
+	if (flags & LB_F_GUE)
+		hdr_len += sizeof(struct udphdr);
+	if (bpf_xdp_adjust_head(ctx, 0 - hdr_len))
+		return -1;
+
+	/* Packet pointers are invalidated by bpf_xdp_adjust_head() */
+	data_end = (void *)(long)ctx->data_end;
+	data     = (void *)(long)ctx->data;
+	eth = data;
+	outer = data + sizeof(*eth);
+	if ((void *)(outer + 1) > data_end)
+		return -1;
+
+	for (i = 0; i < ETH_ALEN; i++)
+		eth->h_dest[i] = lb_cfg.gw_mac[i];
+	__builtin_memcpy(eth->h_source, src_mac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	outer->version	= 4;
+	outer->ihl	= sizeof(*outer) >> 2;
+	outer->tos	= tos;
+	outer->tot_len	= htons(inner_len + hdr_len);
+	outer->id	= 0;
+	outer->frag_off	= 0;
+	outer->ttl	= 64;
+	outer->saddr	= lb_cfg.src_addr;
+	outer->daddr	= be->addr;
+
+	if (flags & LB_F_GUE) {
+		struct udphdr *udph = (void *)(outer + 1);
+
+		if ((void *)(udph + 1) > data_end)
+			return -1;
+		outer->protocol = IPPROTO_UDP;
+		/* Flow entropy for RSS on the backend, in the ephemeral range */
+		udph->source = htons((hash & 0x3fff) | 0xc000);
+		udph->dest   = lb_cfg.gue_port ? : htons(LB_GUE_PORT);
+		udph->len    = htons(inner_len + sizeof(*udph));
+		udph->check  = 0; /* Optional for IPv4 */
+	} else {
+		outer->protocol = IPPROTO_IPIP;
+	}
+	ipv4_csum_outer(outer);
+	return 0;
+}
+
+SEC("xdp_lb01")
+int xdp_lb01_prog(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct flow_key fk = {};
+	struct vip_key vk = {};
+	struct vip_stats *vs;
+	struct vip_meta *vip;
+	struct backend *be;
+	struct iphdr *iph;
+	__be16 *ports;
+	u32 hash;
+
+	stat_inc(LB_STAT_RX);
+
+	/* VLAN frames are passed, the backends are on the untagged link */
+	if ((void *)(eth + 1) > data_end || eth->h_proto != htons(ETH_P_IP))
+		goto pass;
+	iph = (void *)(eth + 1);
+	if ((void *)(iph + 1) > data_end)
+		goto pass;
+	if (iph->ihl != 5 || iph->frag_off & htons(IP_MF | IP_OFFSET))
+		goto pass;
+	if (iph->protocol != IPPROTO_TCP && iph->protocol != IPPROTO_UDP)
+		goto pass;
+	ports = (void *)(iph + 1);
+	if ((void *)(ports + 2) > data_end)
+		goto pass;
+
+	vk.addr  = iph->daddr;
+	vk.port  = ports[1];
+	vk.proto = iph->protocol;
+	vip = bpf_map_lookup_elem(&vip_map, &vk);
+	if (!vip) {
+		vk.port = 0;
+		vip = bpf_map_lookup_elem(&vip_map, &vk);
+		if (!vip)
+			goto pass;
+	}
+
+	fk.src   = iph->saddr;
+	fk.dst   = iph->daddr;
+	fk.proto = iph->protocol;
+	if (!(vip->flags & LB_F_NO_PORT)) {
+		fk.sport = ports[0];
+		fk.dport = ports[1];
+	}
+	hash = SuperFastHash((char *)&fk, sizeof(fk), INIT_SEED);
+
+	vs = bpf_map_lookup_elem(&vip_stats, &vip->vip_num);
+	if (vs) {
+		vs->packets++;
+		vs->bytes += data_end - data;
+	}
+
+	be = backend_select(vip, &fk, hash);
+	if (!be) {
+		stat_inc(LB_STAT_NO_BACKEND);
+		return XDP_DROP;
+	}
+	if (encap(ctx, be, vip->flags, hash)) {
+		stat_inc(LB_STAT_ENCAP_ERR);
+		return XDP_DROP;
+	}
+	stat_inc(LB_STAT_TX);
+	return XDP_TX;
+pass:
+	stat_inc(LB_STAT_PASS);
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,624 @@
+/* Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP L4 load balancer, IPIP or GUE (--gue) encap to the backends\n"
+ "\n"
+ " Each --vip ADDR:PORT/tcp|udp (port 0 for all ports) gets the\n"
+ " following --backend ADDR options.  Backends are picked per flow via\n"
+ " a Maglev consistent hash table per VIP, and kept in a conntrack LRU\n"
+ " (unless --no-conn).  Encapsulated packets go back out the same\n"
+ " --dev via XDP_TX, to the --gw-mac next hop, with --src as outer\n"
+ " source.  The backends decap and reply directly to the clients.\n"
+ "\n"
+ " --bench runs the program via BPF_PROG_TEST_RUN, without a device,\n"
+ " for pps versus the number of VIPs and backends.";
+
+#include <linux/bpf.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "xdp_stats.h"
+#include "xdp_lb01.h"
+
+static int ifindex = -1;
+static char ifname_buf[IF_NAMESIZE];
+static char *ifname;
+
+static __u32 xdp_flags;
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_XDP		3
+#define EXIT_FAIL_BPF		4
+#define EXIT_FAIL_MEM		5
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"vip",		required_argument,	NULL, 'v' },
+	{"backend",	required_argument,	NULL, 'b' },
+	{"gue",		no_argument,		NULL, 'g' },
+	{"no-conn",	no_argument,		NULL, 'n' },
+	{"no-port",	no_argument,		NULL, 'p' },
+	{"gw-mac",	required_argument,	NULL, 'm' },
+	{"src",		required_argument,	NULL, 'a' },
+	{"gue-port",	required_argument,	NULL, 'u' },
+	{"sec",		required_argument,	NULL, 's' },
+	{"bench",	no_argument,		NULL, 'B' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("  --gue, --no-conn and --no-port apply to the last --vip\n");
+	printf("\n");
+}
+
+/* Maglev wants a table much larger than the backends of a VIP, for
+ * an even spread (M >= 100 * N in the paper).
+ */
+#define VIP_BACKENDS_MAX	64
+
+struct vip {
+	struct vip_key key;
+	struct vip_meta meta;
+	__u32 backend_idx[VIP_BACKENDS_MAX];
+	int nr_backends;
+};
+
+static struct vip vips[LB_VIPS_MAX];
+static int nr_vips;
+
+/* Index into the backends map, shared between VIPs */
+static __be32 backend_addrs[LB_BACKENDS_MAX];
+static int nr_backend_addrs;
+
+static int backend_idx_get(__be32 addr)
+{
+	int i;
+
+	for (i = 0; i < nr_backend_addrs; i++)
+		if (backend_addrs[i] == addr)
+			return i;
+	if (nr_backend_addrs == LB_BACKENDS_MAX)
+		return -1;
+	backend_addrs[nr_backend_addrs] = addr;
+	return nr_backend_addrs++;
+}
+
+static int parse_vip(const char *arg, struct vip_key *key)
+{
+	char buf[64], *port, *proto;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	port = strchr(buf, ':');
+	proto = strchr(buf, '/');
+	if (!port || !proto || proto < port)
+		return -1;
+	*port++ = '\0';
+	*proto++ = '\0';
+
+	memset(key, 0, sizeof(*key));
+	if (inet_pton(AF_INET, buf, &key->addr) != 1)
+		return -1;
+	key->port = htons(atoi(port));
+	if (!strcmp(proto, "tcp"))
+		key->proto = IPPROTO_TCP;
+	else if (!strcmp(proto, "udp"))
+		key->proto = IPPROTO_UDP;
+	else
+		return -1;
+	return 0;
+}
+
+static int parse_mac(const char *arg, __u8 *mac)
+{
+	if (sscanf(arg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1],
+		   &mac[2], &mac[3], &mac[4], &mac[5]) != ETH_ALEN)
+		return -1;
+	return 0;
+}
+
+/* Maglev table population, as maglev_populate() in
+ * xdp_redirect_cpu_user.c.  The permutation of a backend depends on
+ * its address, thus the table is stable across --backend ordering and
+ * VIPs, and table[slot] is the position in @addrs.
+ */
+static __u32 maglev_hash(__u32 x, __u32 seed)
+{
+	/* Murmur3 finalizer, good avalanche for small integers */
+	x ^= seed;
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+	return x;
+}
+
+static void maglev_populate(__u32 *table, const __be32 *addrs, int n)
+{
+	__u32 offset[VIP_BACKENDS_MAX], skip[VIP_BACKENDS_MAX];
+	__u32 next[VIP_BACKENDS_MAX];
+	__u32 slot, filled = 0;
+	int i;
+
+	for (slot = 0; slot < LB_RING_SIZE; slot++)
+		table[slot] = ~0U; /* Empty */
+
+	for (i = 0; i < n; i++) {
+		offset[i] = maglev_hash(ntohl(addrs[i]), 0x9e3779b9) %
+			LB_RING_SIZE;
+		skip[i] = maglev_hash(ntohl(addrs[i]), 0x7f4a7c15) %
+			(LB_RING_SIZE - 1) + 1;
+		next[i] = 0;
+	}
+	while (n > 0) {
+		for (i = 0; i < n; i++) {
+			do {
+				slot = (offset[i] + (__u64)next[i] * skip[i]) %
+					LB_RING_SIZE;
+				next[i]++;
+			} while (table[slot] != ~0U);
+			table[slot] = i;
+			if (++filled == LB_RING_SIZE)
+				return;
+		}
+	}
+}
+
+/* Backends, then the ring, then the VIP, thus the VIP never points to
+ * a half written ring.
+ */
+static int vip_write(struct vip *v)
+{
+	int ring_fd = bpf_load_map_fd("ch_rings");
+	__be32 addrs[VIP_BACKENDS_MAX];
+	static __u32 table[LB_RING_SIZE];
+	struct backend be = {};
+	__u32 slot, key, idx;
+	int i;
+
+	for (i = 0; i < v->nr_backends; i++) {
+		idx = v->backend_idx[i];
+		addrs[i] = be.addr = backend_addrs[idx];
+		if (bpf_map_update_elem(bpf_load_map_fd("backends"), &idx,
+					&be, 0))
+			goto err;
+	}
+	maglev_populate(table, addrs, v->nr_backends);
+	for (slot = 0; slot < LB_RING_SIZE; slot++) {
+		key = v->meta.vip_num * LB_RING_SIZE + slot;
+		idx = v->backend_idx[table[slot]];
+		if (bpf_map_update_elem(ring_fd, &key, &idx, 0))
+			goto err;
+	}
+	if (bpf_map_update_elem(bpf_load_map_fd("vip_map"), &v->key,
+				&v->meta, 0))
+		goto err;
+	return 0;
+err:
+	fprintf(stderr, "ERR: map update VIP:%d err(%d):%s\n",
+		v->meta.vip_num, errno, strerror(errno));
+	return -1;
+}
+
+static void vips_clear(void)
+{
+	int fd = bpf_load_map_fd("vip_map");
+	struct vip_key key, next;
+
+	while (bpf_map_get_next_key(fd, NULL, &next) == 0) {
+		key = next;
+		bpf_map_delete_elem(fd, &key);
+	}
+}
+
+static const char *vip_str(const struct vip *v, char *buf, size_t len)
+{
+	char addr[INET_ADDRSTRLEN];
+
+	inet_ntop(AF_INET, &v->key.addr, addr, sizeof(addr));
+	snprintf(buf, len, "%s:%u/%s", addr, ntohs(v->key.port),
+		 v->key.proto == IPPROTO_TCP ? "tcp" : "udp");
+	return buf;
+}
+
+static const char *lb_stat_names[LB_STAT_MAX] = {
+	[LB_STAT_RX]		= "rx",
+	[LB_STAT_PASS]		= "pass",
+	[LB_STAT_CONN_HIT]	= "conn-hit",
+	[LB_STAT_CONN_NEW]	= "conn-new",
+	[LB_STAT_NO_BACKEND]	= "no-backend",
+	[LB_STAT_ENCAP_ERR]	= "encap-err",
+	[LB_STAT_TX]		= "tx",
+};
+
+struct stats {
+	__u64 ts;
+	__u64 lb[LB_STAT_MAX];
+	struct vip_stats vip[LB_VIPS_MAX];
+};
+
+static void stats_collect(struct stats *s)
+{
+	s->ts = stats_gettime();
+	stats_percpu_array_sum(bpf_load_map_fd("lb_stats"), LB_STAT_MAX,
+			       s->lb, sizeof(s->lb[0]));
+	stats_percpu_array_sum(bpf_load_map_fd("vip_stats"), nr_vips,
+			       s->vip, sizeof(s->vip[0]));
+}
+
+static void stats_print(struct stats *cur, struct stats *prev)
+{
+	__u64 period = cur->ts - prev->ts;
+	char buf[64];
+	int i;
+
+	printf("%-14s %-14s\n", "counter", "pps");
+	for (i = 0; i < LB_STAT_MAX; i++)
+		printf("%-14s %'-14llu\n", lb_stat_names[i],
+		       stats_rate(cur->lb[i] - prev->lb[i], period));
+	printf("%-24s %-14s %-14s\n", "VIP", "pps", "Mbit/s");
+	for (i = 0; i < nr_vips; i++)
+		printf("%-24s %'-14llu %'-14llu\n",
+		       vip_str(&vips[i], buf, sizeof(buf)),
+		       stats_rate(cur->vip[i].packets - prev->vip[i].packets,
+				  period),
+		       stats_rate(cur->vip[i].bytes - prev->vip[i].bytes,
+				  period) * 8 / 1000000);
+	printf("\n");
+}
+
+static void stats_poll(int interval)
+{
+	struct stats *cur, *prev, *tmp;
+
+	cur = calloc(1, sizeof(*cur));
+	prev = calloc(1, sizeof(*prev));
+	if (!cur || !prev) {
+		fprintf(stderr, "ERR: Mem alloc error\n");
+		exit(EXIT_FAIL_MEM);
+	}
+	stats_collect(prev);
+	while (1) {
+		sleep(interval);
+		stats_collect(cur);
+		stats_print(cur, prev);
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+}
+
+static void int_exit(int sig)
+{
+	fprintf(stderr, "Interrupted: Removing XDP program on ifindex:%d device:%s\n",
+		ifindex, ifname);
+	if (ifindex > -1)
+		set_link_xdp_fd(ifindex, -1, xdp_flags);
+	exit(EXIT_OK);
+}
+
+/* --bench: Eth + IPv4 + TCP to a VIP, distinct flows from the client
+ * addresses 10.0.x.y.
+ */
+#define BENCH_FLOWS	64
+#define BENCH_PKT_LEN	(ETH_HLEN + sizeof(struct iphdr) + sizeof(struct tcphdr))
+
+static void bench_pkt(unsigned char *pkt, __be32 vip, int flow)
+{
+	struct ethhdr *eth = (void *)pkt;
+	struct iphdr *iph = (void *)(eth + 1);
+	struct tcphdr *tcph = (void *)(iph + 1);
+
+	memset(pkt, 0, BENCH_PKT_LEN);
+	eth->h_proto = htons(ETH_P_IP);
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->tot_len = htons(BENCH_PKT_LEN - ETH_HLEN);
+	iph->protocol = IPPROTO_TCP;
+	iph->saddr = htonl(0x0a000000 + flow * 7919 + 1);
+	iph->daddr = vip;
+	tcph->source = htons(1024 + flow);
+	tcph->dest = htons(80);
+	tcph->ack = 1;
+	tcph->doff = 5;
+}
+
+/* Replaces vips[] by @n VIPs 198.18.0.x:80/tcp of @nr_be backends each */
+static int bench_setup(int n, int nr_be, __u32 flags)
+{
+	int i, j;
+
+	vips_clear();
+	nr_backend_addrs = 0;
+	for (i = 0; i < n; i++) {
+		struct vip *v = &vips[i];
+
+		memset(v, 0, sizeof(*v));
+		v->key.addr = htonl(0xc6120000 + i);
+		v->key.port = htons(80);
+		v->key.proto = IPPROTO_TCP;
+		v->meta.vip_num = i;
+		v->meta.flags = flags;
+		for (j = 0; j < nr_be; j++)
+			v->backend_idx[j] =
+				backend_idx_get(htonl(0xc6130000 +
+						      (i * nr_be + j) %
+						      LB_BACKENDS_MAX));
+		v->nr_backends = nr_be;
+		if (vip_write(v))
+			return -1;
+	}
+	nr_vips = n;
+	return 0;
+}
+
+/* Average ns per packet over BENCH_FLOWS flows spread over the VIPs */
+static int bench_run(int repeat, double *ns)
+{
+	unsigned char pkt[BENCH_PKT_LEN];
+	unsigned char out[BENCH_PKT_LEN + 64];
+	__u32 duration, retval, size;
+	__u64 total = 0;
+	int i;
+
+	for (i = 0; i < BENCH_FLOWS; i++) {
+		bench_pkt(pkt, vips[i % nr_vips].key.addr, i);
+		if (bpf_prog_test_run(prog_fd[0], repeat, pkt, sizeof(pkt),
+				      out, &size, &retval, &duration)) {
+			fprintf(stderr, "ERR: BPF_PROG_TEST_RUN err(%d):%s\n",
+				errno, strerror(errno));
+			return -1;
+		}
+		if (retval != XDP_TX) {
+			fprintf(stderr, "ERR: unexpected retval %u\n", retval);
+			return -1;
+		}
+		total += duration;
+	}
+	*ns = (double)total / BENCH_FLOWS;
+	return 0;
+}
+
+static int bench(int repeat)
+{
+	static const int bench_vips[] = { 1, 64, LB_VIPS_MAX };
+	static const int bench_backends[] = { 4, VIP_BACKENDS_MAX };
+	static const struct {
+		const char *name;
+		__u32 flags;
+	} modes[] = {
+		{ "conn-hit",	0 },
+		{ "hash-only",	LB_F_NO_CONN },
+		{ "gue-hit",	LB_F_GUE },
+	};
+	unsigned int nr_v = sizeof(bench_vips) / sizeof(bench_vips[0]);
+	unsigned int nr_b = sizeof(bench_backends) / sizeof(bench_backends[0]);
+	unsigned int nr_m = sizeof(modes) / sizeof(modes[0]);
+	unsigned int v, b, m;
+	double ns;
+
+	printf("%-6s %-9s %-10s %-10s %-8s\n",
+	       "VIPs", "backends", "mode", "ns/pkt", "Mpps");
+	for (v = 0; v < nr_v; v++) {
+		for (b = 0; b < nr_b; b++) {
+			for (m = 0; m < nr_m; m++) {
+				if (bench_setup(bench_vips[v], bench_backends[b],
+						modes[m].flags))
+					return EXIT_FAIL_BPF;
+				if (bench_run(repeat, &ns))
+					return EXIT_FAIL_BPF;
+				printf("%-6d %-9d %-10s %-10.1f %-8.2f\n",
+				       bench_vips[v], bench_backends[b],
+				       modes[m].name, ns, 1000 / ns);
+			}
+		}
+	}
+	return EXIT_OK;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	struct lb_config cfg = {};
+	bool do_bench = false;
+	int longindex = 0, opt, i;
+	int repeat = 100000;
+	int interval = 2;
+	char filename[256];
+	struct vip *v = NULL;
+	__be32 addr;
+	int idx;
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	while ((opt = getopt_long(argc, argv, "hd:Sv:b:gnpm:a:u:s:Br:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'd':
+			if (strlen(optarg) >= IF_NAMESIZE) {
+				fprintf(stderr, "ERR: --dev name too long\n");
+				goto error;
+			}
+			ifname = (char *)&ifname_buf;
+			strncpy(ifname, optarg, IF_NAMESIZE);
+			ifindex = if_nametoindex(ifname);
+			if (ifindex == 0) {
+				fprintf(stderr,
+					"ERR: --dev name unknown err(%d):%s\n",
+					errno, strerror(errno));
+				goto error;
+			}
+			break;
+		case 'S':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 'v':
+			if (nr_vips == LB_VIPS_MAX) {
+				fprintf(stderr, "ERR: max %d --vip\n",
+					LB_VIPS_MAX);
+				goto error;
+			}
+			v = &vips[nr_vips];
+			if (parse_vip(optarg, &v->key)) {
+				fprintf(stderr, "ERR: --vip ADDR:PORT/tcp|udp\n");
+				goto error;
+			}
+			v->meta.vip_num = nr_vips++;
+			break;
+		case 'b':
+			if (!v || v->nr_backends == VIP_BACKENDS_MAX) {
+				fprintf(stderr,
+					"ERR: --backend after --vip, max %d\n",
+					VIP_BACKENDS_MAX);
+				goto error;
+			}
+			if (inet_pton(AF_INET, optarg, &addr) != 1 || !addr ||
+			    (idx = backend_idx_get(addr)) < 0) {
+				fprintf(stderr, "ERR: --backend %s\n", optarg);
+				goto error;
+			}
+			v->backend_idx[v->nr_backends++] = idx;
+			break;
+		case 'g':
+		case 'n':
+		case 'p':
+			if (!v) {
+				fprintf(stderr,
+					"ERR: --gue, --no-conn, --no-port after --vip\n");
+				goto error;
+			}
+			v->meta.flags |= opt == 'g' ? LB_F_GUE :
+					 opt == 'n' ? LB_F_NO_CONN :
+						      LB_F_NO_PORT;
+			break;
+		case 'm':
+			if (parse_mac(optarg, cfg.gw_mac)) {
+				fprintf(stderr, "ERR: --gw-mac xx:xx:xx:xx:xx:xx\n");
+				goto error;
+			}
+			break;
+		case 'a':
+			if (inet_pton(AF_INET, optarg, &cfg.src_addr) != 1) {
+				fprintf(stderr, "ERR: --src %s\n", optarg);
+				goto error;
+			}
+			break;
+		case 'u':
+			cfg.gue_port = htons(atoi(optarg));
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 'B':
+			do_bench = true;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'h':
+		error:
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	if (!do_bench) {
+		if (ifindex == -1 || !nr_vips) {
+			fprintf(stderr, "ERR: required option --dev or --vip missing\n");
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+		for (i = 0; i < nr_vips; i++) {
+			if (!vips[i].nr_backends) {
+				fprintf(stderr, "ERR: --vip without --backend\n");
+				return EXIT_FAIL_OPTION;
+			}
+		}
+		if (!cfg.src_addr) {
+			fprintf(stderr, "ERR: required option --src missing\n");
+			return EXIT_FAIL_OPTION;
+		}
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (bpf_load_global_set("lb_cfg", &cfg, sizeof(cfg))) {
+		fprintf(stderr, "ERR: bpf_load config\n");
+		return EXIT_FAIL_BPF;
+	}
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (!prog_fd[0]) {
+		printf("load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL_BPF;
+	}
+
+	setlocale(LC_NUMERIC, "en_US");
+	if (do_bench)
+		return bench(repeat);
+
+	for (i = 0; i < nr_vips; i++)
+		if (vip_write(&vips[i]))
+			return EXIT_FAIL_BPF;
+
+	signal(SIGINT, int_exit);
+	signal(SIGTERM, int_exit);
+
+	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+
+	stats_poll(interval);
+	return EXIT_OK;
+}
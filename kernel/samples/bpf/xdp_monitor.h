@@ -0,0 +1,26 @@
+#ifndef __XDP_MONITOR_H__
+#define __XDP_MONITOR_H__
+
+/* Shared struct between _user & _kern */
+
+/* Redirect bulking, devmap flush is max DEV_MAP_BULK_SIZE (16) frames
+ * and cpumap kthread dequeue CPUMAP_BATCH (8), last bucket is
+ * overflow in-case kernel changes these.
+ */
+#define BULK_HIST_MAX	17
+
+enum bulk_hist_t {
+	BULK_DEVMAP_XMIT = 0,
+	BULK_CPUMAP_KTHREAD,
+	BULK_TYPE_MAX
+};
+
+struct bulk_histogram {
+	/* Keep counters per bulk size, per tracepoint event */
+	__u64 hist[BULK_HIST_MAX];
+	__u64 events;
+	__u64 pkts;
+	__u64 drops;
+};
+
+#endif /* __XDP_MONITOR_H__ */
@@ -5,6 +5,8 @@
 #include <uapi/linux/bpf.h>
 #include "bpf_helpers.h"
 
+#include "xdp_monitor.h"
+
 struct bpf_map_def SEC("maps") redirect_err_cnt = {
 	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
 	.key_size = sizeof(u32),
@@ -13,6 +15,14 @@ struct bpf_map_def SEC("maps") redirect_err_cnt = {
 	/* TODO: have entries for all possible errno's */
 };
 
+/* Indexed by enum bulk_hist_t */
+struct bpf_map_def SEC("maps") bulk_hist = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct bulk_histogram),
+	.max_entries = BULK_TYPE_MAX,
+};
+
 /* Tracepoint format: /sys/kernel/debug/tracing/events/xdp/xdp_redirect/format
  * Code in:                kernel/include/trace/events/xdp.h
  */
@@ -87,3 +97,67 @@ int trace_xdp_redirect_map(struct xdp_redirect_ctx *ctx)
 	return xdp_redirect_collect_stat(ctx);
 }
 
+
+static __always_inline
+void bulk_hist_record(u32 type, unsigned int bulk, unsigned int drops)
+{
+	struct bulk_histogram *h;
+
+	h = bpf_map_lookup_elem(&bulk_hist, &type);
+	if (!h)
+		return;
+	h->events++;
+	h->pkts  += bulk;
+	h->drops += drops;
+	if (bulk >= BULK_HIST_MAX)
+		bulk = BULK_HIST_MAX - 1;
+	h->hist[bulk]++;
+}
+
+/* Tracepoint: /sys/kernel/debug/tracing/events/xdp/xdp_devmap_xmit/format
+ * Code in:         kernel/include/trace/events/xdp.h
+ *
+ * Layout before offset:20 changed between kernels (map_id removed in
+ * v5.8), only access drops and sent, which stayed put.
+ */
+struct devmap_xmit_ctx {
+	u64 __pad;		// First 8 bytes are not accessible by bpf code
+	int __unused1;		//	offset:8;  size:4;
+	u32 act;		//	offset:12; size:4; signed:0;
+	int __unused2;		//	offset:16; size:4;
+	int drops;		//	offset:20; size:4; signed:1;
+	int sent;		//	offset:24; size:4; signed:1;
+};
+
+/* Called per devmap flush, thus bulk is frames per ndo_xdp_xmit call */
+SEC("tracepoint/xdp/xdp_devmap_xmit")
+int trace_xdp_devmap_xmit(struct devmap_xmit_ctx *ctx)
+{
+	int sent = ctx->sent, drops = ctx->drops;
+
+	if (sent < 0 || drops < 0)
+		return 0;
+	bulk_hist_record(BULK_DEVMAP_XMIT, sent + drops, drops);
+	return 0;
+}
+
+/* Tracepoint: /sys/kernel/debug/tracing/events/xdp/xdp_cpumap_kthread/format
+ * Code in:         kernel/include/trace/events/xdp.h
+ */
+struct cpumap_kthread_ctx {
+	u64 __pad;		// First 8 bytes are not accessible by bpf code
+	int map_id;		//	offset:8;  size:4; signed:1;
+	u32 act;		//	offset:12; size:4; signed:0;
+	int cpu;		//	offset:16; size:4; signed:1;
+	unsigned int drops;	//	offset:20; size:4; signed:0;
+	unsigned int processed;	//	offset:24; size:4; signed:0;
+	int sched;		//	offset:28; size:4; signed:1;
+};
+
+/* Called per kthread dequeue loop, bulk 0 is a wakeup without frames */
+SEC("tracepoint/xdp/xdp_cpumap_kthread")
+int trace_xdp_cpumap_kthread(struct cpumap_kthread_ctx *ctx)
+{
+	bulk_hist_record(BULK_CPUMAP_KTHREAD, ctx->processed, ctx->drops);
+	return 0;
+}
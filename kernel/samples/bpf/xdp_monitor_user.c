@@ -2,6 +2,10 @@
  */
 static const char *__doc__=
  "XDP monitor tool, based on tracepoints\n"
+ "\n"
+ " Redirect bulking is shown as histograms of frames per devmap flush\n"
+ " (xdp_devmap_xmit) and per cpumap kthread dequeue (xdp_cpumap_kthread),\n"
+ " a dropping average bulk under load indicate bulking degrades.\n"
 ;
 
 static const char *__doc_err_only__=
@@ -10,6 +14,12 @@ static const char *__doc_err_only__=
  "         (which comes with a per packet processing overhead)\n"
 ;
 
+static const char *__doc_sample__=
+ " NOTICE: Success stats are sampled, the per packet tracepoints are\n"
+ "         only attached a '--sample' percentage of each period, and\n"
+ "         pps is scaled by the attached time\n"
+;
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,19 +33,34 @@ static const char *__doc_err_only__=
 #include <getopt.h>
 #include <net/if.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
 
 #include "libbpf.h"
 #include "bpf_load.h"
 #include "bpf_util.h"
 
+/* perf related */
+#include <linux/perf_event.h>
+#include "perf-sys.h"
+
+#include "xdp_monitor.h"
+#include "xdp_stats.h"
+
 static int verbose = 1;
 static bool debug = false;
+static int sample_pct;		/* Zero is not sampling */
+static bool overhead;
+static struct stats_output stats_out;
 
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"debug",	no_argument,		NULL, 'D' },
 	{"stats",	no_argument,		NULL, 'S' },
 	{"sec", 	required_argument,	NULL, 's' },
+	{"sample",	required_argument,	NULL, 'p' },
+	{"overhead",	no_argument,		NULL, 'o' },
+	{"format",	required_argument,	NULL, 'F' },
 	{0, 0, NULL,  0 }
 };
 
@@ -60,20 +85,6 @@ static void usage(char *argv[])
 	printf("\n");
 }
 
-#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
-__u64 gettime(void)
-{
-	struct timespec t;
-	int res;
-
-	res = clock_gettime(CLOCK_MONOTONIC, &t);
-	if (res < 0) {
-		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
-		exit(EXIT_FAILURE);
-	}
-	return (__u64) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
-}
-
 enum {
 	REDIR_SUCCESS = 0,
 	REDIR_ERROR = 1,
@@ -95,14 +106,25 @@ struct record {
 	__u64 timestamp;
 };
 
+static const char *bulk_names[BULK_TYPE_MAX] = {
+	[BULK_DEVMAP_XMIT]	= "devmap_xmit",
+	[BULK_CPUMAP_KTHREAD]	= "cpumap_kthread",
+};
+
 struct stats_record {
 	struct record xdp_redir[REDIR_RES_MAX];
+	__u64 attached_ns;	/* Sampling: success tracepoints attached */
+	__u64 timestamp;
+	struct bulk_histogram bulk[BULK_TYPE_MAX];	/* Sum of all CPUs */
+	struct bulk_histogram *bulk_cpu[BULK_TYPE_MAX];	/* Per CPU */
 };
 
 static void stats_print_headers(bool err_only)
 {
 	if (err_only)
 		printf("\n%s\n", __doc_err_only__);
+	else if (sample_pct)
+		printf("\n%s\n", __doc_sample__);
 
 	printf("%-14s %-10s %-18s %-9s\n",
 	       "XDP_REDIRECT", "pps ", "pps-human-readable", "measure-period");
@@ -128,6 +150,9 @@ static void stats_print(struct stats_record *rec,
 		if (p->timestamp) {
 			packets = r->counter - p->counter;
 			period  = r->timestamp - p->timestamp;
+			/* Success only counted while attached */
+			if (sample_pct && i == REDIR_SUCCESS)
+				period = rec->attached_ns - prev->attached_ns;
 			if (period > 0) {
 				period_ = ((double) period / NANOSEC_PER_SEC);
 				pps = packets / period_;
@@ -139,70 +164,358 @@ static void stats_print(struct stats_record *rec,
 	}
 }
 
-static __u64 get_key32_value64_percpu(int fd, __u32 key)
+static void stats_print_bulk(struct stats_record *rec,
+			     struct stats_record *prev)
 {
-	/* For percpu maps, userspace gets a value per possible CPU */
 	unsigned int nr_cpus = bpf_num_possible_cpus();
-	__u64 values[nr_cpus];
-	__u64 sum = 0;
-	int i;
+	double period_, pps;
+	__u64 cnt, events, pkts, drops;
+	int t, i;
+
+	if (!prev->timestamp)
+		return;
+	period_ = ((double)(rec->timestamp - prev->timestamp) /
+		   NANOSEC_PER_SEC);
+
+	for (t = 0; t < BULK_TYPE_MAX; t++) {
+		struct bulk_histogram *r = &rec->bulk[t];
+		struct bulk_histogram *p = &prev->bulk[t];
+
+		events = r->events - p->events;
+		if (!events)
+			continue;
+		pkts  = r->pkts  - p->pkts;
+		drops = r->drops - p->drops;
+
+		printf("\nXDP %s bulking (measurement period: %f)\n",
+		       bulk_names[t], period_);
+		for (i = 0; i < BULK_HIST_MAX; i++) {
+			cnt = r->hist[i] - p->hist[i];
+			if (cnt) {
+				pps = (cnt * i) / period_;
+				printf("bulk[%02d]%s\t%llu\t( %'11.0f pps)\n",
+				       i, i == BULK_HIST_MAX - 1 ? "+" : "",
+				       cnt, pps);
+			}
+		}
+		printf("\t%llu\taverage bulk\t%.2f\t( %'11.0f pps)"
+		       " drops=%llu\n", events, (double)pkts / events,
+		       pkts / period_, drops);
+
+		/* Per CPU, as bulking is per CPU (devmap flush list) */
+		for (i = 0; i < nr_cpus; i++) {
+			struct bulk_histogram *rc = &rec->bulk_cpu[t][i];
+			struct bulk_histogram *pc = &prev->bulk_cpu[t][i];
+
+			events = rc->events - pc->events;
+			if (!events)
+				continue;
+			printf("\tcpu:%d\t%llu\taverage bulk\t%.2f\tdrops=%llu\n",
+			       i, events,
+			       (double)(rc->pkts - pc->pkts) / events,
+			       rc->drops - pc->drops);
+		}
+	}
+}
 
-	if ((bpf_map_lookup_elem(fd, &key, values)) != 0) {
-		fprintf(stderr,
-			"ERR: bpf_map_lookup_elem failed key:0x%X\n", key);
-		return 0;
+/* The prog_fd[i] and event_fd[i] depend on the order the functions
+ * was defined in _kern.c
+ */
+#ifndef ARRAY_SIZE
+# define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+#endif
+
+#define PROG_IDX_REDIRECT	2
+#define PROG_IDX_REDIRECT_MAP	3
+static const char *prog_names[] = {
+	"redirect_err", "redirect_map_err", "redirect", "redirect_map",
+	"devmap_xmit", "cpumap_kthread",
+};
+
+/* Attaching prog to tracepoint, like bpf_load.c does at load time */
+static int tracepoint_attach(const char *event, int fd)
+{
+	struct perf_event_attr attr = {};
+	char buf[256];
+	int efd, err;
+
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.sample_type = PERF_SAMPLE_RAW;
+	attr.sample_period = 1;
+	attr.wakeup_events = 1;
+
+	snprintf(buf, sizeof(buf),
+		 "/sys/kernel/debug/tracing/events/%s/id", event);
+	efd = open(buf, O_RDONLY, 0);
+	if (efd < 0)
+		return -1;
+	err = read(efd, buf, sizeof(buf) - 1);
+	close(efd);
+	if (err <= 0)
+		return -1;
+	buf[err] = 0;
+	attr.config = atoi(buf);
+
+	efd = sys_perf_event_open(&attr, -1/*pid*/, 0/*cpu*/, -1/*group_fd*/, 0);
+	if (efd < 0)
+		return -1;
+	if (ioctl(efd, PERF_EVENT_IOC_ENABLE, 0) < 0 ||
+	    ioctl(efd, PERF_EVENT_IOC_SET_BPF, fd) < 0) {
+		close(efd);
+		return -1;
 	}
+	return efd;
+}
 
-	/* Sum values from each CPU */
-	for (i = 0; i < nr_cpus; i++) {
-		sum += values[i];
+/* Closing the last event disable the tracepoint (static key) again,
+ * thus detached the per packet cost is gone, not just the counting.
+ */
+static void success_tracepoints(bool attach)
+{
+	if (!attach) {
+		close(event_fd[PROG_IDX_REDIRECT]);
+		close(event_fd[PROG_IDX_REDIRECT_MAP]);
+		event_fd[PROG_IDX_REDIRECT] = -1;
+		event_fd[PROG_IDX_REDIRECT_MAP] = -1;
+		return;
+	}
+	event_fd[PROG_IDX_REDIRECT] =
+		tracepoint_attach("xdp/xdp_redirect",
+				  prog_fd[PROG_IDX_REDIRECT]);
+	event_fd[PROG_IDX_REDIRECT_MAP] =
+		tracepoint_attach("xdp/xdp_redirect_map",
+				  prog_fd[PROG_IDX_REDIRECT_MAP]);
+	if (event_fd[PROG_IDX_REDIRECT] < 0 ||
+	    event_fd[PROG_IDX_REDIRECT_MAP] < 0) {
+		fprintf(stderr, "ERR: re-attach success tracepoints: %s\n",
+			strerror(errno));
+		exit(EXIT_FAILURE);
 	}
-	return sum;
+}
+
+/* Total time success tracepoints have been attached */
+static __u64 sample_attached_ns;
+
+/* Sleep interval, with success tracepoints attached sample_pct of it */
+static void sample_sleep(int interval)
+{
+	__u64 on = (__u64)interval * NANOSEC_PER_SEC / 100 * sample_pct;
+	__u64 t0, t1;
+
+	t0 = stats_gettime();
+	success_tracepoints(true);
+	usleep(on / 1000);
+	success_tracepoints(false);
+	t1 = stats_gettime();
+	sample_attached_ns += t1 - t0;
+	usleep(((__u64)interval * NANOSEC_PER_SEC - (t1 - t0)) / 1000);
+}
+
+/* Extended struct bpf_prog_info, run_time_ns/run_cnt added in v5.1.
+ * Kernel only collect these with sysctl kernel.bpf_stats_enabled=1.
+ */
+struct bpf_prog_info_v51 {
+	struct bpf_prog_info info;
+	__u32 btf_id;
+	__u32 func_info_rec_size;
+	__aligned_u64 func_info;
+	__u32 nr_func_info;
+	__u32 nr_line_info;
+	__aligned_u64 line_info;
+	__aligned_u64 jited_line_info;
+	__u32 nr_jited_line_info;
+	__u32 line_info_rec_size;
+	__u32 jited_line_info_rec_size;
+	__u32 nr_prog_tags;
+	__aligned_u64 prog_tags;
+	__u64 run_time_ns;
+	__u64 run_cnt;
+};
+
+struct prog_run {
+	__u64 run_time_ns;
+	__u64 run_cnt;
+};
+static struct prog_run prog_run_prev[MAX_PROGS];
+
+/* Report the monitor's own cost: BPF run time as share of one CPU */
+static void stats_print_overhead(double period_)
+{
+	struct bpf_prog_info_v51 info;
+	__u64 cnt, ns, total_ns = 0;
+	bool collected = false;
+	__u32 len;
+	int i;
+
+	printf("\nMonitor overhead (BPF prog run time)\n");
+	for (i = 0; i < prog_cnt && i < ARRAY_SIZE(prog_names); i++) {
+		memset(&info, 0, sizeof(info));
+		len = sizeof(info);
+		if (bpf_obj_get_info_by_fd(prog_fd[i], &info, &len) ||
+		    len < sizeof(info))
+			continue;
+		cnt = info.run_cnt - prog_run_prev[i].run_cnt;
+		ns  = info.run_time_ns - prog_run_prev[i].run_time_ns;
+		prog_run_prev[i].run_cnt = info.run_cnt;
+		prog_run_prev[i].run_time_ns = info.run_time_ns;
+		if (info.run_cnt)
+			collected = true;
+		if (!cnt)
+			continue;
+		total_ns += ns;
+		printf("%-18s %'12.0f events/s %6.1f ns/event\n",
+		       prog_names[i], cnt / period_, (double)ns / cnt);
+	}
+	if (!collected) {
+		printf(" (no data, needs: sysctl kernel.bpf_stats_enabled=1)\n");
+		return;
+	}
+	printf("%-18s %.3f%% of one CPU (excl. tracepoint call cost)\n",
+	       "total", total_ns / (period_ * NANOSEC_PER_SEC) * 100);
 }
 
 static bool stats_collect(int fd, struct stats_record *rec)
 {
 	int i;
 
+	__u64 sums[REDIR_RES_MAX];
+	__u64 now;
+
 	/* TODO: Detect if someone unloaded the perf event_fd's, as
 	 * this can happen by someone running perf-record -e
 	 */
+	if (stats_percpu_array_sum(fd, REDIR_RES_MAX, sums, sizeof(__u64)))
+		return false;
 
+	now = stats_gettime();
 	for (i = 0; i < REDIR_RES_MAX; i++) {
-		rec->xdp_redir[i].timestamp = gettime();
-		rec->xdp_redir[i].counter = get_key32_value64_percpu(fd, i);
+		rec->xdp_redir[i].timestamp = now;
+		rec->xdp_redir[i].counter = sums[i];
 	}
 	return true;
 }
 
+static bool stats_collect_bulk(int fd, struct stats_record *rec)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	struct bulk_histogram *sum;
+	__u32 key;
+	int i, j;
+
+	rec->timestamp = stats_gettime();
+	for (key = 0; key < BULK_TYPE_MAX; key++) {
+		if (bpf_map_lookup_elem(fd, &key, rec->bulk_cpu[key])) {
+			fprintf(stderr,
+				"ERR: bpf_map_lookup_elem failed key:0x%X\n",
+				key);
+			return false;
+		}
+		sum = &rec->bulk[key];
+		memset(sum, 0, sizeof(*sum));
+		for (i = 0; i < nr_cpus; i++) {
+			struct bulk_histogram *v = &rec->bulk_cpu[key][i];
+
+			for (j = 0; j < BULK_HIST_MAX; j++)
+				sum->hist[j] += v->hist[j];
+			sum->events += v->events;
+			sum->pkts   += v->pkts;
+			sum->drops  += v->drops;
+		}
+	}
+	return true;
+}
+
+/* Machine readable output, via --format */
+static void stats_export(struct stats_record *rec, struct stats_record *prev)
+{
+	__u64 period = prev->timestamp ? rec->timestamp - prev->timestamp : 0;
+	int i;
+
+	stats_output_begin(&stats_out, period);
+	for (i = 0; i < REDIR_RES_MAX; i++)
+		stats_output_metric(&stats_out, "redirect", "result",
+				    err2str(i), rec->xdp_redir[i].counter,
+				    rec->xdp_redir[i].counter -
+				    prev->xdp_redir[i].counter);
+	for (i = 0; i < BULK_TYPE_MAX; i++)
+		stats_output_metric(&stats_out, "bulk_events", "type",
+				    bulk_names[i], rec->bulk[i].events,
+				    rec->bulk[i].events - prev->bulk[i].events);
+	for (i = 0; i < BULK_TYPE_MAX; i++)
+		stats_output_metric(&stats_out, "bulk_packets", "type",
+				    bulk_names[i], rec->bulk[i].pkts,
+				    rec->bulk[i].pkts - prev->bulk[i].pkts);
+	for (i = 0; i < BULK_TYPE_MAX; i++)
+		stats_output_metric(&stats_out, "bulk_drops", "type",
+				    bulk_names[i], rec->bulk[i].drops,
+				    rec->bulk[i].drops - prev->bulk[i].drops);
+	stats_output_end(&stats_out);
+}
+
+static void stats_record_alloc(struct stats_record *rec)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	int t;
+
+	memset(rec, 0, sizeof(*rec));
+	for (t = 0; t < BULK_TYPE_MAX; t++) {
+		rec->bulk_cpu[t] = calloc(nr_cpus, sizeof(struct bulk_histogram));
+		if (!rec->bulk_cpu[t]) {
+			fprintf(stderr, "ERR: cannot alloc per CPU stats\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
 static void stats_poll(int interval, bool err_only)
 {
-	struct stats_record rec, prev;
-	int map_fd;
+	struct stats_record records[2], *rec, *prev, *tmp;
+	int map_fd, bulk_fd;
 
-	memset(&rec, 0, sizeof(rec));
+	stats_record_alloc(&records[0]);
+	stats_record_alloc(&records[1]);
+	rec  = &records[0];
+	prev = &records[1];
 
 	/* Trick to pretty printf with thousands separators use %' */
 	setlocale(LC_NUMERIC, "en_US");
 
+	map_fd = map_data[0].fd;
+	bulk_fd = map_data[1].fd; /* map: bulk_hist */
+
 	/* Header */
-	if (verbose)
+	if (verbose && stats_out.fmt == STATS_FMT_TEXT) {
 		printf("\n%s", __doc__);
-
-	/* TODO Need more advanced stats on error types */
-	if (verbose)
+		/* TODO Need more advanced stats on error types */
 		printf(" - Stats map: %s\n", map_data[0].name);
-	map_fd = map_data[0].fd;
-
-	stats_print_headers(err_only);
+	}
+	if (stats_out.fmt == STATS_FMT_TEXT)
+		stats_print_headers(err_only);
 	fflush(stdout);
 
 	while (1) {
-		memcpy(&prev, &rec, sizeof(rec));
-		stats_collect(map_fd, &rec);
-		stats_print(&rec, &prev, err_only);
+		/* Swap, as records own their per CPU arrays */
+		tmp = prev;
+		prev = rec;
+		rec = tmp;
+		stats_collect(map_fd, rec);
+		rec->attached_ns = sample_attached_ns;
+		if (!stats_collect_bulk(bulk_fd, rec))
+			exit(EXIT_FAILURE);
+		if (stats_out.fmt != STATS_FMT_TEXT) {
+			stats_export(rec, prev);
+		} else {
+			stats_print(rec, prev, err_only);
+			stats_print_bulk(rec, prev);
+		}
+		if (overhead && prev->timestamp)
+			stats_print_overhead((double)(rec->timestamp -
+					     prev->timestamp) / NANOSEC_PER_SEC);
 		fflush(stdout);
-		sleep(interval);
+		if (sample_pct)
+			sample_sleep(interval);
+		else
+			sleep(interval);
 	}
 }
 
@@ -244,6 +557,7 @@ int main(int argc, char **argv)
 	int interval = 2;
 
 	snprintf(bpf_obj_file, sizeof(bpf_obj_file), "%s_kern.o", argv[0]);
+	stats_output_init(&stats_out, "xdp_monitor", NULL);
 
 	/* Parse commands line args */
 	while ((opt = getopt_long(argc, argv, "h",
@@ -258,6 +572,23 @@ int main(int argc, char **argv)
 		case 's':
 			interval = atoi(optarg);
 			break;
+		case 'p':
+			sample_pct = atoi(optarg);
+			if (sample_pct <= 0 || sample_pct > 100) {
+				fprintf(stderr, "ERR: --sample 1-100 (pct)\n");
+				return EXIT_FAILURE;
+			}
+			errors_only = false;
+			if (sample_pct == 100)
+				sample_pct = 0; /* Same as --stats */
+			break;
+		case 'o':
+			overhead = true;
+			break;
+		case 'F':
+			if (stats_output_init(&stats_out, "xdp_monitor", optarg))
+				return EXIT_FAILURE;
+			break;
 		case 'h':
 		default:
 			usage(argv);
@@ -287,6 +618,9 @@ int main(int argc, char **argv)
 		close(prog_fd[2]);  /* func: trace_xdp_redirect */
 		close(event_fd[3]); /* tracepoint/xdp/xdp_redirect_map */
 		close(prog_fd[3]);  /* func: trace_xdp_redirect_map */
+	} else if (sample_pct) {
+		/* Keep progs, only attached during sample windows */
+		success_tracepoints(false);
 	}
 
 	stats_poll(interval, errors_only);
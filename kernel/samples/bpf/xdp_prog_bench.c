@@ -0,0 +1,409 @@
+/* Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP prog micro-benchmark via BPF_PROG_TEST_RUN, no NIC needed\n"
+ "\n"
+ " Loads each given _kern.o (via bpf_load.c, with the ELF default map\n"
+ " sizes and empty maps) and runs every XDP program section on canned\n"
+ " packet templates, --repeat times per run.  Reports the best ns per\n"
+ " packet out of --runs, as measured by the kernel, and the verdict.\n"
+ " Sections for cpumap entries (xdp_cpumap/) cannot be test run.\n"
+ " Use --format json for one result object per line, e.g. for CI.";
+
+#include <linux/bpf.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "libbpf.h"
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_BPF		4
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{"runs",	required_argument,	NULL, 'n' },
+	{"pkt",		required_argument,	NULL, 'p' },
+	{"section",	required_argument,	NULL, 's' },
+	{"size",	required_argument,	NULL, 'z' },
+	{"format",	required_argument,	NULL, 'f' },
+	{0, 0, NULL,  0 }
+};
+
+enum pkt_template {
+	PKT_IPV4_UDP = 0,
+	PKT_IPV4_TCP,
+	PKT_IPV6_UDP,
+	PKT_IPV6_TCP,
+	PKT_VLAN_IPV4_UDP,
+	PKT_QINQ_IPV4_UDP,
+	PKT_ARP,
+	PKT_MAX
+};
+
+static const char *pkt_names[PKT_MAX] = {
+	[PKT_IPV4_UDP]		= "ipv4-udp",
+	[PKT_IPV4_TCP]		= "ipv4-tcp",
+	[PKT_IPV6_UDP]		= "ipv6-udp",
+	[PKT_IPV6_TCP]		= "ipv6-tcp",
+	[PKT_VLAN_IPV4_UDP]	= "vlan-ipv4-udp",
+	[PKT_QINQ_IPV4_UDP]	= "qinq-ipv4-udp",
+	[PKT_ARP]		= "arp",
+};
+
+#define XDP_ACTION_MAX (XDP_REDIRECT + 1)
+static const char *xdp_action_names[XDP_ACTION_MAX] = {
+	[XDP_ABORTED]	= "XDP_ABORTED",
+	[XDP_DROP]	= "XDP_DROP",
+	[XDP_PASS]	= "XDP_PASS",
+	[XDP_TX]	= "XDP_TX",
+	[XDP_REDIRECT]	= "XDP_REDIRECT",
+};
+
+static const char *action2str(__u32 action)
+{
+	if (action < XDP_ACTION_MAX)
+		return xdp_action_names[action];
+	return "unknown";
+}
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below) FILE_kern.o...\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n --pkt templates (comma separated, default all):\n");
+	for (i = 0; i < PKT_MAX; i++)
+		printf("\t%s\n", pkt_names[i]);
+	printf("\n");
+}
+
+#define PKT_SIZE_MIN	64 /* Minimum size ethernet frame, without FCS */
+#define PKT_SIZE_MAX	1514
+
+struct vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+/* Like pktgen: UDP/TCP dst port 9 (discard), addresses from the
+ * benchmark ranges 198.18.0.0/15 and 2001:db8::/32.
+ *
+ * Returns the L3 offset, as the ethertype and VLAN tags are written.
+ */
+static int build_l2(unsigned char *pkt, int tmpl)
+{
+	struct ethhdr *eth = (struct ethhdr *)pkt;
+	struct vlan_hdr *vh = (struct vlan_hdr *)(eth + 1);
+	__u16 proto = htons(ETH_P_IP);
+	int off = sizeof(*eth);
+
+	memcpy(eth->h_dest,   "\x00\x1b\x21\x00\x00\x01", ETH_ALEN);
+	memcpy(eth->h_source, "\x00\x1b\x21\x00\x00\x02", ETH_ALEN);
+
+	if (tmpl == PKT_IPV6_UDP || tmpl == PKT_IPV6_TCP)
+		proto = htons(ETH_P_IPV6);
+	else if (tmpl == PKT_ARP)
+		proto = htons(ETH_P_ARP);
+
+	switch (tmpl) {
+	case PKT_QINQ_IPV4_UDP:
+		eth->h_proto = htons(ETH_P_8021AD);
+		vh->h_vlan_TCI = htons(100);
+		vh->h_vlan_encapsulated_proto = htons(ETH_P_8021Q);
+		vh++;
+		vh->h_vlan_TCI = htons(4012);
+		vh->h_vlan_encapsulated_proto = proto;
+		off += 2 * sizeof(*vh);
+		break;
+	case PKT_VLAN_IPV4_UDP:
+		eth->h_proto = htons(ETH_P_8021Q);
+		vh->h_vlan_TCI = htons(4012);
+		vh->h_vlan_encapsulated_proto = proto;
+		off += sizeof(*vh);
+		break;
+	default:
+		eth->h_proto = proto;
+	}
+	return off;
+}
+
+static void build_l4(unsigned char *l4, int proto, int len)
+{
+	if (proto == IPPROTO_UDP) {
+		struct udphdr *udph = (struct udphdr *)l4;
+
+		udph->source = htons(4242);
+		udph->dest   = htons(9);
+		udph->len    = htons(len);
+	} else {
+		struct tcphdr *tcph = (struct tcphdr *)l4;
+
+		tcph->source = htons(4242);
+		tcph->dest   = htons(9);
+		tcph->doff   = sizeof(*tcph) / 4;
+		tcph->ack    = 1;
+		tcph->window = htons(512);
+	}
+}
+
+static void build_pkt(unsigned char *pkt, int size, int tmpl)
+{
+	int off, proto;
+
+	memset(pkt, 0, size);
+	off = build_l2(pkt, tmpl);
+	proto = (tmpl == PKT_IPV4_TCP || tmpl == PKT_IPV6_TCP) ?
+		IPPROTO_TCP : IPPROTO_UDP;
+
+	switch (tmpl) {
+	case PKT_IPV6_UDP:
+	case PKT_IPV6_TCP: {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)(pkt + off);
+
+		ip6h->version     = 6;
+		ip6h->payload_len = htons(size - off - sizeof(*ip6h));
+		ip6h->nexthdr     = proto;
+		ip6h->hop_limit   = 64;
+		inet_pton(AF_INET6, "2001:db8::1", &ip6h->saddr);
+		inet_pton(AF_INET6, "2001:db8::2", &ip6h->daddr);
+		build_l4((unsigned char *)(ip6h + 1), proto,
+			 size - off - sizeof(*ip6h));
+		break;
+	}
+	case PKT_ARP:
+		/* ARP request body is not parsed by the sample progs */
+		break;
+	default: {
+		struct iphdr *iph = (struct iphdr *)(pkt + off);
+
+		iph->version  = 4;
+		iph->ihl      = 5;
+		iph->ttl      = 64;
+		iph->protocol = proto;
+		iph->tot_len  = htons(size - off);
+		iph->saddr    = htonl(0xc6120001); /* 198.18.0.1 */
+		iph->daddr    = htonl(0xc6130001); /* 198.19.0.1 */
+		build_l4((unsigned char *)(iph + 1), proto,
+			 size - off - sizeof(*iph));
+	}
+	}
+}
+
+static bool parse_pkt_list(char *list, bool *pkts)
+{
+	char *name;
+	int i;
+
+	memset(pkts, 0, sizeof(bool) * PKT_MAX);
+	for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+		for (i = 0; i < PKT_MAX; i++)
+			if (!strcmp(name, pkt_names[i]))
+				break;
+		if (i == PKT_MAX) {
+			fprintf(stderr, "ERR: unknown --pkt %s\n", name);
+			return false;
+		}
+		pkts[i] = true;
+	}
+	return true;
+}
+
+struct bench_cfg {
+	int repeat;
+	int runs;
+	int size;
+	bool json;
+	const char *section;
+	bool pkts[PKT_MAX];
+};
+
+/* Best (lowest) ns per packet out of cfg->runs, negative on failure */
+static long long bench_prog(int fd, const struct bench_cfg *cfg,
+			    unsigned char *pkt, __u32 *retval)
+{
+	unsigned char out[PKT_SIZE_MAX + 256];
+	__u32 duration, size;
+	long long best = -1;
+	int i;
+
+	for (i = 0; i < cfg->runs; i++) {
+		size = sizeof(out);
+		if (bpf_prog_test_run(fd, cfg->repeat, pkt, cfg->size,
+				      out, &size, retval, &duration)) {
+			fprintf(stderr, "ERR: bpf_prog_test_run errno(%d/%s)\n",
+				errno, strerror(errno));
+			return -1;
+		}
+		if (best < 0 || duration < best)
+			best = duration;
+	}
+	return best;
+}
+
+static void print_result(const struct bench_cfg *cfg, const char *obj,
+			 const char *sec, int tmpl, long long ns,
+			 __u32 retval)
+{
+	if (cfg->json) {
+		printf("{\"object\":\"%s\",\"section\":\"%s\",\"pkt\":\"%s\","
+		       "\"size\":%d,\"repeat\":%d,\"ns\":%lld,"
+		       "\"verdict\":\"%s\"}\n", obj, sec, pkt_names[tmpl],
+		       cfg->size, cfg->repeat, ns, action2str(retval));
+		return;
+	}
+	printf("%-32s %-36s %-14s %8lld %s\n", obj, sec, pkt_names[tmpl],
+	       ns, action2str(retval));
+}
+
+/* The bpf_load.c loader state is global, thus one object at a time */
+static int bench_object(const char *obj, const struct bench_cfg *cfg)
+{
+	unsigned char pkt[PKT_SIZE_MAX];
+	int i, tmpl, err = EXIT_OK;
+	__u32 retval;
+	long long ns;
+
+	prog_cnt = 0;
+	if (load_bpf_file((char *)obj)) {
+		fprintf(stderr, "ERR in load_bpf_file(%s): %s",
+			obj, bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+
+	for (i = 0; i < prog_cnt; i++) {
+		const char *sec = prog_sec[i];
+
+		if (strncmp(sec, "xdp", 3) ||
+		    !strncmp(sec, "xdp_cpumap", 10))
+			continue;
+		if (cfg->section && !strstr(sec, cfg->section))
+			continue;
+
+		for (tmpl = 0; tmpl < PKT_MAX; tmpl++) {
+			if (!cfg->pkts[tmpl])
+				continue;
+			build_pkt(pkt, cfg->size, tmpl);
+			ns = bench_prog(prog_fd[i], cfg, pkt, &retval);
+			if (ns < 0) {
+				err = EXIT_FAIL_BPF;
+				continue;
+			}
+			print_result(cfg, obj, sec, tmpl, ns, retval);
+		}
+	}
+
+	for (i = 0; i < prog_cnt; i++) {
+		close(prog_fd[i]);
+		free(prog_sec[i]);
+		prog_sec[i] = NULL;
+	}
+	for (i = 0; i < map_data_count; i++)
+		close(map_fd[i]);
+	prog_cnt = 0;
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	struct bench_cfg cfg = {
+		.repeat = 1000000,
+		.runs	= 3,
+		.size	= PKT_SIZE_MIN,
+	};
+	int longindex = 0, opt, i, res;
+	int err = EXIT_OK;
+
+	for (i = 0; i < PKT_MAX; i++)
+		cfg.pkts[i] = true;
+
+	while ((opt = getopt_long(argc, argv, "hr:n:p:s:z:f:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'r':
+			cfg.repeat = atoi(optarg);
+			break;
+		case 'n':
+			cfg.runs = atoi(optarg);
+			break;
+		case 'p':
+			if (!parse_pkt_list(optarg, cfg.pkts))
+				return EXIT_FAIL_OPTION;
+			break;
+		case 's':
+			cfg.section = optarg;
+			break;
+		case 'z':
+			cfg.size = atoi(optarg);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "json")) {
+				cfg.json = true;
+			} else if (strcmp(optarg, "text")) {
+				fprintf(stderr, "ERR: --format text|json\n");
+				return EXIT_FAIL_OPTION;
+			}
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	if (cfg.repeat <= 0 || cfg.runs <= 0 || optind >= argc ||
+	    cfg.size < PKT_SIZE_MIN || cfg.size > PKT_SIZE_MAX) {
+		fprintf(stderr, "ERR: need FILE_kern.o, --repeat/--runs > 0"
+			" and --size %d-%d\n", PKT_SIZE_MIN, PKT_SIZE_MAX);
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (!cfg.json)
+		printf("%-32s %-36s %-14s %8s %s\n", "object", "section",
+		       "pkt", "ns/pkt", "verdict");
+	for (i = optind; i < argc; i++) {
+		res = bench_object(argv[i], &cfg);
+		if (res)
+			err = res;
+	}
+	return err;
+}
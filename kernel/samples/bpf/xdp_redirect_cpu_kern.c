@@ -15,16 +15,25 @@
 #include "bpf_helpers.h"
 
 #include "hash_func01.h"
+#include "hash_func02.h"
 
-#define MAX_CPUS 12 /* WARNING - sync with _user.c */
+/* Maps indexed by CPU are resized at load time by _user.c, to the
+ * number of possible CPUs, thus MAX_CPUS is only the ELF default.
+ */
+#define MAX_CPUS 64
+#define CPU_INVALID 0xFFFFFFFF /* WARNING - sync with _user.c */
+
+/* From include/net/ip.h, not in uapi */
+#define IP_MF		0x2000	/* Flag: "More Fragments" */
+#define IP_OFFSET	0x1FFF	/* "Fragment Offset" part */
 
 /* Special map type that can XDP_REDIRECT frames to another CPU */
-struct bpf_map_def SEC("maps") cpu_map = {
-	.type		= BPF_MAP_TYPE_CPUMAP,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(u32),
-	.max_entries	= MAX_CPUS,
-};
+struct {
+	__uint(type, BPF_MAP_TYPE_CPUMAP);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, MAX_CPUS);
+} cpu_map SEC(".maps");
 
 /* Common stats data record to keep userspace more simple */
 struct datarec {
@@ -36,67 +45,96 @@ struct datarec {
 /* Count RX packets, as XDP bpf_prog doesn't get direct TX-success
  * feedback.  Redirect TX errors can be caught via a tracepoint.
  */
-struct bpf_map_def SEC("maps") rx_cnt = {
-	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(struct datarec),
-	.max_entries	= 1,
-};
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct datarec);
+	__uint(max_entries, 1);
+} rx_cnt SEC(".maps");
 
 /* Used by trace point */
-struct bpf_map_def SEC("maps") redirect_err_cnt = {
-	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(struct datarec),
-	.max_entries	= 2,
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct datarec);
+	__uint(max_entries, 2);
 	/* TODO: have entries for all possible errno's */
-};
+} redirect_err_cnt SEC(".maps");
 
 /* Used by trace point */
-struct bpf_map_def SEC("maps") cpumap_enqueue_cnt = {
-	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(struct datarec),
-	.max_entries	= MAX_CPUS,
-};
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct datarec);
+	__uint(max_entries, MAX_CPUS);
+} cpumap_enqueue_cnt SEC(".maps");
 
 /* Used by trace point */
-struct bpf_map_def SEC("maps") cpumap_kthread_cnt = {
-	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(struct datarec),
-	.max_entries	= 1,
-};
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct datarec);
+	__uint(max_entries, 1);
+} cpumap_kthread_cnt SEC(".maps");
 
 /* Set of maps controlling available CPU, and for iterating through
  * selectable redirect CPUs.
  */
-struct bpf_map_def SEC("maps") cpus_available = {
-	.type		= BPF_MAP_TYPE_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(u32),
-	.max_entries	= MAX_CPUS,
-};
-struct bpf_map_def SEC("maps") cpus_count = {
-	.type		= BPF_MAP_TYPE_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(u32),
-	.max_entries	= 1,
-};
-struct bpf_map_def SEC("maps") cpus_iterator = {
-	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(u32),
-	.max_entries	= 1,
-};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, MAX_CPUS);
+} cpus_available SEC(".maps");
+
+/* Number of valid entries in cpus_available, global data (.data map)
+ * written by _user.c, read without a map lookup.
+ */
+u32 cpus_count = 0;
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, 1);
+} cpus_iterator SEC(".maps");
 
 /* Used by trace point */
-struct bpf_map_def SEC("maps") exception_cnt = {
-	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
-	.key_size	= sizeof(u32),
-	.value_size	= sizeof(struct datarec),
-	.max_entries	= 1,
-};
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct datarec);
+	__uint(max_entries, 1);
+} exception_cnt SEC(".maps");
+
+/* Consistent hashing (Maglev) lookup table, slot -> CPU, populated by
+ * userspace.  Size must be prime, and much larger than nr CPUs.
+ */
+#define MAGLEV_TABLE_SIZE 16381 /* WARNING - sync with _user.c */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, MAGLEV_TABLE_SIZE);
+} cpus_maglev SEC(".maps");
+
+/* Stats of second-stage xdp_cpumap progs, running on the remote CPU */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct datarec);
+	__uint(max_entries, 1);
+} cpumap_prog_cnt SEC(".maps");
+
+/* prognum8: processed counts the NIC RX hash used, issue the
+ * fallback to a software hash.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, struct datarec);
+	__uint(max_entries, 1);
+} hw_hash_cnt SEC(".maps");
 
 /* Helper parse functions */
 
@@ -209,7 +247,7 @@ int  xdp_prognum0_no_touch(struct xdp_md *ctx)
 		return XDP_ABORTED;
 	rec->processed++;
 
-	if (cpu_dest >= MAX_CPUS) {
+	if (cpu_dest == CPU_INVALID) {
 		rec->issue++;
 		return XDP_ABORTED;
 	}
@@ -252,7 +290,7 @@ int  xdp_prognum1_touch_data(struct xdp_md *ctx)
 		return XDP_DROP;
 	}
 
-	if (cpu_dest >= MAX_CPUS) {
+	if (cpu_dest == CPU_INVALID) {
 		rec->issue++;
 		return XDP_ABORTED;
 	}
@@ -269,20 +307,15 @@ int  xdp_prognum2_round_robin(struct xdp_md *ctx)
 
 	u32 *cpu_selected;
 	u32 *cpu_iterator;
-	u32 *cpu_max;
 	u32 cpu_idx;
 
-	cpu_max = bpf_map_lookup_elem(&cpus_count, &key0);
-	if (!cpu_max)
-		return XDP_ABORTED;
-
 	cpu_iterator = bpf_map_lookup_elem(&cpus_iterator, &key0);
 	if (!cpu_iterator)
 		return XDP_ABORTED;
 	cpu_idx = *cpu_iterator;
 
 	*cpu_iterator += 1;
-	if (*cpu_iterator == *cpu_max)
+	if (*cpu_iterator >= cpus_count) /* Also after a shrink */
 		*cpu_iterator = 0;
 
 	cpu_selected = bpf_map_lookup_elem(&cpus_available, &cpu_idx);
@@ -296,7 +329,7 @@ int  xdp_prognum2_round_robin(struct xdp_md *ctx)
 		return XDP_ABORTED;
 	rec->processed++;
 
-	if (cpu_dest >= MAX_CPUS) {
+	if (cpu_dest == CPU_INVALID) {
 		rec->issue++;
 		return XDP_ABORTED;
 	}
@@ -364,7 +397,7 @@ int  xdp_prognum3_proto_separate(struct xdp_md *ctx)
 		return XDP_ABORTED;
 	cpu_dest = *cpu_lookup;
 
-	if (cpu_dest >= MAX_CPUS) {
+	if (cpu_dest == CPU_INVALID) {
 		rec->issue++;
 		return XDP_ABORTED;
 	}
@@ -440,7 +473,7 @@ int  xdp_prognum4_ddos_filter_pktgen(struct xdp_md *ctx)
 		return XDP_ABORTED;
 	cpu_dest = *cpu_lookup;
 
-	if (cpu_dest >= MAX_CPUS) {
+	if (cpu_dest == CPU_INVALID) {
 		rec->issue++;
 		return XDP_ABORTED;
 	}
@@ -454,6 +487,27 @@ struct L3_flow_keys {
 	u32 dst[4];
 };
 
+/* Flow hash function, selected at compile time, e.g. make
+ * EXTRA_CFLAGS=-DFLOW_HASH=2.  See xdp_hash_bench for the cost and
+ * xdp_hash_quality for the CPU spread, of these on the same keys.
+ */
+#define FLOW_HASH_SFH	0 /* SuperFastHash */
+#define FLOW_HASH_JHASH	1
+#define FLOW_HASH_MX	2 /* multiply-xorshift */
+#ifndef FLOW_HASH
+#define FLOW_HASH	FLOW_HASH_SFH
+#endif
+
+static __always_inline
+u32 flow_hash(u32 *key, int words, u32 initval)
+{
+	if (FLOW_HASH == FLOW_HASH_JHASH)
+		return jhash_words(key, words, initval);
+	if (FLOW_HASH == FLOW_HASH_MX)
+		return mxhash_words(key, words, initval);
+	return SuperFastHash((char *)key, words * 4, initval);
+}
+
 /* Get hash based on L3 header information */
 static __always_inline
 u32 get_l3_hash(struct L3_flow_keys *flow, u16 protocol, u8 l4_proto)
@@ -474,14 +528,14 @@ u32 get_l3_hash(struct L3_flow_keys *flow, u16 protocol, u8 l4_proto)
 	switch (protocol) {
 	case ETH_P_IP:
 		key[0] = flow->src[0] ^ flow->dst[0];
-		hash = SuperFastHash((char *)&key[0], 4, initval);
+		hash = flow_hash(key, 1, initval);
 		break;
 	case ETH_P_IPV6:
 		key[0] = flow->src[0] ^ flow->dst[0];
 		key[1] = flow->src[1] ^ flow->dst[1];
 		key[2] = flow->src[2] ^ flow->dst[2];
 		key[3] = flow->src[3] ^ flow->dst[3];
-		hash = SuperFastHash((char *)&key, 16, initval);
+		hash = flow_hash(key, 4, initval);
 		break;
 	default:
 		hash = 0;
@@ -490,37 +544,74 @@ u32 get_l3_hash(struct L3_flow_keys *flow, u16 protocol, u8 l4_proto)
 	return hash;
 }
 
-SEC("xdp_cpu_map5_ip_l3_flow_hash")
-int  xdp_prognum5_ip_l3_flow_hash(struct xdp_md *ctx)
+/* Get symmetric L4 5-tuple hash, ports are XOR-folded like the IPs */
+static __always_inline
+u32 get_l4_hash(struct L3_flow_keys *flow, u16 protocol, u8 l4_proto,
+		u32 ports)
+{
+	u32 key[5];
+	u32 initval;
+
+	initval = INIT_SEED + protocol + l4_proto;
+
+	switch (protocol) {
+	case ETH_P_IP:
+		key[0] = flow->src[0] ^ flow->dst[0];
+		key[1] = ports;
+		return flow_hash(key, 2, initval);
+	case ETH_P_IPV6:
+		key[0] = flow->src[0] ^ flow->dst[0];
+		key[1] = flow->src[1] ^ flow->dst[1];
+		key[2] = flow->src[2] ^ flow->dst[2];
+		key[3] = flow->src[3] ^ flow->dst[3];
+		key[4] = ports;
+		return flow_hash(key, 5, initval);
+	}
+	return 0;
+}
+
+/* Read L4 ports as one u32, src XOR dst port in the low 16 bits.
+ * Returns false for non TCP/UDP or truncated packets, which then use
+ * L3 hash.
+ */
+static __always_inline
+bool get_l4_ports(void *l4, void *data_end, u8 l4_proto, u32 *ports)
+{
+	struct udphdr *udph = l4; /* TCP ports are at same offsets */
+
+	if (l4_proto != IPPROTO_TCP && l4_proto != IPPROTO_UDP)
+		return false;
+	if (udph + 1 > data_end)
+		return false;
+	*ports = udph->source ^ udph->dest;
+	return true;
+}
+
+/* Extract L3 IP (src and dst) + next L4-protocol for flow hash.  When
+ * l4 is set, include the L4 ports, except for IP fragments as only the
+ * first fragment carries the ports, thus all fragments of a datagram
+ * use the L3 hash and stay on the same CPU.
+ *
+ * Returns XDP_REDIRECT when *hash is valid, else the XDP action to take
+ */
+static __always_inline
+int get_flow_hash(struct xdp_md *ctx, u32 *hash, bool l4)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data     = (void *)(long)ctx->data;
 	struct ethhdr *eth = data;
-	struct datarec *rec;
 	u16 eth_proto = 0;
 	u64 l3_offset = 0;
-	u32 cpu_dest = 0;
-	u32 cpu_idx = 0;
-	u32 *cpu_lookup;
-	u32 *cpu_max;
-	u32 key0 = 0;
 
 	/* For flow hashing */
 	struct L3_flow_keys f;
 	struct iphdr   *ip4h;
 	struct ipv6hdr *ip6h;
-	u32 hash;
-
-	/* Count RX packet in map */
-	rec = bpf_map_lookup_elem(&rx_cnt, &key0);
-	if (!rec)
-		return XDP_ABORTED;
-	rec->processed++;
+	u32 ports = 0;
 
 	if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset)))
 		return XDP_PASS; /* Just skip */
 
-	/* Extract L3 IP (src and dst) + next L4-protocol for flow hash */
 	switch (eth_proto) {
 	case ETH_P_IP:
 		ip4h = data + l3_offset;
@@ -528,7 +619,13 @@ int  xdp_prognum5_ip_l3_flow_hash(struct xdp_md *ctx)
 			return XDP_ABORTED;
 		f.src[0] = ip4h->saddr;/* network byte-order, does it matter?*/
 		f.dst[0] = ip4h->daddr;
-		hash = get_l3_hash(&f, eth_proto, ip4h->protocol);
+		if (l4 && !(ip4h->frag_off & htons(IP_MF | IP_OFFSET)) &&
+		    get_l4_ports((void *)ip4h + (ip4h->ihl * 4), data_end,
+				 ip4h->protocol, &ports))
+			*hash = get_l4_hash(&f, eth_proto, ip4h->protocol,
+					    ports);
+		else
+			*hash = get_l3_hash(&f, eth_proto, ip4h->protocol);
 		break;
 	case ETH_P_IPV6:
 		ip6h = data + l3_offset;
@@ -536,28 +633,52 @@ int  xdp_prognum5_ip_l3_flow_hash(struct xdp_md *ctx)
 			return XDP_ABORTED;
 		__builtin_memcpy(f.src, ip6h->saddr.s6_addr32, sizeof(f.src));
 		__builtin_memcpy(f.dst, ip6h->daddr.s6_addr32, sizeof(f.dst));
-		hash = get_l3_hash(&f, eth_proto, ip6h->nexthdr);
+		/* Extension headers (incl. fragment header) use L3 hash */
+		if (l4 && get_l4_ports(ip6h + 1, data_end, ip6h->nexthdr,
+				       &ports))
+			*hash = get_l4_hash(&f, eth_proto, ip6h->nexthdr,
+					    ports);
+		else
+			*hash = get_l3_hash(&f, eth_proto, ip6h->nexthdr);
 		break;
 	case ETH_P_ARP:
 		return XDP_PASS; /* ARP packet handled on incoming CPU */
-		break;
 	default:
-		hash = 0; /* Will hit CPU index zero */
+		*hash = 0; /* Will hit CPU index zero */
 	}
+	return XDP_REDIRECT;
+}
 
-	cpu_max = bpf_map_lookup_elem(&cpus_count, &key0);
-	if (!cpu_max)
+SEC("xdp_cpu_map5_ip_l3_flow_hash")
+int  xdp_prognum5_ip_l3_flow_hash(struct xdp_md *ctx)
+{
+	struct datarec *rec;
+	u32 cpu_dest = 0;
+	u32 cpu_idx = 0;
+	u32 *cpu_lookup;
+	u32 key0 = 0;
+	u32 hash = 0;
+	int action;
+
+	/* Count RX packet in map */
+	rec = bpf_map_lookup_elem(&rx_cnt, &key0);
+	if (!rec)
 		return XDP_ABORTED;
+	rec->processed++;
+
+	action = get_flow_hash(ctx, &hash, false);
+	if (action != XDP_REDIRECT)
+		return action;
 
 	/* Distribute over avail CPUs based on L3 IP-address hash */
-	cpu_idx = hash % *cpu_max;
+	cpu_idx = hash % cpus_count;
 
 	cpu_lookup = bpf_map_lookup_elem(&cpus_available, &cpu_idx);
 	if (!cpu_lookup)
 		return XDP_ABORTED;
 	cpu_dest = *cpu_lookup;
 
-	if (cpu_dest >= MAX_CPUS) {
+	if (cpu_dest == CPU_INVALID) {
 		rec->issue++;
 		return XDP_ABORTED;
 	}
@@ -565,6 +686,256 @@ int  xdp_prognum5_ip_l3_flow_hash(struct xdp_md *ctx)
 	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
 }
 
+/* Same L3 flow hash as prognum5, but CPU is selected via the Maglev
+ * table in cpus_maglev.  Adding/removing a CPU only moves the flows
+ * of the slots that changed owner, instead of reshuffling nearly all
+ * flows as "hash % cpus_count" does.
+ */
+SEC("xdp_cpu_map6_ip_l3_flow_maglev")
+int  xdp_prognum6_ip_l3_flow_maglev(struct xdp_md *ctx)
+{
+	struct datarec *rec;
+	u32 cpu_dest = 0;
+	u32 *cpu_lookup;
+	u32 key0 = 0;
+	u32 hash = 0;
+	u32 slot;
+	int action;
+
+	/* Count RX packet in map */
+	rec = bpf_map_lookup_elem(&rx_cnt, &key0);
+	if (!rec)
+		return XDP_ABORTED;
+	rec->processed++;
+
+	action = get_flow_hash(ctx, &hash, false);
+	if (action != XDP_REDIRECT)
+		return action;
+
+	slot = hash % MAGLEV_TABLE_SIZE;
+	cpu_lookup = bpf_map_lookup_elem(&cpus_maglev, &slot);
+	if (!cpu_lookup)
+		return XDP_ABORTED;
+	cpu_dest = *cpu_lookup;
+
+	if (cpu_dest == CPU_INVALID) {
+		rec->issue++;
+		return XDP_ABORTED;
+	}
+
+	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
+}
+
+/* As prognum5, but hash on L4 5-tuple, spreading many flows from one
+ * (e.g. NAT'ed) client IP over all CPUs.
+ */
+SEC("xdp_cpu_map7_ip_l4_flow_hash")
+int  xdp_prognum7_ip_l4_flow_hash(struct xdp_md *ctx)
+{
+	struct datarec *rec;
+	u32 cpu_dest = 0;
+	u32 cpu_idx = 0;
+	u32 *cpu_lookup;
+	u32 key0 = 0;
+	u32 hash = 0;
+	int action;
+
+	/* Count RX packet in map */
+	rec = bpf_map_lookup_elem(&rx_cnt, &key0);
+	if (!rec)
+		return XDP_ABORTED;
+	rec->processed++;
+
+	action = get_flow_hash(ctx, &hash, true);
+	if (action != XDP_REDIRECT)
+		return action;
+
+	cpu_idx = hash % cpus_count;
+
+	cpu_lookup = bpf_map_lookup_elem(&cpus_available, &cpu_idx);
+	if (!cpu_lookup)
+		return XDP_ABORTED;
+	cpu_dest = *cpu_lookup;
+
+	if (cpu_dest == CPU_INVALID) {
+		rec->issue++;
+		return XDP_ABORTED;
+	}
+
+	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
+}
+
+/* As prognum7, but prefer the RX hash the NIC already calculated, via
+ * XDP RX metadata kfunc (prog loaded device bound), which avoids
+ * parsing the headers.  Falls back to the software L4 flow hash,
+ * when the kernel/driver has no RX hash, or for non-L4 hash types.
+ *
+ * Notice: NIC hashes (Toeplitz) are normally not symmetric, thus both
+ * directions of a flow can land on different CPUs, and the NIC likely
+ * hash IP fragments on L3 only, unlike get_flow_hash().
+ */
+#define XDP_RSS_L4	(1U << 3) /* kernel enum xdp_rss_hash_type */
+
+SEC("xdp_cpu_map8_hw_l4_flow_hash")
+int  xdp_prognum8_hw_l4_flow_hash(struct xdp_md *ctx)
+{
+	struct datarec *rec, *hw;
+	u32 rss_type = 0;
+	u32 cpu_dest = 0;
+	u32 cpu_idx = 0;
+	u32 *cpu_lookup;
+	u32 key0 = 0;
+	u32 hash = 0;
+	int action;
+
+	/* Count RX packet in map */
+	rec = bpf_map_lookup_elem(&rx_cnt, &key0);
+	if (!rec)
+		return XDP_ABORTED;
+	rec->processed++;
+
+	hw = bpf_map_lookup_elem(&hw_hash_cnt, &key0);
+	if (!hw)
+		return XDP_ABORTED;
+
+	if (bpf_xdp_metadata_rx_hash(ctx, &hash, &rss_type) == 0 &&
+	    (rss_type & XDP_RSS_L4)) {
+		hw->processed++;
+	} else {
+		hw->issue++;
+		action = get_flow_hash(ctx, &hash, true);
+		if (action != XDP_REDIRECT)
+			return action;
+	}
+
+	cpu_idx = hash % cpus_count;
+
+	cpu_lookup = bpf_map_lookup_elem(&cpus_available, &cpu_idx);
+	if (!cpu_lookup)
+		return XDP_ABORTED;
+	cpu_dest = *cpu_lookup;
+
+	if (cpu_dest == CPU_INVALID) {
+		rec->issue++;
+		return XDP_ABORTED;
+	}
+
+	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
+}
+
+/* Only steer non-TCP traffic to remote CPUs, with the prognum7 L4
+ * flow hash.  TCP stays on the RX CPU, where the driver NAPI GRO can
+ * aggregate it.  Kernels before v6.14 build cpumap SKBs without GRO,
+ * thus redirected TCP cost a full stack traversal per packet.  Compare
+ * against prognum7 with --gro-bench to see if redirecting TCP is
+ * worth it.
+ */
+SEC("xdp_cpu_map9_non_tcp_l4_flow_hash")
+int  xdp_prognum9_non_tcp_l4_flow_hash(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	u8 ip_proto = IPPROTO_UDP;
+	struct datarec *rec;
+	u16 eth_proto = 0;
+	u64 l3_offset = 0;
+	u32 cpu_dest = 0;
+	u32 cpu_idx = 0;
+	u32 *cpu_lookup;
+	u32 key0 = 0;
+	u32 hash = 0;
+	int action;
+
+	/* Count RX packet in map */
+	rec = bpf_map_lookup_elem(&rx_cnt, &key0);
+	if (!rec)
+		return XDP_ABORTED;
+	rec->processed++;
+
+	if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset)))
+		return XDP_PASS; /* Just skip */
+
+	if (eth_proto == ETH_P_IP)
+		ip_proto = get_proto_ipv4(ctx, l3_offset);
+	else if (eth_proto == ETH_P_IPV6)
+		ip_proto = get_proto_ipv6(ctx, l3_offset);
+
+	/* TCP is handled on incoming CPU, via normal GRO */
+	if (ip_proto == IPPROTO_TCP)
+		return XDP_PASS;
+
+	action = get_flow_hash(ctx, &hash, true);
+	if (action != XDP_REDIRECT)
+		return action;
+
+	cpu_idx = hash % cpus_count;
+
+	cpu_lookup = bpf_map_lookup_elem(&cpus_available, &cpu_idx);
+	if (!cpu_lookup)
+		return XDP_ABORTED;
+	cpu_dest = *cpu_lookup;
+
+	if (cpu_dest == CPU_INVALID) {
+		rec->issue++;
+		return XDP_ABORTED;
+	}
+
+	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
+}
+
+/*** Second-stage progs, attached to cpu_map entries (kernel v5.9+) ***
+ *
+ * Runs on the remote CPU, before the SKB is built, thus expensive
+ * filtering can be spread over the cpumap CPUs, instead of all being
+ * done on the RX CPU.  The "xdp_cpumap" section prefix make bpf_load.c
+ * load them with expected_attach_type BPF_XDP_CPUMAP.
+ */
+
+/* Same filter as prognum4, but on the remote CPU */
+SEC("xdp_cpumap/ddos_filter_pktgen")
+int  xdp_cpumap_prog0_ddos_filter_pktgen(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct datarec *rec;
+	u16 eth_proto = 0;
+	u64 l3_offset = 0;
+	u16 dest_port;
+	u32 key = 0;
+
+	rec = bpf_map_lookup_elem(&cpumap_prog_cnt, &key);
+	if (!rec)
+		return XDP_PASS;
+	rec->processed++;
+
+	if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset)))
+		return XDP_PASS;
+
+	if (eth_proto == ETH_P_IP) {
+		/* DDoS filter UDP port 9 (pktgen) */
+		dest_port = get_dest_port_ipv4_udp(ctx, l3_offset);
+		if (dest_port == 9) {
+			rec->dropped++;
+			return XDP_DROP;
+		}
+	}
+	return XDP_PASS;
+}
+
+/* Only count, for measuring the overhead of a second-stage prog */
+SEC("xdp_cpumap/pass")
+int  xdp_cpumap_prog1_pass(struct xdp_md *ctx)
+{
+	struct datarec *rec;
+	u32 key = 0;
+
+	rec = bpf_map_lookup_elem(&cpumap_prog_cnt, &key);
+	if (rec)
+		rec->processed++;
+	return XDP_PASS;
+}
 
 char _license[] SEC("license") = "GPL";
 
@@ -668,9 +1039,7 @@ int trace_xdp_cpumap_enqueue(struct cpumap_enqueue_ctx *ctx)
 	u32 to_cpu = ctx->to_cpu;
 	struct datarec *rec;
 
-	if (to_cpu >= MAX_CPUS)
-		return 1;
-
+	/* Array lookup fails for to_cpu beyond max_entries */
 	rec = bpf_map_lookup_elem(&cpumap_enqueue_cnt, &to_cpu);
 	if (!rec)
 		return 0;
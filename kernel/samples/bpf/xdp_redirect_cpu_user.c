@@ -1,9 +1,22 @@
 /* GPLv2 Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
 static const char *__doc__ =
-	" XDP redirect with a CPU-map type \"BPF_MAP_TYPE_CPUMAP\"";
+	" XDP redirect with a CPU-map type \"BPF_MAP_TYPE_CPUMAP\"\n"
+	"\n"
+	" With --pin maps and prog are pinned in\n"
+	" /sys/fs/bpf/xdp_redirect_cpu/<dev>.  A later run with --replace\n"
+	" reuses these maps (cpumap entries and counters) and atomically\n"
+	" replaces the running prog (XDP_FLAGS_REPLACE, kernel v5.7),\n"
+	" without a packet drop window.\n"
+	"\n"
+	" The --gro-bench SEC mode measures local TCP RX (e.g. an iperf3\n"
+	" server on this host) while redirecting all flows to cpumap\n"
+	" (prognum 7) vs only non-TCP (prognum 9), each with device GRO\n"
+	" on and off.  Cpumap only does GRO on kernel v6.14+, where it\n"
+	" follows the device GRO feature; older kernels show no change.";
 
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,17 +25,39 @@ static const char *__doc__ =
 #include <unistd.h>
 #include <locale.h>
 #include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <getopt.h>
 #include <net/if.h>
 #include <time.h>
 
 #include <arpa/inet.h>
 #include <linux/if_link.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
 
-#define MAX_CPUS 12 /* WARNING - sync with _kern.c */
+/* Maps indexed by CPU are resized at load time to max_cpus (possible
+ * CPUs), see resize_maps_max_cpus().
+ */
+#define CPU_INVALID 0xFFFFFFFF /* WARNING - sync with _kern.c */
+static int max_cpus;
 
 /* How many xdp_progs are defined in _kern.c */
-#define MAX_PROG 6
+#define MAX_PROG 10
+#define PROG_ROUND_ROBIN 2
+#define PROG_DDOS_FILTER 4
+#define PROG_MAGLEV 6 /* xdp_cpu_map6_ip_l3_flow_maglev */
+#define PROG_L4_HASH 7 /* xdp_cpu_map7_ip_l4_flow_hash */
+#define PROG_HW_HASH 8 /* xdp_cpu_map8_hw_l4_flow_hash */
+#define PROG_NON_TCP 9 /* xdp_cpu_map9_non_tcp_l4_flow_hash */
+
+/* Second-stage "xdp_cpumap/" progs, after the xdp_progs in _kern.c,
+ * thus prog_fd[MAX_PROG + n]
+ */
+#define MAX_CPUMAP_PROG 2
+#define CPUMAP_PROG_DDOS_FILTER 0
+
+#define MAGLEV_TABLE_SIZE 16381 /* WARNING - sync with _kern.c */
 
 /* Wanted to get rid of bpf_load.h and fake-"libbpf.h" (and instead
  * use bpf/libbpf.h), but cannot as (currently) needed for XDP
@@ -32,6 +67,7 @@ static const char *__doc__ =
 #include "bpf_load.h"
 
 #include "bpf_util.h"
+#include "xdp_stats.h"
 
 static int ifindex = -1;
 static char ifname_buf[IF_NAMESIZE];
@@ -39,6 +75,14 @@ static char *ifname;
 
 static __u32 xdp_flags;
 
+/* --pin and --replace: maps and attached prog pinned per device */
+#define PIN_BASE_DIR "/sys/fs/bpf/xdp_redirect_cpu"
+#define PIN_FILE_PROG "xdp_prog"
+static char pin_dir[PATH_MAX];
+static bool pin_mode;
+static bool cpu_map_reused;
+static int attached_prog_fd = -1;
+
 /* Exit return codes */
 #define EXIT_OK		0
 #define EXIT_FAIL		1
@@ -58,19 +102,92 @@ static const struct option long_options[] = {
 	{"cpu",		required_argument,	NULL, 'c' },
 	{"stress-mode", no_argument,		NULL, 'x' },
 	{"no-separators", no_argument,		NULL, 'z' },
+	{"top",		required_argument,	NULL, 't' },
+	{"load-aware",	required_argument,	NULL, 'l' },
+	{"cpumap-prog",	required_argument,	NULL, 'C' },
+	{"bench",	required_argument,	NULL, 'b' },
+	{"gro-bench",	required_argument,	NULL, 'g' },
+	{"qsize-adapt",	no_argument,		NULL, 'a' },
+	{"qsize-min",	required_argument,	NULL, 'm' },
+	{"qsize-max",	required_argument,	NULL, 'M' },
+	{"pin",		no_argument,		NULL, 'P' },
+	{"replace",	no_argument,		NULL, 'R' },
 	{0, 0, NULL,  0 }
 };
 
+static const char *pin_file(const char *name)
+{
+	static char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", pin_dir, name);
+	return path;
+}
+
+static void unpin_all(void)
+{
+	int i;
+
+	for (i = 0; i < map_data_count; i++)
+		unlink(pin_file(map_data[i].name));
+	unlink(pin_file(PIN_FILE_PROG));
+	rmdir(pin_dir);
+}
+
 static void int_exit(int sig)
 {
+	if (ifindex > -1 && pin_mode) {
+		/* Only detach our own prog, not one that replaced it */
+		if (set_link_xdp_fd_replace(ifindex, -1, attached_prog_fd,
+					    xdp_flags) == -EEXIST) {
+			fprintf(stderr, "Interrupted: XDP prog on device:%s"
+				" was replaced, leaving it attached\n", ifname);
+			exit(EXIT_OK);
+		}
+		unpin_all();
+	} else if (ifindex > -1) {
+		set_link_xdp_fd(ifindex, -1, xdp_flags);
+	}
 	fprintf(stderr,
-		"Interrupted: Removing XDP program on ifindex:%d device:%s\n",
+		"Interrupted: Removed XDP program on ifindex:%d device:%s\n",
 		ifindex, ifname);
-	if (ifindex > -1)
-		set_link_xdp_fd(ifindex, -1, xdp_flags);
 	exit(EXIT_OK);
 }
 
+/* Attach, or atomically replace the prog pinned by a --pin run */
+static int attach_xdp_prog(int fd, bool replace)
+{
+	int old_fd, err;
+
+	if (replace) {
+		old_fd = bpf_obj_get(pin_file(PIN_FILE_PROG));
+		if (old_fd < 0) {
+			fprintf(stderr, "ERR: --replace: no pinned prog %s\n",
+				pin_file(PIN_FILE_PROG));
+			return -ENOENT;
+		}
+		err = set_link_xdp_fd_replace(ifindex, fd, old_fd, xdp_flags);
+		close(old_fd);
+		if (err == -EEXIST)
+			fprintf(stderr, "ERR: --replace: attached prog is not"
+				" the pinned one\n");
+		else if (err == -EINVAL || err == -EOPNOTSUPP)
+			fprintf(stderr, "ERR: --replace needs kernel v5.7+\n");
+	} else {
+		err = set_link_xdp_fd(ifindex, fd, xdp_flags);
+	}
+	if (err < 0)
+		return err;
+	attached_prog_fd = fd;
+
+	if (pin_mode) {
+		unlink(pin_file(PIN_FILE_PROG));
+		if (bpf_obj_pin(fd, pin_file(PIN_FILE_PROG)))
+			fprintf(stderr, "WARN: cannot pin prog %s: %s\n",
+				pin_file(PIN_FILE_PROG), strerror(errno));
+	}
+	return 0;
+}
+
 static void usage(char *argv[])
 {
 	int i;
@@ -92,24 +209,6 @@ static void usage(char *argv[])
 	printf("\n");
 }
 
-/* gettime returns the current time of day in nanoseconds.
- * Cost: clock_gettime (ns) => 26ns (CLOCK_MONOTONIC)
- *       clock_gettime (ns) =>  9ns (CLOCK_MONOTONIC_COARSE)
- */
-#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
-static __u64 gettime(void)
-{
-	struct timespec t;
-	int res;
-
-	res = clock_gettime(CLOCK_MONOTONIC, &t);
-	if (res < 0) {
-		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
-		exit(EXIT_FAIL);
-	}
-	return (__u64) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
-}
-
 /* Common stats data record shared with _kern.c */
 struct datarec {
 	__u64 processed;
@@ -126,9 +225,31 @@ struct stats_record {
 	struct record redir_err;
 	struct record kthread;
 	struct record exception;
-	struct record enq[MAX_CPUS];
+	struct record cpumap_prog;
+	struct record hw_hash;
+	struct record *enq; /* max_cpus entries */
 };
 
+/* struct bpf_cpumap_val (v5.9), the uapi headers used here are older.
+ * Kernels before v5.9 only support value_size sizeof(__u32), the qsize,
+ * thus cpu_map is only resized when a second-stage prog is wanted.
+ */
+struct cpumap_value {
+	__u32 qsize;
+	union {
+		int   fd;
+		__u32 id;
+	} bpf_prog;
+};
+static bool cpumap_value_ext;
+static int cpumap_prog_fd = -1;
+
+/* CPUs added via --cpu, in cpus_available index order */
+static __u32 *cpus_added;
+static __u32 *cpus_qsize;
+static int *qsize_quiet; /* Intervals without drops, for --qsize-adapt */
+static int cpus_added_cnt;
+
 static bool map_collect_percpu(int fd, __u32 key, struct record *rec)
 {
 	/* For percpu maps, userspace gets a value per possible CPU */
@@ -145,7 +266,7 @@ static bool map_collect_percpu(int fd, __u32 key, struct record *rec)
 		return false;
 	}
 	/* Get time as close as possible to reading map contents */
-	rec->timestamp = gettime();
+	rec->timestamp = stats_gettime();
 
 	/* Record and sum values from each CPU */
 	for (i = 0; i < nr_cpus; i++) {
@@ -193,7 +314,14 @@ static struct stats_record *alloc_stats_record(void)
 	rec->redir_err.cpu = alloc_record_per_cpu();
 	rec->kthread.cpu   = alloc_record_per_cpu();
 	rec->exception.cpu = alloc_record_per_cpu();
-	for (i = 0; i < MAX_CPUS; i++)
+	rec->cpumap_prog.cpu = alloc_record_per_cpu();
+	rec->hw_hash.cpu   = alloc_record_per_cpu();
+	rec->enq = calloc(max_cpus, sizeof(*rec->enq));
+	if (!rec->enq) {
+		fprintf(stderr, "Mem alloc error (max_cpus:%d)\n", max_cpus);
+		exit(EXIT_FAIL_MEM);
+	}
+	for (i = 0; i < max_cpus; i++)
 		rec->enq[i].cpu = alloc_record_per_cpu();
 
 	return rec;
@@ -203,8 +331,11 @@ static void free_stats_record(struct stats_record *r)
 {
 	int i;
 
-	for (i = 0; i < MAX_CPUS; i++)
+	for (i = 0; i < max_cpus; i++)
 		free(r->enq[i].cpu);
+	free(r->enq);
+	free(r->hw_hash.cpu);
+	free(r->cpumap_prog.cpu);
 	free(r->exception.cpu);
 	free(r->kthread.cpu);
 	free(r->redir_err.cpu);
@@ -261,14 +392,58 @@ static __u64 calc_errs_pps(struct datarec *r,
 	return pps;
 }
 
+/* With --top N, each stats section only prints the N busiest CPUs,
+ * plus one "others" row aggregating the rest.  Zero prints all rows.
+ */
+static int top_n;
+
+static int cmp_pps_desc(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y) - (x > y);
+}
+
+/* pps of the N'th busiest of cnt entries, rows below are aggregated */
+static double top_threshold(double *pps, int cnt)
+{
+	if (!top_n || top_n >= cnt)
+		return 0;
+	qsort(pps, cnt, sizeof(*pps), cmp_pps_desc);
+	return pps[top_n - 1];
+}
+
+static double record_top_threshold(struct record *r, struct record *p,
+				   double t, int cnt)
+{
+	double pps[cnt];
+	int i;
+
+	for (i = 0; i < cnt; i++)
+		pps[i] = calc_pps(&r->cpu[i], &p->cpu[i], t);
+	return top_threshold(pps, cnt);
+}
+
+/* Rows with traffic are printed, unless outside the top N */
+static bool top_row(double pps, double thresh, int *rows)
+{
+	if (pps <= 0)
+		return false;
+	if (top_n && (pps < thresh || *rows >= top_n))
+		return false;
+	(*rows)++;
+	return true;
+}
+
 static void stats_print(struct stats_record *stats_rec,
 			struct stats_record *stats_prev,
 			int prog_num)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
 	double pps = 0, drop = 0, err = 0;
+	double o_pps, o_drop, thresh;
 	struct record *rec, *prev;
-	int to_cpu;
+	int to_cpu, rows;
 	double t;
 	int i;
 
@@ -286,6 +461,9 @@ static void stats_print(struct stats_record *stats_rec,
 		rec  = &stats_rec->rx_cnt;
 		prev = &stats_prev->rx_cnt;
 		t = calc_period(rec, prev);
+		thresh = record_top_threshold(rec, prev, t, nr_cpus);
+		o_pps = o_drop = 0;
+		rows = 0;
 		for (i = 0; i < nr_cpus; i++) {
 			struct datarec *r = &rec->cpu[i];
 			struct datarec *p = &prev->cpu[i];
@@ -295,42 +473,68 @@ static void stats_print(struct stats_record *stats_rec,
 			err  = calc_errs_pps(r, p, t);
 			if (err > 0)
 				errstr = "cpu-dest/err";
-			if (pps > 0)
+			if (top_row(pps, thresh, &rows)) {
 				printf(fmt_rx, "XDP-RX",
 					i, pps, drop, err, errstr);
+			} else {
+				o_pps += pps;
+				o_drop += drop;
+			}
 		}
+		if (o_pps > 0)
+			printf(fm2_rx, "XDP-RX", "others", o_pps, o_drop);
 		pps  = calc_pps(&rec->total, &prev->total, t);
 		drop = calc_drop_pps(&rec->total, &prev->total, t);
 		err  = calc_errs_pps(&rec->total, &prev->total, t);
 		printf(fm2_rx, "XDP-RX", "total", pps, drop);
 	}
 
-	/* cpumap enqueue stats */
-	for (to_cpu = 0; to_cpu < MAX_CPUS; to_cpu++) {
+	/* cpumap enqueue stats, with --top only the per to_cpu sum rows */
+	{
 		char *fmt = "%-15s %3d:%-3d %'-14.0f %'-11.0f %'-10.2f %s\n";
 		char *fm2 = "%-15s %3s:%-3d %'-14.0f %'-11.0f %'-10.2f %s\n";
-		char *errstr = "";
+		char *fm3 = "%-15s %-7s %'-14.0f %'-11.0f\n";
+		double sum_pps[max_cpus];
+
+		for (to_cpu = 0; to_cpu < max_cpus; to_cpu++) {
+			rec  = &stats_rec->enq[to_cpu];
+			prev = &stats_prev->enq[to_cpu];
+			t = calc_period(rec, prev);
+			sum_pps[to_cpu] = calc_pps(&rec->total, &prev->total, t);
+		}
+		thresh = top_threshold(sum_pps, max_cpus);
+		o_pps = o_drop = 0;
+		rows = 0;
 
-		rec  =  &stats_rec->enq[to_cpu];
-		prev = &stats_prev->enq[to_cpu];
-		t = calc_period(rec, prev);
-		for (i = 0; i < nr_cpus; i++) {
-			struct datarec *r = &rec->cpu[i];
-			struct datarec *p = &prev->cpu[i];
+		for (to_cpu = 0; to_cpu < max_cpus; to_cpu++) {
+			char *errstr = "";
 
-			pps  = calc_pps(r, p, t);
-			drop = calc_drop_pps(r, p, t);
-			err  = calc_errs_pps(r, p, t);
-			if (err > 0) {
-				errstr = "bulk-average";
-				err = pps / err; /* calc average bulk size */
+			rec  =  &stats_rec->enq[to_cpu];
+			prev = &stats_prev->enq[to_cpu];
+			t = calc_period(rec, prev);
+			pps = calc_pps(&rec->total, &prev->total, t);
+			drop = calc_drop_pps(&rec->total, &prev->total, t);
+			if (!top_row(pps, thresh, &rows)) {
+				o_pps += pps;
+				o_drop += drop;
+				continue;
 			}
-			if (pps > 0)
-				printf(fmt, "cpumap-enqueue",
-				       i, to_cpu, pps, drop, err, errstr);
-		}
-		pps = calc_pps(&rec->total, &prev->total, t);
-		if (pps > 0) {
+			for (i = 0; i < nr_cpus && !top_n; i++) {
+				struct datarec *r = &rec->cpu[i];
+				struct datarec *p = &prev->cpu[i];
+
+				pps  = calc_pps(r, p, t);
+				drop = calc_drop_pps(r, p, t);
+				err  = calc_errs_pps(r, p, t);
+				if (err > 0) {
+					errstr = "bulk-average";
+					err = pps / err; /* calc average bulk size */
+				}
+				if (pps > 0)
+					printf(fmt, "cpumap-enqueue",
+					       i, to_cpu, pps, drop, err, errstr);
+			}
+			pps  = calc_pps(&rec->total, &prev->total, t);
 			drop = calc_drop_pps(&rec->total, &prev->total, t);
 			err  = calc_errs_pps(&rec->total, &prev->total, t);
 			if (err > 0) {
@@ -340,6 +544,37 @@ static void stats_print(struct stats_record *stats_rec,
 			printf(fm2, "cpumap-enqueue",
 			       "sum", to_cpu, pps, drop, err, errstr);
 		}
+		if (o_pps > 0)
+			printf(fm3, "cpumap-enqueue", "others", o_pps, o_drop);
+	}
+
+	/* Load imbalance over the --cpu redirect CPUs, a perfect
+	 * distribution gives max/avg and min/avg of 1.00
+	 */
+	{
+		char *fmt_b = "%-15s %-7s max/avg:%-6.2f min/avg:%-6.2f %s\n";
+		double sum = 0, max = 0, min = 0, avg;
+		int n = cpus_added_cnt;
+
+		for (i = 0; i < n; i++) {
+			to_cpu = cpus_added[i];
+			rec  = &stats_rec->enq[to_cpu];
+			prev = &stats_prev->enq[to_cpu];
+			t = calc_period(rec, prev);
+			/* Load offered to CPU, including enqueue drops */
+			pps  = calc_pps(&rec->total, &prev->total, t);
+			pps += calc_drop_pps(&rec->total, &prev->total, t);
+			sum += pps;
+			if (i == 0 || pps > max)
+				max = pps;
+			if (i == 0 || pps < min)
+				min = pps;
+		}
+		if (n > 1 && sum > 0) {
+			avg = sum / n;
+			printf(fmt_b, "cpumap-balance", "", max / avg, min / avg,
+			       "(enqueue pps)");
+		}
 	}
 
 	/* cpumap kthread stats */
@@ -351,6 +586,9 @@ static void stats_print(struct stats_record *stats_rec,
 		rec  = &stats_rec->kthread;
 		prev = &stats_prev->kthread;
 		t = calc_period(rec, prev);
+		thresh = record_top_threshold(rec, prev, t, nr_cpus);
+		o_pps = o_drop = 0;
+		rows = 0;
 		for (i = 0; i < nr_cpus; i++) {
 			struct datarec *r = &rec->cpu[i];
 			struct datarec *p = &prev->cpu[i];
@@ -360,10 +598,17 @@ static void stats_print(struct stats_record *stats_rec,
 			err  = calc_errs_pps(r, p, t);
 			if (err > 0)
 				e_str = "sched";
-			if (pps > 0)
+			if (top_row(pps, thresh, &rows)) {
 				printf(fmt_k, "cpumap_kthread",
 				       i, pps, drop, err, e_str);
+			} else {
+				o_pps += pps;
+				o_drop += drop;
+			}
 		}
+		if (o_pps > 0)
+			printf(fm2_k, "cpumap_kthread", "others",
+			       o_pps, o_drop, 0.0, "");
 		pps = calc_pps(&rec->total, &prev->total, t);
 		drop = calc_drop_pps(&rec->total, &prev->total, t);
 		err  = calc_errs_pps(&rec->total, &prev->total, t);
@@ -372,6 +617,50 @@ static void stats_print(struct stats_record *stats_rec,
 		printf(fm2_k, "cpumap_kthread", "total", pps, drop, err, e_str);
 	}
 
+	/* Second-stage xdp_cpumap prog, running on remote CPUs */
+	if (cpumap_prog_fd >= 0) {
+		char *fmt_c = "%-15s %-7d %'-14.0f %'-11.0f\n";
+		char *fm2_c = "%-15s %-7s %'-14.0f %'-11.0f\n";
+
+		rec  = &stats_rec->cpumap_prog;
+		prev = &stats_prev->cpumap_prog;
+		t = calc_period(rec, prev);
+		thresh = record_top_threshold(rec, prev, t, nr_cpus);
+		o_pps = o_drop = 0;
+		rows = 0;
+		for (i = 0; i < nr_cpus; i++) {
+			struct datarec *r = &rec->cpu[i];
+			struct datarec *p = &prev->cpu[i];
+
+			pps  = calc_pps(r, p, t);
+			drop = calc_drop_pps(r, p, t);
+			if (top_row(pps, thresh, &rows)) {
+				printf(fmt_c, "cpumap-prog", i, pps, drop);
+			} else {
+				o_pps += pps;
+				o_drop += drop;
+			}
+		}
+		if (o_pps > 0)
+			printf(fm2_c, "cpumap-prog", "others", o_pps, o_drop);
+		pps  = calc_pps(&rec->total, &prev->total, t);
+		drop = calc_drop_pps(&rec->total, &prev->total, t);
+		printf(fm2_c, "cpumap-prog", "total", pps, drop);
+	}
+
+	/* prognum8: NIC RX hash used (pps), vs software hash fallback */
+	if (prog_num == PROG_HW_HASH) {
+		char *fm2_h = "%-15s %-7s %'-14.0f %-11s %'-10.0f %s\n";
+
+		rec  = &stats_rec->hw_hash;
+		prev = &stats_prev->hw_hash;
+		t = calc_period(rec, prev);
+		pps = calc_pps(&rec->total, &prev->total, t);
+		err = calc_errs_pps(&rec->total, &prev->total, t);
+		printf(fm2_h, "hw-rx-hash", "total", pps, "", err,
+		       err > 0 ? "sw-hash" : "");
+	}
+
 	/* XDP redirect err tracepoints (very unlikely) */
 	{
 		char *fmt_err = "%-15s %-7d %'-14.0f %'-11.0f\n";
@@ -380,15 +669,24 @@ static void stats_print(struct stats_record *stats_rec,
 		rec  = &stats_rec->redir_err;
 		prev = &stats_prev->redir_err;
 		t = calc_period(rec, prev);
+		thresh = record_top_threshold(rec, prev, t, nr_cpus);
+		o_pps = o_drop = 0;
+		rows = 0;
 		for (i = 0; i < nr_cpus; i++) {
 			struct datarec *r = &rec->cpu[i];
 			struct datarec *p = &prev->cpu[i];
 
 			pps  = calc_pps(r, p, t);
 			drop = calc_drop_pps(r, p, t);
-			if (pps > 0)
+			if (top_row(pps, thresh, &rows)) {
 				printf(fmt_err, "redirect_err", i, pps, drop);
+			} else {
+				o_pps += pps;
+				o_drop += drop;
+			}
 		}
+		if (o_pps > 0)
+			printf(fm2_err, "redirect_err", "others", o_pps, o_drop);
 		pps = calc_pps(&rec->total, &prev->total, t);
 		drop = calc_drop_pps(&rec->total, &prev->total, t);
 		printf(fm2_err, "redirect_err", "total", pps, drop);
@@ -402,15 +700,24 @@ static void stats_print(struct stats_record *stats_rec,
 		rec  = &stats_rec->exception;
 		prev = &stats_prev->exception;
 		t = calc_period(rec, prev);
+		thresh = record_top_threshold(rec, prev, t, nr_cpus);
+		o_pps = o_drop = 0;
+		rows = 0;
 		for (i = 0; i < nr_cpus; i++) {
 			struct datarec *r = &rec->cpu[i];
 			struct datarec *p = &prev->cpu[i];
 
 			pps  = calc_pps(r, p, t);
 			drop = calc_drop_pps(r, p, t);
-			if (pps > 0)
+			if (top_row(pps, thresh, &rows)) {
 				printf(fmt_err, "xdp_exception", i, pps, drop);
+			} else {
+				o_pps += pps;
+				o_drop += drop;
+			}
 		}
+		if (o_pps > 0)
+			printf(fm2_err, "xdp_exception", "others", o_pps, o_drop);
 		pps = calc_pps(&rec->total, &prev->total, t);
 		drop = calc_drop_pps(&rec->total, &prev->total, t);
 		printf(fm2_err, "xdp_exception", "total", pps, drop);
@@ -424,21 +731,160 @@ static void stats_collect(struct stats_record *rec)
 {
 	int fd, i;
 
-	fd = map_fd[1]; /* map: rx_cnt */
+	fd = bpf_load_map_fd("rx_cnt");
 	map_collect_percpu(fd, 0, &rec->rx_cnt);
 
-	fd = map_fd[2]; /* map: redirect_err_cnt */
+	fd = bpf_load_map_fd("redirect_err_cnt");
 	map_collect_percpu(fd, 1, &rec->redir_err);
 
-	fd = map_fd[3]; /* map: cpumap_enqueue_cnt */
-	for (i = 0; i < MAX_CPUS; i++)
+	fd = bpf_load_map_fd("cpumap_enqueue_cnt");
+	for (i = 0; i < max_cpus; i++)
 		map_collect_percpu(fd, i, &rec->enq[i]);
 
-	fd = map_fd[4]; /* map: cpumap_kthread_cnt */
+	fd = bpf_load_map_fd("cpumap_kthread_cnt");
 	map_collect_percpu(fd, 0, &rec->kthread);
 
-	fd = map_fd[8]; /* map: exception_cnt */
+	fd = bpf_load_map_fd("exception_cnt");
 	map_collect_percpu(fd, 0, &rec->exception);
+
+	fd = bpf_load_map_fd("cpumap_prog_cnt");
+	map_collect_percpu(fd, 0, &rec->cpumap_prog);
+
+	fd = bpf_load_map_fd("hw_hash_cnt");
+	map_collect_percpu(fd, 0, &rec->hw_hash);
+}
+
+/* Load-aware mode: CPUs temporarily removed from the Maglev table */
+static bool *cpu_excluded;
+static __u64 *cpu_excluded_until;
+#define LOAD_AWARE_HOLD_SEC 10
+
+/* Maglev table as currently written into map cpus_maglev.  Both start
+ * out zero, which is CPU 0, thus it must be populated before attach.
+ */
+static __u32 maglev_table[MAGLEV_TABLE_SIZE];
+
+static __u32 maglev_hash(__u32 x, __u32 seed)
+{
+	/* Murmur3 finalizer, good avalanche for small integers */
+	x ^= seed;
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+	return x;
+}
+
+/* Maglev lookup table population (Eisenbud et al, NSDI 2016).  Each
+ * CPU has its own permutation of the table slots (offset + j * skip),
+ * and CPUs take turns claiming their next free slot.  Thus, every CPU
+ * owns close to M/N slots, and removing a CPU mostly only moves the
+ * slots it owned.  The permutation only depends on the CPU number, not
+ * on its index, thus the table is stable across --cpu ordering.
+ */
+static void maglev_populate(__u32 *table, const __u32 *cpus, int n)
+{
+	__u32 offset[max_cpus], skip[max_cpus], next[max_cpus];
+	__u32 slot, filled = 0;
+	int i;
+
+	for (slot = 0; slot < MAGLEV_TABLE_SIZE; slot++)
+		table[slot] = CPU_INVALID; /* Empty */
+	if (n <= 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		offset[i] = maglev_hash(cpus[i], 0x9e3779b9) % MAGLEV_TABLE_SIZE;
+		skip[i] = maglev_hash(cpus[i], 0x7f4a7c15) %
+			(MAGLEV_TABLE_SIZE - 1) + 1;
+		next[i] = 0;
+	}
+	while (1) {
+		for (i = 0; i < n; i++) {
+			do {
+				slot = (offset[i] + (__u64)next[i] * skip[i]) %
+					MAGLEV_TABLE_SIZE;
+				next[i]++;
+			} while (table[slot] != CPU_INVALID);
+			table[slot] = cpus[i];
+			if (++filled == MAGLEV_TABLE_SIZE)
+				return;
+		}
+	}
+}
+
+/* Rebuild the Maglev table from the not-excluded CPUs, and only write
+ * the slots that changed owner.  Updating slots one-by-one is not
+ * atomic, but during the update a flow can only hit its old or new CPU.
+ * Returns the number of slots moved.
+ */
+static int maglev_rebuild(void)
+{
+	static __u32 table[MAGLEV_TABLE_SIZE];
+	__u32 cpus[max_cpus];
+	__u32 slot;
+	int i, n = 0, moved = 0;
+
+	for (i = 0; i < cpus_added_cnt; i++)
+		if (!cpu_excluded[cpus_added[i]])
+			cpus[n++] = cpus_added[i];
+	/* Never leave the table empty, fallback to all CPUs */
+	if (n == 0)
+		for (i = 0; i < cpus_added_cnt; i++)
+			cpus[n++] = cpus_added[i];
+
+	maglev_populate(table, cpus, n);
+	for (slot = 0; slot < MAGLEV_TABLE_SIZE; slot++) {
+		if (table[slot] == maglev_table[slot])
+			continue;
+		if (bpf_map_update_elem(bpf_load_map_fd("cpus_maglev"), &slot, &table[slot], 0)) {
+			fprintf(stderr, "ERR: Failed update Maglev slot:%u\n",
+				slot);
+			exit(EXIT_FAIL_BPF);
+		}
+		maglev_table[slot] = table[slot];
+		moved++;
+	}
+	return moved;
+}
+
+/* Exclude CPUs with a cpumap enqueue drop ratio above drop_pct from the
+ * Maglev table.  An excluded CPU gets no new traffic, thus its ratio
+ * cannot be measured, instead it is re-added after a hold time.
+ */
+static bool load_aware_update(struct stats_record *rec,
+			      struct stats_record *prev, double drop_pct)
+{
+	bool changed = false;
+	__u64 now = stats_gettime();
+	int i;
+
+	for (i = 0; i < cpus_added_cnt; i++) {
+		__u32 cpu = cpus_added[i];
+		struct datarec *r = &rec->enq[cpu].total;
+		struct datarec *p = &prev->enq[cpu].total;
+		__u64 processed = r->processed - p->processed;
+		__u64 dropped = r->dropped - p->dropped;
+		double ratio = 0;
+
+		if (processed + dropped)
+			ratio = 100.0 * dropped / (processed + dropped);
+
+		if (!cpu_excluded[cpu] && ratio > drop_pct) {
+			cpu_excluded[cpu] = true;
+			cpu_excluded_until[cpu] = now +
+				(__u64)LOAD_AWARE_HOLD_SEC * NANOSEC_PER_SEC;
+			printf("Load-aware: exclude CPU:%u (drop %.1f%%)\n",
+			       cpu, ratio);
+			changed = true;
+		} else if (cpu_excluded[cpu] && now >= cpu_excluded_until[cpu]) {
+			cpu_excluded[cpu] = false;
+			printf("Load-aware: re-add CPU:%u\n", cpu);
+			changed = true;
+		}
+	}
+	return changed;
 }
 
 
@@ -452,17 +898,39 @@ static inline void swap(struct stats_record **a, struct stats_record **b)
 	*b = tmp;
 }
 
+/* With --replace, an unchanged entry of the reused cpu_map is kept, as
+ * an update restarts the kthread of that CPU.  An entry with a second
+ * stage prog (reads back the prog id, not the fd) is always updated.
+ */
+static bool cpu_entry_unchanged(__u32 cpu, __u32 queue_size)
+{
+	struct cpumap_value value = {};
+
+	if (!cpu_map_reused || cpumap_value_ext)
+		return false;
+	if (bpf_map_lookup_elem(bpf_load_map_fd("cpu_map"), &cpu, &value))
+		return false;
+	return value.qsize == queue_size;
+}
+
 static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 			    __u32 avail_idx, bool new)
 {
-	__u32 curr_cpus_count = 0;
-	__u32 key = 0;
+	struct cpumap_value value = {};
+	static __u32 curr_cpus_count;
 	int ret;
 
 	/* Add a CPU entry to cpumap, as this allocate a cpu entry in
-	 * the kernel for the cpu.
+	 * the kernel for the cpu.  Second-stage prog is only read by
+	 * the kernel with extended value_size (fd <= 0 means none).
 	 */
-	ret = bpf_map_update_elem(map_fd[0], &cpu, &queue_size, 0);
+	value.qsize = queue_size;
+	value.bpf_prog.fd = cpumap_prog_fd;
+	if (new && cpu_entry_unchanged(cpu, queue_size))
+		ret = 0;
+	else
+		ret = bpf_map_update_elem(bpf_load_map_fd("cpu_map"), &cpu,
+					  &value, 0);
 	if (ret) {
 		fprintf(stderr, "Create CPU entry failed (err:%d)\n", ret);
 		exit(EXIT_FAIL_BPF);
@@ -471,29 +939,30 @@ static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 	/* Inform bpf_prog's that a new CPU is available to select
 	 * from via some control maps.
 	 */
-	/* map_fd[5] = cpus_available */
-	ret = bpf_map_update_elem(map_fd[5], &avail_idx, &cpu, 0);
+	ret = bpf_map_update_elem(bpf_load_map_fd("cpus_available"),
+				  &avail_idx, &cpu, 0);
 	if (ret) {
 		fprintf(stderr, "Add to avail CPUs failed\n");
 		exit(EXIT_FAIL_BPF);
 	}
 
-	/* When not replacing/updating existing entry, bump the count */
-	/* map_fd[6] = cpus_count */
-	ret = bpf_map_lookup_elem(map_fd[6], &key, &curr_cpus_count);
-	if (ret) {
-		fprintf(stderr, "Failed reading curr cpus_count\n");
-		exit(EXIT_FAIL_BPF);
-	}
+	/* When not replacing/updating existing entry, bump the count,
+	 * global variable cpus_count in _kern.c.
+	 */
 	if (new) {
 		curr_cpus_count++;
-		ret = bpf_map_update_elem(map_fd[6], &key, &curr_cpus_count, 0);
+		ret = bpf_load_global_update("cpus_count", &curr_cpus_count,
+					     sizeof(curr_cpus_count));
 		if (ret) {
 			fprintf(stderr, "Failed write curr cpus_count\n");
 			exit(EXIT_FAIL_BPF);
 		}
 	}
-	/* map_fd[7] = cpus_iterator */
+	cpus_added[avail_idx] = cpu;
+	cpus_qsize[avail_idx] = queue_size;
+	if (new)
+		cpus_added_cnt++;
+
 	printf("%s CPU:%u as idx:%u queue_size:%d (total cpus_count:%u)\n",
 	       new ? "Add-new":"Replace", cpu, avail_idx,
 	       queue_size, curr_cpus_count);
@@ -501,17 +970,56 @@ static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 	return 0;
 }
 
+/* Size maps indexed by CPU from the possible CPUs, instead of the
+ * compile time MAX_CPUS in _kern.c
+ */
+static void resize_maps_max_cpus(void)
+{
+	static const char *maps[] = {
+		"cpu_map", "cpumap_enqueue_cnt", "cpus_available",
+	};
+	int i;
+
+	for (i = 0; i < sizeof(maps) / sizeof(maps[0]); i++) {
+		if (bpf_load_map_resize(maps[i], max_cpus)) {
+			fprintf(stderr, "ERR: resize map %s\n", maps[i]);
+			exit(EXIT_FAIL_MEM);
+		}
+	}
+}
+
+static void fixup_map_cpumap_value(struct bpf_map_data *map, int idx)
+{
+	if (!strcmp(map->name, "cpu_map") && cpumap_value_ext)
+		map->def.value_size = sizeof(struct cpumap_value);
+}
+
+static void alloc_cpu_state(void)
+{
+	cpus_added         = calloc(max_cpus, sizeof(*cpus_added));
+	cpus_qsize         = calloc(max_cpus, sizeof(*cpus_qsize));
+	cpu_excluded       = calloc(max_cpus, sizeof(*cpu_excluded));
+	cpu_excluded_until = calloc(max_cpus, sizeof(*cpu_excluded_until));
+	qsize_quiet        = calloc(max_cpus, sizeof(*qsize_quiet));
+	if (!cpus_added || !cpus_qsize || !cpu_excluded ||
+	    !cpu_excluded_until || !qsize_quiet) {
+		fprintf(stderr, "Mem alloc error (max_cpus:%d)\n", max_cpus);
+		exit(EXIT_FAIL_MEM);
+	}
+}
+
 /* CPUs are zero-indexed. Thus, add a special sentinel default value
- * in map cpus_available to mark CPU index'es not configured
+ * in map cpus_available to mark CPU index'es not configured, from
+ * index @from (the CPUs kept from a reused map are below that).
  */
-static void mark_cpus_unavailable(void)
+static void mark_cpus_unavailable(int from)
 {
-	__u32 invalid_cpu = MAX_CPUS;
+	__u32 invalid_cpu = CPU_INVALID;
 	int ret, i;
 
-	for (i = 0; i < MAX_CPUS; i++) {
-		/* map_fd[5] = cpus_available */
-		ret = bpf_map_update_elem(map_fd[5], &i, &invalid_cpu, 0);
+	for (i = from; i < max_cpus; i++) {
+		ret = bpf_map_update_elem(bpf_load_map_fd("cpus_available"),
+					  &i, &invalid_cpu, 0);
 		if (ret) {
 			fprintf(stderr, "Failed marking CPU unavailable\n");
 			exit(EXIT_FAIL_BPF);
@@ -531,9 +1039,55 @@ static void stress_cpumap(void)
 	create_cpu_entry(1, 16000, 0, false);
 }
 
+/* Adaptive queue size per cpumap entry.  A deeper queue absorbs
+ * bursts, but adds latency and (ixgbe) hurts page recycling.  Double
+ * qsize on enqueue drops, and shrink by 1/4 after QSIZE_QUIET_INTERVALS
+ * intervals with traffic but no drops.  Shrinking is kept slow, as
+ * changing qsize frees and allocates a new cpumap entry in the kernel.
+ */
+static __u32 qsize_min = 64;
+static __u32 qsize_max = 8192;
+#define QSIZE_QUIET_INTERVALS 5
+
+static void qsize_adapt(struct stats_record *rec, struct stats_record *prev)
+{
+	int i;
+
+	for (i = 0; i < cpus_added_cnt; i++) {
+		__u32 cpu = cpus_added[i];
+		struct datarec *r = &rec->enq[cpu].total;
+		struct datarec *p = &prev->enq[cpu].total;
+		__u64 processed = r->processed - p->processed;
+		__u64 dropped = r->dropped - p->dropped;
+		__u32 old = cpus_qsize[i];
+		__u32 new = old;
+
+		if (dropped) {
+			new = old * 2;
+			qsize_quiet[i] = 0;
+		} else if (processed &&
+			   ++qsize_quiet[i] >= QSIZE_QUIET_INTERVALS) {
+			new = old - old / 4;
+			qsize_quiet[i] = 0;
+		}
+		if (new > qsize_max)
+			new = qsize_max;
+		if (new < qsize_min)
+			new = qsize_min;
+		if (new == old)
+			continue;
+
+		printf("qsize-adapt: CPU:%u qsize %u -> %u (drops:%llu)\n",
+		       cpu, old, new, dropped);
+		create_cpu_entry(cpu, new, i, false);
+	}
+}
+
 static void stats_poll(int interval, bool use_separators, int prog_num,
-		       bool stress_mode)
+		       bool stress_mode, double drop_pct, bool adapt_qsize)
 {
+	int moved;
+
 	struct stats_record *record, *prev;
 
 	record = alloc_stats_record();
@@ -548,29 +1102,295 @@ static void stats_poll(int interval, bool use_separators, int prog_num,
 		swap(&prev, &record);
 		stats_collect(record);
 		stats_print(record, prev, prog_num);
+		if (adapt_qsize)
+			qsize_adapt(record, prev);
+		if (drop_pct > 0 && load_aware_update(record, prev, drop_pct)) {
+			moved = maglev_rebuild();
+			printf("Maglev: rebuild moved %d of %d slots\n",
+			       moved, MAGLEV_TABLE_SIZE);
+		}
 		sleep(interval);
-		if (stress_mode)
+		if (stress_mode) {
 			stress_cpumap();
+			if (prog_num == PROG_MAGLEV)
+				maglev_rebuild();
+		}
 	}
 
 	free_stats_record(record);
 	free_stats_record(prev);
 }
 
+/* Re-create all cpumap entries, e.g. to change second-stage prog */
+static void cpumap_entries_update(void)
+{
+	int i;
+
+	for (i = 0; i < cpus_added_cnt; i++)
+		create_cpu_entry(cpus_added[i], cpus_qsize[i], i, false);
+}
+
+static void bench_measure(int sec, double *rx_pps, double *drop_pps)
+{
+	struct stats_record *rec, *prev;
+	double t;
+
+	rec  = alloc_stats_record();
+	prev = alloc_stats_record();
+	sleep(1); /* Warmup, let cpumap kthreads settle */
+	stats_collect(prev);
+	sleep(sec);
+	stats_collect(rec);
+
+	t = calc_period(&rec->rx_cnt, &prev->rx_cnt);
+	*rx_pps = calc_pps(&rec->rx_cnt.total, &prev->rx_cnt.total, t);
+	/* Drops are counted in rx_cnt by 1-stage, in cpumap_prog_cnt by 2-stage */
+	*drop_pps = calc_drop_pps(&rec->rx_cnt.total, &prev->rx_cnt.total, t);
+	t = calc_period(&rec->cpumap_prog, &prev->cpumap_prog);
+	*drop_pps += calc_drop_pps(&rec->cpumap_prog.total,
+				   &prev->cpumap_prog.total, t);
+
+	free_stats_record(rec);
+	free_stats_record(prev);
+}
+
+/* Benchmark DDoS filter (pktgen UDP port 9) in 1-stage vs 2-stage.
+ *  1-stage: prognum4 filters on the RX CPU, cpumap without prog
+ *  2-stage: prognum2 round-robin redirects all, and second-stage prog
+ *           xdp_cpumap/ddos_filter_pktgen filters on the cpumap CPUs
+ * When the RX CPU is the bottleneck, 2-stage should show higher rx-pps.
+ */
+static int bench_stages(int sec)
+{
+	char *fmt = "%-8s %-42s %'-14.0f %'-14.0f\n";
+	double rx1, drop1, rx2, drop2;
+
+	cpumap_prog_fd = -1;
+	cpumap_entries_update();
+	if (set_link_xdp_fd(ifindex, prog_fd[PROG_DDOS_FILTER], xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+	printf("Bench 1-stage for %d sec\n", sec);
+	bench_measure(sec, &rx1, &drop1);
+
+	cpumap_prog_fd = prog_fd[MAX_PROG + CPUMAP_PROG_DDOS_FILTER];
+	cpumap_entries_update();
+	if (set_link_xdp_fd(ifindex, prog_fd[PROG_ROUND_ROBIN], xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+	printf("Bench 2-stage for %d sec\n", sec);
+	bench_measure(sec, &rx2, &drop2);
+
+	printf("\n%-8s %-42s %-14s %-14s\n",
+	       "stages", "progs", "rx-pps", "drop-pps");
+	printf(fmt, "1-stage", "xdp_cpu_map4_ddos_filter_pktgen",
+	       rx1, drop1);
+	printf(fmt, "2-stage", "xdp_cpu_map2 + xdp_cpumap/ddos_filter_pktgen",
+	       rx2, drop2);
+	printf("rx-pps ratio 2-stage/1-stage: %.2f\n", rx1 > 0 ? rx2 / rx1 : 0);
+
+	set_link_xdp_fd(ifindex, -1, xdp_flags);
+	return EXIT_OK;
+}
+
+/* Get (val < 0) or set device GRO feature via legacy ethtool ioctl.
+ * Returns the GRO state, or negative errno.
+ */
+static int dev_gro(int val)
+{
+	struct ethtool_value eval = { .cmd = ETHTOOL_GGRO };
+	struct ifreq ifr = {};
+	int fd, err = 0;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -errno;
+	strncpy(ifr.ifr_name, ifname, IF_NAMESIZE - 1);
+	ifr.ifr_data = (void *)&eval;
+	if (val >= 0) {
+		eval.cmd = ETHTOOL_SGRO;
+		eval.data = val;
+		if (ioctl(fd, SIOCETHTOOL, &ifr) < 0)
+			err = -errno;
+		eval.cmd = ETHTOOL_GGRO;
+	}
+	if (!err && ioctl(fd, SIOCETHTOOL, &ifr) < 0)
+		err = -errno;
+	close(fd);
+	return err ? err : !!eval.data;
+}
+
+/* Sum of one counter in /proc/net/snmp or netstat format, where a
+ * header line of names is followed by a line of values.
+ */
+static __u64 proc_net_counter(const char *file, const char *prefix,
+			      const char *name)
+{
+	char names[2048], values[2048];
+	char *n, *v, *sn, *sv;
+	__u64 res = 0;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f)
+		return 0;
+	while (fgets(names, sizeof(names), f) &&
+	       fgets(values, sizeof(values), f)) {
+		if (strncmp(names, prefix, strlen(prefix)))
+			continue;
+		n = strtok_r(names, " \n", &sn);
+		v = strtok_r(values, " \n", &sv);
+		while (n && v) {
+			if (!strcmp(n, name)) {
+				res = strtoull(v, NULL, 10);
+				break;
+			}
+			n = strtok_r(NULL, " \n", &sn);
+			v = strtok_r(NULL, " \n", &sv);
+		}
+		break;
+	}
+	fclose(f);
+	return res;
+}
+
+struct gro_sample {
+	__u64 timestamp;
+	__u64 tcp_segs;
+	__u64 ip_bytes;
+	__u64 cpu_busy; /* jiffies, all CPUs */
+	__u64 cpu_total;
+};
+
+static void gro_sample_collect(struct gro_sample *s)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, sirq, steal;
+	FILE *f;
+
+	memset(s, 0, sizeof(*s));
+	s->timestamp = stats_gettime();
+	s->tcp_segs = proc_net_counter("/proc/net/snmp", "Tcp:", "InSegs");
+	s->ip_bytes = proc_net_counter("/proc/net/netstat", "IpExt:",
+				       "InOctets");
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return;
+	if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &user, &nice, &sys, &idle, &iowait, &irq, &sirq,
+		   &steal) == 8) {
+		s->cpu_busy  = user + nice + sys + irq + sirq + steal;
+		s->cpu_total = s->cpu_busy + idle + iowait;
+	}
+	fclose(f);
+}
+
+struct gro_result {
+	double gbit;
+	double segs_pps;
+	double cpus; /* busy CPUs, summed over all CPUs */
+};
+
+static void gro_measure(int sec, struct gro_result *res)
+{
+	int nr_cpus = bpf_num_possible_cpus();
+	struct gro_sample prev, cur;
+	__u64 period;
+	double busy;
+
+	sleep(1); /* Warmup, let TCP ramp up after the prog change */
+	gro_sample_collect(&prev);
+	sleep(sec);
+	gro_sample_collect(&cur);
+
+	period = cur.timestamp - prev.timestamp;
+	busy = cur.cpu_total - prev.cpu_total;
+	res->gbit = stats_rate(cur.ip_bytes - prev.ip_bytes, period) * 8 / 1e9;
+	res->segs_pps = stats_rate(cur.tcp_segs - prev.tcp_segs, period);
+	res->cpus = busy ? (cur.cpu_busy - prev.cpu_busy) / busy * nr_cpus : 0;
+}
+
+/* Benchmark TCP RX with and without cpumap GRO.  Rows run prognum7
+ * (all flows redirected, TCP GRO'ed by cpumap if the kernel can) and
+ * prognum9 (TCP stays on the RX CPU and is GRO'ed by the driver),
+ * with device GRO on and off.  CPU cost is the busy CPU time of the
+ * whole host, thus include the TCP receiver application.
+ */
+static int bench_gro(int sec)
+{
+	char *fmt = "%-4s %-36s %-10.2f %'-14.0f %-8.2f %-8.2f\n";
+	static const int progs[] = { PROG_L4_HASH, PROG_NON_TCP };
+	static const char *names[] = { "xdp_cpu_map7_ip_l4_flow_hash",
+				       "xdp_cpu_map9_non_tcp_l4_flow_hash" };
+	int nr_progs = sizeof(progs) / sizeof(progs[0]);
+	struct gro_result res[2][2];
+	int gro_orig, gro, i;
+
+	gro_orig = dev_gro(-1);
+	if (gro_orig < 0) {
+		fprintf(stderr, "ERR: cannot get GRO on %s: %s\n",
+			ifname, strerror(-gro_orig));
+		return EXIT_FAIL;
+	}
+
+	for (gro = 0; gro < 2; gro++) {
+		if (dev_gro(gro) != gro) {
+			fprintf(stderr, "ERR: cannot %s GRO on %s\n",
+				gro ? "enable" : "disable", ifname);
+			dev_gro(gro_orig);
+			return EXIT_FAIL;
+		}
+		for (i = 0; i < nr_progs; i++) {
+			if (set_link_xdp_fd(ifindex, prog_fd[progs[i]],
+					    xdp_flags) < 0) {
+				fprintf(stderr, "link set xdp fd failed\n");
+				dev_gro(gro_orig);
+				return EXIT_FAIL_XDP;
+			}
+			printf("Bench GRO %s %s for %d sec\n",
+			       gro ? "on" : "off", names[i], sec);
+			gro_measure(sec, &res[gro][i]);
+		}
+	}
+	set_link_xdp_fd(ifindex, -1, xdp_flags);
+	dev_gro(gro_orig);
+
+	printf("\n%-4s %-36s %-10s %-14s %-8s %-8s\n",
+	       "gro", "prog", "Gbit/s", "tcp-segs/s", "cpus", "Gbit/cpu");
+	for (gro = 0; gro < 2; gro++) {
+		for (i = 0; i < nr_progs; i++) {
+			struct gro_result *r = &res[gro][i];
+
+			printf(fmt, gro ? "on" : "off", names[i], r->gbit,
+			       r->segs_pps, r->cpus,
+			       r->cpus > 0 ? r->gbit / r->cpus : 0);
+		}
+	}
+	return EXIT_OK;
+}
+
 int main(int argc, char **argv)
 {
 	struct rlimit r = {10 * 1024 * 1024, RLIM_INFINITY};
 	bool use_separators = true;
 	bool stress_mode = false;
+	bool adapt_qsize = false;
+	int cpumap_prog_num = -1;
+	__u32 *add_qsize, *add_cpus;
+	double drop_pct = 0;
 	char filename[256];
 	bool debug = false;
+	bool replace = false;
+	int bench_sec = 0;
+	int gro_sec = 0;
 	int added_cpus = 0;
 	int longindex = 0;
 	int interval = 2;
 	int prog_num = 0;
 	int add_cpu = -1;
 	__u32 qsize;
-	int opt;
+	int opt, i, err;
 
 	/* Notice: choosing he queue size is very important with the
 	 * ixgbe driver, because it's driver page recycling trick is
@@ -587,18 +1407,16 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	if (load_bpf_file(filename)) {
-		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
-		return EXIT_FAIL;
+	max_cpus = bpf_num_possible_cpus();
+	alloc_cpu_state();
+	/* CPU entries are created after load, as map defs depend on options */
+	add_cpus  = calloc(max_cpus, sizeof(*add_cpus));
+	add_qsize = calloc(max_cpus, sizeof(*add_qsize));
+	if (!add_cpus || !add_qsize) {
+		fprintf(stderr, "Mem alloc error (max_cpus:%d)\n", max_cpus);
+		return EXIT_FAIL_MEM;
 	}
 
-	if (!prog_fd[0]) {
-		fprintf(stderr, "ERR: load_bpf_file: %s\n", strerror(errno));
-		return EXIT_FAIL;
-	}
-
-	mark_cpus_unavailable();
-
 	/* Parse commands line args */
 	while ((opt = getopt_long(argc, argv, "hSd:",
 				  long_options, &longindex)) != -1) {
@@ -646,18 +1464,81 @@ int main(int argc, char **argv)
 		case 'c':
 			/* Add multiple CPUs */
 			add_cpu = strtoul(optarg, NULL, 0);
-			if (add_cpu >= MAX_CPUS) {
+			if (add_cpu >= max_cpus) {
 				fprintf(stderr,
 				"--cpu nr too large for cpumap err(%d):%s\n",
 					errno, strerror(errno));
 				goto error;
 			}
-			create_cpu_entry(add_cpu, qsize, added_cpus, true);
+			if (added_cpus >= max_cpus) {
+				fprintf(stderr, "--cpu given too many times\n");
+				goto error;
+			}
+			add_cpus[added_cpus]  = add_cpu;
+			add_qsize[added_cpus] = qsize;
 			added_cpus++;
 			break;
+		case 'C':
+			/* Second-stage prog on cpumap entries */
+			cpumap_prog_num = atoi(optarg);
+			if (cpumap_prog_num < 0 ||
+			    cpumap_prog_num >= MAX_CPUMAP_PROG) {
+				fprintf(stderr, "--cpumap-prog must be 0-%d\n",
+					MAX_CPUMAP_PROG - 1);
+				goto error;
+			}
+			cpumap_value_ext = true;
+			break;
+		case 'b':
+			bench_sec = atoi(optarg);
+			if (bench_sec <= 0) {
+				fprintf(stderr, "--bench sec must be > 0\n");
+				goto error;
+			}
+			cpumap_value_ext = true;
+			break;
+		case 'g':
+			gro_sec = atoi(optarg);
+			if (gro_sec <= 0) {
+				fprintf(stderr, "--gro-bench sec must be > 0\n");
+				goto error;
+			}
+			break;
 		case 'q':
 			qsize = atoi(optarg);
 			break;
+		case 'a':
+			adapt_qsize = true;
+			break;
+		case 't':
+			/* Only show N busiest CPUs per stats section */
+			top_n = atoi(optarg);
+			if (top_n < 0) {
+				fprintf(stderr, "--top must be >= 0\n");
+				goto error;
+			}
+			break;
+		case 'm':
+			qsize_min = atoi(optarg);
+			break;
+		case 'M':
+			qsize_max = atoi(optarg);
+			break;
+		case 'R':
+			replace = true;
+			/* fall through */
+		case 'P':
+			pin_mode = true;
+			break;
+		case 'l':
+			/* Load-aware Maglev, exclude CPUs above drop pct */
+			drop_pct = strtod(optarg, NULL);
+			if (drop_pct <= 0 || drop_pct > 100) {
+				fprintf(stderr,
+					"--load-aware drop pct must be 0-100\n");
+				goto error;
+			}
+			break;
 		case 'h':
 		error:
 		default:
@@ -679,10 +1560,79 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_OPTION;
 	}
 
+	if (adapt_qsize && (!qsize_min || qsize_min > qsize_max)) {
+		fprintf(stderr, "ERR: need 0 < --qsize-min <= --qsize-max\n");
+		return EXIT_FAIL_OPTION;
+	}
+	if (drop_pct > 0 && prog_num != PROG_MAGLEV) {
+		fprintf(stderr, "ERR: --load-aware needs --prognum %d\n",
+			PROG_MAGLEV);
+		return EXIT_FAIL_OPTION;
+	}
+
+	/* The RX hash kfunc of prognum8 needs device bound XDP progs,
+	 * which cannot be attached in skb mode (there it falls back to
+	 * the software hash).
+	 */
+	resize_maps_max_cpus();
+	if (pin_mode) {
+		if (snprintf(pin_dir, sizeof(pin_dir), "%s/%s", PIN_BASE_DIR,
+			     ifname) >= sizeof(pin_dir) ||
+		    bpf_load_pin_maps(pin_dir)) {
+			fprintf(stderr, "ERR: cannot pin maps in %s/%s"
+				" (BPF filesystem mounted?)\n", PIN_BASE_DIR,
+				ifname);
+			return EXIT_FAIL_BPF;
+		}
+	}
+	if (prog_num == PROG_HW_HASH && !(xdp_flags & XDP_FLAGS_SKB_MODE))
+		err = load_bpf_file_dev_bound(filename, ifindex,
+					      fixup_map_cpumap_value);
+	else
+		err = load_bpf_file_fixup_map(filename, fixup_map_cpumap_value);
+	if (err) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		if (cpumap_value_ext)
+			fprintf(stderr, "Note: cpumap progs need kernel v5.9+\n");
+		return EXIT_FAIL;
+	}
+
+	if (!prog_fd[0]) {
+		fprintf(stderr, "ERR: load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL;
+	}
+
+	if (cpumap_prog_num >= 0)
+		cpumap_prog_fd = prog_fd[MAX_PROG + cpumap_prog_num];
+
+	/* Keep the reused CPU entries valid, as the old prog still runs */
+	cpu_map_reused = bpf_load_map_reused("cpu_map");
+	if (replace && !cpu_map_reused)
+		fprintf(stderr, "WARN: --replace: no pinned maps reused\n");
+	mark_cpus_unavailable(cpu_map_reused ? added_cpus : 0);
+	for (i = 0; i < added_cpus; i++)
+		create_cpu_entry(add_cpus[i], add_qsize[i], i, true);
+	free(add_cpus);
+	free(add_qsize);
+
+	if (prog_num == PROG_MAGLEV)
+		printf("Maglev: populated %d slots\n", maglev_rebuild());
+
 	/* Remove XDP program when program is interrupted */
 	signal(SIGINT, int_exit);
 
-	if (set_link_xdp_fd(ifindex, prog_fd[prog_num], xdp_flags) < 0) {
+	if (bench_sec) {
+		if (use_separators)
+			setlocale(LC_NUMERIC, "en_US");
+		return bench_stages(bench_sec);
+	}
+	if (gro_sec) {
+		if (use_separators)
+			setlocale(LC_NUMERIC, "en_US");
+		return bench_gro(gro_sec);
+	}
+
+	if (attach_xdp_prog(prog_fd[prog_num], replace) < 0) {
 		fprintf(stderr, "link set xdp fd failed\n");
 		return EXIT_FAIL_XDP;
 	}
@@ -692,6 +1642,7 @@ int main(int argc, char **argv)
 		read_trace_pipe();
 	}
 
-	stats_poll(interval, use_separators, prog_num, stress_mode);
+	stats_poll(interval, use_separators, prog_num, stress_mode, drop_pct,
+		   adapt_qsize);
 	return EXIT_OK;
 }
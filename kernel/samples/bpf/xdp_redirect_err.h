@@ -0,0 +1,16 @@
+#ifndef __XDP_REDIRECT_ERR_H__
+#define __XDP_REDIRECT_ERR_H__
+
+/* Shared between xdp_redirect_err _kern.c and _user.c */
+
+/* Size of both devmaps, vport ids of the hash prog are 16 bit */
+#define VPORTS_MAX	1024
+
+enum redir_cnt_t {
+	REDIR_RX = 0,	/* Packets into the hash and bcast progs */
+	REDIR_MISS,	/* bpf_redirect_map() did not return XDP_REDIRECT */
+	REDIR_ERR,	/* Tracepoints xdp_redirect{,_map}_err */
+	REDIR_CNT_MAX
+};
+
+#endif /* __XDP_REDIRECT_ERR_H__ */
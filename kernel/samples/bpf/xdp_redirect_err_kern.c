@@ -25,11 +25,15 @@
 #include <linux/ipv6.h>
 #include "bpf_helpers.h"
 
+#include "xdp_monitor.h"
+#include "xdp_redirect_err.h"
+
+/* WARNING - sync map and prog order with MAP_IDX_* and PROG_* in _user.c */
 struct bpf_map_def SEC("maps") tx_port = {
 	.type = BPF_MAP_TYPE_DEVMAP,
 	.key_size = sizeof(int),
 	.value_size = sizeof(int),
-	.max_entries = 100,
+	.max_entries = VPORTS_MAX,
 };
 
 /* Count RX packets, as XDP bpf_prog doesn't get direct TX-success
@@ -42,6 +46,38 @@ struct bpf_map_def SEC("maps") rxcnt = {
 	.max_entries = 1,
 };
 
+/* Virtual ports (e.g. VM tap devs) by id, sparse like a bridge FDB */
+struct bpf_map_def SEC("maps") tx_port_hash = {
+	.type = BPF_MAP_TYPE_DEVMAP_HASH,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(int),
+	.max_entries = VPORTS_MAX,
+};
+
+/* Indexed by enum redir_cnt_t */
+struct bpf_map_def SEC("maps") redir_cnt = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = REDIR_CNT_MAX,
+};
+
+/* Devmap TX bulking, only entry BULK_DEVMAP_XMIT used */
+struct bpf_map_def SEC("maps") bulk_hist = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct bulk_histogram),
+	.max_entries = BULK_TYPE_MAX,
+};
+
+static __always_inline void redir_cnt_inc(u32 key)
+{
+	u64 *cnt = bpf_map_lookup_elem(&redir_cnt, &key);
+
+	if (cnt)
+		*cnt += 1;
+}
+
 static void swap_src_dst_mac(void *data)
 {
 	unsigned short *p = data;
@@ -117,4 +153,119 @@ int xdp_prog_redirect_map_rr(struct xdp_md *ctx)
 	return bpf_redirect_map(&tx_port, vport, 0);
 }
 
+/* The vport id is the low 16 bits of the dst MAC, as from pktgen with
+ * dst_mac_count, 00:00 upto the number of vports.
+ */
+static __always_inline int vport_id(struct xdp_md *ctx, u32 *id)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+
+	if (eth + 1 > data_end)
+		return -1;
+	*id = (eth->h_dest[4] << 8) | eth->h_dest[5];
+	return 0;
+}
+
+/* A missing key, or an empty broadcast map, returns the action in the
+ * lower bits of flags (here XDP_ABORTED) instead of XDP_REDIRECT.
+ */
+static __always_inline int redirect_account(int action)
+{
+	redir_cnt_inc(REDIR_RX);
+	if (action != XDP_REDIRECT)
+		redir_cnt_inc(REDIR_MISS);
+	return action;
+}
+
+SEC("xdp_redirect_hash")
+int xdp_prog_redirect_hash(struct xdp_md *ctx)
+{
+	u32 id;
+
+	if (vport_id(ctx, &id))
+		return XDP_DROP;
+	return redirect_account(bpf_redirect_map(&tx_port_hash, id, 0));
+}
+
+/* Multicast/flood, a clone to every vport except the ingress dev */
+SEC("xdp_redirect_bcast")
+int xdp_prog_redirect_bcast(struct xdp_md *ctx)
+{
+	return redirect_account(bpf_redirect_map(&tx_port_hash, 0,
+			BPF_F_BROADCAST | BPF_F_EXCLUDE_INGRESS));
+}
+
+SEC("xdp_redirect_bcast_array")
+int xdp_prog_redirect_bcast_array(struct xdp_md *ctx)
+{
+	return redirect_account(bpf_redirect_map(&tx_port, 0,
+			BPF_F_BROADCAST | BPF_F_EXCLUDE_INGRESS));
+}
+
+/* Redirect errors and devmap TX bulking, as in xdp_monitor_kern.c
+ *
+ * Tracepoint format: /sys/kernel/debug/tracing/events/xdp/xdp_redirect/format
+ * Code in:                kernel/include/trace/events/xdp.h
+ */
+struct xdp_redirect_ctx {
+	u64 __pad;		// First 8 bytes are not accessible by bpf code
+	int prog_id;		//	offset:8;  size:4; signed:1;
+	u32 act;		//	offset:12  size:4; signed:0;
+	int ifindex;		//	offset:16  size:4; signed:1;
+	int err;		//	offset:20  size:4; signed:1;
+	int to_ifindex;		//	offset:24  size:4; signed:1;
+	u32 map_id;		//	offset:28  size:4; signed:0;
+	int map_index;		//	offset:32  size:4; signed:1;
+};				//	offset:36
+
+/* Also system wide, not only from the progs here */
+SEC("tracepoint/xdp/xdp_redirect_err")
+int trace_xdp_redirect_err(struct xdp_redirect_ctx *ctx)
+{
+	redir_cnt_inc(REDIR_ERR);
+	return 0;
+}
+
+SEC("tracepoint/xdp/xdp_redirect_map_err")
+int trace_xdp_redirect_map_err(struct xdp_redirect_ctx *ctx)
+{
+	redir_cnt_inc(REDIR_ERR);
+	return 0;
+}
+
+struct devmap_xmit_ctx {
+	u64 __pad;		// First 8 bytes are not accessible by bpf code
+	int __unused1;		//	offset:8;  size:4;
+	u32 act;		//	offset:12; size:4; signed:0;
+	int __unused2;		//	offset:16; size:4;
+	int drops;		//	offset:20; size:4; signed:1;
+	int sent;		//	offset:24; size:4; signed:1;
+};
+
+/* Per devmap flush of a dev, a broadcast flushes every vport dev */
+SEC("tracepoint/xdp/xdp_devmap_xmit")
+int trace_xdp_devmap_xmit(struct devmap_xmit_ctx *ctx)
+{
+	int sent = ctx->sent, drops = ctx->drops;
+	u32 key = BULK_DEVMAP_XMIT;
+	struct bulk_histogram *h;
+	unsigned int bulk;
+
+	if (sent < 0 || drops < 0)
+		return 0;
+	h = bpf_map_lookup_elem(&bulk_hist, &key);
+	if (!h)
+		return 0;
+	bulk = sent + drops;
+	h->events++;
+	h->pkts  += bulk;
+	h->drops += drops;
+	if (bulk >= BULK_HIST_MAX)
+		bulk = BULK_HIST_MAX - 1;
+	h->hist[bulk]++;
+	return 0;
+}
+
 char _license[] SEC("license") = "GPL";
@@ -13,7 +13,6 @@
  */
 #include <linux/bpf.h>
 #include <linux/if_link.h>
-#include <assert.h>
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
@@ -26,59 +25,141 @@
 #include "bpf_load.h"
 #include "bpf_util.h"
 #include "libbpf.h"
+#include "xdp_stats.h"
+#include "xdp_monitor.h"
+#include "xdp_redirect_err.h"
+
+/* WARNING - sync with map and prog order in _kern.c */
+#define MAP_IDX_TX_PORT		0
+#define MAP_IDX_RXCNT		1
+#define MAP_IDX_TX_PORT_HASH	2
+#define MAP_IDX_REDIR_CNT	3
+#define MAP_IDX_BULK_HIST	4
+
+#define PROG_REDIRECT_ERR	0
+#define PROG_DUMMY		1
+#define PROG_REDIRECT_RR	2
+#define PROG_REDIRECT_HASH	3
+#define PROG_REDIRECT_BCAST	4
+#define PROG_REDIRECT_BCAST_ARR	5
+
+static const struct {
+	const char *name;
+	int prog;
+} modes[] = {
+	{ "err",	PROG_REDIRECT_ERR },
+	{ "rr",		PROG_REDIRECT_RR },
+	{ "hash",	PROG_REDIRECT_HASH },
+	{ "bcast",	PROG_REDIRECT_BCAST },
+	{ "bcast-array", PROG_REDIRECT_BCAST_ARR },
+	{ NULL, 0 }
+};
+
+#define IFINDEX_OUT_MAX	64
 
 static int ifindex_in;
-static int ifindex_out;
-static bool ifindex_out_xdp_dummy_attached = true;
+static int ifindex_out[IFINDEX_OUT_MAX];
+static bool ifindex_out_xdp_dummy_attached[IFINDEX_OUT_MAX];
+static int nr_out;
 
 static __u32 xdp_flags;
 
 static void int_exit(int sig)
 {
+	int i;
+
 	set_link_xdp_fd(ifindex_in, -1, xdp_flags);
-	if (ifindex_out_xdp_dummy_attached)
-		set_link_xdp_fd(ifindex_out, -1, xdp_flags);
+	for (i = 0; i < nr_out; i++)
+		if (ifindex_out_xdp_dummy_attached[i])
+			set_link_xdp_fd(ifindex_out[i], -1, xdp_flags);
 	exit(0);
 }
 
-static void poll_stats(int interval, int ifindex)
+struct stats_rec {
+	__u64 rxcnt;
+	__u64 redir[REDIR_CNT_MAX];
+	struct bulk_histogram bulk;
+};
+
+static void stats_collect(struct stats_rec *rec)
 {
-	unsigned int nr_cpus = bpf_num_possible_cpus();
-	__u64 values[nr_cpus], prev[nr_cpus];
+	rec->rxcnt = stats_percpu_sum_u64(map_fd[MAP_IDX_RXCNT], 0);
+	stats_percpu_array_sum(map_fd[MAP_IDX_REDIR_CNT], REDIR_CNT_MAX,
+			       rec->redir, sizeof(__u64));
+	stats_percpu_array_sum(map_fd[MAP_IDX_BULK_HIST], 1, &rec->bulk,
+			       sizeof(rec->bulk));
+}
 
-	memset(prev, 0, sizeof(prev));
+/* The TX side is per dev flush, thus a broadcast to N vports shows
+ * about N times the RX rate.
+ */
+static void poll_stats(int interval)
+{
+	struct stats_rec prev, rec;
+	__u64 t_prev, t_now;
 
+	stats_collect(&prev);
+	t_prev = stats_gettime();
+	printf("%-12s %-12s %-12s %-12s %-12s %-12s %-8s\n", "rx-pps",
+	       "miss-pps", "err-pps", "tx-pps", "tx-drop-pps", "flush/s",
+	       "bulk-avg");
 	while (1) {
-		__u64 sum = 0;
-		__u32 key = 0;
-		int i;
+		__u64 period, flush, pkts;
 
 		sleep(interval);
-		assert(bpf_map_lookup_elem(map_fd[1], &key, values) == 0);
-		for (i = 0; i < nr_cpus; i++)
-			sum += (values[i] - prev[i]);
-		if (sum)
-			printf("ifindex %i: %10llu pkt/s\n",
-			       ifindex, sum / interval);
-		memcpy(prev, values, sizeof(values));
+		stats_collect(&rec);
+		t_now = stats_gettime();
+		period = t_now - t_prev;
+		flush = rec.bulk.events - prev.bulk.events;
+		pkts = rec.bulk.pkts - prev.bulk.pkts;
+
+		printf("%-12llu %-12llu %-12llu %-12llu %-12llu %-12llu %-8.2f\n",
+		       stats_rate(rec.rxcnt - prev.rxcnt +
+				  rec.redir[REDIR_RX] - prev.redir[REDIR_RX],
+				  period),
+		       stats_rate(rec.redir[REDIR_MISS] -
+				  prev.redir[REDIR_MISS], period),
+		       stats_rate(rec.redir[REDIR_ERR] -
+				  prev.redir[REDIR_ERR], period),
+		       stats_rate(pkts - (rec.bulk.drops - prev.bulk.drops),
+				  period),
+		       stats_rate(rec.bulk.drops - prev.bulk.drops, period),
+		       stats_rate(flush, period),
+		       flush ? (double)pkts / flush : 0);
+		prev = rec;
+		t_prev = t_now;
 	}
 }
 
 static void usage(const char *prog)
 {
+	int i;
+
 	fprintf(stderr,
-		"usage: %s [OPTS] IFINDEX_IN IFINDEX_OUT\n\n"
+		"usage: %s [OPTS] IFINDEX_IN IFINDEX_OUT [IFINDEX_OUT...]\n\n"
 		"OPTS:\n"
 		"    -S    use skb-mode\n"
-		"    -N    enforce native mode\n",
-		prog);
+		"    -N    enforce native mode\n"
+		"    -n N  number of vports (default 1, max %d), spread over\n"
+		"          the IFINDEX_OUTs, key 0..N-1 in both devmaps\n"
+		"    -m M  prog, one of:",
+		prog, VPORTS_MAX);
+	for (i = 0; modes[i].name; i++)
+		fprintf(stderr, " %s", modes[i].name);
+	fprintf(stderr, "\n"
+		"          err: the invalid XDP_REDIRECT test-case (default)\n"
+		"          hash: DEVMAP_HASH, vport id from dst MAC 2 low bytes\n"
+		"          bcast/bcast-array: BPF_F_BROADCAST to all vports\n");
 }
 
 int main(int argc, char **argv)
 {
-	const char *optstr = "SN";
+	const char *optstr = "SNn:m:";
+	int prog = PROG_REDIRECT_ERR;
 	char filename[256];
-	int ret, opt, key = 0;
+	int nr_vports = 1;
+	int ret, opt, i;
+	__u32 key;
 
 	while ((opt = getopt(argc, argv, optstr)) != -1) {
 		switch (opt) {
@@ -88,20 +169,41 @@ int main(int argc, char **argv)
 		case 'N':
 			xdp_flags |= XDP_FLAGS_DRV_MODE;
 			break;
+		case 'n':
+			nr_vports = atoi(optarg);
+			if (nr_vports < 1 || nr_vports > VPORTS_MAX) {
+				usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+		case 'm':
+			for (i = 0; modes[i].name; i++)
+				if (!strcmp(optarg, modes[i].name))
+					break;
+			if (!modes[i].name) {
+				usage(basename(argv[0]));
+				return 1;
+			}
+			prog = modes[i].prog;
+			break;
 		default:
 			usage(basename(argv[0]));
 			return 1;
 		}
 	}
 
-	if (optind == argc) {
+	if (argc - optind < 2 || argc - optind > IFINDEX_OUT_MAX + 1) {
 		printf("usage: %s IFINDEX_IN IFINDEX_OUT\n", argv[0]);
 		return 1;
 	}
 
 	ifindex_in = strtoul(argv[optind], NULL, 0);
-	ifindex_out = strtoul(argv[optind + 1], NULL, 0);
-	printf("input: %d output: %d\n", ifindex_in, ifindex_out);
+	for (i = optind + 1; i < argc; i++)
+		ifindex_out[nr_out++] = strtoul(argv[i], NULL, 0);
+	printf("input: %d output: %d", ifindex_in, ifindex_out[0]);
+	for (i = 1; i < nr_out; i++)
+		printf(",%d", ifindex_out[i]);
+	printf(" vports: %d prog: %d\n", nr_vports, prog);
 
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
 
@@ -115,33 +217,40 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	if (set_link_xdp_fd(ifindex_in, prog_fd[0], xdp_flags) < 0) {
+	/* populate virtual to physical port maps, before attaching */
+	for (key = 0; key < nr_vports; key++) {
+		int out = ifindex_out[key % nr_out];
+
+		ret = bpf_map_update_elem(map_fd[MAP_IDX_TX_PORT], &key,
+					  &out, 0);
+		if (!ret)
+			ret = bpf_map_update_elem(map_fd[MAP_IDX_TX_PORT_HASH],
+						  &key, &out, 0);
+		if (ret) {
+			perror("bpf_update_elem");
+			return 1;
+		}
+	}
+
+	if (set_link_xdp_fd(ifindex_in, prog_fd[prog], xdp_flags) < 0) {
 		printf("ERROR: link set xdp fd failed on %d\n", ifindex_in);
 		return 1;
 	}
 
-	/* Loading dummy XDP prog on out-device */
-	if (set_link_xdp_fd(ifindex_out, prog_fd[1],
-			    (xdp_flags | XDP_FLAGS_UPDATE_IF_NOEXIST)) < 0) {
-		printf("WARN: link set xdp fd failed on %d\n", ifindex_out);
-		ifindex_out_xdp_dummy_attached = false;
+	/* Loading dummy XDP prog on out-devices */
+	for (i = 0; i < nr_out; i++) {
+		if (set_link_xdp_fd(ifindex_out[i], prog_fd[PROG_DUMMY],
+				    (xdp_flags | XDP_FLAGS_UPDATE_IF_NOEXIST)) < 0) {
+			printf("WARN: link set xdp fd failed on %d\n",
+			       ifindex_out[i]);
+			continue;
+		}
+		ifindex_out_xdp_dummy_attached[i] = true;
 	}
 
 	signal(SIGINT, int_exit);
 	signal(SIGTERM, int_exit);
 
-	printf("map[0] (vports) = %i, map[1] (map) = %i, map[2] (count) = %i\n",
-		map_fd[0], map_fd[1], map_fd[2]);
-
-	/* populate virtual to physical port map */
-	ret = bpf_map_update_elem(map_fd[0], &key, &ifindex_out, 0);
-	if (ret) {
-		perror("bpf_update_elem");
-		goto out;
-	}
-
-	poll_stats(2, ifindex_out);
-
-out:
+	poll_stats(2);
 	return 0;
 }
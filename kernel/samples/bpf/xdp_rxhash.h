@@ -1,59 +1,50 @@
-// Needed for (obsoleted) xdp_rxhash program.
+/* Shared between xdp_rxhash _kern.c and _user.c */
 #ifndef __XDP_RXHASH_H__
 #define __XDP_RXHASH_H__
 
-/* RX-hash proposed extending xdp_md, was rejected
-
- struct xdp_md {
-        __u32 data;
-        __u32 data_end;
-	__u32 data_meta;
-+       __u32 rxhash;
-+       // Do we need rxhash_type here???
-+       __u32 rxhash_type;
-+       // Can be done as a translation, reading part of xdp_buff->flags
- };
-*/
-
-/* BPF_FUNC_xdp_rxhash flags */
-#define BPF_F_RXHASH_SET		0ULL
-#define BPF_F_RXHASH_GET		(1ULL << 0)
-
-/* XDP rxhash have an associated type, which is related to the RSS
- * (Receive Side Scaling) standard, but NIC HW have different mapping
- * and support. Thus, create mapping that is interesting for XDP.  XDP
- * would primarly want insight into L3 and L4 protocol info.
- *
- * TODO: Likely need to get extended with "L3_IPV6_EX" due RSS standard
- *
- * The HASH_TYPE will be returned as the top 32-bit of the 64-bit
- * rxhash (internally type stored in xdp_buff->flags).
+/* The NIC RX hash is read via kfunc bpf_xdp_metadata_rx_hash(), which
+ * also returns the RSS hash type.  The bits mirror kernel enum
+ * xdp_rss_hash_type (include/net/xdp.h, v6.4), not available in uapi.
+ */
+#define XDP_RSS_L3_IPV4		(1U << 0)
+#define XDP_RSS_L3_IPV6		(1U << 1)
+#define XDP_RSS_L3_DYNHDR	(1U << 2) /* IPv6 extension headers */
+#define XDP_RSS_L4		(1U << 3)
+#define XDP_RSS_L4_TCP		(1U << 4)
+#define XDP_RSS_L4_UDP		(1U << 5)
+#define XDP_RSS_L4_SCTP		(1U << 6)
+#define XDP_RSS_L4_IPSEC	(1U << 7)
+#define XDP_RSS_L4_ICMP		(1U << 8)
+
+/* The RSS type bits are mapped to a compact L3 and L4 index, used as
+ * key into the small stats_htype_L3 and stats_htype_L4 arrays.
  */
-#define XDP_HASH(x)		((x) & ((1ULL << 32)-1))
-#define XDP_HASH_TYPE(x)	((x) >> 32)
-
-#define XDP_HASH_TYPE_L3_SHIFT	0
 #define XDP_HASH_TYPE_L3_BITS	3
-#define XDP_HASH_TYPE_L3_MASK	((1ULL << XDP_HASH_TYPE_L3_BITS)-1)
-#define XDP_HASH_TYPE_L3(x)	((x) & XDP_HASH_TYPE_L3_MASK)
+#define XDP_HASH_TYPE_L3_MAX	(1 << XDP_HASH_TYPE_L3_BITS)
 enum {
 	XDP_HASH_TYPE_L3_IPV4 = 1,
 	XDP_HASH_TYPE_L3_IPV6,
+	XDP_HASH_TYPE_L3_IPV6_EX,
 };
 
-#define XDP_HASH_TYPE_L4_SHIFT	XDP_HASH_TYPE_L3_BITS
 #define XDP_HASH_TYPE_L4_BITS	5
-#define XDP_HASH_TYPE_L4_MASK						\
-	(((1ULL << XDP_HASH_TYPE_L4_BITS)-1) << XDP_HASH_TYPE_L4_SHIFT)
-#define XDP_HASH_TYPE_L4(x)	((x) & XDP_HASH_TYPE_L4_MASK)
+#define XDP_HASH_TYPE_L4_MAX	(1 << XDP_HASH_TYPE_L4_BITS)
 enum {
-	_XDP_HASH_TYPE_L4_TCP = 1,
-	_XDP_HASH_TYPE_L4_UDP,
+	XDP_HASH_TYPE_L4_TCP = 1,
+	XDP_HASH_TYPE_L4_UDP,
+	XDP_HASH_TYPE_L4_SCTP,
+	XDP_HASH_TYPE_L4_IPSEC,
+	XDP_HASH_TYPE_L4_ICMP,
+	XDP_HASH_TYPE_L4_OTHER,	/* XDP_RSS_L4 without a known protocol */
 };
-#define XDP_HASH_TYPE_L4_TCP (_XDP_HASH_TYPE_L4_TCP << XDP_HASH_TYPE_L4_SHIFT)
-#define XDP_HASH_TYPE_L4_UDP (_XDP_HASH_TYPE_L4_UDP << XDP_HASH_TYPE_L4_SHIFT)
 
-#define XDP_HASH_TYPE_BITS   (XDP_HASH_TYPE_L3_BITS + XDP_HASH_TYPE_L4_BITS)
-#define XDP_HASH_TYPE_MASK   (XDP_HASH_TYPE_L3_MASK | XDP_HASH_TYPE_L4_MASK)
+/* Result of bpf_xdp_metadata_rx_hash(), key into rxhash_status map */
+enum {
+	RXHASH_OK = 0,
+	RXHASH_NO_HASH,		/* -ENODATA: no hash for this packet */
+	RXHASH_NOT_SUPP,	/* -EOPNOTSUPP: kernel or driver lacks kfunc */
+	RXHASH_ERR,		/* other errors */
+	RXHASH_STATUS_MAX
+};
 
 #endif /* __XDP_RXHASH_H__ */
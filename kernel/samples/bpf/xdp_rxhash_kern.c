@@ -1,7 +1,8 @@
-// *** DO NOT USE THIS PROGRAM ***
-// Obsoleted: only kept for historical reasons
-
-/* xdp_rxhash feature test example */
+/* xdp_rxhash: read the NIC RX hash via XDP RX metadata kfunc
+ *
+ * The program must be loaded device bound (BPF_F_XDP_DEV_BOUND_ONLY),
+ * see load_bpf_file_dev_bound(), else the kfunc returns -EOPNOTSUPP.
+ */
 #include <uapi/linux/bpf.h>
 #include <uapi/linux/if_ether.h>
 #include <uapi/linux/if_packet.h>
@@ -11,22 +12,14 @@
 #include <uapi/linux/tcp.h>
 #include <uapi/linux/udp.h>
 
-// Strange: cannot get endianness includes with LLVM
-//#include <sys/types.h>
-//#include <endian.h>
-// Only __LITTLE_ENDIAN_BITFIELD and __BIG_ENDIAN_BITFIELD do seem to work
-
-// HACK to make it compile
-#define BPF_FUNC_xdp_rxhash 666
-static unsigned long long (*bpf_xdp_rxhash)(void *ctx, __u32 new_hash,
-					    __u32 type, unsigned int flags) =
-	(void *) BPF_FUNC_xdp_rxhash;
-
-
 #include "bpf_helpers.h"
 
 #include "xdp_rxhash.h"
 
+/* From uapi asm-generic/errno.h */
+#define ENODATA		61
+#define EOPNOTSUPP	95
+
 //#define DEBUG 1
 #ifdef  DEBUG
 /* Only use this for debug output. Notice output from bpf_trace_printk()
@@ -91,62 +84,96 @@ void stats_action_verdict(u32 action)
 
 /* Keep stats of hash_type for L3 (e.g IPv4, IPv6) and L4 (e.g UDP, TCP)
  *
- * Two small array are sufficient, as the supported types are limited.
- * The type is stored in a 8-bit value, partitioned with 3-bits for L3
- * and 5 bits for L4.
+ * Two small array are sufficient, as the RSS hash types are limited,
+ * see the compact L3 and L4 index in xdp_rxhash.h.
  */
 struct bpf_map_def SEC("maps") stats_htype_L3 = {
 	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
 	.key_size = sizeof(u32),
 	.value_size = sizeof(long),
-	.max_entries = (1 << XDP_HASH_TYPE_L3_BITS),
+	.max_entries = XDP_HASH_TYPE_L3_MAX,
 };
 
 struct bpf_map_def SEC("maps") stats_htype_L4 = {
 	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
 	.key_size = sizeof(u32),
 	.value_size = sizeof(long),
-	.max_entries = (1 << XDP_HASH_TYPE_L4_BITS),
+	.max_entries = XDP_HASH_TYPE_L4_MAX,
+};
+
+/* Counter per bpf_xdp_metadata_rx_hash() result */
+struct bpf_map_def SEC("maps") rxhash_status = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(long),
+	.max_entries = RXHASH_STATUS_MAX,
 };
 
 static __always_inline
-void stats_hash_type(u32 hash_type)
+u32 rss_type_L3(u32 rss_type)
 {
-	u64 *value;
-	u32 L3, L4;
+	if (rss_type & XDP_RSS_L3_IPV4)
+		return XDP_HASH_TYPE_L3_IPV4;
+	if (rss_type & XDP_RSS_L3_IPV6) {
+		if (rss_type & XDP_RSS_L3_DYNHDR)
+			return XDP_HASH_TYPE_L3_IPV6_EX;
+		return XDP_HASH_TYPE_L3_IPV6;
+	}
+	return 0;
+}
 
-	if (hash_type > XDP_HASH_TYPE_MASK)
-		return;
+static __always_inline
+u32 rss_type_L4(u32 rss_type)
+{
+	if (rss_type & XDP_RSS_L4_TCP)
+		return XDP_HASH_TYPE_L4_TCP;
+	if (rss_type & XDP_RSS_L4_UDP)
+		return XDP_HASH_TYPE_L4_UDP;
+	if (rss_type & XDP_RSS_L4_SCTP)
+		return XDP_HASH_TYPE_L4_SCTP;
+	if (rss_type & XDP_RSS_L4_IPSEC)
+		return XDP_HASH_TYPE_L4_IPSEC;
+	if (rss_type & XDP_RSS_L4_ICMP)
+		return XDP_HASH_TYPE_L4_ICMP;
+	if (rss_type & XDP_RSS_L4)
+		return XDP_HASH_TYPE_L4_OTHER;
+	return 0;
+}
+
+static __always_inline
+void stats_hash_type(u32 L3, u32 L4)
+{
+	u64 *value;
 
-	L3 = XDP_HASH_TYPE_L3(hash_type);
 	value = bpf_map_lookup_elem(&stats_htype_L3, &L3);
 	if (value)
 		*value += 1;
 
-	/* The L4 value is shifted down to fit within array size */
-	L4 = XDP_HASH_TYPE_L4(hash_type) >> XDP_HASH_TYPE_L4_SHIFT;
 	value = bpf_map_lookup_elem(&stats_htype_L4, &L4);
 	if (value)
 		*value += 1;
 }
 
-/* Fake structure to allow compile */
-struct xdp_md2 {
-        __u32 data;
-        __u32 data_end;
-	__u32 data_meta;
-	/* Below access go through struct xdp_rxq_info */
-	__u32 ingress_ifindex; /* rxq->dev->ifindex */
-	__u32 rx_queue_index;  /* rxq->queue_index  */
-	/* NOT ACCEPTED UPSTREAM */
-	__u32 rxhash;
-	// Do we need rxhash_type here???
-	__u32 rxhash_type;
-	// Can be done as a translation, reading part of xdp_buff->flags
-};
+static __always_inline
+void stats_rxhash_status(int err)
+{
+	u32 key = RXHASH_OK;
+	u64 *value;
+
+	if (err == -ENODATA)
+		key = RXHASH_NO_HASH;
+	else if (err == -EOPNOTSUPP)
+		key = RXHASH_NOT_SUPP;
+	else if (err)
+		key = RXHASH_ERR;
+
+	value = bpf_map_lookup_elem(&rxhash_status, &key);
+	if (value)
+		*value += 1;
+}
 
 SEC("xdp_rxhash")
-int  xdp_rxhash_prog(struct xdp_md2 *ctx)
+int  xdp_rxhash_prog(struct xdp_md *ctx)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data = (void *)(long)ctx->data;
@@ -155,44 +182,31 @@ int  xdp_rxhash_prog(struct xdp_md2 *ctx)
 	u32 action = XDP_PASS;
 	u32 *a2;
 	u32 key = 0;
-	u64 *touch_mem, h = 0;
-	u32 hash, hash_type;
-	u32 L3, L4;
-	u32 rxhash, rxhash_type;
+	u64 *touch_mem;
+	u32 hash = 0, rss_type = 0;
+	u32 L3 = 0, L4 = 0;
+	int err;
 
 	/* Validate packet length is minimum Eth header size */
 	if (eth + 1 > data_end)
 		return XDP_DROP;
 
-	/* Direct reading of xdp_md->rxhash */
-	rxhash = ctx->rxhash;
-	/* Separate (direct) reading xdp_md->rxhash_type */
-	rxhash_type = ctx->rxhash_type;
-
-	/* Helper bpf_xdp_rxhash, return 64-bit value with hash_type
-	 * in in upper bits.
-	 */
-	h = bpf_xdp_rxhash(ctx, 0, 0, BPF_F_RXHASH_GET);
-	hash      = XDP_HASH(h);
-	hash_type = XDP_HASH_TYPE(h);
-	stats_hash_type(hash_type);
-
-	//L3 = hash_type & XDP_HASH_TYPE_L3_MASK;
-	//L4 = hash_type & XDP_HASH_TYPE_L4_MASK;
-	// or
-	L3 = XDP_HASH_TYPE_L3(hash_type);
-	L4 = XDP_HASH_TYPE_L4(hash_type);
-
-	bpf_debug("xdp_rxhash: hash1=%llu h:%llu hash:%u\n", rxhash, h, hash);
-	bpf_debug("helper: type:%u L3:%u L4:%u\n", hash_type, L3, L4);
-	bpf_debug("experiment: type:%u rxhash_type_direct:%u\n",
-		  hash_type, rxhash_type);
+	/* Driver provided hash, from the RX descriptor */
+	err = bpf_xdp_metadata_rx_hash(ctx, &hash, &rss_type);
+	stats_rxhash_status(err);
+	if (!err) {
+		L3 = rss_type_L3(rss_type);
+		L4 = rss_type_L4(rss_type);
+	}
+	stats_hash_type(L3, L4);
+
+	bpf_debug("xdp_rxhash: err:%d hash:%u rss_type:0x%x\n",
+		  err, hash, rss_type);
+	bpf_debug("type: L3:%u L4:%u\n", L3, L4);
 
 	/* Drop all IPv4 UDP packets without even reading packet data */
-	if (hash_type == (XDP_HASH_TYPE_L4_UDP + XDP_HASH_TYPE_L3_IPV4)) {
+	if (L3 == XDP_HASH_TYPE_L3_IPV4 && L4 == XDP_HASH_TYPE_L4_UDP)
 		action = XDP_ABORTED; /* Notice in --stats output */
-		//goto out;
-	}
 
 	touch_mem = bpf_map_lookup_elem(&touch_memory, &key);
 	if (touch_mem && (*touch_mem == 1)) {
@@ -215,7 +229,6 @@ int  xdp_rxhash_prog(struct xdp_md2 *ctx)
 	if (a2 && (*a2 > 0) && (*a2 < XDP_ACTION_MAX)) {
 		action = *a2;
 	}
-//out:
 	stats_action_verdict(action);
 	return action;
 }
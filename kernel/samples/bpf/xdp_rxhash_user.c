@@ -1,11 +1,11 @@
-// *** DO NOT USE THIS PROGRAM ***
-// Obsoleted: only kept for historical reasons
-
 /* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
 static const char *__doc__=
-" XDP rxhash: EXPERIMENTAL testing kernel XDP rxhash feature\n\n"
-" This program simply test feature under development ;-)\n";
+" XDP rxhash: show the NIC provided RX hash types\n\n"
+" The RX hash and RSS type is read via the XDP RX metadata kfunc\n"
+" bpf_xdp_metadata_rx_hash() (kernel v6.4), which needs the XDP prog\n"
+" loaded bound to the device, thus only works in native XDP mode.\n"
+" As a demo, IPv4 UDP packets are XDP_ABORTED based on hash type alone.\n";
 
 #include <assert.h>
 #include <errno.h>
@@ -20,7 +20,6 @@ static const char *__doc__=
 #include <sys/resource.h>
 #include <getopt.h>
 #include <net/if.h>
-#include <time.h>
 
 #include <arpa/inet.h>
 #include <linux/if_link.h>
@@ -28,6 +27,7 @@ static const char *__doc__=
 #include "libbpf.h"
 #include "bpf_load.h"
 #include "bpf_util.h"
+#include "xdp_stats.h"
 
 #include "xdp_rxhash.h"
 
@@ -42,6 +42,15 @@ static __u32 xdp_flags = 0;
 #define EXIT_FAIL_OPTION        2
 #define EXIT_FAIL_XDP           3
 
+/* Index into map_fd[], ELF map order of _kern.c */
+#define MAP_IDX_RX_CNT		0
+#define MAP_IDX_VERDICT_CNT	1
+#define MAP_IDX_XDP_ACTION	2
+#define MAP_IDX_TOUCH_MEMORY	3
+#define MAP_IDX_HTYPE_L3	4
+#define MAP_IDX_HTYPE_L4	5
+#define MAP_IDX_RXHASH_STATUS	6
+
 static void int_exit(int sig)
 {
 	fprintf(stderr,
@@ -64,14 +73,11 @@ static const struct option long_options[] = {
 	{0, 0, NULL,  0 }
 };
 
-/* Perhaps move these:   MAX defines to bpf.h ??? */
-#define XDP_HASH_TYPE_L3_MAX	(1 << XDP_HASH_TYPE_L3_BITS)
-#define XDP_HASH_TYPE_L4_MAX	(1 << XDP_HASH_TYPE_L4_BITS)
-
 static const char *L3_type_names[XDP_HASH_TYPE_L3_MAX] = {
 	[0]			= "Unknown",
 	[XDP_HASH_TYPE_L3_IPV4]	= "IPv4",
 	[XDP_HASH_TYPE_L3_IPV6]	= "IPv6",
+	[XDP_HASH_TYPE_L3_IPV6_EX] = "IPv6-EX",
 	/* Rest is hopefully inited to zero?!? */
 };
 static const char *L3_type2str(unsigned int type)
@@ -87,8 +93,12 @@ static const char *L3_type2str(unsigned int type)
 }
 static const char *L4_type_names[XDP_HASH_TYPE_L4_MAX] = {
 	[0]			= "Unknown",
-	[_XDP_HASH_TYPE_L4_TCP]	= "TCP",
-	[_XDP_HASH_TYPE_L4_UDP]	= "UDP",
+	[XDP_HASH_TYPE_L4_TCP]	= "TCP",
+	[XDP_HASH_TYPE_L4_UDP]	= "UDP",
+	[XDP_HASH_TYPE_L4_SCTP]	= "SCTP",
+	[XDP_HASH_TYPE_L4_IPSEC] = "IPsec",
+	[XDP_HASH_TYPE_L4_ICMP]	= "ICMP",
+	[XDP_HASH_TYPE_L4_OTHER] = "L4-other",
 	/* Rest is hopefully inited to zero?!? */
 };
 static const char *L4_type2str(unsigned int type)
@@ -103,6 +113,13 @@ static const char *L4_type2str(unsigned int type)
 	return NULL;
 }
 
+static const char *rxhash_status_names[RXHASH_STATUS_MAX] = {
+	[RXHASH_OK]		= "hash",
+	[RXHASH_NO_HASH]	= "no-hash",
+	[RXHASH_NOT_SUPP]	= "not-supported",
+	[RXHASH_ERR]		= "error",
+};
+
 
 
 #define XDP_ACTION_MAX (XDP_TX + 2) /* Extra fake "rx_total" */
@@ -127,8 +144,7 @@ static bool set_xdp_action(__u64 action)
 	__u64 value = action;
 	__u32 key = 0;
 
-	/* map_fd[2] == map(xdp_action) */
-	if ((bpf_map_update_elem(map_fd[2], &key, &value, BPF_ANY)) != 0) {
+	if ((bpf_map_update_elem(map_fd[MAP_IDX_XDP_ACTION], &key, &value, BPF_ANY)) != 0) {
 		fprintf(stderr, "ERR %s(): bpf_map_update_elem failed\n",
 			__func__);
 		return false;
@@ -194,6 +210,7 @@ struct stats_record {
 	struct record xdp_action[XDP_ACTION_MAX];
 	struct record hash_type_L3[XDP_HASH_TYPE_L3_MAX];
 	struct record hash_type_L4[XDP_HASH_TYPE_L4_MAX];
+	struct record rxhash_status[RXHASH_STATUS_MAX];
 	__u64 touch_mem;
 };
 
@@ -216,8 +233,7 @@ static __u64 get_touch_mem(void)
 	__u64 value;
 	__u32 key = 0;
 
-	/* map_fd[3] == map(touch_memory) */
-	if ((bpf_map_lookup_elem(map_fd[3], &key, &value)) != 0) {
+	if ((bpf_map_lookup_elem(map_fd[MAP_IDX_TOUCH_MEMORY], &key, &value)) != 0) {
 		fprintf(stderr, "ERR: %s(): bpf_map_lookup_elem failed\n",
 			__func__);
 		exit(EXIT_FAIL_XDP);
@@ -229,8 +245,7 @@ static bool set_touch_mem(__u64 value)
 {
 	__u32 key = 0;
 
-	/* map_fd[3] == map(touch_memory) */
-	if ((bpf_map_update_elem(map_fd[3], &key, &value, BPF_ANY)) != 0) {
+	if ((bpf_map_update_elem(map_fd[MAP_IDX_TOUCH_MEMORY], &key, &value, BPF_ANY)) != 0) {
 		fprintf(stderr, "ERR: %s(): bpf_map_update_elem failed\n",
 			__func__);
 		return false;
@@ -238,45 +253,6 @@ static bool set_touch_mem(__u64 value)
 	return true;
 }
 
-/* gettime returns the current time of day in nanoseconds.
- * Cost: clock_gettime (ns) => 26ns (CLOCK_MONOTONIC)
- *       clock_gettime (ns) =>  9ns (CLOCK_MONOTONIC_COARSE)
- */
-#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
-uint64_t gettime(void)
-{
-	struct timespec t;
-	int res;
-
-	res = clock_gettime(CLOCK_MONOTONIC, &t);
-	if (res < 0) {
-		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
-		exit(EXIT_FAIL);
-	}
-	return (uint64_t) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
-}
-
-static __u64 get_key32_value64_percpu(int fd, __u32 key)
-{
-	/* For percpu maps, userspace gets a value per possible CPU */
-	unsigned int nr_cpus = bpf_num_possible_cpus();
-	__u64 values[nr_cpus];
-	__u64 sum = 0;
-	int i;
-
-	if ((bpf_map_lookup_elem(fd, &key, values)) != 0) {
-		fprintf(stderr,
-			"ERR: bpf_map_lookup_elem failed key:0x%X\n", key);
-		return 0;
-	}
-
-	/* Sum values from each CPU */
-	for (i = 0; i < nr_cpus; i++) {
-		sum += values[i];
-	}
-	return sum;
-}
-
 static void calc_pps(struct record *r, struct record *p,
 		     double *pps, double *period_)
 {
@@ -367,40 +343,61 @@ static void stats_print_actions(struct stats_record *record,
 	printf("\n");
 }
 
+static void stats_print_rxhash_status(struct stats_record *record,
+				      struct stats_record *prev)
+{
+	int i;
+
+	printf("%-14s %-10s %-18s %-9s\n",
+	       "rx_hash", "pps ", "pps-human-readable", "sample-period");
+
+	for (i = 0; i < RXHASH_STATUS_MAX; i++) {
+		struct record *r = &record->rxhash_status[i];
+		struct record *p = &prev->rxhash_status[i];
+		double pps = 0;
+		double period_ = 0;
+
+		calc_pps(r, p, &pps, &period_);
+		printf("%-14s %-10.0f %'-18.0f %f\n",
+		       rxhash_status_names[i], pps, pps, period_);
+	}
+	printf("\n");
+}
+
 static void stats_print(struct stats_record *record,
 			struct stats_record *prev)
 {
 	stats_print_actions  (record, prev);
+	stats_print_rxhash_status(record, prev);
 	stats_print_hash_type(record, prev, STAT_L3);
 	stats_print_hash_type(record, prev, STAT_L4);
 }
 
-static bool stats_collect(struct stats_record *rec)
+static void collect_array(int fd, struct record *rec, int nr)
 {
-	int i, fd;
+	__u64 timestamp = stats_gettime();
+	int i;
 
-	fd = map_fd[1]; /* map: verdict_cnt */
-	for (i = 0; i < (XDP_ACTION_MAX - 1) ; i++) {
-		rec->xdp_action[i].timestamp = gettime();
-		rec->xdp_action[i].counter = get_key32_value64_percpu(fd, i);
+	for (i = 0; i < nr; i++) {
+		rec[i].timestamp = timestamp;
+		rec[i].counter = stats_percpu_sum_u64(fd, i);
 	}
+}
+
+static bool stats_collect(struct stats_record *rec)
+{
+	collect_array(map_fd[MAP_IDX_VERDICT_CNT], rec->xdp_action,
+		      XDP_ACTION_MAX - 1);
 	/* Global counter */
-	fd = map_fd[0]; /* map: rx_cnt */
-	rec->xdp_action[RX_TOTAL].timestamp = gettime();
-	rec->xdp_action[RX_TOTAL].counter = get_key32_value64_percpu(fd, 0);
+	collect_array(map_fd[MAP_IDX_RX_CNT], &rec->xdp_action[RX_TOTAL], 1);
 
 	/* Collect hash_type stats */
-	fd = map_fd[4]; /* map: stats_htype_L3 */
-	for (i = 0; i < XDP_HASH_TYPE_L3_MAX; i++) {
-		rec->hash_type_L3[i].timestamp = gettime();
-		rec->hash_type_L3[i].counter = get_key32_value64_percpu(fd, i);
-	}
-	fd = map_fd[5]; /* map: stats_htype_L4 */
-	for (i = 0; i < XDP_HASH_TYPE_L4_MAX; i++) {
-		rec->hash_type_L4[i].timestamp = gettime();
-		rec->hash_type_L4[i].counter = get_key32_value64_percpu(fd, i);
-	}
-
+	collect_array(map_fd[MAP_IDX_HTYPE_L3], rec->hash_type_L3,
+		      XDP_HASH_TYPE_L3_MAX);
+	collect_array(map_fd[MAP_IDX_HTYPE_L4], rec->hash_type_L4,
+		      XDP_HASH_TYPE_L4_MAX);
+	collect_array(map_fd[MAP_IDX_RXHASH_STATUS], rec->rxhash_status,
+		      RXHASH_STATUS_MAX);
 	return true;
 }
 
@@ -427,7 +424,7 @@ static void stats_poll(int interval)
 int main(int argc, char **argv)
 {
 	__u64 touch_mem = READ_MEM; /* Default: touch packet memory */
-	__u64 override_action = 0; /* Default disabled */
+	int override_action = 0; /* Default disabled */
 	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
 	char action_str_buf[XDP_ACTION_MAX_STRLEN + 1 /* for \0 */] = {};
 	char *action_str = NULL;
@@ -441,7 +438,7 @@ int main(int argc, char **argv)
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hSd:s:",
+	while ((opt = getopt_long(argc, argv, "hSd:s:a:nD",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'd':
@@ -510,8 +507,18 @@ int main(int argc, char **argv)
 		return EXIT_FAIL;
 	}
 
-	if (load_bpf_file(filename)) {
-		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+	/* The RX metadata kfunc needs a device bound prog, which cannot
+	 * be attached in skb mode, there the kfunc returns -EOPNOTSUPP.
+	 */
+	if (xdp_flags & XDP_FLAGS_SKB_MODE) {
+		if (load_bpf_file(filename)) {
+			fprintf(stderr, "ERR in load_bpf_file(): %s",
+				bpf_log_buf);
+			return EXIT_FAIL;
+		}
+	} else if (load_bpf_file_dev_bound(filename, ifindex, NULL)) {
+		fprintf(stderr, "ERR in load_bpf_file_dev_bound(): %s",
+			bpf_log_buf);
 		return EXIT_FAIL;
 	}
 
@@ -0,0 +1,270 @@
+/* Shared stats helpers for the _user programs, see xdp_stats.h
+ *
+ *  Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat Inc.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+
+#include "libbpf.h"
+#include "bpf_util.h"
+#include "xdp_stats.h"
+
+__u64 stats_gettime(void)
+{
+	struct timespec t;
+	int res;
+
+	res = clock_gettime(CLOCK_MONOTONIC, &t);
+	if (res < 0) {
+		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
+		exit(EXIT_FAILURE);
+	}
+	return (__u64) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+}
+
+/* Userspace gets a value per possible CPU, each rounded up to 8 bytes */
+static void sum_values(void *sum, const void *values, size_t value_size)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	size_t stride = (value_size + 7) & ~7UL;
+	size_t nr = value_size / sizeof(__u64);
+	__u64 *s = sum;
+	int i, j;
+
+	memset(sum, 0, value_size);
+	for (i = 0; i < nr_cpus; i++) {
+		const __u64 *v = values + i * stride;
+
+		for (j = 0; j < nr; j++)
+			s[j] += v[j];
+	}
+}
+
+int stats_percpu_sum(int fd, const void *key, void *sum, size_t value_size)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	size_t stride = (value_size + 7) & ~7UL;
+	char values[stride * nr_cpus];
+
+	if (bpf_map_lookup_elem(fd, key, values)) {
+		memset(sum, 0, value_size);
+		return -errno;
+	}
+	sum_values(sum, values, value_size);
+	return 0;
+}
+
+__u64 stats_percpu_sum_u64(int fd, __u32 key)
+{
+	__u64 sum;
+
+	if (stats_percpu_sum(fd, &key, &sum, sizeof(sum))) {
+		fprintf(stderr,
+			"ERR: bpf_map_lookup_elem failed key:0x%X\n", key);
+		return 0;
+	}
+	return sum;
+}
+
+/* BPF_MAP_LOOKUP_BATCH (v5.6), the uapi headers used here are older */
+#define STATS_BPF_MAP_LOOKUP_BATCH	24
+struct stats_batch_attr {
+	__aligned_u64 in_batch;
+	__aligned_u64 out_batch;
+	__aligned_u64 keys;
+	__aligned_u64 values;
+	__u32 count;
+	__u32 map_fd;
+	__u64 elem_flags;
+	__u64 flags;
+};
+static bool batch_unsupported;
+
+static int lookup_batch(int fd, __u32 nr, __u32 *keys, void *values)
+{
+	struct stats_batch_attr attr;
+	__u32 out_batch;
+	int err;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.out_batch = (unsigned long)&out_batch;
+	attr.keys   = (unsigned long)keys;
+	attr.values = (unsigned long)values;
+	attr.count  = nr;
+	attr.map_fd = fd;
+
+	err = syscall(__NR_bpf, STATS_BPF_MAP_LOOKUP_BATCH, &attr,
+		      sizeof(attr));
+	/* ENOENT signals end of map, entries up to count are valid */
+	if (err && errno != ENOENT)
+		return -errno;
+	return attr.count == nr ? 0 : -ENOENT;
+}
+
+int stats_percpu_array_sum(int fd, __u32 nr, void *sums, size_t value_size)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	size_t stride = (value_size + 7) & ~7UL;
+	__u32 key, *keys;
+	char *values;
+	int err = 0;
+
+	keys = calloc(nr, sizeof(*keys));
+	values = calloc(nr, stride * nr_cpus);
+	if (!keys || !values) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (!batch_unsupported) {
+		err = lookup_batch(fd, nr, keys, values);
+		if (err == -EINVAL || err == -ENOTSUP || err == -524)
+			batch_unsupported = true; /* 524 is ENOTSUPP */
+	}
+	if (batch_unsupported || err) {
+		/* Fallback, lookup per key */
+		for (key = 0; key < nr; key++) {
+			keys[key] = key;
+			err = bpf_map_lookup_elem(fd, &key,
+						  values + key * stride * nr_cpus);
+			if (err) {
+				err = -errno;
+				goto out;
+			}
+		}
+	}
+	for (key = 0; key < nr; key++) {
+		__u32 k = keys[key];
+
+		if (k >= nr)
+			continue;
+		sum_values(sums + k * value_size,
+			   values + key * stride * nr_cpus, value_size);
+	}
+out:
+	free(values);
+	free(keys);
+	return err;
+}
+
+__u64 stats_rate(__u64 delta, __u64 period_ns)
+{
+	if (!period_ns)
+		return 0;
+	/* 128-bit intermediate, as delta * 10^9 can overflow 64-bit */
+	return (unsigned __int128)delta * NANOSEC_PER_SEC / period_ns;
+}
+
+int stats_output_init(struct stats_output *out, const char *prog,
+		      const char *arg)
+{
+	memset(out, 0, sizeof(*out));
+	out->prog = prog;
+	out->fp = stdout;
+
+	if (!arg || !strcmp(arg, "text"))
+		out->fmt = STATS_FMT_TEXT;
+	else if (!strcmp(arg, "json"))
+		out->fmt = STATS_FMT_JSON;
+	else if (!strcmp(arg, "prom"))
+		out->fmt = STATS_FMT_PROM;
+	else if (!strncmp(arg, "prom:", 5) && arg[5]) {
+		out->fmt = STATS_FMT_PROM;
+		out->path = arg + 5;
+		snprintf(out->tmp_path, sizeof(out->tmp_path), "%s.tmp",
+			 out->path);
+	} else {
+		fprintf(stderr, "ERR: --format text|json|prom[:FILE]\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+void stats_output_begin(struct stats_output *out, __u64 period_ns)
+{
+	out->period_ns = period_ns;
+	out->last_name = NULL;
+	out->nr = 0;
+
+	switch (out->fmt) {
+	case STATS_FMT_JSON:
+		fprintf(out->fp, "{\"prog\":\"%s\",\"timestamp\":%llu,"
+			"\"period_ns\":%llu,\"metrics\":[", out->prog,
+			stats_gettime(), period_ns);
+		break;
+	case STATS_FMT_PROM:
+		if (!out->path)
+			break;
+		out->fp = fopen(out->tmp_path, "w");
+		if (!out->fp) {
+			fprintf(stderr, "ERR: open %s: %s\n",
+				out->tmp_path, strerror(errno));
+			out->fp = stdout;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void stats_output_metric(struct stats_output *out, const char *name,
+			 const char *label, const char *label_val,
+			 __u64 counter, __u64 delta)
+{
+	__u64 rate = stats_rate(delta, out->period_ns);
+
+	switch (out->fmt) {
+	case STATS_FMT_TEXT:
+		fprintf(out->fp, "%-24s %-16s %'20llu %'14llu/s\n", name,
+			label_val ? : "", counter, rate);
+		break;
+	case STATS_FMT_JSON:
+		fprintf(out->fp, "%s{\"name\":\"%s\"", out->nr ? "," : "",
+			name);
+		if (label)
+			fprintf(out->fp, ",\"%s\":\"%s\"", label, label_val);
+		fprintf(out->fp, ",\"total\":%llu,\"rate\":%llu}",
+			counter, rate);
+		break;
+	case STATS_FMT_PROM:
+		/* Counters only, Prometheus calculates rates itself */
+		if (!out->last_name || strcmp(out->last_name, name))
+			fprintf(out->fp, "# TYPE %s_%s_total counter\n",
+				out->prog, name);
+		fprintf(out->fp, "%s_%s_total", out->prog, name);
+		if (label)
+			fprintf(out->fp, "{%s=\"%s\"}", label, label_val);
+		fprintf(out->fp, " %llu\n", counter);
+		break;
+	}
+	out->last_name = name;
+	out->nr++;
+}
+
+void stats_output_end(struct stats_output *out)
+{
+	switch (out->fmt) {
+	case STATS_FMT_JSON:
+		fprintf(out->fp, "]}\n");
+		break;
+	case STATS_FMT_PROM:
+		if (!out->path || out->fp == stdout)
+			break;
+		/* Scraper must never see a partially written file */
+		fclose(out->fp);
+		out->fp = stdout;
+		if (rename(out->tmp_path, out->path))
+			fprintf(stderr, "ERR: rename %s: %s\n",
+				out->path, strerror(errno));
+		return;
+	default:
+		break;
+	}
+	fflush(out->fp);
+}
@@ -0,0 +1,65 @@
+/* Shared stats helpers for the _user programs
+ *
+ * Reading and summing per CPU map values, per second rates over a
+ * measurement period, and machine readable output as JSON lines or
+ * Prometheus text format (e.g. for node_exporter textfile collector).
+ * The tools keep their own human readable text output.
+ */
+#ifndef __XDP_STATS_H
+#define __XDP_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/types.h>
+
+#ifndef NANOSEC_PER_SEC
+#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
+#endif
+
+/* CLOCK_MONOTONIC in nanoseconds */
+__u64 stats_gettime(void);
+
+/* Sum per CPU values of a map entry, the value must only consist of
+ * __u64 (or unsigned long) counters, e.g. struct datarec.
+ */
+int stats_percpu_sum(int fd, const void *key, void *sum, size_t value_size);
+__u64 stats_percpu_sum_u64(int fd, __u32 key);
+
+/* Same for keys 0..nr-1 of a PERCPU_ARRAY, into sums[nr].  Uses a
+ * single BPF_MAP_LOOKUP_BATCH syscall on kernels supporting it (v5.6).
+ */
+int stats_percpu_array_sum(int fd, __u32 nr, void *sums, size_t value_size);
+
+/* Per second rate of delta over period, in integer math */
+__u64 stats_rate(__u64 delta, __u64 period_ns);
+
+enum stats_format {
+	STATS_FMT_TEXT = 0,	/* Tool specific output */
+	STATS_FMT_JSON,		/* One JSON object per period */
+	STATS_FMT_PROM,		/* Prometheus text exposition format */
+};
+
+struct stats_output {
+	enum stats_format fmt;
+	const char *prog;	/* Metric name prefix */
+	const char *path;	/* PROM file, replaced atomically each period */
+	FILE *fp;
+	char tmp_path[256];
+	const char *last_name;
+	__u64 period_ns;
+	int nr;
+};
+
+/* Parse --format arg: text, json, prom or prom:FILE */
+int stats_output_init(struct stats_output *out, const char *prog,
+		      const char *arg);
+
+void stats_output_begin(struct stats_output *out, __u64 period_ns);
+/* Metrics of same name must be emitted consecutively, label optional */
+void stats_output_metric(struct stats_output *out, const char *name,
+			 const char *label, const char *label_val,
+			 __u64 counter, __u64 delta);
+void stats_output_end(struct stats_output *out);
+
+#endif /* __XDP_STATS_H */
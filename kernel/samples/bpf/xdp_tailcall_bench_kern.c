@@ -0,0 +1,118 @@
+/*  XDP stage chaining cost: tail calls vs bpf-to-bpf calls vs inlined
+ *
+ *  All three variants run the same stage_work() per stage, the user
+ *  side runs them via BPF_PROG_TEST_RUN for depth 1..N.
+ *
+ *  GPLv2, Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+#include "bpf_helpers.h"
+
+/* WARNING - sync map and prog order with MAP_IDX_* and PROG_* in _user.c */
+#include "xdp_dispatcher_kern.h"
+
+char _license[] SEC("license") = "GPL";
+
+/* Per stage counter, a typical stage touches the packet and a map */
+struct bpf_map_def SEC("maps") stage_cnt = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u64),
+	.max_entries	= DISPATCH_STAGES_MAX,
+};
+
+/* Depth for the bpf2bpf and inline progs, the dispatcher has its own */
+struct bpf_map_def SEC("maps") bench_depth = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u32),
+	.max_entries	= 1,
+};
+
+static __always_inline int stage_work(struct xdp_md *ctx, u32 stage)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	u64 *cnt;
+
+	if (eth + 1 > data_end || !eth->h_proto)
+		return -1;
+	cnt = bpf_map_lookup_elem(&stage_cnt, &stage);
+	if (!cnt)
+		return -1;
+	*cnt += 1;
+	return 0;
+}
+
+static __always_inline u32 depth_get(void)
+{
+	u32 key = 0, *depth;
+
+	depth = bpf_map_lookup_elem(&bench_depth, &key);
+	return depth ? *depth : 0;
+}
+
+SEC("xdp_dispatcher")
+int xdp_dispatcher(struct xdp_md *ctx)
+{
+	return dispatch_start(ctx);
+}
+
+/* Installed in every slot of the pipeline */
+SEC("xdp_stage")
+int xdp_stage(struct xdp_md *ctx)
+{
+	struct dispatch_state *st = dispatch_state_get();
+
+	if (!st)
+		return XDP_ABORTED;
+	if (stage_work(ctx, (st->next - 1) & (DISPATCH_STAGES_MAX - 1)))
+		return XDP_ABORTED;
+	return dispatch_next(ctx, st);
+}
+
+/* The subprog is placed in the same ELF section as its caller, after
+ * it, as bpf_load.c loads a section as one prog and does not relocate
+ * calls into .text.  LLVM resolves such calls without a relocation.
+ */
+static __attribute__((noinline)) int stage_sub(struct xdp_md *ctx, u32 stage)
+	__attribute__((section("xdp_bpf2bpf")));
+
+SEC("xdp_bpf2bpf")
+int xdp_bpf2bpf(struct xdp_md *ctx)
+{
+	u32 depth = depth_get();
+	int i;
+
+#pragma clang loop unroll(full)
+	for (i = 0; i < DISPATCH_STAGES_MAX; i++) {
+		if (i >= depth)
+			break;
+		if (stage_sub(ctx, i))
+			return XDP_ABORTED;
+	}
+	return XDP_DROP;
+}
+
+static __attribute__((noinline)) int stage_sub(struct xdp_md *ctx, u32 stage)
+{
+	return stage_work(ctx, stage);
+}
+
+SEC("xdp_inline")
+int xdp_inline(struct xdp_md *ctx)
+{
+	u32 depth = depth_get();
+	int i;
+
+#pragma clang loop unroll(full)
+	for (i = 0; i < DISPATCH_STAGES_MAX; i++) {
+		if (i >= depth)
+			break;
+		if (stage_work(ctx, i))
+			return XDP_ABORTED;
+	}
+	return XDP_DROP;
+}
@@ -0,0 +1,243 @@
+/* GPLv2 Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__ =
+ " XDP stage chaining cost, via BPF_PROG_TEST_RUN (no device needed)\n"
+ "\n"
+ " Runs a pipeline of 1..--depth identical stages, chained as:\n"
+ "  tail-call: xdp_dispatcher tail-calls each stage (xdp_dispatcher_kern.h)\n"
+ "  bpf2bpf  : one prog calling a noinline subprog per stage\n"
+ "  inline   : one prog with the stages inlined\n"
+ " The cost per stage of chaining is the difference to 'inline',\n"
+ " divided by the depth.  The dispatcher pipeline is changed per depth\n"
+ " by swapping banks, with the same dispatcher prog throughout.";
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <locale.h>
+#include <sys/resource.h>
+#include <getopt.h>
+
+#include <linux/bpf.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "xdp_dispatcher_user.h"
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_BPF		4
+#define EXIT_FAIL_MAP		20
+
+/* WARNING - sync with map and prog order in _kern.c */
+#define MAP_IDX_STAGES		0
+#define MAP_IDX_ACTIVE		1
+#define MAP_IDX_BANKS		2
+#define MAP_IDX_STATE		3
+#define MAP_IDX_STAGE_CNT	4
+#define MAP_IDX_DEPTH		5
+
+#define PROG_DISPATCHER		0
+#define PROG_STAGE		1
+#define PROG_BPF2BPF		2
+#define PROG_INLINE		3
+#define PROG_MAX		4
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"depth",	required_argument,	NULL, 'd' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{"runs",	required_argument,	NULL, 'n' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+/* Best (lowest) average ns per prog run, out of @runs */
+static int bench_prog(int fd, int repeat, int runs, unsigned char *pkt,
+		      int len, __u32 *best)
+{
+	__u32 duration, retval;
+	int i;
+
+	*best = ~0U;
+	for (i = 0; i < runs; i++) {
+		if (bpf_prog_test_run(fd, repeat, pkt, len, NULL, NULL,
+				      &retval, &duration)) {
+			fprintf(stderr, "ERR: BPF_PROG_TEST_RUN err(%d):%s\n",
+				errno, strerror(errno));
+			return -1;
+		}
+		if (retval != XDP_DROP) {
+			fprintf(stderr, "ERR: unexpected retval %u\n", retval);
+			return -1;
+		}
+		if (duration < *best)
+			*best = duration;
+	}
+	return 0;
+}
+
+/* Each stage increments its own counter once per packet */
+static __u64 stage_cnt_sum(void)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus], sum = 0;
+	__u32 key;
+	int i;
+
+	for (key = 0; key < DISPATCH_STAGES_MAX; key++) {
+		if (bpf_map_lookup_elem(map_fd[MAP_IDX_STAGE_CNT], &key,
+					values))
+			continue;
+		for (i = 0; i < nr_cpus; i++)
+			sum += values[i];
+	}
+	return sum;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	int stages[DISPATCH_STAGES_MAX];
+	struct dispatch_maps dmaps;
+	unsigned char pkt[64];
+	int repeat = 10000000;
+	char filename[256];
+	int longindex = 0;
+	int max_depth = 6;
+	int runs = 3;
+	__u32 key = 0;
+	int opt, d, i, err;
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	while ((opt = getopt_long(argc, argv, "hd:r:n:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'd':
+			max_depth = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	if (repeat <= 0 || runs <= 0) {
+		fprintf(stderr, "ERR: --repeat and --runs must be positive\n");
+		return EXIT_FAIL_OPTION;
+	}
+	if (max_depth < 1 || max_depth > DISPATCH_STAGES_MAX) {
+		fprintf(stderr, "ERR: --depth must be 1..%d\n",
+			DISPATCH_STAGES_MAX);
+		return EXIT_FAIL_OPTION;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (prog_cnt != PROG_MAX) {
+		fprintf(stderr, "ERR: %s: expected %d progs, got %d\n",
+			filename, PROG_MAX, prog_cnt);
+		return EXIT_FAIL_BPF;
+	}
+
+	dmaps.stages = map_fd[MAP_IDX_STAGES];
+	dmaps.active = map_fd[MAP_IDX_ACTIVE];
+	dmaps.banks  = map_fd[MAP_IDX_BANKS];
+	for (i = 0; i < DISPATCH_STAGES_MAX; i++)
+		stages[i] = prog_fd[PROG_STAGE];
+
+	/* Eth + IPv4, contents does not matter to the stages */
+	memset(pkt, 0, sizeof(pkt));
+	pkt[12] = 0x08;
+	pkt[13] = 0x00;
+
+	setlocale(LC_NUMERIC, "en_US");
+	printf("Repeat %'d x best of %d runs\n", repeat, runs);
+	printf("%-6s %-10s %-10s %-10s %-14s %-14s\n", "depth",
+	       "tail-call", "bpf2bpf", "inline", "tc-ns/stage",
+	       "b2b-ns/stage");
+
+	for (d = 1; d <= max_depth; d++) {
+		__u32 ns[PROG_MAX];
+		__u64 cnt;
+
+		err = dispatch_set_pipeline(&dmaps, stages, d, XDP_DROP);
+		if (err) {
+			fprintf(stderr, "ERR: dispatch_set_pipeline(%d): %s\n",
+				d, strerror(-err));
+			return EXIT_FAIL_MAP;
+		}
+		if (bpf_map_update_elem(map_fd[MAP_IDX_DEPTH], &key, &d, 0)) {
+			fprintf(stderr, "ERR: bench_depth update: %s\n",
+				strerror(errno));
+			return EXIT_FAIL_MAP;
+		}
+
+		/* Verify the tail-call chain really runs d stages */
+		cnt = stage_cnt_sum();
+		if (bench_prog(prog_fd[PROG_DISPATCHER], 1, 1, pkt,
+			       sizeof(pkt), &ns[PROG_DISPATCHER]))
+			return EXIT_FAIL_BPF;
+		cnt = stage_cnt_sum() - cnt;
+		if (cnt != d) {
+			fprintf(stderr, "ERR: depth %d, pipeline ran %llu"
+				" stages\n", d, cnt);
+			return EXIT_FAIL_BPF;
+		}
+
+		for (i = PROG_DISPATCHER; i < PROG_MAX; i++) {
+			if (i == PROG_STAGE)
+				continue;
+			if (bench_prog(prog_fd[i], repeat, runs, pkt,
+				       sizeof(pkt), &ns[i]))
+				return EXIT_FAIL_BPF;
+		}
+		/* Below inline is measurement noise */
+		printf("%-6d %-10u %-10u %-10u %-14.2f %-14.2f\n", d,
+		       ns[PROG_DISPATCHER], ns[PROG_BPF2BPF], ns[PROG_INLINE],
+		       ns[PROG_DISPATCHER] > ns[PROG_INLINE] ?
+		       (double)(ns[PROG_DISPATCHER] - ns[PROG_INLINE]) / d : 0,
+		       ns[PROG_BPF2BPF] > ns[PROG_INLINE] ?
+		       (double)(ns[PROG_BPF2BPF] - ns[PROG_INLINE]) / d : 0);
+	}
+	return EXIT_OK;
+}
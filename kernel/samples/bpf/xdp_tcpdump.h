@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __XDP_TCPDUMP_H__
+#define __XDP_TCPDUMP_H__
+
+/* Shared struct between _user & the _kern's (perf and ringbuf backend) */
+
+/* Header for capture event (meta data place before pkt data) */
+struct capture_hdr {
+	__u16 cookie;
+	__u16 pkt_len;	/* Length of frame on wire */
+	__u16 cap_len;	/* Bytes of frame in event, after snaplen */
+	__u16 cpu;
+	__u64 timestamp; /* bpf_ktime_get_ns, CLOCK_MONOTONIC */
+};
+#define COOKIE	0x9ca9
+
+/* Controlled by userspace, key 0 in map capture_config */
+struct capture_config {
+	__u32 snaplen;		/* Max bytes of frame to capture */
+	__u32 sample_ratio;	/* Capture 1 out of N frames, 0/1 = all */
+	__u32 wakeup_batch;	/* ringbuf: wakeup reader every N events */
+	__u32 nr_rules;		/* Rules in capture_filter, 0 = capture all */
+};
+
+/* Pre-filter in XDP prog, frame is captured if any rule matches (OR),
+ * and a rule matches if all its FILTER_F_xxx fields match (AND).
+ * Addresses and masks in network byte-order, IPv4 only use word [0].
+ */
+#define FILTER_MAX_RULES	8
+
+#define FILTER_F_FAMILY		(1U << 0)
+#define FILTER_F_PROTO		(1U << 1)
+#define FILTER_F_SADDR		(1U << 2)
+#define FILTER_F_DADDR		(1U << 3)
+#define FILTER_F_ADDR		(1U << 4) /* saddr/smask, src or dst */
+#define FILTER_F_SPORT		(1U << 5)
+#define FILTER_F_DPORT		(1U << 6)
+#define FILTER_F_PORT		(1U << 7) /* sport range, src or dst */
+
+struct filter_rule {
+	__u32 flags;
+	__u8  family;	/* 4 or 6 */
+	__u8  proto;	/* IPPROTO_xxx */
+	__u16 pad;
+	__u16 sport_min, sport_max; /* Host byte-order */
+	__u16 dport_min, dport_max;
+	__u32 saddr[4], smask[4];
+	__u32 daddr[4], dmask[4];
+};
+
+/* Per CPU in map capture_stats */
+struct capture_stats {
+	__u64 seen;	/* Frames seen by XDP prog */
+	__u64 sampled;	/* Frames selected by sampling */
+	__u64 captured;	/* Events successfully written to ring */
+	__u64 lost;	/* Events lost, ring full (or copy error) */
+	__u64 filtered;	/* Frames not matching capture_filter rules */
+};
+
+/* ringbuf backend reserves fixed size classes, largest is max snaplen */
+#define RINGBUF_SNAPLEN_MAX	4096
+#define RINGBUF_SIZE		(1 << 25) /* 32 MB */
+
+#endif /* __XDP_TCPDUMP_H__ */
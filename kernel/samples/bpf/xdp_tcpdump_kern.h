@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __XDP_TCPDUMP_KERN_H__
+#define __XDP_TCPDUMP_KERN_H__
+
+/* Shared by the _kern.c's of the perf and ringbuf backend */
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
+#include <uapi/linux/in.h>
+#include <uapi/linux/udp.h>
+
+#include "xdp_tcpdump.h"
+
+struct bpf_map_def SEC("maps") capture_config = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct capture_config),
+	.max_entries	= 1,
+};
+
+struct bpf_map_def SEC("maps") capture_stats = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct capture_stats),
+	.max_entries	= 1,
+};
+
+struct bpf_map_def SEC("maps") capture_filter = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct filter_rule),
+	.max_entries	= FILTER_MAX_RULES,
+};
+
+/* Frame fields the filter rules can match on */
+struct pkt_info {
+	u8  family;
+	u8  proto;
+	bool has_ports;
+	u16 sport, dport; /* Host byte-order */
+	u32 saddr[4], daddr[4];
+};
+
+struct vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+/* Returns false for non-IP frames, which never match a rule */
+static __always_inline
+bool capture_parse(struct xdp_md *ctx, struct pkt_info *info)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct ipv6hdr *ip6h;
+	struct iphdr *iph;
+	struct udphdr *udph; /* TCP ports are at same offsets */
+	void *l4 = NULL;
+	u16 eth_type;
+	u64 offset;
+
+	offset = sizeof(*eth);
+	if (data + offset > data_end)
+		return false;
+	eth_type = eth->h_proto;
+
+	/* Handle (single) VLAN tagged packet */
+	if (eth_type == htons(ETH_P_8021Q) || eth_type == htons(ETH_P_8021AD)) {
+		struct vlan_hdr *vlan_hdr = data + offset;
+
+		offset += sizeof(*vlan_hdr);
+		if (data + offset > data_end)
+			return false;
+		eth_type = vlan_hdr->h_vlan_encapsulated_proto;
+	}
+
+	if (eth_type == htons(ETH_P_IP)) {
+		iph = data + offset;
+		if (iph + 1 > data_end)
+			return false;
+		info->family = 4;
+		info->proto = iph->protocol;
+		info->saddr[0] = iph->saddr;
+		info->daddr[0] = iph->daddr;
+		/* Only first fragment carries the ports */
+		if (!(iph->frag_off & htons(0x1FFF)))
+			l4 = (void *)iph + (iph->ihl * 4);
+	} else if (eth_type == htons(ETH_P_IPV6)) {
+		ip6h = data + offset;
+		if (ip6h + 1 > data_end)
+			return false;
+		info->family = 6;
+		info->proto = ip6h->nexthdr; /* Extension hdrs not skipped */
+		__builtin_memcpy(info->saddr, ip6h->saddr.s6_addr32, 16);
+		__builtin_memcpy(info->daddr, ip6h->daddr.s6_addr32, 16);
+		l4 = ip6h + 1;
+	} else {
+		return false;
+	}
+
+	if (l4 && (info->proto == IPPROTO_TCP || info->proto == IPPROTO_UDP)) {
+		udph = l4;
+		if (udph + 1 <= data_end) {
+			info->has_ports = true;
+			info->sport = ntohs(udph->source);
+			info->dport = ntohs(udph->dest);
+		}
+	}
+	return true;
+}
+
+static __always_inline
+bool addr_match(const u32 *addr, const u32 *net, const u32 *mask)
+{
+	return (addr[0] & mask[0]) == net[0] && (addr[1] & mask[1]) == net[1] &&
+	       (addr[2] & mask[2]) == net[2] && (addr[3] & mask[3]) == net[3];
+}
+
+static __always_inline
+bool rule_match(struct filter_rule *r, struct pkt_info *info)
+{
+	u32 f = r->flags;
+
+	if ((f & FILTER_F_FAMILY) && r->family != info->family)
+		return false;
+	if ((f & FILTER_F_PROTO) && r->proto != info->proto)
+		return false;
+	if ((f & FILTER_F_SADDR) && !addr_match(info->saddr, r->saddr, r->smask))
+		return false;
+	if ((f & FILTER_F_DADDR) && !addr_match(info->daddr, r->daddr, r->dmask))
+		return false;
+	if ((f & FILTER_F_ADDR) &&
+	    !addr_match(info->saddr, r->saddr, r->smask) &&
+	    !addr_match(info->daddr, r->saddr, r->smask))
+		return false;
+
+	if (!(f & (FILTER_F_SPORT | FILTER_F_DPORT | FILTER_F_PORT)))
+		return true;
+	if (!info->has_ports)
+		return false;
+	if ((f & FILTER_F_SPORT) &&
+	    (info->sport < r->sport_min || info->sport > r->sport_max))
+		return false;
+	if ((f & FILTER_F_DPORT) &&
+	    (info->dport < r->dport_min || info->dport > r->dport_max))
+		return false;
+	if ((f & FILTER_F_PORT) &&
+	    (info->sport < r->sport_min || info->sport > r->sport_max) &&
+	    (info->dport < r->sport_min || info->dport > r->sport_max))
+		return false;
+	return true;
+}
+
+static __always_inline
+bool capture_filter_match(struct xdp_md *ctx, struct capture_config *cfg)
+{
+	struct pkt_info info = {};
+	struct filter_rule *r;
+	u32 i;
+
+	if (!capture_parse(ctx, &info))
+		return false;
+
+#pragma unroll
+	for (i = 0; i < FILTER_MAX_RULES; i++) {
+		if (i >= cfg->nr_rules)
+			break;
+		r = bpf_map_lookup_elem(&capture_filter, &i);
+		if (r && rule_match(r, &info))
+			return true;
+	}
+	return false;
+}
+
+/* Decide if frame is captured, and fill in event header.
+ *
+ * Returns per CPU stats record when frame should be captured, else NULL
+ */
+static __always_inline
+struct capture_stats *capture_begin(struct xdp_md *ctx,
+				    struct capture_hdr *hdr,
+				    struct capture_config **config)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct capture_config *cfg;
+	struct capture_stats *stats;
+	u32 key = 0;
+	u32 len;
+
+	if (data >= data_end)
+		return NULL;
+
+	cfg = bpf_map_lookup_elem(&capture_config, &key);
+	stats = bpf_map_lookup_elem(&capture_stats, &key);
+	if (!cfg || !stats)
+		return NULL;
+
+	stats->seen++;
+	if (cfg->nr_rules && !capture_filter_match(ctx, cfg)) {
+		stats->filtered++;
+		return NULL;
+	}
+
+	/* Sampling via per CPU counter, cheaper than bpf_get_prandom_u32 */
+	if (cfg->sample_ratio > 1 &&
+	    ((stats->seen - stats->filtered) % cfg->sample_ratio))
+		return NULL;
+	stats->sampled++;
+
+	len = data_end - data;
+	hdr->cookie = COOKIE;
+	hdr->pkt_len = len;
+	hdr->cap_len = (cfg->snaplen && len > cfg->snaplen) ? cfg->snaplen : len;
+	hdr->cpu = bpf_get_smp_processor_id();
+	hdr->timestamp = bpf_ktime_get_ns();
+	*config = cfg;
+	return stats;
+}
+
+#endif /* __XDP_TCPDUMP_KERN_H__ */
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: GPL-2.0
+ * Copyright (c) 2018 Jesper Dangaard Brouer
+ */
+static const char *__doc__ =
+ " Merge per CPU pcap files of xdp_tcpdump --per-cpu by timestamp\n"
+ "\n"
+ " Each input file is already ordered by time (one CPU, one ring),\n"
+ " thus this is a plain N-way merge, keeping a single packet per file.";
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+
+#define PCAP_DONT_INCLUDE_PCAP_BPF_H
+#include <pcap/pcap.h>
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"write",	required_argument,	NULL, 'w' },
+	{0, 0, NULL,  0 }
+};
+
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_PCAP		5
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf(" Usage: %s --write OUT.pcap IN.pcap...\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+				*long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+				long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+struct merge_input {
+	pcap_t *handle;
+	struct pcap_pkthdr *hdr;
+	const u_char *data;
+	bool eof;
+};
+
+/* Packet data stays valid until next pcap_next_ex() on same handle */
+static void input_next(struct merge_input *in)
+{
+	if (pcap_next_ex(in->handle, &in->hdr, &in->data) != 1)
+		in->eof = true;
+}
+
+static bool ts_before(const struct timeval *a, const struct timeval *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_usec < b->tv_usec;
+}
+
+int main(int argc, char **argv)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct merge_input *inputs, *min;
+	unsigned long long cnt = 0;
+	pcap_dumper_t *dumper;
+	int snaplen = 0, linktype = -1;
+	char *outfile = NULL;
+	int longindex = 0;
+	int nr, opt, i;
+	pcap_t *out;
+
+	while ((opt = getopt_long(argc, argv, "hw:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'w':
+			outfile = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	nr = argc - optind;
+	if (!outfile || nr <= 0) {
+		fprintf(stderr, "ERR: need --write and input files\n");
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+
+	inputs = calloc(nr, sizeof(*inputs));
+	if (!inputs)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < nr; i++) {
+		inputs[i].handle = pcap_open_offline(argv[optind + i], errbuf);
+		if (!inputs[i].handle) {
+			fprintf(stderr, "ERR: %s: %s\n", argv[optind + i],
+				errbuf);
+			return EXIT_FAIL_PCAP;
+		}
+		if (linktype < 0)
+			linktype = pcap_datalink(inputs[i].handle);
+		if (pcap_datalink(inputs[i].handle) != linktype) {
+			fprintf(stderr, "ERR: %s: different link-type\n",
+				argv[optind + i]);
+			return EXIT_FAIL_PCAP;
+		}
+		if (pcap_snapshot(inputs[i].handle) > snaplen)
+			snaplen = pcap_snapshot(inputs[i].handle);
+		input_next(&inputs[i]);
+	}
+
+	out = pcap_open_dead(linktype, snaplen);
+	dumper = pcap_dump_open(out, outfile);
+	if (!dumper) {
+		fprintf(stderr, "ERR: %s: %s\n", outfile, pcap_geterr(out));
+		return EXIT_FAIL_PCAP;
+	}
+
+	/* Linear scan for oldest head, N is number of CPUs */
+	for (;;) {
+		min = NULL;
+		for (i = 0; i < nr; i++) {
+			if (inputs[i].eof)
+				continue;
+			if (!min || ts_before(&inputs[i].hdr->ts, &min->hdr->ts))
+				min = &inputs[i];
+		}
+		if (!min)
+			break;
+		pcap_dump((u_char *)dumper, min->hdr, min->data);
+		cnt++;
+		input_next(min);
+	}
+	pcap_dump_close(dumper);
+
+	for (i = 0; i < nr; i++)
+		pcap_close(inputs[i].handle);
+	free(inputs);
+	printf("Merged %llu packets from %d files into %s\n",
+	       cnt, nr, outfile);
+	return EXIT_SUCCESS;
+}
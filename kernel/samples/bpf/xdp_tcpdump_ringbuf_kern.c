@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * BPF_MAP_TYPE_RINGBUF backend for xdp_tcpdump (kernel v5.18+ for
+ * bpf_xdp_load_bytes).  A separate ELF file, as xdp_tcpdump_user.c
+ * falls back to the perf ring backend (xdp_tcpdump_kern.o) when this
+ * fails to load on older kernels.
+ *
+ * One ringbuf shared by all CPUs (instead of per CPU perf rings), and
+ * the reader is only woken up every wakeup_batch events.
+ */
+#define KBUILD_MODNAME "foo"
+#include <linux/ptrace.h>
+#include <uapi/linux/bpf.h>
+#include "bpf_helpers.h"
+
+#include "xdp_tcpdump_kern.h"
+
+struct bpf_map_def SEC("maps") ringbuf = {
+	.type		= BPF_MAP_TYPE_RINGBUF,
+	.max_entries	= RINGBUF_SIZE,
+};
+
+char _license[] SEC("license") = "GPL";
+
+struct capture_event {
+	struct capture_hdr hdr;
+	u8 data[];
+};
+
+/* Reserve size must be a constant, thus called per size class */
+static __always_inline
+void ringbuf_capture(struct xdp_md *ctx, struct capture_hdr *hdr,
+		     struct capture_stats *stats, struct capture_config *cfg,
+		     const u32 size)
+{
+	struct capture_event *e;
+	u32 cap_len = hdr->cap_len;
+	u64 flags = BPF_RB_NO_WAKEUP;
+
+	if (cap_len > size) /* Bound for verifier */
+		cap_len = size;
+
+	e = bpf_ringbuf_reserve(&ringbuf, sizeof(*hdr) + size, 0);
+	if (!e) {
+		stats->lost++;
+		return;
+	}
+	e->hdr = *hdr;
+	e->hdr.cap_len = cap_len;
+	if (cap_len == 0 || bpf_xdp_load_bytes(ctx, 0, e->data, cap_len)) {
+		bpf_ringbuf_discard(e, BPF_RB_NO_WAKEUP);
+		stats->lost++;
+		return;
+	}
+
+	/* Batch wakeups, reader also polls with a timeout */
+	stats->captured++;
+	if (cfg->wakeup_batch <= 1 || !(stats->captured % cfg->wakeup_batch))
+		flags = BPF_RB_FORCE_WAKEUP;
+	bpf_ringbuf_submit(e, flags);
+}
+
+SEC("xdp_tcpdump_to_ringbuf")
+int _xdp_prog0(struct xdp_md *ctx)
+{
+	struct capture_config *cfg;
+	struct capture_stats *stats;
+	struct capture_hdr hdr;
+
+	stats = capture_begin(ctx, &hdr, &cfg);
+	if (!stats)
+		return XDP_PASS;
+
+	if (hdr.cap_len <= 128)
+		ringbuf_capture(ctx, &hdr, stats, cfg, 128);
+	else if (hdr.cap_len <= 512)
+		ringbuf_capture(ctx, &hdr, stats, cfg, 512);
+	else if (hdr.cap_len <= 2048)
+		ringbuf_capture(ctx, &hdr, stats, cfg, 2048);
+	else
+		ringbuf_capture(ctx, &hdr, stats, cfg, RINGBUF_SNAPLEN_MAX);
+
+	return XDP_PASS;
+}
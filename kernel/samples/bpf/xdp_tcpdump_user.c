@@ -2,7 +2,22 @@
  * Copyright (c) 2018 Jesper Dangaard Brouer
  */
 static const char *__doc__ =
- "XDP debug program storing XDP level frame into tcpdump-pcap file";
+ "XDP debug program storing XDP level frame into tcpdump-pcap file\n"
+ "\n"
+ " Captures --snaplen bytes of 1 out of --sample N frames, via a\n"
+ " BPF ringbuf (kernel v5.18+) or the per CPU perf ring fallback.\n"
+ " Capture loss (ring full) is reported at exit and every --interval.\n"
+ "\n"
+ " Filter (--filter or trailing args) is applied in the XDP prog, and\n"
+ " supports a subset of pcap-filter syntax, no parentheses or 'not':\n"
+ "  ip | ip6 | tcp | udp | icmp | icmp6\n"
+ "  [src|dst] host ADDR | net ADDR/LEN | port N | portrange N-M\n"
+ " combined with 'and', and up to 8 'or' terms.\n"
+ "  e.g. tcp and dst port 80 or udp and src net 10.0.0.0/8\n"
+ "\n"
+ " With --per-cpu a writer thread per CPU perf ring dumps into its own\n"
+ " file xdp_tcpdump.cpuNN.pcap, merge these by timestamp afterwards:\n"
+ "  ./xdp_tcpdump_merge -w xdp_tcpdump.pcap xdp_tcpdump.cpu*.pcap";
 
 #include <errno.h>
 #include <signal.h>
@@ -15,9 +30,13 @@ static const char *__doc__ =
 #include <sys/resource.h>
 #include <sys/sysinfo.h>
 #include <getopt.h>
+#include <time.h>
 #include <net/if.h>
 #include <assert.h>
+#include <pthread.h>
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
 #include <linux/if_link.h>
 
 /* perf related */
@@ -28,6 +47,7 @@ static const char *__doc__ =
 #include <sys/ioctl.h>
 
 #include "bpf_util.h"
+#include "xdp_tcpdump.h"
 
 /* libbpf related (located in tools/lib/) */
 #include <bpf/bpf.h>
@@ -48,12 +68,48 @@ static struct perf_event_mmap_page *headers[MAX_CPUS];
 
 static pcap_dumper_t *global_pcap_dumper;
 
+/* Large stdio buffer per pcap file, avoids a write(2) per packet */
+#define PCAP_WRITE_BUFSZ	(4 * 1024 * 1024)
+
+/* Per CPU writer threads, one per perf ring (--per-cpu) */
+struct pcap_writer {
+	pthread_t thread;
+	int cpu;
+	pcap_dumper_t *dumper;
+	char *wbuf;
+};
+static struct pcap_writer *writers;
+static int nr_writers;
+static volatile bool exiting;
+
 static __u32 xdp_flags;
 
+static int stats_map_fd = -1;
+static __u64 perf_lost_events;
+static int stats_interval;
+static time_t stats_last;
+
+/* Convert bpf_ktime_get_ns() to time of day, for pcap timestamps */
+static __u64 ktime_offset_ns;
+
+enum capture_backend {
+	BACKEND_AUTO = 0,
+	BACKEND_PERF,
+	BACKEND_RINGBUF,
+};
+
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"dev",		required_argument,	NULL, 'd' },
 	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"snaplen",	required_argument,	NULL, 's' },
+	{"sample",	required_argument,	NULL, 'r' },
+	{"backend",	required_argument,	NULL, 'b' },
+	{"wakeup",	required_argument,	NULL, 'w' },
+	{"interval",	required_argument,	NULL, 'i' },
+	{"filter",	required_argument,	NULL, 'f' },
+	{"per-cpu",	no_argument,		NULL, 'p' },
+	{"ring-pages",	required_argument,	NULL, 'P' },
 	{0, 0, NULL,  0 }
 };
 
@@ -63,8 +119,51 @@ static const struct option long_options[] = {
 #define EXIT_FAIL_BPF		4
 #define EXIT_FAIL_PCAP		5
 
+static void stats_print(void)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	struct capture_stats values[nr_cpus], sum = {};
+	__u32 key = 0;
+	int i;
+
+	if (stats_map_fd < 0 ||
+	    bpf_map_lookup_elem(stats_map_fd, &key, values))
+		return;
+	for (i = 0; i < nr_cpus; i++) {
+		sum.seen     += values[i].seen;
+		sum.sampled  += values[i].sampled;
+		sum.captured += values[i].captured;
+		sum.lost     += values[i].lost;
+		sum.filtered += values[i].filtered;
+	}
+	fprintf(stderr, "capture: seen %llu filtered %llu sampled %llu"
+		" captured %llu lost %llu (%.2f%%) perf-lost-events %llu\n",
+		sum.seen, sum.filtered, sum.sampled, sum.captured, sum.lost,
+		sum.sampled ? 100.0 * sum.lost / sum.sampled : 0.0,
+		perf_lost_events);
+}
+
+/* Called from the poll loops */
+static void stats_periodic(void)
+{
+	time_t now;
+
+	if (!stats_interval)
+		return;
+	now = time(NULL);
+	if (now - stats_last >= stats_interval) {
+		stats_print();
+		stats_last = now;
+	}
+}
+
 static void exit_sig_handler(int sig)
 {
+	/* Writer threads flush and close their files, see main() */
+	if (nr_writers) {
+		exiting = true;
+		return;
+	}
 	fprintf(stderr,
 		"Interrupted: Removing XDP program on ifindex:%d device:%s\n",
 		ifindex, ifname);
@@ -72,6 +171,7 @@ static void exit_sig_handler(int sig)
 		bpf_set_link_xdp_fd(ifindex, -1, xdp_flags);
 	if (global_pcap_dumper)
 		pcap_dump_close(global_pcap_dumper);
+	stats_print();
 	exit(EXIT_SUCCESS);
 }
 
@@ -125,21 +225,210 @@ struct perf_event_sample {
 	char data[];
 };
 
-/* Header for perf event (meta data place before pkt data) */
-struct my_perf_hdr {
-	__u16 cookie;
-	__u16 pkt_len;
-} __packed;
-#define COOKIE	0x9ca9
+/* Compile filter expression into rules, see __doc__ for the syntax */
+static void prefix_mask(int family, int len, __u32 *mask)
+{
+	int i, bits;
+
+	memset(mask, 0, 16);
+	for (i = 0; i < (family == 4 ? 1 : 4); i++) {
+		bits = len > 32 ? 32 : (len < 0 ? 0 : len);
+		mask[i] = bits ? htonl(~0U << (32 - bits)) : 0;
+		len -= 32;
+	}
+}
+
+static int filter_addr(struct filter_rule *r, __u32 flag, char *str,
+		       bool is_net)
+{
+	__u32 addr[4] = {}, mask[4];
+	int family, len, i;
+	char *slash;
+
+	slash = strchr(str, '/');
+	if (slash)
+		*slash = '\0';
+	if (inet_pton(AF_INET, str, addr) == 1)
+		family = 4;
+	else if (inet_pton(AF_INET6, str, addr) == 1)
+		family = 6;
+	else
+		return -1;
+	len = family == 4 ? 32 : 128;
+	if (slash && is_net) {
+		len = atoi(slash + 1);
+		if (len < 0 || len > (family == 4 ? 32 : 128))
+			return -1;
+	} else if (slash) {
+		return -1; /* host with prefix */
+	}
+	if ((r->flags & FILTER_F_FAMILY) && r->family != family)
+		return -1;
+	r->flags |= FILTER_F_FAMILY;
+	r->family = family;
+
+	prefix_mask(family, len, mask);
+	for (i = 0; i < 4; i++)
+		addr[i] &= mask[i];
+	if (flag == FILTER_F_DADDR) {
+		memcpy(r->daddr, addr, 16);
+		memcpy(r->dmask, mask, 16);
+	} else {
+		memcpy(r->saddr, addr, 16);
+		memcpy(r->smask, mask, 16);
+	}
+	return 0;
+}
+
+static int filter_port(struct filter_rule *r, __u32 flag, char *str,
+		       bool is_range)
+{
+	unsigned long lo, hi;
+	char *end;
+
+	lo = strtoul(str, &end, 10);
+	hi = lo;
+	if (is_range && *end == '-')
+		hi = strtoul(end + 1, &end, 10);
+	if (*end != '\0' || end == str || lo > hi || hi > 65535)
+		return -1;
+	if (flag == FILTER_F_DPORT) {
+		r->dport_min = lo;
+		r->dport_max = hi;
+	} else {
+		r->sport_min = lo;
+		r->sport_max = hi;
+	}
+	return 0;
+}
+
+static int filter_proto(struct filter_rule *r, const char *tok)
+{
+	static const struct {
+		const char *name;
+		int family;
+		int proto;
+	} protos[] = {
+		{ "ip",    4, 0 },	{ "ip6",   6, 0 },
+		{ "tcp",   0, IPPROTO_TCP },	{ "udp",   0, IPPROTO_UDP },
+		{ "icmp",  4, IPPROTO_ICMP },	{ "icmp6", 6, IPPROTO_ICMPV6 },
+	};
+	int i;
+
+	for (i = 0; i < sizeof(protos) / sizeof(protos[0]); i++) {
+		if (strcmp(tok, protos[i].name))
+			continue;
+		if (protos[i].family) {
+			if ((r->flags & FILTER_F_FAMILY) &&
+			    r->family != protos[i].family)
+				return -1;
+			r->flags |= FILTER_F_FAMILY;
+			r->family = protos[i].family;
+		}
+		if (protos[i].proto) {
+			if (r->flags & FILTER_F_PROTO)
+				return -1;
+			r->flags |= FILTER_F_PROTO;
+			r->proto = protos[i].proto;
+		}
+		return 0;
+	}
+	return 1; /* Not a protocol keyword */
+}
+
+/* Returns number of rules, or negative on syntax error */
+static int filter_compile(const char *expr, struct filter_rule *rules,
+			  int max_rules)
+{
+	char *buf, *tok, *save = NULL, *arg;
+	struct filter_rule *r;
+	int nr = 1, dir, ret = -1;
+	__u32 flag;
+
+	buf = strdup(expr);
+	if (!buf)
+		return -1;
+	memset(rules, 0, sizeof(*rules) * max_rules);
+	r = &rules[0];
+
+	for (tok = strtok_r(buf, " \t", &save); tok;
+	     tok = strtok_r(NULL, " \t", &save)) {
+		if (!strcmp(tok, "or") || !strcmp(tok, "||")) {
+			if (!r->flags || nr >= max_rules)
+				goto out;
+			r = &rules[nr++];
+			continue;
+		}
+		if (!strcmp(tok, "and") || !strcmp(tok, "&&"))
+			continue;
+
+		ret = filter_proto(r, tok);
+		if (ret < 0)
+			goto out;
+		if (ret == 0)
+			continue;
+		ret = -1;
+
+		/* Optional direction qualifier */
+		dir = 0;
+		if (!strcmp(tok, "src") || !strcmp(tok, "dst")) {
+			dir = tok[0];
+			tok = strtok_r(NULL, " \t", &save);
+			if (!tok)
+				goto out;
+		}
+		arg = strtok_r(NULL, " \t", &save);
+		if (!arg)
+			goto out;
+
+		if (!strcmp(tok, "host") || !strcmp(tok, "net")) {
+			flag = dir == 's' ? FILTER_F_SADDR :
+			       dir == 'd' ? FILTER_F_DADDR : FILTER_F_ADDR;
+			/* One address per direction and term */
+			if (r->flags & (flag | (flag == FILTER_F_ADDR ?
+				FILTER_F_SADDR : FILTER_F_ADDR)))
+				goto out;
+			if (filter_addr(r, flag, arg, tok[0] == 'n'))
+				goto out;
+		} else if (!strcmp(tok, "port") || !strcmp(tok, "portrange")) {
+			flag = dir == 's' ? FILTER_F_SPORT :
+			       dir == 'd' ? FILTER_F_DPORT : FILTER_F_PORT;
+			if (r->flags & (flag | (flag == FILTER_F_PORT ?
+				FILTER_F_SPORT : FILTER_F_PORT)))
+				goto out;
+			if (filter_port(r, flag, arg, tok[4] == 'r'))
+				goto out;
+		} else {
+			goto out;
+		}
+		r->flags |= flag;
+	}
+	if (r->flags)
+		ret = nr;
+out:
+	free(buf);
+	return ret;
+}
+
+static void ktime_offset_init(void)
+{
+	struct timespec mono, real;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	ktime_offset_ns = (real.tv_sec - mono.tv_sec) * 1000000000ULL +
+		real.tv_nsec - mono.tv_nsec;
+}
 
 static int pcap_dump_xdp_data(pcap_dumper_t *dumper, void *data, int size)
 {
 	struct {
 		/* Top part of data, provide by XDP bpf program */
-		struct my_perf_hdr hdr;
+		struct capture_hdr hdr;
 		__u8  pkt_data[];
 	} *e = data;
 	struct pcap_pkthdr pcap_hdr;
+	__u64 ts;
 
 	if (e->hdr.cookie != COOKIE) {
 		fprintf(stderr, "BUG cookie %x sized %d\n",
@@ -147,15 +436,11 @@ static int pcap_dump_xdp_data(pcap_dumper_t *dumper, void *data, int size)
 		return LIBBPF_PERF_EVENT_ERROR;
 	}
 
-	// printf("Pkt len: %-5d bytes event sz:%d\n", e->hdr.pkt_len, size);
-
-	/* TODO: Find fast timestamp method, maybe XDP prog can
-	 * transfer this in my_perf_hdr?  Else the perf-ring infra can
-	 * do some (I think this extra data will be avail at end of
-	 * pkt_data).
-	 */
-	/* pcap_hdr.ts = struct timeval */
-	pcap_hdr.caplen = e->hdr.pkt_len;
+	/* Timestamp taken by XDP prog (bpf_ktime_get_ns) */
+	ts = e->hdr.timestamp + ktime_offset_ns;
+	pcap_hdr.ts.tv_sec  = ts / 1000000000ULL;
+	pcap_hdr.ts.tv_usec = (ts % 1000000000ULL) / 1000;
+	pcap_hdr.caplen = e->hdr.cap_len;
 	pcap_hdr.len    = e->hdr.pkt_len;
 	pcap_dump((u_char *)dumper, &pcap_hdr, e->pkt_data);
 
@@ -178,7 +463,9 @@ static enum bpf_perf_event_ret perf_event_process(void *event, void *priv)
 			__u64 id;
 			__u64 lost;
 		} *lost = (void *) e;
-		printf("lost %lld events\n", lost->lost);
+		/* Per CPU writer threads update this concurrently */
+		__atomic_fetch_add(&perf_lost_events, lost->lost,
+				   __ATOMIC_RELAXED);
 	} else {
 		printf("unknown event type=%d size=%d\n",
 		       e->header.type, e->header.size);
@@ -208,6 +495,7 @@ int pcap_perf_event_poller(int *fds, struct perf_event_mmap_page **headers,
 
 	for (;;) {
 		poll(pfds, num_fds, 1000);
+		stats_periodic();
 		for (i = 0; i < num_fds; i++) {
 			if (!pfds[i].revents)
 				continue;
@@ -227,6 +515,194 @@ int pcap_perf_event_poller(int *fds, struct perf_event_mmap_page **headers,
 	return ret;
 }
 
+/* Minimal BPF ringbuf consumer, as libbpf here predates ring_buffer__*
+ * Layout, see kernel/bpf/ringbuf.c: consumer page (RW), then producer
+ * page and the data area mapped twice (RO), thus records never wrap.
+ */
+#define RINGBUF_BUSY_BIT	(1U << 31)
+#define RINGBUF_DISCARD_BIT	(1U << 30)
+#define RINGBUF_HDR_SZ		8
+
+struct ringbuf_reader {
+	int map_fd;
+	unsigned long *consumer_pos;
+	unsigned long *producer_pos;
+	void *data;
+	unsigned long mask;
+};
+
+static int ringbuf_reader_init(struct ringbuf_reader *rb, int map_fd,
+			       unsigned long size)
+{
+	int psize = getpagesize();
+	void *base;
+
+	rb->map_fd = map_fd;
+	rb->mask = size - 1;
+	rb->consumer_pos = mmap(NULL, psize, PROT_READ | PROT_WRITE,
+				MAP_SHARED, map_fd, 0);
+	if (rb->consumer_pos == MAP_FAILED)
+		return -errno;
+	base = mmap(NULL, psize + 2 * size, PROT_READ, MAP_SHARED,
+		    map_fd, psize);
+	if (base == MAP_FAILED)
+		return -errno;
+	rb->producer_pos = base;
+	rb->data = base + psize;
+	return 0;
+}
+
+static int ringbuf_consume(struct ringbuf_reader *rb, pcap_dumper_t *dumper)
+{
+	unsigned long cons, prod;
+	__u32 *hdr, len;
+	int cnt = 0;
+
+	cons = __atomic_load_n(rb->consumer_pos, __ATOMIC_ACQUIRE);
+	prod = __atomic_load_n(rb->producer_pos, __ATOMIC_ACQUIRE);
+	while (cons < prod) {
+		hdr = rb->data + (cons & rb->mask);
+		len = __atomic_load_n(hdr, __ATOMIC_ACQUIRE);
+		if (len & RINGBUF_BUSY_BIT)
+			break; /* Reserved, but not yet submitted */
+
+		if (!(len & RINGBUF_DISCARD_BIT)) {
+			pcap_dump_xdp_data(dumper, (void *)hdr + RINGBUF_HDR_SZ,
+					   len);
+			cnt++;
+		}
+		len &= ~RINGBUF_DISCARD_BIT;
+		cons += (len + RINGBUF_HDR_SZ + 7) & ~7UL;
+		__atomic_store_n(rb->consumer_pos, cons, __ATOMIC_RELEASE);
+	}
+	return cnt;
+}
+
+static int pcap_ringbuf_poller(int map_fd, pcap_dumper_t *pcap_dumper)
+{
+	struct ringbuf_reader rb;
+	struct pollfd pfd;
+	int err;
+
+	err = ringbuf_reader_init(&rb, map_fd, RINGBUF_SIZE);
+	if (err) {
+		fprintf(stderr, "ERR: mmap ringbuf: %s\n", strerror(-err));
+		return err;
+	}
+	pfd.fd = map_fd;
+	pfd.events = POLLIN;
+
+	/* Timeout as XDP prog only wakes us every wakeup_batch events */
+	for (;;) {
+		poll(&pfd, 1, 100);
+		ringbuf_consume(&rb, pcap_dumper);
+		stats_periodic();
+	}
+	return 0;
+}
+
+static void *pcap_writer_thread(void *arg)
+{
+	struct pcap_writer *w = arg;
+	enum bpf_perf_event_ret ret;
+	struct pollfd pfd;
+	void *buf = NULL;
+	size_t len = 0;
+
+	pfd.fd = pmu_fds[w->cpu];
+	pfd.events = POLLIN;
+
+	while (!exiting) {
+		poll(&pfd, 1, 100);
+		ret = bpf_perf_event_read_simple(headers[w->cpu],
+						 page_cnt * page_size,
+						 page_size, &buf, &len,
+						 perf_event_process,
+						 w->dumper);
+		if (ret != LIBBPF_PERF_EVENT_CONT)
+			break;
+	}
+	free(buf);
+	return NULL;
+}
+
+static pcap_dumper_t *pcap_writer_open(pcap_t *pcap_handle,
+				       const char *path, char **wbuf)
+{
+	pcap_dumper_t *dumper;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open pcap file %s: %s\n",
+			path, strerror(errno));
+		return NULL;
+	}
+	*wbuf = malloc(PCAP_WRITE_BUFSZ);
+	if (*wbuf)
+		setvbuf(fp, *wbuf, _IOFBF, PCAP_WRITE_BUFSZ);
+
+	dumper = pcap_dump_fopen(pcap_handle, fp);
+	if (!dumper) {
+		fprintf(stderr, "Failed to open pcap file %s: %s\n",
+			path, pcap_geterr(pcap_handle));
+		fclose(fp);
+		free(*wbuf);
+	}
+	return dumper;
+}
+
+static int pcap_per_cpu_writers(pcap_t *pcap_handle, int num)
+{
+	char path[64];
+	int i, err = 0;
+
+	writers = calloc(num, sizeof(*writers));
+	if (!writers)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < num; i++) {
+		snprintf(path, sizeof(path), "xdp_tcpdump.cpu%02d.pcap", i);
+		writers[i].cpu = i;
+		writers[i].dumper = pcap_writer_open(pcap_handle, path,
+						     &writers[i].wbuf);
+		if (!writers[i].dumper)
+			return EXIT_FAIL_PCAP;
+	}
+	for (i = 0; i < num; i++) {
+		err = pthread_create(&writers[i].thread, NULL,
+				     pcap_writer_thread, &writers[i]);
+		if (err) {
+			fprintf(stderr, "ERR: pthread_create: %s\n",
+				strerror(err));
+			exiting = true;
+			break;
+		}
+		nr_writers++;
+	}
+
+	/* Main thread only reports stats, until signal sets exiting */
+	while (!exiting) {
+		usleep(100000);
+		stats_periodic();
+	}
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(writers[i].thread, NULL);
+
+	if (ifindex > -1)
+		bpf_set_link_xdp_fd(ifindex, -1, xdp_flags);
+	for (i = 0; i < num; i++) {
+		pcap_dump_close(writers[i].dumper);
+		free(writers[i].wbuf);
+	}
+	stats_print();
+	fprintf(stderr, "Wrote xdp_tcpdump.cpu00-%02d.pcap, merge with:"
+		" xdp_tcpdump_merge -w xdp_tcpdump.pcap"
+		" xdp_tcpdump.cpu*.pcap\n", num - 1);
+	free(writers);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static void setup_bpf_perf_event(int map_fd, int num)
 {
 	struct perf_event_attr attr = {
@@ -258,26 +734,30 @@ int main(int argc, char **argv)
 	struct bpf_prog_load_attr prog_load_attr = {
 		.prog_type	= BPF_PROG_TYPE_XDP,
 	};
-	struct bpf_map *perf_ring_map;
+	struct capture_config cfg = {
+		.snaplen	= 65535,
+		.sample_ratio	= 1,
+		.wakeup_batch	= 64,
+	};
+	struct filter_rule rules[FILTER_MAX_RULES];
+	char filter_expr[1024] = "";
+	int backend = BACKEND_AUTO;
+	bool per_cpu = false;
+	char *wbuf = NULL;
+	struct bpf_map *map;
 	struct bpf_object *obj;
 	char filename[256];
 	int longindex = 0;
 	int prog_fd, opt;
 	int map_fd, i;
 	int numcpus;
+	__u32 key = 0;
 	int err;
 
-	pcap_t *pcap_handle = pcap_open_dead(DLT_EN10MB, 1 << 16);
+	pcap_t *pcap_handle;
 	pcap_dumper_t *pcap_dumper;
 
 	numcpus = get_nprocs();
-	if (numcpus > MAX_CPUS) {
-		fprintf(stderr, "Cannot handle above %d CPUs\n", MAX_CPUS);
-		return EXIT_FAIL_BPF; /* bpf map limitation */
-	}
-
-	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
-	prog_load_attr.file = filename;
 
 	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
 		perror("setrlimit(RLIMIT_MEMLOCK)");
@@ -306,6 +786,50 @@ int main(int argc, char **argv)
 		case 'S':
 			xdp_flags |= XDP_FLAGS_SKB_MODE;
 			break;
+		case 's':
+			cfg.snaplen = atoi(optarg);
+			if (cfg.snaplen == 0 || cfg.snaplen > 65535) {
+				fprintf(stderr, "ERR: --snaplen 1-65535\n");
+				goto error;
+			}
+			break;
+		case 'r':
+			cfg.sample_ratio = atoi(optarg);
+			break;
+		case 'w':
+			cfg.wakeup_batch = atoi(optarg);
+			break;
+		case 'i':
+			stats_interval = atoi(optarg);
+			break;
+		case 'f':
+			snprintf(filter_expr, sizeof(filter_expr), "%s", optarg);
+			break;
+		case 'p':
+			per_cpu = true;
+			break;
+		case 'P':
+			page_cnt = atoi(optarg);
+			/* Perf ring data area must be power-of-2 pages */
+			if (page_cnt <= 0 || (page_cnt & (page_cnt - 1))) {
+				fprintf(stderr,
+					"ERR: --ring-pages must be power of 2\n");
+				goto error;
+			}
+			break;
+		case 'b':
+			if (!strcmp(optarg, "perf"))
+				backend = BACKEND_PERF;
+			else if (!strcmp(optarg, "ringbuf"))
+				backend = BACKEND_RINGBUF;
+			else if (!strcmp(optarg, "auto"))
+				backend = BACKEND_AUTO;
+			else {
+				fprintf(stderr,
+					"ERR: --backend auto|perf|ringbuf\n");
+				goto error;
+			}
+			break;
 		case 'h':
 		error:
 		default:
@@ -319,30 +843,100 @@ int main(int argc, char **argv)
 		usage(argv);
 		return EXIT_FAIL_OPTION;
 	}
+	/* Ringbuf is a single shared ring, per CPU readers need perf */
+	if (per_cpu) {
+		if (backend == BACKEND_RINGBUF) {
+			fprintf(stderr, "ERR: --per-cpu needs perf backend\n");
+			return EXIT_FAIL_OPTION;
+		}
+		backend = BACKEND_PERF;
+	}
+	pcap_handle = pcap_open_dead(DLT_EN10MB, cfg.snaplen);
+
+	/* Trailing args are filter expression, like tcpdump */
+	for (i = optind; i < argc; i++) {
+		if (filter_expr[0])
+			strncat(filter_expr, " ",
+				sizeof(filter_expr) - strlen(filter_expr) - 1);
+		strncat(filter_expr, argv[i],
+			sizeof(filter_expr) - strlen(filter_expr) - 1);
+	}
+	if (filter_expr[0]) {
+		err = filter_compile(filter_expr, rules, FILTER_MAX_RULES);
+		if (err < 0) {
+			fprintf(stderr, "ERR: cannot compile filter: %s\n",
+				filter_expr);
+			return EXIT_FAIL_OPTION;
+		}
+		cfg.nr_rules = err;
+	}
 
-	if (bpf_prog_load_xattr(&prog_load_attr, &obj, &prog_fd))
-		return EXIT_FAIL_BPF;
+	/* Prefer ringbuf backend, fallback to perf ring on older kernels */
+	err = -1;
+	if (backend != BACKEND_PERF) {
+		snprintf(filename, sizeof(filename), "%s_ringbuf_kern.o",
+			 argv[0]);
+		prog_load_attr.file = filename;
+		err = bpf_prog_load_xattr(&prog_load_attr, &obj, &prog_fd);
+		if (!err)
+			backend = BACKEND_RINGBUF;
+		else if (backend == BACKEND_RINGBUF)
+			return EXIT_FAIL_BPF;
+		else
+			fprintf(stderr, "Fallback to perf ring backend\n");
+	}
+	if (err) {
+		snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+		prog_load_attr.file = filename;
+		if (bpf_prog_load_xattr(&prog_load_attr, &obj, &prog_fd))
+			return EXIT_FAIL_BPF;
+		backend = BACKEND_PERF;
+	}
 
 	if (!prog_fd) {
 		fprintf(stderr, "ERR: load_bpf_file: %s\n", strerror(errno));
 		return EXIT_FAIL_BPF;
 	}
 
-	perf_ring_map = bpf_map__next(NULL, obj); // TODO find by name
-	if (!perf_ring_map) {
+	map = bpf_object__find_map_by_name(obj, backend == BACKEND_RINGBUF ?
+					   "ringbuf" : "perf_ring_map");
+	if (!map) {
 		fprintf(stderr, "Failed loading map in obj file\n");
 		return EXIT_FAIL_BPF;
 	}
-	map_fd = bpf_map__fd(perf_ring_map);
-
-	pcap_dumper = pcap_dump_open(pcap_handle, "xdp_tcpdump.pcap");
-	// TEST: pcap_dumper = pcap_dump_open(pcap_handle, "/dev/null");
-	if (!pcap_dumper) {
-		fprintf(stderr, "Failed to open pcap file: %s\n",
-			pcap_geterr(pcap_handle));
-		return EXIT_FAIL_PCAP;
+	map_fd = bpf_map__fd(map);
+
+	map = bpf_object__find_map_by_name(obj, "capture_stats");
+	if (map)
+		stats_map_fd = bpf_map__fd(map);
+	map = bpf_object__find_map_by_name(obj, "capture_filter");
+	for (key = 0; map && key < cfg.nr_rules; key++) {
+		if (bpf_map_update_elem(bpf_map__fd(map), &key,
+					&rules[key], 0)) {
+			fprintf(stderr, "Failed setting capture_filter\n");
+			return EXIT_FAIL_BPF;
+		}
+	}
+	if (cfg.nr_rules)
+		printf("Filter '%s' compiled into %u rule(s)\n",
+		       filter_expr, cfg.nr_rules);
+	key = 0;
+	map = bpf_object__find_map_by_name(obj, "capture_config");
+	if (!map || bpf_map_update_elem(bpf_map__fd(map), &key, &cfg, 0)) {
+		fprintf(stderr, "Failed setting capture_config\n");
+		return EXIT_FAIL_BPF;
+	}
+	ktime_offset_init();
+	stats_last = time(NULL);
+
+	if (!per_cpu) {
+		pcap_dumper = pcap_writer_open(pcap_handle, "xdp_tcpdump.pcap",
+					       &wbuf);
+		// TEST: pcap_writer_open(pcap_handle, "/dev/null", &wbuf);
+		if (!pcap_dumper)
+			return EXIT_FAIL_PCAP;
+		global_pcap_dumper = pcap_dumper;
 	}
-	global_pcap_dumper = pcap_dumper;
 
 	if (bpf_set_link_xdp_fd(ifindex, prog_fd, xdp_flags) < 0) {
 		fprintf(stderr, "link set xdp fd failed\n");
@@ -353,12 +947,35 @@ int main(int argc, char **argv)
 	signal(SIGINT,  exit_sig_handler);
 	signal(SIGTERM, exit_sig_handler);
 
+	if (backend == BACKEND_RINGBUF) {
+		printf("Capture via ringbuf (snaplen:%u sample 1/%u)\n",
+		       cfg.snaplen, cfg.sample_ratio ? : 1);
+		err = pcap_ringbuf_poller(map_fd, pcap_dumper);
+		if (err)
+			return EXIT_FAIL_XDP;
+		return EXIT_SUCCESS;
+	}
+
+	/* Perf ring backend, bpf map limitation */
+	if (numcpus > MAX_CPUS) {
+		fprintf(stderr, "Cannot handle above %d CPUs\n", MAX_CPUS);
+		return EXIT_FAIL_BPF;
+	}
+	printf("Capture via perf ring (snaplen:%u sample 1/%u)\n",
+	       cfg.snaplen, cfg.sample_ratio ? : 1);
+
 	setup_bpf_perf_event(map_fd, numcpus);
 
 	for (i = 0; i < numcpus; i++)
 		if (perf_event_mmap_header(pmu_fds[i], &headers[i]) < 0)
 			return 1;
 
+	if (per_cpu) {
+		printf("Per CPU writer threads (%d), ring %d pages\n",
+		       numcpus, page_cnt);
+		return pcap_per_cpu_writers(pcap_handle, numcpus);
+	}
+
 	err = pcap_perf_event_poller(pmu_fds, headers, numcpus,	pcap_dumper);
 	if (err)
 		return EXIT_FAIL_XDP;
@@ -0,0 +1,176 @@
+/* xdp_traits_bench: per packet cost of XDP-hints via traits vs data_meta
+ *
+ * No _user.c, run via BPF_PROG_TEST_RUN with xdp_prog_bench:
+ *  ./xdp_prog_bench xdp_traits_bench_kern.o
+ *
+ * Each section stores (or reads back) N hints per packet, the
+ * difference to "xdp_baseline" is the per packet cost of the hints.
+ * Compare with lib/bench_traits_simple.c, which measures the kernel
+ * side without the BPF prog call and verifier-inserted checks.
+ *
+ * NOTICE: The trait kfuncs depend on kernel changes under-development,
+ *  https://github.com/arthurfabre/linux/tree/afabre/traits-002-bounds-inline
+ * On a kernel without them the calls return -EOPNOTSUPP (see
+ * bpf_load.c), and the trait sections return XDP_ABORTED.
+ */
+#include <uapi/linux/bpf.h>
+#include "bpf_helpers.h"
+
+extern int bpf_xdp_trait_set(const struct xdp_md *xdp, __u64 key,
+			     const void *val, __u64 val__sz,
+			     __u64 flags) __ksym;
+extern int bpf_xdp_trait_get(const struct xdp_md *xdp, __u64 key,
+			     void *val, __u64 val__sz) __ksym;
+
+/* Kernel limits data_meta to 32 bytes, thus 4x u64 hints or 8x u32 */
+struct meta_hints4 {
+	__u64 field[4];
+};
+
+struct meta_hints8 {
+	__u32 field[8];
+};
+
+SEC("xdp_baseline")
+int xdp_baseline_prog(struct xdp_md *ctx)
+{
+	return XDP_DROP;
+}
+
+static __always_inline int traits_set(struct xdp_md *ctx, const int n)
+{
+	__u64 val = 42;
+	int key;
+
+#pragma unroll
+	for (key = 1; key <= n; key++) {
+		if (bpf_xdp_trait_set(ctx, key, &val, sizeof(val), 0) < 0)
+			return XDP_ABORTED;
+	}
+	return XDP_DROP;
+}
+
+/* Test run repeats on the same xdp_buff, thus only the first run
+ * finds no traits and sets them, like a consumer reading the hints
+ * that the RX prog stored.
+ */
+static __always_inline int traits_get(struct xdp_md *ctx, const int n)
+{
+	__u64 val = 0, sum = 0;
+	int key;
+
+#pragma unroll
+	for (key = 1; key <= n; key++) {
+		if (bpf_xdp_trait_get(ctx, key, &val, sizeof(val)) < 0) {
+			val = 42;
+			if (bpf_xdp_trait_set(ctx, key, &val, sizeof(val), 0))
+				return XDP_ABORTED;
+		}
+		sum += val;
+	}
+	return sum ? XDP_DROP : XDP_ABORTED;
+}
+
+SEC("xdp_traits_set4")
+int xdp_traits_set4_prog(struct xdp_md *ctx)
+{
+	return traits_set(ctx, 4);
+}
+
+SEC("xdp_traits_set8")
+int xdp_traits_set8_prog(struct xdp_md *ctx)
+{
+	return traits_set(ctx, 8);
+}
+
+SEC("xdp_traits_get4")
+int xdp_traits_get4_prog(struct xdp_md *ctx)
+{
+	return traits_get(ctx, 4);
+}
+
+SEC("xdp_traits_get8")
+int xdp_traits_get8_prog(struct xdp_md *ctx)
+{
+	return traits_get(ctx, 8);
+}
+
+/* Grow data_meta to the struct size, which on test run repeats is an
+ * adjust by zero, thus one helper call per packet like a real prog.
+ */
+#define META_PREPARE(ctx, meta)						\
+({									\
+	void *data, *data_meta;						\
+	int ret = 0;							\
+									\
+	data      = (void *)(long)ctx->data;				\
+	data_meta = (void *)(long)ctx->data_meta;			\
+	if (bpf_xdp_adjust_meta(ctx, (data - data_meta) -		\
+				(int)sizeof(*meta)))			\
+		ret = -1;						\
+	meta = (void *)(long)ctx->data_meta;				\
+	if ((void *)(meta + 1) > (void *)(long)ctx->data)		\
+		ret = -1;						\
+	ret;								\
+})
+
+SEC("xdp_meta_write4")
+int xdp_meta_write4_prog(struct xdp_md *ctx)
+{
+	struct meta_hints4 *meta;
+	int i;
+
+	if (META_PREPARE(ctx, meta))
+		return XDP_ABORTED;
+#pragma unroll
+	for (i = 0; i < 4; i++)
+		meta->field[i] = 42;
+	return XDP_DROP;
+}
+
+SEC("xdp_meta_write8")
+int xdp_meta_write8_prog(struct xdp_md *ctx)
+{
+	struct meta_hints8 *meta;
+	int i;
+
+	if (META_PREPARE(ctx, meta))
+		return XDP_ABORTED;
+#pragma unroll
+	for (i = 0; i < 8; i++)
+		meta->field[i] = 42;
+	return XDP_DROP;
+}
+
+SEC("xdp_meta_read4")
+int xdp_meta_read4_prog(struct xdp_md *ctx)
+{
+	struct meta_hints4 *meta;
+	__u64 sum = 0;
+	int i;
+
+	if (META_PREPARE(ctx, meta))
+		return XDP_ABORTED;
+#pragma unroll
+	for (i = 0; i < 4; i++)
+		sum += meta->field[i];
+	/* Data area is uninitialized headroom on first run, any value */
+	return sum != 1 ? XDP_DROP : XDP_PASS;
+}
+
+SEC("xdp_meta_read8")
+int xdp_meta_read8_prog(struct xdp_md *ctx)
+{
+	struct meta_hints8 *meta;
+	__u64 sum = 0;
+	int i;
+
+	if (META_PREPARE(ctx, meta))
+		return XDP_ABORTED;
+#pragma unroll
+	for (i = 0; i < 8; i++)
+		sum += meta->field[i];
+	return sum != 1 ? XDP_DROP : XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
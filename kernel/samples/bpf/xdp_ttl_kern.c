@@ -1,4 +1,7 @@
 /*  XDP example of parsing TTL value of IP-header.
+ *
+ *  Optionally decrements IPv4 TTL and IPv6 hop limit, like a router,
+ *  with a selectable IPv4 header checksum update variant.
  *
  *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
@@ -8,6 +11,7 @@
 #include <uapi/linux/if_packet.h>
 #include <uapi/linux/if_vlan.h>
 #include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
 #include <uapi/linux/in.h>
 #include <uapi/linux/tcp.h>
 #include "bpf_helpers.h"
@@ -35,6 +39,35 @@ struct bpf_map_def SEC("maps") ip2hc_map = {
 	.max_entries = 100000,
 };
 
+/* Checksum update variants, WARNING - sync with _user.c */
+enum csum_variant {
+	CSUM_NONE = 0,		/* Only count TTL, no decrement */
+	CSUM_FULL,		/* Recompute over whole IPv4 header */
+	CSUM_INCREMENTAL,	/* RFC1624 eqn. 3 on the changed 16-bit word */
+	CSUM_HELPER,		/* bpf_csum_diff() on the changed 32-bit word */
+	CSUM_VARIANT_MAX,
+};
+
+struct ttl_config {
+	u32 variant;
+	u32 action;
+};
+
+struct bpf_map_def SEC("maps") ttl_config = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct ttl_config),
+	.max_entries = 1,
+};
+
+/* Packets per variant, userspace derives pps per variant */
+struct bpf_map_def SEC("maps") variant_cnt = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = CSUM_VARIANT_MAX,
+};
+
 //#define DEBUG 1
 #ifdef  DEBUG
 /* Only use this for debug output. Notice output from  bpf_trace_printk()
@@ -90,7 +123,86 @@ bool parse_eth(struct ethhdr *eth, void *data_end,
 }
 
 static __always_inline
-u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
+u16 csum_fold_helper(u32 csum)
+{
+	csum = (csum & 0xffff) + (csum >> 16);
+	csum = (csum & 0xffff) + (csum >> 16);
+	return ~csum;
+}
+
+/* Sum of all 16-bit words in header, ihl is max 15 (60 bytes) */
+static __always_inline
+void ipv4_csum_full(struct iphdr *iph, void *data_end)
+{
+	u16 *word = (u16 *)iph;
+	u32 csum = 0;
+	int i;
+
+	iph->check = 0;
+#pragma unroll
+	for (i = 0; i < 30; i++) {
+		if (i >= iph->ihl * 2)
+			break;
+		if ((void *)(word + i + 1) > data_end)
+			break;
+		csum += word[i];
+	}
+	iph->check = csum_fold_helper(csum);
+}
+
+/* RFC1624: HC' = ~(~HC + ~m + m'), TTL shares a word with protocol */
+static __always_inline
+void ipv4_csum_incremental(struct iphdr *iph, u16 old_word)
+{
+	u16 new_word = *(u16 *)&iph->ttl;
+	u32 csum;
+
+	csum = (u16)~iph->check + (u16)~old_word + new_word;
+	iph->check = csum_fold_helper(csum);
+}
+
+static __always_inline
+void ipv4_csum_helper(struct iphdr *iph, u16 old_word)
+{
+	__be32 from = old_word, to = *(u16 *)&iph->ttl;
+	u32 csum;
+
+	csum = bpf_csum_diff(&from, sizeof(from), &to, sizeof(to),
+			     (u16)~iph->check);
+	iph->check = csum_fold_helper(csum);
+}
+
+static __always_inline
+void ipv4_decrease_ttl(struct iphdr *iph, void *data_end, u32 variant)
+{
+	u16 old_word = *(u16 *)&iph->ttl;
+
+	iph->ttl--;
+	switch (variant) {
+	case CSUM_FULL:
+		ipv4_csum_full(iph, data_end);
+		break;
+	case CSUM_INCREMENTAL:
+		ipv4_csum_incremental(iph, old_word);
+		break;
+	case CSUM_HELPER:
+		ipv4_csum_helper(iph, old_word);
+		break;
+	}
+}
+
+static __always_inline
+void count_variant(u32 variant)
+{
+	u64 *cnt;
+
+	cnt = bpf_map_lookup_elem(&variant_cnt, &variant);
+	if (cnt)
+		*cnt += 1;
+}
+
+static __always_inline
+u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset, struct ttl_config *cfg)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data     = (void *)(long)ctx->data;
@@ -120,17 +232,61 @@ u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
 		//	return XDP_DROP;
 	}
 
-	return XDP_PASS;
+	if (!cfg || cfg->variant == CSUM_NONE ||
+	    cfg->variant >= CSUM_VARIANT_MAX)
+		return XDP_PASS;
+
+	/* Expired, let the stack send ICMP time exceeded */
+	if (ttl <= 1)
+		return XDP_PASS;
+
+	ipv4_decrease_ttl(iph, data_end, cfg->variant);
+	count_variant(cfg->variant);
+	return cfg->action;
+}
+
+/* No IPv6 header checksum, thus no variants */
+static __always_inline
+u32 parse_ipv6(struct xdp_md *ctx, u64 l3_offset, struct ttl_config *cfg)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ipv6hdr *ip6h = data + l3_offset;
+	u64 *counter;
+	u32 hop_limit;
+
+	if (ip6h + 1 > data_end) {
+		bpf_debug("Invalid IPv6 packet: L3off:%llu\n", l3_offset);
+		return XDP_ABORTED;
+	}
+	/* Hop limit shares the TTL histogram */
+	hop_limit = ip6h->hop_limit;
+	counter = bpf_map_lookup_elem(&ttl_map, &hop_limit);
+	if (counter)
+		*counter += 1;
+
+	if (!cfg || cfg->variant == CSUM_NONE || hop_limit <= 1)
+		return XDP_PASS;
+
+	ip6h->hop_limit--;
+	return cfg->action;
 }
 
 static __always_inline
 u32 handle_eth_protocol(struct xdp_md *ctx, u16 eth_proto, u64 l3_offset)
 {
+	struct ttl_config *cfg;
+	u32 key = 0;
+
+	cfg = bpf_map_lookup_elem(&ttl_config, &key);
+
 	switch (eth_proto) {
 	case ETH_P_IP:
-		return parse_ipv4(ctx, l3_offset);
+		return parse_ipv4(ctx, l3_offset, cfg);
+		break;
+	case ETH_P_IPV6:
+		return parse_ipv6(ctx, l3_offset, cfg);
 		break;
-	case ETH_P_IPV6: /* Not handler for IPv6 yet*/
 	case ETH_P_ARP:  /* Let OS handle ARP */
 		/* Fall-through */
 	default:
@@ -1,7 +1,12 @@
 /* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
 static const char *__doc__=
- " XDP example of parsing TTL value of IP-header.";
+ " XDP example of parsing TTL value of IP-header.\n"
+" \n"
+" With --variant, TTL (IPv4) and hop limit (IPv6) are decremented like\n"
+" a router, updating the IPv4 checksum via: full (recompute header),\n"
+" incremental (RFC1624) or helper (bpf_csum_diff).  --cycle rotates\n"
+" the variants each --sec period, and reports pps per variant.";
 
 #include <assert.h>
 #include <errno.h>
@@ -14,15 +19,63 @@ static const char *__doc__=
 
 #include <sys/resource.h>
 #include <getopt.h>
+#include <locale.h>
 
 #include "libbpf.h"
 #include "bpf_load.h"
 #include "bpf_util.h"
+#include "xdp_stats.h"
 
 static int ifindex = -1;
 
+/* Checksum update variants, WARNING - sync with _kern.c */
+enum csum_variant {
+	CSUM_NONE = 0,
+	CSUM_FULL,
+	CSUM_INCREMENTAL,
+	CSUM_HELPER,
+	CSUM_VARIANT_MAX,
+};
+
+static const char *csum_variant_names[CSUM_VARIANT_MAX] = {
+	[CSUM_NONE]		= "none",
+	[CSUM_FULL]		= "full",
+	[CSUM_INCREMENTAL]	= "incremental",
+	[CSUM_HELPER]		= "helper",
+};
+
+struct ttl_config {
+	__u32 variant;
+	__u32 action;
+};
+
+/* Index into map_fd[], ELF map order of _kern.c */
+#define MAP_IDX_TTL_CONFIG	2
+#define MAP_IDX_VARIANT_CNT	3
+
+/* Accumulated over periods a variant was active, for exit summary */
+static struct {
+	__u64 packets;
+	__u64 period;
+} variant_sum[CSUM_VARIANT_MAX];
+
+static void variant_summary(void)
+{
+	int i;
+
+	for (i = CSUM_FULL; i < CSUM_VARIANT_MAX; i++) {
+		if (!variant_sum[i].period)
+			continue;
+		printf("Summary variant %-12s %'14llu pps\n",
+		       csum_variant_names[i],
+		       stats_rate(variant_sum[i].packets,
+				  variant_sum[i].period));
+	}
+}
+
 static void int_exit(int sig)
 {
+	variant_summary();
 	fprintf(stderr, "Interrupted: Removing XDP program on ifindex:%d\n",
 		ifindex);
 	if (ifindex > -1)
@@ -33,6 +86,10 @@ static void int_exit(int sig)
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"ifindex",	required_argument,	NULL, 'i' },
+	{"variant",	required_argument,	NULL, 'v' },
+	{"cycle",	no_argument,		NULL, 'c' },
+	{"drop",	no_argument,		NULL, 'D' },
+	{"sec",		required_argument,	NULL, 's' },
 	{0, 0, NULL,  0 }
 };
 
@@ -129,6 +186,65 @@ static void stats_print(struct ttl_stats *record)
 	}
 }
 
+static bool set_ttl_config(struct ttl_config *cfg)
+{
+	__u32 key = 0;
+
+	if (bpf_map_update_elem(map_fd[MAP_IDX_TTL_CONFIG], &key, cfg,
+				BPF_ANY) != 0) {
+		fprintf(stderr, "ERR: %s(): bpf_map_update_elem failed\n",
+			__func__);
+		return false;
+	}
+	return true;
+}
+
+/* Report pps of the active variant, rotating variants when cycling */
+static void variant_poll(struct ttl_config *cfg, int interval, bool cycle)
+{
+	__u64 cnt[CSUM_VARIANT_MAX], prev[CSUM_VARIANT_MAX];
+	__u64 timestamp, prev_timestamp, period;
+	__u32 active;
+	bool skip = true;
+
+	setlocale(LC_NUMERIC, "en_US");
+	printf("%-12s %14s\n", "variant", "pps");
+
+	memset(cnt, 0, sizeof(cnt));
+	timestamp = stats_gettime();
+	while (1) {
+		sleep(interval);
+		memcpy(prev, cnt, sizeof(prev));
+		prev_timestamp = timestamp;
+		active = cfg->variant;
+		if (stats_percpu_array_sum(map_fd[MAP_IDX_VARIANT_CNT],
+					   CSUM_VARIANT_MAX, cnt, sizeof(__u64)))
+			exit(EXIT_FAIL_XDP);
+		timestamp = stats_gettime();
+		period = timestamp - prev_timestamp;
+
+		/* First period and periods after a switch are mixed */
+		if (!skip) {
+			variant_sum[active].packets += cnt[active] - prev[active];
+			variant_sum[active].period  += period;
+			printf("%-12s %'14llu\n",
+			       csum_variant_names[active],
+			       stats_rate(cnt[active] - prev[active], period));
+		}
+		skip = false;
+
+		if (cycle) {
+			cfg->variant++;
+			if (cfg->variant >= CSUM_VARIANT_MAX)
+				cfg->variant = CSUM_FULL;
+			if (!set_ttl_config(cfg))
+				exit(EXIT_FAIL_XDP);
+			skip = true;
+		}
+		fflush(stdout);
+	}
+}
+
 static void stats_poll(int interval)
 {
 	struct ttl_stats record;
@@ -147,18 +263,42 @@ int main(int argc, char **argv)
 {
 	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
 	char filename[256];
+	struct ttl_config cfg = { .variant = CSUM_NONE, .action = XDP_PASS };
+	bool cycle = false;
 	int longindex = 0;
-	int opt;
+	int interval = 1;
+	int opt, i;
 
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hi:",
+	while ((opt = getopt_long(argc, argv, "hi:v:cDs:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'i':
 			ifindex = atoi(optarg);
 			break;
+		case 'v':
+			for (i = 0; i < CSUM_VARIANT_MAX; i++)
+				if (!strcmp(optarg, csum_variant_names[i]))
+					break;
+			if (i == CSUM_VARIANT_MAX) {
+				printf("**Error**: --variant none|full|"
+				       "incremental|helper\n");
+				return EXIT_FAIL_OPTION;
+			}
+			cfg.variant = i;
+			break;
+		case 'c':
+			cycle = true;
+			cfg.variant = CSUM_FULL;
+			break;
+		case 'D':
+			cfg.action = XDP_DROP;
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
 		case 'h':
 		default:
 			usage(argv);
@@ -188,6 +328,9 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (!set_ttl_config(&cfg))
+		return EXIT_FAIL;
+
 	/* Remove XDP program when program is interrupted */
 	signal(SIGINT, int_exit);
 
@@ -196,7 +339,10 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_XDP;
 	}
 
-	stats_poll(1);
+	if (cfg.variant != CSUM_NONE)
+		variant_poll(&cfg, interval, cycle);
+	else
+		stats_poll(interval);
 
 	return EXIT_OK;
 }
@@ -0,0 +1,39 @@
+#ifndef __XDP_VLAN01_H__
+#define __XDP_VLAN01_H__
+
+/* Shared struct between _user & _kern */
+
+/* VLAN IDs in host-byte-order, zero when tag is not present */
+struct vlan_key {
+	__u16 outer;
+	__u16 inner;
+};
+
+/* Translate/push target VLAN IDs, the priority bits are preserved */
+struct vlan_xlate {
+	__u16 outer;
+	__u16 inner;
+};
+
+/* QinQ programs, also index into vlan_stats.  Same order as the
+ * xdp_qinq_* sections in _kern.c, which come after the other XDP progs.
+ */
+enum vlan_prog {
+	VLAN_PROG_QINQ_POP = 0,		/* memmove of MACs */
+	VLAN_PROG_QINQ_POP2,		/* overlapping 32-bit writes */
+	VLAN_PROG_QINQ_PUSH,		/* memmove of MACs */
+	VLAN_PROG_QINQ_PUSH2,		/* overlapping 32-bit writes */
+	VLAN_PROG_QINQ_TRANSLATE,	/* in place TCI rewrite */
+	VLAN_PROG_MAX
+};
+
+struct vlan_stats {
+	__u64 processed;
+	__u64 miss;	/* No vlan_xlate entry, or wrong number of tags */
+};
+
+struct vlan_config {
+	__u32 action;	/* For processed packets, XDP_ABORTED means XDP_PASS */
+};
+
+#endif /* __XDP_VLAN01_H__ */
@@ -20,6 +20,7 @@
 #include <uapi/linux/pkt_cls.h>
 
 #include "bpf_helpers.h"
+#include "xdp_vlan01.h"
 
 /* linux/if_vlan.h have not exposed this as UAPI, thus mirror some here
  *
@@ -256,6 +257,218 @@ int  xdp_prognum3(struct xdp_md *ctx)
 	return XDP_PASS;
 }
 
+/*=====================================
+ *  QinQ (802.1ad) push/pop/translate
+ * ====================================
+ * Driven by the vlan_xlate map, populated by xdp_vlan01_user.c, which
+ * also attach these programs and measure pps per program.  The pop and
+ * push programs come in two variants for comparing head-adjust
+ * strategies: memmove of the MACs vs. overlapping 32-bit writes.
+ */
+struct bpf_map_def SEC("maps") vlan_xlate = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(struct vlan_key),
+	.value_size = sizeof(struct vlan_xlate),
+	.max_entries = VLAN_N_VID,
+};
+
+struct bpf_map_def SEC("maps") vlan_config = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct vlan_config),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") vlan_stats = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct vlan_stats),
+	.max_entries = VLAN_PROG_MAX,
+};
+
+static __always_inline
+u32 vlan_verdict(u32 prog, bool hit)
+{
+	struct vlan_config *cfg;
+	struct vlan_stats *stats;
+	u32 key = 0;
+
+	stats = bpf_map_lookup_elem(&vlan_stats, &prog);
+	if (stats) {
+		/* Don't need __sync_fetch_and_add(); as percpu map */
+		if (hit)
+			stats->processed++;
+		else
+			stats->miss++;
+	}
+
+	cfg = bpf_map_lookup_elem(&vlan_config, &key);
+	if (!hit || !cfg || cfg->action == XDP_ABORTED)
+		return XDP_PASS;
+	return cfg->action;
+}
+
+static __always_inline
+struct vlan_xlate *vlan_lookup(u16 outer, u16 inner)
+{
+	struct vlan_key key = { .outer = outer, .inner = inner };
+
+	return bpf_map_lookup_elem(&vlan_xlate, &key);
+}
+
+/* Preserve priority and CFI bits */
+static __always_inline
+void vlan_set_vid(struct _vlan_hdr *vlan_hdr, u16 vid)
+{
+	vlan_hdr->h_vlan_TCI =
+		htons((ntohs(vlan_hdr->h_vlan_TCI) & ~VLAN_VID_MASK) |
+		      (vid & VLAN_VID_MASK));
+}
+
+/* Pop both tags, the inner h_vlan_encapsulated_proto takes over the
+ * role as ethhdr->h_proto, thus only the MACs (12 bytes) are moved.
+ */
+static __always_inline
+int qinq_pop(struct xdp_md *ctx, u32 prog)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct parse_pkt pkt = { 0 };
+
+	if (!parse_eth_frame(data, data_end, &pkt))
+		return XDP_ABORTED;
+
+	if (pkt.vlan_inner_offset == 0 ||
+	    !vlan_lookup(pkt.vlan_outer, pkt.vlan_inner))
+		return vlan_verdict(prog, false);
+
+	if (prog == VLAN_PROG_QINQ_POP) {
+		__builtin_memmove(data + 2 * VLAN_HDR_SZ, data, ETH_ALEN * 2);
+	} else {
+		__u32 *p = data;
+
+		/* Shift MACs 8 bytes, highest word first as they overlap */
+		p[4] = p[2];
+		p[3] = p[1];
+		p[2] = p[0];
+	}
+
+	if (bpf_xdp_adjust_head(ctx, 2 * VLAN_HDR_SZ))
+		return XDP_ABORTED;
+	return vlan_verdict(prog, true);
+}
+
+SEC("xdp_qinq_pop")
+int  xdp_prognum4(struct xdp_md *ctx)
+{
+	return qinq_pop(ctx, VLAN_PROG_QINQ_POP);
+}
+
+SEC("xdp_qinq_pop2")
+int  xdp_prognum5(struct xdp_md *ctx)
+{
+	return qinq_pop(ctx, VLAN_PROG_QINQ_POP2);
+}
+
+/* Push an outer 802.1ad S-tag, onto a C-tagged (or untagged) frame.
+ * The old ethhdr->h_proto becomes h_vlan_encapsulated_proto of the
+ * new tag, thus only the MACs (12 bytes) are moved.
+ */
+static __always_inline
+int qinq_push(struct xdp_md *ctx, u32 prog)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct parse_pkt pkt = { 0 };
+	struct _vlan_hdr *vlan_hdr;
+	struct vlan_xlate *xlate;
+	struct ethhdr *eth;
+
+	if (!parse_eth_frame(data, data_end, &pkt))
+		return XDP_ABORTED;
+
+	if (pkt.vlan_inner_offset)
+		return vlan_verdict(prog, false); /* Already double tagged */
+
+	xlate = vlan_lookup(pkt.vlan_outer, 0);
+	if (!xlate)
+		return vlan_verdict(prog, false);
+
+	if (bpf_xdp_adjust_head(ctx, 0 - VLAN_HDR_SZ))
+		return XDP_ABORTED;
+
+	/* Pointers must be re-validated after bpf_xdp_adjust_head() */
+	data_end = (void *)(long)ctx->data_end;
+	data     = (void *)(long)ctx->data;
+	eth      = data;
+	vlan_hdr = data + sizeof(*eth);
+	if ((void *)(vlan_hdr + 1) > data_end)
+		return XDP_ABORTED;
+
+	if (prog == VLAN_PROG_QINQ_PUSH) {
+		__builtin_memmove(data, data + VLAN_HDR_SZ, ETH_ALEN * 2);
+	} else {
+		__u32 *p = data;
+
+		/* Shift MACs 4 bytes down, lowest word first */
+		p[0] = p[1];
+		p[1] = p[2];
+		p[2] = p[3];
+	}
+	eth->h_proto = htons(ETH_P_8021AD);
+	vlan_hdr->h_vlan_TCI = htons(xlate->outer & VLAN_VID_MASK);
+
+	return vlan_verdict(prog, true);
+}
+
+SEC("xdp_qinq_push")
+int  xdp_prognum6(struct xdp_md *ctx)
+{
+	return qinq_push(ctx, VLAN_PROG_QINQ_PUSH);
+}
+
+SEC("xdp_qinq_push2")
+int  xdp_prognum7(struct xdp_md *ctx)
+{
+	return qinq_push(ctx, VLAN_PROG_QINQ_PUSH2);
+}
+
+/* Rewrite VLAN IDs in place, no head adjust */
+SEC("xdp_qinq_translate")
+int  xdp_prognum8(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	const u32 prog = VLAN_PROG_QINQ_TRANSLATE;
+	struct parse_pkt pkt = { 0 };
+	struct _vlan_hdr *vlan_hdr;
+	struct vlan_xlate *xlate;
+
+	if (!parse_eth_frame(data, data_end, &pkt))
+		return XDP_ABORTED;
+
+	if (pkt.vlan_outer_offset == 0)
+		return vlan_verdict(prog, false);
+
+	xlate = vlan_lookup(pkt.vlan_outer, pkt.vlan_inner);
+	if (!xlate)
+		return vlan_verdict(prog, false);
+
+	vlan_hdr = data + pkt.vlan_outer_offset;
+	if ((void *)(vlan_hdr + 1) > data_end)
+		return XDP_ABORTED;
+	vlan_set_vid(vlan_hdr, xlate->outer);
+
+	if (pkt.vlan_inner_offset) {
+		vlan_hdr = data + pkt.vlan_inner_offset;
+		if ((void *)(vlan_hdr + 1) > data_end)
+			return XDP_ABORTED;
+		vlan_set_vid(vlan_hdr, xlate->inner);
+	}
+
+	return vlan_verdict(prog, true);
+}
+
 /*=====================================
  *  BELOW: TC-hook based ebpf programs
  * ====================================
@@ -9,6 +9,7 @@ usage() {
   echo "  -v | --verbose : Verbose"
   echo "  --flush        : Flush before starting (e.g. after --interactive)"
   echo "  --interactive  : Keep netns setup running after test-run"
+  echo "  --qinq         : Also test QinQ translate via ./xdp_vlan01"
   echo ""
 }
 
@@ -30,6 +31,7 @@ cleanup()
 	fi
 
 	set +e
+	[ -n "$PIDS" ] && kill $PIDS 2> /dev/null
 	ip link del veth1 2> /dev/null
 	ip netns del ns1 2> /dev/null
 	ip netns del ns2 2> /dev/null
@@ -37,7 +39,7 @@ cleanup()
 
 # Using external program "getopt" to get --long-options
 OPTIONS=$(getopt -o hvfi: \
-    --long verbose,flush,help,interactive,debug -- "$@")
+    --long verbose,flush,help,interactive,debug,qinq -- "$@")
 if (( $? != 0 )); then
     usage
     echo "selftests: $TESTNAME [FAILED] Error calling getopt, unknown option?"
@@ -56,6 +58,10 @@ while true; do
 		INTERACTIVE=yes
 		shift
 		;;
+	    --qinq )
+		QINQ=yes
+		shift
+		;;
 	    -f | --flush )
 		cleanup
 		shift
@@ -192,3 +198,53 @@ ip netns exec ns2 ping -W 2 -c 3 $IPADDR1
 
 ip netns exec ns1 ping -W 2 -c 3 $IPADDR2
 
+# QinQ (802.1ad) VLAN ID translation
+# ----------------------------------
+# Each side uses different S-VLAN IDs, the xdp_qinq_translate program
+# (ingress on both veth ends) rewrites outer 100 <-> 200.  Needs the
+# vlan_xlate map, thus attached via ./xdp_vlan01 instead of 'ip'.
+if [ -z "$QINQ" ]; then
+	exit 0
+fi
+
+# Remove single VLAN test progs, TC egress would push 4011 on QinQ too
+ip netns exec ns1 ip link set $DEVNS1 xdp off
+ip netns exec ns1 tc qdisc del dev $DEVNS1 clsact
+
+# Also disable S-VLAN (802.1ad) offloading
+ip netns exec ns1 ethtool -K veth1 rx-vlan-stag-hw-parse off \
+	tx-vlan-stag-hw-insert off 2> /dev/null || true
+ip netns exec ns2 ethtool -K veth2 rx-vlan-stag-hw-parse off \
+	tx-vlan-stag-hw-insert off 2> /dev/null || true
+
+export CVLAN=4012
+export QADDR1=100.64.42.1
+export QADDR2=100.64.42.2
+
+ip netns exec ns1 ip link add link veth1 name veth1.200 type vlan proto 802.1ad id 200
+ip netns exec ns1 ip link add link veth1.200 name veth1.200.$CVLAN type vlan id $CVLAN
+ip netns exec ns1 ip addr add ${QADDR1}/24 dev veth1.200.$CVLAN
+ip netns exec ns1 ip link set veth1.200 up
+ip netns exec ns1 ip link set veth1.200.$CVLAN up
+
+ip netns exec ns2 ip link add link veth2 name veth2.100 type vlan proto 802.1ad id 100
+ip netns exec ns2 ip link add link veth2.100 name veth2.100.$CVLAN type vlan id $CVLAN
+ip netns exec ns2 ip addr add ${QADDR2}/24 dev veth2.100.$CVLAN
+ip netns exec ns2 ip link set veth2.100 up
+ip netns exec ns2 ip link set veth2.100.$CVLAN up
+
+# Different S-VLAN IDs, cannot reach each-other yet
+ip netns exec ns2 sh -c "ping -W 1 -c 1 $QADDR1 || echo 'Okay ping fails'"
+
+# Generic-XDP, as translate does not change the header length
+ip netns exec ns1 ./xdp_vlan01 --dev veth1 --skb-mode --sec 1 \
+	--prog qinq_translate --xlate 100:$CVLAN=200:$CVLAN > /dev/null &
+PIDS="$PIDS $!"
+ip netns exec ns2 ./xdp_vlan01 --dev veth2 --skb-mode --sec 1 \
+	--prog qinq_translate --xlate 200:$CVLAN=100:$CVLAN > /dev/null &
+PIDS="$PIDS $!"
+sleep 1
+
+ip netns exec ns2 ping -W 2 -c 3 $QADDR1
+
+ip netns exec ns1 ping -W 2 -c 3 $QADDR2
@@ -9,6 +9,14 @@ static const char *__doc2__ =
 "export ROOTDEV=ixgbe2\n"
 "ip link set $ROOTDEV xdp off\n"
 "ip link set $ROOTDEV xdp object xdp_vlan01_kern.o section xdp_drop_vlan_4011\n"
+"\n"
+"The QinQ (802.1ad) programs need the vlan_xlate map, thus use --dev:\n"
+" --prog NAME   qinq_pop, qinq_pop2, qinq_push, qinq_push2, qinq_translate\n"
+" --xlate O:I=NO:NI  map VLAN IDs outer:inner to new (zero is no tag),\n"
+"               pop matches O:I, push matches C-tag O:0 and pushes NO\n"
+" --cycle       alternate pop/pop2 or push/push2 each --sec period, to\n"
+"               compare memmove of MACs vs overlapping 32-bit writes\n"
+" --drop        XDP_DROP processed packets (default XDP_PASS)\n"
 "";
 
 #include <errno.h>
@@ -17,12 +25,322 @@ static const char *__doc2__ =
 #include <errno.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
 #include <linux/if_link.h>
 
+#include <sys/resource.h>
+#include <getopt.h>
+#include <net/if.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "xdp_stats.h"
+#include "xdp_vlan01.h"
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_XDP		3
+#define EXIT_FAIL_BPF		4
+
+/* XDP progs in _kern.c before the xdp_qinq_* progs */
+#define VLAN_PROG_FD_OFFSET	4
+
+/* Index into map_fd[], ELF map order of _kern.c */
+#define MAP_IDX_VLAN_XLATE	0
+#define MAP_IDX_VLAN_CONFIG	1
+#define MAP_IDX_VLAN_STATS	2
+
+static const char *vlan_prog_names[VLAN_PROG_MAX] = {
+	[VLAN_PROG_QINQ_POP]		= "qinq_pop",
+	[VLAN_PROG_QINQ_POP2]		= "qinq_pop2",
+	[VLAN_PROG_QINQ_PUSH]		= "qinq_push",
+	[VLAN_PROG_QINQ_PUSH2]		= "qinq_push2",
+	[VLAN_PROG_QINQ_TRANSLATE]	= "qinq_translate",
+};
+
+static int ifindex = -1;
+static char ifname_buf[IF_NAMESIZE];
+static char *ifname;
+static __u32 xdp_flags;
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"prog",	required_argument,	NULL, 'p' },
+	{"xlate",	required_argument,	NULL, 'x' },
+	{"cycle",	no_argument,		NULL, 'c' },
+	{"drop",	no_argument,		NULL, 'D' },
+	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"sec",		required_argument,	NULL, 's' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n\n%s\n", __doc__, __doc2__);
+	printf(" Usage: %s (options-see-below)\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+/* Accumulated over periods a prog was attached, for exit summary */
+static struct {
+	__u64 processed;
+	__u64 period;
+} prog_sum[VLAN_PROG_MAX];
+
+static void prog_summary(void)
+{
+	int i;
+
+	for (i = 0; i < VLAN_PROG_MAX; i++) {
+		if (!prog_sum[i].period)
+			continue;
+		printf("Summary %-16s %'14llu pps\n", vlan_prog_names[i],
+		       stats_rate(prog_sum[i].processed, prog_sum[i].period));
+	}
+}
+
+static void int_exit(int sig)
+{
+	prog_summary();
+	fprintf(stderr,
+		"Interrupted: Removing XDP program on ifindex:%d device:%s\n",
+		ifindex, ifname);
+	if (ifindex > -1)
+		set_link_xdp_fd(ifindex, -1, xdp_flags);
+	exit(EXIT_OK);
+}
+
+static int parse_vlan_prog(const char *name)
+{
+	int i;
+
+	for (i = 0; i < VLAN_PROG_MAX; i++)
+		if (!strcmp(name, vlan_prog_names[i]))
+			return i;
+	return -1;
+}
+
+/* Parse O:I=NO:NI and insert into vlan_xlate map */
+static bool add_vlan_xlate(const char *str)
+{
+	unsigned int o, i, no, ni;
+	struct vlan_xlate xlate;
+	struct vlan_key key;
+
+	if (sscanf(str, "%u:%u=%u:%u", &o, &i, &no, &ni) != 4 ||
+	    o >= 4096 || i >= 4096 || no >= 4096 || ni >= 4096) {
+		fprintf(stderr, "ERR: --xlate OUTER:INNER=OUTER:INNER\n");
+		return false;
+	}
+	key.outer   = o;
+	key.inner   = i;
+	xlate.outer = no;
+	xlate.inner = ni;
+
+	if (bpf_map_update_elem(map_fd[MAP_IDX_VLAN_XLATE], &key, &xlate,
+				BPF_ANY)) {
+		fprintf(stderr, "ERR: vlan_xlate update err(%d):%s\n",
+			errno, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static bool attach_prog(int prog)
+{
+	if (set_link_xdp_fd(ifindex, prog_fd[VLAN_PROG_FD_OFFSET + prog],
+			    xdp_flags) < 0) {
+		fprintf(stderr, "ERR: link set xdp fd failed (%s)\n",
+			vlan_prog_names[prog]);
+		return false;
+	}
+	return true;
+}
+
+static void stats_poll(int prog, int interval, bool cycle)
+{
+	struct vlan_stats rec[VLAN_PROG_MAX], prev[VLAN_PROG_MAX];
+	__u64 timestamp, prev_timestamp, period;
+	int active = prog;
+	bool skip = true;
+
+	setlocale(LC_NUMERIC, "en_US");
+	printf("%-16s %14s %14s\n", "XDP-prog", "processed-pps", "miss-pps");
+
+	memset(rec, 0, sizeof(rec));
+	timestamp = stats_gettime();
+	while (1) {
+		sleep(interval);
+		memcpy(prev, rec, sizeof(prev));
+		prev_timestamp = timestamp;
+		if (stats_percpu_array_sum(map_fd[MAP_IDX_VLAN_STATS],
+					   VLAN_PROG_MAX, rec, sizeof(rec[0])))
+			exit(EXIT_FAIL_BPF);
+		timestamp = stats_gettime();
+		period = timestamp - prev_timestamp;
+
+		/* Period after a prog switch is mixed, don't account it */
+		if (!skip) {
+			__u64 processed = rec[active].processed -
+					  prev[active].processed;
+
+			prog_sum[active].processed += processed;
+			prog_sum[active].period    += period;
+			printf("%-16s %'14llu %'14llu\n",
+			       vlan_prog_names[active],
+			       stats_rate(processed, period),
+			       stats_rate(rec[active].miss - prev[active].miss,
+					  period));
+		}
+		skip = false;
+
+		/* The "2" variant follows directly in enum vlan_prog */
+		if (cycle) {
+			active = (active == prog) ? prog + 1 : prog;
+			if (!attach_prog(active))
+				exit(EXIT_FAIL_XDP);
+			skip = true;
+		}
+		fflush(stdout);
+	}
+}
+
+#define MAX_XLATE 64
+
 int main(int argc, char **argv)
 {
-	printf("Simple: %s\n\n", __doc__);
-	printf("%s\n", __doc2__);
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	struct vlan_config cfg = { .action = XDP_PASS };
+	char *xlate[MAX_XLATE];
+	int nr_xlate = 0;
+	int prog = VLAN_PROG_QINQ_TRANSLATE;
+	bool cycle = false;
+	char filename[256];
+	int longindex = 0;
+	int interval = 1;
+	__u32 key = 0;
+	int opt, i;
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	while ((opt = getopt_long(argc, argv, "hd:p:x:cDSs:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'd':
+			if (strlen(optarg) >= IF_NAMESIZE) {
+				fprintf(stderr, "ERR: --dev name too long\n");
+				goto error;
+			}
+			ifname = (char *)&ifname_buf;
+			strncpy(ifname, optarg, IF_NAMESIZE);
+			ifindex = if_nametoindex(ifname);
+			if (ifindex == 0) {
+				fprintf(stderr,
+					"ERR: --dev name unknown err(%d):%s\n",
+					errno, strerror(errno));
+				goto error;
+			}
+			break;
+		case 'p':
+			prog = parse_vlan_prog(optarg);
+			if (prog < 0) {
+				fprintf(stderr, "ERR: --prog %s unknown\n",
+					optarg);
+				goto error;
+			}
+			break;
+		case 'x':
+			if (nr_xlate >= MAX_XLATE) {
+				fprintf(stderr, "ERR: max %d --xlate\n",
+					MAX_XLATE);
+				goto error;
+			}
+			xlate[nr_xlate++] = optarg;
+			break;
+		case 'c':
+			cycle = true;
+			break;
+		case 'D':
+			cfg.action = XDP_DROP;
+			break;
+		case 'S':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 'h':
+		error:
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+
+	/* Without a device, only show how to use the programs via 'ip' */
+	if (ifindex == -1) {
+		printf("Simple: %s\n\n", __doc__);
+		printf("%s\n", __doc2__);
+		return EXIT_SUCCESS;
+	}
+
+	if (cycle && prog != VLAN_PROG_QINQ_POP &&
+	    prog != VLAN_PROG_QINQ_PUSH) {
+		fprintf(stderr, "ERR: --cycle needs --prog qinq_pop or qinq_push\n");
+		return EXIT_FAIL_OPTION;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (prog_cnt < VLAN_PROG_FD_OFFSET + VLAN_PROG_MAX) {
+		fprintf(stderr, "ERR: %s: expected %d XDP progs, got %d\n",
+			filename, VLAN_PROG_FD_OFFSET + VLAN_PROG_MAX, prog_cnt);
+		return EXIT_FAIL_BPF;
+	}
+
+	for (i = 0; i < nr_xlate; i++)
+		if (!add_vlan_xlate(xlate[i]))
+			return EXIT_FAIL_OPTION;
+
+	if (bpf_map_update_elem(map_fd[MAP_IDX_VLAN_CONFIG], &key, &cfg,
+				BPF_ANY)) {
+		fprintf(stderr, "ERR: vlan_config update failed\n");
+		return EXIT_FAIL_BPF;
+	}
+
+	/* Remove XDP program when program is interrupted */
+	signal(SIGINT, int_exit);
+	signal(SIGTERM, int_exit);
+
+	if (!attach_prog(prog))
+		return EXIT_FAIL_XDP;
 
-	return EXIT_SUCCESS;
+	stats_poll(prog, interval, cycle);
+	return EXIT_OK;
 }
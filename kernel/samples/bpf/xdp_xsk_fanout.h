@@ -0,0 +1,21 @@
+#ifndef __XDP_XSK_FANOUT_H__
+#define __XDP_XSK_FANOUT_H__
+
+/* Shared between xdp_xsk_fanout _kern.c and _user.c */
+
+/* The xsks_map key of a socket is rx_queue * fanout + slot, where all
+ * fanout sockets of an RX queue are bound to that queue and share its
+ * UMEM.  xsks_map is resized to queues * fanout before load.
+ */
+#define XSK_SOCKS_MAX	64
+#define XSK_FANOUT_MAX	16
+
+/* Keys of the xsk_cnt PERCPU_ARRAY, counters of the XDP prog */
+enum xsk_cnt {
+	XSK_CNT_RX = 0,		/* All packets seen */
+	XSK_CNT_REDIRECT,	/* Redirected to a socket */
+	XSK_CNT_NO_SOCK,	/* No socket at the key, XDP_PASS */
+	XSK_CNT_MAX
+};
+
+#endif /* __XDP_XSK_FANOUT_H__ */
@@ -0,0 +1,103 @@
+/*  XDP flow fanout to AF_XDP sockets (BPF_MAP_TYPE_XSKMAP)
+ *
+ *  As xdp_redirect_cpu spreads flows over CPUs via cpumap, this spreads
+ *  the flows of each RX queue over the AF_XDP sockets bound to that
+ *  queue, for userspace packet processing.
+ *
+ *  GPLv2, Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
+
+#include <uapi/linux/bpf.h>
+#include "bpf_helpers.h"
+
+#include "hash_func02.h"
+#include "xdp_xsk_fanout.h"
+
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, XSK_SOCKS_MAX);
+} xsks_map SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, XSK_CNT_MAX);
+} xsk_cnt SEC(".maps");
+
+/* Sockets per RX queue, set by _user.c before load.  In .rodata, thus
+ * a constant for the verifier, and with 1 the hash is dead code.
+ */
+const volatile u32 fanout = 1;
+
+static __always_inline void cnt_inc(u32 key)
+{
+	u64 *cnt = bpf_map_lookup_elem(&xsk_cnt, &key);
+
+	if (cnt)
+		*cnt += 1;
+}
+
+/* Symmetric L3 hash (saddr XOR daddr), both directions of a flow go
+ * to the same socket.  Non-IP goes to slot 0.
+ */
+static __always_inline u32 flow_hash(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	u32 key[4];
+	int i;
+
+	if ((void *)(eth + 1) > data_end)
+		return 0;
+
+	if (eth->h_proto == htons(ETH_P_IP)) {
+		struct iphdr *iph = (void *)(eth + 1);
+
+		if ((void *)(iph + 1) > data_end)
+			return 0;
+		return jhash_1word(iph->saddr ^ iph->daddr, iph->protocol);
+	}
+	if (eth->h_proto == htons(ETH_P_IPV6)) {
+		struct ipv6hdr *ip6h = (void *)(eth + 1);
+
+		if ((void *)(ip6h + 1) > data_end)
+			return 0;
+#pragma clang loop unroll(full)
+		for (i = 0; i < 4; i++)
+			key[i] = ip6h->saddr.s6_addr32[i] ^
+				 ip6h->daddr.s6_addr32[i];
+		return jhash_words(key, 4, ip6h->nexthdr);
+	}
+	return 0;
+}
+
+SEC("xdp_xsk_fanout")
+int xdp_xsk_fanout_prog(struct xdp_md *ctx)
+{
+	u32 key, slot = 0;
+
+	cnt_inc(XSK_CNT_RX);
+
+	if (fanout > 1)
+		slot = flow_hash(ctx) % fanout;
+	key = ctx->rx_queue_index * fanout + slot;
+
+	/* Lookup returns the socket since v5.3, avoids a failing
+	 * redirect (XDP_ABORTED) for queues without sockets.
+	 */
+	if (!bpf_map_lookup_elem(&xsks_map, &key)) {
+		cnt_inc(XSK_CNT_NO_SOCK);
+		return XDP_PASS;
+	}
+	cnt_inc(XSK_CNT_REDIRECT);
+	return bpf_redirect_map(&xsks_map, key, 0);
+}
+
+char _license[] SEC("license") = "GPL";
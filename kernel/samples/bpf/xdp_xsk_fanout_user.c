@@ -0,0 +1,802 @@
+/* GPLv2 Copyright(c) 2018 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__ =
+ " XDP flow fanout to AF_XDP sockets, userspace packet processing\n"
+ "\n"
+ " Binds --fanout AF_XDP sockets to each of the RX queues 0..--queues-1,\n"
+ " the sockets of a queue share its UMEM.  The XDP prog hashes the flows\n"
+ " of a queue over its sockets (xsks_map), each socket has its own\n"
+ " thread, with batched RX/TX over the rings.\n"
+ "\n"
+ " Modes: rxdrop (frames go straight back to the fill ring), l2fwd\n"
+ " (swap MACs, TX on the same queue).  Zero-copy is used when the driver\n"
+ " supports it, force it with --zero-copy.  --busy-poll (kernel v5.11)\n"
+ " drives the NAPI of the queue from the socket thread.\n"
+ "\n"
+ " Compare the pps with xdp_redirect_cpu for the ceiling of\n"
+ " kernel-bypass vs cpumap redirect.  Needs kernel v5.4 (need_wakeup).";
+
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "xdp_stats.h"
+#include "xdp_xsk_fanout.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+/* Since v5.11 */
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_XDP		3
+#define EXIT_FAIL_BPF		4
+#define EXIT_FAIL_MEM		5
+#define EXIT_FAIL_XSK		6
+
+/* Per RX queue UMEM, the fill ring holds all frames */
+#define FRAME_SIZE	4096
+#define UMEM_FRAMES	8192
+#define RING_SIZE	2048	/* RX and TX ring of each socket */
+
+enum xsk_mode {
+	MODE_RXDROP = 0,
+	MODE_L2FWD,
+};
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"queues",	required_argument,	NULL, 'Q' },
+	{"fanout",	required_argument,	NULL, 'f' },
+	{"mode",	required_argument,	NULL, 'm' },
+	{"zero-copy",	no_argument,		NULL, 'z' },
+	{"copy",	no_argument,		NULL, 'c' },
+	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"busy-poll",	no_argument,		NULL, 'B' },
+	{"batch",	required_argument,	NULL, 'b' },
+	{"cpu",		required_argument,	NULL, 'C' },
+	{"sec",		required_argument,	NULL, 's' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n", argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+/* Producer/consumer ring, shared with the kernel via mmap */
+struct xsk_ring {
+	__u32 cached_prod;
+	__u32 cached_cons;
+	__u32 mask;
+	__u32 size;
+	__u32 *producer;
+	__u32 *consumer;
+	__u32 *flags;
+	void *ring;
+	void *map;
+	size_t map_len;
+};
+
+struct xsk_umem {
+	void *area;
+	struct xsk_ring fill;
+	struct xsk_ring comp;
+	/* The fanout sockets of a queue share the fill and completion
+	 * rings, uncontended with --fanout 1.
+	 */
+	pthread_spinlock_t lock;
+};
+
+struct xsk_sock {
+	int fd;
+	__u32 queue;
+	struct xsk_umem *umem;
+	struct xsk_ring rx;
+	struct xsk_ring tx;
+	pthread_t thread;
+	int cpu;
+	/* Written by the socket thread only */
+	__u64 rx_pkts;
+	__u64 tx_pkts;
+} __attribute__((aligned(64)));
+
+static int ifindex = -1;
+static char ifname_buf[IF_NAMESIZE];
+static char *ifname;
+static __u32 xdp_flags;
+
+static enum xsk_mode mode = MODE_RXDROP;
+static bool busy_poll;
+static __u32 batch = 64;
+
+static struct xsk_umem *umems;
+static struct xsk_sock *socks;
+static int nr_socks;
+
+static volatile bool exiting;
+
+static void int_exit(int sig)
+{
+	exiting = true;
+}
+
+/* Ring helpers, as tools/lib/bpf/xsk.h of newer libbpf */
+static __u32 ring_prod_reserve(struct xsk_ring *r, __u32 nb, __u32 *idx)
+{
+	__u32 free = r->size - (r->cached_prod - r->cached_cons);
+
+	if (free < nb) {
+		r->cached_cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE);
+		free = r->size - (r->cached_prod - r->cached_cons);
+		if (free < nb)
+			return 0;
+	}
+	*idx = r->cached_prod;
+	r->cached_prod += nb;
+	return nb;
+}
+
+static void ring_prod_submit(struct xsk_ring *r)
+{
+	__atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+static __u32 ring_cons_peek(struct xsk_ring *r, __u32 nb, __u32 *idx)
+{
+	__u32 avail = r->cached_prod - r->cached_cons;
+
+	if (!avail) {
+		r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+		avail = r->cached_prod - r->cached_cons;
+	}
+	if (avail > nb)
+		avail = nb;
+	*idx = r->cached_cons;
+	r->cached_cons += avail;
+	return avail;
+}
+
+static void ring_cons_release(struct xsk_ring *r)
+{
+	__atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static bool ring_needs_wakeup(struct xsk_ring *r)
+{
+	return *r->flags & XDP_RING_NEED_WAKEUP;
+}
+
+static __u64 *ring_addr(struct xsk_ring *r, __u32 idx)
+{
+	return &((__u64 *)r->ring)[idx & r->mask];
+}
+
+static struct xdp_desc *ring_desc(struct xsk_ring *r, __u32 idx)
+{
+	return &((struct xdp_desc *)r->ring)[idx & r->mask];
+}
+
+static int ring_mmap(struct xsk_ring *r, int fd, struct xdp_ring_offset *off,
+		     __u32 size, size_t desc_size, off_t pgoff)
+{
+	r->map_len = off->desc + size * desc_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		fprintf(stderr, "ERR: mmap ring: %s\n", strerror(errno));
+		return -errno;
+	}
+	r->producer = r->map + off->producer;
+	r->consumer = r->map + off->consumer;
+	r->flags = r->map + off->flags;
+	r->ring = r->map + off->desc;
+	r->size = size;
+	r->mask = size - 1;
+	r->cached_prod = *r->producer;
+	/* Producer rings: all entries are free until the kernel consumes */
+	r->cached_cons = *r->consumer;
+	return 0;
+}
+
+static int xsk_setsockopt_u32(int fd, int level, int opt, __u32 val)
+{
+	if (setsockopt(fd, level, opt, &val, sizeof(val))) {
+		fprintf(stderr, "ERR: setsockopt(%d): %s\n", opt,
+			strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+static int xsk_mmap_offsets(int fd, struct xdp_mmap_offsets *off)
+{
+	socklen_t len = sizeof(*off);
+
+	if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, off, &len)) {
+		fprintf(stderr, "ERR: XDP_MMAP_OFFSETS: %s\n", strerror(errno));
+		return -errno;
+	}
+	/* Before v5.4 the offsets have no ring flags (need_wakeup) */
+	if (len != sizeof(*off)) {
+		fprintf(stderr, "ERR: AF_XDP of this kernel is too old\n");
+		return -EOPNOTSUPP;
+	}
+	return 0;
+}
+
+/* The first socket of a queue registers the UMEM and owns its rings */
+static int umem_create(struct xsk_umem *umem, int fd)
+{
+	struct xdp_umem_reg reg = {};
+	struct xdp_mmap_offsets off;
+	__u32 idx, i;
+
+	umem->area = mmap(NULL, (size_t)UMEM_FRAMES * FRAME_SIZE,
+			  PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (umem->area == MAP_FAILED) {
+		fprintf(stderr, "ERR: UMEM alloc: %s\n", strerror(errno));
+		return -ENOMEM;
+	}
+	reg.addr = (__u64)(unsigned long)umem->area;
+	reg.len = (__u64)UMEM_FRAMES * FRAME_SIZE;
+	reg.chunk_size = FRAME_SIZE;
+	if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))) {
+		fprintf(stderr, "ERR: XDP_UMEM_REG: %s\n", strerror(errno));
+		return -errno;
+	}
+	if (xsk_setsockopt_u32(fd, SOL_XDP, XDP_UMEM_FILL_RING, UMEM_FRAMES) ||
+	    xsk_setsockopt_u32(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+			       UMEM_FRAMES))
+		return -EINVAL;
+	if (xsk_mmap_offsets(fd, &off))
+		return -EINVAL;
+	if (ring_mmap(&umem->fill, fd, &off.fr, UMEM_FRAMES, sizeof(__u64),
+		      XDP_UMEM_PGOFF_FILL_RING) ||
+	    ring_mmap(&umem->comp, fd, &off.cr, UMEM_FRAMES, sizeof(__u64),
+		      XDP_UMEM_PGOFF_COMPLETION_RING))
+		return -ENOMEM;
+
+	/* All frames to the fill ring, they circulate from there */
+	ring_prod_reserve(&umem->fill, UMEM_FRAMES, &idx);
+	for (i = 0; i < UMEM_FRAMES; i++)
+		*ring_addr(&umem->fill, idx + i) = (__u64)i * FRAME_SIZE;
+	ring_prod_submit(&umem->fill);
+
+	pthread_spin_init(&umem->lock, PTHREAD_PROCESS_PRIVATE);
+	return 0;
+}
+
+static int xsk_bind(struct xsk_sock *xsk, __u16 flags, int shared_fd)
+{
+	struct sockaddr_xdp sxdp = {};
+
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_flags = flags;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = xsk->queue;
+	sxdp.sxdp_shared_umem_fd = shared_fd;
+	if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)))
+		return -errno;
+	return 0;
+}
+
+/* @bind_flags XDP_ZEROCOPY, XDP_COPY, or zero for zero-copy with
+ * fallback to copy mode.  Returns the bind flags used.
+ */
+static int xsk_create(struct xsk_sock *xsk, bool first, int shared_fd,
+		      __u16 bind_flags)
+{
+	struct xdp_mmap_offsets off;
+	__u16 flags;
+	int err;
+
+	xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xsk->fd < 0) {
+		fprintf(stderr, "ERR: AF_XDP socket: %s\n", strerror(errno));
+		return -errno;
+	}
+	if (first && umem_create(xsk->umem, xsk->fd))
+		return -EINVAL;
+
+	if (xsk_setsockopt_u32(xsk->fd, SOL_XDP, XDP_RX_RING, RING_SIZE) ||
+	    xsk_setsockopt_u32(xsk->fd, SOL_XDP, XDP_TX_RING, RING_SIZE))
+		return -EINVAL;
+	if (xsk_mmap_offsets(xsk->fd, &off))
+		return -EINVAL;
+	if (ring_mmap(&xsk->rx, xsk->fd, &off.rx, RING_SIZE,
+		      sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+	    ring_mmap(&xsk->tx, xsk->fd, &off.tx, RING_SIZE,
+		      sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+		return -ENOMEM;
+
+	if (busy_poll &&
+	    (xsk_setsockopt_u32(xsk->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1) ||
+	     xsk_setsockopt_u32(xsk->fd, SOL_SOCKET, SO_BUSY_POLL, 20) ||
+	     xsk_setsockopt_u32(xsk->fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+				batch))) {
+		fprintf(stderr, "ERR: --busy-poll needs kernel v5.11+\n");
+		return -EOPNOTSUPP;
+	}
+
+	/* Mode flags are taken from the UMEM owner */
+	if (!first) {
+		err = xsk_bind(xsk, XDP_SHARED_UMEM, shared_fd);
+		if (err)
+			fprintf(stderr, "ERR: bind shared UMEM queue:%u: %s\n",
+				xsk->queue, strerror(-err));
+		return err;
+	}
+
+	flags = bind_flags ? bind_flags : XDP_ZEROCOPY;
+	err = xsk_bind(xsk, flags | XDP_USE_NEED_WAKEUP, 0);
+	if (err && !bind_flags) {
+		flags = XDP_COPY;
+		err = xsk_bind(xsk, flags | XDP_USE_NEED_WAKEUP, 0);
+	}
+	if (err) {
+		fprintf(stderr, "ERR: bind AF_XDP queue:%u %s: %s\n",
+			xsk->queue, flags & XDP_ZEROCOPY ? "zero-copy" : "copy",
+			strerror(-err));
+		return err;
+	}
+	return flags;
+}
+
+static void kick_rx(struct xsk_sock *xsk)
+{
+	recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+}
+
+static void kick_tx(struct xsk_sock *xsk)
+{
+	/* EAGAIN, EBUSY and ENOBUFS only mean the driver is busy */
+	sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+/* Refill, with frames from the rx ring or the completion ring */
+static void fill_frames(struct xsk_umem *umem, __u64 *addrs, __u32 nb)
+{
+	__u32 idx, i;
+
+	pthread_spin_lock(&umem->lock);
+	/* Cannot fail, the fill ring holds all frames */
+	ring_prod_reserve(&umem->fill, nb, &idx);
+	for (i = 0; i < nb; i++)
+		*ring_addr(&umem->fill, idx + i) = addrs[i];
+	ring_prod_submit(&umem->fill);
+	pthread_spin_unlock(&umem->lock);
+}
+
+static void complete_tx(struct xsk_umem *umem)
+{
+	__u64 addrs[UMEM_FRAMES / 16];
+	__u32 idx, nb, i;
+
+	pthread_spin_lock(&umem->lock);
+	nb = ring_cons_peek(&umem->comp, UMEM_FRAMES / 16, &idx);
+	for (i = 0; i < nb; i++)
+		addrs[i] = *ring_addr(&umem->comp, idx + i);
+	if (nb)
+		ring_cons_release(&umem->comp);
+	pthread_spin_unlock(&umem->lock);
+
+	if (nb)
+		fill_frames(umem, addrs, nb);
+}
+
+static void swap_mac(void *data)
+{
+	struct ether_header *eth = data;
+	__u8 tmp[ETH_ALEN];
+
+	memcpy(tmp, eth->ether_dhost, ETH_ALEN);
+	memcpy(eth->ether_dhost, eth->ether_shost, ETH_ALEN);
+	memcpy(eth->ether_shost, tmp, ETH_ALEN);
+}
+
+static void l2fwd(struct xsk_sock *xsk, struct xdp_desc *descs, __u32 nb)
+{
+	__u32 idx, i;
+
+	for (i = 0; i < nb; i++)
+		swap_mac(xsk->umem->area + descs[i].addr);
+
+	while (!ring_prod_reserve(&xsk->tx, nb, &idx)) {
+		kick_tx(xsk);
+		complete_tx(xsk->umem);
+		if (exiting)
+			return;
+	}
+	for (i = 0; i < nb; i++)
+		*ring_desc(&xsk->tx, idx + i) = descs[i];
+	ring_prod_submit(&xsk->tx);
+	xsk->tx_pkts += nb;
+
+	if (ring_needs_wakeup(&xsk->tx))
+		kick_tx(xsk);
+	complete_tx(xsk->umem);
+}
+
+static void *xsk_thread(void *arg)
+{
+	struct xsk_sock *xsk = arg;
+	struct xdp_desc *descs;
+	__u64 *addrs;
+	__u32 idx, nb, i;
+
+	if (xsk->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(xsk->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			fprintf(stderr, "WARN: cannot pin to CPU:%d\n",
+				xsk->cpu);
+	}
+
+	descs = calloc(batch, sizeof(*descs));
+	addrs = calloc(batch, sizeof(*addrs));
+	if (!descs || !addrs) {
+		fprintf(stderr, "ERR: Mem alloc error\n");
+		exit(EXIT_FAIL_MEM);
+	}
+
+	while (!exiting) {
+		/* Busy-poll runs the NAPI of the queue in this syscall */
+		if (busy_poll || ring_needs_wakeup(&xsk->umem->fill))
+			kick_rx(xsk);
+
+		nb = ring_cons_peek(&xsk->rx, batch, &idx);
+		if (!nb) {
+			if (mode == MODE_L2FWD)
+				complete_tx(xsk->umem);
+			continue;
+		}
+		for (i = 0; i < nb; i++)
+			descs[i] = *ring_desc(&xsk->rx, idx + i);
+		ring_cons_release(&xsk->rx);
+		xsk->rx_pkts += nb;
+
+		if (mode == MODE_L2FWD) {
+			l2fwd(xsk, descs, nb);
+			continue;
+		}
+		for (i = 0; i < nb; i++)
+			addrs[i] = descs[i].addr;
+		fill_frames(xsk->umem, addrs, nb);
+	}
+	free(descs);
+	free(addrs);
+	return NULL;
+}
+
+struct stats {
+	__u64 ts;
+	__u64 xdp[XSK_CNT_MAX];
+	__u64 rx;
+	__u64 tx;
+	__u64 rx_dropped;	/* Kernel xdp_statistics, all sockets */
+	__u64 rx_ring_full;
+	__u64 fill_empty;
+};
+
+static void stats_collect(struct stats *s, __u64 *sock_rx)
+{
+	struct xdp_statistics xs;
+	socklen_t len;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->ts = stats_gettime();
+	stats_percpu_array_sum(bpf_load_map_fd("xsk_cnt"), XSK_CNT_MAX,
+			       s->xdp, sizeof(__u64));
+	for (i = 0; i < nr_socks; i++) {
+		sock_rx[i] = socks[i].rx_pkts;
+		s->rx += sock_rx[i];
+		s->tx += socks[i].tx_pkts;
+
+		len = sizeof(xs);
+		if (getsockopt(socks[i].fd, SOL_XDP, XDP_STATISTICS, &xs, &len))
+			continue;
+		s->rx_dropped += xs.rx_dropped;
+		/* Since v5.9, zero before */
+		if (len == sizeof(xs)) {
+			s->rx_ring_full += xs.rx_ring_full;
+			s->fill_empty += xs.rx_fill_ring_empty_descs;
+		}
+	}
+}
+
+static void stats_print(struct stats *cur, struct stats *prev,
+			__u64 *sock_rx, __u64 *sock_rx_prev, int fanout)
+{
+	__u64 period = cur->ts - prev->ts;
+	int i;
+
+	printf("%-14s %-14s %-14s %-14s\n", "XDP-prog", "rx-pps",
+	       "redirect-pps", "no-sock-pps");
+	printf("%-14s %'-14llu %'-14llu %'-14llu\n", "",
+	       stats_rate(cur->xdp[XSK_CNT_RX] - prev->xdp[XSK_CNT_RX], period),
+	       stats_rate(cur->xdp[XSK_CNT_REDIRECT] -
+			  prev->xdp[XSK_CNT_REDIRECT], period),
+	       stats_rate(cur->xdp[XSK_CNT_NO_SOCK] -
+			  prev->xdp[XSK_CNT_NO_SOCK], period));
+
+	printf("%-14s %-14s %-14s\n", "AF_XDP", "rx-pps", "tx-pps");
+	for (i = 0; i < nr_socks; i++)
+		printf("q:%-3u sock:%-4d %'-14llu\n", socks[i].queue,
+		       i % fanout, stats_rate(sock_rx[i] - sock_rx_prev[i],
+					      period));
+	printf("%-14s %'-14llu %'-14llu\n", "total",
+	       stats_rate(cur->rx - prev->rx, period),
+	       stats_rate(cur->tx - prev->tx, period));
+
+	printf("%-14s %-14s %-14s %-14s\n", "kernel-drop", "no-buf-pps",
+	       "rx-full-pps", "fill-empty-pps");
+	printf("%-14s %'-14llu %'-14llu %'-14llu\n\n", "",
+	       stats_rate(cur->rx_dropped - prev->rx_dropped, period),
+	       stats_rate(cur->rx_ring_full - prev->rx_ring_full, period),
+	       stats_rate(cur->fill_empty - prev->fill_empty, period));
+	fflush(stdout);
+}
+
+static void stats_poll(int interval, int fanout)
+{
+	__u64 *sock_rx, *sock_rx_prev, *tmp;
+	struct stats cur, prev;
+
+	sock_rx = calloc(nr_socks, sizeof(*sock_rx));
+	sock_rx_prev = calloc(nr_socks, sizeof(*sock_rx_prev));
+	if (!sock_rx || !sock_rx_prev) {
+		fprintf(stderr, "ERR: Mem alloc error\n");
+		exit(EXIT_FAIL_MEM);
+	}
+
+	stats_collect(&prev, sock_rx_prev);
+	while (!exiting) {
+		sleep(interval);
+		stats_collect(&cur, sock_rx);
+		stats_print(&cur, &prev, sock_rx, sock_rx_prev, fanout);
+		prev = cur;
+		tmp = sock_rx_prev;
+		sock_rx_prev = sock_rx;
+		sock_rx = tmp;
+	}
+	free(sock_rx);
+	free(sock_rx_prev);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	__u16 bind_flags = 0;
+	char filename[256];
+	int longindex = 0;
+	int interval = 2;
+	int queues = 1;
+	int fanout = 1;
+	int cpu = -1;
+	int opt, i, ret;
+	__u32 val;
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	while ((opt = getopt_long(argc, argv, "hd:Q:f:m:zcSBb:C:s:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'd':
+			if (strlen(optarg) >= IF_NAMESIZE) {
+				fprintf(stderr, "ERR: --dev name too long\n");
+				goto error;
+			}
+			ifname = (char *)&ifname_buf;
+			strncpy(ifname, optarg, IF_NAMESIZE);
+			ifindex = if_nametoindex(ifname);
+			if (ifindex == 0) {
+				fprintf(stderr,
+					"ERR: --dev name unknown err(%d):%s\n",
+					errno, strerror(errno));
+				goto error;
+			}
+			break;
+		case 'Q':
+			queues = atoi(optarg);
+			break;
+		case 'f':
+			fanout = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "rxdrop")) {
+				mode = MODE_RXDROP;
+			} else if (!strcmp(optarg, "l2fwd")) {
+				mode = MODE_L2FWD;
+			} else {
+				fprintf(stderr, "ERR: --mode rxdrop|l2fwd\n");
+				goto error;
+			}
+			break;
+		case 'z':
+			bind_flags = XDP_ZEROCOPY;
+			break;
+		case 'c':
+			bind_flags = XDP_COPY;
+			break;
+		case 'S':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 'B':
+			busy_poll = true;
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'C':
+			/* First CPU, socket threads are pinned from here */
+			cpu = atoi(optarg);
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 'h':
+		error:
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	if (ifindex == -1) {
+		fprintf(stderr, "ERR: required option --dev missing\n");
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+	if (fanout < 1 || fanout > XSK_FANOUT_MAX || queues < 1 ||
+	    queues * fanout > XSK_SOCKS_MAX) {
+		fprintf(stderr, "ERR: --fanout 1-%d, --queues x --fanout max %d\n",
+			XSK_FANOUT_MAX, XSK_SOCKS_MAX);
+		return EXIT_FAIL_OPTION;
+	}
+	if (batch < 1 || batch > RING_SIZE || interval <= 0) {
+		fprintf(stderr, "ERR: --batch 1-%d and --sec > 0\n", RING_SIZE);
+		return EXIT_FAIL_OPTION;
+	}
+	/* Generic XDP only supports copy mode */
+	if ((xdp_flags & XDP_FLAGS_SKB_MODE) && !bind_flags)
+		bind_flags = XDP_COPY;
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	nr_socks = queues * fanout;
+	val = fanout;
+	if (bpf_load_global_set("fanout", &val, sizeof(val)) ||
+	    bpf_load_map_resize("xsks_map", nr_socks)) {
+		fprintf(stderr, "ERR: bpf_load config\n");
+		return EXIT_FAIL_BPF;
+	}
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+
+	umems = calloc(queues, sizeof(*umems));
+	socks = aligned_alloc(64, nr_socks * sizeof(*socks));
+	if (!umems || !socks) {
+		fprintf(stderr, "ERR: Mem alloc error\n");
+		return EXIT_FAIL_MEM;
+	}
+	memset(socks, 0, nr_socks * sizeof(*socks));
+
+	/* Socket i is xsks_map key i, i.e. queue i / fanout */
+	for (i = 0; i < nr_socks; i++) {
+		struct xsk_sock *xsk = &socks[i];
+		bool first = !(i % fanout);
+		int fd;
+
+		xsk->queue = i / fanout;
+		xsk->umem = &umems[xsk->queue];
+		xsk->cpu = cpu >= 0 ? cpu + i : -1;
+		ret = xsk_create(xsk, first, first ? 0 : socks[i - i % fanout].fd,
+				 bind_flags);
+		if (ret < 0)
+			return EXIT_FAIL_XSK;
+		if (first) {
+			printf("Queue:%u %s mode, %d socket(s)\n", xsk->queue,
+			       ret & XDP_ZEROCOPY ? "zero-copy" : "copy", fanout);
+		}
+
+		fd = xsk->fd;
+		if (bpf_map_update_elem(bpf_load_map_fd("xsks_map"), &i, &fd, 0)) {
+			fprintf(stderr, "ERR: xsks_map update: %s\n",
+				strerror(errno));
+			return EXIT_FAIL_BPF;
+		}
+	}
+
+	signal(SIGINT, int_exit);
+	signal(SIGTERM, int_exit);
+
+	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+
+	for (i = 0; i < nr_socks; i++) {
+		ret = pthread_create(&socks[i].thread, NULL, xsk_thread,
+				     &socks[i]);
+		if (ret) {
+			fprintf(stderr, "ERR: pthread_create: %s\n",
+				strerror(ret));
+			exiting = true;
+			nr_socks = i;
+			break;
+		}
+	}
+
+	setlocale(LC_NUMERIC, "en_US");
+	stats_poll(interval, fanout);
+
+	for (i = 0; i < nr_socks; i++)
+		pthread_join(socks[i].thread, NULL);
+	set_link_xdp_fd(ifindex, -1, xdp_flags);
+	for (i = 0; i < nr_socks; i++)
+		close(socks[i].fd);
+	return EXIT_OK;
+}
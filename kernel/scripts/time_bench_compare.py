@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+#
+# Compare two sets of time_bench results, and detect regressions
+#
+# Input is the export of /sys/kernel/debug/time_bench/results (see
+# lib/time_bench.c), saved after running the bench modules on the
+# baseline and the new kernel.  Each side can be one file, or a
+# directory of files (e.g. one per modprobe run), which all get merged.
+#
+# Records are matched on (name, cpu, step).  Repeated records of a
+# bench (time_bench "repeat" parameter, or several runs) are the
+# samples, which get compared via Welch's t-test.  A bench counts as
+# regressed when the change is both significant (p < alpha) and worse
+# than the threshold.  With a single sample on either side there are
+# no stats, and only the threshold is applied.
+#
+# Usage ala:
+#  cat /sys/kernel/debug/time_bench/results > base.txt   # old kernel
+#  cat /sys/kernel/debug/time_bench/results > new.txt    # new kernel
+#  scripts/time_bench_compare.py base.txt new.txt
+#
+# Exit status: 0 no regressions, 1 regressions found, 2 usage/input error
+#
+import argparse
+import math
+import os
+import sys
+
+# Metric name -> (column, higher_is_better)
+METRICS = {
+    'ns':     ('ns', False),
+    'cycles': ('cycles', False),
+    'core':   ('core_cycles', False),
+    'ops':    ('ops_per_sec', True),
+}
+
+# Record columns of results export "# version:2", newer versions
+# describe their columns in the header (version:3 added core_cycles
+# and freq_mhz)
+COLUMNS = ['name', 'cpu', 'step', 'loops', 'invoked', 'cycles', 'ns',
+           'time_interval', 'ipc', 'p50', 'p99', 'p99.9', 'max', 'flags',
+           'ops_per_sec', 'bytes_per_sec']
+
+
+def parse_file(path, samples, clocks):
+    columns = COLUMNS
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if line.startswith('# clock:'):
+                clocks.add(line.split()[1])
+                continue
+            if line.startswith('# version:'):
+                columns = line.split()[2:]
+                continue
+            if line.startswith('#'):
+                continue
+            fields = line.split()
+            if len(fields) != len(columns):
+                raise ValueError('%s:%d: expected %d columns, got %d'
+                                 % (path, lineno, len(columns), len(fields)))
+            rec = dict(zip(columns, fields))
+            key = (rec['name'], int(rec['cpu']), int(rec['step']))
+            samples.setdefault(key, []).append(rec)
+
+
+def load(path):
+    samples, clocks = {}, set()
+    if os.path.isdir(path):
+        files = sorted(os.path.join(path, f) for f in os.listdir(path))
+        files = [f for f in files if os.path.isfile(f)]
+    else:
+        files = [path]
+    for f in files:
+        parse_file(f, samples, clocks)
+    return samples, clocks
+
+
+def mean_stddev(vals):
+    n = len(vals)
+    mean = sum(vals) / n
+    if n < 2:
+        return mean, 0.0
+    var = sum((v - mean) ** 2 for v in vals) / (n - 1)
+    return mean, math.sqrt(var)
+
+
+def betacf(a, b, x):
+    """Continued fraction for the incomplete beta function"""
+    tiny = 1e-300
+    qab, qap, qam = a + b, a + 1.0, a - 1.0
+    c, d = 1.0, 1.0 - qab * x / qap
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    h = d
+    for m in range(1, 200):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((qam + m2) * (a + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + aa / c
+        c = c if abs(c) > tiny else tiny
+        h *= d * c
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + aa / c
+        c = c if abs(c) > tiny else tiny
+        de = d * c
+        h *= de
+        if abs(de - 1.0) < 3e-12:
+            break
+    return h
+
+
+def betai(a, b, x):
+    """Regularized incomplete beta function I_x(a, b)"""
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    bt = math.exp(math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b) +
+                  a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1.0) / (a + b + 2.0):
+        return bt * betacf(a, b, x) / a
+    return 1.0 - bt * betacf(b, a, 1.0 - x) / b
+
+
+def welch_p(a, b):
+    """Two-sided p-value of Welch's t-test, None if not computable"""
+    n1, n2 = len(a), len(b)
+    if n1 < 2 or n2 < 2:
+        return None
+    m1, s1 = mean_stddev(a)
+    m2, s2 = mean_stddev(b)
+    v1, v2 = s1 * s1 / n1, s2 * s2 / n2
+    if v1 + v2 == 0.0:
+        return 0.0 if m1 != m2 else 1.0
+    t = (m1 - m2) / math.sqrt(v1 + v2)
+    df = (v1 + v2) ** 2 / ((v1 * v1) / (n1 - 1) + (v2 * v2) / (n2 - 1))
+    return betai(df / 2.0, 0.5, df / (df + t * t))
+
+
+def key_str(key):
+    name, cpu, step = key
+    return '%s cpu:%s step:%d' % (name, 'sum' if cpu < 0 else cpu, step)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Compare time_bench results of a baseline and a new run')
+    parser.add_argument('baseline', help='results file or directory')
+    parser.add_argument('new', help='results file or directory')
+    parser.add_argument('-m', '--metric', choices=sorted(METRICS),
+                        default='ns', help='metric to compare (default: ns)')
+    parser.add_argument('-t', '--threshold', type=float, default=5.0,
+                        help='percent change counted as regression (default: 5)')
+    parser.add_argument('-a', '--alpha', type=float, default=0.05,
+                        help='significance level (default: 0.05)')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='also list unchanged and unmatched benches')
+    args = parser.parse_args()
+
+    try:
+        base, base_clocks = load(args.baseline)
+        new, new_clocks = load(args.new)
+    except (OSError, ValueError) as e:
+        print('ERR: %s' % e, file=sys.stderr)
+        return 2
+    if not base or not new:
+        print('ERR: no records in baseline or new results', file=sys.stderr)
+        return 2
+
+    column, higher_better = METRICS[args.metric]
+    if args.metric == 'cycles' and base_clocks != new_clocks:
+        print('WARN: clock differs (%s vs %s), cycles not comparable'
+              % (','.join(sorted(base_clocks)), ','.join(sorted(new_clocks))),
+              file=sys.stderr)
+
+    regressions = improvements = 0
+    print('# %-44s %7s %12s %12s %8s %8s  %s'
+          % ('bench', 'n', 'base', 'new', 'change', 'p', 'verdict'))
+    for key in sorted(set(base) & set(new)):
+        a = [float(r.get(column, 0)) for r in base[key]]
+        b = [float(r.get(column, 0)) for r in new[key]]
+        # Summary records (cpu=-1) have no per call ns, and older
+        # exports have no core_cycles
+        if not any(a) or not any(b):
+            continue
+        ma, _ = mean_stddev(a)
+        mb, _ = mean_stddev(b)
+        change = (mb - ma) * 100.0 / ma if ma else 0.0
+        worse = -change if higher_better else change
+        p = welch_p(a, b)
+        significant = p is None or p < args.alpha
+
+        verdict = ''
+        if significant and worse > args.threshold:
+            verdict = 'REGRESSION'
+            regressions += 1
+        elif significant and -worse > args.threshold:
+            verdict = 'improvement'
+            improvements += 1
+        elif not args.verbose:
+            continue
+        if p is None and verdict:
+            verdict += ' (no stats)'
+        print('%-46s %3d/%-3d %12.3f %12.3f %+7.2f%% %8s  %s'
+              % (key_str(key), len(a), len(b), ma, mb, change,
+                 '-' if p is None else '%.4f' % p, verdict))
+
+    if args.verbose:
+        for key in sorted(set(base) ^ set(new)):
+            print('%-46s only in %s' % (key_str(key),
+                                        'baseline' if key in base else 'new'))
+
+    print('# metric:%s threshold:%.1f%% alpha:%g regressions:%d improvements:%d'
+          % (args.metric, args.threshold, args.alpha, regressions, improvements))
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
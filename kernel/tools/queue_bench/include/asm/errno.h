@@ -0,0 +1,4 @@
+/* Userspace stub, see kcompat.h.  Also included by the libc <errno.h>,
+ * thus forward to the system header.
+ */
+#include_next <asm/errno.h>
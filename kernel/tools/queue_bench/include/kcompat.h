@@ -0,0 +1,604 @@
+/*
+ * Userspace shim of the kernel APIs used by the queue headers
+ * (alf_queue.h, ring_queue.h, ptr_ring.h, wfc_queue.h), their lib/
+ * implementations, and the time_bench API.
+ *
+ * All the include/linux/ and include/asm/ stubs in this directory
+ * only include this file, thus the kernel headers and bench modules
+ * compile unmodified.  Only the subset actually used is provided, with
+ * userspace semantics:
+ *  - "CPU" is the thread pinned to it, see time_bench_user.c
+ *  - preempt/irq/bh disable are no-ops (threads can be preempted)
+ *  - barriers and atomics map to GCC __atomic builtins
+ *  - spinlock_t is a pthread spinlock
+ * Features needing a real kernel (RCU resize, debugfs stats) abort at
+ * runtime via kcompat_unsupported().
+ */
+#ifndef _KCOMPAT_H
+#define _KCOMPAT_H
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#define CONFIG_X86
+#define CONFIG_X86_64
+#elif defined(__aarch64__)
+#define CONFIG_ARM64
+#endif
+#define CONFIG_SMP
+
+/** Types **/
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef long long s64;
+typedef unsigned int gfp_t;
+typedef int64_t  time64_t;
+typedef uint64_t cycles_t;
+
+struct timespec64 {
+	time64_t tv_sec;
+	long     tv_nsec;
+};
+
+/** Compiler **/
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define barrier()		asm volatile("" ::: "memory")
+#ifndef __always_inline
+#define __always_inline		inline __attribute__((always_inline))
+#endif
+#define noinline		__attribute__((noinline))
+#define __must_check		__attribute__((warn_unused_result))
+#define __maybe_unused		__attribute__((unused))
+#define __read_mostly
+#define __percpu
+#define __user
+#define __rcu
+#define __init
+#define __exit
+#define __force
+#define fallthrough		__attribute__((fallthrough))
+
+#define READ_ONCE(x)		(*(const volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val)	(*(volatile typeof(x) *)&(x) = (val))
+
+#define SMP_CACHE_BYTES		64
+#define L1_CACHE_BYTES		SMP_CACHE_BYTES
+#define ____cacheline_aligned	__attribute__((aligned(SMP_CACHE_BYTES)))
+#define ____cacheline_aligned_in_smp ____cacheline_aligned
+#define __cacheline_aligned_in_smp   ____cacheline_aligned
+
+/** Barriers and atomics **/
+#if defined(CONFIG_X86)
+/* x86 is TSO, only store->load needs a fence */
+#define smp_mb()	asm volatile("lock; addl $0,-4(%%rsp)" ::: "memory", "cc")
+#define smp_rmb()	barrier()
+#define smp_wmb()	barrier()
+#define cpu_relax()	asm volatile("pause" ::: "memory")
+#else
+#define smp_mb()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#if defined(CONFIG_ARM64)
+#define cpu_relax()	asm volatile("yield" ::: "memory")
+#else
+#define cpu_relax()	barrier()
+#endif
+#endif
+#define mb()			smp_mb()
+#define rmb()			smp_rmb()
+#define wmb()			smp_wmb()
+#define smp_read_barrier_depends()	do { } while (0)
+#define smp_mb__before_atomic()	barrier()
+#define smp_mb__after_atomic()	barrier()
+#define smp_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+#define cmpxchg(ptr, old, new)	\
+	({ __sync_val_compare_and_swap(ptr, old, new); })
+#define xchg(ptr, v)		\
+	({ __atomic_exchange_n(ptr, v, __ATOMIC_SEQ_CST); })
+
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_read(v)		READ_ONCE((v)->counter)
+#define atomic_set(v, i)	WRITE_ONCE((v)->counter, (i))
+#define atomic_add_return(i, v)	__atomic_add_fetch(&(v)->counter, i, __ATOMIC_SEQ_CST)
+#define atomic_sub_return(i, v)	__atomic_sub_fetch(&(v)->counter, i, __ATOMIC_SEQ_CST)
+#define atomic_inc_return(v)	atomic_add_return(1, v)
+#define atomic_dec_return(v)	atomic_sub_return(1, v)
+#define atomic_inc(v)		((void)atomic_add_return(1, v))
+#define atomic_dec(v)		((void)atomic_sub_return(1, v))
+#define atomic_add(i, v)	((void)atomic_add_return(i, v))
+#define atomic_dec_and_test(v)	(atomic_dec_return(v) == 0)
+#define atomic_cmpxchg(v, o, n)	cmpxchg(&(v)->counter, o, n)
+
+/** Preemption, IRQ and softirq, no-ops in userspace **/
+#define preempt_disable()		barrier()
+#define preempt_enable()		barrier()
+#define preempt_enable_no_resched()	barrier()
+#define preempt_count()			0
+#define local_bh_disable()		barrier()
+#define local_bh_enable()		barrier()
+#define local_irq_disable()		barrier()
+#define local_irq_enable()		barrier()
+#define local_irq_save(f)		do { (f) = 0; barrier(); } while (0)
+#define local_irq_restore(f)		do { (void)(f); barrier(); } while (0)
+#define raw_local_irq_save(f)		local_irq_save(f)
+#define raw_local_irq_restore(f)	local_irq_restore(f)
+#define in_softirq()			0
+#define in_serving_softirq()		0
+#define in_interrupt()			0
+#define in_irq()			0
+#define might_sleep()			do { } while (0)
+#define cond_resched()			do { } while (0)
+
+/** CPUs, a "CPU" is a pinned thread **/
+#define NR_CPUS		1024
+extern unsigned int nr_cpu_ids;
+#define num_possible_cpus()	nr_cpu_ids
+#define num_online_cpus()	nr_cpu_ids
+#define num_online_nodes()	1
+#define raw_smp_processor_id()	sched_getcpu()
+#define smp_processor_id()	sched_getcpu()
+#define get_cpu()		sched_getcpu()
+#define put_cpu()		do { } while (0)
+#define yield()			sched_yield()
+
+/** Per CPU, arrays indexed by CPU id **/
+#define alloc_percpu(type)	((type *)calloc(nr_cpu_ids, sizeof(type)))
+#define free_percpu(p)		free(p)
+#define per_cpu_ptr(p, cpu)	(&(p)[cpu])
+#define this_cpu_ptr(p)		(&(p)[sched_getcpu()])
+#define get_cpu_ptr(p)		this_cpu_ptr(p)
+#define put_cpu_ptr(p)		do { (void)(p); } while (0)
+#define this_cpu_inc(x)		__atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+#define for_each_possible_cpu(cpu) \
+	for ((cpu) = 0; (cpu) < (int)nr_cpu_ids; (cpu)++)
+#define for_each_online_cpu(cpu)	for_each_possible_cpu(cpu)
+
+/** Misc kernel.h **/
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define clamp(v, lo, hi)	min(max(v, lo), hi)
+#define min_t(t, a, b)		min((t)(a), (t)(b))
+#define max_t(t, a, b)		max((t)(a), (t)(b))
+#define swap(a, b) \
+	do { typeof(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define U64_MAX			UINT64_MAX
+#define U32_MAX			UINT32_MAX
+#define U16_MAX			UINT16_MAX
+#define BITS_PER_LONG		(sizeof(long) * 8)
+#define NSEC_PER_SEC		1000000000ULL
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+static inline u64 div64_u64_rem(u64 dividend, u64 divisor, u64 *rem)
+{
+	*rem = dividend % divisor;
+	return dividend / divisor;
+}
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *rem)
+{
+	*rem = dividend % divisor;
+	return dividend / divisor;
+}
+
+/** Bug and warn **/
+void kcompat_unsupported(const char *what) __attribute__((noreturn));
+#define BUG()	do {							\
+		fprintf(stderr, "BUG at %s:%d\n", __FILE__, __LINE__);	\
+		abort();						\
+	} while (0)
+#define BUG_ON(c)		do { if (unlikely(c)) BUG(); } while (0)
+#define WARN_ON(c)	({ int __c = !!(c);				\
+		if (unlikely(__c))					\
+			fprintf(stderr, "WARN at %s:%d\n",		\
+				__FILE__, __LINE__);			\
+		unlikely(__c); })
+#define WARN_ON_ONCE(c)		WARN_ON(c)
+#define BUILD_BUG_ON(c)		_Static_assert(!(c), #c)
+#define BUILD_BUG_ON_NOT_POWER_OF_2(n) BUILD_BUG_ON((n) == 0 || ((n) & ((n) - 1)))
+#define BUILD_BUG()		BUG()
+
+/** Error pointers **/
+#define MAX_ERRNO	4095
+#define ERESTARTSYS	512
+static inline void *ERR_PTR(long error) { return (void *)error; }
+static inline long PTR_ERR(const void *ptr) { return (long)ptr; }
+static inline bool IS_ERR(const void *ptr)
+{
+	return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+static inline bool IS_ERR_OR_NULL(const void *ptr)
+{
+	return !ptr || IS_ERR(ptr);
+}
+static inline void *ERR_CAST(const void *ptr) { return (void *)ptr; }
+
+/** log2 and bitops **/
+static inline int fls(unsigned int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+#define ilog2(n)		(fls64(n) - 1)
+#define is_power_of_2(n)	((n) != 0 && (((n) & ((n) - 1)) == 0))
+#define roundup_pow_of_two(n)	(1UL << fls64((u64)(n) - 1))
+#define BIT(nr)			(1UL << (nr))
+#define BITS_TO_LONGS(n)	DIV_ROUND_UP(n, BITS_PER_LONG)
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+/* Atomic variants, as in the kernel */
+static inline void set_bit(long nr, volatile unsigned long *addr)
+{
+	__atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr), __ATOMIC_RELAXED);
+}
+static inline void clear_bit(long nr, volatile unsigned long *addr)
+{
+	__atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr), __ATOMIC_RELAXED);
+}
+static inline bool test_and_set_bit(long nr, volatile unsigned long *addr)
+{
+	return __atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr),
+				 __ATOMIC_SEQ_CST) & BIT_MASK(nr);
+}
+static inline bool test_and_clear_bit(long nr, volatile unsigned long *addr)
+{
+	return __atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr),
+				  __ATOMIC_SEQ_CST) & BIT_MASK(nr);
+}
+static inline bool test_bit(long nr, const volatile unsigned long *addr)
+{
+	return addr[BIT_WORD(nr)] & BIT_MASK(nr);
+}
+static inline unsigned long find_next_bit(const unsigned long *addr,
+					  unsigned long size,
+					  unsigned long offset)
+{
+	for (; offset < size; offset++)
+		if (test_bit(offset, addr))
+			return offset;
+	return size;
+}
+#define find_first_bit(addr, size)	find_next_bit(addr, size, 0)
+
+/** Memory allocation **/
+#define GFP_KERNEL	0x1u
+#define GFP_ATOMIC	0x2u
+#define __GFP_ZERO	0x100u
+#define __GFP_NOWARN	0x200u
+#define KMALLOC_MAX_SIZE	(1UL << 22)
+
+static inline void *kmalloc(size_t size, gfp_t gfp)
+{
+	return (gfp & __GFP_ZERO) ? calloc(1, size) : malloc(size);
+}
+static inline void *kzalloc(size_t size, gfp_t gfp)
+{
+	return calloc(1, size);
+}
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t gfp)
+{
+	if (size && n > SIZE_MAX / size)
+		return NULL;
+	return kmalloc(n * size, gfp);
+}
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp)
+{
+	return kmalloc_array(n, size, gfp | __GFP_ZERO);
+}
+/* Cache line aligned, like slab for these sizes */
+static inline void *kvmalloc_aligned(size_t size, gfp_t gfp)
+{
+	void *p;
+
+	if (posix_memalign(&p, SMP_CACHE_BYTES, size))
+		return NULL;
+	if (gfp & __GFP_ZERO)
+		memset(p, 0, size);
+	return p;
+}
+#define kvmalloc(size, gfp)		kvmalloc_aligned(size, gfp)
+#define kvzalloc(size, gfp)		kvmalloc_aligned(size, (gfp) | __GFP_ZERO)
+#define kvmalloc_array(n, size, gfp)	kvmalloc_aligned((n) * (size), gfp)
+#define kvcalloc(n, size, gfp)		kvmalloc_aligned((n) * (size), (gfp) | __GFP_ZERO)
+#define vmalloc(size)			kvmalloc_aligned(size, 0)
+#define vzalloc(size)			kvmalloc_aligned(size, __GFP_ZERO)
+#define kfree(p)			free((void *)(p))
+#define kvfree(p)			free((void *)(p))
+#define vfree(p)			free((void *)(p))
+#define kstrdup(s, gfp)			strdup(s)
+#define alloc_pages_exact(size, gfp)	kvmalloc_aligned(size, gfp)
+#define free_pages_exact(p, size)	do { (void)(size); free(p); } while (0)
+
+/** Spinlock and mutex **/
+typedef pthread_spinlock_t spinlock_t;
+#define spin_lock_init(l)	pthread_spin_init(l, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock(l)		pthread_spin_lock(l)
+#define spin_unlock(l)		pthread_spin_unlock(l)
+#define spin_lock_bh(l)		spin_lock(l)
+#define spin_unlock_bh(l)	spin_unlock(l)
+#define spin_lock_irq(l)	spin_lock(l)
+#define spin_unlock_irq(l)	spin_unlock(l)
+#define spin_lock_irqsave(l, f)	do { (f) = 0; spin_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, f) do { (void)(f); spin_unlock(l); } while (0)
+
+struct mutex {
+	pthread_mutex_t lock;
+};
+#define __MUTEX_INITIALIZER(m)	{ PTHREAD_MUTEX_INITIALIZER }
+#define DEFINE_MUTEX(m)		struct mutex m = __MUTEX_INITIALIZER(m)
+#define mutex_init(m)		pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_lock(m)		pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m)		pthread_mutex_unlock(&(m)->lock)
+
+/** RCU, only the read side, as resize needs a grace period **/
+#define rcu_read_lock()			barrier()
+#define rcu_read_unlock()		barrier()
+#define rcu_dereference(p)		READ_ONCE(p)
+#define rcu_dereference_protected(p, c)	(p)
+#define rcu_access_pointer(p)		READ_ONCE(p)
+#define rcu_assign_pointer(p, v)	smp_store_release(&(p), v)
+#define RCU_INIT_POINTER(p, v)		WRITE_ONCE(p, v)
+#define synchronize_rcu()		kcompat_unsupported("synchronize_rcu")
+#define lockdep_is_held(l)		1
+
+/** Time **/
+#define HZ 1000
+static inline u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+static inline void ktime_get_real_ts64(struct timespec64 *ts64)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts64->tv_sec  = ts.tv_sec;
+	ts64->tv_nsec = ts.tv_nsec;
+}
+#define jiffies			(ktime_get_ns() / (NSEC_PER_SEC / HZ))
+#define msecs_to_jiffies(ms)	((unsigned long)(ms))
+#define jiffies_to_msecs(j)	((unsigned int)(j))
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+
+static inline cycles_t get_cycles(void)
+{
+#if defined(CONFIG_X86_64)
+	unsigned int lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((u64)hi << 32) | lo;
+#elif defined(CONFIG_ARM64)
+	u64 val;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r" (val));
+	return val;
+#else
+	return ktime_get_ns();
+#endif
+}
+#define rdmsrl_safe(msr, p)	(*(p) = 0, -EIO)
+
+/** CPU features, for the SIMD helpers in alf_queue_helpers.h **/
+#define X86_FEATURE_AVX2	"avx2"
+#define X86_FEATURE_AVX		"avx"
+#define X86_FEATURE_ERMS	"erms"
+#define boot_cpu_has(f)		__builtin_cpu_supports(f)
+#define irq_fpu_usable()	1
+#define kernel_fpu_begin()	barrier()
+#define kernel_fpu_end()	barrier()
+
+/** Wait queues, by polling, as only used for empty->non-empty wakeups **/
+typedef struct { int dummy; } wait_queue_head_t;
+#define init_waitqueue_head(wq)	do { (void)(wq); } while (0)
+#define wake_up(wq)		do { (void)(wq); } while (0)
+#define wait_event_interruptible_timeout(wq, cond, timeout)	\
+({									\
+	unsigned long __end = jiffies + (timeout);			\
+	long __ret = 0;							\
+	while (!(__ret = (cond) ? 1 : 0) && time_before_eq(jiffies, __end)) \
+		sched_yield();						\
+	if (__ret)							\
+		__ret = max_t(long, (long)(__end - jiffies), 1);	\
+	__ret;								\
+})
+#define time_before_eq(a, b)	((long)((a) - (b)) <= 0)
+
+/** Prefetch **/
+#define prefetch(x)		__builtin_prefetch(x)
+#define prefetchw(x)		__builtin_prefetch(x, 1)
+
+/** Printing **/
+#ifndef KBUILD_MODNAME
+#define KBUILD_MODNAME		"queue_bench"
+#endif
+#ifndef pr_fmt
+#define pr_fmt(fmt)		fmt
+#endif
+#define KERN_INFO		""
+#define printk(fmt, ...)	printf(fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)	printf(pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_warn(fmt, ...)	fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_err(fmt, ...)	fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_debug(fmt, ...)	do { } while (0)
+
+/** Modules, module_param and module_init, see kcompat.c **/
+struct module;
+#define THIS_MODULE		((struct module *)NULL)
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+#define MODULE_DESCRIPTION(s)
+#define MODULE_AUTHOR(s)
+#define MODULE_LICENSE(s)
+#define MODULE_PARM_DESC(name, desc)
+
+enum kcompat_param_type {
+	KCOMPAT_PARAM_INT,
+	KCOMPAT_PARAM_UINT,
+	KCOMPAT_PARAM_ULONG,
+	KCOMPAT_PARAM_BOOL,
+	KCOMPAT_PARAM_CHARP,
+};
+#define kcompat_param_type_int		KCOMPAT_PARAM_INT
+#define kcompat_param_type_uint		KCOMPAT_PARAM_UINT
+#define kcompat_param_type_ulong	KCOMPAT_PARAM_ULONG
+#define kcompat_param_type_bool		KCOMPAT_PARAM_BOOL
+#define kcompat_param_type_charp	KCOMPAT_PARAM_CHARP
+
+void kcompat_param_register(const char *name, void *var,
+			    enum kcompat_param_type type);
+#define module_param_named(name, var, type, perm)			\
+	static void __attribute__((constructor))			\
+	__kcompat_param_##name(void)					\
+	{								\
+		kcompat_param_register(#name, &(var),			\
+				       kcompat_param_type_##type);	\
+	}
+#define module_param(name, type, perm) module_param_named(name, name, type, perm)
+
+/* Called in link order, thus put the lib (dependency) objects first,
+ * like modprobe loading dependencies before the bench module.
+ */
+void kcompat_module_register(int (*init)(void), void (*exit)(void));
+#define module_init(fn)							\
+	static void __attribute__((constructor)) __kcompat_init(void)	\
+	{								\
+		kcompat_module_register(fn, NULL);			\
+	}
+#define module_exit(fn)							\
+	static void __attribute__((constructor)) __kcompat_exit(void)	\
+	{								\
+		kcompat_module_register(NULL, fn);			\
+	}
+
+/** String **/
+static inline char *strim(char *s)
+{
+	char *end;
+
+	while (*s == ' ' || *s == '\t' || *s == '\n')
+		s++;
+	end = s + strlen(s);
+	while (end > s && (end[-1] == ' ' || end[-1] == '\t' ||
+			   end[-1] == '\n'))
+		*--end = '\0';
+	return s;
+}
+#define strscpy(dst, src, len)	\
+	((void)snprintf(dst, len, "%s", src), (ssize_t)strlen(dst))
+
+/** Lists **/
+struct list_head {
+	struct list_head *next, *prev;
+};
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+static inline void INIT_LIST_HEAD(struct list_head *l)
+{
+	l->next = l;
+	l->prev = l;
+}
+static inline void list_add_tail(struct list_head *n, struct list_head *h)
+{
+	n->prev = h->prev;
+	n->next = h;
+	h->prev->next = n;
+	h->prev = n;
+}
+static inline void list_del_init(struct list_head *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	INIT_LIST_HEAD(e);
+}
+#define list_del(e)		list_del_init(e)
+#define list_empty(h)		((h)->next == (h))
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+/** Completion, kthreads replaced by pthreads in time_bench_user.c **/
+struct completion {
+	unsigned int done;
+};
+struct task_struct;
+
+/** CPU masks **/
+struct cpumask {
+	unsigned long bits[NR_CPUS / (sizeof(long) * 8)];
+};
+typedef struct cpumask cpumask_t;
+#define CPU_BITS_PER_LONG	(sizeof(long) * 8)
+#define cpumask_bits(m)		((m)->bits)
+
+static inline void cpumask_clear(struct cpumask *m)
+{
+	memset(m, 0, sizeof(*m));
+}
+static inline void cpumask_set_cpu(unsigned int cpu, struct cpumask *m)
+{
+	m->bits[cpu / CPU_BITS_PER_LONG] |= 1UL << (cpu % CPU_BITS_PER_LONG);
+}
+static inline bool cpumask_test_cpu(int cpu, const struct cpumask *m)
+{
+	return m->bits[cpu / CPU_BITS_PER_LONG] &
+		(1UL << (cpu % CPU_BITS_PER_LONG));
+}
+static inline int cpumask_next(int n, const struct cpumask *m)
+{
+	for (n++; n < (int)nr_cpu_ids; n++)
+		if (cpumask_test_cpu(n, m))
+			return n;
+	return nr_cpu_ids;
+}
+#define cpumask_first(m)	cpumask_next(-1, m)
+static inline unsigned int cpumask_weight(const struct cpumask *m)
+{
+	unsigned int cpu, w = 0;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+		w += cpumask_test_cpu(cpu, m);
+	return w;
+}
+#define for_each_cpu(cpu, mask)					\
+	for ((cpu) = cpumask_first(mask); (cpu) < (int)nr_cpu_ids;	\
+	     (cpu) = cpumask_next(cpu, mask))
+#define cpumask_pr_args(m)	nr_cpu_ids, cpumask_bits(m)
+
+#endif /* _KCOMPAT_H */
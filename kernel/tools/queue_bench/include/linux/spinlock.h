@@ -0,0 +1,2 @@
+/* Userspace stub, see kcompat.h */
+#include <kcompat.h>
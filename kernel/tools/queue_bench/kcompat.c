@@ -0,0 +1,138 @@
+/*
+ * Userspace "module loader" for bench modules, see include/kcompat.h
+ *
+ * The module_param() and module_init() of the linked in modules
+ * register themselves via constructors, main() parses the command
+ * line like modprobe does ("name=value" pairs), calls all module_init
+ * funcs in link order, and the module_exit funcs in reverse.
+ */
+#include <kcompat.h>
+
+unsigned int nr_cpu_ids;
+
+#define KCOMPAT_MODULES_MAX 8
+static int (*module_inits[KCOMPAT_MODULES_MAX])(void);
+static void (*module_exits[KCOMPAT_MODULES_MAX])(void);
+static int nr_inits, nr_exits;
+
+void kcompat_module_register(int (*init)(void), void (*exit)(void))
+{
+	if (nr_inits >= KCOMPAT_MODULES_MAX || nr_exits >= KCOMPAT_MODULES_MAX)
+		kcompat_unsupported("more modules");
+	if (init)
+		module_inits[nr_inits++] = init;
+	if (exit)
+		module_exits[nr_exits++] = exit;
+}
+
+#define KCOMPAT_PARAMS_MAX 32
+static struct kcompat_param {
+	const char *name;
+	void *var;
+	enum kcompat_param_type type;
+} params[KCOMPAT_PARAMS_MAX];
+static int nr_params;
+
+void kcompat_param_register(const char *name, void *var,
+			    enum kcompat_param_type type)
+{
+	if (nr_params >= KCOMPAT_PARAMS_MAX)
+		kcompat_unsupported("more module_params");
+	params[nr_params].name = name;
+	params[nr_params].var  = var;
+	params[nr_params].type = type;
+	nr_params++;
+}
+
+void kcompat_unsupported(const char *what)
+{
+	fprintf(stderr, "ERR: %s not supported in userspace build\n", what);
+	abort();
+}
+
+static int param_set(struct kcompat_param *p, const char *val)
+{
+	char *end;
+
+	errno = 0;
+	switch (p->type) {
+	case KCOMPAT_PARAM_INT:
+		*(int *)p->var = strtol(val, &end, 0);
+		break;
+	case KCOMPAT_PARAM_UINT:
+		*(unsigned int *)p->var = strtoul(val, &end, 0);
+		break;
+	case KCOMPAT_PARAM_ULONG:
+		*(unsigned long *)p->var = strtoul(val, &end, 0);
+		break;
+	case KCOMPAT_PARAM_BOOL:
+		end = (char *)val + strlen(val);
+		*(bool *)p->var = !strcmp(val, "1") || !strcmp(val, "y") ||
+				  !strcmp(val, "Y");
+		break;
+	case KCOMPAT_PARAM_CHARP:
+		*(char **)p->var = (char *)val;
+		return 0;
+	}
+	return (errno || *end) ? -EINVAL : 0;
+}
+
+static void usage(const char *prog)
+{
+	int i;
+
+	printf("Usage: %s [param=value ...]\n"
+	       " Same parameters as the kernel module:\n", prog);
+	for (i = 0; i < nr_params; i++)
+		printf("  %s\n", params[i].name);
+}
+
+/* Weak, as time_bench_user.c sets up the clock for time_bench users */
+void __attribute__((weak)) kcompat_bench_init(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+	int i, j, err;
+
+	/* Keep pr_info (stdout) and pr_err (stderr) ordered when piped */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	nr_cpu_ids = sysconf(_SC_NPROCESSORS_CONF);
+	if (nr_cpu_ids > NR_CPUS)
+		nr_cpu_ids = NR_CPUS;
+
+	for (i = 1; i < argc; i++) {
+		char *eq = strchr(argv[i], '=');
+
+		if (!eq) {
+			usage(argv[0]);
+			return 2;
+		}
+		*eq = '\0';
+		for (j = 0; j < nr_params; j++) {
+			if (!strcmp(argv[i], params[j].name))
+				break;
+		}
+		if (j == nr_params || param_set(&params[j], eq + 1)) {
+			fprintf(stderr, "ERR: invalid param %s=%s\n",
+				argv[i], eq + 1);
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	kcompat_bench_init();
+	for (i = 0; i < nr_inits; i++) {
+		err = module_inits[i]();
+		if (err) {
+			fprintf(stderr, "module_init failed: %s\n",
+				strerror(-err));
+			return 1;
+		}
+	}
+	for (i = nr_exits - 1; i >= 0; i--)
+		module_exits[i]();
+	return 0;
+}
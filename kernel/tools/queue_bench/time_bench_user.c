@@ -0,0 +1,640 @@
+/*
+ * Userspace implementation of the time_bench API, see lib/time_bench.c
+ *
+ * Output format follows lib/time_bench.c, thus the same scripts can
+ * parse results from both.  Differences:
+ *  - time_bench_run_concurrent() uses pthreads pinned to each CPU via
+ *    pthread_setaffinity_np(), released via a spin barrier
+ *  - "exclusive" (preempt+irq disable) is not possible, pin the bench
+ *    to isolated CPUs instead (isolcpus= or taskset/cset)
+ *  - PMU, histogram, noise and APERF/MPERF frequency recording are not
+ *    provided (MSRs need root via /dev/cpu/N/msr), use
+ *    "perf stat" or "perf record" on the binary
+ *  - topology is read from /sys/devices/system/cpu/, NUMA is ignored
+ */
+#include <kcompat.h>
+#include <linux/time_bench.h>
+
+static int verbose = 1;
+module_param(verbose, int, 0);
+MODULE_PARM_DESC(verbose, "Print per CPU start/finish messages");
+
+static int warmup;
+module_param(warmup, int, 0);
+MODULE_PARM_DESC(warmup, "Discarded warmup runs of each time_bench_loop()");
+
+static int repeat = 1;
+module_param(repeat, int, 0);
+MODULE_PARM_DESC(repeat, "Repetitions of each time_bench_loop(), reports min/median/stddev");
+
+int time_bench_clock = TIME_BENCH_CLOCK_DEFAULT;
+module_param_named(clock, time_bench_clock, int, 0);
+MODULE_PARM_DESC(clock, "Cycle counter backend: 0=native(tsc/cntvct) 1=get_cycles 2=ktime");
+
+static uint32_t clock_khz;
+
+static const char *clock_names[] = {
+	[TIME_BENCH_CLOCK_NATIVE]     = "native",
+	[TIME_BENCH_CLOCK_GET_CYCLES] = "get_cycles",
+	[TIME_BENCH_CLOCK_KTIME]      = "ktime",
+};
+
+const char *time_bench_clock_name(void)
+{
+	return clock_names[time_bench_clock];
+}
+
+uint32_t time_bench_clock_khz(void)
+{
+	return clock_khz;
+}
+
+/* Measure counter frequency against ktime over approx 10 ms */
+static void time_bench_clock_calibrate(void)
+{
+	uint64_t t_start, t_stop, c_start, c_stop;
+
+	if (time_bench_clock == TIME_BENCH_CLOCK_KTIME) {
+		clock_khz = 1000000; /* 1 GHz, counter is ns */
+		return;
+	}
+	t_start = ktime_get_ns();
+	c_start = tsc_start_clock();
+	while (ktime_get_ns() - t_start < 10 * 1000 * 1000)
+		cpu_relax();
+	c_stop  = tsc_stop_clock();
+	t_stop  = ktime_get_ns();
+
+	clock_khz = div64_u64((c_stop - c_start) * 1000000, t_stop - t_start);
+}
+
+/* Called by main() in kcompat.c, after params got parsed */
+void kcompat_bench_init(void)
+{
+	if (time_bench_clock < TIME_BENCH_CLOCK_NATIVE ||
+	    time_bench_clock > TIME_BENCH_CLOCK_KTIME) {
+		pr_warn("Invalid clock=%d, fallback to ktime\n",
+			time_bench_clock);
+		time_bench_clock = TIME_BENCH_CLOCK_KTIME;
+	}
+	time_bench_clock_calibrate();
+	pr_info("time_bench: clock:%s %u kHz CPUs:%u\n",
+		time_bench_clock_name(), clock_khz, nr_cpu_ids);
+}
+
+/* Not provided in userspace, see file header */
+bool time_bench_PMU_config(bool enable)
+{
+	return false;
+}
+void time_bench_pmu_set_events(uint32_t mask) {}
+bool time_bench_pmu_setup(struct time_bench_record *rec) { return false; }
+void time_bench_pmu_teardown(struct time_bench_record *rec) {}
+void time_bench_pmu_read(struct time_bench_record *rec, uint64_t *vals) {}
+void time_bench_noise_start(struct time_bench_record *rec) {}
+void time_bench_noise_stop(struct time_bench_record *rec) {}
+bool time_bench_noise_detected(struct time_bench_record *rec)
+{
+	return false;
+}
+void time_bench_freq_start(struct time_bench_record *rec) {}
+void time_bench_freq_stop(struct time_bench_record *rec) {}
+
+static uint64_t time_bench_div(uint64_t dividend, uint64_t divisor,
+			       uint64_t *decimal)
+{
+	if (!divisor) {
+		*decimal = 0;
+		return 0;
+	}
+	*decimal = (dividend % divisor) * 1000 / divisor;
+	return dividend / divisor;
+}
+
+static void time_bench_throughput_print(const char *prefix, const char *txt,
+					uint64_t ops_per_sec,
+					uint64_t bytes_per_sec)
+{
+	uint64_t mops, mops_dec, gbs, gbs_dec;
+
+	mops = time_bench_div(ops_per_sec, 1000000, &mops_dec);
+	if (!bytes_per_sec) {
+		pr_info("%sType:%s throughput: %llu.%03llu Mops/sec\n",
+			prefix, txt, (u64)mops, (u64)mops_dec);
+		return;
+	}
+	gbs = time_bench_div(bytes_per_sec, 1000000000, &gbs_dec);
+	pr_info("%sType:%s throughput: %llu.%03llu Mops/sec %llu.%03llu GB/sec\n",
+		prefix, txt, (u64)mops, (u64)mops_dec, (u64)gbs, (u64)gbs_dec);
+}
+
+bool time_bench_calc_stats(struct time_bench_record *rec)
+{
+	uint64_t invoked_cnt = 0;
+	uint64_t unused;
+
+	if (rec->flags & TIME_BENCH_LOOP) {
+		if (rec->invoked_cnt < 1000) {
+			pr_err("ERR: need more(>1000) loops(%llu) for timing\n",
+			       (u64)rec->invoked_cnt);
+			return false;
+		}
+		invoked_cnt = rec->invoked_cnt;
+	}
+
+	if (rec->flags & TIME_BENCH_TSC) {
+		rec->tsc_interval = rec->tsc_stop - rec->tsc_start;
+		if (rec->tsc_interval == 0) {
+			pr_err("ABORT: timing took ZERO TSC time\n");
+			return false;
+		}
+		if (rec->flags & TIME_BENCH_LOOP)
+			rec->tsc_cycles = time_bench_div(rec->tsc_interval,
+							 invoked_cnt, &unused);
+		else
+			rec->tsc_cycles = rec->tsc_interval;
+	}
+
+	if (rec->flags & TIME_BENCH_WALLCLOCK) {
+		rec->time_start = rec->ts_start.tv_nsec +
+			(NSEC_PER_SEC * rec->ts_start.tv_sec);
+		rec->time_stop  = rec->ts_stop.tv_nsec +
+			(NSEC_PER_SEC * rec->ts_stop.tv_sec);
+		rec->time_interval = rec->time_stop - rec->time_start;
+		if (rec->time_interval == 0) {
+			pr_err("ABORT: timing took ZERO wallclock time\n");
+			return false;
+		}
+		rec->time_sec = div_u64_rem(rec->time_interval, NSEC_PER_SEC,
+					    &rec->time_sec_remainder);
+		if (rec->flags & TIME_BENCH_LOOP) {
+			rec->ns_per_call_quotient =
+				time_bench_div(rec->time_interval, invoked_cnt,
+					       &rec->ns_per_call_decimal);
+			rec->ops_per_sec = (unsigned __int128)invoked_cnt *
+				NSEC_PER_SEC / rec->time_interval;
+			if (rec->flags & TIME_BENCH_STEP_BYTES)
+				rec->bytes_per_sec =
+					rec->ops_per_sec * rec->step;
+		}
+	}
+	return true;
+}
+
+static bool time_bench_loop_once(struct time_bench_record *rec,
+				 uint64_t loops, int step, void *data,
+				 int (*func)(struct time_bench_record *rec,
+					     void *data))
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->version_abi = 1;
+	rec->loops       = loops;
+	rec->step        = step;
+	rec->flags       = (TIME_BENCH_LOOP|TIME_BENCH_TSC|TIME_BENCH_WALLCLOCK);
+
+	if (!func(rec, data)) {
+		pr_err("ABORT: function being timed failed\n");
+		return false;
+	}
+	if (rec->invoked_cnt < loops)
+		pr_warn("WARNING: Invoke count(%llu) smaller than loops(%llu)\n",
+			(u64)rec->invoked_cnt, (u64)loops);
+	return time_bench_calc_stats(rec);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void time_bench_repeat_stats(const char *txt, u64 *ps, int n)
+{
+	u64 sum = 0, mean, var = 0, stddev = 0, median;
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum += ps[i];
+	mean = sum / n;
+	for (i = 0; i < n; i++) {
+		int64_t d = ps[i] - mean;
+
+		var += d * d;
+	}
+	while ((stddev + 1) * (stddev + 1) <= var / n) /* int sqrt */
+		stddev++;
+
+	qsort(ps, n, sizeof(*ps), cmp_u64);
+	median = ps[n / 2];
+
+	pr_info("Type:%s repeat:%d ns per elem min:%llu.%03llu"
+		" median:%llu.%03llu stddev:%llu.%03llu\n",
+		txt, n, ps[0] / 1000, ps[0] % 1000,
+		median / 1000, median % 1000, stddev / 1000, stddev % 1000);
+}
+
+bool time_bench_loop_repeat(uint64_t loops, int step, char *txt, void *data,
+			    int (*func)(struct time_bench_record *record,
+					void *data),
+			    int warmup, int repeat)
+{
+	struct time_bench_record rec;
+	u64 *ps = NULL;
+	int i;
+
+	for (i = 0; i < warmup; i++) {
+		if (!time_bench_loop_once(&rec, loops, step, data, func))
+			return false;
+	}
+	if (repeat < 1)
+		repeat = 1;
+	if (repeat > 1) {
+		ps = calloc(repeat, sizeof(*ps));
+		if (!ps)
+			return false;
+	}
+	for (i = 0; i < repeat; i++) {
+		if (!time_bench_loop_once(&rec, loops, step, data, func)) {
+			free(ps);
+			return false;
+		}
+		if (ps)
+			ps[i] = rec.ns_per_call_quotient * 1000 +
+				rec.ns_per_call_decimal;
+	}
+
+	pr_info("Type:%s Per elem: %llu cycles(tsc) %llu.%03llu ns (step:%d)"
+		" - (measurement period time:%llu.%09u sec time_interval:%llu)"
+		" - (invoke count:%llu tsc_interval:%llu)\n",
+		txt, (u64)rec.tsc_cycles,
+		(u64)rec.ns_per_call_quotient, (u64)rec.ns_per_call_decimal,
+		rec.step, (u64)rec.time_sec, rec.time_sec_remainder,
+		(u64)rec.time_interval,
+		(u64)rec.invoked_cnt, (u64)rec.tsc_interval);
+	time_bench_throughput_print("", txt, rec.ops_per_sec, rec.bytes_per_sec);
+
+	if (ps) {
+		time_bench_repeat_stats(txt, ps, repeat);
+		free(ps);
+	}
+	return true;
+}
+
+bool time_bench_loop(uint64_t loops, int step, char *txt, void *data,
+		     int (*func)(struct time_bench_record *record, void *data))
+{
+	return time_bench_loop_repeat(loops, step, txt, data, func,
+				      warmup, repeat);
+}
+
+/* Registry is a debugfs feature, benches run straight from init */
+int __time_bench_register(struct time_bench_entry *benches, int nr,
+			  struct module *owner)
+{
+	return 0;
+}
+void time_bench_unregister(struct time_bench_entry *benches, int nr) {}
+
+/** Concurrent run, one pinned pthread per CPU in mask **/
+
+/* Always spin-barrier release, as pthreads have no completion, see
+ * time_bench_spin_barrier() in lib/time_bench.c
+ */
+static void time_bench_spin_barrier(struct time_bench_sync *sync)
+{
+	unsigned int gen = READ_ONCE(sync->start_gen);
+
+	if (atomic_inc_return(&sync->nr_arrived) == sync->nr_cpus) {
+		smp_store_release(&sync->start_gen, gen + 1);
+		return;
+	}
+	while (smp_load_acquire(&sync->start_gen) == gen)
+		cpu_relax();
+}
+
+static void *invoke_test_on_cpu_func(void *private)
+{
+	struct time_bench_cpu *cpu = private;
+	struct time_bench_sync *sync = cpu->sync;
+
+	atomic_inc(&sync->nr_tests_running);
+	time_bench_spin_barrier(sync);
+
+	if (!cpu->bench_func(&cpu->rec, cpu->data)) {
+		pr_err("ERROR: function being timed failed on CPU:%d(%d)\n",
+		       cpu->rec.cpu, smp_processor_id());
+	} else {
+		if (verbose > 1)
+			pr_info("SUCCESS: ran on CPU:%d(%d)\n",
+				cpu->rec.cpu, smp_processor_id());
+	}
+	cpu->did_bench_run = true;
+	atomic_dec(&sync->nr_tests_running);
+	return NULL;
+}
+
+void time_bench_run_concurrent(
+		uint64_t loops, int step, void *data,
+		const struct cpumask *mask, /* Support masking outsome CPUs*/
+		struct time_bench_sync *sync,
+		struct time_bench_cpu *cpu_tasks,
+		int (*func)(struct time_bench_record *record, void *data)
+	)
+{
+	pthread_t *threads;
+	int cpu, running = 0;
+
+	threads = calloc(nr_cpu_ids, sizeof(*threads));
+	if (!threads) {
+		pr_err("%s(): no memory\n", __func__);
+		return;
+	}
+	atomic_set(&sync->nr_tests_running, 0);
+	sync->spin_release = true;
+	sync->nr_cpus      = cpumask_weight(mask);
+	sync->start_gen    = 0;
+	atomic_set(&sync->nr_arrived, 0);
+
+	for_each_cpu(cpu, mask) {
+		struct time_bench_cpu *c = &cpu_tasks[cpu];
+		pthread_attr_t attr;
+		cpu_set_t set;
+		int err;
+
+		running++;
+		c->sync = sync;
+		c->data = data;
+		memset(&c->rec, 0, sizeof(struct time_bench_record));
+		c->rec.version_abi = 1;
+		c->rec.loops       = loops;
+		c->rec.step        = step;
+		c->rec.flags       = (TIME_BENCH_LOOP|TIME_BENCH_TSC|
+				      TIME_BENCH_WALLCLOCK);
+		c->rec.cpu = cpu;
+		c->rec.cpu_idx = running - 1;
+		c->bench_func = func;
+		c->did_bench_run = false;
+
+		/* Pin before start, thus the thread never runs elsewhere */
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		err = pthread_create(&threads[cpu], &attr,
+				     invoke_test_on_cpu_func, c);
+		pthread_attr_destroy(&attr);
+		if (err) {
+			pr_err("%s(): Failed to start thread on CPU:%d (%s)\n",
+			       __func__, cpu, strerror(err));
+			/* Threads already started wait in the barrier */
+			exit(EXIT_FAILURE);
+		}
+	}
+	for_each_cpu(cpu, mask)
+		pthread_join(threads[cpu], NULL);
+	free(threads);
+}
+
+void time_bench_print_stats_cpumask(const char *desc,
+				    struct time_bench_cpu *cpu_tasks,
+				    const struct cpumask *mask)
+{
+	uint64_t average = 0;
+	int cpu;
+	int step = 0;
+	struct sum {
+		uint64_t tsc_cycles;
+		uint64_t invoked_cnt;
+		uint64_t ops_per_sec;
+		uint64_t bytes_per_sec;
+		int records;
+	} sum = {0};
+	uint64_t first_start = U64_MAX, last_start = 0;
+	uint64_t first_stop  = U64_MAX, last_stop  = 0;
+
+	for_each_cpu(cpu, mask) {
+		struct time_bench_record *rec = &cpu_tasks[cpu].rec;
+
+		time_bench_calc_stats(rec);
+
+		pr_info("Type:%s CPU(%d) %llu cycles(tsc) %llu.%03llu ns"
+		" (step:%d)"
+		" - (measurement period time:%llu.%09u sec time_interval:%llu)"
+		" - (invoke count:%llu tsc_interval:%llu)\n",
+		desc, cpu, (u64)rec->tsc_cycles,
+		(u64)rec->ns_per_call_quotient, (u64)rec->ns_per_call_decimal,
+		rec->step, (u64)rec->time_sec, rec->time_sec_remainder,
+		(u64)rec->time_interval,
+		(u64)rec->invoked_cnt, (u64)rec->tsc_interval);
+
+		sum.records++;
+		sum.tsc_cycles += rec->tsc_cycles;
+		sum.invoked_cnt += rec->invoked_cnt;
+		sum.ops_per_sec += rec->ops_per_sec;
+		sum.bytes_per_sec += rec->bytes_per_sec;
+		step = rec->step;
+
+		first_start = min(first_start, rec->time_start);
+		last_start  = max(last_start,  rec->time_start);
+		first_stop  = min(first_stop,  rec->time_stop);
+		last_stop   = max(last_stop,   rec->time_stop);
+	}
+
+	if (sum.records)
+		average = sum.tsc_cycles / sum.records;
+	pr_info("Sum Type:%s Average: %llu cycles(tsc) CPUs:%d step:%d\n",
+		desc, (u64)average, sum.records, step);
+	time_bench_throughput_print("Sum ", desc, sum.ops_per_sec,
+				    sum.bytes_per_sec);
+	if (sum.records > 1)
+		pr_info("Sum Type:%s skew start:%llu ns stop:%llu ns"
+			" (all CPUs overlap:%lld ns)\n",
+			desc, (u64)(last_start - first_start),
+			(u64)(last_stop - first_stop),
+			(long long)(first_stop - last_start));
+}
+
+/** CPU topology, from sysfs **/
+
+/* Parse cpulist format, e.g. "0,2,8-11", ignoring CPUs beyond nr_cpu_ids */
+static int cpulist_parse(const char *buf, struct cpumask *mask)
+{
+	const char *p = buf;
+	char *end;
+
+	cpumask_clear(mask);
+	while (*p && *p != '\n') {
+		unsigned long a, b;
+
+		a = strtoul(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+		b = a;
+		p = end;
+		if (*p == '-') {
+			b = strtoul(++p, &end, 10);
+			if (end == p || b < a)
+				return -EINVAL;
+			p = end;
+		}
+		for (; a <= b && a < nr_cpu_ids; a++)
+			cpumask_set_cpu(a, mask);
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static void cpumask_print(char *buf, size_t len, const struct cpumask *mask)
+{
+	size_t n = 0;
+	int cpu, last;
+
+	buf[0] = '\0';
+	for_each_cpu(cpu, mask) {
+		last = cpu;
+		while (last + 1 < (int)nr_cpu_ids &&
+		       cpumask_test_cpu(last + 1, mask))
+			last++;
+		if (n >= len)
+			break;
+		if (last > cpu)
+			n += snprintf(buf + n, len - n, "%s%d-%d",
+				      n ? "," : "", cpu, last);
+		else
+			n += snprintf(buf + n, len - n, "%s%d",
+				      n ? "," : "", cpu);
+		cpu = last;
+	}
+}
+
+/* Online CPUs we are allowed to run on (honours taskset/cset) */
+static struct cpumask online_mask;
+
+static void online_mask_init(void)
+{
+	cpu_set_t set;
+	unsigned int cpu;
+
+	cpumask_clear(&online_mask);
+	if (sched_getaffinity(0, sizeof(set), &set)) {
+		for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+			cpumask_set_cpu(cpu, &online_mask);
+		return;
+	}
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		if (CPU_ISSET(cpu, &set))
+			cpumask_set_cpu(cpu, &online_mask);
+	}
+}
+
+static void sibling_mask(int cpu, struct cpumask *mask)
+{
+	char path[128], buf[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+		 cpu);
+	f = fopen(path, "r");
+	if (!f || !fgets(buf, sizeof(buf), f) || cpulist_parse(buf, mask)) {
+		cpumask_clear(mask);
+		cpumask_set_cpu(cpu, mask);
+	}
+	if (f)
+		fclose(f);
+}
+
+void time_bench_print_topology(const char *desc, const struct cpumask *mask)
+{
+	struct cpumask sib;
+	char buf[256];
+	int cpu;
+
+	cpumask_print(buf, sizeof(buf), mask);
+	pr_info("Topology:%s CPUs:%s (nodes online:%d)\n",
+		desc, buf, num_online_nodes());
+	if (verbose < 2)
+		return;
+	for_each_cpu(cpu, mask) {
+		sibling_mask(cpu, &sib);
+		cpumask_print(buf, sizeof(buf), &sib);
+		pr_info(" CPU(%d) SMT-siblings:%s\n", cpu, buf);
+	}
+}
+
+int time_bench_cpumask_select(struct cpumask *mask, const char *topology,
+			      int nr_cpus)
+{
+	struct cpumask sib;
+	int cpu, sibling, cnt = 0;
+
+	online_mask_init();
+	if (nr_cpus <= 0)
+		nr_cpus = cpumask_weight(&online_mask);
+
+	cpumask_clear(mask);
+
+	if (!topology || !*topology || !strcmp(topology, "first") ||
+	    !strcmp(topology, "node")) {
+		/* Single node assumed, thus "node" equals "first" */
+		if (!topology || !*topology)
+			topology = "first";
+		for_each_cpu(cpu, &online_mask) {
+			if (cnt++ >= nr_cpus)
+				break;
+			cpumask_set_cpu(cpu, mask);
+		}
+	} else if (!strcmp(topology, "core")) {
+		for_each_cpu(cpu, &online_mask) {
+			sibling_mask(cpu, &sib);
+			if (cpumask_first(&sib) != cpu)
+				continue;
+			if (cnt++ >= nr_cpus)
+				break;
+			cpumask_set_cpu(cpu, mask);
+		}
+	} else if (!strcmp(topology, "smt")) {
+		for_each_cpu(cpu, &online_mask) {
+			sibling_mask(cpu, &sib);
+			if (cpumask_first(&sib) != cpu)
+				continue;
+			for_each_cpu(sibling, &sib) {
+				if (cnt >= nr_cpus)
+					break;
+				if (!cpumask_test_cpu(sibling, &online_mask))
+					continue;
+				cpumask_set_cpu(sibling, mask);
+				cnt++;
+			}
+			if (cnt >= nr_cpus)
+				break;
+		}
+		sibling_mask(cpumask_first(mask), &sib);
+		if (cnt > 1 && cpumask_weight(&sib) < 2)
+			pr_warn("Topology:smt but CPUs have no SMT siblings\n");
+	} else if (!strcmp(topology, "cross")) {
+		pr_err("Topology:cross (NUMA) not supported in userspace\n");
+		return -EOPNOTSUPP;
+	} else {
+		int i;
+
+		if (cpulist_parse(topology, mask)) {
+			pr_err("Topology: invalid cpulist \"%s\"\n", topology);
+			return -EINVAL;
+		}
+		for (i = 0; i < (int)ARRAY_SIZE(mask->bits); i++)
+			mask->bits[i] &= online_mask.bits[i];
+	}
+
+	if (!cpumask_weight(mask)) {
+		pr_err("Topology:%s no CPUs selected\n", topology);
+		return -ENODEV;
+	}
+	time_bench_print_topology(topology, mask);
+	return cpumask_weight(mask);
+}
@@ -0,0 +1,91 @@
+#!/bin/bash
+#
+# The purpose of this script is to measure the cost of the error path
+# in kmem_cache_alloc_bulk(), at a configurable failure rate.
+#
+# The fail01/fail02 scripts only verify correctness.  This script sets
+# up the kernels fault-injection framework, and loads the time_bench
+# module slab_bulk_test09_fault_bench, which reports throughput and
+# latency histograms of successful versus failed bulk allocs.
+#
+#  https://www.kernel.org/doc/Documentation/fault-injection/fault-injection.txt
+#
+# Usage: bench01_kmem_cache_alloc_bulk.sh [probability] [interval] [type]
+#   probability: percent of eligible allocs that fail (default 1)
+#   interval:    only every Nth eligible alloc can fail (default 1),
+#                allows failure rates below 1%
+#   type:        fail_page_alloc (default) or failslab
+#
+# With fail_page_alloc the bulk fails half-way, when SLUB needs a new
+# slab page, exercising the partial-bulk rollback.  With failslab the
+# whole bulk call is failed up front.
+#
+# Unlike fail01, failcmd.sh is not used.  "task-filter" is enabled and
+# the module itself marks its task make-it-fail only around the
+# measured loop, thus min-order=0 cannot break modprobe or module setup.
+
+MODULE=slab_bulk_test09_fault_bench
+VERBOSE=1
+
+PROBABILITY=${1:-1}
+INTERVAL=${2:-1}
+FAILTYPE=${3:-fail_page_alloc}
+
+if [[ $UID != 0 ]]; then
+	echo must be run as root >&2
+	exit 1
+fi
+
+$(modinfo $MODULE > /dev/null 2>&1)
+if [[ $? != 0 ]]; then
+    echo "ERR - Need kernel module $MODULE for this test"
+    exit 2
+fi
+
+DEBUGFS=`mount -t debugfs | head -1 | awk '{ print $3}'`
+FAULTATTR=$DEBUGFS/$FAILTYPE
+if [[ ! -d $FAULTATTR ]]; then
+    echo "ERR - $FAILTYPE is not available (need CONFIG_FAULT_INJECTION)"
+    exit 3
+fi
+
+fault_attr_default()
+{
+	echo 0 > $FAULTATTR/probability
+	echo 1 > $FAULTATTR/interval
+	echo 1 > $FAULTATTR/times
+	echo N > $FAULTATTR/task-filter
+	if [[ $FAILTYPE == fail_page_alloc ]]; then
+	    echo 1 > $FAULTATTR/min-order
+	fi
+}
+trap "fault_attr_default" SIGINT SIGTERM EXIT
+
+# Module allocates with GFP_ATOMIC, thus ignore-gfp-wait can stay Y
+echo Y > $FAULTATTR/task-filter
+echo 0 > $FAULTATTR/space
+echo 0 > $FAULTATTR/verbose
+echo -1 > $FAULTATTR/times
+echo $INTERVAL > $FAULTATTR/interval
+echo $PROBABILITY > $FAULTATTR/probability
+if [[ $FAILTYPE == fail_page_alloc ]]; then
+    # SLUB retries with order 0 before it gives up
+    echo 0 > $FAULTATTR/min-order
+else
+    echo N > $FAULTATTR/cache-filter
+fi
+
+if [[ $VERBOSE > 0 ]]; then
+    echo "Fault-inject $FAILTYPE probability:$PROBABILITY% interval:$INTERVAL"
+fi
+
+# Remaining args are passed as module params, e.g. bulksz=32 no_bulk=1
+shift $(( $# < 3 ? $# : 3 ))
+modprobe $MODULE verbose=1 inject=1 "$@"
+
+# Cleanup: remove module again
+rmmod $MODULE
+
+if [[ $VERBOSE > 0 ]]; then
+    dmesg | egrep -e "$MODULE" | tail -n20
+fi